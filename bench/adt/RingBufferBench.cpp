@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "monomux/adt/RingBuffer.hpp"
+
+using namespace monomux;
+
+/// Sizes of the chunks moved through the buffer, from keystrokes to bulk
+/// output.
+static void chunkSizes(benchmark::internal::Benchmark* B)
+{
+  B->RangeMultiplier(8)->Range(1, 1 << 18);
+}
+
+static void ringBufferPutTake(benchmark::State& State)
+{
+  const auto Size = static_cast<std::size_t>(State.range(0));
+  const std::vector<char> Data(Size, 'x');
+  RingBuffer<char> Buf(4096);
+  for (auto _ : State)
+  {
+    Buf.putBack(Data.data(), Data.size());
+    std::vector<char> Out = Buf.takeFront(Size);
+    benchmark::DoNotOptimize(Out.data());
+  }
+  State.SetBytesProcessed(static_cast<std::int64_t>(State.iterations() * Size));
+}
+BENCHMARK(ringBufferPutTake)->Apply(chunkSizes);
+
+static void ringBufferPutPeekDrop(benchmark::State& State)
+{
+  const auto Size = static_cast<std::size_t>(State.range(0));
+  const std::vector<char> Data(Size, 'x');
+  RingBuffer<char> Buf(4096);
+  for (auto _ : State)
+  {
+    Buf.putBack(Data.data(), Data.size());
+    auto Segments = Buf.peekFrontSegments(Size);
+    benchmark::DoNotOptimize(Segments);
+    Buf.dropFront(Size);
+  }
+  State.SetBytesProcessed(static_cast<std::int64_t>(State.iterations() * Size));
+}
+BENCHMARK(ringBufferPutPeekDrop)->Apply(chunkSizes);
+
+static void ringBufferReserveCommit(benchmark::State& State)
+{
+  const auto Size = static_cast<std::size_t>(State.range(0));
+  RingBuffer<char> Buf(4096);
+  for (auto _ : State)
+  {
+    auto Segments = Buf.reserveBackSegments(Size);
+    benchmark::DoNotOptimize(Segments);
+    Buf.commitBack(Size);
+    Buf.dropFront(Size);
+  }
+  State.SetBytesProcessed(static_cast<std::int64_t>(State.iterations() * Size));
+}
+BENCHMARK(ringBufferReserveCommit)->Apply(chunkSizes);
+
+/// Keeps \p range(0) bytes in the buffer while the front of it is peeked,
+/// which copies if the contents wrap around.
+static void ringBufferPeekFront(benchmark::State& State)
+{
+  const auto Size = static_cast<std::size_t>(State.range(0));
+  const std::vector<char> Data(Size, 'x');
+  RingBuffer<char> Buf(Size);
+  Buf.putBack(Data.data(), Data.size());
+  for (auto _ : State)
+  {
+    std::vector<char> Out = Buf.peekFront(Size);
+    benchmark::DoNotOptimize(Out.data());
+  }
+  State.SetBytesProcessed(static_cast<std::int64_t>(State.iterations() * Size));
+}
+BENCHMARK(ringBufferPeekFront)->Apply(chunkSizes);
@@ -0,0 +1,160 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "monomux/adt/SmallIndexMap.hpp"
+
+using namespace monomux;
+
+/// The size of the small representation, as used by the server for its
+/// lookup of file descriptors.
+static constexpr std::size_t SmallSize = 256;
+
+/// Fills the map with \p range(0) keys, then accesses every key. Below
+/// \p SmallSize keys, the map stays in the small representation.
+template <typename T> static void smallIndexMapFillGet(benchmark::State& State)
+{
+  const auto Count = static_cast<std::size_t>(State.range(0));
+  static int Value = 0;
+  for (auto _ : State)
+  {
+    SmallIndexMap<T, SmallSize> M;
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      if constexpr (std::is_pointer_v<T>)
+        M.set(I, &Value);
+      else
+        M.set(I, "x");
+    }
+    for (std::size_t I = 0; I < Count; ++I)
+      benchmark::DoNotOptimize(M.tryGet(I));
+  }
+  State.SetItemsProcessed(
+    static_cast<std::int64_t>(State.iterations() * Count));
+}
+BENCHMARK_TEMPLATE(smallIndexMapFillGet, int*)
+  ->Arg(16)
+  ->Arg(SmallSize - 1)
+  ->Arg(SmallSize * 4);
+BENCHMARK_TEMPLATE(smallIndexMapFillGet, std::string)
+  ->Arg(16)
+  ->Arg(SmallSize - 1)
+  ->Arg(SmallSize * 4);
+
+/// Repeatedly crosses the boundary between the representations by mapping a
+/// key beyond the small range, and erasing it again.
+static void smallIndexMapTransition(benchmark::State& State)
+{
+  static int Value = 0;
+  SmallIndexMap<int*, SmallSize> M;
+  for (std::size_t I = 0; I < SmallSize / 4; ++I)
+    M.set(I, &Value);
+  for (auto _ : State)
+  {
+    M.set(SmallSize * 2, &Value);
+    benchmark::DoNotOptimize(M.isLarge());
+    M.erase(SmallSize * 2);
+    benchmark::DoNotOptimize(M.isSmall());
+  }
+}
+BENCHMARK(smallIndexMapTransition);
+
+/// The number of pages of \p SmallSize keys the paged representation indexes.
+static constexpr std::size_t PageCount = 4096;
+
+/// Maps \p range(0) keys scattered in the range of a few thousand file
+/// descriptors, then looks up every key, in either the large or the paged
+/// representation.
+template <std::size_t Pages>
+static void smallIndexMapBeyondSmall(benchmark::State& State)
+{
+  const auto Count = static_cast<std::size_t>(State.range(0));
+  static int Value = 0;
+  SmallIndexMap<int*,
+                SmallSize,
+                /* StoreInPlace =*/true,
+                /* IntrusiveDefaultSentinel =*/true,
+                std::size_t,
+                Pages>
+    M;
+  for (std::size_t I = 0; I < Count; ++I)
+    M.set(I * 3, &Value);
+  for (auto _ : State)
+    for (std::size_t I = 0; I < Count * 3; I += 3)
+      benchmark::DoNotOptimize(M.tryGet(I));
+  State.SetItemsProcessed(
+    static_cast<std::int64_t>(State.iterations() * Count));
+}
+BENCHMARK_TEMPLATE(smallIndexMapBeyondSmall, 0)
+  ->Arg(SmallSize * 4)
+  ->Arg(SmallSize * 16);
+BENCHMARK_TEMPLATE(smallIndexMapBeyondSmall, PageCount)
+  ->Arg(SmallSize * 4)
+  ->Arg(SmallSize * 16);
+
+/// Repeatedly maps and erases a key beyond the small range, in either the
+/// large or the paged representation, while many other keys are mapped.
+template <std::size_t Pages>
+static void smallIndexMapChurnBeyondSmall(benchmark::State& State)
+{
+  static int Value = 0;
+  SmallIndexMap<int*,
+                SmallSize,
+                /* StoreInPlace =*/true,
+                /* IntrusiveDefaultSentinel =*/true,
+                std::size_t,
+                Pages>
+    M;
+  for (std::size_t I = 0; I < SmallSize * 8; ++I)
+    M.set(I, &Value);
+  for (auto _ : State)
+  {
+    M.set(SmallSize * 8, &Value);
+    benchmark::DoNotOptimize(M.tryGet(SmallSize * 8));
+    M.erase(SmallSize * 8);
+  }
+}
+BENCHMARK_TEMPLATE(smallIndexMapChurnBeyondSmall, 0);
+BENCHMARK_TEMPLATE(smallIndexMapChurnBeyondSmall, PageCount);
+
+/// Maps a single key and clears the map again, with or without tracking the
+/// occupied indices.
+template <bool TrackOccupancy>
+static void smallIndexMapClearSparse(benchmark::State& State)
+{
+  static int Value = 0;
+  SmallIndexMap<int*,
+                SmallSize,
+                /* StoreInPlace =*/true,
+                /* IntrusiveDefaultSentinel =*/true,
+                std::size_t,
+                /* PageCount =*/0,
+                TrackOccupancy>
+    M;
+  for (auto _ : State)
+  {
+    M.set(SmallSize / 2, &Value);
+    M.clear();
+    benchmark::DoNotOptimize(M.empty());
+  }
+}
+BENCHMARK_TEMPLATE(smallIndexMapClearSparse, false);
+BENCHMARK_TEMPLATE(smallIndexMapClearSparse, true);
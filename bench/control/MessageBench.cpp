@@ -0,0 +1,225 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "monomux/control/Message.hpp"
+
+using namespace monomux::message;
+
+/// \returns a representative instance of \p Msg. The messages that carry
+/// lists are filled with \p Count elements.
+template <typename Msg> static Msg makeMessage(std::size_t Count)
+{
+  (void)Count;
+  return Msg{};
+}
+
+static std::vector<SessionData> makeSessions(std::size_t Count)
+{
+  std::vector<SessionData> Sessions;
+  Sessions.reserve(Count);
+  for (std::size_t I = 0; I < Count; ++I)
+    Sessions.push_back(SessionData{"session-" + std::to_string(I),
+                                   static_cast<std::time_t>(1'600'000'000)});
+  return Sessions;
+}
+
+template <> request::MakeSession makeMessage(std::size_t Count)
+{
+  request::MakeSession Msg;
+  Msg.Name = "session";
+  Msg.SpawnOpts.Program = "/bin/bash";
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    Msg.SpawnOpts.Arguments.emplace_back("--arg-" + std::to_string(I));
+    Msg.SpawnOpts.SetEnvironment.emplace_back("VAR" + std::to_string(I),
+                                              "value");
+  }
+  Msg.ScrollbackSize = 1 << 20;
+  return Msg;
+}
+
+template <> request::Attach makeMessage(std::size_t /* Count */)
+{
+  return request::Attach{"session"};
+}
+
+template <> response::SessionList makeMessage(std::size_t Count)
+{
+  return response::SessionList{makeSessions(Count)};
+}
+
+template <> response::Subscribe makeMessage(std::size_t Count)
+{
+  return response::Subscribe{makeSessions(Count)};
+}
+
+template <> response::MakeSession makeMessage(std::size_t /* Count */)
+{
+  response::MakeSession Msg;
+  Msg.Success = true;
+  Msg.Name = "session";
+  return Msg;
+}
+
+template <> response::Attach makeMessage(std::size_t /* Count */)
+{
+  response::Attach Msg;
+  Msg.Success = true;
+  Msg.Session = SessionData{"session", 1'600'000'000};
+  return Msg;
+}
+
+template <> response::Statistics makeMessage(std::size_t Count)
+{
+  return response::Statistics{std::string(Count * 64, 'x')};
+}
+
+template <> response::Metrics makeMessage(std::size_t Count)
+{
+  response::Metrics Msg;
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    Metric& M = Msg.Samples.emplace_back();
+    M.Name = "monomux_session_output_bytes_total";
+    M.Labels.emplace_back("session", "session-" + std::to_string(I));
+    M.Value = I;
+  }
+  return Msg;
+}
+
+template <> response::Trace makeMessage(std::size_t Count)
+{
+  response::Trace Msg;
+  for (std::size_t I = 0; I < Count; ++I)
+    Msg.Records.push_back(monomux::trace::Record{
+      I, 7, monomux::trace::Event::ChannelRead, 0, 4096, I});
+  return Msg;
+}
+
+template <> notification::Connection makeMessage(std::size_t /* Count */)
+{
+  notification::Connection Msg;
+  Msg.Accepted = true;
+  return Msg;
+}
+
+template <> notification::SessionEvent makeMessage(std::size_t /* Count */)
+{
+  notification::SessionEvent Msg;
+  Msg.Session = SessionData{"session", 1'600'000'000};
+  Msg.AttachedClients = 2;
+  return Msg;
+}
+
+/// The arguments are the encoding and the number of list elements.
+static void encodings(benchmark::internal::Benchmark* B)
+{
+  B->ArgNames({"binary", "count"});
+  for (int E : {0, 1})
+    B->Args({E, 1});
+}
+
+static void encodingsAndLists(benchmark::internal::Benchmark* B)
+{
+  B->ArgNames({"binary", "count"});
+  for (int E : {0, 1})
+    for (int N : {1, 64, 4096})
+      B->Args({E, N});
+}
+
+static Encoding encodingArg(const benchmark::State& State)
+{
+  return State.range(0) ? Encoding::Binary : Encoding::Text;
+}
+
+template <typename Msg> static void encodeMessage(benchmark::State& State)
+{
+  const Msg M = makeMessage<Msg>(static_cast<std::size_t>(State.range(1)));
+  const Encoding E = encodingArg(State);
+  std::size_t Bytes = 0;
+  for (auto _ : State)
+  {
+    std::string Data = encode(M, E);
+    Bytes += Data.size();
+    benchmark::DoNotOptimize(Data.data());
+  }
+  State.SetBytesProcessed(static_cast<std::int64_t>(Bytes));
+}
+
+template <typename Msg> static void decodeMessage(benchmark::State& State)
+{
+  const std::string Data = encode(
+    makeMessage<Msg>(static_cast<std::size_t>(State.range(1))),
+    encodingArg(State));
+  if (!decode<Msg>(Data))
+  {
+    State.SkipWithError("The encoded message does not decode!");
+    return;
+  }
+  for (auto _ : State)
+  {
+    std::optional<Msg> M = decode<Msg>(Data);
+    benchmark::DoNotOptimize(M);
+  }
+  State.SetBytesProcessed(
+    static_cast<std::int64_t>(State.iterations() * Data.size()));
+}
+
+#define MESSAGE_BENCHMARK(TYPE, ARGS)                                          \
+  BENCHMARK_TEMPLATE(encodeMessage, TYPE)->Apply(ARGS);                        \
+  BENCHMARK_TEMPLATE(decodeMessage, TYPE)->Apply(ARGS);
+
+MESSAGE_BENCHMARK(request::ClientID, encodings)
+MESSAGE_BENCHMARK(request::DataSocket, encodings)
+MESSAGE_BENCHMARK(request::SessionList, encodings)
+MESSAGE_BENCHMARK(request::MakeSession, encodingsAndLists)
+MESSAGE_BENCHMARK(request::Attach, encodings)
+MESSAGE_BENCHMARK(request::Detach, encodings)
+MESSAGE_BENCHMARK(request::Signal, encodings)
+MESSAGE_BENCHMARK(request::Statistics, encodings)
+MESSAGE_BENCHMARK(request::Protocol, encodings)
+MESSAGE_BENCHMARK(request::Subscribe, encodings)
+MESSAGE_BENCHMARK(request::SharedOutput, encodings)
+MESSAGE_BENCHMARK(request::PtyHandOff, encodings)
+MESSAGE_BENCHMARK(request::Metrics, encodings)
+MESSAGE_BENCHMARK(request::Trace, encodings)
+
+MESSAGE_BENCHMARK(response::ClientID, encodings)
+MESSAGE_BENCHMARK(response::DataSocket, encodings)
+MESSAGE_BENCHMARK(response::SessionList, encodingsAndLists)
+MESSAGE_BENCHMARK(response::MakeSession, encodings)
+MESSAGE_BENCHMARK(response::Attach, encodings)
+MESSAGE_BENCHMARK(response::Detach, encodings)
+MESSAGE_BENCHMARK(response::Statistics, encodingsAndLists)
+MESSAGE_BENCHMARK(response::Protocol, encodings)
+MESSAGE_BENCHMARK(response::Subscribe, encodingsAndLists)
+MESSAGE_BENCHMARK(response::SharedOutput, encodings)
+MESSAGE_BENCHMARK(response::PtyHandOff, encodings)
+MESSAGE_BENCHMARK(response::Metrics, encodingsAndLists)
+MESSAGE_BENCHMARK(response::Trace, encodingsAndLists)
+
+MESSAGE_BENCHMARK(notification::Connection, encodings)
+MESSAGE_BENCHMARK(notification::Detached, encodings)
+MESSAGE_BENCHMARK(notification::Redraw, encodings)
+MESSAGE_BENCHMARK(notification::SessionEvent, encodings)
+
+#undef MESSAGE_BENCHMARK
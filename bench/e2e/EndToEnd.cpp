@@ -0,0 +1,1239 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/// \file An end-to-end harness that runs a \p Server in-process and measures
+/// the throughput and the keystroke latency as seen by headless clients.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "monomux/Log.hpp"
+#include "monomux/adt/POD.hpp"
+#include "monomux/client/Client.hpp"
+#include "monomux/client/ControlClient.hpp"
+#include "monomux/server/Recording.hpp"
+#include "monomux/server/Server.hpp"
+#include "monomux/system/Process.hpp"
+#include "monomux/system/fd.hpp"
+
+using namespace monomux;
+using namespace monomux::client;
+using namespace monomux::server;
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+struct Options
+{
+  std::vector<std::string> Scenarios;
+  std::size_t Megabytes = 256;
+  std::size_t Clients = 1;
+  std::size_t Keystrokes = 2000;
+  std::size_t IdleSessions = 64;
+  std::size_t FleetSessions = 1024;
+  std::size_t Churn = 64;
+  std::size_t Requests = 10000;
+  std::optional<std::size_t> Workers;
+  bool SpliceRelay = false;
+  bool UseIOUring = false;
+  /// The recordings the 'replay' scenario feeds to the server.
+  std::vector<std::string> Recordings;
+  /// How many times faster than recorded the recordings are replayed, or
+  /// \p 0 to replay them as fast as possible.
+  double Speed = 1.0;
+  /// The directory the server records the sessions of the scenarios in.
+  std::optional<std::string> RecordDirectory;
+};
+
+std::string temporarySocketPath()
+{
+  return "/tmp/monomux-e2e-" + std::to_string(::getpid()) + ".sock";
+}
+
+void configure(Server& S, const Options& Opts)
+{
+  // The signals were blocked by main(), and reach the loop through a
+  // signalfd(2).
+  S.setSignalEvents(true);
+  S.setExitIfNoMoreSessions(false);
+  S.setFlowControl(true);
+  S.setSpliceRelay(Opts.SpliceRelay);
+  S.setIOUring(Opts.UseIOUring);
+  if (Opts.Workers)
+    S.setWorkerCount(*Opts.Workers);
+  if (Opts.RecordDirectory)
+    S.setRecordDirectory(*Opts.RecordDirectory);
+}
+
+/// Creates the pipe the \p Server notifies through once it is accepting
+/// connections, which the socket only does once the loop is running.
+std::pair<fd, fd> readinessPipe()
+{
+  int Ready[2];
+  if (::pipe2(Ready, O_CLOEXEC) == -1)
+    throw std::system_error{errno, std::system_category(), "pipe2()"};
+  return {fd{Ready[0]}, fd{Ready[1]}};
+}
+
+void waitReady(const fd& ReadyRead)
+{
+  char Byte;
+  while (::read(ReadyRead.get(), &Byte, 1) == -1 && errno == EINTR)
+    ;
+}
+
+/// A \p Server listening on a temporary socket, running its loop on a
+/// background thread.
+class InProcessServer
+{
+public:
+  InProcessServer(const Options& Opts)
+    : SocketPath(temporarySocketPath()), S(Socket::create(SocketPath))
+  {
+    configure(S, Opts);
+    auto [ReadyRead, ReadyWrite] = readinessPipe();
+    S.setReadinessNotification(std::move(ReadyWrite));
+    Thread = std::thread{[this] {
+      S.loop();
+      S.shutdown();
+    }};
+    waitReady(ReadyRead);
+  }
+
+  ~InProcessServer()
+  {
+    // Only a signal wakes the loop reliably.
+    ::kill(::getpid(), SIGTERM);
+    Thread.join();
+  }
+
+  const std::string& socketPath() const noexcept { return SocketPath; }
+
+private:
+  std::string SocketPath;
+  Server S;
+  std::thread Thread;
+};
+
+/// A \p Server running in a child process, so the resources it uses can be
+/// told apart from those of the clients.
+class ForkedServer
+{
+public:
+  ForkedServer(const Options& Opts) : SocketPath(temporarySocketPath())
+  {
+    auto [ReadyRead, ReadyWrite] = readinessPipe();
+    PID = ::fork();
+    if (PID == -1)
+      throw std::system_error{errno, std::system_category(), "fork()"};
+    if (PID == 0)
+    {
+      int Code = EXIT_SUCCESS;
+      try
+      {
+        Server S{Socket::create(SocketPath)};
+        configure(S, Opts);
+        S.setReadinessNotification(std::move(ReadyWrite));
+        S.loop();
+        S.shutdown();
+      }
+      catch (const std::exception& E)
+      {
+        std::cerr << "Server failed: " << E.what() << std::endl;
+        Code = EXIT_FAILURE;
+      }
+      ::_exit(Code);
+    }
+
+    // If the server fails to start, the pipe is closed without notifying.
+    ReadyWrite = fd{};
+    waitReady(ReadyRead);
+  }
+
+  ~ForkedServer()
+  {
+    ::kill(PID, SIGTERM);
+    while (::waitpid(PID, nullptr, 0) == -1 && errno == EINTR)
+      ;
+  }
+
+  const std::string& socketPath() const noexcept { return SocketPath; }
+  ::pid_t pid() const noexcept { return PID; }
+
+private:
+  std::string SocketPath;
+  ::pid_t PID;
+};
+
+/// A headless \p Client attached to a session, which consumes the output of
+/// the session instead of a terminal.
+class Attachment
+{
+public:
+  /// The time it took to establish the connection and to attach.
+  struct Timings
+  {
+    /// Connecting and the handshake, until the client is usable.
+    Clock::duration Accept;
+    /// The attach request and its response.
+    Clock::duration Attach;
+  };
+
+  /// Connects to the server at \p SocketPath and attaches to \p Session.
+  static std::unique_ptr<Attachment> attach(const std::string& SocketPath,
+                                            const std::string& Session,
+                                            Timings* Times = nullptr)
+  {
+    std::string Reason;
+    const Clock::time_point Begin = Clock::now();
+    std::optional<Client> C = Client::create(SocketPath, &Reason);
+    const bool Connected = C && C->handshake(&Reason);
+    const Clock::time_point Accepted = Clock::now();
+    const bool Attached = Connected && C->requestAttach(Session);
+    if (Times)
+    {
+      Times->Accept = Accepted - Begin;
+      Times->Attach = Clock::now() - Accepted;
+    }
+    if (!Attached)
+    {
+      std::cerr << "Attaching to '" << Session << "' failed: " << Reason
+                << std::endl;
+      return nullptr;
+    }
+
+    fd::addStatusFlag(C->getControlSocket().raw(), O_NONBLOCK);
+    fd::addStatusFlag(C->getDataSocket()->raw(), O_NONBLOCK);
+    return std::unique_ptr<Attachment>{new Attachment{std::move(*C)}};
+  }
+
+  Client& client() noexcept { return C; }
+
+  /// \returns whether the session exited, or the server went away.
+  bool finished() const noexcept
+  {
+    return C.exitReason() != Client::None || C.getDataSocket()->failed();
+  }
+
+  /// The amount of output received since the last \p reset().
+  std::size_t Bytes = 0;
+  /// The time the last output was received at.
+  Clock::time_point LastOutput;
+  /// The output received, if \p KeepOutput is set.
+  std::string Output;
+  bool KeepOutput = false;
+
+  void reset() noexcept
+  {
+    Bytes = 0;
+    Output.clear();
+  }
+
+  /// Waits at most \p Timeout for any of the \p Attachments to receive
+  /// control messages or output, and handles them.
+  ///
+  /// \returns the amount of output received.
+  static std::size_t pump(const std::vector<Attachment*>& Attachments,
+                          std::chrono::milliseconds Timeout);
+
+private:
+  Client C;
+
+  Attachment(Client&& C) : C(std::move(C)) {}
+
+  std::size_t receive();
+};
+
+std::size_t Attachment::pump(const std::vector<Attachment*>& Attachments,
+                             std::chrono::milliseconds Timeout)
+{
+  std::vector<struct ::pollfd> FDs;
+  FDs.reserve(Attachments.size() * 2);
+  for (Attachment* A : Attachments)
+  {
+    // Headless clients have no loop to send the input buffered when the
+    // connection was full.
+    if (Socket& DS = *A->C.getDataSocket();
+        DS.hasBufferedWrite() && !DS.failed())
+      try
+      {
+        DS.flushWrites();
+      }
+      catch (const std::system_error&)
+      {}
+    FDs.push_back({A->C.getControlSocket().raw(), POLLIN, 0});
+    FDs.push_back({A->C.getDataSocket()->raw(), POLLIN, 0});
+  }
+  if (::poll(FDs.data(), FDs.size(), static_cast<int>(Timeout.count())) <= 0)
+    return 0;
+
+  std::size_t Received = 0;
+  for (std::size_t I = 0; I < Attachments.size(); ++I)
+  {
+    Attachment& A = *Attachments[I];
+    if (FDs[I * 2 + 1].revents && !A.C.getDataSocket()->failed())
+      Received += A.receive();
+    if (FDs[I * 2].revents && A.C.exitReason() == Client::None)
+      A.C.controlCallback();
+  }
+  return Received;
+}
+
+std::size_t Attachment::receive()
+{
+  Socket& DS = *C.getDataSocket();
+  try
+  {
+    DS.load(DS.readSize());
+  }
+  catch (const std::system_error&)
+  {
+    // The server closed the connection, which is reported on the control
+    // connection.
+  }
+
+  const std::size_t Size = DS.readInBuffer();
+  if (KeepOutput)
+    for (std::string_view Segment : DS.peekRead(Size))
+      Output.append(Segment);
+  DS.consumeRead(Size);
+  DS.tryFreeResources();
+
+  if (Size)
+  {
+    Bytes += Size;
+    LastOutput = Clock::now();
+  }
+  return Size;
+}
+
+/// Creates a session through the connected \p C running \p Script in a shell.
+///
+/// \returns the name of the created session.
+std::optional<std::string>
+makeSession(Client& C, const std::string& Name, const std::string& Script)
+{
+  Process::SpawnOptions Spawn;
+  Spawn.Program = "/bin/sh";
+  Spawn.Arguments = {"-c", Script};
+  // No scrollback, the output of the session is never replayed.
+  std::optional<std::string> Session =
+    C.requestMakeSession(Name, std::move(Spawn), 0);
+  if (!Session)
+    std::cerr << "Creating session '" << Name << "' failed" << std::endl;
+  return Session;
+}
+
+/// \returns a client connected to the server at \p SocketPath.
+std::optional<Client> connect(const std::string& SocketPath)
+{
+  std::string Reason;
+  std::optional<Client> C = Client::create(SocketPath, &Reason);
+  if (!C || !C->handshake(&Reason))
+  {
+    std::cerr << "Connecting to the server failed: " << Reason << std::endl;
+    return std::nullopt;
+  }
+  return C;
+}
+
+/// Creates a session on the server at \p SocketPath running \p Script in a
+/// shell.
+///
+/// \returns the name of the created session.
+std::optional<std::string> makeSession(const std::string& SocketPath,
+                                       const std::string& Name,
+                                       const std::string& Script)
+{
+  std::optional<Client> C = connect(SocketPath);
+  if (!C)
+    return std::nullopt;
+  return makeSession(*C, Name, Script);
+}
+
+/// The prelude of the scripts which makes the PTY pass the output through
+/// unaltered, and waits for a line of input before starting the work.
+constexpr char Gate[] = "stty raw -echo && read -r _ && ";
+
+/// Waits until every \p Attachments of a finite producer is \p finished() and
+/// stopped receiving output.
+void drain(const std::vector<Attachment*>& Attachments)
+{
+  static constexpr std::chrono::milliseconds IdleTimeout{100};
+  while (Attachment::pump(Attachments, IdleTimeout) ||
+         !std::all_of(Attachments.begin(),
+                      Attachments.end(),
+                      [](const Attachment* A) { return A->finished(); }))
+    ;
+}
+
+double mibPerSecond(std::size_t Bytes, Clock::duration Elapsed)
+{
+  const double Seconds = std::chrono::duration<double>(Elapsed).count();
+  return Seconds > 0 ? static_cast<double>(Bytes) / (1 << 20) / Seconds : 0;
+}
+
+/// Runs a finite producer \p Script and reports the output delivered to each
+/// of the clients attached to the session.
+bool runThroughput(const Options& Opts,
+                   const std::string& Title,
+                   const std::string& Script)
+{
+  InProcessServer Srv{Opts};
+  std::optional<std::string> Session =
+    makeSession(Srv.socketPath(), Title, Gate + Script);
+  if (!Session)
+    return false;
+
+  std::vector<std::unique_ptr<Attachment>> Clients;
+  std::vector<Attachment*> Attachments;
+  for (std::size_t I = 0; I < Opts.Clients; ++I)
+  {
+    Clients.emplace_back(Attachment::attach(Srv.socketPath(), *Session));
+    if (!Clients.back())
+      return false;
+    Attachments.emplace_back(Clients.back().get());
+  }
+
+  // Every client is expected to receive the output, so the session is only
+  // started once they are all attached.
+  const Clock::time_point Start = Clock::now();
+  Clients.front()->client().sendData("\n");
+  drain(Attachments);
+
+  std::cout << Title << ": " << Opts.Clients << " client(s)\n";
+  for (std::size_t I = 0; I < Clients.size(); ++I)
+  {
+    const Attachment& A = *Clients[I];
+    const Clock::duration Elapsed = A.LastOutput - Start;
+    std::cout << "  client #" << I << ": " << std::fixed
+              << std::setprecision(2)
+              << static_cast<double>(A.Bytes) / (1 << 20) << " MiB in "
+              << std::setprecision(3)
+              << std::chrono::duration<double>(Elapsed).count() << " s, "
+              << std::setprecision(1) << mibPerSecond(A.Bytes, Elapsed)
+              << " MiB/s\n";
+  }
+  return true;
+}
+
+/// Starts a session which echoes every keystroke.
+///
+/// \returns the client attached to it, ready to measure with.
+std::unique_ptr<Attachment> startEcho(const InProcessServer& Srv)
+{
+  std::optional<std::string> Session = makeSession(
+    Srv.socketPath(), "echo", std::string{Gate} + "printf R && exec cat");
+  if (!Session)
+    return nullptr;
+  std::unique_ptr<Attachment> A =
+    Attachment::attach(Srv.socketPath(), *Session);
+  if (!A)
+    return nullptr;
+
+  A->KeepOutput = true;
+  A->client().sendData("\n");
+  while (A->Output.find('R') == std::string::npos && !A->finished())
+    Attachment::pump({A.get()}, std::chrono::milliseconds{100});
+  A->reset();
+  A->KeepOutput = false;
+  return A;
+}
+
+/// \returns the \p P-th percentile of the \p Sorted durations, in
+/// microseconds.
+double percentile(const std::vector<Clock::duration>& Sorted, double P)
+{
+  if (Sorted.empty())
+    return 0;
+  auto Index = static_cast<std::size_t>(P * Sorted.size());
+  return std::chrono::duration<double, std::micro>(
+           Sorted[std::min(Index, Sorted.size() - 1)])
+    .count();
+}
+
+/// Types \p Count keystrokes into the session of \p A one after the other,
+/// and prints the time it took for each to be echoed back.
+bool measureEcho(Attachment& A, std::size_t Count)
+{
+  static constexpr std::chrono::seconds Timeout{5};
+  std::vector<Clock::duration> Latencies;
+  Latencies.reserve(Count);
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    const std::size_t Expected = A.Bytes + 1;
+    const Clock::time_point Sent = Clock::now();
+    A.client().sendData("x");
+    while (A.Bytes < Expected && !A.finished() &&
+           Clock::now() - Sent < Timeout)
+      Attachment::pump({&A}, std::chrono::milliseconds{100});
+    if (A.Bytes < Expected)
+    {
+      std::cerr << "Keystroke #" << I << " was not echoed back" << std::endl;
+      return false;
+    }
+    Latencies.emplace_back(A.LastOutput - Sent);
+  }
+
+  std::sort(Latencies.begin(), Latencies.end());
+  std::cout << "  " << Count << " keystrokes, input-to-echo latency: "
+            << std::fixed << std::setprecision(1) << "p50 "
+            << percentile(Latencies, 0.5) << " us, p99 "
+            << percentile(Latencies, 0.99) << " us, p999 "
+            << percentile(Latencies, 0.999) << " us\n";
+  return true;
+}
+
+bool runEcho(const Options& Opts)
+{
+  InProcessServer Srv{Opts};
+  std::unique_ptr<Attachment> A = startEcho(Srv);
+  if (!A)
+    return false;
+
+  std::cout << "echo: 1 session\n";
+  return measureEcho(*A, Opts.Keystrokes);
+}
+
+/// Measures the keystroke latency while many other sessions are attached but
+/// idle, and one floods its client with output. Any latency over the baseline
+/// of \p runEcho() is caused by the server serving the other sessions first.
+bool runHot(const Options& Opts)
+{
+  InProcessServer Srv{Opts};
+
+  std::vector<std::unique_ptr<Attachment>> Idle;
+  std::vector<Attachment*> IdleAttachments;
+  for (std::size_t I = 0; I < Opts.IdleSessions; ++I)
+  {
+    std::optional<std::string> Session =
+      makeSession(Srv.socketPath(), "idle-" + std::to_string(I), "exec cat");
+    if (!Session)
+      return false;
+    Idle.emplace_back(Attachment::attach(Srv.socketPath(), *Session));
+    if (!Idle.back())
+      return false;
+    IdleAttachments.emplace_back(Idle.back().get());
+  }
+
+  std::optional<std::string> HotSession =
+    makeSession(Srv.socketPath(),
+                "hot",
+                std::string{Gate} +
+                  "exec yes 'The quick brown fox jumps over the lazy dog.'");
+  if (!HotSession)
+    return false;
+  std::unique_ptr<Attachment> Hot =
+    Attachment::attach(Srv.socketPath(), *HotSession);
+  std::unique_ptr<Attachment> Echo = startEcho(Srv);
+  if (!Hot || !Echo)
+    return false;
+
+  // The other clients are served by their own threads, like the terminals of
+  // other users would be.
+  std::atomic<bool> Stop = false;
+  std::thread IdleThread{[&Stop, &IdleAttachments] {
+    while (!Stop.load())
+      Attachment::pump(IdleAttachments, std::chrono::milliseconds{100});
+  }};
+  std::thread HotThread{[&Stop, &Hot] {
+    while (!Stop.load() && !Hot->finished())
+      Attachment::pump({Hot.get()}, std::chrono::milliseconds{100});
+  }};
+
+  std::cout << "hot: " << Opts.IdleSessions
+            << " idle session(s), 1 hot session\n";
+  const Clock::time_point Start = Clock::now();
+  Hot->client().sendData("\n");
+  const bool Measured = measureEcho(*Echo, Opts.Keystrokes);
+  const Clock::time_point End = Clock::now();
+  Stop.store(true);
+  IdleThread.join();
+  HotThread.join();
+
+  std::cout << "  the hot session received " << std::fixed
+            << std::setprecision(1) << mibPerSecond(Hot->Bytes, End - Start)
+            << " MiB/s meanwhile\n";
+  return Measured;
+}
+
+/// Spawns short-lived sessions, and attaches to and detaches from long-lived
+/// ones over and over, like users hopping between their sessions do.
+bool runCycles(const Options& Opts)
+{
+  InProcessServer Srv{Opts};
+  std::optional<Client> Controller = connect(Srv.socketPath());
+  if (!Controller)
+    return false;
+
+  std::vector<std::string> Sessions;
+  for (std::size_t I = 0; I < std::max<std::size_t>(Opts.IdleSessions, 1); ++I)
+  {
+    std::optional<std::string> Session =
+      makeSession(*Controller, "cycle-" + std::to_string(I), "exec cat");
+    if (!Session)
+      return false;
+    Sessions.emplace_back(std::move(*Session));
+  }
+
+  std::vector<Clock::duration> Attaches;
+  const Clock::time_point Start = Clock::now();
+  for (std::size_t I = 0; I < Opts.Churn; ++I)
+  {
+    if (!makeSession(
+          *Controller, "spawn-" + std::to_string(I), "echo spawned && exit 0"))
+      return false;
+
+    Attachment::Timings Times;
+    std::unique_ptr<Attachment> A = Attachment::attach(
+      Srv.socketPath(), Sessions[I % Sessions.size()], &Times);
+    if (!A)
+      return false;
+    Attaches.emplace_back(Times.Accept + Times.Attach);
+    // Type a line, and detach once it is echoed.
+    A->client().sendData("cycle\n");
+    while (A->Bytes < 6 && !A->finished())
+      Attachment::pump({A.get()}, std::chrono::milliseconds{100});
+  }
+  const Clock::duration Elapsed = Clock::now() - Start;
+
+  std::sort(Attaches.begin(), Attaches.end());
+  std::cout << "cycles: " << Opts.Churn << " attach(es) over "
+            << Sessions.size() << " session(s), " << Opts.Churn
+            << " session(s) spawned\n"
+            << "  " << std::fixed << std::setprecision(3)
+            << std::chrono::duration<double>(Elapsed).count()
+            << " s, connect-and-attach latency: " << std::setprecision(1)
+            << "p50 " << percentile(Attaches, 0.5) << " us, p99 "
+            << percentile(Attaches, 0.99) << " us\n";
+  return true;
+}
+
+/// Sends a flood of control requests without waiting for the responses in
+/// between, like scripts polling the server would.
+bool runStorm(const Options& Opts)
+{
+  static constexpr std::size_t Controllers = 4;
+  static constexpr std::size_t Window = 64;
+  InProcessServer Srv{Opts};
+
+  std::vector<Client> Clients;
+  for (std::size_t I = 0; I < Controllers; ++I)
+  {
+    std::optional<Client> C = connect(Srv.socketPath());
+    if (!C)
+      return false;
+    Clients.emplace_back(std::move(*C));
+  }
+  for (std::size_t I = 0; I < 8; ++I)
+    if (!makeSession(Clients.front(),
+                     "storm-" + std::to_string(I),
+                     "yes 'storm " + std::to_string(I) +
+                       "' | head -n 1000 && exec cat"))
+      return false;
+
+  std::size_t Failed = 0;
+  auto Count = [&Failed](const auto& Response) { Failed += !Response; };
+  const Clock::time_point Start = Clock::now();
+  for (std::size_t I = 0; I < Opts.Requests; ++I)
+  {
+    Client& C = Clients[I % Controllers];
+    // Most requests are the cheap, pipelined ones, with the occasional heavy
+    // request blocking in between.
+    if (I % 256 == 255)
+      ControlClient{C}.requestMetrics(
+        [](const std::vector<message::Metric>& /* Part */) {});
+    else if (I % 256 == 127)
+      ControlClient{C}.requestSearch("storm 3", "");
+    else
+      C.requestSessionListAsync(Count);
+    if (C.numPendingRequests() >= Window)
+      C.waitForAllResponses();
+  }
+  for (Client& C : Clients)
+    C.waitForAllResponses();
+  const Clock::duration Elapsed = Clock::now() - Start;
+
+  const double Seconds = std::chrono::duration<double>(Elapsed).count();
+  std::cout << "storm: " << Opts.Requests << " request(s) over "
+            << Controllers << " connection(s)\n"
+            << "  " << std::fixed << std::setprecision(3) << Seconds << " s, "
+            << std::setprecision(0)
+            << (Seconds > 0 ? static_cast<double>(Opts.Requests) / Seconds : 0)
+            << " requests/s, " << Failed << " failed\n";
+  return !Failed;
+}
+
+/// The metrics of the server the scaling report of \p runFleet() is made of.
+struct ServerSample
+{
+  std::uint64_t Resident = 0;
+  std::uint64_t Saturated = 0;
+  std::uint64_t MaxEvents = 0;
+  std::uint64_t EventCapacity = 0;
+  bool LookupLarge = false;
+  std::vector<std::uint64_t> IterationTime;
+};
+
+ServerSample sampleServer(Client& C)
+{
+  ServerSample Ret;
+  std::vector<message::Metric> Metrics;
+  ControlClient{C}.requestMetrics(
+    [&Metrics](const std::vector<message::Metric>& Part) {
+      Metrics.insert(Metrics.end(), Part.begin(), Part.end());
+    });
+  for (const message::Metric& M : Metrics)
+  {
+    if (M.Name == "monomux_resident_bytes")
+      Ret.Resident = M.Value;
+    else if (M.Name == "monomux_loop_saturated_total")
+      Ret.Saturated = M.Value;
+    else if (M.Name == "monomux_loop_events_max")
+      Ret.MaxEvents = M.Value;
+    else if (M.Name == "monomux_loop_event_capacity")
+      Ret.EventCapacity = M.Value;
+    else if (M.Name == "monomux_fd_lookup_large")
+      Ret.LookupLarge = M.Value;
+    else if (M.Name == "monomux_loop_iteration_microseconds")
+      Ret.IterationTime = M.Buckets;
+  }
+  return Ret;
+}
+
+/// \returns the upper bound of the bucket of the \p P-th percentile of the
+/// observations that happened between the \p Previous and the \p Current
+/// samples of a histogram, in microseconds.
+std::uint64_t histogramPercentile(const std::vector<std::uint64_t>& Previous,
+                                  const std::vector<std::uint64_t>& Current,
+                                  double P)
+{
+  std::vector<std::uint64_t> Delta = Current;
+  for (std::size_t I = 0; I < Delta.size() && I < Previous.size(); ++I)
+    Delta[I] -= Previous[I];
+
+  std::uint64_t Total = 0;
+  for (std::uint64_t B : Delta)
+    Total += B;
+  std::uint64_t Seen = 0;
+  for (std::size_t I = 0; I < Delta.size(); ++I)
+  {
+    Seen += Delta[I];
+    if (Total && static_cast<double>(Seen) >= P * static_cast<double>(Total))
+      return 1ULL << I;
+  }
+  return 0;
+}
+
+/// \returns the number of files the process \p PID has open, and the largest
+/// file descriptor among them.
+std::pair<std::size_t, raw_fd> openFiles(::pid_t PID)
+{
+  std::size_t Count = 0;
+  raw_fd Largest = fd::Invalid;
+  std::error_code EC;
+  for (const auto& Entry : std::filesystem::directory_iterator{
+         "/proc/" + std::to_string(PID) + "/fd", EC})
+  {
+    ++Count;
+    Largest = std::max(Largest, std::atoi(Entry.path().filename().c_str()));
+  }
+  return {Count, Largest};
+}
+
+/// Ramps up the number of sessions on a server, each with a client attached,
+/// and detaches and reattaches clients at every step, to show how the server
+/// scales.
+bool runFleet(const Options& Opts)
+{
+  // Every session takes up multiple files, both in the server and here.
+  POD<struct ::rlimit> Files;
+  if (::getrlimit(RLIMIT_NOFILE, &Files) == 0)
+  {
+    Files->rlim_cur = Files->rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &Files);
+  }
+
+  ForkedServer Srv{Opts};
+  std::optional<Client> Controller = connect(Srv.socketPath());
+  if (!Controller)
+    return false;
+
+  std::cout << "fleet: up to " << Opts.FleetSessions << " session(s), "
+            << Opts.Churn << " reattach(es) per step\n"
+            << "  sessions  files  max-fd   RSS MiB  accept p50/p99 us  "
+            << "attach p50/p99 us  loop p99 us  events max/cap  saturated  "
+               "lookup\n";
+
+  std::vector<std::string> Sessions;
+  std::vector<std::unique_ptr<Attachment>> Attached;
+  std::size_t NextReattach = 0;
+  ServerSample Previous = sampleServer(*Controller);
+  for (std::size_t Target = std::min<std::size_t>(16, Opts.FleetSessions);;
+       Target = std::min(Target * 2, Opts.FleetSessions))
+  {
+    std::vector<Clock::duration> Accepts;
+    std::vector<Clock::duration> Attaches;
+    auto AttachTo = [&](const std::string& Session) {
+      Attachment::Timings Times;
+      std::unique_ptr<Attachment> A =
+        Attachment::attach(Srv.socketPath(), Session, &Times);
+      Accepts.emplace_back(Times.Accept);
+      Attaches.emplace_back(Times.Attach);
+      return A;
+    };
+
+    while (Sessions.size() < Target)
+    {
+      std::optional<std::string> Session = makeSession(
+        *Controller, "fleet-" + std::to_string(Sessions.size()), "exec cat");
+      if (!Session)
+        return false;
+      Sessions.emplace_back(std::move(*Session));
+      Attached.emplace_back(AttachTo(Sessions.back()));
+      if (!Attached.back())
+        return false;
+    }
+    for (std::size_t I = 0; I < Opts.Churn && !Attached.empty(); ++I)
+    {
+      const std::size_t Index = NextReattach++ % Attached.size();
+      Attached[Index].reset();
+      Attached[Index] = AttachTo(Sessions[Index]);
+      if (!Attached[Index])
+        return false;
+    }
+
+    ServerSample Current = sampleServer(*Controller);
+    const auto [Files, LargestFD] = openFiles(Srv.pid());
+    std::sort(Accepts.begin(), Accepts.end());
+    std::sort(Attaches.begin(), Attaches.end());
+    std::cout << std::fixed << std::setprecision(1) << "  " << std::setw(8)
+              << Sessions.size() << std::setw(7) << Files << std::setw(8)
+              << LargestFD << std::setw(10)
+              << static_cast<double>(Current.Resident) / (1 << 20)
+              << std::setw(10) << percentile(Accepts, 0.5) << '/'
+              << std::setw(8) << std::left << percentile(Accepts, 0.99)
+              << std::right << std::setw(10) << percentile(Attaches, 0.5)
+              << '/' << std::setw(8) << std::left
+              << percentile(Attaches, 0.99) << std::right << std::setw(11)
+              << histogramPercentile(
+                   Previous.IterationTime, Current.IterationTime, 0.99)
+              << std::setw(10) << Current.MaxEvents << '/' << std::setw(5)
+              << std::left << Current.EventCapacity << std::right
+              << std::setw(11) << Current.Saturated - Previous.Saturated
+              << "  " << (Current.LookupLarge ? "large" : "small") << '\n';
+    Previous = std::move(Current);
+
+    if (Target == Opts.FleetSessions)
+      break;
+  }
+  return true;
+}
+
+/// Writes \p Data to the non-blocking \p FIFO, receiving the output of \p A
+/// while the pipe is full, so neither end waits for the other.
+///
+/// \returns whether all the data was written.
+bool feed(const fd& FIFO, std::string_view Data, Attachment& A)
+{
+  while (!Data.empty())
+  {
+    const ::ssize_t Written = ::write(FIFO.get(), Data.data(), Data.size());
+    if (Written > 0)
+    {
+      Data.remove_prefix(static_cast<std::size_t>(Written));
+      continue;
+    }
+    if (Written == -1 && errno != EAGAIN && errno != EINTR)
+      return false;
+    if (A.finished())
+      return false;
+    Attachment::pump({&A}, std::chrono::milliseconds{1});
+  }
+  return true;
+}
+
+/// Replays the recording at \p Path into a session of an in-process server.
+/// The recorded output is written into a FIFO, which the session copies to
+/// its PTY, and the recorded input is sent by the attached client, each at
+/// the time it was recorded at, scaled by the speed of the options.
+///
+/// The time from writing each piece of output to the client receiving it is
+/// the latency the relay adds to real traffic.
+bool runReplay(const Options& Opts, const std::string& Path)
+{
+  RecordingReader Recording = RecordingReader::open(Path);
+  const std::string FIFOPath =
+    "/tmp/monomux-e2e-" + std::to_string(::getpid()) + ".fifo";
+  if (::mkfifo(FIFOPath.c_str(), 0600) == -1)
+    throw std::system_error{errno, std::system_category(), "mkfifo()"};
+  struct Unlink
+  {
+    const std::string& Path;
+    ~Unlink() { ::unlink(Path.c_str()); }
+  } RemoveFIFO{FIFOPath};
+
+  InProcessServer Srv{Opts};
+  // The input is copied away from a duplicate of the PTY, as the shell would
+  // give the asynchronous command /dev/null instead.
+  std::optional<std::string> Session =
+    makeSession(Srv.socketPath(),
+                "replay",
+                std::string{Gate} +
+                  "exec 3<&0 && { cat <&3 >/dev/null 3<&- & } && exec cat " +
+                  FIFOPath + " 3<&-");
+  if (!Session)
+    return false;
+  std::unique_ptr<Attachment> A =
+    Attachment::attach(Srv.socketPath(), *Session);
+  if (!A)
+    return false;
+  A->client().sendData("\n");
+
+  // Opening the FIFO for writing only succeeds once the session opened it.
+  fd FIFO;
+  const Clock::time_point OpenDeadline = Clock::now() + std::chrono::seconds{5};
+  while (!FIFO.has() && Clock::now() < OpenDeadline)
+  {
+    const raw_fd Handle =
+      ::open(FIFOPath.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (Handle != fd::Invalid)
+      FIFO = fd{Handle};
+    else
+      Attachment::pump({A.get()}, std::chrono::milliseconds{1});
+  }
+  if (!FIFO.has())
+  {
+    std::cerr << "The session did not start replaying" << std::endl;
+    return false;
+  }
+  A->reset();
+
+  struct Pending
+  {
+    /// The position in the output at which the piece ends.
+    std::size_t End;
+    Clock::time_point Written;
+  };
+  std::deque<Pending> InFlight;
+  std::vector<Clock::duration> Latencies;
+  auto Collect = [&A, &InFlight, &Latencies] {
+    while (!InFlight.empty() && InFlight.front().End <= A->Bytes)
+    {
+      Latencies.emplace_back(A->LastOutput - InFlight.front().Written);
+      InFlight.pop_front();
+    }
+  };
+
+  std::size_t Records = 0;
+  std::size_t OutputBytes = 0;
+  std::size_t InputBytes = 0;
+  std::chrono::nanoseconds Recorded{0};
+  const Clock::time_point Start = Clock::now();
+  while (std::optional<RecordingReader::Record> R = Recording.next())
+  {
+    ++Records;
+    Recorded = R->Time;
+    if (Opts.Speed > 0)
+    {
+      const Clock::time_point Due =
+        Start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double, std::nano>(
+                    static_cast<double>(R->Time.count()) / Opts.Speed));
+      for (Clock::time_point Now = Clock::now(); Now < Due && !A->finished();
+           Now = Clock::now())
+      {
+        Attachment::pump(
+          {A.get()},
+          std::max(std::chrono::duration_cast<std::chrono::milliseconds>(
+                     Due - Now),
+                   std::chrono::milliseconds{0}));
+        Collect();
+      }
+    }
+
+    if (R->Direction == SessionRecording::Direction::Input)
+    {
+      A->client().sendData(R->Data);
+      InputBytes += R->Data.size();
+      continue;
+    }
+    if (R->Data.empty())
+      continue;
+    const Clock::time_point Written = Clock::now();
+    if (!feed(FIFO, R->Data, *A))
+    {
+      std::cerr << "The session stopped replaying" << std::endl;
+      return false;
+    }
+    OutputBytes += R->Data.size();
+    InFlight.push_back({OutputBytes, Written});
+    Collect();
+  }
+  if (Recording.corrupt())
+    std::cerr << "The recording '" << Path
+              << "' ends in a truncated record, replayed until it"
+              << std::endl;
+
+  // The output still in the PTY is lost if the session exits, so it is only
+  // let to once everything arrived.
+  static constexpr std::chrono::seconds IdleTimeout{5};
+  while (A->Bytes < OutputBytes && !A->finished() &&
+         Clock::now() - A->LastOutput < IdleTimeout)
+  {
+    Attachment::pump({A.get()}, std::chrono::milliseconds{100});
+    Collect();
+  }
+  fd::close(FIFO.release());
+  drain({A.get()});
+  Collect();
+  const Clock::duration Elapsed = A->LastOutput - Start;
+
+  std::sort(Latencies.begin(), Latencies.end());
+  std::cout << "replay: " << Path << ", " << Records << " records over "
+            << std::fixed << std::setprecision(3)
+            << std::chrono::duration<double>(Recorded).count() << " s\n"
+            << "  " << OutputBytes << " bytes output, " << InputBytes
+            << " bytes input, ";
+  if (Opts.Speed > 0)
+    std::cout << std::setprecision(1) << Opts.Speed << "x speed, ";
+  else
+    std::cout << "unpaced, ";
+  std::cout << std::setprecision(3)
+            << std::chrono::duration<double>(Elapsed).count() << " s, "
+            << std::setprecision(1) << mibPerSecond(A->Bytes, Elapsed)
+            << " MiB/s\n"
+            << "  output delivery latency: p50 " << percentile(Latencies, 0.5)
+            << " us, p99 " << percentile(Latencies, 0.99) << " us, p999 "
+            << percentile(Latencies, 0.999) << " us\n";
+  if (A->Bytes != OutputBytes)
+  {
+    std::cerr << "The client received " << A->Bytes << " bytes of the "
+              << OutputBytes << " replayed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int ArgC, char* ArgV[])
+{
+  Options Opts;
+  static const struct ::option LongOptions[] = {
+    {"help", no_argument, nullptr, 'h'},
+    {"scenario", required_argument, nullptr, 'S'},
+    {"megabytes", required_argument, nullptr, 'b'},
+    {"clients", required_argument, nullptr, 'c'},
+    {"keystrokes", required_argument, nullptr, 'k'},
+    {"idle", required_argument, nullptr, 'i'},
+    {"sessions", required_argument, nullptr, 'n'},
+    {"churn", required_argument, nullptr, 'C'},
+    {"requests", required_argument, nullptr, 'r'},
+    {"workers", required_argument, nullptr, 'w'},
+    {"splice", no_argument, nullptr, 's'},
+    {"io-uring", no_argument, nullptr, 'u'},
+    {"recording", required_argument, nullptr, 'R'},
+    {"speed", required_argument, nullptr, 'x'},
+    {"record", required_argument, nullptr, 'O'},
+    {nullptr, 0, nullptr, 0}};
+
+  int Opt;
+  while ((Opt = ::getopt_long(ArgC,
+                              ArgV,
+                              "hS:b:c:k:i:n:C:r:w:suR:x:O:",
+                              LongOptions,
+                              nullptr)) != -1)
+  {
+    switch (Opt)
+    {
+      case 'S':
+        Opts.Scenarios.emplace_back(optarg);
+        break;
+      case 'b':
+        Opts.Megabytes = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'c':
+        Opts.Clients = std::max(std::strtoull(optarg, nullptr, 10), 1ULL);
+        break;
+      case 'k':
+        Opts.Keystrokes = std::max(std::strtoull(optarg, nullptr, 10), 1ULL);
+        break;
+      case 'i':
+        Opts.IdleSessions = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'n':
+        Opts.FleetSessions = std::max(std::strtoull(optarg, nullptr, 10), 1ULL);
+        break;
+      case 'C':
+        Opts.Churn = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'r':
+        Opts.Requests = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'w':
+        Opts.Workers = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 's':
+        Opts.SpliceRelay = true;
+        break;
+      case 'u':
+        Opts.UseIOUring = true;
+        break;
+      case 'R':
+        Opts.Recordings.emplace_back(optarg);
+        break;
+      case 'x':
+        Opts.Speed = std::max(std::strtod(optarg, nullptr), 0.0);
+        break;
+      case 'O':
+        Opts.RecordDirectory = std::filesystem::absolute(optarg).string();
+        break;
+      case 'h':
+      default:
+        std::cout << "Usage: " << ArgV[0] << " [OPTIONS...]\n\n"
+                  << R"EOF(Options:
+    -S, --scenario NAME     Run only the scenario NAME, which is one of
+                            'throughput' (a 'cat' of zeros), 'lines' (a flood
+                            of short lines), 'echo' (keystroke latency), 'hot'
+                            (keystroke latency next to many idle and one
+                            flooding session), 'cycles' (spawning sessions,
+                            and attaching to and detaching from the idle
+                            ones), 'storm' (a flood of control requests), or
+                            'fleet' (a scaling report of a growing number of
+                            sessions), or 'replay' (the sessions recorded by
+                            a server started with '--record-sessions'). The
+                            last four are only run if requested. May be given
+                            multiple times.
+    -b, --megabytes N       The amount of output the producers of the
+                            throughput scenarios write. (Default: 256)
+    -c, --clients N         The number of clients attached to the producer in
+                            the throughput scenarios. (Default: 1)
+    -k, --keystrokes N      The number of keystrokes to measure the latency
+                            of. (Default: 2000)
+    -i, --idle N            The number of idle sessions, each with a client
+                            attached, in the 'hot' scenario, and the number
+                            of sessions 'cycles' attaches to. (Default: 64)
+    -n, --sessions N        The number of sessions the 'fleet' scenario ramps
+                            up to, doubling at every step. (Default: 1024)
+    -C, --churn N           The number of clients the 'fleet' scenario
+                            detaches and reattaches at every step, and the
+                            number of cycles 'cycles' runs. (Default: 64)
+    -r, --requests N        The number of control requests the 'storm'
+                            scenario sends. (Default: 10000)
+    -w, --workers N         Run the server with N relay worker threads.
+    -s, --splice            Run the server with splice(2) relaying.
+    -u, --io-uring          Run the server with the io_uring backend.
+    -R, --recording FILE    A recording the 'replay' scenario replays. May be
+                            given multiple times.
+    -x, --speed X           Replay the recordings X times faster than they
+                            were recorded, or as fast as possible if 0.
+                            (Default: 1)
+    -O, --record DIR        Record the sessions of the scenarios into DIR,
+                            e.g. to replay them later.
+)EOF";
+        return Opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (Opts.Scenarios.empty())
+    Opts.Scenarios = {"throughput", "lines", "echo", "hot"};
+
+  // The server reports the clients and sessions going away as errors.
+  log::Logger::get().setLimit(log::Fatal);
+  (void)std::signal(SIGPIPE, SIG_IGN);
+  // The server receives these signals through a signalfd(2), for which they
+  // must be blocked in every thread, so this must happen before any starts.
+  POD<::sigset_t> Blocked;
+  ::sigemptyset(&Blocked);
+  for (int Sig : {SIGCHLD, SIGHUP, SIGINT, SIGTERM})
+    ::sigaddset(&Blocked, Sig);
+  ::pthread_sigmask(SIG_BLOCK, &Blocked, nullptr);
+
+  const std::string Bytes = std::to_string(Opts.Megabytes << 20);
+  bool Success = true;
+  for (const std::string& Scenario : Opts.Scenarios)
+  {
+    try
+    {
+      if (Scenario == "throughput")
+        Success &= runThroughput(
+          Opts, Scenario, "exec head -c " + Bytes + " /dev/zero");
+      else if (Scenario == "lines")
+        Success &= runThroughput(
+          Opts,
+          Scenario,
+          "yes 'The quick brown fox jumps over the lazy dog.' | head -c " +
+            Bytes);
+      else if (Scenario == "echo")
+        Success &= runEcho(Opts);
+      else if (Scenario == "hot")
+        Success &= runHot(Opts);
+      else if (Scenario == "cycles")
+        Success &= runCycles(Opts);
+      else if (Scenario == "storm")
+        Success &= runStorm(Opts);
+      else if (Scenario == "fleet")
+        Success &= runFleet(Opts);
+      else if (Scenario == "replay")
+      {
+        if (Opts.Recordings.empty())
+        {
+          std::cerr << "The 'replay' scenario needs a '--recording'"
+                    << std::endl;
+          Success = false;
+        }
+        for (const std::string& Recording : Opts.Recordings)
+          Success &= runReplay(Opts, Recording);
+      }
+      else
+      {
+        std::cerr << "Unknown scenario '" << Scenario << "'" << std::endl;
+        Success = false;
+      }
+    }
+    catch (const std::system_error& Err)
+    {
+      std::cerr << "Scenario '" << Scenario << "' failed: " << Err.what()
+                << std::endl;
+      Success = false;
+    }
+  }
+  return Success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
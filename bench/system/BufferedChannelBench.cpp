@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <string>
+
+#include <sys/socket.h>
+
+#include <benchmark/benchmark.h>
+
+#include "monomux/system/Pipe.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+
+/// Writes \p range(0) bytes into \p Write and reads them back from \p Read,
+/// on the same thread. The chunks are small enough to fit the kernel buffer.
+static void roundTrip(benchmark::State& State,
+                      BufferedChannel& Write,
+                      BufferedChannel& Read)
+{
+  const auto Size = static_cast<std::size_t>(State.range(0));
+  const std::string Data(Size, 'x');
+  for (auto _ : State)
+  {
+    Write.write(Data);
+    std::size_t Received = 0;
+    while (Received < Size)
+    {
+      std::string Chunk = Read.read(Size - Received);
+      Received += Chunk.size();
+      benchmark::DoNotOptimize(Chunk.data());
+    }
+  }
+  State.SetBytesProcessed(static_cast<std::int64_t>(State.iterations() * Size));
+}
+
+static void chunkSizes(benchmark::internal::Benchmark* B)
+{
+  B->RangeMultiplier(8)->Range(1, 1 << 15);
+}
+
+static void bufferedChannelPipe(benchmark::State& State)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+  roundTrip(State, *AP.getWrite(), *AP.getRead());
+}
+BENCHMARK(bufferedChannelPipe)->Apply(chunkSizes);
+
+static void bufferedChannelSocketPair(benchmark::State& State)
+{
+  raw_fd FDs[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, FDs))
+  {
+    State.SkipWithError("socketpair() failed!");
+    return;
+  }
+  Socket A = Socket::wrap(fd{FDs[0]}, "bench-a");
+  Socket B = Socket::wrap(fd{FDs[1]}, "bench-b");
+  roundTrip(State, A, B);
+}
+BENCHMARK(bufferedChannelSocketPair)->Apply(chunkSizes);
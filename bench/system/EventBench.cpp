@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include "monomux/system/Event.hpp"
+#include "monomux/system/Pipe.hpp"
+
+using namespace monomux;
+
+static void backends(benchmark::internal::Benchmark* B)
+{
+  B->ArgName("io_uring")->Arg(0)->Arg(1);
+}
+
+static EPoll::Backend backendArg(const benchmark::State& State)
+{
+  return State.range(0) ? EPoll::Backend::IOUring : EPoll::Backend::EPoll;
+}
+
+/// A manually scheduled event makes \p wait() return without blocking, which
+/// measures the overhead of a loop iteration without any I/O.
+static void epollSchedule(benchmark::State& State)
+{
+  static constexpr raw_fd Token = 1000;
+  EPoll Poll{16, backendArg(State)};
+  for (auto _ : State)
+  {
+    Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+    benchmark::DoNotOptimize(Poll.wait());
+  }
+}
+BENCHMARK(epollSchedule)->Apply(backends);
+
+/// Waits on \p range(1) pipes that are all readable.
+static void epollWaitReady(benchmark::State& State)
+{
+  const auto Count = static_cast<std::size_t>(State.range(1));
+  std::vector<Pipe::AnonymousPipe> Pipes;
+  EPoll Poll{Count, backendArg(State)};
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    Pipe::AnonymousPipe& AP = Pipes.emplace_back(Pipe::create());
+    AP.getWrite()->write("x");
+    Poll.listen(AP.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  }
+  for (auto _ : State)
+    benchmark::DoNotOptimize(Poll.wait());
+  State.SetItemsProcessed(
+    static_cast<std::int64_t>(State.iterations() * Count));
+}
+BENCHMARK(epollWaitReady)
+  ->ArgNames({"io_uring", "fds"})
+  ->Args({0, 1})
+  ->Args({0, 64})
+  ->Args({1, 1})
+  ->Args({1, 64});
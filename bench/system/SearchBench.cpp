@@ -0,0 +1,52 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "monomux/system/Search.hpp"
+
+using namespace monomux;
+using namespace monomux::search;
+
+/// Searches 1 MiB of build-like terminal output for a line that is not there,
+/// with the needle's first and last bytes frequent in the text.
+static void searchScrollback(benchmark::State& State)
+{
+  const auto Impl = static_cast<Implementation>(State.range(0));
+  if (!supported(Impl))
+  {
+    State.SkipWithError("Not supported by the CPU");
+    return;
+  }
+
+  std::string Haystack;
+  for (std::size_t I = 0; Haystack.size() < (1 << 20); ++I)
+    Haystack += "\x1b[1;32m[" + std::to_string(I) +
+                "/9999]\x1b[0m Building CXX object src/server/Server.cpp.o\r\n";
+  for (auto _ : State)
+    benchmark::DoNotOptimize(
+      search::find(Haystack, "src/server/Server.cpp: error", Impl));
+  State.SetBytesProcessed(
+    static_cast<std::int64_t>(State.iterations() * Haystack.size()));
+}
+BENCHMARK(searchScrollback)
+  ->Arg(static_cast<int>(Implementation::Scalar))
+  ->Arg(static_cast<int>(Implementation::SSE2))
+  ->Arg(static_cast<int>(Implementation::AVX2));
@@ -33,10 +33,70 @@ else()
   unset(CMAKE_UNITY_BUILD_BATCH_SIZE CACHE)
 endif()
 
+set(MONOMUX_PGO "OFF" CACHE STRING
+  "The stage of a profile-guided optimised build. 'GENERATE' instruments the binaries and adds the 'pgo_train' target which runs the training workloads of the end-to-end harness, and 'USE' rebuilds the SAME build directory with the collected profile.")
+set_property(CACHE MONOMUX_PGO PROPERTY STRINGS "OFF" "GENERATE" "USE")
+set(MONOMUX_PGO_PROFILE_DIR "${CMAKE_BINARY_DIR}/pgo-profile" CACHE PATH
+  "The directory the profile of a profile-guided optimised build is collected into.")
+if (NOT MONOMUX_PGO STREQUAL "OFF")
+  if (MONOMUX_BUILD_UNITY)
+    message(WARNING "Unity build is not compatible with profile-guided optimisation, as the training harness links the libraries, but MONOMUX_PGO was supplied. Prioritising unity build and disabling PGO...")
+    set(MONOMUX_PGO "OFF")
+  elseif (NOT CMAKE_CXX_COMPILER_ID MATCHES "^(GNU|Clang)$")
+    message(WARNING "Profile-guided optimisation is only supported with GCC and Clang. Disabling PGO...")
+    set(MONOMUX_PGO "OFF")
+  endif()
+endif()
+if (CMAKE_CXX_COMPILER_ID STREQUAL "Clang")
+  # Clang writes raw profiles, which must be merged before they can be used.
+  set(MONOMUX_PGO_PROFILE "${MONOMUX_PGO_PROFILE_DIR}/monomux.profdata")
+else()
+  set(MONOMUX_PGO_PROFILE "${MONOMUX_PGO_PROFILE_DIR}")
+endif()
+if (MONOMUX_PGO STREQUAL "GENERATE")
+  # The server relays on multiple threads, whose counter updates must not be
+  # lost.
+  add_compile_options(
+    -fprofile-generate=${MONOMUX_PGO_PROFILE_DIR} -fprofile-update=atomic)
+  add_link_options(-fprofile-generate=${MONOMUX_PGO_PROFILE_DIR})
+elseif (MONOMUX_PGO STREQUAL "USE")
+  if (NOT EXISTS "${MONOMUX_PGO_PROFILE}")
+    message(WARNING "No profile was collected at '${MONOMUX_PGO_PROFILE}'! Build with MONOMUX_PGO=GENERATE and run the 'pgo_train' target first.")
+  endif()
+  add_compile_options(-fprofile-use=${MONOMUX_PGO_PROFILE})
+  if (CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+    # The code the training does not reach (e.g. the command-line parsing) is
+    # still optimised for speed, and is not expected to have a profile.
+    add_compile_options(-fprofile-partial-training -Wno-missing-profile)
+  else()
+    add_compile_options(-Wno-profile-instr-unprofiled)
+  endif()
+endif()
+
 set(MONOMUX_NON_ESSENTIAL_LOGS ON CACHE BOOL
   "If set, the built binary will contain some additional log outputs that are needed for verbose debugging of the project. Turn off to cut down further on the binary size for production."
   )
 
+set(MONOMUX_TRACEPOINTS ON CACHE BOOL
+  "If set, the hot paths of the built binary record compact binary events into per-thread in-memory rings, which can be dumped from a running server. Turn off to remove even the cost of recording them."
+  )
+
+set(MONOMUX_USDT_PROBES OFF CACHE BOOL
+  "If set, the tracepoints are also exposed as USDT probes for tools like bpftrace and perf. Needs <sys/sdt.h> (SystemTap's development package), and MONOMUX_TRACEPOINTS."
+  )
+if (MONOMUX_USDT_PROBES)
+  include(CheckIncludeFileCXX)
+  check_include_file_cxx("sys/sdt.h" MONOMUX_HAVE_SYS_SDT_H)
+  if (NOT MONOMUX_TRACEPOINTS OR NOT MONOMUX_HAVE_SYS_SDT_H)
+    message(WARNING "USDT probes need MONOMUX_TRACEPOINTS and <sys/sdt.h>, but MONOMUX_USDT_PROBES was supplied. Disabling probes...")
+    set(MONOMUX_USDT_PROBES OFF)
+  endif()
+endif()
+
+set(MONOMUX_ALLOCATION_ACCOUNTING OFF CACHE BOOL
+  "If set, the allocations of the built binary are counted per subsystem, with live and peak values, which a running server reports in its statistics. This replaces the global operator new, and costs a small header and a few relaxed atomic additions per allocation."
+  )
+
 configure_file(src/Config.in.h include/monomux/Config.h)
 install(FILES
     "${CMAKE_BINARY_DIR}/include/monomux/Config.h"
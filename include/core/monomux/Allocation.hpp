@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "monomux/Config.h"
+
+namespace monomux::alloc
+{
+
+/// The subsystems the allocations of the program are accounted to.
+enum class Tag : std::uint8_t
+{
+  /// Allocations outside of any scope.
+  Other,
+
+  /// The buffers of \p BufferedChannel, including the slabs of the rings.
+  Channel,
+  /// Encoding and decoding the control messages.
+  Message,
+  /// The state of the \p Server, e.g. the nodes of its lookup tables.
+  Server,
+  /// The registrations of the event loop.
+  Poll,
+  /// Formatting and queueing log messages.
+  Log,
+  // (If adding new tags, update TagCount and the names in Allocation.cpp!)
+};
+
+/// The number of \p Tag values, which are dense from \p 0.
+constexpr std::size_t TagCount = static_cast<std::size_t>(Tag::Log) + 1;
+
+/// \returns the human-readable name of \p T.
+const char* name(Tag T) noexcept;
+
+/// \returns whether the program was built with the allocations accounted.
+constexpr bool enabled() noexcept
+{
+#ifdef MONOMUX_ALLOCATION_ACCOUNTING
+  return true;
+#else  /* !MONOMUX_ALLOCATION_ACCOUNTING */
+  return false;
+#endif /* MONOMUX_ALLOCATION_ACCOUNTING */
+}
+
+/// The allocations accounted to a \p Tag, summed over every thread.
+struct Counters
+{
+  /// The bytes and the number of allocations not yet freed.
+  std::uint64_t LiveBytes = 0;
+  std::uint64_t LiveCount = 0;
+  /// The highest \p LiveBytes ever reached.
+  std::uint64_t PeakBytes = 0;
+  /// The bytes and the number of allocations ever made.
+  std::uint64_t TotalBytes = 0;
+  std::uint64_t TotalCount = 0;
+};
+
+/// \returns the current counters of every \p Tag, indexed by the tag.
+///
+/// \note The counters are read one by one while other threads keep
+/// allocating, so they are only consistent with each other if the program is
+/// quiescent.
+std::array<Counters, TagCount> snapshot() noexcept;
+
+/// Accounts an allocation of \p Bytes made outside of \p operator new, e.g.
+/// by a pool that maps its own memory, to \p T.
+void account(Tag T, std::size_t Bytes) noexcept;
+/// Accounts freeing an allocation of \p Bytes that was passed to
+/// \p account() with the same \p T.
+void release(Tag T, std::size_t Bytes) noexcept;
+
+namespace detail
+{
+
+inline thread_local Tag CurrentTag = Tag::Other;
+
+} // namespace detail
+
+/// \returns the \p Tag the allocations of the calling thread are accounted to.
+inline Tag current() noexcept { return detail::CurrentTag; }
+
+/// Accounts the allocations of the calling thread to a \p Tag for the
+/// lifetime of the object, after which the previous tag is restored.
+/// Allocations are accounted to the innermost scope.
+///
+/// Freeing is always accounted to the \p Tag of the allocation, regardless of
+/// the scope it happens in.
+class Scope
+{
+public:
+  explicit Scope(Tag T) noexcept
+    : Previous(std::exchange(detail::CurrentTag, T))
+  {}
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+  ~Scope() noexcept { detail::CurrentTag = Previous; }
+
+private:
+  Tag Previous;
+};
+
+} // namespace monomux::alloc
+
+#define MONOMUX_DETAIL_ALLOCATION_SCOPE_NAME2(LINE) AllocationScope##LINE
+#define MONOMUX_DETAIL_ALLOCATION_SCOPE_NAME(LINE)                             \
+  MONOMUX_DETAIL_ALLOCATION_SCOPE_NAME2(LINE)
+
+#ifdef MONOMUX_ALLOCATION_ACCOUNTING
+/// Accounts the allocations of the enclosing block to \p alloc::Tag::TAG.
+/// This costs a thread-local store on entry and exit, so it is fit for the
+/// hot paths of the program.
+#define MONOMUX_ALLOCATION_SCOPE(TAG)                                          \
+  ::monomux::alloc::Scope MONOMUX_DETAIL_ALLOCATION_SCOPE_NAME(__LINE__)       \
+  {                                                                            \
+    ::monomux::alloc::Tag::TAG                                                 \
+  }
+#else /* !MONOMUX_ALLOCATION_ACCOUNTING */
+#define MONOMUX_ALLOCATION_SCOPE(TAG) static_cast<void>(0)
+#endif /* MONOMUX_ALLOCATION_ACCOUNTING */
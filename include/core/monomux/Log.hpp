@@ -18,10 +18,14 @@
  */
 #pragma once
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <string_view>
 
+#include "monomux/Allocation.hpp"
 #include "monomux/Config.h"
 #include "monomux/Debug.h"
 
@@ -71,23 +75,35 @@ constexpr std::int8_t MinimumVerbosity = log::Default - log::Max - 1;
 
 /// The \p Logger class handles emitting log messages to an output device.
 ///
-/// \note This object is \b NOT thread-safe!
+/// \note Emitting messages may happen from multiple threads, but the
+/// configuration of this object is \b NOT thread-safe!
 class Logger
 {
 private:
   class OutputBuffer
   {
+#ifdef MONOMUX_ALLOCATION_ACCOUNTING
+    /// Formatting the message is accounted to the logs, for as long as the
+    /// buffer lives.
+    alloc::Scope Allocations{alloc::Tag::Log};
+#endif /* MONOMUX_ALLOCATION_ACCOUNTING */
     bool Discard;
-    std::ostream* OS;
+    Logger* Owner;
+    Severity S;
+    std::string_view Facility;
+    std::chrono::system_clock::time_point Time;
     std::ostringstream Buffer;
 
   public:
-    /// Wraps an output device into a log buffer.
+    /// Wraps the output of \p Owner into a log buffer.
     ///
     /// \param Discard Whether to throw the logged data away.
-    OutputBuffer(std::ostream& OS, bool Discard, std::string_view Prefix);
+    OutputBuffer(Logger& Owner,
+                 bool Discard,
+                 Severity S,
+                 std::string_view Facility);
 
-    /// Print the contents of the log buffer to the output device.
+    /// Hand the contents of the log buffer over to the owning \p Logger.
     ~OutputBuffer() noexcept(false);
 
     /// Print the contents of the fed value to the internal buffer.
@@ -102,6 +118,10 @@ private:
   /// A global instance of the logger.
   static std::unique_ptr<Logger> Singleton;
 
+  /// Formats the log messages on a background thread. Defined in the
+  /// implementation file.
+  class AsyncBackend;
+
 public:
   /// \returns a human-readable tag for the specified severity.
   static const char* levelName(Severity S) noexcept;
@@ -124,6 +144,7 @@ public:
   ///
   /// \see get()
   Logger(Severity SeverityLimit, std::ostream& OS);
+  ~Logger();
 
   Severity getLimit() const noexcept { return SeverityLimit; }
   void setLimit(Severity Limit) noexcept { SeverityLimit = Limit; }
@@ -132,6 +153,36 @@ public:
   /// output device.
   void setOutput(std::ostream& OS) noexcept { this->OS = &OS; }
 
+  /// The default limit of the memory taken by the queued messages of the
+  /// asynchronous backend.
+  static constexpr std::size_t DefaultAsyncCapacity = 1 << 20; // 1 MiB
+
+  /// Sets whether log messages are written to the output device by a
+  /// background thread.
+  ///
+  /// In asynchronous mode, emitting a message only formats its body and
+  /// pushes it into a lock-free queue. The prefix is formatted and the
+  /// message is written by the background thread, which flushes the output
+  /// device once per batch of messages instead of once per line. At most
+  /// \p Capacity bytes of messages are queued, messages beyond that are
+  /// dropped and counted. \p Fatal messages are written synchronously, after
+  /// every queued message.
+  ///
+  /// Turning asynchronous mode off writes the queued messages and stops the
+  /// background thread.
+  ///
+  /// \note The background thread does not survive a \p fork(), so the
+  /// child process of a \p fork() continues in synchronous mode.
+  void setAsynchronous(bool Async, std::size_t Capacity = DefaultAsyncCapacity);
+  bool isAsynchronous() const noexcept;
+
+  /// \returns the number of messages thrown away because the queue of the
+  /// asynchronous backend was full.
+  std::uint64_t droppedMessages() const noexcept;
+
+  /// Waits until the messages queued for asynchronous writing are written.
+  void flush();
+
   /// Starts printing a log message with the specified \p S severity.
   /// If the \p S severity is lower than the current severity limit, the message
   /// will be discarded.
@@ -140,6 +191,14 @@ public:
 private:
   Severity SeverityLimit;
   std::ostream* OS;
+  std::unique_ptr<AsyncBackend> Async;
+  std::uint64_t DroppedBefore = 0;
+
+  /// Writes or queues a finished message.
+  void emit(Severity S,
+            std::string_view Facility,
+            std::chrono::system_clock::time_point Time,
+            std::string Message);
 };
 
 #define MONOMUX_LOGGER_SHORTCUT(NAME, SEVERITY)                                \
@@ -0,0 +1,188 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "monomux/Config.h"
+
+#ifdef MONOMUX_USDT_PROBES
+#include <sys/sdt.h>
+#endif /* MONOMUX_USDT_PROBES */
+
+namespace monomux::trace
+{
+
+/// The identifiers of the tracepoints.
+enum class Event : std::uint16_t
+{
+  /// No event. Never recorded.
+  None,
+
+  /// An event loop woke up. \p Bytes is the number of events received.
+  LoopWake,
+  /// An event loop started handling the event on \p FD. \p Requested is \p 1
+  /// for incoming, \p 2 for outgoing, and \p 3 for bidirectional events.
+  LoopEvent,
+
+  /// \p Bytes were returned by a \p BufferedChannel::read() of \p Requested
+  /// bytes.
+  ChannelRead,
+  /// \p Bytes were moved into the buffer by a \p BufferedChannel::load() of
+  /// \p Requested bytes.
+  ChannelLoad,
+  /// \p Bytes were sent by a \p BufferedChannel::write() of \p Requested
+  /// bytes.
+  ChannelWrite,
+  /// \p Bytes were sent by a \p BufferedChannel::tryWrite() of \p Requested
+  /// bytes.
+  ChannelTryWrite,
+  /// \p Bytes were sent from the \p Requested bytes in the write buffer.
+  ChannelFlush,
+  /// \p Bytes remained unsent and were moved to the write buffer, which now
+  /// holds \p Requested bytes.
+  ChannelBuffer,
+  /// A buffer of \p Requested bytes was found to overflow.
+  ChannelOverflow,
+  // (If adding new events, update EventCount and the names in Trace.cpp!)
+};
+
+/// The number of \p Event values, which are dense from \p 0.
+constexpr std::size_t EventCount =
+  static_cast<std::size_t>(Event::ChannelOverflow) + 1;
+
+/// \returns the human-readable name of \p E.
+const char* name(Event E) noexcept;
+
+/// A single fixed-size entry in the trace.
+struct Record
+{
+  /// The time of the event, in nanoseconds of \p std::chrono::steady_clock.
+  std::uint64_t Timestamp;
+  /// The file descriptor the event happened on, or \p -1.
+  std::int32_t FD;
+  Event Id;
+  /// The index of the thread that recorded the event. Only filled by
+  /// \p collect().
+  std::uint16_t Thread;
+  std::uint64_t Requested;
+  std::uint64_t Bytes;
+};
+static_assert(sizeof(Record) == 32, "Records should stay compact!");
+
+/// A fixed-capacity circular buffer of the most recent \p Record entries of a
+/// single thread. The owning thread is the only writer, and pushing is
+/// wait-free. Readers from other threads can take a snapshot at any time, but
+/// the records overwritten during the copy are dropped from it.
+class Ring
+{
+public:
+  static constexpr std::size_t Capacity = 4096;
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of 2!");
+
+  void push(const Record& R) noexcept
+  {
+    const std::uint64_t H = Head.load(std::memory_order_relaxed);
+    Records[H & (Capacity - 1)] = R;
+    Head.store(H + 1, std::memory_order_release);
+  }
+
+  /// \returns the number of records ever pushed, including the already
+  /// overwritten ones.
+  std::uint64_t written() const noexcept
+  {
+    return Head.load(std::memory_order_acquire);
+  }
+
+  /// Appends the records still in the ring to \p Out, oldest first.
+  void snapshot(std::vector<Record>& Out) const;
+
+private:
+  std::array<Record, Capacity> Records{};
+  std::atomic<std::uint64_t> Head = 0;
+};
+
+namespace detail
+{
+
+inline thread_local Ring* CurrentRing = nullptr;
+
+/// Creates the \p Ring of the calling thread, which lives until the end of
+/// the process so its records can be collected after the thread exited.
+Ring& registerThread();
+
+} // namespace detail
+
+/// Appends a record of \p Id to the ring of the calling thread.
+inline void
+record(Event Id, int FD, std::uint64_t Requested, std::uint64_t Bytes)
+{
+  Ring* R = detail::CurrentRing;
+  if (!R)
+    R = &detail::registerThread();
+
+  const auto Now = std::chrono::steady_clock::now().time_since_epoch();
+  R->push(Record{static_cast<std::uint64_t>(
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(Now)
+                     .count()),
+                 static_cast<std::int32_t>(FD),
+                 Id,
+                 0,
+                 Requested,
+                 Bytes});
+}
+
+/// \returns the records of every thread that ever recorded one, ordered by
+/// their timestamp.
+///
+/// \note The rings of the other threads are read without stopping them, so
+/// the tracing threads should be quiescent (e.g. paused workers of a
+/// \p Server) for the most recent records to be reliable.
+std::vector<Record> collect();
+
+} // namespace monomux::trace
+
+#ifdef MONOMUX_TRACEPOINTS
+#ifdef MONOMUX_USDT_PROBES
+#define MONOMUX_DETAIL_USDT(EVENT, FD, REQUESTED, BYTES)                       \
+  DTRACE_PROBE3(monomux, EVENT, FD, REQUESTED, BYTES)
+#else /* !MONOMUX_USDT_PROBES */
+#define MONOMUX_DETAIL_USDT(EVENT, FD, REQUESTED, BYTES)
+#endif /* MONOMUX_USDT_PROBES */
+
+/// Records a \p trace::Record of \p trace::Event::EVENT into the trace of the
+/// current thread. This costs a clock read and a few stores, so unlike
+/// \p MONOMUX_TRACE_LOG it is fit for the hot paths of the program.
+#define MONOMUX_TRACEPOINT(EVENT, FD, REQUESTED, BYTES)                        \
+  do                                                                           \
+  {                                                                            \
+    MONOMUX_DETAIL_USDT(EVENT, FD, REQUESTED, BYTES);                          \
+    ::monomux::trace::record(                                                  \
+      ::monomux::trace::Event::EVENT, FD, REQUESTED, BYTES);                   \
+  } while (false)
+#else /* !MONOMUX_TRACEPOINTS */
+#define MONOMUX_TRACEPOINT(EVENT, FD, REQUESTED, BYTES)                        \
+  do                                                                           \
+  {                                                                            \
+  } while (false)
+#endif /* MONOMUX_TRACEPOINTS */
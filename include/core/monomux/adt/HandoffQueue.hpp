@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace monomux
+{
+
+/// A multiple-producer, single-consumer queue that hands elements over from
+/// arbitrary threads to the one thread owning the queue.
+///
+/// Pushing is lock-free: elements are prepended to an intrusive list with a
+/// compare-and-swap loop. The consumer never removes individual elements, but
+/// detaches the entire list at once, so the list is immune to the \e ABA
+/// problem.
+template <typename T> class HandoffQueue
+{
+  struct Node
+  {
+    T Value;
+    Node* Next;
+  };
+
+  std::atomic<Node*> Head = nullptr;
+
+  static void release(Node* N) noexcept
+  {
+    while (N)
+    {
+      Node* Next = N->Next;
+      delete N;
+      N = Next;
+    }
+  }
+
+public:
+  HandoffQueue() = default;
+  HandoffQueue(const HandoffQueue&) = delete;
+  HandoffQueue(HandoffQueue&&) = delete;
+  HandoffQueue& operator=(const HandoffQueue&) = delete;
+  HandoffQueue& operator=(HandoffQueue&&) = delete;
+  ~HandoffQueue() { release(Head.exchange(nullptr)); }
+
+  /// \returns whether the queue is empty at the time of the call.
+  [[nodiscard]] bool empty() const noexcept
+  {
+    return Head.load(std::memory_order_acquire) == nullptr;
+  }
+
+  /// Adds \p Value to the queue. This function may be called from any thread.
+  ///
+  /// \returns whether the queue was empty before the push, i.e. whether the
+  /// consumer might need to be woken up.
+  bool push(T Value)
+  {
+    Node* N = new Node{std::move(Value), Head.load(std::memory_order_relaxed)};
+    while (!Head.compare_exchange_weak(
+      N->Next, N, std::memory_order_release, std::memory_order_relaxed))
+      ;
+    return N->Next == nullptr;
+  }
+
+  /// Removes every element from the queue.
+  ///
+  /// \returns the removed elements, in the order they were pushed.
+  ///
+  /// \note This function must only be called by the consumer thread.
+  [[nodiscard]] std::vector<T> take()
+  {
+    Node* N = Head.exchange(nullptr, std::memory_order_acquire);
+    std::vector<T> R;
+    for (Node* It = N; It; It = It->Next)
+      R.emplace_back(std::move(It->Value));
+    release(N);
+
+    std::reverse(R.begin(), R.end());
+    return R;
+  }
+};
+
+} // namespace monomux
@@ -18,16 +18,24 @@
  */
 #pragma once
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <optional>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "monomux/adt/MemberFunctionHelper.hpp"
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/system/SlabPool.hpp"
+#include "monomux/system/Time.hpp"
 
 namespace monomux
 {
@@ -122,7 +130,7 @@ protected:
       return false;
 
     static constexpr std::size_t TimeThresholdSeconds = 60;
-    if (std::chrono::system_clock::now() - LastAccess >=
+    if (LoopClock::now() - LastAccess >=
         std::chrono::seconds(TimeThresholdSeconds))
       // Consider the buffer for shrinking if operations were successful without
       // accessing the buffer for a sufficient amount of time.
@@ -160,7 +168,7 @@ private:
 
   std::chrono::time_point<std::chrono::system_clock> LastAccess;
 
-  void markAccess() noexcept { LastAccess = std::chrono::system_clock::now(); }
+  void markAccess() noexcept { LastAccess = LoopClock::now(); }
 
   /// Marks the current size as the peak of the current zone, if sufficient.
   void mayBePeak() noexcept
@@ -189,6 +197,17 @@ private:
   }
 };
 
+/// Deleter for the storage of \p RingBuffer allocated from the \p SlabPool.
+struct RingBufferFree
+{
+  std::size_t Bytes = 0;
+
+  void operator()(void* Ptr) const noexcept
+  {
+    SlabPool::deallocate(Ptr, Bytes);
+  }
+};
+
 } // namespace detail
 
 /// A ring buffer based backing store that can contain an arbitrary count of
@@ -221,15 +240,43 @@ private:
 /// from the backing data structure.
 ///
 /// \tparam T The element type to store. Ring storage works best if T is
-/// default-constructible and this construction is cheap.
+/// default-constructible and this construction is cheap. If \p T is a trivial
+/// type, such as \p char, elements are copied in bulk with \p std::memcpy()
+/// and the storage is drawn from the \p SlabPool.
 template <class T> class RingBuffer : public detail::RingBufferBase
 {
-  using StorageType = std::unique_ptr<T[]>;
+  /// Whether the elements can be copied as raw memory, and the storage can be
+  /// allocated without constructing the elements.
+  static constexpr bool Bulk = std::is_trivial_v<T>;
+  using StorageType =
+    std::conditional_t<Bulk,
+                       std::unique_ptr<T[], detail::RingBufferFree>,
+                       std::unique_ptr<T[]>>;
   static constexpr bool NothrowAssignable = std::is_nothrow_assignable_v<T, T>;
 
 public:
+  /// A non-owning view of elements laid out contiguously in the storage of
+  /// the buffer.
+  struct Segment
+  {
+    const T* Begin = nullptr;
+    std::size_t Size = 0;
+
+    bool empty() const noexcept { return Size == 0; }
+  };
+
+  /// A non-owning view of writable slots laid out contiguously in the storage
+  /// of the buffer.
+  struct MutableSegment
+  {
+    T* Begin = nullptr;
+    std::size_t Size = 0;
+
+    bool empty() const noexcept { return Size == 0; }
+  };
+
   RingBuffer(std::size_t Capacity)
-    : RingBufferBase(Capacity), StorageWithOriginalCapacity(new T[Capacity]),
+    : RingBufferBase(Capacity), StorageWithOriginalCapacity(allocate(Capacity)),
       Origin(physicalBegin()), End(physicalBegin())
   {}
 
@@ -298,8 +345,11 @@ public:
 
   void clear() noexcept(NothrowAssignable)
   {
-    for (std::size_t I = 0; I < originalCapacity(); ++I)
-      StorageWithOriginalCapacity[I] = T{};
+    if constexpr (!Bulk)
+      // Release the resources held by the elements. Trivial elements left
+      // behind are never observed.
+      for (std::size_t I = 0; I < originalCapacity(); ++I)
+        StorageWithOriginalCapacity[I] = T{};
     zeroSize();
     tryCleanup();
   }
@@ -389,6 +439,12 @@ public:
 
     std::vector<T> V;
     V.reserve(N);
+    if constexpr (Bulk)
+    {
+      for (const Segment& S : peekFrontSegments(N))
+        V.insert(V.end(), S.Begin, S.Begin + S.Size);
+      return V;
+    }
 
     T* P = Origin;
     while (N > 0)
@@ -404,12 +460,105 @@ public:
     return V;
   }
 
+  /// Obtain views into at most \p N elements from the beginning of the buffer,
+  /// without copying or consuming them. As the storage might wrap around the
+  /// physical end, the elements are returned in at most \b two contiguous
+  /// segments, in order. Unused segments are empty.
+  ///
+  /// \note The returned views are invalidated by any operation that modifies
+  /// the buffer.
+  ///
+  /// \see peekFront, dropFront
+  std::array<Segment, 2> peekFrontSegments(std::size_t N) const noexcept
+  {
+    if (N > Size)
+      N = Size;
+
+    std::array<Segment, 2> Segments;
+    if (N == 0)
+      return Segments;
+
+    const auto UntilPhysicalEnd =
+      static_cast<std::size_t>(physicalEnd() - Origin.get());
+    Segments[0].Begin = Origin.get();
+    Segments[0].Size = std::min(N, UntilPhysicalEnd);
+    if (N > Segments[0].Size)
+    {
+      // The requested range wraps around the physical end of the storage.
+      Segments[1].Begin = physicalBegin();
+      Segments[1].Size = N - Segments[0].Size;
+    }
+    return Segments;
+  }
+
+  /// Obtain views into exactly \p N unused slots at the end of the buffer,
+  /// growing the storage if needed. The slots can be filled in-place (e.g. by
+  /// a system call), after which \p commitBack() must be called to append
+  /// them to the buffer. As the free space might wrap around the physical end,
+  /// the slots are returned in at most \b two contiguous segments, in order.
+  ///
+  /// \note The returned views are invalidated by any operation that modifies
+  /// the buffer.
+  ///
+  /// \see commitBack
+  std::array<MutableSegment, 2> reserveBackSegments(std::size_t N)
+  {
+    std::array<MutableSegment, 2> Segments;
+    if (N == 0)
+      return Segments;
+    if (Size + N > Capacity)
+      grow(Size + N);
+
+    T* P = nextSlot();
+    Segments[0].Begin = P;
+    if (P >= Origin.get())
+    {
+      // The free space is split by the physical end.
+      Segments[0].Size =
+        std::min(N, static_cast<std::size_t>(physicalEnd() - P));
+      if (N > Segments[0].Size)
+      {
+        Segments[1].Begin = physicalBegin();
+        Segments[1].Size = N - Segments[0].Size;
+      }
+    }
+    else
+      Segments[0].Size = N;
+    return Segments;
+  }
+
+  /// Appends the first \p N slots previously obtained from
+  /// \p reserveBackSegments() to the logical end of the buffer.
+  ///
+  /// \see reserveBackSegments
+  void commitBack(std::size_t N) noexcept
+  {
+    assert(Size + N <= Capacity && "commitBack() over the reserved space!");
+    if (N == 0)
+      return;
+
+    T* P = nextSlot();
+    const auto UntilPhysicalEnd =
+      static_cast<std::size_t>(physicalEnd() - P);
+    if (N < UntilPhysicalEnd)
+      End = P + N;
+    else
+      End = physicalBegin() + (N - UntilPhysicalEnd);
+    addSize(N);
+  }
+
   /// Push the contents of \p V to the end of the buffer.
   void putBack(std::vector<T> V) { putBack(V.data(), V.size()); }
 
   /// Push \p N elements starting at \p Ptr to the end of the buffer.
   void putBack(T* Ptr, std::size_t N)
   {
+    if constexpr (Bulk)
+    {
+      putBack(static_cast<const T*>(Ptr), N);
+      return;
+    }
+
     if (Size + N > Capacity)
       grow(Size + N);
 
@@ -434,6 +583,19 @@ public:
   /// Push \p N elements starting at \p Ptr to the end of the buffer.
   void putBack(const T* Ptr, std::size_t N)
   {
+    if constexpr (Bulk)
+    {
+      for (const MutableSegment& S : reserveBackSegments(N))
+      {
+        if (S.empty())
+          break;
+        std::memcpy(S.Begin, Ptr, S.Size * sizeof(T));
+        Ptr += S.Size;
+      }
+      commitBack(N);
+      return;
+    }
+
     if (Size + N > Capacity)
       grow(Size + N);
 
@@ -485,6 +647,17 @@ private:
   }
   MEMBER_FN_NON_CONST_0(StorageType&, getStorage);
 
+  /// Allocates a storage for \p N elements. The elements of trivial types are
+  /// not initialised.
+  static StorageType allocate(std::size_t N)
+  {
+    if constexpr (Bulk)
+      return StorageType{static_cast<T*>(SlabPool::allocate(N * sizeof(T))),
+                         detail::RingBufferFree{N * sizeof(T)}};
+    else
+      return StorageType{new T[N]};
+  }
+
   T* physicalBegin() const noexcept { return getStorage().get(); }
   T* physicalEnd() const noexcept { return (getStorage().get()) + Capacity; }
 
@@ -550,8 +723,6 @@ private:
   /// non-zero.
   void grow(std::size_t NewCapacityAtLeast = 0)
   {
-    rotateToPhysical();
-
     std::size_t NewCapacity = Capacity;
     if (NewCapacityAtLeast == 0 || NewCapacityAtLeast < Capacity)
       NewCapacity = Capacity * 2;
@@ -562,7 +733,14 @@ private:
     if (NewCapacity <= Capacity)
       return;
 
-    StorageType New{new T[NewCapacity]};
+    if constexpr (Bulk)
+    {
+      growBulk(NewCapacity);
+      return;
+    }
+
+    rotateToPhysical();
+    StorageType New{allocate(NewCapacity)};
     for (std::size_t I = 0; I < Size; ++I)
       New[I] = std::move(getStorage()[I]);
 
@@ -583,6 +761,29 @@ private:
     End = Origin + Size;
   }
 
+  /// Grows the storage of a buffer of trivial elements to \p NewCapacity, which
+  /// must be at least twice the current capacity, copying the elements in bulk.
+  void growBulk(std::size_t NewCapacity)
+  {
+    // The slabs are not resized in place, so the elements are copied to the
+    // beginning of the new storage.
+    StorageType New{allocate(NewCapacity)};
+    T* P = New.get();
+    for (const Segment& S : peekFrontSegments(Size))
+    {
+      if (S.empty())
+        break;
+      std::memcpy(P, S.Begin, S.Size * sizeof(T));
+      P += S.Size;
+    }
+    GrowingStorage = std::move(New);
+    UsingGrowingStorage = true;
+
+    Capacity = NewCapacity;
+    Origin = physicalBegin();
+    End = Origin + Size;
+  }
+
   /// Shrinks the buffer to be able to store exactly \p NewCapacity elements.
   void shrink(std::size_t NewCapacity)
   {
@@ -601,7 +802,7 @@ private:
     else
     {
       UsingGrowingStorage = true;
-      StorageType New{new T[NewCapacity]};
+      StorageType New{allocate(NewCapacity)};
       std::swap(GrowingStorage, New);
     }
 
@@ -0,0 +1,266 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace monomux
+{
+
+/// A container that stores its elements in chunks of \p ChunkSize contiguous
+/// slots, and identifies them with generational handles.
+///
+/// A chunk is never moved or released while the container lives, so the
+/// address of an element is stable from its insertion until its erasure, and
+/// the slots of erased elements are reused by later insertions without
+/// touching the allocator. A \p Handle remembers the generation of the slot it
+/// was made for, so a handle kept after its element was erased does not
+/// resolve to the element that reused the slot.
+///
+/// Iteration visits the elements in the order of their slots, which is not the
+/// order of insertion once slots are reused.
+template <typename T, std::size_t ChunkSize = 64> class SlotMap
+{
+  static_assert(ChunkSize > 0, "Chunks must hold elements!");
+
+public:
+  /// Identifies an element of the container.
+  struct Handle
+  {
+    std::uint32_t Index = 0;
+    /// The generation of the slot when the element was inserted. Valid
+    /// handles are never generation \p 0.
+    std::uint32_t Generation = 0;
+
+    explicit operator bool() const noexcept { return Generation != 0; }
+    bool operator==(const Handle& RHS) const noexcept
+    {
+      return Index == RHS.Index && Generation == RHS.Generation;
+    }
+    bool operator!=(const Handle& RHS) const noexcept
+    {
+      return !(*this == RHS);
+    }
+  };
+
+private:
+  static constexpr std::uint32_t NoSlot = ~std::uint32_t{0};
+
+  struct Slot
+  {
+    alignas(T) unsigned char Storage[sizeof(T)];
+    std::uint32_t Generation = 0;
+    /// The next slot in the list of free slots, if this slot is free.
+    std::uint32_t NextFree = NoSlot;
+    bool Live = false;
+
+    T& get() noexcept { return *std::launder(reinterpret_cast<T*>(Storage)); }
+    const T& get() const noexcept
+    {
+      return *std::launder(reinterpret_cast<const T*>(Storage));
+    }
+  };
+  static_assert(std::is_standard_layout_v<Slot>,
+                "The element must be at the beginning of the slot!");
+
+  struct Chunk
+  {
+    Slot Slots[ChunkSize];
+  };
+
+  std::vector<std::unique_ptr<Chunk>> Chunks;
+  /// The number of slots that were ever used, all of them in the beginning of
+  /// the chunks.
+  std::uint32_t UsedSlots = 0;
+  /// The most recently freed slot, which is reused first, as it is the most
+  /// likely to be in the cache still.
+  std::uint32_t FreeHead = NoSlot;
+  std::size_t Count = 0;
+
+  Slot& slot(std::uint32_t Index) noexcept
+  {
+    return Chunks[Index / ChunkSize]->Slots[Index % ChunkSize];
+  }
+  const Slot& slot(std::uint32_t Index) const noexcept
+  {
+    return Chunks[Index / ChunkSize]->Slots[Index % ChunkSize];
+  }
+
+  const Slot* find(Handle H) const noexcept
+  {
+    if (H.Index >= UsedSlots)
+      return nullptr;
+    const Slot& S = slot(H.Index);
+    return S.Live && S.Generation == H.Generation ? &S : nullptr;
+  }
+
+  template <bool Const> class Iterator
+  {
+    using Container = std::conditional_t<Const, const SlotMap, SlotMap>;
+    Container* Map;
+    std::uint32_t Index;
+
+    void skipFree() noexcept
+    {
+      while (Index < Map->UsedSlots && !Map->slot(Index).Live)
+        ++Index;
+    }
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const T*, T*>;
+    using reference = std::conditional_t<Const, const T&, T&>;
+
+    Iterator(Container* Map, std::uint32_t Index) noexcept
+      : Map(Map), Index(Index)
+    {
+      skipFree();
+    }
+
+    reference operator*() const noexcept { return Map->slot(Index).get(); }
+    pointer operator->() const noexcept { return &**this; }
+    Iterator& operator++() noexcept
+    {
+      ++Index;
+      skipFree();
+      return *this;
+    }
+    Iterator operator++(int) noexcept
+    {
+      Iterator Old = *this;
+      ++*this;
+      return Old;
+    }
+    bool operator==(const Iterator& RHS) const noexcept
+    {
+      return Index == RHS.Index;
+    }
+    bool operator!=(const Iterator& RHS) const noexcept
+    {
+      return Index != RHS.Index;
+    }
+  };
+
+public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  SlotMap() = default;
+  SlotMap(const SlotMap&) = delete;
+  SlotMap(SlotMap&&) = delete;
+  SlotMap& operator=(const SlotMap&) = delete;
+  SlotMap& operator=(SlotMap&&) = delete;
+  ~SlotMap() { clear(); }
+
+  [[nodiscard]] bool empty() const noexcept { return Count == 0; }
+  std::size_t size() const noexcept { return Count; }
+  /// \returns the number of elements the container can hold without
+  /// allocating.
+  std::size_t capacity() const noexcept { return Chunks.size() * ChunkSize; }
+
+  /// Constructs a new element from \p Args in a free slot.
+  ///
+  /// \returns the inserted element, which stays at the same address until it
+  /// is erased.
+  template <typename... Args> T& emplace(Args&&... As)
+  {
+    const bool Reuse = FreeHead != NoSlot;
+    if (!Reuse && UsedSlots == capacity())
+      Chunks.emplace_back(std::make_unique<Chunk>());
+    const std::uint32_t Index = Reuse ? FreeHead : UsedSlots;
+    Slot& S = slot(Index);
+    T* Element = new (S.Storage) T(std::forward<Args>(As)...);
+
+    if (Reuse)
+      FreeHead = S.NextFree;
+    else
+      ++UsedSlots;
+    if (++S.Generation == 0)
+      S.Generation = 1;
+    S.Live = true;
+    ++Count;
+    return *Element;
+  }
+
+  /// \returns the handle of \p Element, which must be stored in the container.
+  Handle handle(const T& Element) const noexcept
+  {
+    const auto* S = reinterpret_cast<const Slot*>(&Element);
+    const std::less<const Slot*> Before;
+    for (std::size_t C = 0; C < Chunks.size(); ++C)
+    {
+      const Slot* First = Chunks[C]->Slots;
+      if (!Before(S, First) && Before(S, First + ChunkSize))
+        return Handle{static_cast<std::uint32_t>(C * ChunkSize + (S - First)),
+                      S->Generation};
+    }
+    return Handle{};
+  }
+
+  /// \returns the element identified by \p H, or \p nullptr if it was erased.
+  T* get(Handle H) noexcept
+  {
+    return const_cast<T*>(std::as_const(*this).get(H));
+  }
+  const T* get(Handle H) const noexcept
+  {
+    const Slot* S = find(H);
+    return S ? &S->get() : nullptr;
+  }
+
+  /// Destroys the element identified by \p H, if it was not erased yet.
+  void erase(Handle H) noexcept
+  {
+    if (!find(H))
+      return;
+    Slot& S = slot(H.Index);
+    S.get().~T();
+    S.Live = false;
+    S.NextFree = FreeHead;
+    FreeHead = H.Index;
+    --Count;
+  }
+  /// Destroys \p Element, which must be stored in the container.
+  void erase(const T& Element) noexcept { erase(handle(Element)); }
+
+  /// Destroys every element, but keeps the chunks for reuse.
+  void clear() noexcept
+  {
+    for (std::uint32_t I = 0; I < UsedSlots; ++I)
+      erase(Handle{I, slot(I).Generation});
+  }
+
+  iterator begin() noexcept { return iterator{this, 0}; }
+  iterator end() noexcept { return iterator{this, UsedSlots}; }
+  const_iterator begin() const noexcept { return const_iterator{this, 0}; }
+  const_iterator end() const noexcept
+  {
+    return const_iterator{this, UsedSlots};
+  }
+};
+
+} // namespace monomux
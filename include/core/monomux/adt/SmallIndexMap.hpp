@@ -21,6 +21,7 @@
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <type_traits>
 #include <variant>
@@ -31,11 +32,70 @@
 namespace monomux
 {
 
+namespace detail
+{
+
+/// Marks the indices of a block of \p N elements that were stored into, so
+/// the occupied ones can be visited one word at a time.
+template <std::size_t N, bool Enabled> class OccupancyBitmap
+{
+  static constexpr std::size_t WordBits = 64;
+  std::array<std::uint64_t, (N + WordBits - 1) / WordBits> Words{};
+
+public:
+  void set(std::size_t I) noexcept
+  {
+    Words[I / WordBits] |= std::uint64_t{1} << (I % WordBits);
+  }
+  void reset(std::size_t I) noexcept
+  {
+    Words[I / WordBits] &= ~(std::uint64_t{1} << (I % WordBits));
+  }
+  void clear() noexcept { Words.fill(0); }
+
+  /// Calls \p F with every marked index, in increasing order.
+  template <typename Fn> void forEach(Fn&& F) const
+  {
+    for (std::size_t W = 0; W < Words.size(); ++W)
+      for (std::uint64_t Bits = Words[W]; Bits; Bits &= Bits - 1)
+        F(W * WordBits + static_cast<std::size_t>(__builtin_ctzll(Bits)));
+  }
+};
+
+/// The disabled bitmap, which stores nothing and makes every visit a full
+/// scan.
+template <std::size_t N> class OccupancyBitmap<N, false>
+{
+public:
+  void set(std::size_t /* I */) noexcept {}
+  void reset(std::size_t /* I */) noexcept {}
+  void clear() noexcept {}
+
+  template <typename Fn> void forEach(Fn&& F) const
+  {
+    for (std::size_t I = 0; I < N; ++I)
+      F(I);
+  }
+};
+
+} // namespace detail
+
 /// An implementation of a \p std::map where keys are fixed to be unsigned
 /// integer types. In addition, when the \p size() of the map is less than \p N,
 /// lookup is small buffer optimised to be done against an \p std::array
 /// instead.
 ///
+/// If \p PageCount is not \p 0, keys beyond the small representation are
+/// first stored in a paged representation, which is a table of \p PageCount
+/// arrays of \p N elements each, allocated on demand as keys are mapped into
+/// their range. Only keys that do not fit into \p N * \p PageCount force the
+/// node-based large representation.
+///
+/// \tparam TrackOccupancy Whether to keep a bitmap of the occupied indices of
+/// the directly indexed representations, so \p clear(), \p forEach() and the
+/// conversions between representations only visit the occupied elements,
+/// instead of every one of the \p N indices.
+///
 /// \tparam StoreInPlace Whether to store the elements in-place in the backing
 /// data structures. Storing elements in-place allows greater locality, but
 /// makes iterators and references to the added data prone to invalidation.
@@ -50,7 +110,9 @@ template <typename T,
           std::size_t N,
           bool StoreInPlace = true,
           bool IntrusiveDefaultSentinel = std::is_pointer_v<T>,
-          typename KeyTy = std::size_t>
+          typename KeyTy = std::size_t,
+          std::size_t PageCount = 0,
+          bool TrackOccupancy = false>
 class SmallIndexMap
 {
   /// The threshold at which point the small representation will be re-engaged.
@@ -84,8 +146,24 @@ class SmallIndexMap
                 "and moveable.");
 
   using SmallRepresentation = std::array<E, N>;
+  using Bitmap = detail::OccupancyBitmap<N, TrackOccupancy>;
+  struct Page
+  {
+    SmallRepresentation Elements{};
+    Bitmap Occupied;
+    /// The number of elements added into the page.
+    std::size_t Count = 0;
+  };
+  using PagedRepresentation = std::vector<std::unique_ptr<Page>>;
   using LargeRepresentation = std::map<KeyTy, E>;
-  std::variant<SmallRepresentation, LargeRepresentation> Storage;
+  std::variant<SmallRepresentation, PagedRepresentation, LargeRepresentation>
+    Storage;
+
+  /// The first key that does not fit into the paged representation.
+  static constexpr std::size_t PagedKeyEnd = N * PageCount;
+
+  /// The occupied indices of the small representation.
+  Bitmap SmallOccupied;
 
   /// The number of mapped elements.
   std::size_t Size = 0;
@@ -104,9 +182,19 @@ public:
   {
     return std::holds_alternative<SmallRepresentation>(Storage);
   }
+  /// \returns Whether the data structure is currently in the paged
+  /// representation. In this mode, access of data is a constant operation,
+  /// with an additional indirection.
+  bool isPaged() const noexcept
+  {
+    return std::holds_alternative<PagedRepresentation>(Storage);
+  }
   /// \returns Whether the data structure is currently in the large
   /// representation. In this mode, access of data is a logarithmic operation.
-  bool isLarge() const noexcept { return !isSmall(); }
+  bool isLarge() const noexcept
+  {
+    return std::holds_alternative<LargeRepresentation>(Storage);
+  }
 
   /// \returns the size of the container, i.e. the number of elements added
   /// into it.
@@ -128,6 +216,11 @@ public:
         return false;
       return isMapped(getSmallRepr()->at(Key));
     }
+    if (isPaged())
+    {
+      const E* Elem = getPagedElement(Key);
+      return Elem && isMapped(*Elem);
+    }
 
     return getLargeRepr()->find(Key) != getLargeRepr()->end();
   }
@@ -149,24 +242,36 @@ public:
     {
       if (Key >= N)
       {
-        convertToLarge();
+        convertOutOfSmall(Key);
         return set(Key, std::forward<Arg>(Args)...);
       }
 
       E& Elem = getSmallRepr()->at(Key);
       if (!isMapped(Elem))
+      {
         ++Size;
-
-      if constexpr (!NeedsMaybe)
-        Elem = T{std::forward<Arg>(Args)...};
-      else
+        SmallOccupied.set(Key);
+      }
+      assign(Elem, std::forward<Arg>(Args)...);
+      return;
+    }
+    if (isPaged())
+    {
+      if (Key >= PagedKeyEnd)
       {
-        if constexpr (StoreInPlace)
-          Elem = std::optional<T>{std::in_place, std::forward<Arg>(Args)...};
-        else
-          Elem = std::make_unique<T>(std::forward<Arg>(Args)...);
+        convertToLarge();
+        return set(Key, std::forward<Arg>(Args)...);
       }
 
+      Page& P = getOrAllocatePage(*getPagedRepr(), Key);
+      E& Elem = P.Elements[Key % N];
+      if (!isMapped(Elem))
+      {
+        ++Size;
+        ++P.Count;
+        P.Occupied.set(Key % N);
+      }
+      assign(Elem, std::forward<Arg>(Args)...);
       return;
     }
 
@@ -191,16 +296,7 @@ public:
       return;
     }
 
-    if constexpr (IntrusiveDefaultSentinel)
-      It->second = T{std::forward<Arg>(Args)...};
-    else
-    {
-      if constexpr (StoreInPlace)
-        It->second =
-          std::optional<T>{std::in_place, std::forward<Arg>(Args)...};
-      else
-        It->second = std::make_unique<T>(std::forward<Arg>(Args)...);
-    }
+    assign(It->second, std::forward<Arg>(Args)...);
   }
 
   /// Deletes the element mapped to \p Key if such element exists
@@ -219,12 +315,30 @@ public:
       if (!isMapped(Elem))
         return;
 
-      if constexpr (IntrusiveDefaultSentinel)
-        Elem = T{};
-      else
-        Elem.reset();
+      unmap(Elem);
+      SmallOccupied.reset(Key);
+      --Size;
+      return;
+    }
+    if (isPaged())
+    {
+      PagedRepresentation& PR = *getPagedRepr();
+      const std::size_t PageIndex = Key / N;
+      E* Elem = getPagedElement(Key);
+      if (!Elem || !isMapped(*Elem))
+        return;
 
+      unmap(*Elem);
+      PR[PageIndex]->Occupied.reset(Key % N);
       --Size;
+      if (--PR[PageIndex]->Count == 0 && PageIndex != 0)
+      {
+        // The first page is kept, as it becomes the small representation.
+        PR[PageIndex].reset();
+        while (!PR.back())
+          PR.pop_back();
+      }
+      convertToSmallConditional();
       return;
     }
 
@@ -242,18 +356,21 @@ public:
   {
     if (isSmall())
     {
-      for (KeyTy K = 0; K < N; ++K)
-      {
-        E& Elem = getSmallRepr()->at(K);
-        if constexpr (IntrusiveDefaultSentinel)
-          Elem = T{};
-        else
-          Elem.reset();
-      }
+      SmallRepresentation& SR = *getSmallRepr();
+      SmallOccupied.forEach([&SR](std::size_t I) { unmap(SR[I]); });
+      SmallOccupied.clear();
 
       Size = 0;
       return;
     }
+    if (isPaged())
+    {
+      Storage.template emplace<SmallRepresentation>(SmallRepresentation{});
+      fillSmallRepresentation();
+      SmallOccupied.clear();
+      Size = 0;
+      return;
+    }
 
     getLargeRepr()->clear();
     Size = 0;
@@ -275,6 +392,14 @@ public:
 
       return &unwrap(Elem);
     }
+    if (isPaged())
+    {
+      const E* Elem = getPagedElement(Key);
+      if (!Elem || !isMapped(*Elem))
+        return nullptr;
+
+      return &unwrap(*Elem);
+    }
 
     auto It = getLargeRepr()->find(Key);
     if (It == getLargeRepr()->end())
@@ -317,7 +442,7 @@ public:
     {
       if (Key >= N)
       {
-        convertToLarge();
+        convertOutOfSmall(Key);
         return operator[](Key);
       }
 
@@ -326,6 +451,27 @@ public:
       {
         Elem = constructElement();
         ++Size;
+        SmallOccupied.set(Key);
+      }
+
+      return unwrap(Elem);
+    }
+    if (isPaged())
+    {
+      if (Key >= PagedKeyEnd)
+      {
+        convertToLarge();
+        return operator[](Key);
+      }
+
+      Page& P = getOrAllocatePage(*getPagedRepr(), Key);
+      E& Elem = P.Elements[Key % N];
+      if (!isMapped(Elem))
+      {
+        Elem = constructElement();
+        ++Size;
+        ++P.Count;
+        P.Occupied.set(Key % N);
       }
 
       return unwrap(Elem);
@@ -340,7 +486,55 @@ public:
     return unwrap(It->second);
   }
 
+  /// Calls \p F with the key and a non-mutable reference to every mapped
+  /// element, in increasing order of keys.
+  ///
+  /// If \p TrackOccupancy is \p true, the directly indexed representations
+  /// only visit the indices that were stored into.
+  template <typename Fn> void forEach(Fn&& F) const
+  {
+    forEachImpl(*this, std::forward<Fn>(F));
+  }
+  /// Calls \p F with the key and a mutable reference to every mapped element,
+  /// in increasing order of keys.
+  template <typename Fn> void forEach(Fn&& F)
+  {
+    forEachImpl(*this, std::forward<Fn>(F));
+  }
+
 private:
+  template <typename Self, typename Fn>
+  static void forEachImpl(Self& Map, Fn&& F)
+  {
+    if (auto* SR = Map.getSmallRepr())
+    {
+      Map.SmallOccupied.forEach([&Map, &F, SR](std::size_t I) {
+        if (Map.isMapped((*SR)[I]))
+          F(static_cast<KeyTy>(I), Map.unwrap((*SR)[I]));
+      });
+      return;
+    }
+    if (auto* PR = Map.getPagedRepr())
+    {
+      for (std::size_t PageIndex = 0; PageIndex < PR->size(); ++PageIndex)
+      {
+        if (!(*PR)[PageIndex])
+          continue;
+        std::conditional_t<std::is_const_v<Self>, const Page, Page>& P =
+          *(*PR)[PageIndex];
+        P.Occupied.forEach([&Map, &F, &P, PageIndex](std::size_t I) {
+          if (Map.isMapped(P.Elements[I]))
+            F(static_cast<KeyTy>(PageIndex * N + I),
+              Map.unwrap(P.Elements[I]));
+        });
+      }
+      return;
+    }
+    for (auto& KV : *Map.getLargeRepr())
+      if (Map.isMapped(KV.second))
+        F(KV.first, Map.unwrap(KV.second));
+  }
+
   // NOLINTNEXTLINE(readability-identifier-naming)
   [[noreturn]] void out_of_range(KeyTy Key) const
   {
@@ -357,6 +551,29 @@ private:
       return static_cast<bool>(Elem);
   }
 
+  /// Sets \p Elem to a mapped value constructed by forwarding \p Args.
+  template <typename... Arg> static void assign(E& Elem, Arg&&... Args)
+  {
+    if constexpr (!NeedsMaybe)
+      Elem = T{std::forward<Arg>(Args)...};
+    else
+    {
+      if constexpr (StoreInPlace)
+        Elem = std::optional<T>{std::in_place, std::forward<Arg>(Args)...};
+      else
+        Elem = std::make_unique<T>(std::forward<Arg>(Args)...);
+    }
+  }
+
+  /// Sets \p Elem to the unmapped value.
+  static void unmap(E& Elem)
+  {
+    if constexpr (IntrusiveDefaultSentinel)
+      Elem = T{};
+    else
+      Elem.reset();
+  }
+
   template <typename R = E>
   std::enable_if_t<std::is_default_constructible_v<T>, R> constructElement()
   {
@@ -389,12 +606,40 @@ private:
     return std::get_if<SmallRepresentation>(&Storage);
   }
   MEMBER_FN_NON_CONST_0_NOEXCEPT(SmallRepresentation*, getSmallRepr);
+  const PagedRepresentation* getPagedRepr() const noexcept
+  {
+    return std::get_if<PagedRepresentation>(&Storage);
+  }
+  MEMBER_FN_NON_CONST_0_NOEXCEPT(PagedRepresentation*, getPagedRepr);
   const LargeRepresentation* getLargeRepr() const noexcept
   {
     return std::get_if<LargeRepresentation>(&Storage);
   }
   MEMBER_FN_NON_CONST_0_NOEXCEPT(LargeRepresentation*, getLargeRepr);
 
+  /// \returns the storage of \p Key in the paged representation, or
+  /// \p nullptr if the page that would contain it is not allocated.
+  const E* getPagedElement(KeyTy Key) const noexcept
+  {
+    const PagedRepresentation& PR = *getPagedRepr();
+    const std::size_t PageIndex = Key / N;
+    if (PageIndex >= PR.size() || !PR[PageIndex])
+      return nullptr;
+    return &PR[PageIndex]->Elements[Key % N];
+  }
+  MEMBER_FN_NON_CONST_1_NOEXCEPT(E*, getPagedElement, KeyTy, Key);
+
+  /// \returns the page of \p PR that contains \p Key, allocating it if needed.
+  static Page& getOrAllocatePage(PagedRepresentation& PR, KeyTy Key)
+  {
+    const std::size_t PageIndex = Key / N;
+    if (PageIndex >= PR.size())
+      PR.resize(PageIndex + 1);
+    if (!PR[PageIndex])
+      PR[PageIndex] = std::make_unique<Page>();
+    return *PR[PageIndex];
+  }
+
   /// Fills the small representation \p std::array with default initialised
   /// values.
   void fillSmallRepresentation()
@@ -409,16 +654,33 @@ private:
     }
   }
 
-  /// Convers the representation to the small representation, if beneficial.
+  /// Converts the representation away from the small representation to the
+  /// one that can store \p Key.
+  void convertOutOfSmall(KeyTy Key)
+  {
+    if (Key < PagedKeyEnd)
+      convertToPaged();
+    else
+      convertToLarge();
+  }
+
+  /// Convers the representation to a smaller representation, if beneficial.
   /// This method does not always convert.
   void convertToSmallConditional()
   {
     if (isSmall())
       return;
-    if (size() > MeaningfulSmallConversionThreshold)
+    if (isPaged())
+    {
+      // Only the first page remaining means every key fits the small buffer.
+      if (getPagedRepr()->size() == 1)
+        convertToSmall();
       return;
-
-    convertToSmall();
+    }
+    if (size() <= MeaningfulSmallConversionThreshold)
+      convertToSmall();
+    if (isLarge())
+      convertToPaged();
   }
 
   /// Converts the representation to the small representation, if possible.
@@ -428,6 +690,17 @@ private:
   {
     if (isSmall() || size() > N)
       return;
+    if (isPaged())
+    {
+      if (getPagedRepr()->size() != 1)
+        return;
+
+      auto PR = std::get<PagedRepresentation>(std::move(Storage));
+      Storage.template emplace<SmallRepresentation>(
+        std::move(PR.front()->Elements));
+      SmallOccupied = PR.front()->Occupied;
+      return;
+    }
     // Check if the largest index fits the small buffer. If not, the rebalance
     // cannot happen.
     if (size() != 0 && (--getLargeRepr()->end())->first >= N)
@@ -437,38 +710,90 @@ private:
     auto& SR =
       Storage.template emplace<SmallRepresentation>(SmallRepresentation{});
     fillSmallRepresentation();
+    SmallOccupied.clear();
 
     for (auto It = LR.begin(); It != LR.end();)
     {
       SR.at(It->first) = std::move(It->second);
+      SmallOccupied.set(It->first);
       It = LR.erase(It);
     }
   }
 
+  /// Converts the representation to the paged representation, if the paged
+  /// representation is enabled and every key fits into it.
+  void convertToPaged()
+  {
+    if constexpr (PageCount == 0)
+      return;
+    else
+    {
+      if (isPaged())
+        return;
+
+      PagedRepresentation PR;
+      if (isSmall())
+      {
+        PR.emplace_back(std::make_unique<Page>());
+        PR.front()->Elements = std::move(*getSmallRepr());
+        PR.front()->Occupied = SmallOccupied;
+        PR.front()->Count = size();
+      }
+      else
+      {
+        LargeRepresentation& LR = *getLargeRepr();
+        if (!LR.empty() && (--LR.end())->first >= PagedKeyEnd)
+          return;
+
+        PR.emplace_back(std::make_unique<Page>());
+        for (auto& KV : LR)
+        {
+          Page& P = getOrAllocatePage(PR, KV.first);
+          P.Elements[KV.first % N] = std::move(KV.second);
+          P.Occupied.set(KV.first % N);
+          ++P.Count;
+        }
+      }
+
+      Storage.template emplace<PagedRepresentation>(std::move(PR));
+    }
+  }
+
   /// Coverts the representation to the large representation, if currently in
-  /// the small representation.
+  /// a directly indexed representation.
   ///
   /// \note This is a costly operation that rebalances the lookup map.
   void convertToLarge()
   {
     if (isLarge())
       return;
-
-    std::vector<std::size_t> IndicesToMove;
+    if (isPaged())
     {
-      IndicesToMove.reserve(N);
-      const SmallRepresentation* Data = getSmallRepr();
-      for (std::size_t I = 0; I < N; ++I)
-        if (isMapped(Data->at(I)))
-          IndicesToMove.push_back(I);
+      auto PR = std::get<PagedRepresentation>(std::move(Storage));
+      auto& LR =
+        Storage.template emplace<LargeRepresentation>(LargeRepresentation{});
+
+      for (std::size_t PageIndex = 0; PageIndex < PR.size(); ++PageIndex)
+      {
+        if (!PR[PageIndex])
+          continue;
+        Page& P = *PR[PageIndex];
+        P.Occupied.forEach([this, &LR, &P, PageIndex](std::size_t I) {
+          if (isMapped(P.Elements[I]))
+            LR.emplace(PageIndex * N + I, std::move(P.Elements[I]));
+        });
+      }
+      return;
     }
 
     auto SR = std::get<SmallRepresentation>(std::move(Storage));
     auto& LR =
       Storage.template emplace<LargeRepresentation>(LargeRepresentation{});
 
-    for (std::size_t I : IndicesToMove)
-      LR.emplace(I, std::move(SR.at(I)));
+    SmallOccupied.forEach([this, &LR, &SR](std::size_t I) {
+      if (isMapped(SR[I]))
+        LR.emplace(I, std::move(SR[I]));
+    });
   }
 };
 
@@ -17,19 +17,29 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <functional>
-#include <map>
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "monomux/adt/Atomic.hpp"
 #include "monomux/adt/ScopeGuard.hpp"
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/control/ChannelFrame.hpp"
+#include "monomux/control/FrameDecoder.hpp"
+#include "monomux/control/Message.hpp"
+#include "monomux/control/MessageBase.hpp"
+#include "monomux/control/PascalString.hpp"
 #include "monomux/system/Event.hpp"
+#include "monomux/system/Pipe.hpp"
 #include "monomux/system/Process.hpp"
+#include "monomux/system/SharedRing.hpp"
 #include "monomux/system/Socket.hpp"
 
 #include "SessionData.hpp"
@@ -67,6 +77,9 @@ public:
     ServerExit,
     /// The client was kicked by the server.
     ServerKicked,
+    /// The client was disconnected because the server is being upgraded, and
+    /// should reconnect to the session.
+    ServerUpgrade,
   };
 
   /// The type of message handler functions.
@@ -89,11 +102,18 @@ public:
 
   /// Override the default handling logic for the specified message \p Kind to
   /// fire the user-given \p Handler \b instead \b of the built-in default.
+  /// An empty \p Handler restores the built-in default.
   void registerMessageHandler(std::uint16_t Kind,
                               std::function<HandlerFunction> Handler);
 
   Socket& getControlSocket() noexcept { return ControlSocket; }
   const Socket& getControlSocket() const noexcept { return ControlSocket; }
+  /// \returns the encoding the messages sent on the control socket should be
+  /// encoded in, as negotiated during the \p handshake().
+  message::Encoding getControlEncoding() const noexcept
+  {
+    return ControlEncoding;
+  }
 
   Socket* getDataSocket() noexcept
   {
@@ -111,6 +131,16 @@ public:
   /// client.
   void setDataSocket(Socket&& DataSocket);
 
+  /// \returns the ring in memory shared with the server through which the
+  /// output of the attached session arrives instead of the \p DataSocket, if
+  /// the server agreed to set one up during the \p handshake().
+  SharedRing* getOutputRing() noexcept { return OutputRing.get(); }
+
+  /// \returns the reading end of the PTY of the attached session, if the
+  /// server handed it over in \p requestPtyHandOff(). The output of the
+  /// session is read from here instead of the \p DataSocket.
+  Pipe* getPtyReader() noexcept { return PtyReader.get(); }
+
   raw_fd getInputFile() const noexcept { return InputFile; }
 
   /// Sets the file descriptor which the client will consider its "input
@@ -120,6 +150,31 @@ public:
   /// disassociate.
   void setInputFile(raw_fd FD);
 
+  raw_fd getOutputFile() const noexcept { return OutputFile; }
+
+  /// Sets the file descriptor which the client writes the output of the
+  /// session to, and fires the \p OutputCallback for once it becomes writable
+  /// while there is an output backlog.
+  ///
+  /// \param FD A file descriptor to watch for, or \p fd::Invalid to
+  /// disassociate.
+  ///
+  /// \see notifyOutputBacklog()
+  void setOutputFile(raw_fd FD);
+
+  /// The amount of output waiting to be written to the \p OutputFile above
+  /// which the client stops handling the data connection, so the server stops
+  /// relaying, and the session stops producing, until the backlog is written.
+  static constexpr std::size_t OutputBacklogHighWatermark = 1ULL << 18;
+  /// The amount of output waiting to be written under which the client
+  /// resumes handling the data connection.
+  static constexpr std::size_t OutputBacklogLowWatermark = 1ULL << 16;
+
+  /// Reports that \p Bytes of output are waiting to be written to the
+  /// \p OutputFile. While there is a backlog, the \p OutputCallback is fired
+  /// whenever the \p OutputFile becomes writable.
+  void notifyOutputBacklog(std::size_t Bytes);
+
   /// Perform a handshake mechanism over the control socket.
   ///
   /// A successful handshake initialises the client to be fully \e capable of
@@ -144,12 +199,108 @@ public:
   /// client, if any. This field is not always meaningful.
   std::string exitMessage() const noexcept { return ExitMessage; }
 
+  /// The identifier of a request sent without waiting for its response,
+  /// unique within the \p Client.
+  using RequestID = std::size_t;
+
+  /// Sends the \p Msg request on the control connection, without waiting for
+  /// the response to arrive.
+  ///
+  /// Many requests may be in flight at the same time. The server handles the
+  /// requests of a connection in order, and the responses are correlated to
+  /// the requests in the same order. When the response of type \p Response
+  /// arrives, either during the \p loop() or while waiting for another
+  /// response in \p waitForResponse(), the \p Callback is fired with the
+  /// decoded response, or with \p nullopt if communication failed.
+  template <typename Response, typename Request>
+  RequestID sendRequest(const Request& Msg,
+                        std::function<void(std::optional<Response>)> Callback)
+  {
+    RequestID ID = expectResponse(
+      Response::Kind,
+      [Callback = std::move(Callback)](std::optional<std::string_view> Raw) {
+        if (Callback)
+          Callback(Raw ? Response::decode(*Raw) : std::nullopt);
+        return false;
+      });
+    sendExpected(ID, Msg);
+    return ID;
+  }
+
+  /// Sends the \p Msg request on the control connection, like
+  /// \p sendRequest(), for a response that the server sends in multiple
+  /// parts. The \p Callback is fired for every part as it arrives, and the
+  /// request is pending until the part that has no \p More after it.
+  ///
+  /// \see sendRequest()
+  template <typename Response, typename Request>
+  RequestID
+  sendStreamedRequest(const Request& Msg,
+                      std::function<void(std::optional<Response>)> Callback)
+  {
+    RequestID ID = expectResponse(
+      Response::Kind,
+      [Callback = std::move(Callback)](std::optional<std::string_view> Raw) {
+        std::optional<Response> Part =
+          Raw ? Response::decode(*Raw) : std::nullopt;
+        const bool More = Part && Part->More;
+        if (Callback)
+          Callback(std::move(Part));
+        return More;
+      });
+    sendExpected(ID, Msg);
+    return ID;
+  }
+
+  /// \returns whether the response to the request \p ID had not arrived yet.
+  bool isPending(RequestID ID) const noexcept;
+  /// \returns the number of requests sent that are yet to be responded to.
+  std::size_t numPendingRequests() const noexcept
+  {
+    return PendingRequests.size();
+  }
+
+  /// Handles the messages arriving on the control connection until the
+  /// response to the request \p ID arrives, or the connection fails.
+  ///
+  /// \note This operation \b blocks.
+  void waitForResponse(RequestID ID);
+  /// Handles the messages arriving on the control connection until every
+  /// pending request is responded to, or the connection fails.
+  ///
+  /// \note This operation \b blocks.
+  void waitForAllResponses();
+
   /// Sends a request to the connected server to tell what sessions are running
   /// on the server.
   ///
   /// \returns The data received from the server, or \p nullopt, if
   /// commmuniation failed.
   std::optional<std::vector<SessionData>> requestSessionList();
+  /// Sends a request to the connected server to tell what sessions are running
+  /// on the server, without waiting for the response.
+  ///
+  /// \see sendRequest()
+  RequestID requestSessionListAsync(
+    std::function<void(std::optional<std::vector<SessionData>>)> Callback);
+  /// Sends a request to the connected server to tell at most \p Limit of the
+  /// sessions running on the server whose name starts with \p Prefix, after
+  /// skipping the first \p Offset of them. The cost of this request does not
+  /// depend on the number of sessions on the server.
+  ///
+  /// \returns The data received from the server, or \p nullopt, if
+  /// commmuniation failed.
+  std::optional<SessionPage>
+  requestSessionPage(std::string Prefix, std::size_t Offset, std::size_t Limit);
+  /// Sends a request to the connected server to tell a part of the sessions
+  /// running on the server, without waiting for the response.
+  ///
+  /// \see requestSessionPage(), sendRequest()
+  RequestID requestSessionPageAsync(
+    std::string Prefix,
+    std::size_t Offset,
+    std::size_t Limit,
+    std::function<void(std::optional<SessionPage>)> Callback);
 
   /// Sends a request of new session creation to the server the client is
   /// connected to.
@@ -157,17 +308,133 @@ public:
   /// \param Name The name to associate with the session. This is non-normative,
   /// and the server may overrule the request.
   /// \param Opts Details of the process to spawn on the server's end.
+  /// \param ScrollbackSize The size of the scrollback the server should keep
+  /// for the session. If empty, the server's default is used.
+  /// \param CoalesceWindow The time the server should wait to accumulate the
+  /// output of the session before relaying it. If empty, the server's default
+  /// is used.
+  /// \param RateLimit The number of bytes per second the server should read at
+  /// most from the session. If empty, the server's default is used.
   ///
   /// \returns The actual name of the created session, if creation was
   /// successful.
-  std::optional<std::string> requestMakeSession(std::string Name,
-                                                Process::SpawnOptions Opts);
+  std::optional<std::string>
+  requestMakeSession(std::string Name,
+                     Process::SpawnOptions Opts,
+                     std::optional<std::size_t> ScrollbackSize = std::nullopt,
+                     std::optional<std::chrono::microseconds> CoalesceWindow =
+                       std::nullopt,
+                     std::optional<std::size_t> RateLimit = std::nullopt);
+  /// Sends a request of new session creation to the server the client is
+  /// connected to, without waiting for the response. The \p Callback receives
+  /// the actual name of the created session, if creation was successful.
+  ///
+  /// \see requestMakeSession(), sendRequest()
+  RequestID requestMakeSessionAsync(
+    std::string Name,
+    Process::SpawnOptions Opts,
+    std::function<void(std::optional<std::string>)> Callback,
+    std::optional<std::size_t> ScrollbackSize = std::nullopt,
+    std::optional<std::chrono::microseconds> CoalesceWindow = std::nullopt,
+    std::optional<std::size_t> RateLimit = std::nullopt);
 
   /// Sends a request to the server to attach the client to the session
   /// identified by \p SessionName.
   ///
+  /// \param Observer Whether the client attaches read-only, only observing
+  /// the output of the session, and never sending input or window size
+  /// changes.
+  ///
+  /// \param Resume The position in the output of the session the client had
+  /// received earlier, on another connection. If the server still retains
+  /// the output from there, only the output after it is sent, instead of the
+  /// scrollback.
+  ///
   /// \return whether the attachment succeeded.
-  bool requestAttach(std::string SessionName);
+  bool requestAttach(std::string SessionName,
+                     bool Observer = false,
+                     std::optional<ResumePoint> Resume = std::nullopt);
+  /// Sends a request to the server to attach the client to the session
+  /// identified by \p SessionName, without waiting for the response. The
+  /// \p Callback receives whether the attachment succeeded.
+  ///
+  /// \see requestAttach(), sendRequest()
+  RequestID
+  requestAttachAsync(std::string SessionName,
+                     std::function<void(bool)> Callback,
+                     bool Observer = false,
+                     std::optional<ResumePoint> Resume = std::nullopt);
+
+  /// The type of the function fired for the changes of the sessions on the
+  /// server, after \p requestSubscribe().
+  using SessionEventFunction =
+    void(Client& Client, const message::notification::SessionEvent& Event);
+
+  /// Sends a request to the server to push the changes of the sessions to the
+  /// client, instead of the client polling \p requestSessionList(). The
+  /// \p Callback is fired for every change, from within \p loop() or while
+  /// waiting for a response.
+  ///
+  /// \returns The sessions running on the server at the time of subscribing,
+  /// to which the later changes are relative to, or \p nullopt, if
+  /// communication failed.
+  std::optional<std::vector<SessionData>>
+  requestSubscribe(std::function<SessionEventFunction> Callback);
+
+  /// Sends a request to the server to relay the session identified by
+  /// \p SessionName over a new \e channel of the data connection, instead of
+  /// attaching the client itself. Many channels, to different sessions, can
+  /// be open over the same connection, but the client can not attach once it
+  /// opened a channel, as the data connection only carries the frames of the
+  /// channels afterwards.
+  ///
+  /// \param Observer Whether the channel is read-only, like an observer
+  /// client.
+  ///
+  /// \returns the identifier of the channel, if it was opened.
+  ///
+  /// \see setChannelOutputCallback(), receiveChannelOutput()
+  std::optional<message::ChannelID> requestOpenChannel(std::string SessionName,
+                                                       bool Observer = false);
+  /// Sends a notification to the server to stop relaying the \p Channel.
+  void closeChannel(message::ChannelID Channel);
+  /// Sends \p Data to the session of the \p Channel.
+  void sendChannelData(message::ChannelID Channel, std::string_view Data);
+  /// Sends a notification to the server that the window of the \p Channel
+  /// changed to the new \p Rows and \p Columns.
+  void notifyChannelWindowSize(message::ChannelID Channel,
+                               unsigned short Rows,
+                               unsigned short Columns);
+
+  /// The type of the function fired for the output of a channel.
+  using ChannelOutputFunction =
+    void(Client& Client, message::ChannelID Channel, std::string_view Data);
+  /// The type of the function fired when the server closed a channel.
+  using ChannelClosedFunction =
+    void(Client& Client, const message::notification::ChannelClosed& Closed);
+
+  /// Sets the handler that is fired for the output of the channels, as it is
+  /// read by \p receiveChannelOutput().
+  void setChannelOutputCallback(std::function<ChannelOutputFunction> Callback);
+  /// Sets the handler that is fired when the server closed a channel, e.g.
+  /// because its session exited.
+  void setChannelClosedCallback(std::function<ChannelClosedFunction> Callback);
+  /// Reads the frames of the channels available on the data connection and
+  /// fires the \p ChannelOutputCallback for each of them.
+  ///
+  /// \returns the number of bytes of output received.
+  std::size_t receiveChannelOutput();
+
+  /// Sends a request to the server to hand over the PTY of the attached
+  /// session, after which the output of the session is read, and the input is
+  /// written, by the client directly. The server takes the PTY back once the
+  /// client detaches.
+  ///
+  /// \returns whether the PTY was handed over.
+  bool requestPtyHandOff();
+  /// Closes the PTY handed over by the server, and falls back to the
+  /// \p DataSocket.
+  void releasePty();
 
   /// \returns whether the client successfully attached to a session on the
   /// server.
@@ -175,6 +442,31 @@ public:
   /// \see requestAttach()
   bool attached() const noexcept { return Attached; }
 
+  /// \returns whether the client attached to its session as an observer, in
+  /// which case the input, signals, and window size changes are not sent.
+  bool isObserver() const noexcept { return Observer; }
+
+  /// Sets whether the subsequent attach requests ask the server to skip the
+  /// output the client lags too far behind in receiving, and to make the
+  /// session redraw its screen instead.
+  void setCatchUp(bool CatchUp) noexcept { this->CatchUp = CatchUp; }
+
+  /// Sets whether the \p handshake() asks the server to compress the output
+  /// sent on the data connection. The server agrees only if the client is not
+  /// on the same machine, e.g. because the socket is forwarded over a network.
+  void setCompressOutput(bool Compress) noexcept
+  {
+    WantCompression = Compress;
+  }
+  /// \returns whether the output arrives compressed on the data connection,
+  /// to be read by \p receiveCompressedOutput().
+  bool isOutputCompressed() const noexcept { return CompressedOutput; }
+  /// Reads and decompresses the frames of the output available on the data
+  /// connection into \p Output, until \p Output has too much buffered.
+  ///
+  /// \returns the number of bytes of output received.
+  std::size_t receiveCompressedOutput(BufferedChannel& Output);
+
   /// \returns information about the session the client is (if \p attached() is
   /// \p true) or last was (if \p attached() is \p false) attached to. If the
   /// client never attached to any session, returns \p nullptr.
@@ -183,6 +475,23 @@ public:
     return AttachedSession ? &*AttachedSession : nullptr;
   }
 
+  /// Accounts for \p Bytes of the session's output that the client had
+  /// received over the \e data connection, and written to its output.
+  void countOutput(std::size_t Bytes) noexcept
+  {
+    if (OutputOffset)
+      *OutputOffset += Bytes;
+  }
+  /// \returns the position of the output stream of the attached session up
+  /// to which the client had received the output, which a new connection can
+  /// resume from, if the position is known.
+  std::optional<ResumePoint> resumePoint() const noexcept
+  {
+    if (!AttachedSession || !OutputOffset)
+      return std::nullopt;
+    return ResumePoint{*OutputOffset, AttachedSession->Created};
+  }
+
   /// Sends \p Data to the server over the \e data connection.
   void sendData(std::string_view Data);
 
@@ -198,6 +507,9 @@ public:
   /// connection of the client. This method deals with parsing a \p Message
   /// from the control connection, and fire a message-specific handler.
   ///
+  /// \note This may also be called by an event loop other than \p loop(),
+  /// which watches the file descriptors of several clients at once.
+  ///
   /// \see registerMessageHandler().
   void controlCallback();
 
@@ -212,6 +524,10 @@ public:
   /// The input is \b NOT read before the callback fires.
   void setInputCallback(std::function<RawCallbackFn> Callback);
 
+  /// Sets the handler that is fired when the output backlog can be written to
+  /// the \p OutputFile.
+  void setOutputCallback(std::function<RawCallbackFn> Callback);
+
   /// Sets the callback object for handling external events when the client's
   /// internal event handling \p loop() is ready for such.
   void setExternalEventProcessor(std::function<RawCallbackFn> Callback);
@@ -220,29 +536,129 @@ private:
   /// The control socket is used to communicate control commands with the
   /// server.
   Socket ControlSocket;
+  /// The encoding negotiated for the messages sent on \p ControlSocket.
+  message::Encoding ControlEncoding = message::Encoding::Text;
+  /// Reassembles the messages received on \p ControlSocket.
+  message::FrameDecoder ControlFrames;
+
+  /// The function that completes a pending request with the raw response, or
+  /// \p nullopt if communication failed.
+  ///
+  /// \returns whether the request stays pending, because the response was
+  /// only a part of a streamed response.
+  using CompletionFunction = bool(std::optional<std::string_view> RawMessage);
+
+  struct PendingRequest
+  {
+    RequestID ID;
+    message::MessageKind ResponseKind;
+    std::function<CompletionFunction> Complete;
+  };
+  /// The requests sent but not yet responded to, in the order of sending.
+  std::deque<PendingRequest> PendingRequests;
+  RequestID NextRequestID = 0;
+
+  /// Registers a new pending request that expects a response of \p Kind.
+  RequestID expectResponse(message::MessageKind Kind,
+                           std::function<CompletionFunction> Complete);
+  /// Removes the pending request \p ID without completing it.
+  void forgetResponse(RequestID ID) noexcept;
+  /// Sends the \p Msg of the pending request \p ID.
+  template <typename Request>
+  void sendExpected(RequestID ID, const Request& Msg)
+  {
+    try
+    {
+      message::sendMessage(ControlSocket, Msg, ControlEncoding);
+    }
+    catch (const buffer_overflow&)
+    {
+      // The request is buffered, and will be sent later.
+    }
+    catch (const std::system_error&)
+    {
+      forgetResponse(ID);
+      throw;
+    }
+  }
+  /// Completes the earliest pending request expecting a response of \p Kind.
+  ///
+  /// \returns whether such a request was pending.
+  bool completeResponse(message::MessageKind Kind, std::string_view Message);
+  /// Completes every pending request as failed.
+  void failPendingRequests();
+
+  /// Handles the output of the session that is still in flight after the
+  /// session exited, until none arrives for a while.
+  void drainOutput();
+
+  /// Parses a \p Message read from the control connection and fires the
+  /// appropriate handler.
+  void handleControlMessage(std::string_view Data);
+
+  /// Receives the handles of the \p OutputRing the server had sent through
+  /// the \p DataSocket, and opens the ring.
+  void setUpOutputRing();
 
   /// The data connection is used to transmit the process data to the client.
   /// (This is initialised in a lazy fashion during operation.)
   std::unique_ptr<Socket> DataSocket;
 
+  /// The ring the server writes the output of the session to, if such was set
+  /// up. The data doorbell of the ring is handled instead of \p DataSocket.
+  std::unique_ptr<SharedRing> OutputRing;
+
+  /// The PTY of the attached session, if the server handed it over. It is
+  /// handled instead of both \p OutputRing and \p DataSocket.
+  fd Pty;
+  std::unique_ptr<Pipe> PtyReader;
+  std::unique_ptr<Pipe> PtyWriter;
+
+  /// \returns the file descriptor the output of the session arrives on.
+  raw_fd outputFD() const noexcept;
+
   /// Whether continuous \e handling of data on the \p DataSocket (if connected)
   /// via \p Poll is enabled.
   UniqueScalar<bool, false> DataSocketEnabled;
 
   /// Whether the client successfully attached to a session on the server.
   UniqueScalar<bool, false> Attached;
+  /// Whether the client attached as an observer, which does not send input.
+  UniqueScalar<bool, false> Observer;
+  /// Whether the client asks to catch up with the output when attaching.
+  UniqueScalar<bool, false> CatchUp;
+  /// Whether the client asks for, and whether the server agreed to, the
+  /// output being compressed on the data connection.
+  UniqueScalar<bool, false> WantCompression;
+  UniqueScalar<bool, false> CompressedOutput;
 
   /// Information about the session the client attached to.
   std::optional<SessionData> AttachedSession;
+  /// The position in the output stream of the attached session up to which
+  /// the output was received, if the server reported it.
+  std::optional<std::uint64_t> OutputOffset;
 
   /// A callback object that is fired when the client's event handling loop is
   /// "in the mood" for processing externalia.
   std::function<RawCallbackFn> ExternalEventProcessor;
 
+  /// The callback object fired for the session events after subscribing.
+  std::function<SessionEventFunction> SessionEventHandler;
+
+  /// The callback objects fired for the output, and the closing, of the
+  /// channels.
+  std::function<ChannelOutputFunction> ChannelOutputHandler;
+  std::function<ChannelClosedFunction> ChannelClosedHandler;
+  /// Reassembles the frames of the channels, or of the compressed output,
+  /// received on \p DataSocket.
+  message::FrameDecoder DataFrames;
+
   /// The callback object fired when data becomes available on \p DataSocket.
   std::function<RawCallbackFn> DataHandler;
   /// The callback object fired when data becomes available on \p InputFile.
   std::function<RawCallbackFn> InputHandler;
+  /// The callback object fired when \p OutputFile becomes writable.
+  std::function<RawCallbackFn> OutputHandler;
 
   /// Weak file handle for the stream that is considered the user-facing input
   /// of the client.
@@ -252,6 +668,19 @@ private:
   /// \p Poll is enabled.
   UniqueScalar<bool, false> InputFileEnabled;
 
+  /// Weak file handle for the stream the output of the session is written to.
+  UniqueScalar<raw_fd, fd::Invalid> OutputFile;
+
+  /// Whether \p OutputFile is polled for becoming writable, because of an
+  /// output backlog.
+  UniqueScalar<bool, false> OutputFileWaited;
+
+  /// Whether handling the data connection is paused because the output
+  /// backlog exceeded \p OutputBacklogHighWatermark.
+  UniqueScalar<bool, false> OutputBacklogged;
+  /// The amount of output last reported by \p notifyOutputBacklog().
+  std::size_t OutputBacklog = 0;
+
   ExitReason Exit = None;
   int ExitCode = 0;
   std::string ExitMessage;
@@ -272,10 +701,19 @@ private:
   /// Return the stored \p Nonce of the current instance, resetting it.
   std::size_t consumeNonce() noexcept;
 
-  /// Maps \p MessageKind to handler functions.
-  std::map<std::uint16_t, std::function<HandlerFunction>> Dispatch;
+  using DispatchTable =
+    std::array<HandlerFunction*, message::MessageKindCount>;
+  /// The built-in handler functions, indexed by \p MessageKind. This table is
+  /// generated from \p Dispatch.ipp at compile-time.
+  static const DispatchTable BuiltinDispatch;
+  /// The user-given handler functions, indexed by \p MessageKind, which take
+  /// precedence over \p BuiltinDispatch.
+  std::vector<std::function<HandlerFunction>> Overrides;
 
-  void setUpDispatch();
+  /// Calls the handler function for \p Kind.
+  ///
+  /// \returns whether a handler was found.
+  bool dispatch(std::uint16_t Kind, std::string_view Message);
 
 #define DISPATCH(KIND, FUNCTION_NAME)                                          \
   static void FUNCTION_NAME(Client& Client, std::string_view Message);
@@ -17,6 +17,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "Client.hpp"
 
 namespace monomux::client
@@ -50,16 +58,145 @@ public:
   /// session.
   void requestDetachAllClients();
 
+  /// Send a request to the server to read at most \p BytesPerSecond of the
+  /// output of the session from now on, or to stop limiting it, if \p 0.
+  ///
+  /// \returns whether the server changed the limit.
+  bool requestRateLimit(std::size_t BytesPerSecond);
+
   /// Sends a request to the server to gather statistical information and reply
-  /// it back to this \p Client.
+  /// it back to this \p Client. The reply is received in parts, and the
+  /// \p Callback is fired for each of them in order, so the whole reply is
+  /// never held in memory.
+  ///
+  /// \throws std::runtime_error Thrown if communication with the server failed
+  /// and it did not produce a response that the client could understand.
+  void requestStatistics(const std::function<void(std::string_view)>& Callback);
+
+  /// Sends a request to the server to reply the current values of its
+  /// metrics to this \p Client. The samples are received in parts, and the
+  /// \p Callback is fired for each of them in order.
+  ///
+  /// \throws std::runtime_error Thrown if communication with the server failed
+  /// and it did not produce a response that the client could understand.
+  void requestMetrics(
+    const std::function<void(const std::vector<message::Metric>&)>& Callback);
+
+  /// Sends a request to the server to reply the records of its tracepoints to
+  /// this \p Client. The records are received in parts, and the \p Callback
+  /// is fired for each of them in order.
+  ///
+  /// \throws std::runtime_error Thrown if communication with the server failed
+  /// and it did not produce a response that the client could understand.
+  void requestTrace(
+    const std::function<void(const std::vector<trace::Record>&)>& Callback);
+
+  /// Sends a request to the server to search the scrollback of \p Session, or
+  /// of every session if empty, for the lines containing \p Pattern, and
+  /// waits for the search to finish.
   ///
   /// \throws std::runtime_error Thrown if communication with the server failed
   /// and it did not produce a response that the client could understand.
-  std::string requestStatistics();
+  message::response::Search requestSearch(std::string Pattern,
+                                          std::string Session);
+
+  /// A control operation of a batch, which is executed together with the
+  /// other operations of the batch over the connection of the client.
+  struct BatchCommand
+  {
+    enum CommandKind
+    {
+      /// Create \p Session, running \p Program, or the default shell if
+      /// \p Program is empty.
+      Create,
+      /// Send the signal \p Number to \p Session.
+      Signal,
+      /// Detach the latest client from \p Session.
+      Detach,
+      /// Detach every client from \p Session.
+      DetachAll,
+      /// Read at most \p Number bytes per second of the output of \p Session.
+      RateLimit,
+      /// List the sessions of the server.
+      List,
+      /// Query the statistics of the server.
+      Statistics,
+    };
+    CommandKind Kind = List;
+
+    /// The number of the line of the batch the command was parsed from, which
+    /// identifies the command in the results.
+    std::size_t Line{};
+
+    std::string Session;
+    std::vector<std::string> Program;
+    std::size_t Number{};
+
+    /// \returns the name of the command, as written in a batch.
+    const char* name() const noexcept;
+
+    /// Parses the command written on the \p Text of a line of a batch, e.g.
+    /// \p "signal my-session TERM". The words of the command are separated by
+    /// whitespace, and lines that are empty or start with \p '#' are ignored.
+    ///
+    /// \returns the command, or \p std::nullopt if the line is ignored.
+    ///
+    /// \throws std::invalid_argument If the line is not a valid command.
+    static std::optional<BatchCommand> parse(std::string_view Text,
+                                             std::size_t Line);
+  };
+
+  enum class BatchStatus
+  {
+    /// A part of the output of the command, e.g. an entry of \p List.
+    Data,
+    /// The command was executed.
+    Success,
+    /// The command failed.
+    Failure
+  };
+  /// The type of the function fired with the results of the commands of a
+  /// batch, with a human-readable \p Detail of the result.
+  using BatchFunction = void(const BatchCommand& Command,
+                             BatchStatus Status,
+                             std::string_view Detail);
+
+  /// The number of commands of a batch that can wait for their responses at
+  /// the same time, after which the next command waits for the earliest.
+  static constexpr std::size_t BatchWindow = 64;
+
+  /// Sends the requests of \p Command to the server without waiting for the
+  /// responses, which arrive while executing the later commands, or in
+  /// \p finishBatch(). The \p Callback is fired with the results of the
+  /// commands in the order the commands were executed.
+  ///
+  /// A command to another session than the previous one waits until the
+  /// client is attached to the new session, so the command is not executed
+  /// on the wrong session if attaching fails.
+  void runBatchCommand(const BatchCommand& Command,
+                       const std::function<BatchFunction>& Callback);
+
+  /// Waits for the results of every command sent by \p runBatchCommand().
+  void finishBatch();
 
 private:
   Client& BackingClient;
 
+  /// The session the client was last attached to while executing a batch.
+  std::optional<std::string> BatchSession;
+  /// The requests of the batch whose responses had not arrived yet, in the
+  /// order they were sent.
+  std::deque<Client::RequestID> BatchInFlight;
+
+  /// Attaches the client to \p Session for a command of a batch, unless it is
+  /// already attached to it.
+  ///
+  /// \returns whether the client is attached to \p Session.
+  bool attachForBatch(const std::string& Session);
+  /// Records the request \p ID of a batch as in flight, and waits for the
+  /// earliest requests until at most \p BatchWindow of them are.
+  void trackBatchRequest(Client::RequestID ID);
+
   /// The name of the session the controlling client will send requests to.
   std::string SessionName;
 };
@@ -5,5 +5,8 @@
 
 DISPATCH(ClientIDResponse, responseClientID)
 DISPATCH(DetachedNotification, receivedDetachNotification)
+DISPATCH(ProtocolResponse, responseProtocol)
+DISPATCH(SessionEventNotification, receivedSessionEvent)
+DISPATCH(ChannelClosedNotification, receivedChannelClosed)
 
 #undef DISPATCH
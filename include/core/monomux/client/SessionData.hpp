@@ -18,7 +18,10 @@
  */
 #pragma once
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace monomux::client
 {
@@ -33,4 +36,28 @@ struct SessionData
   std::chrono::time_point<std::chrono::system_clock> Created;
 };
 
+/// A part of the list of sessions running on a server, as reported by the
+/// server.
+struct SessionPage
+{
+  /// The sessions in the page, in the order of their names.
+  std::vector<SessionData> Sessions;
+  /// The number of sessions on the server, regardless of any filter.
+  std::size_t Total = 0;
+  /// Whether more matching sessions exist after the ones in \p Sessions.
+  bool More = false;
+};
+
+/// The position in the output stream of a session up to which a client had
+/// received the output, from where a new connection can continue without
+/// receiving the output again.
+struct ResumePoint
+{
+  /// The absolute position in the output stream of the session.
+  std::uint64_t Offset;
+  /// The creation time of the session, which tells apart a new session that
+  /// was created with the name of the original one.
+  std::chrono::time_point<std::chrono::system_clock> Created;
+};
+
 } // namespace monomux::client
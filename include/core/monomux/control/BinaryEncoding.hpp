@@ -0,0 +1,142 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace monomux::message
+{
+
+/// Appends the fields of a message in the binary encoding to a destination.
+/// Integers are stored fixed-width and little-endian, and strings are stored
+/// prefixed with their length as a 32-bit integer.
+class BinaryWriter
+{
+public:
+  /// The function that appends the encoded \p Bytes to the \p Destination.
+  using AppendFn = void(void* Destination, std::string_view Bytes);
+
+  /// Creates a writer that appends to the end of \p Buffer.
+  explicit BinaryWriter(std::string& Buffer) noexcept
+    : Destination(&Buffer), Append(&appendToString)
+  {}
+  /// Creates a writer that appends to an arbitrary \p Destination, e.g. the
+  /// write buffer of a channel, through \p Append.
+  BinaryWriter(void* Destination, AppendFn* Append) noexcept
+    : Destination(Destination), Append(Append)
+  {}
+
+  /// Appends the raw \p Bytes, without a length prefix.
+  void bytes(std::string_view Bytes) { Append(Destination, Bytes); }
+
+  template <typename T> void integer(T Value)
+  {
+    static_assert(std::is_integral_v<T>, "Only integers are fixed-width!");
+    auto Bits = static_cast<std::make_unsigned_t<T>>(Value);
+    char Bytes[sizeof(T)];
+    for (std::size_t I = 0; I < sizeof(T); ++I)
+      Bytes[I] = static_cast<char>((Bits >> (I * 8)) & 0xFF);
+    bytes({Bytes, sizeof(T)});
+  }
+
+  void boolean(bool Value) { integer<std::uint8_t>(Value ? 1 : 0); }
+
+  void string(std::string_view Value)
+  {
+    integer(static_cast<std::uint32_t>(Value.size()));
+    bytes(Value);
+  }
+
+private:
+  void* Destination;
+  AppendFn* Append;
+
+  static void appendToString(void* Buffer, std::string_view Bytes)
+  {
+    static_cast<std::string*>(Buffer)->append(Bytes);
+  }
+};
+
+/// Reads the fields of a message in the binary encoding from a buffer,
+/// written by a \p BinaryWriter.
+///
+/// Reading past the end of the buffer does not throw, but returns empty
+/// values and marks the reader failed, which should be checked with \p good()
+/// after reading the fields.
+class BinaryReader
+{
+public:
+  explicit BinaryReader(std::string_view Buffer) noexcept : Buffer(Buffer) {}
+
+  /// \returns whether every field was read successfully so far.
+  bool good() const noexcept { return !Failed; }
+  /// \returns whether every field was read successfully, and nothing remains
+  /// in the buffer.
+  bool done() const noexcept { return !Failed && Buffer.empty(); }
+  /// \returns the number of bytes not yet read.
+  std::size_t remaining() const noexcept { return Buffer.size(); }
+
+  template <typename T> T integer() noexcept
+  {
+    static_assert(std::is_integral_v<T>, "Only integers are fixed-width!");
+    using Unsigned = std::make_unsigned_t<T>;
+    std::string_view Bytes = take(sizeof(T));
+    if (Bytes.size() != sizeof(T))
+      return T{};
+
+    Unsigned Bits = 0;
+    for (std::size_t I = 0; I < sizeof(T); ++I)
+      Bits |= static_cast<Unsigned>(
+        static_cast<Unsigned>(static_cast<unsigned char>(Bytes[I])) << (I * 8));
+    return static_cast<T>(Bits);
+  }
+
+  bool boolean() noexcept { return integer<std::uint8_t>() != 0; }
+
+  /// \returns a view of the string in the underlying buffer, without copying.
+  ///
+  /// \warning The view is only valid while the buffer the reader was created
+  /// for is alive!
+  std::string_view string() noexcept
+  {
+    auto Size = integer<std::uint32_t>();
+    return take(Size);
+  }
+
+private:
+  std::string_view Buffer;
+  bool Failed = false;
+
+  std::string_view take(std::size_t N) noexcept
+  {
+    if (Failed || Buffer.size() < N)
+    {
+      Failed = true;
+      return {};
+    }
+
+    std::string_view Bytes = Buffer.substr(0, N);
+    Buffer.remove_prefix(N);
+    return Bytes;
+  }
+};
+
+} // namespace monomux::message
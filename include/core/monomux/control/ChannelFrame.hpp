@@ -0,0 +1,53 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace monomux::message
+{
+
+/// Identifies one of the sessions multiplexed over the data connection of a
+/// client, as assigned by the server when the channel was opened.
+using ChannelID = std::uint16_t;
+
+/// The most session data carried by one frame of a channel.
+constexpr std::size_t ChannelFrameDataMax = 1 << 16;
+
+/// Appends \p Data as frames of \p Channel to \p Buffer, to be sent on a
+/// multiplexed data connection. Each frame is a size-prefixed payload (as
+/// created by \p encodeWithSize(), and read by a \p FrameDecoder) of the
+/// \p Channel followed by at most \p ChannelFrameDataMax bytes of \p Data.
+void appendChannelFrames(std::string& Buffer,
+                         ChannelID Channel,
+                         std::string_view Data);
+
+/// Splits the \p Payload of a frame read by a \p FrameDecoder into the channel
+/// and the data it carries.
+///
+/// \returns \p std::nullopt if the \p Payload is too short to be a frame of a
+/// channel.
+std::optional<std::pair<ChannelID, std::string_view>>
+decodeChannelFrame(std::string_view Payload) noexcept;
+
+} // namespace monomux::message
@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace monomux::message
+{
+
+/// The most session data compressed into one frame, which is also as far as
+/// the matches of \p compress::compressBlock() reach.
+constexpr std::size_t CompressedFrameDataMax = 1 << 16;
+
+/// Appends \p Data compressed as frames to \p Buffer, to be sent on a data
+/// connection that negotiated a \p CompressionRequest. Each frame is a
+/// size-prefixed payload (as created by \p encodeWithSize(), and read by a
+/// \p FrameDecoder) of the 32-bit size of the original data, followed by at
+/// most \p CompressedFrameDataMax bytes of data made by
+/// \p compress::compressBlock(). Data that does not shrink is stored as is,
+/// which is told by the payload being exactly as long as the original.
+///
+/// Every frame is compressed on its own, so whatever was appended can be sent,
+/// and decompressed on arrival, right away.
+void appendCompressedFrames(std::string& Buffer, std::string_view Data);
+
+/// \returns the original data of the \p Payload of a frame read by a
+/// \p FrameDecoder, or \p std::nullopt if the \p Payload is malformed.
+std::optional<std::string>
+decodeCompressedFrame(std::string_view Payload) noexcept;
+
+} // namespace monomux::message
@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+
+#include "monomux/system/BufferedChannel.hpp"
+
+namespace monomux::message
+{
+
+/// Incrementally reassembles size-prefixed payloads (as created by
+/// \p encodeWithSize()) from a \p BufferedChannel.
+///
+/// Unlike \p readPascalString(), a frame that is only partially available is
+/// kept in the decoder and completed by later calls, once the rest of the
+/// data arrives, without blocking. Only the bytes of the current frame are
+/// consumed from the channel, so the data of later frames stays buffered in
+/// the channel itself.
+class FrameDecoder
+{
+public:
+  /// The largest payload that is accepted. A greater size prefix is assumed
+  /// to be the result of memory corruption.
+  static constexpr std::size_t MaxFrameSize = 1 << 24;
+
+  /// Reads from the \p Channel until the current frame is complete, or no more
+  /// data is available at the moment.
+  ///
+  /// \returns the payload of the completed frame, or \p std::nullopt if the
+  /// frame is not complete yet.
+  ///
+  /// \throws buffer_overflow and \p std::system_error as the \p readInto()
+  /// of the \p Channel does. The partially read frame is kept.
+  std::optional<std::string> next(BufferedChannel& Channel);
+
+  /// \returns whether some bytes of an incomplete frame had been consumed.
+  bool hasPartialFrame() const noexcept
+  {
+    return SizeKnown || SizePrefixRead;
+  }
+
+  /// \returns whether a size prefix larger than \p MaxFrameSize was read. In
+  /// this case, the stream is out of sync and no further frames are decoded.
+  bool corrupt() const noexcept { return Corrupt; }
+
+private:
+  /// The storage of the size prefix, of which \p SizePrefixRead bytes had
+  /// been read so far.
+  std::array<char, sizeof(std::size_t)> SizePrefix;
+  std::size_t SizePrefixRead = 0;
+  /// The storage of the payload, of which \p PayloadRead bytes had been read
+  /// so far.
+  std::string Payload;
+  std::size_t PayloadRead = 0;
+  /// The size of the payload of the current frame, if \p SizeKnown.
+  std::size_t Size = 0;
+  bool SizeKnown = false;
+  bool Corrupt = false;
+};
+
+} // namespace monomux::message
@@ -19,21 +19,33 @@
 #pragma once
 #include <cstdint>
 #include <ctime>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "monomux/Trace.hpp"
+#include "monomux/control/ChannelFrame.hpp"
+
 #include "MessageBase.hpp"
 
 #define MONOMUX_MESSAGE(KIND, NAME)                                            \
   static constexpr MessageKind Kind = MessageKind::KIND;                       \
-  static std::optional<NAME> decode(std::string_view Buffer);                  \
-  static std::string encode(const NAME& Object);
+  static std::optional<NAME> decode(std::string_view Buffer)                   \
+  {                                                                            \
+    return decodeBody<NAME>(Buffer);                                           \
+  }                                                                            \
+  static std::optional<NAME> decodeText(std::string_view Buffer);              \
+  static std::string encode(const NAME& Object);                               \
+  static std::optional<NAME> decodeBinary(BinaryReader& Buffer);               \
+  static void encodeBinary(BinaryWriter& Buffer, const NAME& Object);
 
 #define MONOMUX_MESSAGE_BASE(NAME)                                             \
   static constexpr MessageKind Kind = MessageKind::Base;                       \
   static std::optional<NAME> decode(std::string_view& Buffer);                 \
-  static std::string encode(const NAME& Object);
+  static std::string encode(const NAME& Object);                               \
+  static std::optional<NAME> decodeBinary(BinaryReader& Buffer);               \
+  static void encodeBinary(BinaryWriter& Buffer, const NAME& Object);
 
 namespace monomux::message
 {
@@ -88,6 +100,23 @@ struct SessionData
   std::time_t Created{};
 };
 
+/// The state of a session as published by the server in its status page,
+/// which clients read without connecting to the server.
+///
+/// \see server::Server::publishStatus()
+struct SessionStatus
+{
+  MONOMUX_MESSAGE_BASE(SessionStatus);
+
+  SessionData Session;
+
+  /// The number of clients attached to the session.
+  std::size_t AttachedClients{};
+
+  /// \see server::SessionData::LastActivity.
+  std::time_t LastActive{};
+};
+
 /// A base class for responding boolean values consistently.
 struct Boolean
 {
@@ -103,6 +132,56 @@ struct Boolean
   bool Value{};
 };
 
+/// A sample of one of the metrics of the server.
+struct Metric
+{
+  MONOMUX_MESSAGE_BASE(Metric);
+
+  enum MetricKind
+  {
+    /// A monotonically increasing number.
+    Counter,
+    /// A number that might go up and down.
+    Gauge,
+    /// The distribution of observed durations, in microseconds.
+    Histogram
+  };
+  MetricKind Type = Counter;
+
+  /// The name of the metric, e.g. \p "monomux_loop_iterations_total".
+  std::string Name;
+
+  /// The dimensions distinguishing samples of the same metric, e.g. the name
+  /// of a session.
+  std::vector<std::pair<std::string, std::string>> Labels;
+
+  /// The value of a \p Counter or a \p Gauge, or the sum of the observations
+  /// of a \p Histogram.
+  std::uint64_t Value{};
+
+  /// The number of the observations of a \p Histogram in each bucket. Bucket
+  /// \p I counts the observations of at most \p 2^I that do not fit an
+  /// earlier bucket, and the last bucket counts every larger observation.
+  std::vector<std::uint64_t> Buckets;
+};
+
+/// A line of the scrollback of a session that matched a search.
+struct SearchMatch
+{
+  MONOMUX_MESSAGE_BASE(SearchMatch);
+
+  /// The name of the session.
+  std::string Session;
+
+  /// The position of the match in the output of the session, counted in
+  /// bytes from the creation of the session.
+  std::size_t Offset{};
+
+  /// The line containing the match, which might be clipped around the match
+  /// if the line is long.
+  std::string Context;
+};
+
 namespace request
 {
 
@@ -128,11 +207,40 @@ struct DataSocket
   monomux::message::ClientID Client;
 };
 
+/// A request from the client to the server sent over the control connection
+/// to create the data connection of the client as an unnamed pair of sockets,
+/// instead of the client connecting again and sending a \p DataSocket.
+///
+/// \note Servers that do not understand the request ignore it, and the client
+/// has to fall back to establishing the data connection itself.
+struct DataSocketPair
+{
+  MONOMUX_MESSAGE(DataSocketPairRequest, DataSocketPair);
+  /// The process ID of the client. The server compares it to the process at
+  /// the other end of the control connection, which differs if the connection
+  /// is relayed by another process, e.g. a socket forwarded by \p ssh, which
+  /// would drop the descriptors sent to the client.
+  std::optional<std::int64_t> Process;
+};
+
 /// A request from the client to the server to advise the client about the
 /// sessions available on the server for attachment.
+///
+/// The list might be requested in pages, in which case only the sessions
+/// selected by the request are sent, so the cost of the request does not
+/// depend on the number of sessions on the server.
 struct SessionList
 {
   MONOMUX_MESSAGE(SessionListRequest, SessionList);
+  /// If not empty, only the sessions whose name starts with \p Prefix are
+  /// listed.
+  std::string Prefix;
+  /// The number of (matching) sessions to skip from the beginning of the list,
+  /// in the order of their names.
+  std::size_t Offset = 0;
+  /// The maximum number of sessions to list. If empty, every (matching)
+  /// session is listed.
+  std::optional<std::size_t> Limit;
 };
 
 /// A request from the client to the server to initialise a new session with
@@ -147,6 +255,19 @@ struct MakeSession
 
   /// The options for the program to create in the session.
   ProcessSpawnOptions SpawnOpts;
+
+  /// The size of the scrollback to keep for the session, in bytes. If empty,
+  /// the server's default is used.
+  std::optional<std::size_t> ScrollbackSize;
+
+  /// The time the server should wait to accumulate the output of the session
+  /// before relaying it, in microseconds. If empty, the server's default is
+  /// used.
+  std::optional<std::size_t> CoalesceWindow;
+
+  /// The number of bytes per second the server should read at most from the
+  /// session, or \p 0 for no limit. If empty, the server's default is used.
+  std::optional<std::size_t> RateLimit;
 };
 
 /// A request from the client to the server to attach the client to the
@@ -156,6 +277,33 @@ struct Attach
   MONOMUX_MESSAGE(AttachRequest, Attach);
   /// The name of the session to attach to.
   std::string Name;
+
+  /// Whether the client attaches read-only, only observing the output of the
+  /// session, e.g. to watch or record it. The server does not read input from
+  /// observers, ignores their window size, and serves them after the
+  /// interactive clients. A lagging observer does not pause the session for
+  /// the other attached clients.
+  bool Observer = false;
+
+  /// Whether the client keeps track of the position of the output it received
+  /// in the output stream of the session, in which case the response tells
+  /// where the output sent to the client starts.
+  bool Resumable = false;
+  /// The position in the output stream of the session until which the client
+  /// had received the output, while it was attached before, e.g. until its
+  /// connection was lost. If the output from this position is still retained,
+  /// only the output the client missed is sent, instead of the scrollback.
+  std::optional<std::uint64_t> ResumeFrom;
+  /// The creation time of the session \p ResumeFrom belongs to, which must
+  /// match the session attached to for the output to be resumed.
+  std::time_t ResumeCreated = 0;
+
+  /// Whether the client prefers to skip the output it lags too far behind in
+  /// receiving: instead of buffering the output for the client, or detaching
+  /// it once too much is pending, the server discards the output the client
+  /// did not receive, apart from a short tail, and makes the program in the
+  /// session redraw its screen.
+  bool CatchUp = false;
 };
 
 /// A request from a client to the server to detach some clients from an ongoing
@@ -187,6 +335,134 @@ struct Signal
 struct Statistics
 {
   MONOMUX_MESSAGE(StatisticsRequest, Statistics);
+  /// Whether the client accepts the response in multiple parts.
+  ///
+  /// \see response::Statistics::More
+  bool Streamed = false;
+};
+
+/// A request from the client to the server to encode the messages sent on the
+/// connection in the binary encoding.
+///
+/// This message is sent in the text encoding during the handshake, right
+/// \b before the \p ClientID request, as servers not understanding it ignore
+/// it and only respond to the latter.
+struct Protocol
+{
+  MONOMUX_MESSAGE(ProtocolRequest, Protocol);
+  /// The highest version of the binary encoding the client understands.
+  std::uint8_t BinaryVersion{};
+};
+
+/// A request from the client to the server to be notified about the sessions
+/// being created, destroyed, attached to, and detached from, instead of
+/// polling the \p SessionList.
+struct Subscribe
+{
+  MONOMUX_MESSAGE(SubscribeRequest, Subscribe);
+};
+
+/// A request from the client to the server to relay the output of sessions
+/// through a ring in shared memory, instead of the data connection. Both must
+/// run on the same host, which is always the case over a Unix domain socket.
+///
+/// \note The request is only valid after the data connection was established,
+/// and before attaching to a session.
+struct SharedOutput
+{
+  MONOMUX_MESSAGE(SharedOutputRequest, SharedOutput);
+};
+
+/// A request from the client to the server to compress the output of sessions
+/// sent on the data connection, as frames created by
+/// \p appendCompressedFrames(). It only pays off if the connection is slower
+/// than compressing, so the server only agrees if the connection is relayed,
+/// e.g. forwarded to another host, and not directly between two local
+/// processes.
+///
+/// \note The request is only valid after the data connection was established,
+/// and before attaching to a session.
+struct Compression
+{
+  MONOMUX_MESSAGE(CompressionRequest, Compression);
+};
+
+/// A request from the client to the server to hand the PTY of the attached
+/// session over, so the client can read and write it directly, without the
+/// server relaying the data.
+///
+/// \note The request is only valid if the client is the only one attached to
+/// the session. The server takes the PTY back once the client detaches.
+struct PtyHandOff
+{
+  MONOMUX_MESSAGE(PtyHandOffRequest, PtyHandOff);
+};
+
+/// A request from a client to the server to respond with the current values
+/// of its metrics.
+struct Metrics
+{
+  MONOMUX_MESSAGE(MetricsRequest, Metrics);
+  /// Whether the client accepts the response in multiple parts.
+  ///
+  /// \see response::Metrics::More
+  bool Streamed = false;
+};
+
+/// A request from a client to the server to respond with the records of the
+/// tracepoints of all its threads.
+struct Trace
+{
+  MONOMUX_MESSAGE(TraceRequest, Trace);
+  /// Whether the client accepts the response in multiple parts.
+  ///
+  /// \see response::Trace::More
+  bool Streamed = false;
+};
+
+/// A request from the client to the server to change the number of bytes per
+/// second read at most from the attached session.
+struct RateLimit
+{
+  MONOMUX_MESSAGE(RateLimitRequest, RateLimit);
+  /// The new limit, or \p 0 to disable rate limiting.
+  std::size_t BytesPerSecond{};
+};
+
+/// A request from the client to the server to relay the session identified by
+/// \p Name through a new channel over the data connection of the client. The
+/// output of every channel arrives in frames tagged by the channel, and the
+/// input is sent the same way, see \p appendChannelFrames().
+///
+/// \note The request is only valid after the data connection was established,
+/// and while the client is not attached to a session itself.
+struct OpenChannel
+{
+  MONOMUX_MESSAGE(OpenChannelRequest, OpenChannel);
+  /// The name of the session to relay.
+  std::string Name;
+
+  /// Whether the channel is read-only, \see Attach::Observer.
+  bool Observer = false;
+};
+
+/// A request from a client to the server to search the scrollback of the
+/// sessions for the lines containing \p Pattern.
+///
+/// \note The server searches in the background, and the response might only
+/// arrive after other messages.
+struct Search
+{
+  MONOMUX_MESSAGE(SearchRequest, Search);
+  /// The literal text to search for.
+  std::string Pattern;
+
+  /// The name of the session to search, or every session, if empty.
+  std::string Session;
+
+  /// The number of matches to respond with at most, or \p 0 for the limit of
+  /// the server.
+  std::size_t MaxMatches{};
 };
 
 } // namespace request
@@ -212,11 +488,30 @@ struct DataSocket
   monomux::message::Boolean Success;
 };
 
+/// The response to the \p request::DataSocketPair, sent by the server.
+///
+/// In case of \p Success, the client's end of the data connection is sent
+/// along this message on the \e Control connection, with
+/// \p Socket::sendFDs().
+struct DataSocketPair
+{
+  MONOMUX_MESSAGE(DataSocketPairResponse, DataSocketPair);
+  monomux::message::Boolean Success;
+};
+
 /// The response to the \p request::SessionList, sent by the server.
 struct SessionList
 {
   MONOMUX_MESSAGE(SessionListResponse, SessionList);
+  /// The requested sessions, in the order of their names.
   std::vector<monomux::message::SessionData> Sessions;
+
+  /// The number of sessions on the server, regardless of the filter. Only sent
+  /// if the request specified a \p Limit.
+  std::optional<std::size_t> Total;
+  /// Whether more matching sessions exist after the ones sent. Only sent if
+  /// the request specified a \p Limit.
+  bool More = false;
 };
 
 /// The response to the \p request::MakeSession,sent by the server.
@@ -239,6 +534,10 @@ struct Attach
   /// Information about the session the client attached to. Only meaningful if
   /// \p Success is \p true.
   SessionData Session;
+  /// The position in the output stream of the session of the first byte of
+  /// output sent to the client. Only sent if \p Success is \p true and the
+  /// request was \p Resumable.
+  std::optional<std::uint64_t> Offset;
 };
 
 /// The response to the \p request::Detach indicating receipt.
@@ -256,6 +555,123 @@ struct Statistics
   /// \warning This text is \b NOT meant to be machine-readable, and only useful
   /// for development and debugging by a human!
   std::string Contents;
+  /// Whether this is one part of a streamed response, which is followed by
+  /// the rest of the \p Contents in further responses. The last part has this
+  /// flag unset.
+  bool More = false;
+};
+
+/// The response to the \p request::Protocol, sent by the server in the text
+/// encoding.
+struct Protocol
+{
+  MONOMUX_MESSAGE(ProtocolResponse, Protocol);
+  /// The version of the binary encoding the server uses for the messages sent
+  /// after this response, or \p 0 if the server keeps using the text
+  /// encoding.
+  std::uint8_t BinaryVersion{};
+};
+
+/// The response to the \p request::Subscribe, sent by the server.
+struct Subscribe
+{
+  MONOMUX_MESSAGE(SubscribeResponse, Subscribe);
+  /// The sessions running on the server at the time of subscribing. Every
+  /// later change is sent as a \p notification::SessionEvent.
+  std::vector<monomux::message::SessionData> Sessions;
+};
+
+/// The response to the \p request::SharedOutput, sent by the server.
+///
+/// In case of \p Success, the handles of the shared memory and its doorbells
+/// had been sent through the \e Data connection before this message, with
+/// \p Socket::sendFDs().
+struct SharedOutput
+{
+  MONOMUX_MESSAGE(SharedOutputResponse, SharedOutput);
+  monomux::message::Boolean Success;
+};
+
+/// The response to the \p request::Compression, sent by the server. In case of
+/// \p Success, everything the server sends on the \e Data connection from now
+/// on is compressed.
+struct Compression
+{
+  MONOMUX_MESSAGE(CompressionResponse, Compression);
+  monomux::message::Boolean Success;
+};
+
+/// The response to the \p request::PtyHandOff, sent by the server.
+///
+/// In case of \p Success, the handle of the PTY is sent along this message on
+/// the \e Control connection, with \p Socket::sendFDs().
+struct PtyHandOff
+{
+  MONOMUX_MESSAGE(PtyHandOffResponse, PtyHandOff);
+  monomux::message::Boolean Success;
+};
+
+/// The response to the \p request::Metrics, sent by the server.
+///
+/// Unlike \p Statistics, this is meant to be machine-readable.
+struct Metrics
+{
+  MONOMUX_MESSAGE(MetricsResponse, Metrics);
+  /// The samples of the metrics. The samples of the same metric are adjacent.
+  std::vector<Metric> Samples;
+  /// Whether this is one part of a streamed response, which is followed by
+  /// further samples in further responses.
+  bool More = false;
+};
+
+/// The response to the \p request::Trace, sent by the server.
+///
+/// \note The timestamps are of the monotonic clock of the server's host.
+struct Trace
+{
+  MONOMUX_MESSAGE(TraceResponse, Trace);
+  /// The records of every thread, ordered by their timestamp.
+  std::vector<trace::Record> Records;
+  /// Whether this is one part of a streamed response, which is followed by
+  /// further records in further responses.
+  bool More = false;
+};
+
+/// The response to the \p request::RateLimit, sent by the server.
+struct RateLimit
+{
+  MONOMUX_MESSAGE(RateLimitResponse, RateLimit);
+  /// Whether the client was attached to a session whose limit was changed.
+  monomux::message::Boolean Success;
+};
+
+/// The response to the \p request::OpenChannel, sent by the server.
+struct OpenChannel
+{
+  MONOMUX_MESSAGE(OpenChannelResponse, OpenChannel);
+  monomux::message::Boolean Success;
+  /// The channel that tags the data of the session. Only meaningful if
+  /// \p Success is \p true.
+  ChannelID Channel{};
+  /// Information about the session of the channel. Only meaningful if
+  /// \p Success is \p true.
+  SessionData Session;
+};
+
+/// The response to the \p request::Search, sent by the server.
+struct Search
+{
+  MONOMUX_MESSAGE(SearchResponse, Search);
+  /// Whether the search was performed. It is not if the requested session
+  /// does not exist or the pattern is empty.
+  monomux::message::Boolean Success;
+
+  /// The matches, ordered by the name of the session and the offset.
+  std::vector<SearchMatch> Matches;
+
+  /// Whether the search stopped early, as the maximum number of matches was
+  /// reached.
+  bool Truncated = false;
 };
 
 } // namespace response
@@ -294,6 +710,9 @@ struct Detached
     ///
     /// \see Reason
     Kicked,
+    /// The server is being replaced by a new binary, which keeps the sessions
+    /// running, and accepts connections again shortly.
+    ServerUpgrade,
   };
   DetachMode Mode = Detach;
 
@@ -318,6 +737,60 @@ struct Redraw
   unsigned short Columns{};
 };
 
+/// A notification sent by the client to the server to stop relaying a channel
+/// opened with \p request::OpenChannel.
+struct CloseChannel
+{
+  MONOMUX_MESSAGE(CloseChannelNotification, CloseChannel);
+  ChannelID Channel{};
+};
+
+/// A notification sent by the server to the client indicating that a channel
+/// was closed because its session detached from it, e.g. as the session
+/// exited. The data of the channel sent before is still delivered.
+struct ChannelClosed
+{
+  MONOMUX_MESSAGE(ChannelClosedNotification, ChannelClosed);
+  ChannelID Channel{};
+  /// The circumstances of the detachment, as if the channel was a client.
+  Detached Reason;
+};
+
+/// A notification sent by the client to the server to apply window
+/// resize/redraw to the session of a channel. \see Redraw.
+struct ChannelRedraw
+{
+  MONOMUX_MESSAGE(ChannelRedrawNotification, ChannelRedraw);
+  ChannelID Channel{};
+  unsigned short Rows{};
+  unsigned short Columns{};
+};
+
+/// A notification sent by the server to the clients that subscribed with
+/// \p request::Subscribe about a change of a session.
+struct SessionEvent
+{
+  MONOMUX_MESSAGE(SessionEventNotification, SessionEvent);
+  enum EventKind
+  {
+    /// The session was created.
+    Created,
+    /// The session exited and was destroyed.
+    Destroyed,
+    /// A client attached to the session.
+    Attached,
+    /// A client detached from the session.
+    Detached,
+  };
+  EventKind Event = Created;
+
+  /// The session the event happened to.
+  SessionData Session;
+
+  /// The number of clients attached to the session after the event.
+  std::size_t AttachedClients{};
+};
+
 } // namespace notification
 
 } // namespace monomux::message
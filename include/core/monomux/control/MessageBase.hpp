@@ -18,10 +18,14 @@
  */
 #pragma once
 #include <cstdint>
+#include <cstring>
 #include <optional>
 #include <string>
 #include <string_view>
 
+#include "monomux/Allocation.hpp"
+#include "monomux/control/BinaryEncoding.hpp"
+
 namespace monomux::message
 {
 
@@ -92,8 +96,119 @@ enum class MessageKind : std::uint16_t
   StatisticsRequest,
   /// A response to the \p StatisticsRequest.
   StatisticsResponse,
+
+  /// A request to the server to use the binary encoding for the messages sent
+  /// on the connection.
+  ProtocolRequest,
+  /// A response to the \p ProtocolRequest containing the encoding the server
+  /// uses from now on.
+  ProtocolResponse,
+
+  /// A request to the server to push the changes of the sessions to the
+  /// client from now on.
+  SubscribeRequest,
+  /// A response to the \p SubscribeRequest containing the snapshot of the
+  /// sessions the later \p SessionEventNotification messages are relative to.
+  SubscribeResponse,
+  /// A notification sent by the server to the subscribed clients about a
+  /// change of a session.
+  SessionEventNotification,
+
+  /// A request to the server to send the output of sessions to the client
+  /// through memory shared between them, instead of the data connection.
+  SharedOutputRequest,
+  /// A response to the \p SharedOutputRequest indicating whether the shared
+  /// memory was set up.
+  SharedOutputResponse,
+
+  /// A request to the server to hand the PTY of the attached session over to
+  /// the client, which will then exchange data with it directly.
+  PtyHandOffRequest,
+  /// A response to the \p PtyHandOffRequest indicating whether the PTY was
+  /// handed over.
+  PtyHandOffResponse,
+
+  /// A request to the server to respond with the current values of its
+  /// metrics.
+  MetricsRequest,
+  /// A response to the \p MetricsRequest.
+  MetricsResponse,
+
+  /// A request to the server to respond with the records of its tracepoints.
+  TraceRequest,
+  /// A response to the \p TraceRequest.
+  TraceResponse,
+
+  /// A request to the server to change the rate limit of the output of the
+  /// attached session.
+  RateLimitRequest,
+  /// A response to the \p RateLimitRequest indicating whether the limit was
+  /// changed.
+  RateLimitResponse,
+
+  /// A request to the server to multiplex the output of a session, tagged by
+  /// a channel, over the data connection of the client.
+  OpenChannelRequest,
+  /// A response to the \p OpenChannelRequest containing the channel assigned.
+  OpenChannelResponse,
+  /// A notification to the server to stop multiplexing a channel.
+  CloseChannelNotification,
+  /// A notification sent by the server to a client indicating that one of its
+  /// channels had been closed.
+  ChannelClosedNotification,
+  /// A notification to the server to apply window resize/redraw to the
+  /// session of a channel.
+  ChannelRedrawNotification,
+
+  /// A request to the server to search the scrollback of sessions for a
+  /// pattern.
+  SearchRequest,
+  /// A response to the \p SearchRequest containing the matches found.
+  SearchResponse,
+
+  /// A request to the server to create the data connection of the client as
+  /// a socket pair, and send one end to the client, instead of the client
+  /// connecting a second time.
+  DataSocketPairRequest,
+  /// A response to the \p DataSocketPairRequest indicating whether the data
+  /// connection was created.
+  DataSocketPairResponse,
+
+  /// A request to the server to compress the output of sessions sent on the
+  /// data connection.
+  CompressionRequest,
+  /// A response to the \p CompressionRequest indicating whether the output is
+  /// compressed from now on.
+  CompressionResponse,
+  // (If adding new kinds, update MessageKindCount!)
+};
+
+/// The number of \p MessageKind values, which are dense from \p 0.
+constexpr std::size_t MessageKindCount =
+  static_cast<std::size_t>(MessageKind::CompressionResponse) + 1;
+
+/// The encodings the body of a message can be transmitted in.
+enum class Encoding : std::uint8_t
+{
+  /// The tag-delimited text form, which every peer understands.
+  Text,
+  /// The compact binary form, which is only sent to peers that negotiated it
+  /// with a \p ProtocolRequest.
+  Binary
 };
 
+/// The version of the binary encoding implemented. The body of a message in
+/// the binary encoding starts with this byte, which the body of a message in
+/// the text encoding (starting with a \p '<') never does.
+constexpr std::uint8_t BinaryVersion = 1;
+
+/// \returns whether the \p Body of a message is in the binary encoding.
+inline bool isBinaryBody(std::string_view Body) noexcept
+{
+  return !Body.empty() &&
+         static_cast<std::uint8_t>(Body.front()) == BinaryVersion;
+}
+
 /// Helper class that contains the parsed \p MessageKind of a \p Message, and
 /// the remaining, not yet parsed \p Buffer.
 struct Message
@@ -121,24 +236,73 @@ struct Message
   static Message unpack(std::string_view Str) noexcept;
 };
 
-/// Encodes a message object into its raw data form.
-template <typename T> std::string encode(const T& Msg)
+/// Writes the packed form of a message object (as created by
+/// \p Message::pack()), with the body in the \p BodyEncoding, through the
+/// \p Writer, without building intermediate buffers.
+template <typename T>
+void serialise(BinaryWriter& Writer, const T& Msg, Encoding BodyEncoding)
 {
-  std::string RawForm = T::encode(Msg);
-
-  Message MB;
-  MB.Kind = Msg.Kind;
-  MB.RawData = RawForm;
+  MONOMUX_ALLOCATION_SCOPE(Message);
+  const MessageKind Kind = Msg.Kind;
+  const std::string_view KindBytes{reinterpret_cast<const char*>(&Kind),
+                                   sizeof(MessageKind)};
+  if (BodyEncoding == Encoding::Binary)
+  {
+    Writer.bytes(KindBytes);
+    Writer.integer(BinaryVersion);
+    T::encodeBinary(Writer, Msg);
+  }
+  else
+  {
+    // (Encode the text first, so a failure leaves nothing written.)
+    std::string Body = T::encode(Msg);
+    Writer.bytes(KindBytes);
+    Writer.bytes(Body);
+  }
+  Writer.bytes({"\0", 1});
+}
 
-  return MB.pack();
+/// Encodes a message object into its raw data form, with the body in the
+/// \p BodyEncoding.
+template <typename T>
+std::string encode(const T& Msg, Encoding BodyEncoding = Encoding::Text)
+{
+  std::string Payload;
+  BinaryWriter Writer{Payload};
+  serialise(Writer, Msg, BodyEncoding);
+  return Payload;
 }
 
 /// Encodes a message object into its raw data form, prefixed with a payload
 /// size.
-template <typename T> std::string encodeWithSize(const T& Msg)
+template <typename T>
+std::string encodeWithSize(const T& Msg,
+                           Encoding BodyEncoding = Encoding::Text)
 {
-  std::string Payload = encode(Msg);
-  return Message::sizeToBinaryString(Payload.size()) + std::move(Payload);
+  // The size is only known after the message is written after it.
+  std::string Payload(sizeof(std::size_t), '\0');
+  BinaryWriter Writer{Payload};
+  serialise(Writer, Msg, BodyEncoding);
+
+  const std::size_t Size = Payload.size() - sizeof(std::size_t);
+  std::memcpy(Payload.data(), &Size, sizeof(std::size_t));
+  return Payload;
+}
+
+/// Decodes the \p Body of a message, in either encoding, as a specific message
+/// object, and returns it if successful.
+template <typename T> std::optional<T> decodeBody(std::string_view Body)
+{
+  MONOMUX_ALLOCATION_SCOPE(Message);
+  if (!isBinaryBody(Body))
+    return T::decodeText(Body);
+
+  Body.remove_prefix(sizeof(BinaryVersion));
+  BinaryReader Reader{Body};
+  std::optional<T> Msg = T::decodeBinary(Reader);
+  if (!Reader.done())
+    return std::nullopt;
+  return Msg;
 }
 
 /// Decodes the given received buffer as a specific message object, and returns
@@ -23,14 +23,45 @@
 namespace monomux::message
 {
 
-/// Sends a specific message, fully encoded for transportation, on the
-/// \p Channel.
+namespace detail
+{
+
+inline void appendToChannel(void* Channel, std::string_view Bytes)
+{
+  static_cast<BufferedChannel*>(Channel)->bufferWrite(Bytes);
+}
+
+} // namespace detail
+
+/// Sends a specific message, fully encoded for transportation in the
+/// \p BodyEncoding, on the \p Channel.
+///
+/// The message is serialised in-place into the write buffer of the
+/// \p Channel, and the size prefix is filled in once the size is known, so
+/// messages in the binary encoding are sent without allocating memory.
+///
+/// \returns the number of bytes sent, which includes data that had been
+/// buffered on the \p Channel before the message.
 ///
 /// \note This operation \b MAY block.
 template <typename T>
-std::size_t sendMessage(BufferedChannel& Channel, const T& Msg)
+std::size_t sendMessage(BufferedChannel& Channel,
+                        const T& Msg,
+                        Encoding BodyEncoding = Encoding::Text)
 {
-  return Channel.write(encodeWithSize(Msg));
+  const std::size_t Begin = Channel.writeInBuffer();
+  const std::size_t Placeholder = 0;
+  Channel.bufferWrite(
+    {reinterpret_cast<const char*>(&Placeholder), sizeof(std::size_t)});
+
+  BinaryWriter Writer{&Channel, &detail::appendToChannel};
+  serialise(Writer, Msg, BodyEncoding);
+
+  const std::size_t Size =
+    Channel.writeInBuffer() - Begin - sizeof(std::size_t);
+  Channel.overwriteBufferedWrite(
+    Begin, {reinterpret_cast<const char*>(&Size), sizeof(std::size_t)});
+  return Channel.commitWrites();
 }
 
 /// Reads a size-prefixed payload from the \p Channel.
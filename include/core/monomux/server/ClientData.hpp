@@ -18,11 +18,22 @@
  */
 #pragma once
 #include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
 #include <memory>
 #include <optional>
+#include <vector>
 
+#include "monomux/control/ChannelFrame.hpp"
+#include "monomux/control/FrameDecoder.hpp"
 #include "monomux/control/Message.hpp"
+#include "monomux/system/Pty.hpp"
+#include "monomux/system/SharedRing.hpp"
 #include "monomux/system/Socket.hpp"
+#include "monomux/system/SplicePipe.hpp"
+#include "monomux/system/Time.hpp"
 
 namespace monomux::server
 {
@@ -34,6 +45,13 @@ class ClientData
 {
 public:
   ClientData(std::unique_ptr<Socket> Connection);
+  /// Creates a \e channel of the \p Parent client, which is attached to a
+  /// session like a client, but has no connections of its own. Its data is
+  /// multiplexed over the data connection of the \p Parent, in frames tagged
+  /// by \p Channel.
+  ///
+  /// \see openChannel()
+  ClientData(ClientData& Parent, message::ChannelID Channel);
 
   std::size_t id() const noexcept { return ID; }
   /// Returns the most recent random-generated nonce for this client, and
@@ -52,14 +70,30 @@ public:
   {
     return LastActivity;
   }
-  void activity() noexcept { LastActivity = std::chrono::system_clock::now(); }
+  void activity() noexcept { LastActivity = LoopClock::now(); }
 
-  Socket& getControlSocket() noexcept { return *ControlConnection; }
-  Socket* getDataSocket() noexcept { return DataConnection.get(); }
+  Socket& getControlSocket() noexcept
+  {
+    return Parent ? Parent->getControlSocket() : *ControlConnection;
+  }
+  /// \returns the decoder that reassembles the messages received on the
+  /// control connection across multiple reads.
+  message::FrameDecoder& getControlFrames() noexcept { return ControlFrames; }
+  Socket* getDataSocket() noexcept
+  {
+    return Parent ? Parent->getDataSocket() : DataConnection.get();
+  }
+  const Socket* getDataSocket() const noexcept
+  {
+    return Parent ? Parent->getDataSocket() : DataConnection.get();
+  }
 
   /// Releases the control socket of the other client and associates it as the
   /// data connection of the current client.
   void subjugateIntoDataSocket(ClientData& Other) noexcept;
+  /// Associates the \p Connection created by the server as the data connection
+  /// of the current client.
+  void setDataSocket(std::unique_ptr<Socket> Connection) noexcept;
 
   SessionData* getAttachedSession() noexcept { return AttachedSession; }
   const SessionData* getAttachedSession() const noexcept
@@ -72,7 +106,140 @@ public:
     AttachedSession = &Session;
   }
 
+  /// \returns the absolute position in the output stream of the attached
+  /// session up to which the output had been delivered to the client.
+  std::size_t outputCursor() const noexcept { return OutputCursor; }
+  void setOutputCursor(std::size_t Position) noexcept
+  {
+    OutputCursor = Position;
+  }
+
+  /// \returns the number of bytes of session output sent to the client.
+  std::uint64_t sentBytes() const noexcept { return SentBytes; }
+  void countSent(std::size_t Bytes) noexcept { SentBytes += Bytes; }
+  /// \returns the number of bytes of input received from the client.
+  std::uint64_t receivedBytes() const noexcept { return ReceivedBytes; }
+  void countReceived(std::size_t Bytes) noexcept { ReceivedBytes += Bytes; }
+
+  /// \returns the kernel pipe used to relay session output to the client
+  /// without copying it through userspace, if such was created.
+  SplicePipe* getSplicePipe() noexcept { return Splice.get(); }
+  const SplicePipe* getSplicePipe() const noexcept { return Splice.get(); }
+  /// Creates the kernel pipe used to relay session output to the client.
+  ///
+  /// \throws std::system_error If creating the pipe failed.
+  SplicePipe& createSplicePipe();
+  /// \returns whether there is session output in the kernel pipe that was not
+  /// yet moved to the client's data connection.
+  bool hasSpliceResidue() const noexcept { return Splice && !Splice->empty(); }
+
+  /// \returns the ring in memory shared with the client through which session
+  /// output is relayed instead of the data connection, if such was set up.
+  SharedRing* getOutputRing() noexcept { return OutputRing.get(); }
+  const SharedRing* getOutputRing() const noexcept { return OutputRing.get(); }
+  void setOutputRing(std::unique_ptr<SharedRing> Ring) noexcept
+  {
+    OutputRing = std::move(Ring);
+  }
+
+  /// \returns whether the connection of the client failed while it was handled
+  /// by a worker thread of the server, and the client waits for the main loop
+  /// to tear it down.
+  bool isLeaving() const noexcept { return Leaving; }
+  void setLeaving() noexcept { Leaving = true; }
+
+  /// \returns the encoding of the messages sent to the client on the control
+  /// connection.
+  message::Encoding encoding() const noexcept
+  {
+    return Parent ? Parent->encoding() : ControlEncoding;
+  }
+  void setEncoding(message::Encoding Encoding) noexcept
+  {
+    ControlEncoding = Encoding;
+  }
+
+  /// \returns whether the connection of the client is relayed by another
+  /// process, e.g. a socket forwarded from another host, so descriptors can not
+  /// be sent to the client.
+  bool isRemote() const noexcept
+  {
+    return Parent ? Parent->isRemote() : Remote;
+  }
+  void setRemote() noexcept { Remote = true; }
+
+  /// \returns whether the output sent on the data connection of the client is
+  /// compressed, see \p appendCompressedFrames().
+  bool isCompressed() const noexcept { return Compressed; }
+  void setCompressed() noexcept { Compressed = true; }
+
+  /// \returns whether the client subscribed to the session events.
+  bool isSubscribed() const noexcept { return Subscribed; }
+  void setSubscribed() noexcept { Subscribed = true; }
+
+  /// \returns whether the client attached to its session read-only, only to
+  /// observe the output, e.g. to watch or record it.
+  bool isObserver() const noexcept { return Observer; }
+  void setObserver(bool Observer) noexcept { this->Observer = Observer; }
+
+  /// \returns whether the client asked to skip ahead to the most recent output
+  /// of its session, instead of receiving everything, if it lags behind too
+  /// much.
+  bool catchesUp() const noexcept { return CatchUp; }
+  void setCatchUp(bool CatchUp) noexcept { this->CatchUp = CatchUp; }
+
+  /// \returns the size of the terminal of the client, as most recently
+  /// reported by it, if ever.
+  const std::optional<Pty::WindowSize>& getWindowSize() const noexcept
+  {
+    return WindowSize;
+  }
+  void setWindowSize(Pty::WindowSize Size) noexcept { WindowSize = Size; }
+
+  /// \returns whether this is a channel of another client.
+  bool isChannel() const noexcept { return Parent; }
+  ClientData* getParent() noexcept { return Parent; }
+  /// \returns the identifier that tags the data of the channel.
+  message::ChannelID channel() const noexcept { return Channel; }
+
+  /// \returns whether the client ever opened a channel, after which the data
+  /// connection only carries the frames of the channels.
+  bool isMultiplexed() const noexcept { return Multiplexed; }
+  std::size_t channelCount() const noexcept { return Channels.size(); }
+  /// Creates a new channel of the client.
+  ///
+  /// \returns \p nullptr if every identifier is in use.
+  ClientData* openChannel();
+  ClientData* getChannel(message::ChannelID Channel) noexcept;
+  /// Destroys the record of the \p Channel, which must not be attached to a
+  /// session anymore.
+  void closeChannel(message::ChannelID Channel) noexcept;
+  /// \returns the channels of the client, starting with a different one at
+  /// every call, so each of them gets to use the shared data connection first
+  /// in turn.
+  std::vector<ClientData*> channelsInTurn();
+  /// \returns the decoder that reassembles the frames of the channels
+  /// received on the data connection.
+  message::FrameDecoder& getDataFrames() noexcept { return DataFrames; }
+
+  /// The function that sends the next part of a streamed response to the
+  /// client on the \p Control connection, in the \p Encoding.
+  ///
+  /// \returns whether more parts follow.
+  using ResponsePartFunction = bool(Socket& Control,
+                                    message::Encoding Encoding);
+  /// Adds a streamed response to be sent to the client, after the ones queued
+  /// earlier.
+  void queueResponseStream(std::function<ResponsePartFunction> Stream)
+  {
+    ResponseStreams.emplace_back(std::move(Stream));
+  }
+  bool hasResponseStream() const noexcept { return !ResponseStreams.empty(); }
+  /// Sends the next part of the earliest streamed response.
+  void sendResponsePart();
+
   /// Sends the specified detachment reason to the client, if it is connected.
+  /// For a channel, the parent is notified that the channel was closed.
   ///
   /// \param EC The exit code of the session that is detaching from. Not always
   /// meaningful.
@@ -91,6 +258,7 @@ private:
 
   /// The control connection transcieves control information and commands.
   std::unique_ptr<Socket> ControlConnection;
+  message::FrameDecoder ControlFrames;
 
   /// The data connection transcieves the actual program data.
   std::unique_ptr<Socket> DataConnection;
@@ -98,6 +266,56 @@ private:
   /// \e If the client is attached to a session, points to the data record of
   /// the session.
   SessionData* AttachedSession;
+
+  /// The position in the output stream of \p AttachedSession up to which the
+  /// data had been sent to the client.
+  ///
+  /// \note Data moved into \p Splice counts as being sent already.
+  std::size_t OutputCursor = 0;
+
+  /// The kernel pipe through which session output is relayed to the data
+  /// connection in \p splice() mode.
+  std::unique_ptr<SplicePipe> Splice;
+
+  /// The ring shared with the client that session output is written to
+  /// instead of \p DataConnection, if the client asked for it.
+  std::unique_ptr<SharedRing> OutputRing;
+
+  /// The encoding negotiated for the messages sent on \p ControlConnection.
+  message::Encoding ControlEncoding = message::Encoding::Text;
+
+  std::uint64_t SentBytes = 0;
+  std::uint64_t ReceivedBytes = 0;
+
+  /// The client whose connections the channel is multiplexed over, if this is
+  /// a channel.
+  ClientData* Parent = nullptr;
+  message::ChannelID Channel = 0;
+
+  /// The channels of the client, by their identifier.
+  ///
+  /// \note \p unique_ptr is used so the channels stay in place, as the
+  /// sessions refer to them.
+  std::map<message::ChannelID, std::unique_ptr<ClientData>> Channels;
+  /// The identifier tried first for the next channel.
+  message::ChannelID NextChannel = 1;
+  /// The channel that is the first in the next \p channelsInTurn().
+  message::ChannelID ChannelTurn = 0;
+  /// Reassembles the frames of the channels from \p DataConnection.
+  message::FrameDecoder DataFrames;
+
+  /// The responses that are sent in parts, interleaved with the other work of
+  /// the server, in the order of the requests.
+  std::deque<std::function<ResponsePartFunction>> ResponseStreams;
+
+  bool Leaving = false;
+  bool Subscribed = false;
+  bool Remote = false;
+  bool Compressed = false;
+  bool Observer = false;
+  bool CatchUp = false;
+  bool Multiplexed = false;
+  std::optional<Pty::WindowSize> WindowSize;
 };
 
 } // namespace monomux::server
@@ -5,6 +5,7 @@
 
 DISPATCH(ClientIDRequest, requestClientID)
 DISPATCH(DataSocketRequest, requestDataSocket)
+DISPATCH(DataSocketPairRequest, requestDataSocketPair)
 
 DISPATCH(SessionListRequest, requestSessionList)
 DISPATCH(MakeSessionRequest, requestMakeSession)
@@ -12,9 +13,23 @@ DISPATCH(AttachRequest, requestAttach)
 DISPATCH(DetachRequest, requestDetach)
 
 DISPATCH(SignalRequest, signalSession)
+DISPATCH(RateLimitRequest, requestRateLimit)
 
 DISPATCH(RedrawNotification, redrawNotified)
 
 DISPATCH(StatisticsRequest, statisticsRequest)
+DISPATCH(MetricsRequest, metricsRequest)
+DISPATCH(TraceRequest, traceRequest)
+DISPATCH(SearchRequest, requestSearch)
+
+DISPATCH(ProtocolRequest, requestProtocol)
+DISPATCH(SubscribeRequest, requestSubscribe)
+DISPATCH(SharedOutputRequest, requestSharedOutput)
+DISPATCH(CompressionRequest, requestCompression)
+DISPATCH(PtyHandOffRequest, requestPtyHandOff)
+
+DISPATCH(OpenChannelRequest, requestOpenChannel)
+DISPATCH(CloseChannelNotification, closeChannelNotified)
+DISPATCH(ChannelRedrawNotification, channelRedrawNotified)
 
 #undef DISPATCH
@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/control/FrameDecoder.hpp"
+#include "monomux/system/Process.hpp"
+#include "monomux/system/Socket.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux::server
+{
+
+/// A helper process that spawns processes on behalf of the process that
+/// started it.
+///
+/// Creating a process with \p fork() copies the page tables of the caller,
+/// which takes longer the more memory the caller holds. A server that keeps
+/// the buffers of many sessions would stall every relay for the duration. The
+/// helper is forked while the caller is still small, and the processes are
+/// created with \p Process::SpawnOptions::ChildOfParent, so they are still the
+/// children of the caller, which receives their PID and the master side of
+/// their PTY over a socket.
+///
+/// Requests are served in order, and their results are collected with
+/// \p results() once \p raw() becomes readable, without blocking the caller.
+class ForkServer
+{
+public:
+  /// The outcome of a request sent by \p spawn().
+  struct Result
+  {
+    /// The spawned process, if the spawn succeeded.
+    std::optional<Process> Spawned;
+    /// The reason the spawn failed, if it did.
+    std::string Error;
+    /// The PID of the process that was created but failed to \p exec(), if
+    /// the spawn failed so. It is the child of the caller, which must collect
+    /// it.
+    raw_pid FailedPID = Process::Invalid;
+  };
+
+  /// Forks the helper process.
+  ///
+  /// \note The helper inherits the state of the caller at the time of the
+  /// call, so this should be done before the caller allocates many resources
+  /// or starts threads.
+  ///
+  /// \throws std::system_error
+  static ForkServer start();
+
+  ForkServer(ForkServer&&) noexcept = default;
+  ForkServer& operator=(ForkServer&&) = delete;
+  /// Stops the helper process and waits for it to exit.
+  ~ForkServer();
+
+  /// \returns the PID of the helper process.
+  raw_pid pid() const noexcept { return Helper; }
+  /// \returns the file descriptor of the connection to the helper, which
+  /// becomes readable once results are available.
+  raw_fd raw() const noexcept { return Sock.raw(); }
+  /// \returns whether the helper process is still reachable.
+  bool alive() const noexcept { return !Sock.failed() && !Frames.corrupt(); }
+  /// \returns the number of requests that are still waiting for their result.
+  std::size_t pending() const noexcept { return Pending; }
+
+  /// Asks the helper to spawn a process with \p Opts. The result is returned
+  /// by a later \p results() call.
+  ///
+  /// \note The overrides of the standard streams in \p Opts are not
+  /// supported, as the descriptors are not valid in the helper.
+  ///
+  /// \throws std::system_error if the helper is not reachable.
+  void spawn(const Process::SpawnOptions& Opts);
+
+  /// \returns whether some requests could not be sent to the helper yet, in
+  /// which case \p flushRequests() should be called once \p raw() becomes
+  /// writable.
+  bool hasBufferedRequests() const noexcept { return Sock.hasBufferedWrite(); }
+  /// Sends the requests that could not be sent by \p spawn() at once.
+  void flushRequests();
+
+  /// Reads the results that arrived from the helper, without blocking, in the
+  /// order of the requests.
+  ///
+  /// \note If the helper is lost (see \p alive()), every request still pending
+  /// is returned as failed.
+  std::vector<Result> results();
+
+private:
+  ForkServer(Socket&& Sock, raw_pid Helper);
+
+  Socket Sock;
+  UniqueScalar<raw_pid, Process::Invalid> Helper;
+  message::FrameDecoder Frames;
+  /// The file descriptors that arrived with the results not yet decoded.
+  std::deque<fd> ReceivedFDs;
+  std::size_t Pending = 0;
+
+  /// The loop of the helper process, serving the requests arriving on
+  /// \p Sock, until the connection is closed.
+  [[noreturn]] static void serve(Socket& Sock);
+};
+
+} // namespace monomux::server
@@ -0,0 +1,128 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace monomux::server
+{
+
+/// Counts durations in buckets of exponentially growing width, cheaply enough
+/// to record one on every iteration of an event loop.
+class DurationHistogram
+{
+public:
+  /// Bucket \p I counts the durations of at most \p 2^I microseconds that do
+  /// not fit an earlier bucket. The last bucket counts every longer duration.
+  static constexpr std::size_t BucketCount = 24;
+
+  /// \returns the inclusive upper bound of bucket \p I, in microseconds.
+  static constexpr std::uint64_t bound(std::size_t I) noexcept
+  {
+    return std::uint64_t{1} << I;
+  }
+
+  void record(std::chrono::microseconds Duration) noexcept
+  {
+    const std::uint64_t US =
+      Duration.count() > 0 ? static_cast<std::uint64_t>(Duration.count()) : 0;
+    std::size_t I = 0;
+    while (I < BucketCount - 1 && US > bound(I))
+      ++I;
+    ++Buckets[I];
+    Sum += US;
+  }
+
+  /// Adds the observations of \p RHS to the current histogram.
+  void merge(const DurationHistogram& RHS) noexcept
+  {
+    for (std::size_t I = 0; I < BucketCount; ++I)
+      Buckets[I] += RHS.Buckets[I];
+    Sum += RHS.Sum;
+  }
+
+  const std::array<std::uint64_t, BucketCount>& buckets() const noexcept
+  {
+    return Buckets;
+  }
+  /// \returns the sum of the recorded durations, in microseconds.
+  std::uint64_t sum() const noexcept { return Sum; }
+
+private:
+  std::array<std::uint64_t, BucketCount> Buckets{};
+  std::uint64_t Sum = 0;
+};
+
+/// The counters of one event loop of a \p Server. They are only ever changed
+/// by the thread running the loop, and read while the thread is paused, so
+/// they are plain integers.
+struct LoopMetrics
+{
+  /// The number of times the loop woke up.
+  std::uint64_t Iterations = 0;
+  /// The number of events handled, including the manually scheduled ones.
+  std::uint64_t Events = 0;
+  /// The most events the system reported in a single wakeup.
+  std::uint64_t MaxEvents = 0;
+  /// The number of wakeups in which the system reported as many events as
+  /// fit into the notification array, leaving the rest for later iterations.
+  std::uint64_t Saturated = 0;
+  /// The number of events that were scheduled by the loop for itself, e.g.
+  /// because a read budget ran out, or a buffer overflowed.
+  std::uint64_t Rescheduled = 0;
+  /// The number of buffer overflows handled by rescheduling the connection.
+  std::uint64_t Overflows = 0;
+  /// The number of times a lagging client skipped ahead to the recent output.
+  std::uint64_t CatchUps = 0;
+  /// The number of system calls made by the thread of the loop.
+  std::uint64_t Syscalls = 0;
+  /// The number of bytes read from the sessions.
+  std::uint64_t OutputBytes = 0;
+  /// The number of bytes read from the clients and sent to the sessions.
+  std::uint64_t InputBytes = 0;
+  /// The time it took to handle the events of an iteration.
+  DurationHistogram IterationTime;
+  /// The number of connections accepted.
+  std::uint64_t Accepted = 0;
+  /// The time from the loop starting to accept a batch of pending connections
+  /// until each of them was set up.
+  DurationHistogram AcceptTime;
+
+  /// Adds the counters of \p RHS to the current ones.
+  void merge(const LoopMetrics& RHS) noexcept
+  {
+    Iterations += RHS.Iterations;
+    Events += RHS.Events;
+    MaxEvents = std::max(MaxEvents, RHS.MaxEvents);
+    Saturated += RHS.Saturated;
+    Rescheduled += RHS.Rescheduled;
+    Overflows += RHS.Overflows;
+    CatchUps += RHS.CatchUps;
+    Syscalls += RHS.Syscalls;
+    OutputBytes += RHS.OutputBytes;
+    InputBytes += RHS.InputBytes;
+    IterationTime.merge(RHS.IterationTime);
+    Accepted += RHS.Accepted;
+    AcceptTime.merge(RHS.AcceptTime);
+  }
+};
+
+} // namespace monomux::server
@@ -0,0 +1,145 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "monomux/system/RecordFile.hpp"
+
+namespace monomux::server
+{
+
+/// Records the output of a session and the input sent to it, with the time
+/// each piece was relayed at, so the traffic can be replayed later.
+///
+/// The file starts with \p Magic, followed by the records, each of which is
+/// the \p Direction as a byte, the time since the start of the recording in
+/// nanoseconds as a 64-bit integer, and the data prefixed with its length as
+/// a 32-bit integer. The integers are little-endian, as in
+/// \p message::BinaryWriter.
+class SessionRecording
+{
+public:
+  enum class Direction : std::uint8_t
+  {
+    /// Read from the PTY of the session.
+    Output = 1,
+    /// Sent by an attached client to the session.
+    Input = 2,
+  };
+
+  static constexpr std::string_view Magic{"MMXREC\x01\n", 8};
+  static constexpr std::string_view Extension = ".mmrec";
+  /// The size of the fields of a record before the data.
+  static constexpr std::size_t RecordHeaderSize = 1 + 8 + 4;
+  /// Recordings are written through a smaller buffer than the default, as
+  /// every recorded session has one.
+  static constexpr std::size_t BufferSize = 1ULL << 16; // 64 KiB
+
+  /// Creates the recording at \p Path, truncating the file if it exists.
+  ///
+  /// \throws std::system_error If the file could not be created.
+  static SessionRecording create(const std::string& Path);
+
+  /// Appends \p Data, the two parts of a buffer, as one record.
+  ///
+  /// \throws std::system_error If writing the file failed.
+  void record(Direction D, const std::array<std::string_view, 2>& Data);
+
+  /// \returns the number of records appended.
+  std::uint64_t records() const noexcept { return Records; }
+  /// \returns the number of bytes appended to the file.
+  std::uint64_t size() const noexcept { return File.size(); }
+
+private:
+  SessionRecording(RecordFile File);
+
+  RecordFile File;
+  std::chrono::steady_clock::time_point Start;
+  std::uint64_t Records = 0;
+};
+
+/// Reads the records of a \p SessionRecording in order, either from a
+/// read-only mapping of the file, or from a copy of its contents.
+class RecordingReader
+{
+public:
+  struct Record
+  {
+    /// The time since the start of the recording.
+    std::chrono::nanoseconds Time;
+    SessionRecording::Direction Direction;
+    /// A view of the data in the reader.
+    std::string_view Data;
+  };
+
+  /// Opens the recording at \p Path. If \p Map, the file is mapped into
+  /// memory, otherwise it is read entirely.
+  ///
+  /// \throws std::system_error If the file could not be read, or it is not a
+  /// recording.
+  static RecordingReader open(const std::string& Path, bool Map = true);
+  /// Reads the recording from the already loaded \p Contents.
+  ///
+  /// \throws std::system_error If \p Contents is not a recording.
+  explicit RecordingReader(std::string Contents);
+
+  RecordingReader(RecordingReader&& RHS) noexcept;
+  RecordingReader& operator=(RecordingReader&& RHS) noexcept;
+  RecordingReader(const RecordingReader&) = delete;
+  RecordingReader& operator=(const RecordingReader&) = delete;
+  ~RecordingReader();
+
+  bool isMapped() const noexcept { return Mapping; }
+
+  /// \returns the next record, or \p std::nullopt at the end of the recording.
+  ///
+  /// \warning The view of the data is only valid while the reader is alive!
+  std::optional<Record> next() noexcept;
+  /// \returns whether reading stopped at a malformed or truncated record,
+  /// e.g. because the recording server had been killed.
+  bool corrupt() const noexcept { return Corrupt; }
+  /// Restarts reading from the first record.
+  void rewind() noexcept { Position = SessionRecording::Magic.size(); }
+
+private:
+  RecordingReader(void* Mapping, std::size_t MappingSize);
+
+  void* Mapping = nullptr;
+  std::size_t MappingSize = 0;
+  std::string Contents;
+  std::size_t Position = SessionRecording::Magic.size();
+  bool Corrupt = false;
+
+  std::string_view data() const noexcept
+  {
+    if (Mapping)
+      return {static_cast<const char*>(Mapping), MappingSize};
+    return Contents;
+  }
+  /// \throws std::system_error If the data does not start with the magic.
+  void checkMagic() const;
+};
+
+} // namespace monomux::server
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace monomux::server
+{
+
+class SessionData;
+
+/// Searches the scrollback of a session for a literal pattern, a bounded
+/// amount at a time, so the event loop can serve other events between the
+/// steps. Each line is reported once, at its first match, together with the
+/// line itself. (A line longer than \p ContextMax after a match might be
+/// reported again for a later match.)
+///
+/// The output produced after the search started is not searched, and the
+/// scrollback dropped between two steps is skipped.
+class ScrollbackSearch
+{
+public:
+  /// The bytes of the line around a match that are reported at most on
+  /// either side of it.
+  static constexpr std::size_t ContextMax = 256;
+
+  struct Match
+  {
+    /// The position of the match in the output stream of the session.
+    std::size_t Offset;
+    /// The line that contains the match, without the line terminator, clipped
+    /// to \p ContextMax bytes on either side of the match.
+    std::string Context;
+  };
+
+  ScrollbackSearch(std::string Pattern, const SessionData& Session);
+
+  const std::string& pattern() const noexcept { return Pattern; }
+
+  /// Searches through the next at most \p Budget bytes of the scrollback of
+  /// \p Session, which must be the session the search was created for, and
+  /// appends the matches found to \p Matches.
+  ///
+  /// \returns whether the search finished.
+  bool step(const SessionData& Session,
+            std::size_t Budget,
+            std::vector<Match>& Matches);
+
+private:
+  std::string Pattern;
+  /// The position of the end of the output at the start of the search.
+  std::size_t End;
+
+  /// A copy of the output loaded in earlier steps, which is still needed
+  /// either for the context before the unsearched part, or to be searched.
+  std::string Window;
+  /// The position of the first byte of \p Window in the output stream.
+  std::size_t WindowBegin;
+  /// The position from which the matches are not searched for yet.
+  std::size_t ScanBegin;
+
+  std::size_t windowEnd() const noexcept
+  {
+    return WindowBegin + Window.size();
+  }
+};
+
+} // namespace monomux::server
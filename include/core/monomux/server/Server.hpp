@@ -17,24 +17,41 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <thread>
+#include <unordered_map>
 #include <variant>
+#include <vector>
 
 #include "monomux/adt/Atomic.hpp"
+#include "monomux/adt/HandoffQueue.hpp"
+#include "monomux/adt/SlotMap.hpp"
 #include "monomux/adt/SmallIndexMap.hpp"
 #include "monomux/adt/Tagged.hpp"
+#include "monomux/control/MessageBase.hpp"
 #include "monomux/system/Event.hpp"
 #include "monomux/system/Process.hpp"
 #include "monomux/system/Socket.hpp"
+#include "monomux/system/StatusPage.hpp"
 #include "monomux/system/fd.hpp"
 
 #include "ClientData.hpp"
+#include "ForkServer.hpp"
+#include "Metrics.hpp"
+#include "Recording.hpp"
+#include "ScrollbackSearch.hpp"
 #include "SessionData.hpp"
+#include "Upgrade.hpp"
+#include "Watchdog.hpp"
 
 namespace monomux::server
 {
@@ -86,6 +103,7 @@ public:
 
   /// Override the default handling logic for the specified message \p Kind to
   /// fire the user-given \p Handler \b instead \b of the built-in default.
+  /// An empty \p Handler restores the built-in default.
   void registerMessageHandler(std::uint16_t Kind,
                               std::function<HandlerFunction> Handler);
 
@@ -93,6 +111,228 @@ public:
   /// session running under it terminated.
   void setExitIfNoMoreSessions(bool ExitIfNoMoreSessions);
 
+  /// Sets whether the server should relay the output of sessions with exactly
+  /// one attached client through kernel pipes with \p splice(), without
+  /// copying the data through userspace buffers.
+  void setSpliceRelay(bool SpliceRelay);
+
+  /// Sets whether the \p loop() should wait for events with \p io_uring(7)
+  /// instead of \p epoll(7), if the kernel supports it.
+  void setIOUring(bool UseIOUring);
+
+  /// Sets the number of worker threads the sessions are distributed between.
+  /// Each worker runs its own event loop that relays the data of its sessions
+  /// and of the clients attached to them, while the main \p loop() keeps
+  /// handling new connections and control messages. A count of \p 0 handles
+  /// everything on the main loop.
+  ///
+  /// \note Workers always wait with \p epoll(7).
+  void setWorkerCount(std::size_t WorkerCount);
+
+  /// Sets whether the \p loop() should receive the signals of the server
+  /// through a \p signalfd(2), and observe the exit of sessions through
+  /// \p pidfd_open(2) handles, as events, instead of the asynchronous signal
+  /// handlers that only record what happened for the next iteration.
+  void setSignalEvents(bool SignalEvents);
+
+  /// Sets whether the \p loop() should start a \p ForkServer before it
+  /// allocates anything, and spawn the processes of new sessions through it,
+  /// so creating a session does not \p fork() the (potentially large) server
+  /// itself.
+  void setForkServer(bool UseForkServer);
+
+  /// Sets the number of idle sessions running the default shell that the
+  /// server keeps spawned in advance. A client creating a session with the
+  /// same program and no arguments or environment of its own is given one of
+  /// them, so it need not wait for the shell to start up.
+  void setSessionPoolSize(std::size_t Size);
+
+  /// Sets the time after which a session with no clients attached, which
+  /// neither produced output nor received input meanwhile, is hibernated:
+  /// the excess memory of its buffers is released, and its PTY is moved from
+  /// the event loop that relays it to a cold listen-set, which is itself
+  /// listened to by the main loop. The session is woken up when it produces
+  /// output, or a client attaches to it. \p 0 does not hibernate sessions.
+  void setHibernateAfter(std::chrono::seconds After);
+
+  /// The size of the scrollback kept for sessions if neither the server nor the
+  /// creating client specified one.
+  static constexpr std::size_t DefaultScrollbackSize = 1ULL << 20; // 1 MiB
+
+  /// Sets the size of the scrollback kept for sessions that did not request
+  /// a specific size when they were created.
+  void setScrollbackSize(std::size_t ScrollbackSize);
+
+  /// The amount of output pending delivery to an attached client after which
+  /// the server stops reading the output of the session, if flow control is
+  /// enabled.
+  static constexpr std::size_t FlowControlHighWatermark = 1ULL << 20; // 1 MiB
+  /// The amount of output pending delivery to the slowest attached client
+  /// under which reading the output of a throttled session resumes.
+  static constexpr std::size_t FlowControlLowWatermark = 1ULL << 18; // 256 KiB
+
+  /// Sets whether the server should stop reading the output of a session (and
+  /// thus make the program running in it block on its writes) while an
+  /// attached client is lagging behind receiving the output, instead of
+  /// buffering without a limit and kicking the client eventually.
+  void setFlowControl(bool FlowControl);
+
+  /// Decides the size of a session from the terminal sizes of the clients
+  /// attached to it, if they differ.
+  enum class SizePolicy
+  {
+    /// The size of the client that was active most recently, as chosen by
+    /// \p SessionData::getLatestClient(). Resizing a terminal counts as
+    /// activity.
+    Latest,
+    /// The smallest number of rows and columns among the clients, so the
+    /// entire screen fits into every terminal.
+    Smallest,
+    /// The size of the client that is attached the longest.
+    Owner,
+  };
+
+  /// The time resize requests for a session are collected for before the size
+  /// is negotiated and set, so a client being resized continuously, or many
+  /// clients resizing at once, make the program redraw its screen only once.
+  static constexpr std::chrono::milliseconds ResizeCoalesceWindow{50};
+
+  /// Sets how the size of a session is decided between its attached clients.
+  void setSizePolicy(SizePolicy Policy);
+
+  /// The amount of output pending delivery to a client that asked to catch up
+  /// after which the server discards the output the client did not receive,
+  /// instead of buffering more of it or throttling the session.
+  static constexpr std::size_t CatchUpThreshold = 1ULL << 19; // 512 KiB
+  /// The most of the recent output that is still sent to a client that caught
+  /// up, so it does not lose the context of the screen entirely.
+  static constexpr std::size_t CatchUpTail = 1ULL << 14; // 16 KiB
+
+  /// The percentages of the memory budget the usage has to reach for the
+  /// server to start relieving memory pressure, and drop under for it to
+  /// stop.
+  static constexpr std::size_t MemoryPressureHighPercent = 85;
+  static constexpr std::size_t MemoryPressureLowPercent = 70;
+  /// The interval at which the memory usage is compared to the budget.
+  static constexpr std::chrono::milliseconds MemoryBudgetCheckInterval{100};
+
+  /// Sets the number of bytes the buffers of the connections, and the output
+  /// backlog and scrollback of the sessions may use in total. A budget of
+  /// \p 0 disables the limit.
+  ///
+  /// Under memory pressure, the server stops reading the output of every
+  /// session that has output pending delivery, and releases the memory of the
+  /// largest buffers first, moving scrollback to the spill files.
+  void setMemoryBudget(std::size_t Budget);
+
+  /// \returns the number of bytes the buffers of the connections, and the
+  /// output backlog and scrollback of the sessions use.
+  static std::size_t memoryUsage() noexcept;
+
+  /// Sets whether the server should relay the output of sessions to the clients
+  /// that ask for it through a ring in memory shared with the client, instead
+  /// of writing it to the data connection.
+  void setSharedOutput(bool SharedOutput);
+
+  /// Sets the file descriptor to write a single byte to, and then close, once
+  /// the \p loop() is accepting connections. The process that started the
+  /// server waits on it instead of polling for the socket.
+  void setReadinessNotification(fd FD);
+
+  /// The number of bytes read from a session or a client's data connection in
+  /// one go, after which the rest of the available data is left for the next
+  /// iteration of the event loop, so other connections are not starved.
+  static constexpr std::size_t DrainBudget = 1ULL << 18; // 256 KiB
+
+  /// Input sent to a session at most this long ago makes the output of the
+  /// session bypass the coalescing window, so the echo of keystrokes is not
+  /// delayed.
+  static constexpr std::chrono::milliseconds CoalesceInputBypass{10};
+
+  /// The number of bytes of output the sessions that did not receive input
+  /// recently may relay in total in one iteration of an event loop. The budget
+  /// is shared equally between such sessions, so a flood of output from many
+  /// of them does not delay the handling of input for long.
+  static constexpr std::size_t IterationOutputBudget = 1ULL << 20; // 1 MiB
+  /// The least number of bytes of output a session may relay in one iteration
+  /// of an event loop, regardless of how many sessions share the
+  /// \p IterationOutputBudget.
+  static constexpr std::size_t SessionQuotaMin = 1ULL << 14; // 16 KiB
+
+  /// Sets the time the server waits to accumulate the output of sessions that
+  /// did not request a specific coalescing window when they were created. A
+  /// window of \p 0 disables coalescing.
+  void setCoalesceWindow(std::chrono::microseconds Window);
+  /// Sets the number of bytes per second read at most from the sessions that
+  /// did not request a specific rate limit when they were created. A limit of
+  /// \p 0 disables rate limiting.
+  void setRateLimit(std::size_t BytesPerSecond);
+  /// Changes the rate limit of the running \p Session, resuming reading its
+  /// output if it was paused by the previous limit.
+  ///
+  /// \see SessionData::setRateLimit()
+  void setSessionRateLimit(SessionData& Session, std::size_t BytesPerSecond);
+
+  /// The time the server stops accepting new connections for, if accepting
+  /// failed because the system ran out of resources.
+  static constexpr std::chrono::seconds AcceptRetryDelay{1};
+
+  /// The number of pending connections the kernel queues for the server to
+  /// accept, if not configured otherwise.
+  static constexpr std::size_t DefaultListenBacklog = 1024;
+  /// The number of connections accepted at most in one iteration of the event
+  /// loop. The rest stay queued for the next iteration, so many clients
+  /// reconnecting at once do not delay the relay of the existing sessions.
+  static constexpr std::size_t AcceptBudget = 64;
+
+  /// Sets the number of pending connections the kernel queues for the server
+  /// to accept, before refusing new ones.
+  ///
+  /// \see listen(2)
+  void setListenBacklog(std::size_t Backlog);
+
+  /// Sets the time an iteration of the \p loop() may take at most, after
+  /// which a \p Watchdog reports the loop as stalled, and captures what it is
+  /// stuck in. \p 0 does not watch the loop.
+  void setStallDeadline(std::chrono::milliseconds Deadline);
+
+  /// Sets the directory in which the output and the input of every session is
+  /// recorded with timestamps into a \p SessionRecording, e.g. to replay real
+  /// traffic in benchmarks. An empty \p Directory records nothing.
+  ///
+  /// \note Recorded sessions are never relayed with \p splice(), and their
+  /// PTY is never handed over to a client, so all the traffic passes through
+  /// the server.
+  void setRecordDirectory(std::string Directory);
+
+  /// The interval at which the activity of the sessions is republished in the
+  /// status page.
+  static constexpr std::chrono::seconds StatusPageInterval{1};
+
+  /// Sets whether the \p loop() should publish the state of the sessions in a
+  /// \p StatusPage next to the socket, through which clients can list the
+  /// sessions without connecting to the server.
+  ///
+  /// \see SocketPath::statusPagePath()
+  void setStatusPage(bool StatusPage);
+
+  /// The interval at which the buffers of idle sessions and clients are
+  /// considered for releasing their excess memory.
+  static constexpr std::chrono::seconds IdleSweepInterval{30};
+
+  /// The interval at which the scrollback of the sessions is compressed, if
+  /// the loop has nothing else to do at the time.
+  static constexpr std::chrono::milliseconds ScrollbackCompactInterval{250};
+  /// The amount of output compressed at most at once, so events arriving
+  /// meanwhile are not delayed by much.
+  static constexpr std::size_t ScrollbackCompactBudget = 1ULL << 20; // 1 MiB
+
+  /// The amount of the scrollback of a session searched at once, so events
+  /// arriving meanwhile are not delayed by much.
+  static constexpr std::size_t SearchStepBudget = 1ULL << 18; // 256 KiB
+  /// The number of matches a search responds with at most.
+  static constexpr std::size_t SearchMatchesMax = 1000;
+
   /// Start actively listening and handling connections.
   ///
   /// \note This is a blocking call!
@@ -103,8 +343,49 @@ public:
 
   /// After the server's \p listen() loop has terminated, performs graceful
   /// shutdown of connections and sessions.
+  ///
+  /// Every client is notified and disconnected first. Then every session is
+  /// sent a \p SIGHUP at once, and the exits are collected as they happen.
+  /// Sessions still running after the grace period are sent a \p SIGKILL,
+  /// and waited for at most \p ShutdownKillWait more.
   void shutdown();
 
+  /// The time sessions are given to exit after the \p SIGHUP of
+  /// \p shutdown(), if not configured otherwise.
+  static constexpr std::chrono::milliseconds DefaultShutdownGrace{3000};
+  /// The time waited for sessions to exit after they were sent a \p SIGKILL.
+  static constexpr std::chrono::milliseconds ShutdownKillWait{1000};
+  /// The interval at which the sessions an exit watch could not be opened for
+  /// are checked during \p shutdown().
+  static constexpr std::chrono::milliseconds ShutdownReapInterval{20};
+
+  /// Sets the time sessions are given to exit after a \p SIGHUP during
+  /// \p shutdown(), before they are killed.
+  void setShutdownGrace(std::chrono::milliseconds Grace);
+
+  /// Atomically request the server's \p listen() loop to die, so the server
+  /// can be replaced by a new binary that keeps the sessions running.
+  void requestUpgrade() const noexcept;
+  /// \returns whether the loop was terminated by \p requestUpgrade().
+  bool upgradeRequested() const noexcept
+  {
+    return UpgradeRequested.get().load();
+  }
+
+  /// After the server's \p listen() loop has terminated, disconnects the
+  /// clients, asking them to reconnect, and records the state of the sessions
+  /// for the binary the server is replaced with. The listening socket and the
+  /// PTYs of the sessions are made inheritable by the \p exec().
+  ///
+  /// \note The sessions are not terminated, and \p shutdown() must only be
+  /// called if the \p exec() failed.
+  UpgradeState handOver();
+
+  /// Takes over the sessions recorded by \p handOver() in the server process
+  /// the current one was \p exec()ed from. The sessions are served once the
+  /// \p loop() starts.
+  void resume(UpgradeState State);
+
 private:
   /// Create a data structure that allows us to (in the optimal case) quickly
   /// resolve a file descriptor to its origin kind, e.g. whether the connection
@@ -115,54 +396,471 @@ private:
     CT_None = 0,
     CT_ClientControl = 1,
     CT_ClientData = 2,
-    CT_Session = 4
+    CT_Session = 4,
+    CT_SessionExit = 8,
+    CT_ClientOutputRing = 16
   };
 
   using ClientControlConnection = Tagged<CT_ClientControl, ClientData>;
   using ClientDataConnection = Tagged<CT_ClientData, ClientData>;
   using SessionConnection = Tagged<CT_Session, SessionData>;
+  using SessionExitConnection = Tagged<CT_SessionExit, SessionData>;
+  using ClientOutputRingConnection = Tagged<CT_ClientOutputRing, ClientData>;
   using LookupVariant = std::variant<std::monostate,
                                      ClientControlConnection,
                                      ClientDataConnection,
-                                     SessionConnection>;
+                                     SessionConnection,
+                                     SessionExitConnection,
+                                     ClientOutputRingConnection>;
 
   Socket Sock;
   std::chrono::time_point<std::chrono::system_clock> WhenStarted;
 
   static constexpr std::size_t FDLookupSize = 256;
+  /// The number of pages of \p FDLookupSize file descriptors each that are
+  /// indexed directly, covering the usual hard limit of open files.
+  static constexpr std::size_t FDLookupPages = 4096;
   /// A quick lookup that associates a file descriptor to the data for the
   /// entity behind the file descriptor.
   SmallIndexMap<LookupVariant,
                 FDLookupSize,
                 /* StoreInPlace =*/true,
-                /* IntrusiveDefaultSentinel =*/true>
+                /* IntrusiveDefaultSentinel =*/true,
+                std::size_t,
+                FDLookupPages>
     FDLookup;
 
-  /// Map client IDs to the client information data structure.
-  ///
-  /// \note \p unique_ptr is used so changing the map's balancing does not
-  /// invalidate other references to the data.
-  std::map<std::size_t, std::unique_ptr<ClientData>> Clients;
+  /// Owns the data of the clients. Clients connect and disconnect often, and
+  /// the slots of the ones gone are reused by the next ones, while the
+  /// address of every client stays stable.
+  SlotMap<ClientData> Clients;
+  using ClientHandle = SlotMap<ClientData>::Handle;
+  /// Indexes \p Clients by their ID, which is the number of their control
+  /// connection.
+  SmallIndexMap<ClientData*,
+                FDLookupSize,
+                /* StoreInPlace =*/true,
+                /* IntrusiveDefaultSentinel =*/true,
+                std::size_t,
+                FDLookupPages>
+    ClientsByID;
+  /// The number of \p Clients that subscribed to the session events.
+  std::size_t Subscribers = 0;
 
-  /// Map terminal \p Sessions running under the current shell to their names.
+  /// Owns the data of every session of the server: the registered ones, the
+  /// ones in the \p SessionPool, and the ones waiting to be spawned. The
+  /// address of a session stays stable from its creation until its removal.
+  SlotMap<SessionData> Sessions;
+  /// Indexes the registered \p Sessions by their name. The keys view the name
+  /// stored in the \p SessionData itself.
+  std::unordered_map<std::string_view, SessionData*> SessionsByName;
+  /// Indexes the registered \p Sessions by their name, in order, so they can
+  /// be listed without sorting, and in pages.
+  std::map<std::string_view, SessionData*> SessionsInOrder;
+  /// Indexes \p Sessions by their \p SessionData::alias(), if they were
+  /// renamed.
+  std::unordered_map<std::string_view, SessionData*> SessionsByAlias;
+  /// Indexes \p Sessions and \p SessionPool by the PID of the process running
+  /// in them, at the time the session was registered.
+  std::unordered_map<Process::raw_handle, SessionData*> SessionsByPID;
+  /// Registers and indexes \p Session, which is owned by \p Sessions.
   ///
-  /// \note \p unique_ptr is used so changing the map's balancing does not
-  /// invalidate other references to the data.
-  std::map<std::string, std::unique_ptr<SessionData>> Sessions;
+  /// \returns \p nullptr if a session with the same name already exists, in
+  /// which case \p Session is destroyed.
+  SessionData* addSession(SessionData& Session);
+  /// \returns the registered sessions, in the order of their names.
+  std::vector<SessionData*> sessionsInOrder() const;
+  /// \returns at most \p Limit of the registered sessions whose name starts
+  /// with \p Prefix, after skipping the first \p Offset of them, in the order
+  /// of their names. The cost depends on \p Offset and \p Limit, and not on
+  /// the number of sessions.
+  ///
+  /// \param More Set to whether more matching sessions exist after the
+  /// returned ones.
+  std::vector<SessionData*> sessionsInOrder(std::string_view Prefix,
+                                            std::size_t Offset,
+                                            std::size_t Limit,
+                                            bool& More) const;
 
   static constexpr std::size_t DeadChildrenVecSize = 8;
   /// A list of process handles that were signalle
   mutable std::array<Process::raw_handle, DeadChildrenVecSize> DeadChildren;
 
   mutable Atomic<bool> TerminateLoop;
+  mutable Atomic<bool> UpgradeRequested;
   bool ExitIfNoMoreSessions;
+  bool SpliceRelay;
+  bool UseIOUring;
+  bool SignalEvents;
+  bool UseForkServer;
+  bool FlowControl;
+  bool SharedOutput;
+  bool PublishStatus;
+  SizePolicy Sizing;
+  std::size_t MemoryBudget;
+  /// Whether the memory usage had reached \p MemoryPressureHighPercent of the
+  /// budget, and did not drop under \p MemoryPressureLowPercent since.
+  Atomic<bool> MemoryPressure;
+  std::size_t ScrollbackSize;
+  std::chrono::microseconds CoalesceWindow;
+  std::size_t RateLimit;
+  std::size_t SessionPoolSize;
+  std::chrono::seconds HibernateAfter;
+  std::size_t ListenBacklog;
+  std::chrono::milliseconds StallDeadline;
+  std::chrono::milliseconds ShutdownGrace;
+  /// Set once \p shutdown() started, after which session events are not
+  /// published, as every client is being disconnected.
+  bool ShuttingDown = false;
+  std::string RecordDirectory;
   std::unique_ptr<EPoll> Poll;
+  /// The page the state of the sessions is published in, if \p PublishStatus.
+  std::optional<StatusPage> Status;
+  /// The most recently published contents of \p Status.
+  std::string PublishedStatus;
+  /// Set when a session event happened since the status was last published.
+  Atomic<bool> StatusStale;
+  /// The counters of the main loop.
+  LoopMetrics MainLoopMetrics;
+  /// Watches the main loop for stalls, if a \p StallDeadline is set.
+  std::unique_ptr<Watchdog> Watch;
+
+  /// A thread running an event loop for the sessions assigned to it, and the
+  /// data connections of the clients attached to them.
+  struct Worker
+  {
+    std::unique_ptr<EPoll> Poll;
+    std::thread Thread;
+    /// Held by the worker, except while it blocks waiting for events, and
+    /// held by the main loop while it changes the state of the sessions and
+    /// the clients.
+    std::mutex Lock;
+    /// Set while the main loop waits for \p Lock.
+    std::atomic<bool> Yield = false;
+    /// An \p eventfd(2) that wakes the worker up from its wait.
+    fd Wakeup;
+    /// The counters of the loop of the worker.
+    LoopMetrics Metrics;
+  };
+  std::size_t WorkerCount;
+  std::vector<std::unique_ptr<Worker>> Workers;
+  /// An \p eventfd(2) that wakes the main loop up to handle
+  /// \p LeavingClients.
+  fd Wakeup;
+  /// The IDs of the clients whose connection failed on a worker, and which
+  /// the main loop should tear down.
+  HandoffQueue<std::size_t> LeavingClients;
+  /// The session events that happened on a worker, and which the main loop
+  /// should send to the subscribed clients.
+  HandoffQueue<message::notification::SessionEvent> PendingSessionEvents;
+
+  /// A search of the scrollback of sessions requested by a client. Every
+  /// session is searched in steps on the event loop relaying it, so the
+  /// sessions of different workers are searched in parallel.
+  struct PendingSearch
+  {
+    /// The client that requested the search, to respond to.
+    ClientHandle Client;
+    std::size_t MaxMatches;
+    /// The names of the searched sessions, and the state of their search,
+    /// only accessed by the loop of the session.
+    std::vector<std::pair<std::string, ScrollbackSearch>> Sessions;
+
+    /// Guards the members below, which are updated by every loop.
+    std::mutex Lock;
+    /// The matches found, with the index of their session in \p Sessions.
+    std::vector<std::pair<std::size_t, ScrollbackSearch::Match>> Matches;
+    /// The number of sessions whose search did not finish yet.
+    std::size_t Remaining = 0;
+    /// Set once \p MaxMatches is exceeded, which stops the search.
+    bool Truncated = false;
+  };
+  /// The searches that finished on a worker, which the main loop should
+  /// respond to.
+  HandoffQueue<std::shared_ptr<PendingSearch>> FinishedSearches;
+
+  /// The helper spawning the processes of sessions, if \p UseForkServer is
+  /// set.
+  std::unique_ptr<ForkServer> Spawner;
+  /// A session waiting for its process to be spawned by the \p Spawner.
+  struct PendingSpawn
+  {
+    /// The client that requested the session, to respond to.
+    ClientHandle Client;
+    /// The session, owned by \p Sessions.
+    SessionData* Session;
+    /// Whether the session is spawned for the \p SessionPool, and no client
+    /// is waiting for it.
+    bool ForPool = false;
+    /// The program the session is spawned with, if \p ForPool.
+    std::string Program{};
+  };
+  /// The sessions waiting for the \p Spawner, in the order of the requests.
+  std::deque<PendingSpawn> PendingSpawns;
+  /// Registers the sessions whose process the \p Spawner had spawned (or
+  /// failed to), and responds to the clients that requested them.
+  void handleSpawnResults();
+  /// Spawns the process of \p Spawn as described by \p Opts, through the
+  /// \p Spawner if available.
+  void startSpawn(PendingSpawn Spawn, const Process::SpawnOptions& Opts);
+  /// Registers the session of \p Spawn with its process already set, and
+  /// responds to the client that requested it.
+  void finishSpawn(PendingSpawn Spawn);
+
+  /// A pre-spawned session that was not given to a client yet.
+  struct PooledSession
+  {
+    /// The program the session was spawned with.
+    std::string Program;
+    /// The session, owned by \p Sessions.
+    SessionData* Session;
+  };
+  /// The idle sessions kept for \p SessionPoolSize.
+  std::deque<PooledSession> SessionPool;
+  /// The number of sessions created for the pool so far, used to name them.
+  std::size_t PooledSessionCount = 0;
+  /// Spawns idle sessions until the pool (with the sessions being spawned for
+  /// it) is \p SessionPoolSize large.
+  void replenishSessionPool();
+  /// \returns whether \p Session is an idle member of the \p SessionPool.
+  bool isPooled(const SessionData& Session) const noexcept;
+  /// Starts relaying the output of \p Session and watching for its exit,
+  /// without announcing it to the clients.
+  void registerSessionIO(SessionData& Session);
+  /// The sessions taken over by \p resume() that the \p loop() did not start
+  /// serving yet.
+  std::vector<SessionData*> ResumedSessions;
+
+  /// A file descriptor held in reserve, to be freed for accepting and then
+  /// dropping connections while the server is out of file descriptors.
+  fd ReserveFD;
+
+  /// Written to once the server is listening, see
+  /// \p setReadinessNotification().
+  fd ReadinessNotification;
+
+  /// The \p signalfd(2) the server receives its signals through, if
+  /// \p SignalEvents is set.
+  fd SignalFD;
+  /// Blocks the handled signals and starts receiving them through
+  /// \p SignalFD.
+  void startSignalEvents();
+  /// Stops receiving signals through \p SignalFD and unblocks them.
+  void stopSignalEvents();
+  /// Handles the signals pending on \p SignalFD.
+  void handleSignalEvents();
+  /// Starts watching the exit of the process of \p Session through a
+  /// \p pidfd, if the kernel supports it.
+  void watchExit(SessionData& Session);
+  /// Stops watching the exit of the process of \p Session.
+  void unwatchExit(SessionData& Session);
 
   void reapDeadChildren();
+  /// Reaps every exited child process of the server, without a limit on how
+  /// many had exited since the last call.
+  void reapExitedChildren();
+  /// Destroys \p Session if its process had exited, notifying the attached
+  /// clients.
+  ///
+  /// \returns whether the process had been reaped.
+  bool reapSession(SessionData& Session);
   /// Sends a connection accpetance message to the client.
   void sendAcceptClient(ClientData& Client);
   /// Sends a rejection message to the client.
   void sendRejectClient(ClientData& Client, std::string Reason);
+  /// Relays the output of the \p Session to its only attached client with
+  /// \p splice(), if possible.
+  ///
+  /// \returns whether the relay was handled, or the output should be relayed
+  /// through the buffered path instead.
+  bool relayBySplice(SessionData& Session);
+  /// Drains the output of the \p Session that has no attached clients into a
+  /// scratch buffer, keeping only what the scrollback needs.
+  ///
+  /// \returns whether the relay was handled, or the output should be relayed
+  /// through the buffered path instead.
+  bool relayDetached(SessionData& Session);
+  /// Reads one chunk of output of \p Session and relays it to the attached
+  /// clients.
+  void relayOutput(SessionData& Session);
+  /// Moves the \p Clients of \p Session that lag too far behind in receiving
+  /// its output ahead to a short tail of the most recent output, and makes the
+  /// program in the session redraw its screen.
+  void catchUp(SessionData& Session, const std::vector<ClientData*>& Clients);
+  /// Reads one chunk of input from the data connection of \p Client and sends
+  /// it to the attached session.
+  ///
+  /// \returns the number of bytes read, or \p 0 if there was nothing to read
+  /// or the client disconnected.
+  std::size_t relayInput(ClientData& Client);
+  /// Reads the frames available on the multiplexed data connection of
+  /// \p Client, and sends the data of each to the session of its channel.
+  ///
+  /// \returns the number of bytes of the frames completed.
+  std::size_t relayChannelInput(ClientData& Client);
+  /// Writes the \p Data received from \p Client to the input of \p Session.
+  void writeInput(ClientData& Client,
+                  SessionData& Session,
+                  const BufferedChannel::BufferView& Data);
+  /// Pauses or resumes reading the output of \p Session, based on how much
+  /// data its slowest attached client has pending.
+  void updateFlowControl(SessionData& Session);
+  /// Decides whether reading the output of \p Session that became readable
+  /// should be deferred to accumulate more of it, and if so, opens the
+  /// coalescing window of the session.
+  ///
+  /// \returns whether the output should not be read now.
+  bool deferOutput(SessionData& Session);
+  /// Closes the coalescing window of \p Session, if open, and relays the output
+  /// accumulated during it.
+  void endCoalesceWindow(SessionData& Session);
+  /// Adds a timer that ends the coalescing window of \p Session at its
+  /// current deadline.
+  void armCoalesceTimer(SessionData& Session);
+  /// Negotiates the size of \p Session anew after \p ResizeCoalesceWindow,
+  /// unless a negotiation is already pending.
+  void requestResize(SessionData& Session);
+  /// \returns the size \p Session should have according to the
+  /// \p SizePolicy, or \p std::nullopt if no attached client reported one.
+  std::optional<Pty::WindowSize>
+  negotiateSize(const SessionData& Session) const;
+  /// Sets the negotiated size on the PTY of \p Session, if it differs from
+  /// the current one.
+  void resize(SessionData& Session);
+  /// Stops reading the output of \p Session, which exhausted its rate limit,
+  /// and adds a timer that resumes it once the bucket of the session is full
+  /// again.
+  void pauseForRateLimit(SessionData& Session);
+  /// Ends the rate limiting pause of \p Session, if paused, and relays the
+  /// output that arrived during it.
+  void endRatePause(SessionData& Session);
+  /// Accepts and immediately closes a pending connection with the help of
+  /// \p ReserveFD, so the client is not left hanging while the server is out
+  /// of file descriptors.
+  ///
+  /// \returns whether a connection was dropped.
+  bool shedConnection();
+  /// Releases the excess memory of the buffers of sessions and clients that
+  /// had been idle, and schedules the next sweep.
+  void sweepIdleResources();
+  /// Signals the process of every session, waits for them to exit, killing
+  /// the ones that stay after the \p ShutdownGrace, and removes the sessions.
+  void terminateSessions();
+
+  /// The listen-set of the PTYs of the hibernated sessions, if
+  /// \p HibernateAfter is set. It is always an epoll instance, as only that
+  /// can be nested into another event loop.
+  std::unique_ptr<EPoll> ColdPoll;
+  /// The sessions listened to in \p ColdPoll, by the file descriptor of
+  /// their PTY.
+  std::unordered_map<raw_fd, SessionData*> HibernatedSessions;
+  std::uint64_t HibernationCount = 0;
+  std::uint64_t WakeupCount = 0;
+  /// Hibernates the sessions that had been detached and silent for
+  /// \p HibernateAfter, and schedules the next check.
+  void hibernateIdleSessions();
+  /// Moves the PTY of \p Session to the \p ColdPoll, if it is idle.
+  ///
+  /// \returns whether the session was hibernated.
+  bool hibernate(SessionData& Session);
+  /// Moves the PTY of the hibernated \p Session back to the event loop that
+  /// relays it, and schedules reading its output.
+  void wake(SessionData& Session);
+  /// Wakes the sessions which PTY became readable in the \p ColdPoll.
+  void handleColdEvents();
+  /// Compresses the older part of the scrollback of the sessions, if no other
+  /// event is waiting, and schedules the next round.
+  ///
+  /// \see SessionData::compactOutput()
+  void compactScrollback();
+  /// Compares the memory usage to the budget, relieves the pressure or
+  /// resumes the sessions throttled because of it, and schedules the next
+  /// check.
+  void checkMemoryBudget();
+  /// Releases the excess memory of the largest buffers, and then evicts the
+  /// largest backlogs to the spill files, until the usage drops under
+  /// \p Target bytes.
+  void relieveMemory(std::size_t Target);
+
+  /// \returns the event loop that handles the connection of \p Session.
+  EPoll& pollOf(const SessionData& Session) const noexcept;
+  /// \returns the event loop that handles the data connection of \p Client.
+  EPoll& pollOf(const ClientData& Client) const noexcept;
+  /// \returns the worker that should handle a newly created session, or
+  /// \p std::nullopt if there are no workers.
+  std::optional<std::size_t> pickShard() const;
+  /// Starts the threads of \p Workers.
+  void startWorkers();
+  /// Terminates and joins the threads of \p Workers.
+  void stopWorkers();
+  /// The event loop of a worker thread.
+  void workerLoop(Worker& W);
+  /// Takes the lock of every worker, in order, so the main loop can change
+  /// the state shared with them.
+  void pauseWorkers();
+  /// Releases the locks taken by \p pauseWorkers(), and wakes the workers
+  /// which had events scheduled for them in the meantime.
+  void resumeWorkers();
+  /// Handles an event that fired for the connection of a session or a client
+  /// in the \p Current event loop.
+  void handleEvent(EPoll& Current, EPoll::EventWithMode Event);
+  /// Orders the indices of the first \p Count events reported by \p Poll
+  /// into \p Order, in which they should be handled: the events of the
+  /// clients and of everything else that is not the output of a session come
+  /// first, followed by the output of the sessions that received input
+  /// recently, and lastly the output of the other sessions.
+  ///
+  /// \returns the number of bytes each of the latter sessions may relay in the
+  /// iteration.
+  std::size_t orderEvents(EPoll& Poll,
+                          std::size_t Count,
+                          std::vector<std::size_t>& Order);
+  /// Moves the data connection of \p Client from the \p From event loop to
+  /// \p To.
+  void moveDataConnection(ClientData& Client, EPoll& From, EPoll& To);
+  /// Tears down \p Client whose connection failed. On a worker, the client is
+  /// only detached from its session, and the rest is handed off to the main
+  /// loop.
+  ///
+  /// \note A channel is closed instead, as its parent is torn down when the
+  /// connections of the parent fail.
+  void dropClient(ClientData& Client);
+  /// Tears down the clients handed off by the workers.
+  void handleLeavingClients();
+  /// Sends the \p Event to every subscribed client. If called on a worker,
+  /// the event is handed off to the main loop.
+  void publishSessionEvent(message::notification::SessionEvent Event);
+  /// Sends the session events handed off by the workers.
+  void handlePendingSessionEvents();
+  /// Publishes the name, creation time, number of attached clients, and the
+  /// time of the last activity of every session in the \p Status page, if it
+  /// changed since last published.
+  void publishStatus();
+  /// Publishes the status, and schedules the next refresh.
+  void refreshStatus();
+  /// Starts recording \p Session into a new file in \p RecordDirectory, if
+  /// set.
+  void startRecording(SessionData& Session);
+  /// Appends \p Data to the recording of \p Session, if it is recorded. If
+  /// the recording fails, it is stopped.
+  void record(SessionData& Session,
+              SessionRecording::Direction D,
+              const std::array<std::string_view, 2>& Data);
+  /// Starts the \p Watch of the loop, if a \p StallDeadline is set.
+  void startWatchdog();
+  /// Logs the \p Stall of the main loop, once it is over.
+  void reportStall(const Watchdog::Stall& Stall) const;
+  /// Searches the next part of the scrollback of the session at \p Index of
+  /// \p Search, and schedules the next step on the loop of the session. The
+  /// step that finishes the last session responds to the client, or, on a
+  /// worker, hands the search off to the main loop.
+  void stepSearch(const std::shared_ptr<PendingSearch>& Search,
+                  std::size_t Index);
+  /// Sends the matches of the finished \p Search to the client that
+  /// requested it.
+  void respondToSearch(PendingSearch& Search);
+  /// Responds to the searches handed off by the workers.
+  void handleFinishedSearches();
 
 public:
   /// Retrieve data about the client registered as \p ID.
@@ -171,6 +869,36 @@ public:
   /// Retrieve data about the session registered as \p Name.
   SessionData* getSession(std::string_view Name) noexcept;
 
+  /// \returns whether the process of a session named \p Name is being
+  /// spawned, and the session will be registered once it is running.
+  bool isSpawning(std::string_view Name) const noexcept;
+
+  /// Takes an idle session from the pool that runs \p Program without
+  /// arguments or environment of its own, registers it as \p Name (firing
+  /// \p createCallback()), and spawns its replacement in the pool.
+  ///
+  /// \returns the session, or \p nullptr if no such session was available.
+  SessionData* takePooledSession(std::string_view Program, std::string Name);
+
+  /// Spawns the process of \p Session as described by \p Opts, registers the
+  /// session (firing \p createCallback()), and sends the response to the
+  /// \p Client that requested it.
+  ///
+  /// \note If a \p ForkServer is used, this happens once the process is
+  /// running, in a later iteration of the \p loop().
+  void spawnSession(ClientData& Client,
+                    SessionData Session,
+                    const Process::SpawnOptions& Opts);
+
+  /// Starts searching the scrollback of the session named \p Session, or of
+  /// every session if empty, for \p Pattern, and responds to \p Client with
+  /// at most \p MaxMatches matches, or \p SearchMatchesMax if \p 0, once
+  /// the search finished in a later iteration of the \p loop().
+  void startSearch(ClientData& Client,
+                   std::string Pattern,
+                   std::string_view Session,
+                   std::size_t MaxMatches);
+
   /// Creates a new client on the server.
   ///
   /// \note Calling this function only manages the backing data structure and
@@ -181,6 +909,9 @@ public:
   ///
   /// \note Calling this function only manages the backing data structure and
   /// does \b NOT fire any associated callbacks!
+  ///
+  /// \note The process of the session must be set before the call, so the
+  /// session can be found when the process dies.
   SessionData* makeSession(SessionData Session);
 
   /// Delete the \p Client from the list of clients.
@@ -215,6 +946,10 @@ public:
   /// The clalback function that is fired for transmission on a \p Client's
   /// data connection. It sends the data received to the session the client
   /// attached to.
+  ///
+  /// \note The data connection is listened edge-triggered, so this function
+  /// reads it until it is drained, or \p DrainBudget is exhausted, in which
+  /// case the rest is scheduled for the next iteration.
   void dataCallback(ClientData& Client);
   /// The callback function that is fired when a \p Client has disconnected.
   void exitCallback(ClientData& Client);
@@ -224,10 +959,19 @@ public:
   /// The callback function that is fired when the server-side of a \p Session
   /// receives data. It sends the data received from the session to all attached
   /// clients.
+  ///
+  /// \note The session is listened edge-triggered, so this function reads it
+  /// until it is drained, or the quota of the session in the current iteration
+  /// is exhausted, in which case the rest is scheduled for the next iteration.
+  /// Sessions that received input recently may relay \p DrainBudget, the
+  /// others share \p IterationOutputBudget.
   void dataCallback(SessionData& Session);
   /// The callback function that is fired when a \p Client attaches to a
   /// \p Session.
-  void clientAttachedCallback(ClientData& Client, SessionData& Session);
+  void
+  clientAttachedCallback(ClientData& Client,
+                         SessionData& Session,
+                         std::optional<std::size_t> ResumeFrom = std::nullopt);
   /// The callback function that is fired when a \p Client had detached from a
   /// \p Session.
   void clientDetachedCallback(ClientData& Client, SessionData& Session);
@@ -241,16 +985,49 @@ public:
   /// This method takes care of associating that in the \p Clients map.
   void turnClientIntoDataOfOtherClient(ClientData& MainClient,
                                        ClientData& DataClient);
+  /// Creates the data connection of \p Client as a pair of connected sockets,
+  /// keeping one end for the server.
+  ///
+  /// \returns the other end, to be sent to the client.
+  fd makeDataSocketPair(ClientData& Client);
+  /// Starts handling the data connection that was just associated with
+  /// \p Client.
+  void registerDataSocket(ClientData& Client);
+
+  /// Detaches the \p Channel from its session, and destroys it.
+  void closeChannel(ClientData& Channel);
+
+  /// Starts relaying the output of sessions to \p Client through \p Ring,
+  /// whose handles had already been sent to the client.
+  void enableOutputRing(ClientData& Client, std::unique_ptr<SharedRing> Ring);
+  /// Resumes reading and writing the PTY of \p Session which was handed over
+  /// to a client.
+  void takeBackPty(SessionData& Session);
 
   /// \returns a statistical breakdown of the state of the server and the
   /// connections handled. This data is not meant to be machine-readable!
   std::string statistics() const;
 
+  /// \returns the current values of the metrics of the server: the counters
+  /// of the event loops summed across the threads, and the traffic of every
+  /// session and client.
+  std::vector<message::Metric> metrics() const;
+
 private:
-  /// Maps \p MessageKind to handler functions.
-  std::map<std::uint16_t, std::function<HandlerFunction>> Dispatch;
+  using DispatchTable =
+    std::array<HandlerFunction*, message::MessageKindCount>;
+  /// The built-in handler functions, indexed by \p MessageKind. This table is
+  /// generated from \p Dispatch.ipp at compile-time.
+  static const DispatchTable BuiltinDispatch;
+  /// The user-given handler functions, indexed by \p MessageKind, which take
+  /// precedence over \p BuiltinDispatch.
+  std::vector<std::function<HandlerFunction>> Overrides;
 
-  void setUpDispatch();
+  /// Calls the handler function for \p Kind.
+  ///
+  /// \returns whether a handler was found.
+  bool
+  dispatch(std::uint16_t Kind, ClientData& Client, std::string_view Message);
 
 #define DISPATCH(KIND, FUNCTION_NAME)                                          \
   static void FUNCTION_NAME(                                                   \
@@ -17,13 +17,24 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <chrono>
+#include <deque>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
+#include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/server/Recording.hpp"
 #include "monomux/system/Process.hpp"
+#include "monomux/system/SpillFile.hpp"
+#include "monomux/system/Time.hpp"
 
 namespace monomux::server
 {
@@ -37,18 +48,41 @@ public:
   SessionData(std::string Name)
     : Name(std::move(Name)), Created(std::chrono::system_clock::now())
   {}
+  SessionData(SessionData&&) noexcept = default;
+  ~SessionData();
 
   const std::string& name() const noexcept { return Name; }
+  /// \returns the name the session had before it was \p rename()d, which is
+  /// the one exposed to its process in the environment, or an empty string.
+  const std::string& alias() const noexcept { return Alias; }
+  /// Renames the session to \p Name, keeping the current name as its
+  /// \p alias(). The session is considered created at the time of the call.
+  ///
+  /// \note The indexes of the server are not updated by this call.
+  void rename(std::string Name)
+  {
+    Alias = std::move(this->Name);
+    this->Name = std::move(Name);
+    Created = std::chrono::system_clock::now();
+  }
+
   std::chrono::time_point<std::chrono::system_clock>
   whenCreated() const noexcept
   {
     return Created;
   }
+  /// Sets the creation timestamp of a session that was created by another
+  /// server process.
+  void setWhenCreated(
+    std::chrono::time_point<std::chrono::system_clock> When) noexcept
+  {
+    Created = When;
+  }
   std::chrono::time_point<std::chrono::system_clock> lastActive() const noexcept
   {
     return LastActivity;
   }
-  void activity() noexcept { LastActivity = std::chrono::system_clock::now(); }
+  void activity() noexcept { LastActivity = LoopClock::now(); }
 
   bool hasProcess() const noexcept { return MainProcess.has_value(); }
   void setProcess(Process&& Process) noexcept;
@@ -91,12 +125,299 @@ public:
   /// \returns the \p ClientData from all attached client which \p activity()
   /// field is the newest (most recently active client).
   ClientData* getLatestClient() const;
-  void attachClient(ClientData& Client);
+  /// Attaches \p Client to the session. If \p ResumeFrom is a position of
+  /// the output stream that is still retained, the client receives the output
+  /// from that position, instead of the usual scrollback replay.
+  void attachClient(ClientData& Client,
+                    std::optional<std::size_t> ResumeFrom = std::nullopt);
   void removeClient(ClientData& Client) noexcept;
 
+  /// The maximum number of bytes a single attached client might lag behind in
+  /// receiving the output of the session.
+  static constexpr std::size_t OutputBacklogMax = 1ULL << 31; // 2 GiB
+
+  /// \returns the position of the logical end of the output stream of the
+  /// session, i.e. the number of bytes the session had produced since it was
+  /// created.
+  std::size_t outputEnd() const noexcept
+  {
+    return OutputBacklogBegin + OutputBacklogSize;
+  }
+  /// \returns the number of bytes of output retained for clients that did not
+  /// receive it yet.
+  std::size_t outputBacklogSize() const noexcept { return OutputBacklogSize; }
+  /// \returns the number of separately stored chunks in the output backlog.
+  std::size_t outputBacklogChunks() const noexcept
+  {
+    return OutputBacklog.size();
+  }
+
+  /// \returns the number of bytes of the most recent output that is kept in the
+  /// backlog even if every attached client received it, to be replayed to
+  /// newly attaching clients.
+  std::size_t scrollbackSize() const noexcept { return ScrollbackSize; }
+  /// Sets the size of the scrollback kept for the session, clamped to
+  /// \p OutputBacklogMax. A size of \p 0 disables the scrollback.
+  void setScrollbackSize(std::size_t Size) noexcept;
+
+  /// The amount of the most recent output kept in memory, if the older parts
+  /// of the backlog can be spilled to disk.
+  static constexpr std::size_t ScrollbackResidentMax = 1ULL << 19; // 512 KiB
+
+  /// Sets the directory where the part of the backlog that is not kept in
+  /// memory is spilled to. If empty, the entire backlog is kept in memory.
+  void setSpillDirectory(std::string Directory) noexcept
+  {
+    SpillDirectory = std::move(Directory);
+  }
+  /// \returns the position of the first byte of the output stream that is
+  /// kept in memory uncompressed. Output before this position, if still
+  /// retained, is read from the compressed blocks or the spill file.
+  std::size_t outputResidentBegin() const noexcept
+  {
+    return OutputBacklogBegin;
+  }
+  /// \returns the number of bytes of output retained in the spill file.
+  std::size_t outputSpillSize() const noexcept
+  {
+    return Spill ? outputColdBegin() - outputRetainedBegin() : 0;
+  }
+
+  /// The size of the blocks the older part of the scrollback is compressed in.
+  static constexpr std::size_t ScrollbackBlockSize = 1ULL << 16; // 64 KiB
+  /// Compresses the output that is only kept for the scrollback, in blocks of
+  /// \p ScrollbackBlockSize, apart from the newest block, which stays
+  /// uncompressed for cheap appends and replay. The blocks are decompressed
+  /// when a client is replayed the scrollback.
+  ///
+  /// \returns the number of bytes of output compressed, which stops after
+  /// \p Budget is reached.
+  std::size_t compactOutput(std::size_t Budget);
+  /// \returns the number of bytes of output stored in compressed blocks.
+  std::size_t outputCompressedSize() const noexcept { return ColdOutputSize; }
+  /// \returns the number of bytes of memory the compressed blocks use.
+  std::size_t outputCompressedMemory() const noexcept
+  {
+    return ColdOutputMemory;
+  }
+  /// \returns the number of bytes of the spill file mapped into memory.
+  std::size_t outputSpillMappedSize() const noexcept
+  {
+    return Spill ? Spill->mappedSize() : 0;
+  }
+
+  /// Advances the output stream of the session with \p Data. If \p Retain is
+  /// set, the data is stored (once, for all clients) in the backlog, from
+  /// which attached clients that could not receive it yet can be served later.
+  ///
+  /// \note If the backlog is not empty or the session keeps a scrollback, the
+  /// data is always retained, as the backlog must not have holes.
+  void appendOutput(const std::array<std::string_view, 2>& Data, bool Retain);
+  /// Advances the output stream of the session by \p Bytes that were relayed
+  /// to the clients without passing through the server's buffers.
+  void skipOutput(std::size_t Bytes) noexcept
+  {
+    assert(OutputBacklog.empty() && "Output skipped while backlog is pending!");
+    OutputBacklogBegin += Bytes;
+  }
+  /// \returns a view into the output backlog, starting at the absolute stream
+  /// position \p Position, until the end of the contiguously stored chunk the
+  /// position belongs to. The view is empty if there is nothing to serve from
+  /// \p Position.
+  ///
+  /// \note A view into the spill file is only valid until the next call.
+  std::string_view peekOutput(std::size_t Position) const noexcept;
+  /// \returns the position of the first byte of the most recent
+  /// \p scrollbackSize() bytes of the retained output.
+  std::size_t scrollbackBegin() const noexcept
+  {
+    return std::max(outputRetainedBegin(),
+                    outputEnd() - std::min(ScrollbackSize, outputEnd()));
+  }
+  /// \returns a copy of the most recent \p scrollbackSize() bytes of the
+  /// retained output, including the part that was spilled to disk.
+  std::string copyScrollback() const;
+  /// Releases the chunks of the output backlog that were already delivered to
+  /// every attached client and are not part of the scrollback, and moves the
+  /// ones exceeding \p ScrollbackResidentMax to the spill file, if possible.
+  void trimOutput() noexcept { trimOutput(ScrollbackResidentMax); }
+  /// Moves the entire output backlog of a session with a scrollback to the
+  /// spill file, if possible, to relieve the memory of the server.
+  void evictOutput() noexcept { trimOutput(0); }
+
+  /// \returns the number of bytes of memory the output kept by all sessions
+  /// uses, counting the compressed blocks by their compressed size.
+  static std::size_t totalOutputBacklogSize() noexcept
+  {
+    return TotalOutputBacklogSize.load(std::memory_order_relaxed);
+  }
+
+  /// \returns whether reading the output of the session is paused because an
+  /// attached client is lagging behind in receiving it.
+  bool isOutputThrottled() const noexcept { return OutputThrottled; }
+  void setOutputThrottled(bool Throttled) noexcept
+  {
+    OutputThrottled = Throttled;
+  }
+
+  /// \returns the client the PTY of the session is handed over to, if any.
+  /// While handed over, the server neither reads nor writes the PTY.
+  ClientData* getHandedOffTo() const noexcept { return HandedOffTo; }
+  void setHandedOffTo(ClientData* Client) noexcept { HandedOffTo = Client; }
+
+  /// \returns whether the PTY of the session is listened to in the cold
+  /// listen-set of the server, because the session had been detached and
+  /// silent for long.
+  bool isHibernated() const noexcept { return Hibernated; }
+  void setHibernated(bool Hibernated) noexcept
+  {
+    this->Hibernated = Hibernated;
+  }
+
+  /// \returns the size most recently set on the PTY of the session by the
+  /// server.
+  const std::optional<Pty::WindowSize>& appliedSize() const noexcept
+  {
+    return AppliedSize;
+  }
+  void setAppliedSize(Pty::WindowSize Size) noexcept { AppliedSize = Size; }
+  /// \returns the time at which the size of the session is negotiated
+  /// between the attached clients, if a resize is pending.
+  const std::optional<std::chrono::steady_clock::time_point>&
+  resizeDeadline() const noexcept
+  {
+    return ResizeDeadline;
+  }
+  void setResizeDeadline(
+    std::optional<std::chrono::steady_clock::time_point> Deadline) noexcept
+  {
+    ResizeDeadline = Deadline;
+  }
+
+  /// The longest time the server may wait to accumulate the output of a
+  /// session before relaying it.
+  static constexpr std::chrono::microseconds CoalesceWindowMax{100'000};
+
+  /// \returns the time the server waits, after the output of the session
+  /// became readable, to accumulate more of it before relaying it to the
+  /// attached clients. A window of \p 0 relays the output immediately.
+  std::chrono::microseconds coalesceWindow() const noexcept
+  {
+    return CoalesceWindow;
+  }
+  /// Sets the coalescing window of the session, clamped to
+  /// \p CoalesceWindowMax.
+  void setCoalesceWindow(std::chrono::microseconds Window) noexcept
+  {
+    CoalesceWindow =
+      std::clamp(Window, decltype(Window)::zero(), CoalesceWindowMax);
+  }
+  /// \returns the time until which reading the output of the session is
+  /// deferred, if a coalescing window is currently open.
+  const std::optional<std::chrono::steady_clock::time_point>&
+  coalesceDeadline() const noexcept
+  {
+    return CoalesceDeadline;
+  }
+  void setCoalesceDeadline(
+    std::optional<std::chrono::steady_clock::time_point> Deadline) noexcept
+  {
+    CoalesceDeadline = Deadline;
+  }
+
+  /// The time of output a full rate limiting bucket holds, i.e. the most a
+  /// rate limited session may read in one burst after it was quiet.
+  static constexpr std::chrono::milliseconds RateLimitBurst{100};
+
+  /// \returns the number of bytes per second read at most from the PTY of the
+  /// session, or \p 0 if the output is not rate limited.
+  std::size_t rateLimit() const noexcept { return RateLimit; }
+  /// Sets the rate limit of the session, and fills its bucket. A limit of \p 0
+  /// disables rate limiting.
+  void setRateLimit(std::size_t BytesPerSecond) noexcept;
+  /// Refills the bucket of the session for the time elapsed until \p Now.
+  ///
+  /// \returns the number of bytes that may be read from the session, which is
+  /// unbounded if the session is not rate limited.
+  std::size_t
+  rateAllowance(std::chrono::steady_clock::time_point Now) noexcept;
+  /// Takes the \p Bytes read from the session out of its bucket.
+  ///
+  /// \note A single read might overdraw the bucket, which delays the time it is
+  /// full again accordingly.
+  void consumeRateAllowance(std::size_t Bytes) noexcept;
+  /// \returns the time at which the bucket of the session will be full again.
+  std::chrono::steady_clock::time_point rateRefillTime() const noexcept;
+  /// \returns the time until which reading the output of the session is
+  /// paused, if the session had exhausted its rate limit.
+  const std::optional<std::chrono::steady_clock::time_point>&
+  ratePauseDeadline() const noexcept
+  {
+    return RatePauseDeadline;
+  }
+  void setRatePauseDeadline(
+    std::optional<std::chrono::steady_clock::time_point> Deadline) noexcept
+  {
+    RatePauseDeadline = Deadline;
+  }
+
+  /// \returns the timestamp when an attached client most recently sent input
+  /// to the session.
+  std::chrono::steady_clock::time_point lastInput() const noexcept
+  {
+    return LastInput;
+  }
+  void inputActivity() noexcept
+  {
+    LastInput = std::chrono::steady_clock::now();
+  }
+
+  /// \returns the number of bytes of input sent to the session by the attached
+  /// clients since it was created.
+  std::uint64_t inputBytes() const noexcept { return InputBytes; }
+  void countInput(std::size_t Bytes) noexcept { InputBytes += Bytes; }
+
+  /// \returns whether output of the session may be relayed with \p splice().
+  ///
+  /// \note Output relayed in the kernel can not be kept in the scrollback, nor
+  /// be rate limited or recorded.
+  bool canSplice() const noexcept
+  {
+    return !SpliceUnsupported && !ScrollbackSize && !RateLimit && !Recording;
+  }
+  /// Disables \p splice() relaying of the session's output, e.g. because the
+  /// underlying file does not support it.
+  void disableSplice() noexcept { SpliceUnsupported = true; }
+
+  /// \returns the recording of the output and the input of the session, if
+  /// it is recorded.
+  SessionRecording* getRecording() noexcept
+  {
+    return Recording ? &*Recording : nullptr;
+  }
+  void startRecording(SessionRecording R) { Recording.emplace(std::move(R)); }
+  /// Stops recording the session, writing the end of the recording.
+  void stopRecording() noexcept { Recording.reset(); }
+
+  /// \returns the index of the worker thread of the server that handles the
+  /// connections of the session, or \p std::nullopt if the server's main
+  /// loop does.
+  std::optional<std::size_t> shard() const noexcept { return Shard; }
+  void setShard(std::optional<std::size_t> Shard) noexcept
+  {
+    this->Shard = Shard;
+  }
+
+  /// \returns the file descriptor that becomes readable when the process of
+  /// the session exits, or \p fd::Invalid if the server does not watch it.
+  raw_fd exitWatch() const noexcept { return ExitWatch.get(); }
+  void setExitWatch(fd Watch) noexcept { ExitWatch = std::move(Watch); }
+
 private:
   /// A user-given identifier for the session.
   std::string Name;
+  /// The name the session was created with, if it was renamed since.
+  std::string Alias;
   /// The timestamp when the session was spawned.
   std::chrono::time_point<std::chrono::system_clock> Created;
   /// The timestamp when the underlying program was most recently trasmitted
@@ -112,6 +433,122 @@ private:
 
   /// The list of clients currently attached to this session.
   std::vector<ClientData*> AttachedClients;
+
+  /// The output of the session that is pending delivery to at least one
+  /// attached client. The data is stored only once, and each client tracks its
+  /// own position (cursor) in the stream.
+  std::deque<std::string> OutputBacklog;
+  /// The absolute position in the output stream of the first byte stored in
+  /// \p OutputBacklog.
+  std::size_t OutputBacklogBegin = 0;
+  /// The number of bytes stored in \p OutputBacklog.
+  UniqueScalar<std::size_t, 0> OutputBacklogSize;
+  /// The number of bytes at the end of the output stream that is kept in
+  /// \p OutputBacklog for replaying to newly attaching clients.
+  std::size_t ScrollbackSize = 0;
+
+  /// A block of the output that precedes \p OutputBacklog in the stream, only
+  /// kept for the scrollback. It is stored as-is if it did not compress.
+  struct ColdBlock
+  {
+    std::string Data;
+    bool Compressed;
+  };
+  /// The compressed blocks of the scrollback, each \p ScrollbackBlockSize
+  /// bytes of output, ending at \p OutputBacklogBegin.
+  std::deque<ColdBlock> ColdOutput;
+  /// The number of bytes of output stored in \p ColdOutput.
+  std::size_t ColdOutputSize = 0;
+  /// The number of bytes of memory \p ColdOutput uses.
+  std::size_t ColdOutputMemory = 0;
+  /// The last block of \p ColdOutput decompressed for \p peekOutput(), and
+  /// its position in the output stream.
+  mutable std::string ColdCache;
+  mutable std::size_t ColdCacheBegin = -1;
+
+  /// \returns the position of the first byte of the output stream that is
+  /// kept in memory, either compressed or not.
+  std::size_t outputColdBegin() const noexcept
+  {
+    return OutputBacklogBegin - ColdOutputSize;
+  }
+  /// \returns the output stored in the block of \p ColdOutput at \p Index,
+  /// or an empty view if it could not be decompressed.
+  ///
+  /// \note The view is only valid until the next call.
+  std::string_view peekColdBlock(std::size_t Index) const noexcept;
+
+  /// The directory where the spill file is created.
+  std::string SpillDirectory;
+  /// The storage of the older part of the backlog that is not kept in memory.
+  /// The spill file, if exists, always ends at \p outputColdBegin().
+  std::unique_ptr<SpillFile> Spill;
+  /// The position in the output stream of the logical offset \p 0 of
+  /// \p Spill.
+  std::size_t SpillBase = 0;
+  /// Whether creating or writing the spill file had failed, in which case the
+  /// backlog is kept in memory entirely.
+  bool SpillFailed = false;
+
+  /// \returns the position of the first byte of the output stream that is
+  /// retained, either in memory or in the spill file.
+  std::size_t outputRetainedBegin() const noexcept
+  {
+    return Spill ? std::min(SpillBase + Spill->begin(), outputColdBegin())
+                 : outputColdBegin();
+  }
+  /// Appends the first block of \p ColdOutput, or if there is none, the first
+  /// chunk of \p OutputBacklog to the spill file.
+  ///
+  /// \returns whether the operation succeeded.
+  bool spillFrontChunk() noexcept;
+  /// Removes the first block of \p ColdOutput, or if there is none, the first
+  /// chunk of \p OutputBacklog from memory.
+  void popFrontChunk() noexcept;
+  /// Implements \p trimOutput(), keeping at most \p ResidentMax bytes of
+  /// memory used by the scrollback if the rest can be spilled.
+  void trimOutput(std::size_t ResidentMax) noexcept;
+
+  /// The sum of \p OutputBacklogSize and \p ColdOutputMemory of every
+  /// session.
+  static std::atomic<std::size_t> TotalOutputBacklogSize;
+
+  /// Whether the server stopped reading the output of the session.
+  bool OutputThrottled = false;
+  /// The client that exchanges data with the PTY directly, if any.
+  ClientData* HandedOffTo = nullptr;
+  bool Hibernated = false;
+  std::optional<Pty::WindowSize> AppliedSize;
+  std::optional<std::chrono::steady_clock::time_point> ResizeDeadline;
+
+  /// The time to wait for more output before relaying it.
+  std::chrono::microseconds CoalesceWindow{0};
+  /// The end of the currently open coalescing window, if any.
+  std::optional<std::chrono::steady_clock::time_point> CoalesceDeadline;
+  /// The number of bytes per second that may be read from the session.
+  std::size_t RateLimit = 0;
+  /// The number of bytes that may be read from the session right now. This is
+  /// negative if the most recent read overdrew the bucket.
+  double RateTokens = 0;
+  /// The time \p RateTokens was most recently refilled at.
+  std::chrono::steady_clock::time_point RateRefilled;
+  /// The end of the pause of a session that exhausted its rate limit, if any.
+  std::optional<std::chrono::steady_clock::time_point> RatePauseDeadline;
+
+  /// The timestamp when the session most recently received input.
+  std::chrono::steady_clock::time_point LastInput;
+  std::uint64_t InputBytes = 0;
+
+  /// Whether relaying the output with \p splice() had been found unsupported.
+  bool SpliceUnsupported = false;
+
+  std::optional<SessionRecording> Recording;
+
+  /// The worker thread the session is assigned to.
+  std::optional<std::size_t> Shard;
+
+  /// The \p pidfd of \p MainProcess, if the server watches its exit directly.
+  fd ExitWatch;
 };
 
 } // namespace monomux::server
@@ -0,0 +1,87 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "monomux/system/Process.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux::server
+{
+
+/// The state of a server that is handed over to the binary replacing it in a
+/// live upgrade. The processes of the sessions keep running, as the new binary
+/// is \p exec()ed in the same process, and inherits the listening socket and
+/// the master side of the PTY of every session.
+///
+/// Only the state that outlives the connections is recorded. Clients are
+/// disconnected during the upgrade, and reconnect to the new binary.
+struct UpgradeState
+{
+  /// The recorded state of a single session.
+  struct Session
+  {
+    std::string Name;
+    std::string Alias;
+    std::chrono::system_clock::time_point Created;
+    raw_pid PID;
+    /// The inherited master side of the PTY of the session, if it has one.
+    raw_fd PtyMaster = fd::Invalid;
+    std::string PtyName;
+    std::size_t ScrollbackSize;
+    std::chrono::microseconds CoalesceWindow;
+    std::size_t RateLimit = 0;
+    /// The retained output of the session, replayed to the clients that
+    /// reattach after the upgrade.
+    std::string Scrollback;
+    /// The position of the end of the output stream, so the offsets known to
+    /// resuming clients stay valid after the upgrade.
+    std::size_t OutputEnd = 0;
+  };
+
+  /// The inherited listening socket of the server.
+  raw_fd Socket = fd::Invalid;
+  std::vector<Session> Sessions;
+
+  /// Formats the state into a buffer that \p decode() understands.
+  std::string encode() const;
+  /// Parses the buffer created by \p encode().
+  ///
+  /// \returns \p std::nullopt if the buffer is malformed, or was created by an
+  /// incompatible version.
+  static std::optional<UpgradeState> decode(std::string_view Buffer);
+
+  /// Writes the encoded state into an anonymous memory file that is inherited
+  /// by the binary the server \p exec()s into.
+  ///
+  /// \throws std::system_error
+  fd store() const;
+  /// Reads and decodes the state stored by \p store() in the inherited \p FD,
+  /// and closes it.
+  ///
+  /// \throws std::system_error
+  static std::optional<UpgradeState> load(fd&& FD);
+};
+
+} // namespace monomux::server
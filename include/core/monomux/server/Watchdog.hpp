@@ -0,0 +1,146 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+#include "monomux/server/Metrics.hpp"
+#include "monomux/system/fd.hpp"
+
+namespace monomux::server
+{
+
+/// Watches the event loop running on the thread that created the instance
+/// from a thread of its own, and reports the iterations of the loop that take
+/// longer than a deadline, during which every session and client handled by
+/// the loop is frozen.
+///
+/// The loop marks the start and the end of the busy part of each iteration,
+/// and the work it is doing, by writing a few atomic variables. When an
+/// iteration misses the deadline, the watchdog interrupts the loop thread
+/// with a signal to capture its stack, while it is still stuck.
+class Watchdog
+{
+public:
+  /// The part of an iteration the loop is in.
+  enum class Phase : std::uint8_t
+  {
+    /// Waiting for events, which is never a stall.
+    Idle,
+    /// Handling the exit of sessions.
+    Children,
+    /// Handling an event reported for a file descriptor.
+    Event,
+    /// Publishing the status page.
+    Status,
+  };
+
+  /// \returns the human-readable name of \p P.
+  static const char* name(Phase P) noexcept;
+
+  /// The signal sent to the loop thread to capture its stack.
+  static int signal() noexcept;
+
+  /// The most stack frames captured.
+  static constexpr std::size_t FramesMax = 64;
+
+  struct Stall
+  {
+    /// How long the iteration took, or took until the stall was detected.
+    std::chrono::microseconds Duration;
+    /// What the loop was doing when the stall was detected.
+    Phase At;
+    raw_fd FD;
+    /// The symbolised frames of the loop thread, most recent first, if the
+    /// loop was still stuck when detected.
+    std::vector<std::string> Backtrace;
+  };
+
+  /// Creates a watchdog for the loop of the calling thread, and starts its
+  /// thread.
+  ///
+  /// \throws std::system_error If the thread can not be started.
+  explicit Watchdog(std::chrono::milliseconds Deadline);
+  ~Watchdog();
+
+  Watchdog(const Watchdog&) = delete;
+  Watchdog& operator=(const Watchdog&) = delete;
+
+  std::chrono::milliseconds deadline() const noexcept { return Deadline; }
+
+  /// Marks the loop thread starting to work after waiting.
+  void busy() noexcept;
+  /// Marks the loop thread starting to wait for events.
+  ///
+  /// \returns the stall, if the iteration that ended took longer than the
+  /// deadline.
+  std::optional<Stall> idle();
+  /// Marks the loop thread starting \p P, on \p FD if relevant.
+  void enter(Phase P, raw_fd FD = fd::Invalid) noexcept
+  {
+    CurrentPhase.store(P, std::memory_order_relaxed);
+    CurrentFD.store(FD, std::memory_order_relaxed);
+  }
+
+  /// \returns the number of iterations that missed the deadline.
+  std::uint64_t stalls() const;
+  /// \returns the distribution of the duration of the stalled iterations.
+  DurationHistogram stallTimes() const;
+  /// \returns the most recent stall, as detected by the watchdog thread.
+  std::optional<Stall> lastStall() const;
+
+private:
+  std::chrono::milliseconds Deadline;
+  pthread_t Loop;
+
+  /// Incremented by both \p busy() and \p idle(), so the loop is busy when
+  /// the value is odd.
+  std::atomic<std::uint64_t> Heartbeat = 0;
+  /// The time of the last \p busy(), in nanoseconds of
+  /// \p std::chrono::steady_clock.
+  std::atomic<std::int64_t> BusySince = 0;
+  std::atomic<Phase> CurrentPhase = Phase::Idle;
+  std::atomic<raw_fd> CurrentFD = fd::Invalid;
+
+  mutable std::mutex Lock;
+  std::condition_variable Wake;
+  bool Terminate = false;
+  /// The heartbeat of the iteration whose stall was detected.
+  std::optional<std::uint64_t> DetectedHeartbeat;
+  std::optional<Stall> Detected;
+  std::uint64_t StallCount = 0;
+  DurationHistogram StallTimes;
+
+  std::thread Thread;
+
+  void run();
+  /// Captures the stack of the loop thread.
+  std::vector<std::string> captureLoop();
+};
+
+} // namespace monomux::server
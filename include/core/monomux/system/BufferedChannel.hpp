@@ -17,7 +17,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <array>
 #include <cassert>
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -50,6 +52,9 @@ class BufferedChannelBuffer;
 /// read/write that many data. In some cases, reading \p N bytes might consume
 /// a larger amount from the kernel-backed data structure, in which case the
 /// tail end is dropped.
+///
+/// The buffers are only allocated when data has to be stored in them, and are
+/// returned to a pool shared by the channels of the thread once emptied.
 class BufferedChannel : public Channel
 {
   using OpaqueBufferType = detail::BufferedChannelBuffer;
@@ -58,6 +63,9 @@ public:
   /// The initial size of the buffers that are allocated for a
   /// \p BufferedChannel.
   static constexpr std::size_t BufferSize = 1ULL << 14; // 16 KiB
+  /// The maximum size single low-level read operations are allowed to grow to
+  /// when the channel is observed to transmit bulk data.
+  static constexpr std::size_t ReadSizeMax = 1ULL << 16; // 64 KiB
 
   /// Thrown if the \p Buffer of a \p BufferedChannel exceeds a (reasonable)
   /// size limit.
@@ -91,6 +99,10 @@ public:
     bool writeOverflow() const noexcept { return Write; }
   };
 
+  /// A non-owning view of at most two contiguous chunks of data, in order,
+  /// held in one of the buffers of a \p BufferedChannel.
+  using BufferView = std::array<std::string_view, 2>;
+
   BufferedChannel() = delete;
   ~BufferedChannel() override;
 
@@ -109,9 +121,22 @@ public:
   /// is \e NOT lost, but stored into the buffer, however, care must be taken
   /// so that system resources are not exhausted.
   ///
-  /// \see load
+  /// \see load, readInto
   std::string read(std::size_t Bytes);
 
+  /// Reads and consumes at \b maximum \p Capacity bytes of data from the
+  /// channel into the caller-owned storage at \p Destination.
+  ///
+  /// This function buffers the same way as \p read() does, but the data is
+  /// received from the underlying implementation directly into
+  /// \p Destination, and only the tail end that was loaded over the requested
+  /// amount is put into the buffer, making the operation allocation-free.
+  ///
+  /// \returns the number of bytes placed into \p Destination.
+  ///
+  /// \throws buffer_overflow As \p read().
+  std::size_t readInto(char* Destination, std::size_t Capacity);
+
   /// Writes the contents of \p Data into the channel.
   ///
   /// This function \e buffers: if thers is data that had been put into the
@@ -129,6 +154,17 @@ public:
   /// taken so that system resources are not exhausted.
   std::size_t write(std::string_view Data);
 
+  /// Writes as much of the contents of \p Data into the channel as possible,
+  /// but, unlike \p write(), does \b NOT buffer the unsent remainder. This
+  /// allows the caller to keep ownership of the data that could not be sent.
+  ///
+  /// If there is data already in the write buffer, it is flushed first, and
+  /// none of \p Data is sent unless the buffer had been emptied, in order to
+  /// retain the order of the data.
+  ///
+  /// \returns the number of bytes of \p Data written to the channel.
+  std::size_t tryWrite(BufferView Data);
+
   /// Reads at \b least \p Bytes bytes from the underlying implementation,
   /// consuming it, and unconditionally placing it into the locally held buffer.
   ///
@@ -143,6 +179,21 @@ public:
   /// \see read
   std::size_t load(std::size_t Bytes);
 
+  /// \returns views into at most \p Bytes of the data that had already been
+  /// read (e.g. by \p load()) and is held in the buffer, without copying or
+  /// consuming it. The views are in order, and the second one is empty if the
+  /// data is contiguous.
+  ///
+  /// \note The views are invalidated by any operation that modifies the read
+  /// buffer, e.g. \p read(), \p load(), or \p consumeRead().
+  ///
+  /// \see consumeRead
+  BufferView peekRead(std::size_t Bytes) const;
+
+  /// Discards at most \p Bytes of data from the beginning of the read buffer.
+  /// This is used to mark data obtained through \p peekRead() as consumed.
+  void consumeRead(std::size_t Bytes);
+
   /// Performs \p write() only on the contents of the already established
   /// buffer. Not all data might be actually written out.
   ///
@@ -152,6 +203,24 @@ public:
   /// thus will not throw \p buffer_overflow.
   std::size_t flushWrites();
 
+  /// Appends \p Data to the end of the write buffer, without sending anything.
+  /// Together with \p overwriteBufferedWrite(), this allows serialising data
+  /// in-place in the buffer, to be sent later by \p commitWrites().
+  void bufferWrite(std::string_view Data);
+
+  /// Overwrites the data buffered but not yet sent at \p Position, counted
+  /// from the beginning of the write buffer, with \p Data.
+  ///
+  /// \note Positions are shifted by every operation that sends data.
+  void overwriteBufferedWrite(std::size_t Position,
+                              std::string_view Data) noexcept;
+
+  /// Performs \p flushWrites(), and checks the size of the remaining buffer
+  /// the same way \p write() would.
+  ///
+  /// \throws buffer_overflow If the unsent data exceeds \p BufferSizeMax.
+  std::size_t commitWrites();
+
   /// \returns whether there are buffered data read but not yet consumed.
   bool hasBufferedRead() const noexcept;
   /// \returns whether there are buffered data written but not yet flushed.
@@ -160,10 +229,21 @@ public:
   std::size_t readInBuffer() const noexcept;
   /// \returns the number of bytes already written but not yet flushed.
   std::size_t writeInBuffer() const noexcept;
+  /// \returns the number of bytes allocated for the buffers at the moment.
+  std::size_t allocatedSize() const noexcept;
 
   /// \returns the size of low-level single read operations that are in some
   /// sense "optimal" for the underlying implementation.
   virtual std::size_t optimalReadSize() const noexcept { return BufferSize; }
+  /// \returns the size of the low-level single read operations the channel
+  /// currently performs. This starts at \p optimalReadSize(), and adapts to
+  /// the amount of data observed to be available at once: it grows up to
+  /// \p ReadSizeMax while reads fill the requested size, and shrinks back if
+  /// only a small fraction of it is used.
+  std::size_t readSize() const noexcept
+  {
+    return AdaptiveReadSize ? AdaptiveReadSize : optimalReadSize();
+  }
   /// \returns the size of low-level single write operations that are in some
   /// sense "optimal" for the underlying implementation.
   virtual std::size_t optimalWriteSize() const noexcept { return BufferSize; }
@@ -178,14 +258,15 @@ public:
   std::string statistics() const;
 
 protected:
+  /// The buffers, if they are allocated at the moment.
   UniqueScalar<OpaqueBufferType*, nullptr> Read;
   UniqueScalar<OpaqueBufferType*, nullptr> Write;
 
   /// Creates the buffering structure for the object.
   /// \param ReadBufferSize If non-zero, the size of the read buffer. If zero,
-  /// a read buffer will not be created.
+  /// the channel does not support reading.
   /// \param WriteBufferSize If non-zero, the size of the write buffer. If zero,
-  /// a write buffer will not be created.
+  /// the channel does not support writing.
   BufferedChannel(fd Handle,
                   std::string Identifier,
                   bool NeedsCleanup,
@@ -193,6 +274,66 @@ protected:
                   std::size_t WriteBufferSize = BufferSize);
   BufferedChannel(BufferedChannel&&) noexcept = default;
   BufferedChannel& operator=(BufferedChannel&&) noexcept = default;
+
+  /// The \p transport policies the buffered operations can be bound to.
+  enum class StaticTransport : std::uint8_t
+  {
+    /// Go through the virtual \p readvImpl() and \p writevImpl().
+    None,
+    File,
+    Socket
+  };
+
+  /// Binds the buffered operations to the system calls of \p Transport,
+  /// bypassing the virtual implementation functions.
+  ///
+  /// \note This is only valid if the implementation functions of the channel
+  /// perform nothing but the transfer with the same \p Transport. The channels
+  /// that bind a transport are \p final for this reason.
+  void setStaticTransport(StaticTransport Transport) noexcept
+  {
+    BoundTransport = Transport;
+  }
+
+private:
+  /// The operations of the channel that move the data, either through the
+  /// virtual implementation, or a compile-time \p transport policy.
+  struct DynamicIO;
+  template <typename Transport> struct StaticIO;
+
+  StaticTransport BoundTransport = StaticTransport::None;
+
+  /// The initial size of the buffers, or \p 0 if the direction is not
+  /// supported.
+  std::size_t ReadBufferSize;
+  std::size_t WriteBufferSize;
+
+  /// The current size of single reads, if it had been adapted already.
+  std::size_t AdaptiveReadSize = 0;
+
+  /// Adapts \p readSize() after a series of reads with \p ChunkSize resulted
+  /// in \p ReadBytes bytes in total, and the last read was \p Saturated, i.e.
+  /// filled the entire request. The size does not shrink below \p MinSize.
+  void adaptReadSize(std::size_t ChunkSize,
+                     std::size_t ReadBytes,
+                     bool Saturated,
+                     std::size_t MinSize) noexcept;
+
+  /// Calls \p Fn with the I/O policy of the bound transport.
+  template <typename Fn> std::size_t withIO(Fn&& F);
+
+  /// The implementations of the buffered operations with the \p IO policy.
+  template <typename IO>
+  std::size_t readIntoWith(IO Policy, char* Destination, std::size_t Capacity);
+  template <typename IO>
+  std::size_t writeWith(IO Policy, std::string_view Data);
+  template <typename IO> std::size_t tryWriteWith(IO Policy, BufferView Data);
+  template <typename IO> std::size_t loadWith(IO Policy, std::size_t Bytes);
+  template <typename IO> std::size_t flushWritesWith(IO Policy);
+
+  /// \returns the read or write buffer, allocating it if needed.
+  OpaqueBufferType& readBuffer();
+  OpaqueBufferType& writeBuffer();
 };
 
 using buffer_overflow = BufferedChannel::OverflowError;
@@ -21,7 +21,11 @@
 #include <string_view>
 #include <vector>
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/system/Transport.hpp"
 #include "monomux/system/fd.hpp"
 
 namespace monomux
@@ -58,6 +62,17 @@ public:
   /// \b more than \p Bytes of data, in which case the tail end is discarded.
   std::string read(std::size_t Bytes);
 
+  /// Read at maximum \p Capacity bytes of data from the communication channel
+  /// directly into the caller-owned storage at \p Destination.
+  ///
+  /// Unlike \p read(), this does not allocate, which makes it suitable for
+  /// receiving into preallocated or reused buffers.
+  ///
+  /// \warning The same caveats apply as for \p read().
+  ///
+  /// \returns the number of bytes read into \p Destination.
+  std::size_t readInto(char* Destination, std::size_t Capacity);
+
   /// Write the contents of \p Buffer into the communication channel.
   ///
   /// \warning Depending on the implementation of the OS primitive and its
@@ -75,17 +90,108 @@ protected:
   Channel(Channel&&) noexcept = default;
   Channel& operator=(Channel&&) noexcept = default;
 
-  /// Implemented by subclases to actually perform reading from the system.
+  /// Implemented by subclases to actually perform reading from the system
+  /// into the \p Capacity bytes of storage at \p Destination.
   ///
   /// \param Continue Whether the read operation from the low-level resource
   /// might continue, because there is more data available.
-  virtual std::string readImpl(std::size_t Bytes, bool& Continue) = 0;
+  ///
+  /// \returns the number of bytes read into \p Destination.
+  virtual std::size_t
+  readIntoImpl(char* Destination, std::size_t Capacity, bool& Continue) = 0;
   /// Implemented by subclases to actually perform writing to the system.
   ///
   /// \param Continue Whether the write operation to the low-level resource
   /// might continue, because there is more space available.
   virtual std::size_t writeImpl(std::string_view Buffer, bool& Continue) = 0;
 
+  /// Implemented by subclasses to perform a \e scattering read from the system
+  /// directly into the \p Count buffers described by \p Buffers, in order.
+  ///
+  /// The default implementation falls back to calling \p readIntoImpl() for
+  /// each buffer in sequence.
+  ///
+  /// \param Continue Whether the read operation from the low-level resource
+  /// might continue, because there is more data available.
+  ///
+  /// \returns the number of bytes read into the buffers.
+  ///
+  /// \see readv(2)
+  virtual std::size_t
+  readvImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue);
+  /// Implemented by subclasses to perform a \e gathering write to the system
+  /// from the \p Count buffers described by \p Buffers, in order.
+  ///
+  /// The default implementation falls back to calling \p writeImpl() for each
+  /// buffer in sequence.
+  ///
+  /// \param Continue Whether the write operation to the low-level resource
+  /// might continue, because there is more space available.
+  ///
+  /// \returns the number of bytes written from the buffers.
+  ///
+  /// \see writev(2)
+  virtual std::size_t
+  writevImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue);
+
+  /// Performs one \e scattering read into the \p Count buffers described by
+  /// \p Buffers, with the system call of the \p Transport policy.
+  ///
+  /// \param Continue Whether the read operation from the low-level resource
+  /// might continue.
+  ///
+  /// \returns the number of bytes read into the buffers.
+  ///
+  /// \see transport::File
+  template <typename Transport>
+  std::size_t
+  receiveWith(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+  {
+    const ::ssize_t Result = transport::retryInterrupted(
+      [FD = raw(), Buffers, Count] {
+        return Transport::receive(FD, Buffers, Count);
+      });
+    if (Result > 0)
+    {
+      Continue = true;
+      return static_cast<std::size_t>(Result);
+    }
+    return transferStopped(Result, /* Reading =*/true, Continue);
+  }
+
+  /// Performs one \e gathering write from the \p Count buffers described by
+  /// \p Buffers, with the system call of the \p Transport policy.
+  ///
+  /// \param Continue Whether the write operation to the low-level resource
+  /// might continue.
+  ///
+  /// \returns the number of bytes written from the buffers.
+  template <typename Transport>
+  std::size_t
+  sendWith(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+  {
+    const ::ssize_t Result = transport::retryInterrupted(
+      [FD = raw(), Buffers, Count] {
+        return Transport::send(FD, Buffers, Count);
+      });
+    if (Result > 0)
+    {
+      Continue = true;
+      return static_cast<std::size_t>(Result);
+    }
+    return transferStopped(Result, /* Reading =*/false, Continue);
+  }
+
+  /// Handles the \p Result of a system call that transferred no data: the end
+  /// of the stream, the resource being temporarily unavailable, or an error.
+  /// This is kept out of line, so the templates above only inline the path
+  /// that moved data.
+  ///
+  /// \returns \p 0, the number of bytes transferred.
+  ///
+  /// \throws std::system_error If the system call failed with a hard error.
+  std::size_t transferStopped(::ssize_t Result, bool Reading, bool& Continue);
+
   bool needsCleanup() const noexcept { return EntityCleanup; }
   void setFailed() noexcept { Failed = true; }
 
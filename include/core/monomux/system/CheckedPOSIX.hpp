@@ -18,6 +18,7 @@
  */
 #pragma once
 #include <cerrno>
+#include <cstdint>
 #include <cstring>
 #include <system_error>
 #include <type_traits>
@@ -32,6 +33,10 @@ using errno_t = int;
 namespace detail
 {
 
+/// The number of system calls the current thread made through
+/// \p CheckedPOSIX().
+inline thread_local std::uint64_t SyscallCount = 0;
+
 template <typename R> struct Result
 {
 private:
@@ -67,6 +72,10 @@ public:
 
 } // namespace detail
 
+/// \returns the number of system calls the current thread had made through
+/// \p CheckedPOSIX() and \p CheckedPOSIXThrow() so far.
+inline std::uint64_t syscallCount() noexcept { return detail::SyscallCount; }
+
 /// Allows executing a system call with automatically handled \p errno checking.
 ///
 /// Clients MUST pass a lambda that returns the value of the system call, and
@@ -96,6 +105,7 @@ CheckedPOSIX(Fn&& F, ErrTys&&... ErrorValues) noexcept
   static_assert(!std::is_same_v<decltype(F()), void>,
                 "Lambda must return something!");
 
+  ++SyscallCount;
   auto ReturnValue = F();
   bool Errored = (false || ... || (ReturnValue == ErrorValues));
   return Result<decltype(ReturnValue)>{
@@ -169,6 +179,7 @@ CheckedPOSIX(Fn&& F) noexcept // NOLINT(readability-identifier-naming)
   using namespace monomux::detail;
   bool Errored = false;
   using result_type = decltype(F(Errored)); // What is the lambda returning?
+  ++SyscallCount;
 
   if constexpr (std::is_same_v<result_type, void>)
   {
@@ -0,0 +1,57 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace monomux
+{
+
+/// A fast, byte-oriented LZ77 codec for blocks of at most a few hundred KiB,
+/// in the spirit of LZ4. Terminal output, with its repetitive escape sequences
+/// and line prefixes, usually shrinks to a fraction of its size, while both
+/// directions run at memory speed.
+///
+/// The compressed block is a series of sequences, each made of a token byte,
+/// whose high nibble is the number of literal bytes that follow and the low
+/// nibble the length of the match (less \p MinMatch) that comes after them,
+/// extended by \p 255 -valued bytes if the nibble is saturated, and the 16-bit
+/// little-endian offset of the match. The last sequence has literals only.
+namespace compress
+{
+
+/// The shortest repetition that is encoded as a match.
+static constexpr std::size_t MinMatch = 4;
+/// The farthest a match may refer back to.
+static constexpr std::size_t MaxOffset = (1ULL << 16) - 1;
+
+/// \returns the compressed representation of \p Data. Incompressible data
+/// grows slightly, by about \p 1 byte in every \p 255.
+std::string compressBlock(std::string_view Data);
+
+/// \returns the data \p Compressed was made from, which must be exactly
+/// \p Size bytes long, or \p nullopt if \p Compressed is malformed.
+std::optional<std::string> decompressBlock(std::string_view Compressed,
+                                           std::size_t Size);
+
+} // namespace compress
+
+} // namespace monomux
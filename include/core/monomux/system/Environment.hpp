@@ -45,6 +45,9 @@ struct SocketPath
 
   /// \returns the \p Path and \p Filename concatenated appropriately.
   std::string toString() const;
+  /// \returns the path of the \p StatusPage published by the server listening
+  /// on the socket.
+  std::string statusPagePath() const;
 
   std::string Path;
   std::string Filename;
@@ -18,15 +18,21 @@
  */
 #pragma once
 #include <cassert>
-#include <map>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <sys/epoll.h>
 
 #include "monomux/adt/MemberFunctionHelper.hpp"
 #include "monomux/adt/POD.hpp"
-#include "monomux/adt/SmallIndexMap.hpp"
+#include "monomux/system/IOUring.hpp"
 #include "monomux/system/fd.hpp"
 
 namespace monomux
@@ -40,28 +46,32 @@ namespace monomux
 /// notified by the kernel if some of the registered files undergo an I/O
 /// change, such as data becoming available on a socket.
 ///
-/// Using \p eventfd(2), this implementation is also capable of having events
-/// crafted by clients appear as if they were created by the kernel.
+/// This implementation is also capable of having events crafted by clients
+/// appear as if they were created by the kernel.
+///
+/// The listen-set might also be implemented by an \p IOUring instead of an
+/// \p epoll(7) structure, with the same interface and results.
+///
+/// Timers can be added to the structure, which call back once they expire.
+/// The expiry of timers is signalled by a \p timerfd(2) in the listen-set,
+/// see \p isTimer().
 class EPoll
 {
-  friend class Listener;
-  /// Helper RAII object that manages assigning a file descriptor into the
-  /// listen-set of an \p epoll(7) structure.
-  class Listener
+public:
+  /// The kernel facility that implements the listen-set.
+  enum class Backend
   {
-    EPoll& Master;
-    raw_fd FDToListenFor;
-
-  public:
-    Listener(EPoll& Master, raw_fd FD, bool Incoming, bool Outgoing);
-    ~Listener();
+    EPoll,
+    IOUring
   };
 
-public:
   /// Create a new \p epoll(7) structure associated with the current process.
   ///
   /// The structure is initialised to support at most \p EventCount events.
-  EPoll(std::size_t EventCount);
+  ///
+  /// If \p Engine is \p Backend::IOUring but the kernel does not support it,
+  /// \p epoll(7) is used instead.
+  EPoll(std::size_t EventCount, Backend Engine = Backend::EPoll);
 
   ~EPoll();
 
@@ -76,12 +86,44 @@ public:
 
   std::size_t getMaxEventCount() const noexcept { return Notifications.size(); }
 
+  /// \returns the kernel facility actually in use.
+  Backend getBackend() const noexcept
+  {
+    return Ring ? Backend::IOUring : Backend::EPoll;
+  }
+
   /// Blocks and waits until there is a notification that signalled the event
-  /// watcher.
+  /// watcher. If events were manually scheduled, only the notifications that
+  /// are already available are collected, without blocking.
   ///
   /// \return The number of events received, either from the system or by
   /// manual scheduling.
   std::size_t wait();
+  /// Collects the notifications that are already available, and the events
+  /// scheduled, like \p wait(), but never blocks.
+  ///
+  /// \return The number of events received.
+  std::size_t poll();
+
+  /// \returns the file that becomes readable when a file in the listen-set
+  /// has an event, through which the structure can be nested into the
+  /// listen-set of another one, or \p fd::Invalid for the \p IOUring backend.
+  raw_fd raw() const noexcept { return Ring ? fd::Invalid : MasterFD.get(); }
+
+  /// Sets \p Lock to be released while \p wait() blocks in the kernel. The
+  /// calling thread must hold \p Lock when calling \p wait(), and other
+  /// threads may change the listen-set or schedule events while they hold it.
+  ///
+  /// \note Only the \p epoll(7) backend supports this.
+  void setWaitLock(std::mutex* Lock) noexcept
+  {
+    assert(!Ring && "io_uring listen-set must be owned by one thread!");
+    WaitLock = Lock;
+  }
+
+  /// \returns whether events were scheduled and will be delivered by the next
+  /// \p wait() call.
+  bool hasScheduled() const noexcept { return !ScheduledWaiting.empty(); }
 
   /// Retrieve the Nth event.
   const struct ::epoll_event& operator[](std::size_t Index) const
@@ -110,7 +152,15 @@ public:
   /// Adds the specified file descriptor \p FD to the event queue. Events will
   /// trigger for \p Incoming (the file is available for reading) or \p Outgoing
   /// (the file is available for writing) operations.
-  void listen(raw_fd FD, bool Incoming, bool Outgoing);
+  ///
+  /// If \p EdgeTriggered is set, an event only triggers when the state of the
+  /// file changes, e.g. new data arrives. The handler of the event must then
+  /// consume the file until \p EAGAIN, otherwise no new notification will
+  /// arrive for the data left behind.
+  void listen(raw_fd FD,
+              bool Incoming,
+              bool Outgoing,
+              bool EdgeTriggered = false);
 
   /// Stop listening for changes of \p FD.
   void stop(raw_fd FD);
@@ -126,13 +176,64 @@ public:
   /// result \b after a call to \p wait(), but do not \e override system
   /// results. A file descriptor both "hand-scheduled" and system notified will
   /// appear twice in the result array.
+  ///
+  /// \note Scheduling is in-process only, and must happen on the thread that
+  /// calls \p wait(), or while holding the lock set by \p setWaitLock().
   void schedule(raw_fd FD, bool Incoming, bool Outgoing);
 
+  using TimerCallback = std::function<void()>;
+  /// Identifies a timer added to the structure. \p 0 is never a valid timer.
+  using TimerID = std::uint64_t;
+
+  /// Adds a timer that calls \p Callback once the \p Deadline has passed.
+  TimerID addTimer(std::chrono::steady_clock::time_point Deadline,
+                   TimerCallback Callback);
+  /// Adds a timer that calls \p Callback once \p Delay has elapsed.
+  TimerID addTimer(std::chrono::steady_clock::duration Delay,
+                   TimerCallback Callback)
+  {
+    return addTimer(std::chrono::steady_clock::now() + Delay,
+                    std::move(Callback));
+  }
+  /// Removes \p Timer without calling it, if it had not expired yet.
+  void cancelTimer(TimerID Timer);
+
+  /// \returns whether \p FD is the file that signals the expiry of the timers.
+  /// When an event is reported for it, \p fireTimers() should be called.
+  bool isTimer(raw_fd FD) const noexcept
+  {
+    return FD != fd::Invalid && FD == TimerFD.get();
+  }
+  /// Calls the callbacks of the timers whose deadline had passed.
+  ///
+  /// \note The expired timers are removed before their callback is called, so
+  /// callbacks may add new timers, including re-adding themselves.
+  void fireTimers();
+
 private:
   std::size_t NotificationCount = 0;
   /// The file descriptor registered in the system for the event structure.
   fd MasterFD;
-  std::map<raw_fd, Listener> Listeners;
+  /// If the \p IOUring backend is used, the listen-set is managed by this
+  /// object instead of \p MasterFD.
+  std::unique_ptr<IOUring> Ring;
+  /// Released while blocking in the kernel, see \p setWaitLock().
+  std::mutex* WaitLock = nullptr;
+
+  /// The state of a file descriptor in the event structure.
+  struct FDState
+  {
+    /// Whether the file is in the listen-set of \p MasterFD.
+    bool Listened = false;
+    /// The index of the record of the file in \p ScheduledWaiting, plus one.
+    /// \p 0 if the file is not scheduled.
+    std::uint32_t Scheduled = 0;
+  };
+  /// The state of the file descriptors, indexed by their number. As the system
+  /// always allocates the lowest free number, this table stays dense.
+  std::vector<FDState> FDTable;
+  /// \returns the state for \p FD, growing \p FDTable if needed.
+  FDState& state(raw_fd FD);
 
   /// Contains the events that fired and triggered a notification from the
   /// system.
@@ -141,28 +242,33 @@ private:
   /// \p wait() call.
   std::vector<POD<struct ::epoll_event>> ScheduledResult;
 
-  /// The file descriptor registered in the system for the manually scheduled
-  /// event callbacks.
-  fd ScheduleFD;
-  /// Contains the index in the \p Notifications vector, after a successful call
-  /// to \p wait(), where the \p ScheduleFD's notification was placed.
-  std::optional<std::size_t> ScheduleFDNotifiedAtIndex;
-
-  static const std::size_t FDLookupSize = 256;
   /// Contains the events that were manually scheduled by the client before a
   /// call to \p wait(). After \p wait() is called, the events are moved to
   /// the \p ScheduledResult list to be accessed appropriately.
   std::vector<POD<struct ::epoll_event>> ScheduledWaiting;
-  /// Map file descriptor values to existing records in the \p ScheduledWaiting
-  /// vector. Used only to de-duplicate the same file descriptor being scheduled
-  /// more than once.
-  SmallIndexMap<decltype(ScheduledWaiting)::iterator,
-                FDLookupSize,
-                /* StoreInPlace =*/true,
-                /* IntrusiveDefaultSentinel =*/true>
-    ScheduledWaitingMap;
+
+  using TimerDeadline =
+    std::pair<std::chrono::steady_clock::time_point, TimerID>;
+  /// A min-heap of the timers by their deadline. Cancelled timers are only
+  /// removed from here when they get to the top.
+  std::vector<TimerDeadline> TimerHeap;
+  std::unordered_map<TimerID, TimerCallback> TimerCallbacks;
+  TimerID NextTimerID = 1;
+  /// The \p timerfd(2) set to expire at the earliest deadline in
+  /// \p TimerHeap. Created when the first timer is added.
+  fd TimerFD;
+  /// The deadline \p TimerFD is currently set to, if any.
+  std::optional<std::chrono::steady_clock::time_point> TimerArmedFor;
+  /// Sets \p TimerFD to the deadline of the earliest pending timer.
+  void armTimer();
 
   bool isValidIndex(std::size_t I) const noexcept;
+  /// Implements \p wait() and \p poll().
+  std::size_t collect(bool Block);
+  /// Moves the events scheduled before the current \p wait() into the result.
+  ///
+  /// \returns the total number of events in the result.
+  std::size_t collectScheduled();
 };
 
 } // namespace monomux
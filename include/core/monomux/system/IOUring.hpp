@@ -0,0 +1,143 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/fd.hpp"
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace monomux
+{
+
+/// A minimal \p io_uring(7) instance that waits for files to become ready
+/// with \p IORING_OP_POLL_ADD requests, as an alternative implementation of
+/// the listen-set of \p EPoll.
+///
+/// Registering and re-arming files does not cost a system call: the requests
+/// are only queued, and are submitted together with waiting for the
+/// completions in a single \p io_uring_enter(2) call. Edge-triggered files are
+/// watched with a single multishot request. Level-triggered ones are polled
+/// once, and the request is re-armed by the next \p wait(), which completes
+/// right away if the file is still ready.
+///
+/// \see io_uring_setup(2), io_uring_enter(2)
+class IOUring
+{
+public:
+  /// Creates a ring with space for at least \p EntryCount requests queued
+  /// between two calls to \p wait().
+  ///
+  /// \throws std::system_error If the kernel does not support \p io_uring(7),
+  /// or it lacks multishot polling (added in Linux 5.13).
+  IOUring(std::size_t EntryCount);
+  IOUring(const IOUring&) = delete;
+  IOUring& operator=(const IOUring&) = delete;
+  ~IOUring();
+
+  raw_fd raw() const noexcept { return RingFD.get(); }
+
+  /// Starts watching \p FD for the \p epoll(7) \p Events. Files already
+  /// watched are left unchanged.
+  void add(raw_fd FD, std::uint32_t Events, bool EdgeTriggered);
+
+  /// Stops watching \p FD. The cancellation is submitted immediately, so the
+  /// ring drops its reference to the file before the caller closes it.
+  void remove(raw_fd FD);
+
+  /// Stops watching all files.
+  void clear();
+
+  /// Submits the queued requests and collects the completed ones into
+  /// \p Events, at most as many as its size. Completions that do not fit are
+  /// kept for the next call. If \p Block is set and nothing completed yet,
+  /// the call blocks until something does.
+  ///
+  /// \returns the number of events written to \p Events.
+  ///
+  /// \throws std::system_error If \p io_uring_enter(2) failed, including
+  /// being interrupted by a signal.
+  std::size_t wait(std::vector<POD<struct ::epoll_event>>& Events, bool Block);
+
+private:
+  struct Watch
+  {
+    /// Identifies the request belonging to this registration of the file,
+    /// so completions of previous, cancelled requests can be told apart.
+    /// \p 0 if the file is not watched.
+    std::uint32_t Generation = 0;
+    std::uint32_t Events = 0;
+    bool EdgeTriggered = false;
+    /// Whether a request for the file is queued or in flight.
+    bool Armed = false;
+    /// The \p WaitRound the file was last reported in, and the index of the
+    /// event reported.
+    std::uint32_t ReportedRound = 0;
+    std::size_t ReportedAt = 0;
+  };
+
+  /// \returns the next free submission queue entry, submitting the queued
+  /// ones to the kernel first if the queue is full.
+  struct io_uring_sqe& nextSQE();
+  void arm(raw_fd FD, Watch& W);
+  void cancel(raw_fd FD, const Watch& W);
+  /// Calls \p io_uring_enter(2) to submit the queued requests, and to wait for
+  /// \p MinComplete completions. If \p Flush is set, the completions the
+  /// kernel held back because of an overflow are moved to the queue.
+  std::error_code enter(unsigned MinComplete, bool Flush = false) noexcept;
+  void unmap() noexcept;
+
+  fd RingFD;
+  /// The watched files, indexed by their file descriptor number.
+  std::vector<Watch> Watches;
+  /// \returns the watch for \p FD, or \p nullptr if it is not watched.
+  Watch* find(raw_fd FD) noexcept;
+  std::uint32_t NextGeneration = 1;
+  /// Counts the calls to \p wait(), so events for the same file are merged.
+  std::uint32_t WaitRound = 0;
+  /// Level-triggered files that reported an event and are to be polled again
+  /// before the next wait.
+  std::vector<raw_fd> Rearm;
+
+  void* SQRing = nullptr;
+  std::size_t SQRingSize = 0;
+  void* CQRing = nullptr;
+  std::size_t CQRingSize = 0;
+  struct io_uring_sqe* SQEs = nullptr;
+  std::size_t SQEsSize = 0;
+
+  unsigned* SQHead;
+  unsigned* SQTail;
+  unsigned SQMask;
+  unsigned SQEntries;
+  unsigned* SQFlags;
+  unsigned* CQHead;
+  unsigned* CQTail;
+  unsigned CQMask;
+  struct io_uring_cqe* CQEs;
+};
+
+} // namespace monomux
@@ -38,7 +38,7 @@ namespace monomux
 /// This class wraps a nameless pipe or a Unix named pipe (\e FIFO) appearing as
 /// a file in the filesystem, and allows reading or writing (but noth both!) to
 /// it.
-class Pipe : public BufferedChannel
+class Pipe final : public BufferedChannel
 {
 public:
   /// The mode with which the \p Pipe is opened.
@@ -157,6 +157,7 @@ public:
   Pipe& operator=(Pipe&&) noexcept = default;
 
   using BufferedChannel::read;
+  using BufferedChannel::readInto;
   using BufferedChannel::write;
 
   std::size_t optimalReadSize() const noexcept override;
@@ -165,8 +166,16 @@ public:
 protected:
   Pipe(fd Handle, std::string Identifier, bool NeedsCleanup, Mode OpenMode);
 
-  std::string readImpl(std::size_t Bytes, bool& Continue) override;
+  std::size_t readIntoImpl(char* Destination,
+                           std::size_t Capacity,
+                           bool& Continue) override;
   std::size_t writeImpl(std::string_view Buffer, bool& Continue) override;
+  std::size_t readvImpl(const ::iovec* Buffers,
+                        std::size_t Count,
+                        bool& Continue) override;
+  std::size_t writevImpl(const ::iovec* Buffers,
+                         std::size_t Count,
+                         bool& Continue) override;
 
 private:
   UniqueScalar<Mode, None> OpenedAs;
@@ -21,6 +21,7 @@
 #include <map>
 #include <optional>
 #include <string>
+#include <system_error>
 #include <vector>
 
 #include <unistd.h>
@@ -41,6 +42,23 @@ public:
 
   static constexpr raw_handle Invalid = -1;
 
+  /// Thrown by \p spawn() if the child was created, but it failed to set
+  /// itself up or to \p exec() the program, and had exited.
+  class SpawnError : public std::system_error
+  {
+    raw_handle PID;
+
+  public:
+    SpawnError(std::error_code EC, raw_handle PID)
+      : std::system_error(EC, "exec() failed in spawn()"), PID(PID)
+    {}
+
+    /// \returns the PID of the exited child. If it was spawned with
+    /// \p SpawnOptions::ChildOfParent, it is not collected by \p spawn(), and
+    /// the parent must collect it.
+    raw_handle pid() const noexcept { return PID; }
+  };
+
   struct SpawnOptions
   {
     std::string Program;
@@ -55,6 +73,12 @@ public:
     ///
     /// This option has no effect if \p CreatePTY is \p true.
     std::optional<raw_fd> StandardInput, StandardOutput, StandardError;
+
+    /// Whether to create the process as the child of the \p parent of the
+    /// current process (via \p CLONE_PARENT), as if the parent had spawned it.
+    /// This allows a helper process to spawn processes on behalf of its
+    /// parent, which can then wait for them.
+    bool ChildOfParent = false;
   };
 
   raw_handle raw() const noexcept { return Handle; }
@@ -67,6 +91,13 @@ public:
   /// \b MAY remove associated information at the invocation of this call.
   bool reapIfDead();
 
+  /// Opens a \p pidfd_open() handle to the process, which becomes readable
+  /// once the process terminates.
+  ///
+  /// \returns an empty \p fd if the process is not running, or the kernel does
+  /// not support the call.
+  fd openExitWatch() const;
+
   /// Blocks until the current process instance has terminated.
   void wait();
 
@@ -111,17 +142,28 @@ public:
   /// \warning This command does \b NOT \p fork()!
   [[noreturn]] static void exec(const SpawnOptions& Opts);
 
-  /// Spawns a new process based on the specified \p Opts. This process calls
-  /// \p fork() internally, and then does an \p exec(). The spawned subprocess
-  /// will be meaningfully set up to be a clearly spawned process.
+  /// Spawns a new process based on the specified \p Opts. The arguments and
+  /// the environment are prepared in the current process, and the child is
+  /// created with \p clone(CLONE_VM | CLONE_VFORK), so it shares the memory
+  /// of the current process until it does an \p exec(). The cost of the call
+  /// thus does not depend on the size of the current process. The spawned
+  /// subprocess will be meaningfully set up to be a clearly spawned process.
   ///
   /// The spawned process will be the child of the current process. The call
   /// returns the PID of the child, and execution resumes normally in the
   /// parent.
   ///
   /// \note This call does \b NOT return in the child!
+  ///
+  /// \throws std::system_error if the child could not be created.
+  /// \throws SpawnError if the child failed to \p exec() the program.
   static Process spawn(const SpawnOptions& Opts);
 
+  /// Wraps the already running child process \p Handle, e.g. one that was
+  /// spawned by another process with \p SpawnOptions::ChildOfParent, together
+  /// with the master side of its \p PTY, if any.
+  static Process adopt(raw_handle Handle, std::optional<Pty> PTY);
+
   /// \p fork(): Ask the kernel to create an exact duplicate of the current
   /// process. The specified callbacks \p ParentAction and \p ChildAction will
   /// be run in the parent and the child process, respectively.
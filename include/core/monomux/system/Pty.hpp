@@ -18,6 +18,7 @@
  */
 #pragma once
 #include <optional>
+#include <string>
 
 #include "monomux/adt/UniqueScalar.hpp"
 #include "monomux/system/Pipe.hpp"
@@ -43,10 +44,35 @@ class Pty
   /// setting up either as parent or childside.
   std::unique_ptr<Pipe> Write;
 
+  Pty(fd&& Master, std::string Name);
+
+  /// Creates the \p Read and \p Write pipes of the side that is open.
+  void makePipes();
+
 public:
+  /// The dimensions of the terminal window, in characters.
+  struct WindowSize
+  {
+    unsigned short Rows;
+    unsigned short Columns;
+
+    bool operator==(const WindowSize& RHS) const noexcept
+    {
+      return Rows == RHS.Rows && Columns == RHS.Columns;
+    }
+    bool operator!=(const WindowSize& RHS) const noexcept
+    {
+      return !(*this == RHS);
+    }
+  };
+
   /// Creates a new PTY-pair.
   Pty();
 
+  /// Wraps the already set up \p Master side of a PTY-pair named \p Name,
+  /// e.g. one that was received from another process.
+  static Pty wrapMaster(fd&& Master, std::string Name);
+
   /// \returns whether the current instance is open on the master (PTM, control)
   /// side.
   bool isMaster() const noexcept { return IsMaster; }
@@ -98,6 +124,10 @@ public:
 
   /// Sets the size of the pseudoterminal device to have the given dimensions.
   void setSize(unsigned short Rows, unsigned short Columns);
+  /// Changes the size of the pseudoterminal device back and forth, so the
+  /// foreground process receives a \p SIGWINCH and redraws its screen, without
+  /// the size having changed in the end.
+  void wiggleSize();
 };
 
 } // namespace monomux
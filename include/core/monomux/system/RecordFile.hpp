@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// A sequential writer of a file, which collects the data in a large buffer
+/// aligned to the block size of the storage, and writes it in few, large
+/// chunks. Regular files are preallocated ahead of the written data, and may
+/// be written with direct I/O, bypassing the page cache of the kernel.
+///
+/// \see open(2), fallocate(2)
+class RecordFile
+{
+public:
+  static constexpr std::size_t DefaultBufferSize = 1ULL << 20; // 1 MiB
+  /// The alignment of the buffer, and of the offset and size of the writes,
+  /// as direct I/O requires.
+  static constexpr std::size_t BlockSize = 4096;
+  /// The amount of storage allocated ahead of the written data at once.
+  static constexpr std::size_t PreallocateSize = 1ULL << 26; // 64 MiB
+
+  /// Creates the file at \p Path, truncating it if it exists. If \p Direct,
+  /// the file is opened with \p O_DIRECT, falling back to writing through the
+  /// page cache if the file system does not support it.
+  ///
+  /// \note \p BufferSize is rounded up to a multiple of \p BlockSize.
+  ///
+  /// \throws std::system_error If the file could not be created.
+  static RecordFile create(const std::string& Path,
+                           bool Direct,
+                           std::size_t BufferSize = DefaultBufferSize);
+
+  /// Wraps the already open \p Handle, e.g. the standard output, which is
+  /// written through the page cache, and is only preallocated if it is a
+  /// regular file.
+  explicit RecordFile(fd Handle, std::size_t BufferSize = DefaultBufferSize);
+  RecordFile(RecordFile&&) noexcept = default;
+  RecordFile& operator=(RecordFile&&) noexcept = default;
+  /// Writes the buffered data and closes the file, ignoring errors.
+  ~RecordFile();
+
+  raw_fd raw() const noexcept { return Handle.get(); }
+  /// \returns whether the file is written with direct I/O.
+  bool isDirect() const noexcept { return Direct; }
+  /// \returns the number of bytes appended to the file.
+  std::uint64_t size() const noexcept { return Written + Used; }
+  /// \returns the number of bytes appended, but not yet written.
+  std::size_t buffered() const noexcept { return Used; }
+
+  /// Appends \p Data to the file. The buffer is written whenever it fills up.
+  ///
+  /// \throws std::system_error If writing the file failed.
+  void append(std::string_view Data);
+  /// Writes the buffered data. With direct I/O, only whole blocks can be
+  /// written, and the rest of the data stays buffered until more arrives, or
+  /// the file is closed.
+  ///
+  /// \throws std::system_error If writing the file failed.
+  void flush();
+  /// Writes all the buffered data, trims the file to \p size(), releasing the
+  /// storage preallocated beyond it, and closes the file.
+  ///
+  /// \throws std::system_error If writing the file failed.
+  void close();
+
+private:
+  struct FreeBuffer
+  {
+    void operator()(char* Buffer) const noexcept;
+  };
+
+  RecordFile(fd Handle, bool Direct, std::size_t BufferSize);
+
+  fd Handle;
+  bool Direct;
+  /// Whether the file is a regular file, whose storage is preallocated.
+  bool Regular = false;
+  std::unique_ptr<char[], FreeBuffer> Buffer;
+  std::size_t Capacity;
+  /// The number of bytes at the beginning of \p Buffer yet to be written.
+  std::size_t Used = 0;
+  /// The number of bytes written to the file.
+  std::uint64_t Written = 0;
+  /// The end of the storage preallocated for the file.
+  std::uint64_t Allocated = 0;
+
+  /// Writes the first \p Bytes of \p Buffer, and moves the rest of the
+  /// buffered data to its beginning.
+  void write(std::size_t Bytes);
+};
+
+} // namespace monomux
@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+namespace monomux
+{
+
+/// Substring search over large buffers, like the scrollback of sessions.
+///
+/// The vectorised implementations compare the first and the last byte of the
+/// needle at 16 or 32 positions of the haystack at once, and only compare the
+/// rest of the needle at the positions where both matched, which in text is
+/// rarely more than one per block.
+namespace search
+{
+
+/// The implementations of \p find().
+enum class Implementation
+{
+  /// Byte by byte, on every platform.
+  Scalar,
+  /// With the 128-bit SSE2 instructions, available on every x86-64 CPU.
+  SSE2,
+  /// With the 256-bit AVX2 instructions, if the CPU supports them.
+  AVX2
+};
+
+/// \returns the fastest implementation the CPU running the program supports,
+/// which is detected once.
+Implementation best() noexcept;
+
+/// \returns whether \p Impl can run on the CPU running the program.
+bool supported(Implementation Impl) noexcept;
+
+/// \returns the position of the first occurrence of \p Needle in
+/// \p Haystack, or \p std::string_view::npos. An empty needle is found at
+/// \p 0.
+std::size_t find(std::string_view Haystack, std::string_view Needle) noexcept;
+
+/// \returns the position of the first occurrence of \p Needle in
+/// \p Haystack, searching with \p Impl, or the \p Scalar implementation if
+/// \p Impl is not \p supported().
+std::size_t find(std::string_view Haystack,
+                 std::string_view Needle,
+                 Implementation Impl) noexcept;
+
+} // namespace search
+
+} // namespace monomux
@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// A single-producer, single-consumer byte ring in memory shared between two
+/// processes. The memory is an anonymous \p memfd_create(2) file that is
+/// mapped by both sides, so the data written by the producer is read by the
+/// consumer without passing through the kernel.
+///
+/// The sides wake each other up through two \p eventfd(2) doorbells: the
+/// \e data doorbell is rung by the producer when it writes to a ring the
+/// consumer found empty, and the \e space doorbell is rung by the consumer when
+/// it frees up space in a ring the producer found full. A doorbell is rung
+/// only if the other side announced that it will wait for it, so a steady
+/// stream of data does not cost system calls.
+///
+/// The ring is created by the producer, and the handles of the memory and the
+/// doorbells are to be sent to the consumer, e.g. with \p Socket::sendFDs(),
+/// which opens the same ring with them.
+///
+/// \see memfd_create(2)
+/// \see eventfd(2)
+class SharedRing
+{
+public:
+  static constexpr std::size_t DefaultCapacity = 1ULL << 20; // 1 MiB
+
+  /// Creates a new ring that can hold \p Capacity bytes.
+  ///
+  /// \note \p Capacity must be a power of 2.
+  ///
+  /// \throws std::system_error If the memory or the doorbells could not be
+  /// created.
+  static SharedRing create(std::size_t Capacity = DefaultCapacity);
+
+  /// Opens the ring created by another process from the handles of its
+  /// \p Memory and its doorbells.
+  ///
+  /// \throws std::system_error If the memory could not be mapped, or it is not
+  /// laid out as a ring.
+  static SharedRing open(fd Memory, fd DataBell, fd SpaceBell);
+
+  SharedRing(const SharedRing&) = delete;
+  SharedRing& operator=(const SharedRing&) = delete;
+  SharedRing(SharedRing&& RHS) noexcept;
+  SharedRing& operator=(SharedRing&& RHS) noexcept;
+  ~SharedRing() noexcept;
+
+  raw_fd memory() const noexcept { return Memory.get(); }
+  raw_fd dataBell() const noexcept { return DataBell.get(); }
+  raw_fd spaceBell() const noexcept { return SpaceBell.get(); }
+
+  std::size_t capacity() const noexcept { return Capacity; }
+  /// \returns the number of bytes written to the ring but not yet consumed.
+  std::size_t size() const noexcept;
+  bool empty() const noexcept { return size() == 0; }
+
+  /// \returns whether the positions in the memory are inconsistent, i.e. the
+  /// other side claims more data to be in the ring than it can hold. Such a
+  /// ring is neither written to nor read from.
+  bool corrupt() const noexcept;
+
+  /// Writes as much of \p Data as fits into the ring, and rings the data
+  /// doorbell if the consumer is waiting for it.
+  ///
+  /// \returns the number of bytes written, which is \p 0 if the ring is full
+  /// or \p corrupt().
+  std::size_t write(std::string_view Data) noexcept;
+
+  /// Announces that the producer waits for the space doorbell to be rung
+  /// before writing again.
+  ///
+  /// \returns whether the ring is still full. If \p false, space was freed up
+  /// in the meantime, and the doorbell might not be rung for it.
+  bool awaitSpace() noexcept;
+
+  /// \returns a view of the data at the beginning of the ring, up to the end of
+  /// the memory area. If the ring is empty, the returned view is empty, and the
+  /// consumer is announced to wait for the data doorbell.
+  ///
+  /// \note The view is valid until the data is \p consume()d.
+  std::string_view peek() noexcept;
+
+  /// Releases the first \p Bytes of the data in the ring, and rings the space
+  /// doorbell if the producer is waiting for it.
+  void consume(std::size_t Bytes) noexcept;
+
+  /// Resets the data doorbell after it was rung.
+  void clearDataBell() noexcept;
+  /// Resets the space doorbell after it was rung.
+  void clearSpaceBell() noexcept;
+
+private:
+  struct Header;
+
+  SharedRing(fd Memory, fd DataBell, fd SpaceBell, std::size_t Capacity);
+
+  /// Maps \p Memory into the address space of the process.
+  ///
+  /// \throws std::system_error
+  void map();
+  void unmap() noexcept;
+
+  Header& header() const noexcept;
+  char* data() const noexcept;
+
+  fd Memory;
+  fd DataBell;
+  fd SpaceBell;
+  std::size_t Capacity;
+  void* Mapping = nullptr;
+};
+
+} // namespace monomux
@@ -0,0 +1,83 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+
+namespace monomux
+{
+
+/// An allocator of raw memory blocks ("slabs") in power-of-two size classes,
+/// which the storage of the buffers of channels is drawn from. Freed slabs are
+/// cached per thread and handed out again for requests of the same class, so
+/// buffers growing and shrinking over the lifetime of a long-running server
+/// do not fragment the heap.
+///
+/// Slabs of at least \p MappedSize bytes are mapped from the kernel directly.
+/// When such a slab is cached, its pages are given back with \p madvise(), and
+/// only the address range stays reserved.
+class SlabPool
+{
+public:
+  /// The size of the smallest size class.
+  static constexpr std::size_t MinSize = 64;
+  /// The size from which slabs are mapped instead of allocated from the heap.
+  static constexpr std::size_t MappedSize = 1ULL << 16; // 64 KiB
+  /// The size of the largest size class that is cached. Larger slabs are
+  /// returned to the system immediately.
+  static constexpr std::size_t CachedSizeMax = 1ULL << 24; // 16 MiB
+
+  /// Counters of the pool, summed for all threads.
+  struct Statistics
+  {
+    /// The number of slabs obtained from the system.
+    std::size_t Allocations;
+    /// The number of requests served from a cache.
+    std::size_t Reuses;
+    /// The number of slabs returned to the system.
+    std::size_t Releases;
+    /// The total size of the slabs handed out and not given back yet.
+    std::size_t UsedBytes;
+    /// The number and total size of the slabs currently cached.
+    std::size_t CachedSlabs;
+    std::size_t CachedBytes;
+  };
+
+  /// \returns the size of the class requests of \p Bytes are served from.
+  static std::size_t sizeClass(std::size_t Bytes) noexcept;
+
+  /// \returns a slab capable of holding \p Bytes bytes, with unspecified
+  /// contents.
+  ///
+  /// \throws std::bad_alloc If the memory could not be obtained.
+  static void* allocate(std::size_t Bytes);
+
+  /// Gives back the slab at \p Ptr, which was obtained from \p allocate() for
+  /// \p Bytes bytes.
+  static void deallocate(void* Ptr, std::size_t Bytes) noexcept;
+
+  /// Returns the slabs cached by the current thread to the system.
+  static void trim() noexcept;
+
+  /// \returns the total size of the slabs handed out and not given back yet.
+  static std::size_t usedBytes() noexcept;
+
+  static Statistics statistics() noexcept;
+};
+
+} // namespace monomux
@@ -20,6 +20,9 @@
 #include <optional>
 #include <string>
 #include <system_error>
+#include <vector>
+
+#include <sys/types.h>
 
 #include "monomux/adt/UniqueScalar.hpp"
 #include "monomux/system/BufferedChannel.hpp"
@@ -44,7 +47,7 @@ namespace monomux
 /// facilitating socket behaviour.
 ///
 /// \see socket(7)
-class Socket : public BufferedChannel
+class Socket final : public BufferedChannel
 {
 public:
   /// Creates a new \p Socket which will be owned by the current instance, and
@@ -81,6 +84,14 @@ public:
   /// mode) already.
   static Socket wrap(fd&& FD, std::string Identifier);
 
+  /// Takes ownership of \p FD, a socket bound to \p Path by \p create() in a
+  /// process that this one was \p exec()ed from. The socket is controlled as
+  /// if it was created by \p create(), and the file is removed on exit.
+  ///
+  /// \note The socket may already be listening, in which case \p listen() only
+  /// updates its queue size.
+  static Socket adopt(fd&& FD, std::string Path);
+
   /// Starts listening for incoming connection on the current socket by calling
   /// \p listen(). This is only valid if the current socket was created in full
   /// ownership mode, with the \p create() method.
@@ -92,21 +103,59 @@ public:
   /// \b MAY block. This call is only valid if the current socket was created in
   /// full ownership mode, and \p listen() had already been called for it.
   ///
+  /// The accepted connection is already non-blocking and close-on-exec.
+  ///
   /// \param Error If non-null and the accepting of the client fails, the error
   /// code is returned in this parameter.
   /// \param Recoverable If non-null and the accepting of the client fails, but
   /// the low-level error is indicative of a potential to try again, will be set
   /// to \p true.
   ///
-  /// \see accept(2)
+  /// \see accept4(2)
   std::optional<Socket> accept(std::error_code* Error = nullptr,
                                bool* Recoverable = nullptr);
 
+  /// Sends the file descriptors \p FDs to the other end of the connection, as
+  /// the ancillary data of \p Data, or of a single byte if \p Data is empty.
+  /// The part of \p Data that could not be sent at once is buffered.
+  ///
+  /// \note Nothing may be buffered for writing, as the receiving side must be
+  /// able to tell where the descriptors are in the stream.
+  ///
+  /// \throws std::system_error
+  ///
+  /// \see unix(7), \p SCM_RIGHTS
+  void sendFDs(const std::vector<raw_fd>& FDs, std::string_view Data = {});
+
+  /// Receives at most \p Count file descriptors sent by \p sendFDs() from the
+  /// other end of the connection. This operation \b MAY block.
+  ///
+  /// \note Nothing may be buffered for reading, as the descriptors would have
+  /// been lost when reading the byte they arrived with.
+  ///
+  /// \throws std::system_error
+  std::vector<fd> receiveFDs(std::size_t Count);
+
+  /// Sets whether the file descriptors that arrive with the data read by the
+  /// buffered operations are kept, to be taken with \p takeReceivedFDs().
+  /// Otherwise, such descriptors are closed by the kernel.
+  void setAcceptFDs(bool AcceptFDs) noexcept;
+  /// \returns the file descriptors that arrived with the data read since the
+  /// previous call, if \p setAcceptFDs() was enabled.
+  std::vector<fd> takeReceivedFDs() noexcept;
+
+  /// \returns the ID of the process at the other end of the connection, as
+  /// of when the connection was made, or \p std::nullopt if it is not known.
+  ///
+  /// \see unix(7), \p SO_PEERCRED
+  std::optional<::pid_t> peerProcess() const noexcept;
+
   ~Socket() noexcept override;
   Socket(Socket&&) noexcept = default;
   Socket& operator=(Socket&&) noexcept = default;
 
   using BufferedChannel::read;
+  using BufferedChannel::readInto;
   using BufferedChannel::write;
 
   std::size_t optimalReadSize() const noexcept override;
@@ -115,8 +164,16 @@ public:
 protected:
   Socket(fd Handle, std::string Identifier, bool NeedsCleanup);
 
-  std::string readImpl(std::size_t Bytes, bool& Continue) override;
+  std::size_t readIntoImpl(char* Destination,
+                           std::size_t Capacity,
+                           bool& Continue) override;
   std::size_t writeImpl(std::string_view Buffer, bool& Continue) override;
+  std::size_t readvImpl(const ::iovec* Buffers,
+                        std::size_t Count,
+                        bool& Continue) override;
+  std::size_t writevImpl(const ::iovec* Buffers,
+                         std::size_t Count,
+                         bool& Continue) override;
 
 private:
   /// Whether the current instance is \e owning a socket, i.e. controlling it
@@ -125,6 +182,16 @@ private:
   /// Whether the current instance is \e listening for incoming connections
   /// via \p listen().
   UniqueScalar<bool, false> Listening;
+  /// Whether the file descriptors sent along the data are kept in
+  /// \p ReceivedFDs.
+  UniqueScalar<bool, false> AcceptFDs;
+  std::vector<fd> ReceivedFDs;
+
+  /// Reads into \p Buffers with \p recvmsg(), keeping the file descriptors
+  /// that arrived with the data.
+  ///
+  /// \returns the result of the system call.
+  ::ssize_t receiveWithFDs(::iovec* Buffers, std::size_t Count);
 };
 
 } // namespace monomux
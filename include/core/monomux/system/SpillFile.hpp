@@ -0,0 +1,124 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// An append-only byte log backed by an unnamed file on disk, accessed through
+/// memory mappings. The file is split into fixed-size segments, of which only
+/// the one being appended to and a few recently read ones are mapped at a
+/// time, so the memory used by the log is bounded independently of its size.
+/// The rest of the data is paged in and out by the kernel on demand.
+///
+/// Offsets into the log are logical, counting from the first byte ever
+/// appended. The beginning of the log can be released, after which the
+/// storage of whole segments is returned to the file system.
+///
+/// \see mmap(2)
+class SpillFile
+{
+public:
+  static constexpr std::size_t DefaultSegmentSize = 1ULL << 20; // 1 MiB
+  /// The number of segments that are kept mapped for reading at a time.
+  static constexpr std::size_t ReadMappingCount = 2;
+
+  /// Creates the backing file in \p Directory. The file is unlinked right
+  /// away, so it does not outlive the process, even if it crashes.
+  ///
+  /// \note \p SegmentSize must be a multiple of the page size.
+  ///
+  /// \throws std::system_error If the file could not be created.
+  SpillFile(const std::string& Directory,
+            std::size_t SegmentSize = DefaultSegmentSize);
+
+  std::size_t begin() const noexcept { return Begin; }
+  std::size_t end() const noexcept { return End; }
+  std::size_t size() const noexcept { return End - Begin; }
+  bool empty() const noexcept { return Begin == End; }
+
+  /// \returns the number of bytes currently mapped into memory.
+  std::size_t mappedSize() const noexcept;
+
+  /// Appends \p Data to the end of the log.
+  ///
+  /// \throws std::system_error If the storage for the data could not be
+  /// allocated, e.g. because the file system is full, or mapping the file
+  /// failed. If allocating the storage failed, nothing is appended.
+  void append(std::string_view Data);
+
+  /// \returns a view into the log, starting at the logical \p Offset, until
+  /// the end of the segment \p Offset belongs to, or the end of the log. The
+  /// view is empty if \p Offset is not in the log, or mapping the data failed.
+  ///
+  /// \note The returned view is invalidated by any subsequent non-const
+  /// operation on the log.
+  std::string_view peek(std::size_t Offset) noexcept;
+
+  /// Releases the data before the logical \p Offset. Segments that are
+  /// entirely released have their storage freed.
+  void discard(std::size_t Offset) noexcept;
+
+private:
+  /// A single segment of the file mapped into memory.
+  struct Mapping
+  {
+    Mapping() = default;
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+    ~Mapping() { unmap(); }
+
+    bool has() const noexcept { return Address != nullptr; }
+    void unmap() noexcept;
+
+    char* Address = nullptr;
+    std::size_t Length = 0;
+    std::size_t Segment = 0;
+  };
+
+  /// Maps the segment with the index \p Segment into \p Map.
+  ///
+  /// \throws std::system_error
+  void map(Mapping& Map, std::size_t Segment, bool Writable);
+
+  /// Frees the storage of the segment with the index \p Segment in the file.
+  void release(std::size_t Segment) noexcept;
+
+  fd Handle;
+  std::size_t SegmentSize;
+  std::size_t Begin = 0;
+  std::size_t End = 0;
+  /// The size of the file up to which storage is allocated.
+  std::size_t Allocated = 0;
+
+  /// The segment where \p append() takes place.
+  Mapping WriteMap;
+  /// The most recently read segments.
+  std::array<Mapping, ReadMappingCount> ReadMaps;
+  /// The index of the \p ReadMaps to be replaced on the next miss.
+  std::size_t NextReadMap = 0;
+};
+
+} // namespace monomux
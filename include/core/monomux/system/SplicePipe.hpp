@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <string>
+
+#include "monomux/system/fd.hpp"
+
+namespace monomux
+{
+
+/// Wraps an anonymous kernel pipe that is used as an intermediate buffer to
+/// move data between two file descriptors with \p splice(), without the data
+/// ever being copied to userspace.
+///
+/// \see splice(2)
+class SplicePipe
+{
+public:
+  /// Creates the kernel pipe backing the buffer.
+  ///
+  /// \throws std::system_error If the pipe could not be created.
+  SplicePipe();
+
+  /// \returns the number of bytes moved into the pipe, but not out of it yet.
+  std::size_t size() const noexcept { return Size; }
+  bool empty() const noexcept { return Size == 0; }
+
+  /// Moves at most \p Bytes of data from the file descriptor \p From into the
+  /// pipe.
+  ///
+  /// \returns the number of bytes moved, which is \p 0 if no data was
+  /// available without blocking.
+  ///
+  /// \throws std::system_error If the operation failed, e.g. because \p From
+  /// does not support splicing (\p EINVAL).
+  std::size_t fill(raw_fd From, std::size_t Bytes);
+
+  /// Moves as much of the data held in the pipe into the file descriptor \p To
+  /// as possible without blocking.
+  ///
+  /// \returns the number of bytes moved.
+  ///
+  /// \throws std::system_error If the operation failed.
+  std::size_t drain(raw_fd To);
+
+  /// Reads all the data remaining in the pipe into userspace, emptying it.
+  std::string take();
+
+private:
+  fd Read;
+  fd Write;
+  std::size_t Size = 0;
+};
+
+} // namespace monomux
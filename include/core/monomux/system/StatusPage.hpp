@@ -0,0 +1,114 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace monomux
+{
+
+/// A small file mapped into memory by a single writer and any number of
+/// readers, through which the writer publishes a snapshot of its state that
+/// the readers can take without communicating with the writer, or waking it
+/// up.
+///
+/// The snapshot is protected by a sequence lock: the writer makes the
+/// sequence number odd while it overwrites the data, and even again once it
+/// is done. A reader copies the data, and accepts the copy only if the
+/// sequence number was the same even number before and after copying.
+///
+/// If a snapshot does not fit the file, the writer moves to a larger file
+/// created at the same path, and the old file is marked retired, so readers
+/// that still have it mapped know to open the path again.
+///
+/// \see mmap(2)
+class StatusPage
+{
+public:
+  static constexpr std::size_t DefaultCapacity = 1ULL << 16; // 64 KiB
+  /// The number of times a reader tries to copy the snapshot while the writer
+  /// keeps overwriting it, before giving up.
+  static constexpr std::size_t ReadAttempts = 64;
+
+  /// Creates the file of the page at \p Path, replacing the file of any
+  /// previous writer, that can hold a snapshot of \p Capacity bytes. The file
+  /// is created accessible only to the user, and is removed when the page is
+  /// destroyed.
+  ///
+  /// \throws std::system_error If the file could not be created.
+  static StatusPage create(std::string Path,
+                           std::size_t Capacity = DefaultCapacity);
+
+  /// Opens the page created by another process at \p Path for reading.
+  ///
+  /// \throws std::system_error If the file could not be opened or mapped, it
+  /// is not laid out as a page, or the process that created it is no longer
+  /// running.
+  static StatusPage open(std::string Path);
+
+  StatusPage(const StatusPage&) = delete;
+  StatusPage& operator=(const StatusPage&) = delete;
+  StatusPage(StatusPage&& RHS) noexcept;
+  StatusPage& operator=(StatusPage&& RHS) noexcept;
+  ~StatusPage() noexcept;
+
+  const std::string& path() const noexcept { return Path; }
+  std::size_t capacity() const noexcept { return Capacity; }
+  /// \returns whether this instance is the writer of the page.
+  bool owning() const noexcept { return Owning; }
+
+  /// Replaces the snapshot in the page with \p Data, moving to a larger file
+  /// if it does not fit the current one.
+  ///
+  /// \note Only the writer may publish.
+  ///
+  /// \throws std::system_error If the larger file could not be created. The
+  /// previous snapshot is kept in this case.
+  void publish(std::string_view Data);
+
+  /// \returns a copy of the most recently published snapshot, or
+  /// \p std::nullopt if the page was retired, or a consistent copy could not
+  /// be taken in \p ReadAttempts tries.
+  std::optional<std::string> read() const;
+
+private:
+  struct Header;
+
+  StatusPage(std::string Path, bool Owning);
+
+  /// Creates and maps a new file of \p Capacity bytes in place of \p Path.
+  ///
+  /// \throws std::system_error
+  void makeFile();
+  /// Retires and removes the file if this is the writer, and unmaps it.
+  void release() noexcept;
+  void unmap() noexcept;
+
+  Header& header() const noexcept;
+  char* data() const noexcept;
+
+  std::string Path;
+  bool Owning;
+  std::size_t Capacity = 0;
+  void* Mapping = nullptr;
+};
+
+} // namespace monomux
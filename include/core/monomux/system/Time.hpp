@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <iomanip>
@@ -26,12 +27,47 @@
 namespace monomux
 {
 
+/// A clock that is advanced explicitly by the event loops, once after every
+/// wakeup, so that the many timestamps taken while handling the events (e.g.
+/// on every buffer operation) do not each read the system clock.
+///
+/// The timestamps are \p std::chrono::system_clock time points, but the cached
+/// value never moves backwards.
+class LoopClock
+{
+public:
+  using clock = std::chrono::system_clock;
+  using time_point = std::chrono::time_point<clock>;
+
+  /// \returns the time of the most recent \p tick().
+  static time_point now() noexcept
+  {
+    return Now.load(std::memory_order_relaxed);
+  }
+  /// Refreshes the cached time from the system clock.
+  static void tick() noexcept;
+
+  /// \returns the granularity of the cached time.
+  static std::chrono::microseconds resolution() noexcept { return Resolution; }
+  /// Sets the granularity of the cached time to \p Resolution. A resolution of
+  /// \p 0 keeps the precision of the system clock. If the resolution is at
+  /// least as coarse as that of the kernel's cheaper coarse clock, the coarse
+  /// clock is read instead.
+  static void setResolution(std::chrono::microseconds Resolution) noexcept;
+
+private:
+  static inline std::atomic<time_point> Now = clock::now();
+  static inline std::chrono::microseconds Resolution{0};
+  static inline bool Coarse = false;
+};
+
 /// Formats the given \p Chrono \p Time object to an internationally viable
 /// representation.
 template <typename T> std::string formatTime(const T& Time)
 {
   std::time_t RawTime = T::clock::to_time_t(Time);
-  std::tm SplitTime = *std::localtime(&RawTime);
+  std::tm SplitTime;
+  ::localtime_r(&RawTime, &SplitTime);
 
   std::ostringstream Buf;
   // Mirror the behaviour of tmux/byobu menu.
@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/fd.hpp"
+
+/// The transports are the system calls that move the data of a \p Channel,
+/// bound at compile time. The buffered operations of the \p Pipe and
+/// \p Socket channels are instantiated with them, so the system calls on the
+/// hot path are direct, inlineable calls instead of virtual ones.
+///
+/// A transport is a type with a \p ChunkSize, the size of single reads and
+/// writes that is optimal for it, and static \p receive() and \p send()
+/// functions which perform one \e scattering read or \e gathering write, and
+/// return the result of the system call as-is.
+namespace monomux::transport
+{
+
+/// Executes \p Call, repeating it for as long as it was interrupted by a
+/// signal before transferring any data.
+///
+/// \returns the result of the last \p Call.
+template <typename Fn> inline ::ssize_t retryInterrupted(Fn&& Call)
+{
+  ::ssize_t Result;
+  do
+    Result = Call();
+  while (Result == -1 && errno == EINTR);
+  return Result;
+}
+
+/// Transfers data with \p readv() and \p writev(), which is valid for any
+/// kind of file, e.g. pipes.
+struct File
+{
+  static constexpr std::size_t ChunkSize = BUFSIZ;
+
+  static ::ssize_t
+  receive(raw_fd FD, const ::iovec* Buffers, std::size_t Count) noexcept
+  {
+    return ::readv(FD, Buffers, static_cast<int>(Count));
+  }
+  static ::ssize_t
+  send(raw_fd FD, const ::iovec* Buffers, std::size_t Count) noexcept
+  {
+    return ::writev(FD, Buffers, static_cast<int>(Count));
+  }
+};
+
+/// Transfers data with \p recvmsg() and \p sendmsg() on a connected socket,
+/// without ancillary data.
+struct Socket
+{
+  static constexpr std::size_t ChunkSize = BUFSIZ;
+
+  static ::ssize_t
+  receive(raw_fd FD, const ::iovec* Buffers, std::size_t Count) noexcept
+  {
+    POD<::msghdr> Msg;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    Msg->msg_iov = const_cast<::iovec*>(Buffers);
+    Msg->msg_iovlen = Count;
+    return ::recvmsg(FD, &Msg, 0);
+  }
+  static ::ssize_t
+  send(raw_fd FD, const ::iovec* Buffers, std::size_t Count) noexcept
+  {
+    POD<::msghdr> Msg;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    Msg->msg_iov = const_cast<::iovec*>(Buffers);
+    Msg->msg_iovlen = Count;
+    return ::sendmsg(FD, &Msg, 0);
+  }
+};
+
+} // namespace monomux::transport
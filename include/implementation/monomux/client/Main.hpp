@@ -17,8 +17,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <chrono>
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "monomux/client/Client.hpp"
@@ -67,6 +69,43 @@ struct Options
   /// \note This is a control-mode flag.
   bool StatisticsRequest : 1;
 
+  /// Whether it was requested to list the sessions with their state, read
+  /// from the status page of the server if possible.
+  ///
+  /// \note This is a control-mode flag.
+  bool StatusPageRequest : 1;
+
+  /// Whether it was requested to print the metrics of the running server.
+  ///
+  /// \note This is a control-mode flag.
+  bool MetricsRequest : 1;
+
+  /// Whether it was requested to print the tracepoint records of the running
+  /// server.
+  ///
+  /// \note This is a control-mode flag.
+  bool TraceDumpRequest : 1;
+
+  /// Whether the client should ask the server to hand over the PTY of the
+  /// session after attaching, and exchange data with it directly.
+  bool Exclusive : 1;
+
+  /// Whether the client should attach to an existing session read-only, only
+  /// showing its output, without sending input or resizing it.
+  bool ReadOnly : 1;
+
+  /// Whether the server should skip the output the client lags too far behind
+  /// in receiving, and make the session redraw, instead of buffering it.
+  bool CatchUp : 1;
+
+  /// Whether the output should be compressed on the data connection, if the
+  /// server is not on the same machine.
+  bool Compress : 1;
+
+  /// Whether the recordings should be written with direct I/O, bypassing the
+  /// page cache.
+  bool RecordDirect : 1;
+
   /// The path to the server socket where the client should connect to.
   std::optional<std::string> SocketPath;
 
@@ -79,6 +118,44 @@ struct Options
   /// session.)
   std::optional<Process::SpawnOptions> Program;
 
+  /// The size of the scrollback the server should keep for the session if a
+  /// new one is created during the client's connection.
+  std::optional<std::size_t> ScrollbackSize;
+
+  /// The time the server should wait to accumulate the output of the session
+  /// before relaying it, if a new one is created during the client's
+  /// connection.
+  std::optional<std::chrono::microseconds> CoalesceWindow;
+
+  /// The number of bytes per second the server should read at most from the
+  /// session, if a new one is created during the client's connection.
+  std::optional<std::size_t> RateLimit;
+
+  /// The new rate limit requested to be set for the session the client is
+  /// executed in.
+  ///
+  /// \note This is a control-mode option.
+  std::optional<std::size_t> RateLimitRequest;
+
+  /// The text requested to be searched for in the scrollback of the sessions,
+  /// or only of \p SessionName, if given.
+  ///
+  /// \note This is a control-mode option.
+  std::optional<std::string> SearchRequest;
+
+  /// The file to read the commands of a batch from, with \p "-" meaning the
+  /// standard input, which are executed over one connection.
+  ///
+  /// \see ControlClient::runBatchCommand()
+  ///
+  /// \note This is a control-mode option.
+  std::optional<std::string> BatchScript;
+
+  /// The sessions to record the output of, and the files to record them to,
+  /// with \p "-" meaning the standard output. If any is given, the client
+  /// runs headless, as a \p Recorder.
+  std::vector<std::pair<std::string, std::string>> Recordings;
+
   /// Contains the master connection to the server, if such was established.
   std::optional<Client> Connection;
 
@@ -103,6 +180,13 @@ connect(Options& Opts, bool Block, std::string* FailureReason);
 /// human-readable reason for the failure will be written to.
 bool makeWholeWithData(Client& Client, std::string* FailureReason);
 
+/// Lists the sessions of the server specified in \p Opts from the status page
+/// the server publishes, without connecting to the server.
+///
+/// \returns the exit code, or \p std::nullopt if the status page could not be
+/// read, and the sessions should be listed through a connection instead.
+std::optional<int> listSessionsFromStatusPage(const Options& Opts);
+
 /// Executes the Monomux Client logic.
 ///
 /// \returns \p ExitCode
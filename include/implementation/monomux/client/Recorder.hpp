@@ -0,0 +1,145 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "monomux/adt/Atomic.hpp"
+#include "monomux/client/Client.hpp"
+#include "monomux/system/Event.hpp"
+#include "monomux/system/RecordFile.hpp"
+
+namespace monomux::client
+{
+
+/// A headless client, which attaches to sessions as an \e observer, and writes
+/// everything they output to a \p RecordFile. It never sends input, or asks
+/// the session to redraw, and several sessions are recorded by the same event
+/// loop. The sessions are multiplexed over the channels of one connection to
+/// the server where the server allows, and recorded through connections of
+/// their own otherwise.
+///
+/// Observers do not take part in deciding which client is the "latest" that
+/// controls the session, and while an interactive client is attached, a
+/// recorder that falls behind does not hold back the output of the session.
+class Recorder
+{
+public:
+  /// The time after which the buffered data is written even if the buffer of
+  /// the recording did not fill up.
+  static constexpr std::chrono::seconds FlushInterval{1};
+  /// The time to wait for more output of a session that ended, before its
+  /// recording is closed.
+  static constexpr std::chrono::milliseconds DrainTimeout{100};
+
+  Recorder() = default;
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+  Recorder(Recorder&&) = delete;
+  Recorder& operator=(Recorder&&) = delete;
+
+  /// Takes ownership of the \p Connection, establishes its data connection,
+  /// and attaches it to \p SessionName as an observer.
+  ///
+  /// \returns whether the session was attached. Otherwise, the recording is
+  /// dropped, \p File is closed, and the reason is written to
+  /// \p FailureReason.
+  bool record(Client&& Connection,
+              std::string SessionName,
+              RecordFile&& File,
+              std::string* FailureReason);
+
+  /// Takes ownership of the \p Connection, and establishes its data
+  /// connection, over which the sessions given to \p recordChannel() are
+  /// multiplexed.
+  ///
+  /// \returns whether the connection was set up. Otherwise, the connection is
+  /// dropped, and the reason is written to \p FailureReason.
+  bool multiplex(Client&& Connection, std::string* FailureReason);
+  /// Opens a channel to \p SessionName over the connection set up by
+  /// \p multiplex(), as an observer.
+  ///
+  /// \returns whether the channel was opened, in which case the recording
+  /// takes \p File. Otherwise, \p File is left untouched, and the session
+  /// should be recorded through a \p record() connection of its own.
+  bool recordChannel(std::string SessionName, RecordFile& File);
+
+  std::size_t size() const noexcept { return Recordings.size(); }
+
+  /// Records the output of the sessions until all of them ended, or
+  /// \p terminate() was called.
+  void loop();
+
+  /// Makes the \p loop() stop, after writing the data received so far.
+  ///
+  /// \note This function is safe to be called from a signal handler.
+  void terminate() noexcept { TerminateLoop.get().store(true); }
+
+private:
+  struct Recording
+  {
+    /// The connection the output of the session arrives on, owned by
+    /// \p Connections.
+    Client* Connection;
+    /// The channel of the \p Connection the session is relayed over, if it is
+    /// multiplexed.
+    std::optional<message::ChannelID> Channel;
+    std::string SessionName;
+    RecordFile File;
+    /// Whether the client exited, and the remaining output is being drained.
+    bool Draining = false;
+    /// Whether the recording is closed.
+    bool Finished = false;
+    /// The last time output was received.
+    std::chrono::steady_clock::time_point LastData{};
+  };
+
+  /// The requests register callbacks that refer to the clients, so they must
+  /// not be moved after the connections are set up.
+  std::vector<std::unique_ptr<Client>> Connections;
+  /// The connection the channels are multiplexed over, if it was set up.
+  Client* Mux = nullptr;
+  std::vector<std::unique_ptr<Recording>> Recordings;
+  std::unique_ptr<EPoll> Poll;
+  Atomic<bool> TerminateLoop = false;
+
+  /// Writes the output of the session that is available at the moment.
+  void receive(Recording& R);
+  /// Writes the output of the channels of \p Mux that is available at the
+  /// moment.
+  void receiveChannels();
+  /// \returns the recording of the \p Channel of \p Mux, if it is not
+  /// finished.
+  Recording* channelRecording(message::ChannelID Channel) noexcept;
+  /// Starts draining every recording multiplexed over \p Mux, after it
+  /// exited.
+  void drainChannels();
+  /// Starts draining \p R after its client exited.
+  void drain(Recording& R);
+  /// Closes the recording after the drain, if no output arrived in its time.
+  void drainTimer(Recording& R);
+  /// Stops watching the connections of \p R, and closes its file.
+  void finish(Recording& R);
+  void flushTimer();
+};
+
+} // namespace monomux::client
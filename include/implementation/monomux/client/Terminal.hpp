@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <chrono>
+
 #include <termios.h>
 
 #include "monomux/adt/Atomic.hpp"
@@ -41,6 +43,15 @@ public:
 
   Terminal(raw_fd InputStream, raw_fd OutputStream);
 
+  /// The amount of input read at once from which on the input is considered a
+  /// burst, e.g. a paste, instead of typing, and more of it is gathered before
+  /// sending it to the server.
+  static constexpr std::size_t InputBurstSize = 512;
+  /// The most input gathered to be sent to the server at once.
+  static constexpr std::size_t InputBatchMax = 1ULL << 16; // 64 KiB
+  /// The longest time the input of a burst is held back to gather more of it.
+  static constexpr std::chrono::microseconds InputBatchLatency{2000};
+
   /// Engages control over the current input and ouput terminal and sets it
   /// into the mode necesary for remote communication.
   void engage();
@@ -97,6 +108,8 @@ private:
   static void clientInput(Terminal* Term, Client& Client);
   /// Callback function fired when the client reports available output.
   static void clientOutput(Terminal* Term, Client& Client);
+  /// Callback function fired when the output backlog can be written.
+  static void clientOutputWritable(Terminal* Term, Client& Client);
   /// Callback function fired when the client is ready to process events of the
   /// environment.
   static void clientEventReady(Terminal* Term, Client& Client);
@@ -17,10 +17,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <chrono>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "monomux/system/fd.hpp"
+
 namespace monomux::server
 {
 
@@ -43,8 +46,96 @@ struct Options
   /// has terminated.
   bool ExitOnLastSessionTerminate : 1;
 
+  /// Whether the server should relay session output to a single attached
+  /// client with \p splice(), bypassing userspace buffers.
+  bool SpliceRelay : 1;
+
+  /// Whether the server should implement its event loop with \p io_uring(7)
+  /// instead of \p epoll(7).
+  bool UseIOUring : 1;
+
+  /// Whether the server should relay session output to the clients through
+  /// memory shared with them, instead of their data connections.
+  bool SharedOutput : 1;
+
+  /// Whether the server should receive signals and the exit of sessions as
+  /// events through \p signalfd(2) and \p pidfd_open(2).
+  bool SignalEvents : 1;
+
+  /// Whether the server should spawn the processes of sessions through a
+  /// helper process forked at startup, instead of forking itself.
+  bool UseForkServer : 1;
+
+  /// Whether the server should stop reading the output of sessions while an
+  /// attached client is lagging behind, instead of kicking the client.
+  bool FlowControl : 1;
+
+  /// Whether the server should publish the state of the sessions in a status
+  /// page next to its socket.
+  bool StatusPage : 1;
+
+  /// Whether the server should write its log messages from a background
+  /// thread, instead of the thread emitting them.
+  bool AsyncLog : 1;
+
+  /// The size of the scrollback to keep for sessions created without an
+  /// explicitly requested size.
+  std::optional<std::size_t> ScrollbackSize;
+
+  /// The time to wait to accumulate the output of sessions created without an
+  /// explicitly requested coalescing window.
+  std::optional<std::chrono::microseconds> CoalesceWindow;
+
+  /// The number of bytes per second to read at most from sessions created
+  /// without an explicitly requested rate limit.
+  std::optional<std::size_t> RateLimit;
+
+  /// The number of bytes the buffers of the server may use in total.
+  std::optional<std::size_t> MemoryBudget;
+
+  /// The number of worker threads to distribute the sessions between.
+  std::optional<std::size_t> WorkerCount;
+
+  /// The number of idle sessions to keep spawned, ready to be handed out.
+  std::optional<std::size_t> SessionPoolSize;
+
+  /// How the size of a session is decided between its clients: \p "latest",
+  /// \p "smallest", or \p "owner".
+  std::optional<std::string> SizePolicy;
+
+  /// The time of inactivity after which detached sessions are hibernated.
+  std::optional<std::chrono::seconds> HibernateAfter;
+
+  /// The number of pending connections the kernel queues for the server.
+  std::optional<std::size_t> ListenBacklog;
+
+  /// The time an iteration of the event loop may take before it is reported
+  /// as a stall.
+  std::optional<std::chrono::milliseconds> StallDeadline;
+
+  /// The time sessions are given to exit when the server shuts down.
+  std::optional<std::chrono::milliseconds> ShutdownGrace;
+
+  /// The directory the traffic of the sessions is recorded in.
+  std::optional<std::string> RecordDirectory;
+
+  /// The granularity of the time cached once per iteration of the event loop.
+  std::optional<std::chrono::microseconds> ClockResolution;
+
   /// The path of the server socket to start listening on.
   std::optional<std::string> SocketPath;
+
+  /// The file to append the raw backtrace to if the process crashes, instead
+  /// of symbolising it.
+  std::optional<std::string> CrashReportPath;
+
+  /// The file descriptor, inherited from the process that started the server,
+  /// to notify once the server accepts connections.
+  std::optional<raw_fd> ReadinessFD;
+
+  /// The file descriptor, inherited from the server process that is being
+  /// upgraded, which stores the state of the sessions to resume.
+  std::optional<raw_fd> ResumeStateFD;
 };
 
 /// \p exec() into a server process that is created with the \p Opts options.
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #pragma once
+#include <array>
 #include <cstdint>
 #include <iosfwd>
 #include <memory>
@@ -119,6 +120,13 @@ public:
   /// skipped from the report.
   Backtrace(std::size_t Depth = MaxSize, std::size_t Ignore = 0);
 
+  /// Creates a backtrace from the frames of the last report written to
+  /// \p RawReport by \p writeRaw() or a \p CrashCapture, which may then be
+  /// symbolised with \p prettify().
+  explicit Backtrace(std::istream& RawReport);
+
+  Backtrace(const Backtrace&) = delete;
+  Backtrace& operator=(const Backtrace&) = delete;
   ~Backtrace();
 
   /// \returns the stack frames created and stored when the \p Backtrace
@@ -128,8 +136,18 @@ public:
 
   /// Prettify the stack symbol information and fill \p Pretty for each \p Frame
   /// by calling system binaries such as \p addr2line on the collected raw data.
+  ///
+  /// The frames of each binary are symbolised by one invocation of each
+  /// symboliser, and the results are cached for the lifetime of the process.
   void prettify();
 
+  /// Writes the stack frames to \p OS without symbolising them, for offline
+  /// symbolisation. Each line contains the index of the frame, the binary it
+  /// was loaded from, the build ID of the binary (or \p - if it has none), and
+  /// the address of the frame relative to where the binary is loaded, which
+  /// can be given to \p addr2line directly.
+  void writeRaw(std::ostream& OS) const;
+
   const std::size_t IgnoredFrameCount;
 
 private:
@@ -138,6 +156,71 @@ private:
   /// The buffer where the backtrace generator returns the symbol information
   /// in a string format.
   const char* const* SymbolDataBuffer;
+
+  /// The lines of a raw report the frames were read from, which the views in
+  /// \p RawData point into.
+  std::vector<std::string> RawReportLines;
+};
+
+/// Captures the backtrace of a crashing process into a raw report, in the
+/// format of \p Backtrace::writeRaw(), calling only async-signal-safe
+/// functions and without allocating memory. Everything needed, including the
+/// report file and the table of loaded binaries, is set up when the instance
+/// is created, so it should be created at startup and registered as an object
+/// of \p SignalHandling for the crash handler.
+class CrashCapture
+{
+public:
+  /// The maximum number of loaded binaries remembered.
+  static constexpr std::size_t ObjectCountMax = 64;
+  /// The maximum length of the path of a binary. Longer paths are truncated.
+  static constexpr std::size_t PathSizeMax = 1024;
+
+  /// Prepares capturing into the file at \p ReportPath. Every report starts
+  /// with the line \p Header.
+  CrashCapture(const std::string& ReportPath, std::string_view Header);
+  ~CrashCapture();
+
+  CrashCapture(const CrashCapture&) = delete;
+  CrashCapture& operator=(const CrashCapture&) = delete;
+
+  /// \returns whether the report file could be opened.
+  bool valid() const noexcept { return ReportFD != -1; }
+
+  /// Sets a helper process, \p Program with \p Arguments (including the 0th
+  /// argument), to execute after the report is written, in a process forked
+  /// from the crashing one. This allows deferring symbolisation to a fresh
+  /// process, while the crashing one exits without waiting.
+  void setHelper(std::string Program, std::vector<std::string> Arguments);
+
+  /// Writes the report of the current stack, and the signal \p SigNum that
+  /// the crash was detected with in \p Module, then starts the helper.
+  ///
+  /// \note This function is async-signal-safe.
+  void capture(int SigNum, const char* Module) noexcept;
+
+private:
+  struct LoadedObject
+  {
+    std::uintptr_t Begin, End, LoadBias;
+    std::array<char, PathSizeMax> Name;
+    /// The hexadecimal GNU build ID, or "-".
+    std::array<char, 2 * 64 + 1> BuildID;
+  };
+
+  int ReportFD;
+  std::string Header;
+  std::array<LoadedObject, ObjectCountMax> Objects;
+  std::size_t ObjectCount;
+  std::array<void*, Backtrace::MaxSize> Addresses;
+  std::array<char, PathSizeMax + 256> Line;
+
+  std::string HelperProgram;
+  std::vector<std::string> HelperArguments;
+  std::vector<char*> HelperArgv;
+
+  /// Records the binaries loaded into the process.
+  void snapshotObjects();
 };
 
 /// Prints \p Trace to the output \p OS using the default formatting logic.
@@ -0,0 +1,285 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "monomux/Allocation.hpp"
+
+namespace monomux::alloc
+{
+
+// clang-format off
+static constexpr const char* TagName[TagCount] = {"Other",
+                                                  "Channel",
+                                                  "Message",
+                                                  "Server",
+                                                  "Poll",
+                                                  "Log"};
+static constexpr const char InvalidTag[] =        "Invalid";
+// clang-format on
+
+const char* name(Tag T) noexcept
+{
+  const auto I = static_cast<std::size_t>(T);
+  if (I >= TagCount)
+    return InvalidTag;
+  return TagName[I];
+}
+
+namespace
+{
+
+/// The counters of a \p Tag, on their own cache line so the threads
+/// allocating in different subsystems do not contend.
+///
+/// Allocating and freeing each cost two relaxed additions, the live values
+/// are derived from the difference of the two, and the peak is only written
+/// when it grows.
+struct alignas(64) Slot
+{
+  std::atomic<std::uint64_t> AllocatedBytes;
+  std::atomic<std::uint64_t> AllocatedCount;
+  std::atomic<std::uint64_t> FreedBytes;
+  std::atomic<std::uint64_t> FreedCount;
+  std::atomic<std::uint64_t> PeakBytes;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "Accounting from operator new must not rely on locks!");
+
+/// (Constant-initialised, so it is usable by allocations made during the
+/// initialisation of other objects with static storage.)
+std::array<Slot, TagCount> Slots{};
+
+Slot& slot(Tag T) noexcept
+{
+  const auto I = static_cast<std::size_t>(T);
+  return Slots[I < TagCount ? I : 0];
+}
+
+} // namespace
+
+void account(Tag T, std::size_t Bytes) noexcept
+{
+  Slot& S = slot(T);
+  const std::uint64_t Allocated =
+    S.AllocatedBytes.fetch_add(Bytes, std::memory_order_relaxed) + Bytes;
+  S.AllocatedCount.fetch_add(1, std::memory_order_relaxed);
+
+  const std::uint64_t Live =
+    Allocated - S.FreedBytes.load(std::memory_order_relaxed);
+  std::uint64_t Peak = S.PeakBytes.load(std::memory_order_relaxed);
+  while (Live > Peak && !S.PeakBytes.compare_exchange_weak(
+                          Peak, Live, std::memory_order_relaxed))
+    ;
+}
+
+void release(Tag T, std::size_t Bytes) noexcept
+{
+  Slot& S = slot(T);
+  S.FreedBytes.fetch_add(Bytes, std::memory_order_relaxed);
+  S.FreedCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::array<Counters, TagCount> snapshot() noexcept
+{
+  std::array<Counters, TagCount> Ret;
+  for (std::size_t I = 0; I < TagCount; ++I)
+  {
+    const Slot& S = Slots[I];
+    Counters& C = Ret[I];
+    // (Read the frees first, so a concurrent allocation and free of the same
+    // block does not make the live values underflow.)
+    const std::uint64_t FreedBytes =
+      S.FreedBytes.load(std::memory_order_relaxed);
+    const std::uint64_t FreedCount =
+      S.FreedCount.load(std::memory_order_relaxed);
+    C.TotalBytes = S.AllocatedBytes.load(std::memory_order_relaxed);
+    C.TotalCount = S.AllocatedCount.load(std::memory_order_relaxed);
+    C.LiveBytes = C.TotalBytes - std::min(FreedBytes, C.TotalBytes);
+    C.LiveCount = C.TotalCount - std::min(FreedCount, C.TotalCount);
+    C.PeakBytes =
+      std::max(S.PeakBytes.load(std::memory_order_relaxed), C.LiveBytes);
+  }
+  return Ret;
+}
+
+} // namespace monomux::alloc
+
+#ifdef MONOMUX_ALLOCATION_ACCOUNTING
+// The global allocation functions are replaced for the whole program, so every
+// block carries a header before it that records its size and its tag, from
+// which freeing is accounted.
+
+namespace
+{
+
+struct BlockHeader
+{
+  std::size_t Size;
+  monomux::alloc::Tag Tag;
+};
+
+/// The space before each block, which keeps the fundamental alignment of the
+/// block returned.
+constexpr std::size_t HeaderSize = alignof(std::max_align_t);
+constexpr std::size_t DefaultAlign = alignof(std::max_align_t);
+static_assert(sizeof(BlockHeader) <= HeaderSize);
+
+std::size_t headerOffset(std::size_t Align) noexcept
+{
+  return std::max(Align, HeaderSize);
+}
+
+BlockHeader& header(void* Ptr) noexcept
+{
+  return *reinterpret_cast<BlockHeader*>(static_cast<char*>(Ptr) - HeaderSize);
+}
+
+void* allocate(std::size_t Size, std::size_t Align) noexcept
+{
+  const std::size_t Offset = headerOffset(Align);
+  if (Size > static_cast<std::size_t>(-1) - Offset)
+    return nullptr;
+  void* Base = nullptr;
+  if (Align <= alignof(std::max_align_t))
+    Base = std::malloc(Offset + Size);
+  else if (::posix_memalign(&Base, Align, Offset + Size) != 0)
+    Base = nullptr;
+  if (!Base)
+    return nullptr;
+
+  void* Ptr = static_cast<char*>(Base) + Offset;
+  BlockHeader& H = header(Ptr);
+  H.Size = Size;
+  H.Tag = monomux::alloc::current();
+  monomux::alloc::account(H.Tag, Size);
+  return Ptr;
+}
+
+void* allocateOrThrow(std::size_t Size, std::size_t Align)
+{
+  while (true)
+  {
+    if (void* Ptr = allocate(Size, Align))
+      return Ptr;
+    std::new_handler Handler = std::get_new_handler();
+    if (!Handler)
+      throw std::bad_alloc{};
+    Handler();
+  }
+}
+
+void deallocate(void* Ptr, std::size_t Align) noexcept
+{
+  if (!Ptr)
+    return;
+  const BlockHeader& H = header(Ptr);
+  monomux::alloc::release(H.Tag, H.Size);
+  std::free(static_cast<char*>(Ptr) - headerOffset(Align));
+}
+
+} // namespace
+
+void* operator new(std::size_t Size)
+{
+  return allocateOrThrow(Size, DefaultAlign);
+}
+void* operator new[](std::size_t Size)
+{
+  return allocateOrThrow(Size, DefaultAlign);
+}
+void* operator new(std::size_t Size, const std::nothrow_t&) noexcept
+{
+  return allocate(Size, DefaultAlign);
+}
+void* operator new[](std::size_t Size, const std::nothrow_t&) noexcept
+{
+  return allocate(Size, DefaultAlign);
+}
+void* operator new(std::size_t Size, std::align_val_t Align)
+{
+  return allocateOrThrow(Size, static_cast<std::size_t>(Align));
+}
+void* operator new[](std::size_t Size, std::align_val_t Align)
+{
+  return allocateOrThrow(Size, static_cast<std::size_t>(Align));
+}
+void* operator new(std::size_t Size,
+                   std::align_val_t Align,
+                   const std::nothrow_t&) noexcept
+{
+  return allocate(Size, static_cast<std::size_t>(Align));
+}
+void* operator new[](std::size_t Size,
+                     std::align_val_t Align,
+                     const std::nothrow_t&) noexcept
+{
+  return allocate(Size, static_cast<std::size_t>(Align));
+}
+
+void operator delete(void* Ptr) noexcept { deallocate(Ptr, DefaultAlign); }
+void operator delete[](void* Ptr) noexcept { deallocate(Ptr, DefaultAlign); }
+void operator delete(void* Ptr, const std::nothrow_t&) noexcept
+{
+  deallocate(Ptr, DefaultAlign);
+}
+void operator delete[](void* Ptr, const std::nothrow_t&) noexcept
+{
+  deallocate(Ptr, DefaultAlign);
+}
+void operator delete(void* Ptr, std::size_t) noexcept
+{
+  deallocate(Ptr, DefaultAlign);
+}
+void operator delete[](void* Ptr, std::size_t) noexcept
+{
+  deallocate(Ptr, DefaultAlign);
+}
+void operator delete(void* Ptr, std::align_val_t Align) noexcept
+{
+  deallocate(Ptr, static_cast<std::size_t>(Align));
+}
+void operator delete[](void* Ptr, std::align_val_t Align) noexcept
+{
+  deallocate(Ptr, static_cast<std::size_t>(Align));
+}
+void operator delete(void* Ptr, std::size_t, std::align_val_t Align) noexcept
+{
+  deallocate(Ptr, static_cast<std::size_t>(Align));
+}
+void operator delete[](void* Ptr, std::size_t, std::align_val_t Align) noexcept
+{
+  deallocate(Ptr, static_cast<std::size_t>(Align));
+}
+void operator delete(void* Ptr,
+                     std::align_val_t Align,
+                     const std::nothrow_t&) noexcept
+{
+  deallocate(Ptr, static_cast<std::size_t>(Align));
+}
+void operator delete[](void* Ptr,
+                       std::align_val_t Align,
+                       const std::nothrow_t&) noexcept
+{
+  deallocate(Ptr, static_cast<std::size_t>(Align));
+}
+#endif /* MONOMUX_ALLOCATION_ACCOUNTING */
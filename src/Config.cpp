@@ -46,6 +46,16 @@ std::string getHumanReadableConfiguration()
   Buf << " + Non-essential trace logs\n";
 #endif /* MONOMUX_NON_ESSENTIAL_LOGS */
 
+#ifndef MONOMUX_TRACEPOINTS
+  Buf << " - Tracepoints\n";
+#else  /* !MONOMUX_TRACEPOINTS */
+#ifndef MONOMUX_USDT_PROBES
+  Buf << " + Tracepoints\n";
+#else  /* !MONOMUX_USDT_PROBES */
+  Buf << " + Tracepoints (with USDT probes)\n";
+#endif /* MONOMUX_USDT_PROBES */
+#endif /* MONOMUX_TRACEPOINTS */
+
   std::string S = Buf.str();
 
   {
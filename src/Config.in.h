@@ -28,6 +28,20 @@
  */
 #cmakedefine MONOMUX_NON_ESSENTIAL_LOGS
 
+/* If set, the hot paths of the built binary record compact binary events into
+ * per-thread rings in memory, which can be dumped from a running server.
+ */
+#cmakedefine MONOMUX_TRACEPOINTS
+
+/* If set, the tracepoints are also exposed as USDT probes. */
+#cmakedefine MONOMUX_USDT_PROBES
+
+/* If set, the global allocation functions are replaced to count the
+ * allocations of the built binary per subsystem, which the server reports in
+ * its statistics.
+ */
+#cmakedefine MONOMUX_ALLOCATION_ACCOUNTING
+
 /* The build type for the current build. */
 #define MONOMUX_BUILD_TYPE "${CMAKE_BUILD_TYPE}"
 
@@ -16,8 +16,16 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include <pthread.h>
+
+#include "monomux/adt/HandoffQueue.hpp"
 #include "monomux/system/Time.hpp"
 
 #include "monomux/Log.hpp"
@@ -47,19 +55,183 @@ const char* Logger::levelName(Severity S) noexcept
   return SeverityName[S];
 }
 
-Logger::OutputBuffer::OutputBuffer(std::ostream& OS,
+/// Keeps the lines of messages emitted by different threads intact.
+static std::mutex EmitLock;
+
+/// Set in the child process of a \p fork(), where the background threads of
+/// the asynchronous backends no longer exist.
+static std::atomic<bool> ForkedChild = false;
+
+static void writeMessage(std::ostream& OS,
+                         std::chrono::system_clock::time_point Time,
+                         Severity S,
+                         std::string_view Facility,
+                         std::string_view Message)
+{
+  OS << '[' << formatTime(Time) << ']';
+  if (std::string_view SN = SeverityName[S]; !SN.empty())
+    OS << '[' << SN << "] ";
+  if (!Facility.empty())
+    OS << Facility << ": ";
+  else
+    OS << "?: ";
+  OS << Message << '\n';
+}
+
+class Logger::AsyncBackend
+{
+public:
+  struct Entry
+  {
+    std::ostream* OS;
+    std::chrono::system_clock::time_point Time;
+    Severity S;
+    std::string Facility;
+    std::string Message;
+  };
+
+  /// The longest time a pushed message waits for the background thread if
+  /// its wakeup was missed.
+  static constexpr std::chrono::milliseconds WakeupPeriod{50};
+
+  explicit AsyncBackend(std::size_t Capacity)
+    : Capacity(Capacity), Thread([this] { run(); })
+  {
+    static std::once_flag AtFork;
+    std::call_once(AtFork, [] {
+      ::pthread_atfork(
+        [] { EmitLock.lock(); },
+        [] { EmitLock.unlock(); },
+        [] {
+          EmitLock.unlock();
+          ForkedChild.store(true, std::memory_order_relaxed);
+        });
+    });
+  }
+
+  ~AsyncBackend()
+  {
+    {
+      std::lock_guard<std::mutex> L{Lock};
+      Terminate = true;
+    }
+    Wake.notify_one();
+    Thread.join();
+  }
+
+  std::uint64_t dropped() const noexcept
+  {
+    return Dropped.load(std::memory_order_relaxed);
+  }
+
+  /// Queues \p E for writing, or drops it if the queue is full. This function
+  /// does not block.
+  void push(Entry E)
+  {
+    const std::size_t Size = size(E);
+    if (Pending.fetch_add(Size, std::memory_order_relaxed) + Size > Capacity)
+    {
+      Pending.fetch_sub(Size, std::memory_order_relaxed);
+      Dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (Queue.push(std::move(E)))
+      // The notification is sent without the lock, so the background thread
+      // might miss it, and only wake up after the WakeupPeriod.
+      Wake.notify_one();
+  }
+
+  void flush()
+  {
+    std::unique_lock<std::mutex> L{Lock};
+    Wake.notify_one();
+    Drained.wait(L, [this] {
+      return Pending.load(std::memory_order_relaxed) == 0;
+    });
+  }
+
+private:
+  std::size_t Capacity;
+  /// The memory taken by the messages in the \p Queue, or being written.
+  std::atomic<std::size_t> Pending = 0;
+  std::atomic<std::uint64_t> Dropped = 0;
+  HandoffQueue<Entry> Queue;
+
+  std::mutex Lock;
+  std::condition_variable Wake;
+  std::condition_variable Drained;
+  bool Terminate = false;
+
+  std::thread Thread;
+
+  static std::size_t size(const Entry& E) noexcept
+  {
+    return sizeof(Entry) + E.Facility.size() + E.Message.size();
+  }
+
+  void run()
+  {
+    MONOMUX_ALLOCATION_SCOPE(Log);
+    std::uint64_t Reported = 0;
+    std::unique_lock<std::mutex> L{Lock};
+    while (true)
+    {
+      Wake.wait_for(
+        L, WakeupPeriod, [this] { return Terminate || !Queue.empty(); });
+      const bool Stopping = Terminate;
+      L.unlock();
+
+      std::vector<Entry> Batch = Queue.take();
+      std::size_t Size = 0;
+      {
+        std::lock_guard<std::mutex> Emit{EmitLock};
+        for (std::size_t I = 0; I < Batch.size(); ++I)
+        {
+          const Entry& E = Batch.at(I);
+          writeMessage(*E.OS, E.Time, E.S, E.Facility, E.Message);
+          Size += size(E);
+          if (I + 1 == Batch.size() || Batch.at(I + 1).OS != E.OS)
+            E.OS->flush();
+        }
+
+        if (const std::uint64_t D = dropped(); D != Reported && !Batch.empty())
+        {
+          std::ostream& OS = *Batch.back().OS;
+          writeMessage(OS,
+                       std::chrono::system_clock::now(),
+                       Warning,
+                       "logger",
+                       std::to_string(D - Reported) +
+                         " messages dropped, as the queue was full");
+          OS.flush();
+          Reported = D;
+        }
+      }
+
+      L.lock();
+      Pending.fetch_sub(Size, std::memory_order_relaxed);
+      Drained.notify_all();
+      if (Stopping && Queue.empty())
+        break;
+    }
+  }
+};
+
+Logger::OutputBuffer::OutputBuffer(Logger& Owner,
                                    bool Discard,
-                                   std::string_view Prefix)
-  : Discard(Discard), OS(&OS)
+                                   Severity S,
+                                   std::string_view Facility)
+  : Discard(Discard), Owner(&Owner), S(S), Facility(Facility)
 {
   if (!Discard)
-    Buffer << Prefix;
+    Time = std::chrono::system_clock::now();
 }
 
 Logger::OutputBuffer::~OutputBuffer() noexcept(false)
 {
-  if (!Discard)
-    (*OS) << Buffer.str() << std::endl;
+  if (Discard)
+    return;
+  Owner->emit(S, Facility, Time, Buffer.str());
 }
 
 std::unique_ptr<Logger> Logger::Singleton;
@@ -91,21 +263,66 @@ std::size_t Logger::digits(std::size_t Number)
 
 Logger::Logger(Severity S, std::ostream& OS) : SeverityLimit(S), OS(&OS) {}
 
-Logger::OutputBuffer Logger::operator()(Severity S, std::string_view Facility)
+Logger::~Logger()
+{
+  if (ForkedChild.load(std::memory_order_relaxed))
+    // The background thread does not exist in this process, and can not be
+    // joined.
+    (void)Async.release();
+}
+
+void Logger::setAsynchronous(bool Async, std::size_t Capacity)
+{
+  if (ForkedChild.load(std::memory_order_relaxed))
+    return;
+
+  if (this->Async)
+  {
+    DroppedBefore += this->Async->dropped();
+    this->Async.reset();
+  }
+  if (Async)
+    this->Async = std::make_unique<AsyncBackend>(Capacity);
+}
+
+bool Logger::isAsynchronous() const noexcept { return Async != nullptr; }
+
+std::uint64_t Logger::droppedMessages() const noexcept
 {
-  std::ostringstream LogPrefix;
-  bool Discarding = S > getLimit();
-  if (!Discarding)
+  return DroppedBefore + (Async ? Async->dropped() : 0);
+}
+
+void Logger::flush()
+{
+  if (Async && !ForkedChild.load(std::memory_order_relaxed))
+    Async->flush();
+}
+
+void Logger::emit(Severity S,
+                  std::string_view Facility,
+                  std::chrono::system_clock::time_point Time,
+                  std::string Message)
+{
+  if (Async && !ForkedChild.load(std::memory_order_relaxed))
   {
-    LogPrefix << '[' << formatTime(std::chrono::system_clock::now()) << ']';
-    if (std::string_view SN = SeverityName[S]; !SN.empty())
-      LogPrefix << '[' << SN << "] ";
-    if (!Facility.empty())
-      LogPrefix << Facility << ": ";
-    else
-      LogPrefix << "?: ";
+    if (S > Fatal)
+    {
+      Async->push(AsyncBackend::Entry{
+        OS, Time, S, std::string{Facility}, std::move(Message)});
+      return;
+    }
+    // Fatal messages are likely the last ones, make sure they get out.
+    Async->flush();
   }
-  return OutputBuffer{*OS, Discarding, LogPrefix.str()};
+
+  std::lock_guard<std::mutex> Lock{EmitLock};
+  writeMessage(*OS, Time, S, Facility, Message);
+  OS->flush();
+}
+
+Logger::OutputBuffer Logger::operator()(Severity S, std::string_view Facility)
+{
+  return OutputBuffer{*this, S > getLimit(), S, Facility};
 }
 
 } // namespace monomux::log
@@ -0,0 +1,122 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#include "monomux/Trace.hpp"
+
+namespace monomux::trace
+{
+
+// clang-format off
+static constexpr const char* EventName[EventCount] = {"None",
+                                                      "LoopWake",
+                                                      "LoopEvent",
+                                                      "ChannelRead",
+                                                      "ChannelLoad",
+                                                      "ChannelWrite",
+                                                      "ChannelTryWrite",
+                                                      "ChannelFlush",
+                                                      "ChannelBuffer",
+                                                      "ChannelOverflow"};
+static constexpr const char InvalidEvent[] =          "Invalid";
+// clang-format on
+
+const char* name(Event E) noexcept
+{
+  const auto I = static_cast<std::size_t>(E);
+  if (I >= EventCount)
+    return InvalidEvent;
+  return EventName[I];
+}
+
+void Ring::snapshot(std::vector<Record>& Out) const
+{
+  const std::uint64_t End = written();
+  std::uint64_t Begin = End > Capacity ? End - Capacity : 0;
+  const std::size_t OutBegin = Out.size();
+  for (std::uint64_t I = Begin; I < End; ++I)
+    Out.emplace_back(Records[I & (Capacity - 1)]);
+
+  // The writer might have lapped the copy, in which case the oldest records
+  // copied were overwritten in the meantime.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const std::uint64_t EndAfter = written();
+  if (EndAfter - Begin > Capacity)
+  {
+    const std::uint64_t Overwritten =
+      std::min(EndAfter - Begin - Capacity, End - Begin);
+    Out.erase(Out.begin() + static_cast<std::ptrdiff_t>(OutBegin),
+              Out.begin() + static_cast<std::ptrdiff_t>(OutBegin) +
+                static_cast<std::ptrdiff_t>(Overwritten));
+  }
+}
+
+namespace
+{
+
+struct Registry
+{
+  std::mutex Lock;
+  std::vector<std::unique_ptr<Ring>> Rings;
+};
+
+Registry& registry()
+{
+  static Registry R;
+  return R;
+}
+
+} // namespace
+
+namespace detail
+{
+
+Ring& registerThread()
+{
+  Registry& R = registry();
+  std::lock_guard<std::mutex> Guard{R.Lock};
+  CurrentRing = R.Rings.emplace_back(std::make_unique<Ring>()).get();
+  return *CurrentRing;
+}
+
+} // namespace detail
+
+std::vector<Record> collect()
+{
+  Registry& R = registry();
+  std::lock_guard<std::mutex> Guard{R.Lock};
+
+  std::vector<Record> Ret;
+  for (std::size_t I = 0; I < R.Rings.size(); ++I)
+  {
+    const std::size_t Begin = Ret.size();
+    R.Rings.at(I)->snapshot(Ret);
+    for (std::size_t J = Begin; J < Ret.size(); ++J)
+      Ret.at(J).Thread = static_cast<std::uint16_t>(I);
+  }
+  std::stable_sort(
+    Ret.begin(), Ret.end(), [](const Record& LHS, const Record& RHS) {
+      return LHS.Timestamp < RHS.Timestamp;
+    });
+  return Ret;
+}
+
+} // namespace monomux::trace
@@ -16,11 +16,19 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <utility>
 
+#include <poll.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/control/CompressedFrame.hpp"
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
 #include "monomux/system/Pipe.hpp"
+#include "monomux/system/Time.hpp"
 
 #include "monomux/client/Client.hpp"
 
@@ -60,14 +68,14 @@ std::optional<Client> Client::create(std::string SocketPath,
 }
 
 Client::Client(Socket&& ControlSock) : ControlSocket(std::move(ControlSock))
-{
-  setUpDispatch();
-}
+{}
 
 void Client::registerMessageHandler(std::uint16_t Kind,
                                     std::function<HandlerFunction> Handler)
 {
-  Dispatch[Kind] = std::move(Handler);
+  if (Kind >= Overrides.size())
+    Overrides.resize(Kind + 1);
+  Overrides[Kind] = std::move(Handler);
 }
 
 void Client::setDataSocket(Socket&& DataSocket)
@@ -82,6 +90,55 @@ void Client::setDataSocket(Socket&& DataSocket)
     enableDataSocket();
 }
 
+void Client::setOutputFile(raw_fd FD)
+{
+  if (OutputFileWaited && Poll)
+    Poll->stop(OutputFile);
+  OutputFileWaited = false;
+  OutputFile = FD;
+}
+
+void Client::notifyOutputBacklog(std::size_t Bytes)
+{
+  OutputBacklog = Bytes;
+  if (!Poll || OutputFile == fd::Invalid)
+    return;
+
+  if (Bytes && !OutputFileWaited)
+  {
+    Poll->listen(OutputFile, /* Incoming =*/false, /* Outgoing =*/true);
+    OutputFileWaited = true;
+  }
+  else if (!Bytes && OutputFileWaited)
+  {
+    Poll->stop(OutputFile);
+    OutputFileWaited = false;
+  }
+
+  if (!OutputBacklogged && Bytes > OutputBacklogHighWatermark)
+  {
+    MONOMUX_TRACE_LOG(LOG(trace) << "Output backlogged, " << Bytes
+                                 << " bytes pending");
+    const bool PreviousDataSocketWasEnabled = DataSocketEnabled;
+    disableDataSocket();
+    // Resume handling the data connection later, as it was.
+    DataSocketEnabled = PreviousDataSocketWasEnabled;
+    OutputBacklogged = true;
+  }
+  else if (OutputBacklogged && Bytes < OutputBacklogLowWatermark)
+  {
+    MONOMUX_TRACE_LOG(LOG(trace) << "Output resumed, " << Bytes
+                                 << " bytes pending");
+    OutputBacklogged = false;
+    if (DataSocketEnabled && DataSocket)
+    {
+      enableDataSocket();
+      // Output might have arrived without a notification to wait for.
+      Poll->schedule(outputFD(), /* Incoming =*/true, /* Outgoing =*/false);
+    }
+  }
+}
+
 void Client::setInputFile(raw_fd FD)
 {
   bool PreviousInputFileWasEnabled = InputFileEnabled;
@@ -102,11 +159,56 @@ bool Client::handshake(std::string* FailureReason)
 
   // Authenticate the client on the server.
   {
+    // Offer the binary encoding first, and ask for the data connection and
+    // the shared output to be set up right away, so the handshake needs a
+    // single round-trip. Servers that do not understand some of the requests
+    // ignore them, and respond only to the identity request.
+    ControlSocket.setAcceptFDs(true);
+    sendMessage(ControlSocket, request::Protocol{BinaryVersion});
+    // The server only hands the pair over to a client on its machine, which
+    // it tells apart by the process on the other end of the connection.
+    request::DataSocketPair PairReq;
+    PairReq.Process = static_cast<std::int64_t>(::getpid());
+    sendMessage(ControlSocket, PairReq);
+    sendMessage(ControlSocket, request::SharedOutput{});
     sendMessage(ControlSocket, request::ClientID{});
 
     // We decode the response message to be able to fire the handler manually.
     std::string Data = readPascalString(ControlSocket);
     Message MB = Message::unpack(Data);
+    if (MB.Kind == MessageKind::ProtocolResponse)
+    {
+      responseProtocol(*this, MB.RawData);
+      Data = readPascalString(ControlSocket);
+      MB = Message::unpack(Data);
+    }
+    if (MB.Kind == MessageKind::DataSocketPairResponse)
+    {
+      std::optional<response::DataSocketPair> Resp =
+        response::DataSocketPair::decode(MB.RawData);
+      std::vector<fd> FDs = ControlSocket.takeReceivedFDs();
+      if (Resp && Resp->Success && FDs.size() == 1)
+        DataSocket = std::make_unique<Socket>(
+          Socket::wrap(std::move(FDs.front()), ControlSocket.identifier()));
+      else if (Resp && Resp->Success)
+        LOG(error) << "Server sent " << FDs.size()
+                   << " handles for the data connection instead of 1";
+      Data = readPascalString(ControlSocket);
+      MB = Message::unpack(Data);
+    }
+    if (MB.Kind == MessageKind::SharedOutputResponse)
+    {
+      // Without a data connection, the server refused the shared output.
+      std::optional<response::SharedOutput> Resp =
+        response::SharedOutput::decode(MB.RawData);
+      if (Resp && Resp->Success && DataSocket)
+        setUpOutputRing();
+      Data = readPascalString(ControlSocket);
+      MB = Message::unpack(Data);
+    }
+    ControlSocket.setAcceptFDs(false);
+    ControlSocket.takeReceivedFDs();
+
     if (MB.Kind != MessageKind::ClientIDResponse)
     {
       if (FailureReason)
@@ -123,6 +225,10 @@ bool Client::handshake(std::string* FailureReason)
       return false;
     }
   }
+  if (DataSocket)
+    // The server created the data connection, so there is no need to connect
+    // again.
+    return true;
 
   // If the control socket is now successfully established, establish another
   // connection to the same location, but for the data socket.
@@ -178,11 +284,37 @@ bool Client::handshake(std::string* FailureReason)
   // After a successful data connection establishment, the Nonce value was
   // consumed, so we need to request a new one.
   {
-    sendMessage(ControlSocket, request::ClientID{});
+    // Ask for the output to be relayed through shared memory. Servers that do
+    // not support it ignore the request, and respond only to the identity
+    // request.
+    sendMessage(ControlSocket, request::SharedOutput{}, ControlEncoding);
+    if (WantCompression)
+      // The server refuses this to clients on its machine.
+      sendMessage(ControlSocket, request::Compression{}, ControlEncoding);
+    sendMessage(ControlSocket, request::ClientID{}, ControlEncoding);
 
     // We decode the response message to be able to fire the handler manually.
     std::string Data = readPascalString(ControlSocket);
     Message MB = Message::unpack(Data);
+    if (MB.Kind == MessageKind::SharedOutputResponse)
+    {
+      std::optional<response::SharedOutput> Resp =
+        response::SharedOutput::decode(MB.RawData);
+      if (Resp && Resp->Success)
+        setUpOutputRing();
+      Data = readPascalString(ControlSocket);
+      MB = Message::unpack(Data);
+    }
+    if (MB.Kind == MessageKind::CompressionResponse)
+    {
+      std::optional<response::Compression> Resp =
+        response::Compression::decode(MB.RawData);
+      CompressedOutput = Resp && Resp->Success;
+      if (CompressedOutput)
+        LOG(debug) << "Output is compressed on the data connection";
+      Data = readPascalString(ControlSocket);
+      MB = Message::unpack(Data);
+    }
     if (MB.Kind != MessageKind::ClientIDResponse)
     {
       if (FailureReason)
@@ -203,6 +335,26 @@ bool Client::handshake(std::string* FailureReason)
   return true;
 }
 
+void Client::setUpOutputRing()
+{
+  try
+  {
+    std::vector<fd> FDs = DataSocket->receiveFDs(3);
+    if (FDs.size() != 3)
+    {
+      LOG(error) << "Server sent " << FDs.size()
+                 << " handles for the shared output instead of 3";
+      return;
+    }
+    OutputRing = std::make_unique<SharedRing>(SharedRing::open(
+      std::move(FDs.at(0)), std::move(FDs.at(1)), std::move(FDs.at(2))));
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Failed to set up shared output: " << Err.what();
+  }
+}
+
 void Client::loop()
 {
   if (InputFile == fd::Invalid)
@@ -227,6 +379,9 @@ void Client::loop()
   enableControlResponse();
   enableDataSocket();
   enableInputFile();
+  if (PtyReader && DataSocket->hasBufferedRead())
+    // The output relayed before the hand-off must be written first.
+    Poll->schedule(Pty.get(), /* Incoming =*/true, /* Outgoing =*/false);
 
   while (!TerminateLoop.get().load())
   {
@@ -238,7 +393,10 @@ void Client::loop()
     DataSocket->tryFreeResources();
 
     const std::size_t NumTriggeredFDs = Poll->wait();
-    for (std::size_t I = 0; I < NumTriggeredFDs; ++I)
+    LoopClock::tick();
+    // An event handled earlier might have made the client exit, which drops
+    // the rest of the events.
+    for (std::size_t I = 0; I < NumTriggeredFDs && Poll; ++I)
     {
       EPoll::EventWithMode Event;
       try
@@ -258,6 +416,34 @@ void Client::loop()
 
       try
       {
+        if (PtyReader && Event.FD == Pty.get())
+        {
+          if (Event.Incoming && DataHandler)
+            DataHandler(*this);
+          if (Event.Outgoing && PtyWriter)
+          {
+            PtyWriter->flushWrites();
+            if (PtyWriter->hasBufferedWrite())
+              Poll->schedule(
+                Pty.get(), /* Incoming =*/false, /* Outgoing =*/true);
+          }
+          continue;
+        }
+        if (OutputRing && Event.FD == OutputRing->dataBell())
+        {
+          if (Event.Incoming)
+          {
+            OutputRing->clearDataBell();
+            if (DataHandler)
+              DataHandler(*this);
+
+            if (!OutputRing->empty() && !OutputBacklogged)
+              Poll->schedule(OutputRing->dataBell(),
+                             /* Incoming =*/true,
+                             /* Outgoing =*/false);
+          }
+          continue;
+        }
         if (Event.FD == DataSocket->raw())
         {
           if (Event.Incoming)
@@ -265,7 +451,7 @@ void Client::loop()
             if (DataHandler)
               DataHandler(*this);
 
-            if (DataSocket->hasBufferedRead())
+            if (DataSocket->hasBufferedRead() && !OutputBacklogged)
               Poll->schedule(
                 DataSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
           }
@@ -278,6 +464,12 @@ void Client::loop()
           }
           continue;
         }
+        if (OutputFile != fd::Invalid && Event.FD == OutputFile)
+        {
+          if (Event.Outgoing && OutputHandler)
+            OutputHandler(*this);
+          continue;
+        }
         if (InputFile != fd::Invalid && Event.FD == InputFile)
         {
           if (Event.Incoming && InputHandler)
@@ -302,80 +494,254 @@ void Client::loop()
     }
   }
 
+  if (OutputFileWaited && Poll)
+    Poll->stop(OutputFile);
+  OutputFileWaited = false;
+  if (Exit == SessionExit)
+    drainOutput();
   disableInputFile();
   disableDataSocket();
   disableControlResponse();
 }
 
+void Client::drainOutput()
+{
+  // The session might have produced more output than what was handled while
+  // the output backlog paused the data connection.
+  static constexpr int IdleTimeout = 100; // ms
+  OutputBacklogged = false;
+  while (DataHandler && DataSocket && !DataSocket->failed())
+  {
+    if (OutputBacklog > OutputBacklogHighWatermark && OutputHandler)
+    {
+      // The terminal must take some of the output before more is handled.
+      POD<struct ::pollfd> P;
+      P->fd = OutputFile;
+      P->events = POLLOUT;
+      if (!CheckedPOSIX([&P] { return ::poll(&P, 1, -1); }, -1))
+        return;
+      OutputHandler(*this);
+      continue;
+    }
+
+    const bool Buffered = DataSocket->hasBufferedRead() ||
+                          (OutputRing && !OutputRing->empty());
+    if (!Buffered)
+    {
+      POD<struct ::pollfd> P;
+      P->fd = outputFD();
+      P->events = POLLIN;
+      auto Ready =
+        CheckedPOSIX([&P] { return ::poll(&P, 1, IdleTimeout); }, -1);
+      if (!Ready || Ready.get() == 0)
+        return;
+    }
+
+    try
+    {
+      DataHandler(*this);
+    }
+    catch (const std::system_error&)
+    {
+      return;
+    }
+  }
+}
+
 void Client::controlCallback()
 {
   using namespace monomux::message;
-  std::string Data;
 
-  try
-  {
-    Data = readPascalString(ControlSocket);
-  }
-  catch (const buffer_overflow& BO)
+  // Handle every message that arrived since the last wakeup, as responses to
+  // pipelined requests may arrive in bulk.
+  while (true)
   {
-    LOG(error) << "Reading CONTROL: "
-               << "\n\t" << BO.what();
-    Poll->schedule(
-      ControlSocket.raw(), /* Incoming =*/true, /* Outgoing =*/false);
-    return;
-  }
-  catch (const std::system_error& Err)
-  {
-    LOG(error) << "Reading CONTROL: " << Err.what();
+    std::optional<std::string> Data;
+    try
+    {
+      Data = ControlFrames.next(ControlSocket);
+    }
+    catch (const buffer_overflow& BO)
+    {
+      LOG(error) << "Reading CONTROL: "
+                 << "\n\t" << BO.what();
+      if (Poll)
+        Poll->schedule(
+          ControlSocket.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+      return;
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Reading CONTROL: " << Err.what();
+    }
+    if (!Data)
+      break;
+
+    handleControlMessage(*Data);
+    if (Exit != None)
+      // One of the handlers made the client exit.
+      return;
   }
 
-  if (ControlSocket.failed())
+  if (ControlSocket.failed() || ControlFrames.corrupt())
   {
+    failPendingRequests();
     exit(Failed, -1, "");
     return;
   }
 
-  if (ControlSocket.hasBufferedRead())
+  if (ControlSocket.hasBufferedRead() && Poll)
     Poll->schedule(
       ControlSocket.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+}
 
-  if (Data.empty())
-    return;
-
+void Client::handleControlMessage(std::string_view Data)
+{
+  using namespace monomux::message;
   Message MB = Message::unpack(Data);
-  auto Action =
-    Dispatch.find(static_cast<decltype(Dispatch)::key_type>(MB.Kind));
-  if (Action == Dispatch.end())
-  {
-    MONOMUX_TRACE_LOG(LOG(trace) << "Unknown message type "
-                                 << static_cast<int>(MB.Kind) << " received");
-    return;
-  }
-
   MONOMUX_TRACE_LOG(LOG(data) << MB.RawData);
   try
   {
-    Action->second(*this, MB.RawData);
+    if (completeResponse(MB.Kind, MB.RawData))
+      return;
+    if (!dispatch(static_cast<std::uint16_t>(MB.Kind), MB.RawData))
+      MONOMUX_TRACE_LOG(LOG(trace) << "Unknown message type "
+                                   << static_cast<int>(MB.Kind) << " received");
   }
   catch (const buffer_overflow& BO)
   {
     LOG(error) << "Error when handling message"
                << "\n\t" << BO.what();
-    Poll->schedule(BO.fd(), BO.readOverflow(), BO.writeOverflow());
+    if (Poll)
+      Poll->schedule(BO.fd(), BO.readOverflow(), BO.writeOverflow());
   }
   catch (const std::system_error& Err)
   {
     LOG(error) << "Error when handling message";
     if (getControlSocket().failed())
+    {
+      failPendingRequests();
       exit(Failed, -1, "");
+    }
   }
 }
 
+Client::RequestID
+Client::expectResponse(message::MessageKind Kind,
+                       std::function<CompletionFunction> Complete)
+{
+  RequestID ID = NextRequestID++;
+  PendingRequests.push_back(PendingRequest{ID, Kind, std::move(Complete)});
+  return ID;
+}
+
+void Client::forgetResponse(RequestID ID) noexcept
+{
+  auto It = std::find_if(
+    PendingRequests.begin(),
+    PendingRequests.end(),
+    [ID](const PendingRequest& Req) { return Req.ID == ID; });
+  if (It != PendingRequests.end())
+    PendingRequests.erase(It);
+}
+
+bool Client::isPending(RequestID ID) const noexcept
+{
+  return std::any_of(
+    PendingRequests.begin(),
+    PendingRequests.end(),
+    [ID](const PendingRequest& Req) { return Req.ID == ID; });
+}
+
+bool Client::completeResponse(message::MessageKind Kind,
+                              std::string_view Message)
+{
+  // The responses arrive in the order of the requests, but requests that the
+  // server did not respond to (e.g. because it does not understand them) must
+  // not hold up the ones sent later.
+  auto It = std::find_if(
+    PendingRequests.begin(),
+    PendingRequests.end(),
+    [Kind](const PendingRequest& Req) { return Req.ResponseKind == Kind; });
+  if (It == PendingRequests.end())
+    return false;
+
+  std::function<CompletionFunction> Complete = std::move(It->Complete);
+  const RequestID ID = It->ID;
+  PendingRequests.erase(It);
+  if (Complete && Complete(Message))
+    // The rest of a streamed response arrives before any later response of
+    // the same kind.
+    PendingRequests.push_front(PendingRequest{ID, Kind, std::move(Complete)});
+  return true;
+}
+
+void Client::failPendingRequests()
+{
+  std::deque<PendingRequest> Failed;
+  std::swap(Failed, PendingRequests);
+  for (PendingRequest& Req : Failed)
+    if (Req.Complete)
+      Req.Complete(std::nullopt);
+}
+
+/// Blocks until there is data to read on \p FD.
+static void waitReadable(raw_fd FD)
+{
+  POD<struct ::pollfd> P;
+  P->fd = FD;
+  P->events = POLLIN;
+  (void)CheckedPOSIX([&P] { return ::poll(&P, 1, -1); }, -1);
+}
+
+void Client::waitForResponse(RequestID ID)
+{
+  auto X = inhibitControlResponse();
+  while (isPending(ID))
+  {
+    std::optional<std::string> Data;
+    try
+    {
+      Data = ControlFrames.next(ControlSocket);
+    }
+    catch (const buffer_overflow&)
+    {}
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Reading CONTROL: " << Err.what();
+    }
+
+    if (ControlSocket.failed() || ControlFrames.corrupt())
+    {
+      failPendingRequests();
+      return;
+    }
+    if (!Data)
+    {
+      waitReadable(ControlSocket.raw());
+      continue;
+    }
+
+    handleControlMessage(*Data);
+  }
+}
+
+void Client::waitForAllResponses()
+{
+  while (!PendingRequests.empty())
+    waitForResponse(PendingRequests.back().ID);
+}
+
 void Client::setDataCallback(std::function<RawCallbackFn> Callback)
 {
   DataHandler = std::move(Callback);
 }
 
+void Client::setOutputCallback(std::function<RawCallbackFn> Callback)
+{
+  OutputHandler = std::move(Callback);
+}
+
 void Client::setInputCallback(std::function<RawCallbackFn> Callback)
 {
   InputHandler = std::move(Callback);
@@ -395,6 +761,7 @@ void Client::exit(ExitReason E, int ECode, std::string Message)
   Exit = E;
   ExitCode = ECode;
   ExitMessage = std::move(Message);
+  releasePty();
   Poll.reset();
   TerminateLoop.get().store(true);
 }
@@ -407,21 +774,13 @@ std::size_t Client::consumeNonce() noexcept
   return R;
 }
 
-std::optional<std::vector<SessionData>> Client::requestSessionList()
+/// Converts the \p Sessions received from the server to the client's view.
+static std::vector<SessionData>
+toSessions(std::vector<monomux::message::SessionData> Sessions)
 {
-  using namespace monomux::message;
-  auto X = inhibitControlResponse();
-
-  sendMessage(ControlSocket, request::SessionList{});
-
-  std::optional<response::SessionList> Resp =
-    receiveMessage<response::SessionList>(ControlSocket);
-  if (!Resp)
-    return std::nullopt;
-
   std::vector<SessionData> R;
-
-  for (monomux::message::SessionData& TransmitData : Resp->Sessions)
+  R.reserve(Sessions.size());
+  for (monomux::message::SessionData& TransmitData : Sessions)
   {
     SessionData SD;
     SD.Name = std::move(TransmitData.Name);
@@ -429,15 +788,111 @@ std::optional<std::vector<SessionData>> Client::requestSessionList()
 
     R.emplace_back(std::move(SD));
   }
+  return R;
+}
 
+std::optional<std::vector<SessionData>> Client::requestSessionList()
+{
+  std::optional<std::vector<SessionData>> R;
+  waitForResponse(requestSessionListAsync(
+    [&R](std::optional<std::vector<SessionData>> Sessions) {
+      R = std::move(Sessions);
+    }));
   return R;
 }
 
+Client::RequestID Client::requestSessionListAsync(
+  std::function<void(std::optional<std::vector<SessionData>>)> Callback)
+{
+  using namespace monomux::message;
+  return sendRequest<response::SessionList>(
+    request::SessionList{},
+    [Callback = std::move(Callback)](
+      std::optional<response::SessionList> Resp) {
+      if (!Callback)
+        return;
+      if (!Resp)
+      {
+        Callback(std::nullopt);
+        return;
+      }
+      Callback(toSessions(std::move(Resp->Sessions)));
+    });
+}
+
+std::optional<SessionPage> Client::requestSessionPage(std::string Prefix,
+                                                      std::size_t Offset,
+                                                      std::size_t Limit)
+{
+  std::optional<SessionPage> R;
+  waitForResponse(requestSessionPageAsync(
+    std::move(Prefix), Offset, Limit, [&R](std::optional<SessionPage> Page) {
+      R = std::move(Page);
+    }));
+  return R;
+}
+
+Client::RequestID Client::requestSessionPageAsync(
+  std::string Prefix,
+  std::size_t Offset,
+  std::size_t Limit,
+  std::function<void(std::optional<SessionPage>)> Callback)
+{
+  using namespace monomux::message;
+  request::SessionList Req;
+  Req.Prefix = std::move(Prefix);
+  Req.Offset = Offset;
+  Req.Limit = Limit;
+  return sendRequest<response::SessionList>(
+    std::move(Req),
+    [Callback = std::move(Callback)](
+      std::optional<response::SessionList> Resp) {
+      if (!Callback)
+        return;
+      if (!Resp || !Resp->Total)
+      {
+        Callback(std::nullopt);
+        return;
+      }
+
+      SessionPage Page;
+      Page.Sessions = toSessions(std::move(Resp->Sessions));
+      Page.Total = *Resp->Total;
+      Page.More = Resp->More;
+      Callback(std::move(Page));
+    });
+}
+
 std::optional<std::string>
-Client::requestMakeSession(std::string Name, Process::SpawnOptions Opts)
+Client::requestMakeSession(std::string Name,
+                           Process::SpawnOptions Opts,
+                           std::optional<std::size_t> ScrollbackSize,
+                           std::optional<std::chrono::microseconds>
+                             CoalesceWindow,
+                           std::optional<std::size_t> RateLimit)
+{
+  std::optional<std::string> R;
+  waitForResponse(requestMakeSessionAsync(
+    std::move(Name),
+    std::move(Opts),
+    [&R](std::optional<std::string> SessionName) {
+      R = std::move(SessionName);
+    },
+    ScrollbackSize,
+    CoalesceWindow,
+    RateLimit));
+  return R;
+}
+
+Client::RequestID Client::requestMakeSessionAsync(
+  std::string Name,
+  Process::SpawnOptions Opts,
+  std::function<void(std::optional<std::string>)> Callback,
+  std::optional<std::size_t> ScrollbackSize,
+  std::optional<std::chrono::microseconds> CoalesceWindow,
+  std::optional<std::size_t> RateLimit)
 {
   using namespace monomux::message;
-  auto X = inhibitControlResponse();
 
   request::MakeSession Msg;
   Msg.Name = std::move(Name);
@@ -451,47 +906,297 @@ Client::requestMakeSession(std::string Name, Process::SpawnOptions Opts)
     else
       Msg.SpawnOpts.SetEnvironment.emplace_back(E.first, std::move(*E.second));
   }
-  sendMessage(ControlSocket, Msg);
-
-  std::optional<response::MakeSession> Resp =
-    receiveMessage<response::MakeSession>(ControlSocket);
-  if (!Resp || !Resp->Success)
-    return std::nullopt;
+  Msg.ScrollbackSize = ScrollbackSize;
+  if (CoalesceWindow)
+    Msg.CoalesceWindow = CoalesceWindow->count();
+  Msg.RateLimit = RateLimit;
+
+  return sendRequest<response::MakeSession>(
+    Msg,
+    [Callback = std::move(Callback)](
+      std::optional<response::MakeSession> Resp) {
+      if (!Callback)
+        return;
+      if (!Resp || !Resp->Success)
+        Callback(std::nullopt);
+      else
+        Callback(std::move(Resp->Name));
+    });
+}
 
-  return std::move(Resp->Name);
+bool Client::requestAttach(std::string SessionName,
+                           bool Observer,
+                           std::optional<ResumePoint> Resume)
+{
+  waitForResponse(requestAttachAsync(
+    std::move(SessionName), nullptr, Observer, std::move(Resume)));
+  return Attached;
 }
 
-bool Client::requestAttach(std::string SessionName)
+Client::RequestID
+Client::requestAttachAsync(std::string SessionName,
+                           std::function<void(bool)> Callback,
+                           bool Observer,
+                           std::optional<ResumePoint> Resume)
 {
   using namespace monomux::message;
-  auto X = inhibitControlResponse();
 
   request::Attach Msg;
   Msg.Name = std::move(SessionName);
-  sendMessage(ControlSocket, Msg);
+  Msg.Observer = Observer;
+  Msg.Resumable = true;
+  Msg.CatchUp = CatchUp;
+  if (Resume)
+  {
+    Msg.ResumeFrom = Resume->Offset;
+    Msg.ResumeCreated = std::chrono::system_clock::to_time_t(Resume->Created);
+  }
+  return sendRequest<response::Attach>(
+    Msg,
+    [this, Callback = std::move(Callback), Observer](
+      std::optional<response::Attach> Resp) {
+      if (!Resp)
+        Attached = false;
+      else
+        Attached = Resp->Success;
+      this->Observer = Attached && Observer;
+
+      if (Attached)
+      {
+        if (!AttachedSession)
+          AttachedSession.emplace();
+
+        AttachedSession->Name = std::move(Resp->Session.Name);
+        AttachedSession->Created = std::chrono::system_clock::from_time_t(
+          std::move(Resp->Session.Created));
+        OutputOffset = Resp->Offset;
+      }
 
-  std::optional<response::Attach> Resp =
-    receiveMessage<response::Attach>(ControlSocket);
-  if (!Resp)
-    Attached = false;
-  else
-    Attached = Resp->Success;
+      if (Callback)
+        Callback(Attached);
+    });
+}
 
-  if (Attached)
+std::optional<std::vector<SessionData>>
+Client::requestSubscribe(std::function<SessionEventFunction> Callback)
+{
+  using namespace monomux::message;
+  SessionEventHandler = std::move(Callback);
+
+  std::optional<std::vector<SessionData>> R;
+  waitForResponse(sendRequest<response::Subscribe>(
+    request::Subscribe{}, [&R](std::optional<response::Subscribe> Resp) {
+      if (Resp)
+        R = toSessions(std::move(Resp->Sessions));
+    }));
+  return R;
+}
+
+bool Client::requestPtyHandOff()
+{
+  using namespace monomux::message;
+  if (!Attached || !DataSocket || PtyReader)
+    return false;
+
+  bool Success = false;
+  ControlSocket.setAcceptFDs(true);
+  waitForResponse(sendRequest<response::PtyHandOff>(
+    request::PtyHandOff{},
+    [&Success](std::optional<response::PtyHandOff> Resp) {
+      Success = Resp && Resp->Success;
+    }));
+  ControlSocket.setAcceptFDs(false);
+  std::vector<fd> FDs = ControlSocket.takeReceivedFDs();
+  if (!Success)
+    return false;
+  if (FDs.size() != 1)
   {
-    if (!AttachedSession)
-      AttachedSession.emplace();
+    LOG(error) << "Server sent " << FDs.size()
+               << " handles for the PTY instead of 1";
+    return false;
+  }
 
-    AttachedSession->Name = std::move(Resp->Session.Name);
-    AttachedSession->Created =
-      std::chrono::system_clock::from_time_t(std::move(Resp->Session.Created));
+  // The server relayed nothing after it stopped reading the PTY, so whatever
+  // it had sent before is already on the data connection.
+  fd::addStatusFlag(DataSocket->raw(), O_NONBLOCK);
+  try
+  {
+    while (DataSocket->load(DataSocket->readSize()))
+      ;
   }
+  catch (const buffer_overflow&)
+  {}
+  catch (const std::system_error&)
+  {}
 
-  return Attached;
+  const bool PreviousDataSocketWasEnabled = DataSocketEnabled;
+  if (PreviousDataSocketWasEnabled)
+    disableDataSocket();
+  Pty = std::move(FDs.front());
+  // The output read from the PTY directly is not part of the stream of the
+  // server, so the position is not known any more.
+  OutputOffset.reset();
+  // (The handle shares the non-blocking status with the server's.)
+  PtyReader = std::make_unique<Pipe>(Pipe::weakWrap(Pty.get(), Pipe::Read));
+  PtyWriter = std::make_unique<Pipe>(Pipe::weakWrap(Pty.get(), Pipe::Write));
+  if (PreviousDataSocketWasEnabled)
+    enableDataSocket();
+  return true;
+}
+
+std::optional<message::ChannelID>
+Client::requestOpenChannel(std::string SessionName, bool Observer)
+{
+  using namespace monomux::message;
+
+  request::OpenChannel Msg;
+  Msg.Name = std::move(SessionName);
+  Msg.Observer = Observer;
+  std::optional<ChannelID> Channel;
+  waitForResponse(sendRequest<response::OpenChannel>(
+    Msg, [&Channel](std::optional<response::OpenChannel> Resp) {
+      if (Resp && Resp->Success)
+        Channel = Resp->Channel;
+    }));
+  return Channel;
+}
+
+void Client::closeChannel(message::ChannelID Channel)
+{
+  using namespace monomux::message;
+  auto X = inhibitControlResponse();
+  notification::CloseChannel M;
+  M.Channel = Channel;
+  sendMessage(ControlSocket, M, ControlEncoding);
+}
+
+void Client::sendChannelData(message::ChannelID Channel, std::string_view Data)
+{
+  if (!DataSocket)
+  {
+    LOG(error) << "Trying to sendChannelData() but the connection was not "
+                  "established";
+    return;
+  }
+  std::string Frames;
+  message::appendChannelFrames(Frames, Channel, Data);
+  try
+  {
+    DataSocket->write(Frames);
+  }
+  catch (const buffer_overflow& BO)
+  {
+    // Allow reschedule later.
+  }
+
+  if (DataSocket->hasBufferedWrite() && Poll)
+    Poll->schedule(
+      DataSocket->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+void Client::notifyChannelWindowSize(message::ChannelID Channel,
+                                     unsigned short Rows,
+                                     unsigned short Columns)
+{
+  using namespace monomux::message;
+  auto X = inhibitControlResponse();
+  notification::ChannelRedraw M;
+  M.Channel = Channel;
+  M.Rows = Rows;
+  M.Columns = Columns;
+  sendMessage(ControlSocket, M, ControlEncoding);
+}
+
+void Client::setChannelOutputCallback(
+  std::function<ChannelOutputFunction> Callback)
+{
+  ChannelOutputHandler = std::move(Callback);
+}
+
+void Client::setChannelClosedCallback(
+  std::function<ChannelClosedFunction> Callback)
+{
+  ChannelClosedHandler = std::move(Callback);
+}
+
+std::size_t Client::receiveChannelOutput()
+{
+  if (!DataSocket)
+    return 0;
+  std::size_t Size = 0;
+  while (std::optional<std::string> Frame = DataFrames.next(*DataSocket))
+  {
+    auto ChannelAndData = message::decodeChannelFrame(*Frame);
+    if (!ChannelAndData)
+      continue;
+    Size += ChannelAndData->second.size();
+    if (ChannelOutputHandler)
+      ChannelOutputHandler(
+        *this, ChannelAndData->first, ChannelAndData->second);
+  }
+  return Size;
+}
+
+std::size_t Client::receiveCompressedOutput(BufferedChannel& Output)
+{
+  if (!DataSocket)
+    return 0;
+  std::size_t Size = 0;
+  while (Output.writeInBuffer() <= OutputBacklogHighWatermark)
+  {
+    std::optional<std::string> Frame = DataFrames.next(*DataSocket);
+    if (!Frame)
+      break;
+    std::optional<std::string> Data = message::decodeCompressedFrame(*Frame);
+    if (!Data)
+    {
+      LOG(error) << "Invalid compressed output frame of " << Frame->size()
+                 << " bytes";
+      continue;
+    }
+    Output.write(*Data);
+    Size += Data->size();
+  }
+  return Size;
+}
+
+void Client::releasePty()
+{
+  if (!PtyReader)
+    return;
+  MONOMUX_TRACE_LOG(LOG(trace) << "Releasing the PTY of the session");
+
+  const bool PreviousDataSocketWasEnabled = DataSocketEnabled;
+  if (PreviousDataSocketWasEnabled)
+    disableDataSocket();
+  PtyReader.reset();
+  PtyWriter.reset();
+  fd::close(Pty.release());
+  if (PreviousDataSocketWasEnabled)
+    enableDataSocket();
 }
 
 void Client::sendData(std::string_view Data)
 {
+  if (Observer)
+    // The server would drop the input of a read-only client.
+    return;
+  if (PtyWriter)
+  {
+    try
+    {
+      PtyWriter->write(Data);
+    }
+    catch (const buffer_overflow& BO)
+    {
+      // Allow reschedule later.
+    }
+
+    if (PtyWriter->hasBufferedWrite() && Poll)
+      Poll->schedule(Pty.get(), /* Incoming =*/false, /* Outgoing =*/true);
+    return;
+  }
   if (!DataSocket)
   {
     LOG(error) << "Trying to sendData() but the connection was not established";
@@ -506,7 +1211,7 @@ void Client::sendData(std::string_view Data)
     // Allow reschedule later.
   }
 
-  if (DataSocket->hasBufferedWrite())
+  if (DataSocket->hasBufferedWrite() && Poll)
     Poll->schedule(
       DataSocket->raw(), /* Incoming =*/false, /* Outgoing =*/true);
 }
@@ -514,21 +1219,25 @@ void Client::sendData(std::string_view Data)
 void Client::sendSignal(int Signal)
 {
   using namespace monomux::message;
+  if (Observer)
+    return;
   auto X = inhibitControlResponse();
   request::Signal M;
   M.SigNum = Signal;
-  sendMessage(ControlSocket, M);
+  sendMessage(ControlSocket, M, ControlEncoding);
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 void Client::notifyWindowSize(unsigned short Rows, unsigned short Columns)
 {
   using namespace monomux::message;
+  if (Observer)
+    return;
   auto X = inhibitControlResponse();
   notification::Redraw M;
   M.Rows = Rows;
   M.Columns = Columns;
-  sendMessage(ControlSocket, M);
+  sendMessage(ControlSocket, M, ControlEncoding);
 }
 
 void Client::enableControlResponse()
@@ -545,11 +1254,27 @@ void Client::disableControlResponse()
   Poll->stop(ControlSocket.raw());
 }
 
+raw_fd Client::outputFD() const noexcept
+{
+  if (PtyReader)
+    return Pty.get();
+  if (OutputRing)
+    return OutputRing->dataBell();
+  return DataSocket->raw();
+}
+
 void Client::enableDataSocket()
 {
   if (!Poll || !DataSocket)
     return;
-  Poll->listen(DataSocket->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  if (OutputBacklogged)
+  {
+    // Resumed once the backlog is written, see notifyOutputBacklog().
+    DataSocketEnabled = true;
+    return;
+  }
+  // Nothing but the output of the session would arrive on the data socket.
+  Poll->listen(outputFD(), /* Incoming =*/true, /* Outgoing =*/false);
   DataSocketEnabled = true;
 }
 
@@ -557,7 +1282,7 @@ void Client::disableDataSocket()
 {
   if (!Poll || !DataSocket)
     return;
-  Poll->stop(DataSocket->raw());
+  Poll->stop(outputFD());
   DataSocketEnabled = false;
 }
 
@@ -16,8 +16,13 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <csignal>
+#include <stdexcept>
+
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
+#include "monomux/system/Environment.hpp"
+#include "monomux/unreachable.hpp"
 
 #include "monomux/client/ControlClient.hpp"
 
@@ -38,10 +43,8 @@ void ControlClient::requestDetachLatestClient()
   if (!BackingClient.attached())
     return;
 
-  auto X = BackingClient.inhibitControlResponse();
-  sendMessage(BackingClient.getControlSocket(),
-              request::Detach{request::Detach::Latest});
-  receiveMessage<response::Detach>(BackingClient.getControlSocket());
+  BackingClient.waitForResponse(BackingClient.sendRequest<response::Detach>(
+    request::Detach{request::Detach::Latest}, nullptr));
 }
 
 void ControlClient::requestDetachAllClients()
@@ -50,24 +53,380 @@ void ControlClient::requestDetachAllClients()
   if (!BackingClient.attached())
     return;
 
-  auto X = BackingClient.inhibitControlResponse();
-  sendMessage(BackingClient.getControlSocket(),
-              request::Detach{request::Detach::All});
-  receiveMessage<response::Detach>(BackingClient.getControlSocket());
+  BackingClient.waitForResponse(BackingClient.sendRequest<response::Detach>(
+    request::Detach{request::Detach::All}, nullptr));
+}
+
+bool ControlClient::requestRateLimit(std::size_t BytesPerSecond)
+{
+  using namespace monomux::message;
+  if (!BackingClient.attached())
+    return false;
+
+  std::optional<response::RateLimit> Response;
+  BackingClient.waitForResponse(BackingClient.sendRequest<response::RateLimit>(
+    request::RateLimit{BytesPerSecond},
+    [&Response](std::optional<response::RateLimit> Resp) {
+      Response = std::move(Resp);
+    }));
+  return Response && Response->Success;
+}
+
+void ControlClient::requestStatistics(
+  const std::function<void(std::string_view)>& Callback)
+{
+  using namespace monomux::message;
+
+  bool Failed = false;
+  BackingClient.waitForResponse(
+    BackingClient.sendStreamedRequest<response::Statistics>(
+      request::Statistics{/* Streamed =*/true},
+      [&Callback, &Failed](std::optional<response::Statistics> Part) {
+        if (!Part)
+          Failed = true;
+        else
+          Callback(Part->Contents);
+      }));
+
+  if (Failed)
+    throw std::runtime_error{"Failed to receive a valid response!"};
+}
+
+void ControlClient::requestMetrics(
+  const std::function<void(const std::vector<message::Metric>&)>& Callback)
+{
+  using namespace monomux::message;
+
+  bool Failed = false;
+  BackingClient.waitForResponse(
+    BackingClient.sendStreamedRequest<response::Metrics>(
+      request::Metrics{/* Streamed =*/true},
+      [&Callback, &Failed](std::optional<response::Metrics> Part) {
+        if (!Part)
+          Failed = true;
+        else
+          Callback(Part->Samples);
+      }));
+
+  if (Failed)
+    throw std::runtime_error{"Failed to receive a valid response!"};
 }
 
-std::string ControlClient::requestStatistics()
+void ControlClient::requestTrace(
+  const std::function<void(const std::vector<trace::Record>&)>& Callback)
 {
   using namespace monomux::message;
 
-  auto X = BackingClient.inhibitControlResponse();
-  sendMessage(BackingClient.getControlSocket(), request::Statistics{});
-  auto Response =
-    receiveMessage<response::Statistics>(BackingClient.getControlSocket());
+  bool Failed = false;
+  BackingClient.waitForResponse(
+    BackingClient.sendStreamedRequest<response::Trace>(
+      request::Trace{/* Streamed =*/true},
+      [&Callback, &Failed](std::optional<response::Trace> Part) {
+        if (!Part)
+          Failed = true;
+        else
+          Callback(Part->Records);
+      }));
+
+  if (Failed)
+    throw std::runtime_error{"Failed to receive a valid response!"};
+}
+
+message::response::Search ControlClient::requestSearch(std::string Pattern,
+                                                       std::string Session)
+{
+  using namespace monomux::message;
+
+  std::optional<response::Search> Response;
+  BackingClient.waitForResponse(BackingClient.sendRequest<response::Search>(
+    request::Search{std::move(Pattern), std::move(Session), 0},
+    [&Response](std::optional<response::Search> Resp) {
+      Response = std::move(Resp);
+    }));
 
   if (!Response)
     throw std::runtime_error{"Failed to receive a valid response!"};
-  return std::move(Response)->Contents;
+  return *std::move(Response);
+}
+
+const char* ControlClient::BatchCommand::name() const noexcept
+{
+  switch (Kind)
+  {
+    case Create:
+      return "create";
+    case Signal:
+      return "signal";
+    case Detach:
+      return "detach";
+    case DetachAll:
+      return "detach-all";
+    case RateLimit:
+      return "rate-limit";
+    case List:
+      return "list";
+    case Statistics:
+      return "statistics";
+  }
+  unreachable("Unknown kind of batch command!");
+}
+
+/// \returns the number of the signal named \p Name, with or without the
+/// \p "SIG" prefix, or given as a number.
+static int parseSignal(std::string_view Name)
+{
+  static constexpr std::pair<std::string_view, int> Names[] = {
+    {"HUP", SIGHUP},
+    {"INT", SIGINT},
+    {"QUIT", SIGQUIT},
+    {"KILL", SIGKILL},
+    {"USR1", SIGUSR1},
+    {"USR2", SIGUSR2},
+    {"TERM", SIGTERM},
+    {"CONT", SIGCONT},
+    {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP},
+    {"WINCH", SIGWINCH},
+  };
+
+  if (Name.substr(0, 3) == "SIG")
+    Name.remove_prefix(3);
+  for (const auto& [SigName, SigNum] : Names)
+    if (Name == SigName)
+      return SigNum;
+
+  std::size_t End = 0;
+  int SigNum = 0;
+  try
+  {
+    SigNum = std::stoi(std::string{Name}, &End);
+  }
+  catch (const std::logic_error&)
+  {}
+  if (End != Name.size() || SigNum <= 0 || SigNum >= NSIG)
+    throw std::invalid_argument{"Unknown signal '" + std::string{Name} + '\''};
+  return SigNum;
+}
+
+std::optional<ControlClient::BatchCommand>
+ControlClient::BatchCommand::parse(std::string_view Text, std::size_t Line)
+{
+  static constexpr std::string_view Whitespace = " \t\r\n";
+  std::vector<std::string> Words;
+  while (true)
+  {
+    std::string_view::size_type Begin = Text.find_first_not_of(Whitespace);
+    if (Begin == std::string_view::npos)
+      break;
+    Text.remove_prefix(Begin);
+    std::string_view::size_type End = Text.find_first_of(Whitespace);
+    Words.emplace_back(Text.substr(0, End));
+    Text.remove_prefix(End == std::string_view::npos ? Text.size() : End);
+  }
+  if (Words.empty() || Words.front().front() == '#')
+    return std::nullopt;
+
+  static constexpr std::pair<std::string_view, CommandKind> Commands[] = {
+    {"create", Create},
+    {"signal", Signal},
+    {"detach", Detach},
+    {"detach-all", DetachAll},
+    {"rate-limit", RateLimit},
+    {"list", List},
+    {"statistics", Statistics},
+  };
+
+  BatchCommand Cmd;
+  Cmd.Line = Line;
+  bool Known = false;
+  for (const auto& [Name, Kind] : Commands)
+    if (Words.front() == Name)
+    {
+      Cmd.Kind = Kind;
+      Known = true;
+    }
+  if (!Known)
+    throw std::invalid_argument{"Unknown command '" + Words.front() + '\''};
+
+  auto ExpectWords = [&Words, &Cmd](std::size_t Count) {
+    if (Words.size() != Count + 1)
+      throw std::invalid_argument{std::string{"Command '"} + Cmd.name() +
+                                  "' takes " + std::to_string(Count) +
+                                  " argument(s)"};
+  };
+  switch (Cmd.Kind)
+  {
+    case Create:
+      if (Words.size() < 2)
+        throw std::invalid_argument{"Command 'create' takes a session name"};
+      Cmd.Session = std::move(Words.at(1));
+      Cmd.Program.assign(std::make_move_iterator(Words.begin() + 2),
+                         std::make_move_iterator(Words.end()));
+      break;
+    case Signal:
+      ExpectWords(2);
+      Cmd.Session = std::move(Words.at(1));
+      Cmd.Number = static_cast<std::size_t>(parseSignal(Words.at(2)));
+      break;
+    case Detach:
+    case DetachAll:
+      ExpectWords(1);
+      Cmd.Session = std::move(Words.at(1));
+      break;
+    case RateLimit:
+    {
+      ExpectWords(2);
+      Cmd.Session = std::move(Words.at(1));
+      std::size_t End = 0;
+      try
+      {
+        Cmd.Number = std::stoull(Words.at(2), &End);
+      }
+      catch (const std::logic_error&)
+      {}
+      if (End == 0 || End != Words.at(2).size())
+        throw std::invalid_argument{"Invalid rate '" + Words.at(2) + '\''};
+      break;
+    }
+    case List:
+    case Statistics:
+      ExpectWords(0);
+      break;
+  }
+  return Cmd;
+}
+
+bool ControlClient::attachForBatch(const std::string& Session)
+{
+  if (BatchSession == Session)
+    return true;
+
+  // Requests of the command are sent only after the client is known to be
+  // attached to the session, as on failure, the server would execute them
+  // on the previous session.
+  BatchSession.reset();
+  if (BackingClient.requestAttach(Session))
+    BatchSession = Session;
+  return BatchSession.has_value();
+}
+
+void ControlClient::trackBatchRequest(Client::RequestID ID)
+{
+  BatchInFlight.emplace_back(ID);
+  while (!BatchInFlight.empty() &&
+         (BatchInFlight.size() > BatchWindow ||
+          !BackingClient.isPending(BatchInFlight.front())))
+  {
+    BackingClient.waitForResponse(BatchInFlight.front());
+    BatchInFlight.pop_front();
+  }
+}
+
+void ControlClient::runBatchCommand(
+  const BatchCommand& Command,
+  const std::function<BatchFunction>& Callback)
+{
+  using namespace monomux::message;
+
+  if (!Command.Session.empty() && Command.Kind != BatchCommand::Create &&
+      !attachForBatch(Command.Session))
+  {
+    Callback(Command, BatchStatus::Failure, "Failed to attach to session");
+    return;
+  }
+
+  switch (Command.Kind)
+  {
+    case BatchCommand::Create:
+    {
+      Process::SpawnOptions Spawn;
+      if (Command.Program.empty())
+        Spawn.Program = defaultShell();
+      else
+      {
+        Spawn.Program = Command.Program.front();
+        Spawn.Arguments.assign(Command.Program.begin() + 1,
+                               Command.Program.end());
+      }
+      trackBatchRequest(BackingClient.requestMakeSessionAsync(
+        Command.Session,
+        std::move(Spawn),
+        [Command, Callback](std::optional<std::string> Name) {
+          if (Name)
+            Callback(Command, BatchStatus::Success, *Name);
+          else
+            Callback(Command, BatchStatus::Failure, "Failed to create");
+        }));
+      return;
+    }
+    case BatchCommand::Signal:
+      // The signal has no response, so the result is reported once the
+      // results of the earlier commands are.
+      BackingClient.sendSignal(static_cast<int>(Command.Number));
+      finishBatch();
+      Callback(Command, BatchStatus::Success, "");
+      return;
+    case BatchCommand::Detach:
+    case BatchCommand::DetachAll:
+      if (Command.Kind == BatchCommand::DetachAll)
+        // The client detaches itself as well.
+        BatchSession.reset();
+      trackBatchRequest(BackingClient.sendRequest<response::Detach>(
+        request::Detach{Command.Kind == BatchCommand::Detach
+                          ? request::Detach::Latest
+                          : request::Detach::All},
+        [Command, Callback](std::optional<response::Detach> Resp) {
+          if (Resp)
+            Callback(Command, BatchStatus::Success, "");
+          else
+            Callback(Command, BatchStatus::Failure, "Failed to detach");
+        }));
+      return;
+    case BatchCommand::RateLimit:
+      trackBatchRequest(BackingClient.sendRequest<response::RateLimit>(
+        request::RateLimit{Command.Number},
+        [Command, Callback](std::optional<response::RateLimit> Resp) {
+          if (Resp && Resp->Success)
+            Callback(Command, BatchStatus::Success, "");
+          else
+            Callback(Command, BatchStatus::Failure, "Failed to set the limit");
+        }));
+      return;
+    case BatchCommand::List:
+      trackBatchRequest(BackingClient.requestSessionListAsync(
+        [Command, Callback](std::optional<std::vector<SessionData>> Sessions) {
+          if (!Sessions)
+          {
+            Callback(Command, BatchStatus::Failure, "Failed to list");
+            return;
+          }
+          for (const SessionData& S : *Sessions)
+            Callback(Command, BatchStatus::Data, S.Name);
+          Callback(Command, BatchStatus::Success, "");
+        }));
+      return;
+    case BatchCommand::Statistics:
+      trackBatchRequest(
+        BackingClient.sendStreamedRequest<response::Statistics>(
+          request::Statistics{/* Streamed =*/true},
+          [Command, Callback](std::optional<response::Statistics> Part) {
+            if (!Part)
+            {
+              Callback(Command, BatchStatus::Failure, "Failed to query");
+              return;
+            }
+            Callback(Command, BatchStatus::Data, Part->Contents);
+            if (!Part->More)
+              Callback(Command, BatchStatus::Success, "");
+          }));
+      return;
+  }
+}
+
+void ControlClient::finishBatch()
+{
+  BackingClient.waitForAllResponses();
+  BatchInFlight.clear();
 }
 
 } // namespace monomux::client
@@ -28,14 +28,30 @@ using namespace monomux::message;
 namespace monomux::client
 {
 
-void Client::setUpDispatch()
-{
-#define KIND(E) static_cast<std::uint16_t>(MessageKind::E)
+const Client::DispatchTable Client::BuiltinDispatch = [] {
+  DispatchTable Table{};
+#define KIND(E) static_cast<std::size_t>(MessageKind::E)
 #define MEMBER(NAME) &Client::NAME
-#define DISPATCH(K, FUNCTION) registerMessageHandler(KIND(K), MEMBER(FUNCTION));
+#define DISPATCH(K, FUNCTION) Table[KIND(K)] = MEMBER(FUNCTION);
 #include "monomux/client/Dispatch.ipp"
 #undef MEMBER
 #undef KIND
+  return Table;
+}();
+
+bool Client::dispatch(std::uint16_t Kind, std::string_view Message)
+{
+  if (Kind < Overrides.size() && Overrides[Kind])
+  {
+    Overrides[Kind](*this, Message);
+    return true;
+  }
+  if (Kind < BuiltinDispatch.size() && BuiltinDispatch[Kind])
+  {
+    BuiltinDispatch[Kind](*this, Message);
+    return true;
+  }
+  return false;
 }
 
 #define HANDLER(NAME)                                                          \
@@ -77,9 +93,39 @@ HANDLER(receivedDetachNotification)
     case Detached::Kicked:
       Client.exit(ServerKicked, 0, std::move(Msg->Reason));
       break;
+    case Detached::ServerUpgrade:
+      Client.exit(ServerUpgrade, 0, "");
+      break;
   }
 }
 
+HANDLER(responseProtocol)
+{
+  MSG(response::Protocol);
+
+  if (Msg->BinaryVersion == BinaryVersion)
+    Client.ControlEncoding = Encoding::Binary;
+  MONOMUX_TRACE_LOG(LOG(debug)
+                    << "Server uses "
+                    << (Client.ControlEncoding == Encoding::Binary ? "binary"
+                                                                   : "text")
+                    << " encoding");
+}
+
+HANDLER(receivedSessionEvent)
+{
+  MSG(notification::SessionEvent);
+  if (Client.SessionEventHandler)
+    Client.SessionEventHandler(Client, *Msg);
+}
+
+HANDLER(receivedChannelClosed)
+{
+  MSG(notification::ChannelClosed);
+  if (Client.ChannelClosedHandler)
+    Client.ChannelClosedHandler(Client, *Msg);
+}
+
 #undef HANDLER
 
 } // namespace monomux::client
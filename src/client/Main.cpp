@@ -16,17 +16,24 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <thread>
 
 #include "monomux/adt/Lazy.hpp"
 #include "monomux/adt/ScopeGuard.hpp"
 #include "monomux/client/Client.hpp"
 #include "monomux/client/ControlClient.hpp"
+#include "monomux/client/Recorder.hpp"
 #include "monomux/client/Terminal.hpp"
 #include "monomux/system/Environment.hpp"
 #include "monomux/system/Signal.hpp"
+#include "monomux/system/StatusPage.hpp"
 #include "monomux/system/Time.hpp"
 #include "monomux/unreachable.hpp"
 
@@ -44,7 +51,10 @@ namespace monomux::client
 Options::Options()
   : ClientMode(false), OnlyListSessions(false), InteractiveSessionMenu(false),
     DetachRequestLatest(false), DetachRequestAll(false),
-    StatisticsRequest(false)
+    StatisticsRequest(false), StatusPageRequest(false), MetricsRequest(false),
+    TraceDumpRequest(false),
+    Exclusive(false), ReadOnly(false), CatchUp(false), Compress(false),
+    RecordDirect(false)
 {}
 
 std::vector<std::string> Options::toArgv() const
@@ -73,6 +83,58 @@ std::vector<std::string> Options::toArgv() const
     Ret.emplace_back("--detach-all");
   if (StatisticsRequest)
     Ret.emplace_back("--statistics");
+  if (StatusPageRequest)
+    Ret.emplace_back("--status");
+  if (MetricsRequest)
+    Ret.emplace_back("--metrics");
+  if (TraceDumpRequest)
+    Ret.emplace_back("--dump-trace");
+  if (Exclusive)
+    Ret.emplace_back("--exclusive");
+  if (ReadOnly)
+    Ret.emplace_back("--read-only");
+  if (CatchUp)
+    Ret.emplace_back("--catch-up");
+  if (Compress)
+    Ret.emplace_back("--compress");
+  for (const auto& Recording : Recordings)
+  {
+    Ret.emplace_back("--record");
+    Ret.emplace_back(Recording.first).append("=").append(Recording.second);
+  }
+  if (RecordDirect)
+    Ret.emplace_back("--record-direct");
+
+  if (ScrollbackSize.has_value())
+  {
+    Ret.emplace_back("--scrollback");
+    Ret.emplace_back(std::to_string(*ScrollbackSize));
+  }
+  if (CoalesceWindow.has_value())
+  {
+    Ret.emplace_back("--coalesce");
+    Ret.emplace_back(std::to_string(CoalesceWindow->count()));
+  }
+  if (RateLimit.has_value())
+  {
+    Ret.emplace_back("--rate-limit");
+    Ret.emplace_back(std::to_string(*RateLimit));
+  }
+  if (RateLimitRequest.has_value())
+  {
+    Ret.emplace_back("--set-rate-limit");
+    Ret.emplace_back(std::to_string(*RateLimitRequest));
+  }
+  if (SearchRequest.has_value())
+  {
+    Ret.emplace_back("--search");
+    Ret.emplace_back(*SearchRequest);
+  }
+  if (BatchScript.has_value())
+  {
+    Ret.emplace_back("--batch");
+    Ret.emplace_back(*BatchScript);
+  }
 
   if (Program)
   {
@@ -102,7 +164,26 @@ std::vector<std::string> Options::toArgv() const
 
 bool Options::isControlMode() const noexcept
 {
-  return DetachRequestLatest || DetachRequestAll || StatisticsRequest;
+  return DetachRequestLatest || DetachRequestAll || StatisticsRequest ||
+         StatusPageRequest || MetricsRequest || TraceDumpRequest ||
+         RateLimitRequest.has_value() || SearchRequest.has_value() ||
+         BatchScript.has_value();
+}
+
+/// The number of attempts made to connect, or to perform the handshake, before
+/// giving up.
+static constexpr std::size_t MaxRetries = 24;
+/// The delay before the first retry, which is doubled for every further one.
+static constexpr std::chrono::milliseconds RetryDelayMin{1};
+/// The longest delay between two retries. With \p MaxRetries, the retries give
+/// up after about 8 seconds.
+static constexpr std::chrono::milliseconds RetryDelayMax{512};
+
+/// Waits \p Delay before the next retry, and doubles it for the one after.
+static void backOff(std::chrono::milliseconds& Delay)
+{
+  std::this_thread::sleep_for(Delay);
+  Delay = std::min(Delay * 2, RetryDelayMax);
 }
 
 std::optional<Client>
@@ -112,20 +193,20 @@ connect(Options& Opts, bool Block, std::string* FailureReason)
   if (!Block)
     return C;
 
-  static constexpr std::size_t MaxConnectTries = 16;
-  unsigned short ConnectCounter = 0;
+  std::chrono::milliseconds Delay = RetryDelayMin;
+  std::size_t ConnectCounter = 0;
   while (!C)
   {
     ++ConnectCounter;
-    if (ConnectCounter == MaxConnectTries)
+    if (ConnectCounter == MaxRetries)
     {
       if (FailureReason)
         *FailureReason = "Connection failed after enough retries.";
       return std::nullopt;
     }
 
+    backOff(Delay);
     C = Client::create(*Opts.SocketPath, FailureReason);
-    std::this_thread::sleep_for(std::chrono::seconds(1));
   }
 
   return C;
@@ -133,12 +214,12 @@ connect(Options& Opts, bool Block, std::string* FailureReason)
 
 bool makeWholeWithData(Client& Client, std::string* FailureReason)
 {
-  static constexpr std::size_t MaxHandshakeTries = 16;
-  unsigned short HandshakeCounter = 0;
+  std::chrono::milliseconds Delay = RetryDelayMin;
+  std::size_t HandshakeCounter = 0;
   while (!Client.handshake(FailureReason))
   {
     ++HandshakeCounter;
-    if (HandshakeCounter == MaxHandshakeTries)
+    if (HandshakeCounter == MaxRetries)
     {
       if (FailureReason)
         FailureReason->insert(
@@ -147,7 +228,7 @@ bool makeWholeWithData(Client& Client, std::string* FailureReason)
     }
 
     LOG(warn) << "Establishing full connection failed:\n\t" << FailureReason;
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    backOff(Delay);
   }
 
   return true;
@@ -172,17 +253,29 @@ struct SessionSelectionResult
   SessionMode Mode;
 };
 
+/// The number of sessions shown at once in the interactive session menu.
+constexpr std::size_t SessionMenuPageSize = 20;
+
 void emplaceDefaultProgram(Options& Opts);
-SessionSelectionResult selectSession(const std::vector<SessionData>& Sessions,
-                                     const std::string& ToCreateSessionName);
-SessionSelectionResult selectSession(const std::string& ClientID,
-                                     const std::string& DefaultProgram,
-                                     const std::vector<SessionData>& Sessions,
-                                     const std::string& ToCreateSessionName,
-                                     bool ListSessions,
-                                     bool Interactive);
+/// Decides the session to use without user interaction, from as few sessions
+/// fetched from the server as possible.
+///
+/// \returns \p nullopt if the communication with the server failed.
+std::optional<SessionSelectionResult>
+selectSession(Client& Client, const std::string& ToCreateSessionName);
+/// Decides the session to use, asking the user if needed.
+///
+/// \returns \p nullopt if the communication with the server failed.
+std::optional<SessionSelectionResult>
+selectSession(Client& Client,
+              const std::string& DefaultProgram,
+              const std::string& ToCreateSessionName,
+              bool ListSessions,
+              bool Interactive);
 ExitCode mainForControlClient(Options& Opts);
+ExitCode mainForRecorder(Options& Opts);
 ExitCode handleSessionCreateOrAttach(Options& Opts);
+bool reattach(Options& Opts);
 int handleClientExitStatus(const Client& Client);
 
 void windowSizeChange(SignalHandling::Signal SigNum,
@@ -191,15 +284,67 @@ void windowSizeChange(SignalHandling::Signal SigNum,
 void coreDumped(SignalHandling::Signal SigNum,
                 ::siginfo_t* Info,
                 const SignalHandling* Handling);
+void recorderTerminate(SignalHandling::Signal SigNum,
+                       ::siginfo_t* Info,
+                       const SignalHandling* Handling);
 
 // NOLINTNEXTLINE(cert-err58-cpp)
 auto OriginalLogLevel =
   makeLazy([]() -> log::Severity { return log::Logger::get().getLimit(); });
 
 constexpr char TerminalObjName[] = "Terminal";
+constexpr char RecorderObjName[] = "Recorder";
 
 } // namespace
 
+std::optional<int> listSessionsFromStatusPage(const Options& Opts)
+{
+  const std::string Path =
+    SocketPath::absolutise(*Opts.SocketPath).statusPagePath();
+  std::optional<std::string> Data;
+  try
+  {
+    Data = StatusPage::open(Path).read();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(debug) << "Reading the status page '" << Path
+               << "' failed: " << Err.what();
+  }
+  if (!Data)
+    return std::nullopt;
+
+  message::BinaryReader Reader{*Data};
+  const auto Count = Reader.integer<std::uint32_t>();
+  std::vector<message::SessionStatus> Sessions;
+  Sessions.reserve(std::min<std::size_t>(Count, Reader.remaining()));
+  for (std::size_t I = 0; I < Count && Reader.good(); ++I)
+    if (auto Status = message::SessionStatus::decodeBinary(Reader))
+      Sessions.emplace_back(*std::move(Status));
+  if (!Reader.done())
+  {
+    LOG(warn) << "The status page '" << Path << "' is malformed";
+    return std::nullopt;
+  }
+
+  std::cout << "\nMonomux sessions on '" << *Opts.SocketPath << "'...\n\n";
+  for (std::size_t I = 0; I < Sessions.size(); ++I)
+  {
+    const message::SessionStatus& S = Sessions[I];
+    std::cout << "    " << I + 1 << ". " << S.Session.Name << " (created "
+              << formatTime(
+                   std::chrono::system_clock::from_time_t(S.Session.Created))
+              << ", " << S.AttachedClients << " attached";
+    if (S.LastActive)
+      std::cout << ", last active "
+                << formatTime(
+                     std::chrono::system_clock::from_time_t(S.LastActive));
+    std::cout << ")\n";
+  }
+  std::cout << std::endl;
+  return EXIT_Success;
+}
+
 int main(Options& Opts)
 {
   // For the convenience of auto-starting a server if none exists, the creation
@@ -213,6 +358,8 @@ int main(Options& Opts)
 
   if (Opts.isControlMode())
     return mainForControlClient(Opts);
+  if (!Opts.Recordings.empty())
+    return mainForRecorder(Opts);
 
   if (ExitCode Err = handleSessionCreateOrAttach(Opts); Err != EXIT_Success)
     return Err;
@@ -224,68 +371,101 @@ int main(Options& Opts)
   // ----------------------------- Be a real client ----------------------------
   Terminal Term{fd::fileno(stdin), fd::fileno(stdout)};
 
+  while (true)
   {
-    // Ask the remote program to redraw by generating the "window size changed"
-    // signal explicitly.
-    Client.sendSignal(SIGWINCH);
-
-    // Send the initial window size to the server so the attached session prompt
-    // is appropriately (re)drawn to the right size, if the size is different.
-    Terminal::Size S = Term.getSize();
-    LOG(data) << "Terminal size: rows=" << S.Rows << ", columns=" << S.Columns;
-
-    // This is a little bit of a hack, but we observed that certain elaborate
-    // prompts, such as multiline ZSH Powerline do not really redraw when the
-    // size remains the same.
-    Client.notifyWindowSize(S.Rows - 1, S.Columns - 1);
-
-    Client.notifyWindowSize(S.Rows, S.Columns);
-  }
-
-  {
-    ScopeGuard TerminalSetup{[&Term, &Client] { Term.setupClient(Client); },
-                             [&Term] { Term.releaseClient(); }};
-    ScopeGuard Signal{[&Term] {
-                        SignalHandling& Sig = SignalHandling::get();
-                        Sig.registerObject(SignalHandling::ModuleObjName,
-                                           "Client");
-                        Sig.registerObject(TerminalObjName, &Term);
-                        Sig.registerCallback(SIGWINCH, &windowSizeChange);
-                        Sig.enable();
-
-                        // Override the SIGABRT handler with a custom one that
-                        // resets the terminal during a crash.
-                        Sig.registerCallback(SIGILL, &coreDumped);
-                        Sig.registerCallback(SIGABRT, &coreDumped);
-                        Sig.registerCallback(SIGSEGV, &coreDumped);
-                        Sig.registerCallback(SIGSYS, &coreDumped);
-                        Sig.registerCallback(SIGSTKFLT, &coreDumped);
-                      },
-                      [] {
-                        SignalHandling& Sig = SignalHandling::get();
-                        Sig.defaultCallback(SIGWINCH);
-                        Sig.deleteObject(TerminalObjName);
-
-                        Sig.clearOneCallback(SIGILL);
-                        Sig.clearOneCallback(SIGABRT);
-                        Sig.clearOneCallback(SIGSEGV);
-                        Sig.clearOneCallback(SIGSYS);
-                        Sig.clearOneCallback(SIGSTKFLT);
-                      }};
-
-    LOG(trace) << "Starting client...";
+    {
+      // Ask the remote program to redraw by generating the "window size
+      // changed" signal explicitly.
+      Client.sendSignal(SIGWINCH);
+
+      // Send the initial window size to the server so the attached session
+      // prompt is appropriately (re)drawn to the right size, if the size is
+      // different.
+      Terminal::Size S = Term.getSize();
+      LOG(data) << "Terminal size: rows=" << S.Rows
+                << ", columns=" << S.Columns;
+
+      // This is a little bit of a hack, but we observed that certain elaborate
+      // prompts, such as multiline ZSH Powerline do not really redraw when the
+      // size remains the same.
+      Client.notifyWindowSize(S.Rows - 1, S.Columns - 1);
+
+      Client.notifyWindowSize(S.Rows, S.Columns);
+    }
 
-    // Turn off all logging from this point now on, because the attached client
-    // randomly printing log to stdout would garble the terminal printouts.
-    OriginalLogLevel.get(); // Load it in.
-    ScopeGuard Loglevel{
-      [] { log::Logger::get().setLimit(log::None); },
-      [] { log::Logger::get().setLimit(OriginalLogLevel.get()); }};
+    if (Opts.Exclusive && !Client.requestPtyHandOff())
+      LOG(warn)
+        << "The server did not hand over the session, output is relayed";
 
-    ScopeGuard TermIO{[&Term] { Term.engage(); },
-                      [&Term] { Term.disengage(); }};
+    {
+      ScopeGuard TerminalSetup{
+        [&Term, &Client] { Term.setupClient(Client); },
+        [&Term] { Term.releaseClient(); }};
+      ScopeGuard Signal{[&Term] {
+                          SignalHandling& Sig = SignalHandling::get();
+                          Sig.registerObject(SignalHandling::ModuleObjName,
+                                             "Client");
+                          Sig.registerObject(TerminalObjName, &Term);
+                          Sig.registerCallback(SIGWINCH, &windowSizeChange);
+                          Sig.enable();
+
+                          // Override the SIGABRT handler with a custom one
+                          // that resets the terminal during a crash.
+                          Sig.registerCallback(SIGILL, &coreDumped);
+                          Sig.registerCallback(SIGABRT, &coreDumped);
+                          Sig.registerCallback(SIGSEGV, &coreDumped);
+                          Sig.registerCallback(SIGSYS, &coreDumped);
+                          Sig.registerCallback(SIGSTKFLT, &coreDumped);
+                        },
+                        [] {
+                          SignalHandling& Sig = SignalHandling::get();
+                          Sig.defaultCallback(SIGWINCH);
+                          Sig.deleteObject(TerminalObjName);
+
+                          Sig.clearOneCallback(SIGILL);
+                          Sig.clearOneCallback(SIGABRT);
+                          Sig.clearOneCallback(SIGSEGV);
+                          Sig.clearOneCallback(SIGSYS);
+                          Sig.clearOneCallback(SIGSTKFLT);
+                        }};
+
+      LOG(trace) << "Starting client...";
+
+      // Turn off all logging from this point now on, because the attached
+      // client randomly printing log to stdout would garble the terminal
+      // printouts.
+      OriginalLogLevel.get(); // Load it in.
+      ScopeGuard Loglevel{
+        [] { log::Logger::get().setLimit(log::None); },
+        [] { log::Logger::get().setLimit(OriginalLogLevel.get()); }};
+
+      // A read-only client leaves the terminal in its normal mode, so the
+      // user can interrupt it, as the input is not sent anywhere.
+      ScopeGuard TermIO{[&Term, &Opts] {
+                          if (!Opts.ReadOnly)
+                            Term.engage();
+                        },
+                        [&Term] {
+                          if (Term.engaged())
+                            Term.disengage();
+                        }};
+
+      Client.loop();
+    }
 
-    Client.loop();
+    // The server disconnects the clients when it is upgraded, but the sessions
+    // keep running in the new server. A connection that was lost might have
+    // been dropped on the way, while the session is still running.
+    const bool Upgraded = Client.exitReason() == Client::ServerUpgrade;
+    if (!Upgraded && Client.exitReason() != Client::Failed)
+      break;
+    if (!reattach(Opts))
+    {
+      std::cout << (Upgraded ? "\n[lost server during upgrade]"
+                             : "\n[lost server]")
+                << std::endl;
+      return EXIT_SystemError;
+    }
   }
 
   LOG(trace) << "Client stopped...";
@@ -314,123 +494,521 @@ void emplaceDefaultProgram(Options& Opts)
 }
 
 
-SessionSelectionResult selectSession(const std::vector<SessionData>& Sessions,
-                                     const std::string& ToCreateSessionName)
+std::optional<SessionSelectionResult>
+selectSession(Client& Client, const std::string& ToCreateSessionName)
 {
-  if (Sessions.empty())
+  // Only the first session is needed to decide, and the total count.
+  std::optional<SessionPage> First = Client.requestSessionPage("", 0, 1);
+  if (!First)
+    return std::nullopt;
+  if (!First->Total)
   {
     LOG(debug) << "List of sessions on server is empty, requesting default...";
-    return {ToCreateSessionName, SessionSelectionResult::Create};
+    return SessionSelectionResult{ToCreateSessionName,
+                                  SessionSelectionResult::Create};
   }
 
-  if (ToCreateSessionName.empty() && Sessions.size() == 1)
+  if (ToCreateSessionName.empty() && First->Total == 1)
   {
     LOG(debug) << "No session '--name' specified, attaching to the singular "
                   "existing session...";
-    return {Sessions.front().Name, SessionSelectionResult::Attach};
+    return SessionSelectionResult{First->Sessions.front().Name,
+                                  SessionSelectionResult::Attach};
   }
 
   if (!ToCreateSessionName.empty())
   {
     LOG(debug) << "Session \"" << ToCreateSessionName
                << "\" requested, checking...";
-    for (const SessionData& S : Sessions)
-      if (S.Name == ToCreateSessionName)
-      {
-        LOG(debug) << "\tFound requested session, preparing for attach...";
-        return {S.Name, SessionSelectionResult::Attach};
-      }
+    // The session with the exact name is ordered first among the ones that
+    // start with it.
+    std::optional<SessionPage> Named =
+      Client.requestSessionPage(ToCreateSessionName, 0, 1);
+    if (!Named)
+      return std::nullopt;
+    if (!Named->Sessions.empty() &&
+        Named->Sessions.front().Name == ToCreateSessionName)
+    {
+      LOG(debug) << "\tFound requested session, preparing for attach...";
+      return SessionSelectionResult{ToCreateSessionName,
+                                    SessionSelectionResult::Attach};
+    }
 
     LOG(debug) << "\tRequested session not found, requesting spawn...";
-    return {ToCreateSessionName, SessionSelectionResult::Create};
+    return SessionSelectionResult{ToCreateSessionName,
+                                  SessionSelectionResult::Create};
   }
 
-  return {"", SessionSelectionResult::None};
+  return SessionSelectionResult{"", SessionSelectionResult::None};
+}
+
+/// Prints every session of the server, fetching and printing them in pages,
+/// so the output starts without the entire list being transmitted first.
+///
+/// \returns whether the list was received successfully.
+static bool listSessions(Client& Client)
+{
+  static constexpr std::size_t PageSize = 256;
+  std::cout << "\nMonomux sessions on '"
+            << Client.getControlSocket().identifier() << "'...\n\n";
+  std::size_t Offset = 0;
+  while (true)
+  {
+    std::optional<SessionPage> Page =
+      Client.requestSessionPage("", Offset, PageSize);
+    if (!Page)
+      return false;
+    for (const SessionData& SD : Page->Sessions)
+      std::cout << "    " << ++Offset << ". " << SD.Name << " (created "
+                << formatTime(SD.Created) << ")\n";
+    if (!Page->More)
+      break;
+  }
+  std::cout << std::endl;
+  return true;
 }
 
-SessionSelectionResult selectSession(const std::string& ClientID,
-                                     const std::string& DefaultProgram,
-                                     const std::vector<SessionData>& Sessions,
-                                     const std::string& ToCreateSessionName,
-                                     bool UserWantsOnlyListSessions,
-                                     bool UserWantsInteractive)
+std::optional<SessionSelectionResult>
+selectSession(Client& Client,
+              const std::string& DefaultProgram,
+              const std::string& ToCreateSessionName,
+              bool UserWantsOnlyListSessions,
+              bool UserWantsInteractive)
 {
   if (!(UserWantsOnlyListSessions || UserWantsInteractive))
   {
     // Unless we know already that interactivity is needed, try the default
     // logic...
-    SessionSelectionResult R = selectSession(Sessions, ToCreateSessionName);
-    if (R.Mode != SessionSelectionResult::None)
+    std::optional<SessionSelectionResult> R =
+      selectSession(Client, ToCreateSessionName);
+    if (!R || R->Mode != SessionSelectionResult::None)
       // If decision making was successful, pass it on.
       return R;
     // If the non-interactive logic did not work out, fall back to
     // interactivity.
   }
 
-  const std::size_t NewSessionChoice = Sessions.size() + 1;
-  const std::size_t QuitChoice = NewSessionChoice + 1;
-  std::size_t UserChoice = 0;
+  if (UserWantsOnlyListSessions)
+  {
+    if (!listSessions(Client))
+      return std::nullopt;
+    return SessionSelectionResult{"", SessionSelectionResult::None};
+  }
 
+  // Only a page of the sessions is fetched and shown at a time, filtered by
+  // the beginning of their names on the server's side, so the menu is quick
+  // to appear and to navigate, no matter how many sessions there are.
+  std::string Filter;
+  std::size_t Offset = 0;
+  std::optional<SessionData> Chosen;
   // Mimicking the layout of tmux/byobu menu.
-  while (true)
+  while (!Chosen)
   {
-    std::cout << "\nMonomux sessions on '" << ClientID << "'...\n\n";
-    for (std::size_t I = 0; I < Sessions.size(); ++I)
+    std::optional<SessionPage> Page =
+      Client.requestSessionPage(Filter, Offset, SessionMenuPageSize);
+    if (!Page)
+      return std::nullopt;
+    if (Page->Sessions.empty() && Offset)
     {
-      const SessionData& SD = Sessions.at(I);
-      std::cout << "    " << (I + 1) << ". " << SD.Name << " (created "
-                << formatTime(SD.Created) << ")\n";
+      // Sessions exited since the previous page was shown.
+      Offset = 0;
+      continue;
     }
-    if (UserWantsOnlyListSessions)
+
+    std::cout << "\nMonomux sessions on '"
+              << Client.getControlSocket().identifier() << '\'';
+    if (!Filter.empty())
+      std::cout << " starting with '" << Filter << '\'';
+    std::cout << "...\n\n";
+    for (std::size_t I = 0; I < Page->Sessions.size(); ++I)
     {
-      std::cout << std::endl;
-      return {"", SessionSelectionResult::None};
+      const SessionData& SD = Page->Sessions.at(I);
+      std::cout << "    " << (Offset + I + 1) << ". " << SD.Name
+                << " (created " << formatTime(SD.Created) << ")\n";
+    }
+    if (Page->Sessions.empty() && !Filter.empty())
+      std::cout << "    (none)\n";
+    if (Offset || Page->More)
+    {
+      std::cout << "\n    (showing " << (Offset + 1) << '-'
+                << (Offset + Page->Sessions.size());
+      if (Filter.empty())
+        std::cout << " of " << Page->Total;
+      std::cout << ")\n";
     }
 
     // ---------------------- Show the interactive menu -----------------------
-    std::cout << "    " << NewSessionChoice << ". Create a new ";
+    std::cout << '\n';
+    if (Page->More)
+      std::cout << "    n. Next page\n";
+    if (Offset)
+      std::cout << "    p. Previous page\n";
+    std::cout << "    c. Create a new ";
     if (!ToCreateSessionName.empty())
       std::cout << '\'' << ToCreateSessionName << "' ";
     std::cout << "session (" << DefaultProgram << ")\n";
+    std::cout << "    q. Quit\n";
+
+    std::cout << "\nChoose a number or a letter, or type the beginning of a "
+                 "name to filter\n(a leading '/' filters for anything, alone "
+                 "it clears the filter): ";
+    std::string Input;
+    if (!std::getline(std::cin, Input))
+      return SessionSelectionResult{"", SessionSelectionResult::None};
+    Input.erase(0, Input.find_first_not_of(" \t"));
+    Input.erase(Input.find_last_not_of(" \t") + 1);
+
+    if (Input.empty())
+      continue;
+    if (Input == "q")
+      return SessionSelectionResult{"", SessionSelectionResult::None};
+    if (Input == "c")
+      break;
+    if (Input == "n" && Page->More)
+    {
+      Offset += Page->Sessions.size();
+      continue;
+    }
+    if (Input == "p" && Offset)
+    {
+      Offset -= std::min(Offset, SessionMenuPageSize);
+      continue;
+    }
+    if (std::all_of(Input.begin(), Input.end(), [](char C) {
+          return C >= '0' && C <= '9';
+        }))
+    {
+      const std::size_t UserChoice =
+        Input.size() < std::numeric_limits<std::size_t>::digits10
+          ? std::stoull(Input)
+          : 0;
+      if (UserChoice > Offset && UserChoice - Offset <= Page->Sessions.size())
+        Chosen = Page->Sessions.at(UserChoice - Offset - 1);
+      else
+        std::cerr << "\nERROR: Invalid input" << std::endl;
+      continue;
+    }
 
-    std::cout << "    " << QuitChoice << ". Quit\n";
+    // Anything else is the beginning of the name of the wanted session.
+    Filter = Input.front() == '/' ? Input.substr(1) : Input;
+    Offset = 0;
+  }
 
-    std::cout << "\nChoose 1-" << QuitChoice << ": ";
-    std::cin >> UserChoice;
-    std::cin.clear();
-    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    if (UserChoice == 0 || UserChoice > QuitChoice)
-      std::cerr << "\nERROR: Invalid input" << std::endl;
-    else
-      break;
+  if (Chosen)
+    return SessionSelectionResult{Chosen->Name, SessionSelectionResult::Attach};
+
+  if (!ToCreateSessionName.empty())
+    return SessionSelectionResult{ToCreateSessionName,
+                                  SessionSelectionResult::Create};
+
+  std::cout << "\nSession name (leave blank for default): ";
+  std::string ToCreateSessionName2;
+  std::getline(std::cin, ToCreateSessionName2);
+  std::cout << std::endl;
+  return SessionSelectionResult{ToCreateSessionName2,
+                                SessionSelectionResult::Create};
+}
+
+/// Writes the \p Samples to \p OS in the text exposition format of
+/// Prometheus. \p PreviousName is the name of the metric printed last, so
+/// the parts of a streamed response are printed as one.
+static void printPrometheus(std::ostream& OS,
+                            const std::vector<message::Metric>& Samples,
+                            std::string& PreviousName)
+{
+  using message::Metric;
+  const auto PrintLabels = [&OS](const Metric& M, const std::string& Le) {
+    if (M.Labels.empty() && Le.empty())
+      return;
+
+    OS << '{';
+    bool First = true;
+    const auto PrintLabel = [&OS, &First](std::string_view Key,
+                                          std::string_view Value) {
+      if (!First)
+        OS << ',';
+      First = false;
+      OS << Key << "=\"";
+      for (char C : Value)
+      {
+        if (C == '\\' || C == '"')
+          OS << '\\' << C;
+        else if (C == '\n')
+          OS << "\\n";
+        else
+          OS << C;
+      }
+      OS << '"';
+    };
+    for (const std::pair<std::string, std::string>& Label : M.Labels)
+      PrintLabel(Label.first, Label.second);
+    if (!Le.empty())
+      PrintLabel("le", Le);
+    OS << '}';
+  };
+
+  for (const Metric& M : Samples)
+  {
+    if (PreviousName != M.Name)
+    {
+      OS << "# TYPE " << M.Name << ' ';
+      switch (M.Type)
+      {
+        case Metric::Counter:
+          OS << "counter";
+          break;
+        case Metric::Gauge:
+          OS << "gauge";
+          break;
+        case Metric::Histogram:
+          OS << "histogram";
+          break;
+      }
+      OS << '\n';
+      PreviousName = M.Name;
+    }
+
+    if (M.Type != Metric::Histogram)
+    {
+      OS << M.Name;
+      PrintLabels(M, {});
+      OS << ' ' << M.Value << '\n';
+      continue;
+    }
+
+    // Prometheus expects cumulative buckets.
+    std::uint64_t Count = 0;
+    for (std::size_t I = 0; I < M.Buckets.size(); ++I)
+    {
+      Count += M.Buckets.at(I);
+      OS << M.Name << "_bucket";
+      PrintLabels(M,
+                  I + 1 < M.Buckets.size()
+                    ? std::to_string(std::uint64_t{1} << I)
+                    : "+Inf");
+      OS << ' ' << Count << '\n';
+    }
+    OS << M.Name << "_sum";
+    PrintLabels(M, {});
+    OS << ' ' << M.Value << '\n';
+    OS << M.Name << "_count";
+    PrintLabels(M, {});
+    OS << ' ' << Count << '\n';
   }
+}
+
+/// Writes the \p Records to \p OS, one per line, with the timestamps relative
+/// to the first record, the timestamp of which is kept in \p Begin, so the
+/// parts of a streamed response are printed as one.
+static void printTrace(std::ostream& OS,
+                       const std::vector<trace::Record>& Records,
+                       std::optional<std::uint64_t>& Begin)
+{
+  if (Records.empty())
+    return;
 
-  if (UserChoice == NewSessionChoice)
+  if (!Begin)
+    Begin = Records.front().Timestamp;
+  for (const trace::Record& R : Records)
   {
-    if (!ToCreateSessionName.empty())
-      return {ToCreateSessionName, SessionSelectionResult::Create};
+    const std::uint64_t US = (R.Timestamp - *Begin) / 1000;
+    OS << '+' << std::setw(12) << US << "us" << ' ' << '#' << std::left
+       << std::setw(3) << R.Thread << ' ' << std::setw(16)
+       << trace::name(R.Id) << std::right << " fd=" << std::setw(4) << R.FD
+       << " requested=" << R.Requested << " bytes=" << R.Bytes << '\n';
+  }
+}
 
-    std::cout << "\nSession name (leave blank for default): ";
-    std::string ToCreateSessionName2;
-    std::getline(std::cin, ToCreateSessionName2);
-    std::cout << std::endl;
-    return {ToCreateSessionName2, SessionSelectionResult::Create};
+/// Writes the \p Matches to \p OS, one per line, prefixed with the session
+/// and the offset of the match. Control characters in the lines, e.g. of
+/// escape sequences, are printed as \p '.'.
+static void printSearchMatches(std::ostream& OS,
+                               const std::vector<message::SearchMatch>& Matches)
+{
+  for (const message::SearchMatch& M : Matches)
+  {
+    OS << M.Session << ':' << M.Offset << ": ";
+    for (char C : M.Context)
+      OS << (static_cast<unsigned char>(C) < ' ' || C == '\x7f' ? '.' : C);
+    OS << '\n';
   }
-  if (UserChoice == QuitChoice)
-    return {"", SessionSelectionResult::None};
-  return {Sessions.at(UserChoice - 1).Name, SessionSelectionResult::Attach};
 }
 
 /// Handles operations through a \p ControlClient -only connection.
+/// Prints the result of a \p Command of a batch as a line of tab-separated
+/// fields, one line for every line of the \p Detail of the output.
+static void printBatchResult(std::ostream& OS,
+                             const ControlClient::BatchCommand& Command,
+                             ControlClient::BatchStatus Status,
+                             std::string_view Detail)
+{
+  const char* StatusName = "ok";
+  if (Status == ControlClient::BatchStatus::Data)
+    StatusName = "data";
+  else if (Status == ControlClient::BatchStatus::Failure)
+    StatusName = "error";
+
+  do
+  {
+    std::string_view::size_type EOL = Detail.find('\n');
+    OS << Command.Line << '\t' << Command.name() << '\t' << StatusName;
+    if (!Detail.empty())
+      OS << '\t' << Detail.substr(0, EOL);
+    OS << '\n';
+    Detail.remove_prefix(EOL == std::string_view::npos ? Detail.size()
+                                                       : EOL + 1);
+  } while (!Detail.empty());
+  if (Status != ControlClient::BatchStatus::Data)
+    // Whoever consumes the results should not wait for the end of the batch.
+    OS << std::flush;
+}
+
+/// Executes the commands of the batch read from \p Script over \p Client,
+/// printing the results to the standard output.
+///
+/// \returns whether every command succeeded.
+static bool runBatch(Client& Client, std::istream& Script)
+{
+  ControlClient CC{Client};
+  bool Failed = false;
+  auto Print = [&Failed](const ControlClient::BatchCommand& Command,
+                         ControlClient::BatchStatus Status,
+                         std::string_view Detail) {
+    Failed |= Status == ControlClient::BatchStatus::Failure;
+    printBatchResult(std::cout, Command, Status, Detail);
+  };
+
+  std::string Text;
+  std::size_t Line = 0;
+  while (std::getline(Script, Text))
+  {
+    ++Line;
+    std::optional<ControlClient::BatchCommand> Command;
+    try
+    {
+      Command = ControlClient::BatchCommand::parse(Text, Line);
+    }
+    catch (const std::invalid_argument& Err)
+    {
+      std::cout << Line << "\t-\terror\t" << Err.what() << std::endl;
+      Failed = true;
+      continue;
+    }
+    if (Command)
+      CC.runBatchCommand(*Command, Print);
+  }
+  CC.finishBatch();
+  return !Failed;
+}
+
 ExitCode mainForControlClient(Options& Opts)
 {
+  if (Opts.BatchScript)
+  {
+    std::ifstream File;
+    if (*Opts.BatchScript != "-")
+    {
+      File.open(*Opts.BatchScript);
+      if (!File)
+      {
+        std::cerr << "Failed to open batch '" << *Opts.BatchScript << '\''
+                  << std::endl;
+        return EXIT_InvocationError;
+      }
+    }
+
+    try
+    {
+      return runBatch(*Opts.Connection,
+                      *Opts.BatchScript == "-" ? std::cin : File)
+               ? EXIT_Success
+               : EXIT_Failure;
+    }
+    catch (const std::system_error& Err)
+    {
+      std::cerr << "Communication with the server failed: " << Err.what()
+                << std::endl;
+      return EXIT_SystemError;
+    }
+  }
+  if (Opts.StatusPageRequest)
+    // The server does not publish a status page, so only what is sent over the
+    // connection is listed.
+    return listSessions(*Opts.Connection) ? EXIT_Success : EXIT_SystemError;
   if (Opts.StatisticsRequest)
   {
     ControlClient CC{*Opts.Connection};
     try
     {
-      std::string Stats = CC.requestStatistics();
-      std::cout << Stats << std::endl;
+      CC.requestStatistics(
+        [](std::string_view Part) { std::cout << Part; });
+      std::cout << std::endl;
+      return EXIT_Success;
+    }
+    catch (const std::runtime_error& Err)
+    {
+      std::cerr << Err.what() << std::endl;
+      return EXIT_SystemError;
+    }
+  }
+  if (Opts.MetricsRequest)
+  {
+    ControlClient CC{*Opts.Connection};
+    try
+    {
+      std::string PreviousName;
+      CC.requestMetrics(
+        [&PreviousName](const std::vector<message::Metric>& Samples) {
+          printPrometheus(std::cout, Samples, PreviousName);
+        });
+      std::cout << std::flush;
+      return EXIT_Success;
+    }
+    catch (const std::runtime_error& Err)
+    {
+      std::cerr << Err.what() << std::endl;
+      return EXIT_SystemError;
+    }
+  }
+  if (Opts.TraceDumpRequest)
+  {
+    ControlClient CC{*Opts.Connection};
+    try
+    {
+      std::optional<std::uint64_t> Begin;
+      CC.requestTrace([&Begin](const std::vector<trace::Record>& Records) {
+        printTrace(std::cout, Records, Begin);
+      });
+      std::cout << std::flush;
+      return EXIT_Success;
+    }
+    catch (const std::runtime_error& Err)
+    {
+      std::cerr << Err.what() << std::endl;
+      return EXIT_SystemError;
+    }
+  }
+
+  if (Opts.SearchRequest)
+  {
+    ControlClient CC{*Opts.Connection};
+    try
+    {
+      message::response::Search Result = CC.requestSearch(
+        *Opts.SearchRequest, Opts.SessionName.value_or(std::string{}));
+      if (!Result.Success)
+      {
+        std::cerr << "Failed to search "
+                  << (Opts.SessionName ? "session \"" + *Opts.SessionName + '"'
+                                       : std::string{"the sessions"})
+                  << '!' << std::endl;
+        return EXIT_SystemError;
+      }
+      printSearchMatches(std::cout, Result.Matches);
+      std::cout << std::flush;
+      if (Result.Truncated)
+        std::cerr << "(Only the first " << Result.Matches.size()
+                  << " matches are shown.)" << std::endl;
       return EXIT_Success;
     }
     catch (const std::runtime_error& Err)
@@ -457,6 +1035,13 @@ ExitCode mainForControlClient(Options& Opts)
     return EXIT_SystemError;
   }
 
+  if (Opts.RateLimitRequest && !CC.requestRateLimit(*Opts.RateLimitRequest))
+  {
+    std::cerr << "Failed to set the rate limit of session \""
+              << CC.sessionName() << "\"!" << std::endl;
+    return EXIT_SystemError;
+  }
+
   if (Opts.DetachRequestLatest)
     CC.requestDetachLatestClient();
   else if (Opts.DetachRequestAll)
@@ -465,29 +1050,119 @@ ExitCode mainForControlClient(Options& Opts)
   return EXIT_Success;
 }
 
-
-ExitCode handleSessionCreateOrAttach(Options& Opts)
+/// Records the sessions requested in \p Opts, multiplexed over the connection
+/// made in the entry point where the server allows, and each through a
+/// connection of its own otherwise, until all of them end, or the user
+/// interrupts the recording.
+ExitCode mainForRecorder(Options& Opts)
 {
-  Client& Client = *Opts.Connection;
+  Recorder Rec;
+  ExitCode Ret = EXIT_Success;
+  if (Opts.Connection)
+  {
+    std::string FailureReason;
+    if (!Rec.multiplex(std::move(*Opts.Connection), &FailureReason))
+      LOG(warn) << "Setting up the multiplexed connection failed:\n\t"
+                << FailureReason;
+    Opts.Connection.reset();
+  }
 
-  std::optional<std::vector<SessionData>> Sessions =
-    Client.requestSessionList();
-  if (!Sessions.has_value())
+  for (const auto& [SessionName, Path] : Opts.Recordings)
   {
-    LOG(fatal) << "Receiving the list of sessions from the server failed!";
-    return EXIT_SystemError;
+    std::optional<RecordFile> File;
+    try
+    {
+      if (Path == "-")
+        File.emplace(fd::dup(fd::fileno(stdout)));
+      else
+        File.emplace(RecordFile::create(Path, Opts.RecordDirect));
+    }
+    catch (const std::system_error& Err)
+    {
+      std::cerr << "ERROR: Creating the recording '" << Path
+                << "' failed:\n\t" << Err.what() << std::endl;
+      Ret = EXIT_SystemError;
+      continue;
+    }
+
+    if (Rec.recordChannel(SessionName, *File))
+      continue;
+    // E.g. the session is handled by a worker thread of the server, which
+    // can not be multiplexed with the others.
+    std::string FailureReason;
+    std::optional<Client> Connection;
+    try
+    {
+      Connection = connect(Opts, false, &FailureReason);
+    }
+    catch (const std::system_error& Err)
+    {
+      FailureReason = Err.what();
+    }
+    if (!Connection)
+    {
+      std::cerr << "ERROR: Connecting to record session '" << SessionName
+                << "' failed:\n\t" << FailureReason << std::endl;
+      Ret = EXIT_SystemError;
+      continue;
+    }
+
+    if (!Rec.record(std::move(*Connection),
+                    SessionName,
+                    std::move(*File),
+                    &FailureReason))
+    {
+      std::cerr << "ERROR: " << FailureReason << std::endl;
+      Ret = EXIT_SystemError;
+    }
   }
+  if (!Rec.size())
+    return EXIT_SystemError;
+
+  ScopeGuard Signal{[&Rec] {
+                      SignalHandling& Sig = SignalHandling::get();
+                      Sig.registerObject(RecorderObjName, &Rec);
+                      Sig.registerCallback(SIGINT, &recorderTerminate);
+                      Sig.registerCallback(SIGTERM, &recorderTerminate);
+                      Sig.enable();
+                    },
+                    [] {
+                      SignalHandling& Sig = SignalHandling::get();
+                      Sig.clearOneCallback(SIGINT);
+                      Sig.clearOneCallback(SIGTERM);
+                      Sig.deleteObject(RecorderObjName);
+                    }};
+  Rec.loop();
+  return Ret;
+}
+
+
+ExitCode handleSessionCreateOrAttach(Options& Opts)
+{
+  Client& Client = *Opts.Connection;
 
   emplaceDefaultProgram(Opts);
-  SessionSelectionResult SessionAction =
-    selectSession(Client.getControlSocket().identifier(),
+  std::optional<SessionSelectionResult> Selection =
+    selectSession(Client,
                   Opts.Program->Program,
-                  *Sessions,
                   Opts.SessionName ? *Opts.SessionName : "",
                   Opts.OnlyListSessions,
                   Opts.InteractiveSessionMenu);
+  if (!Selection)
+  {
+    LOG(fatal) << "Receiving the list of sessions from the server failed!";
+    return EXIT_SystemError;
+  }
+  SessionSelectionResult& SessionAction = *Selection;
   if (SessionAction.Mode == SessionSelectionResult::None)
     return EXIT_Success;
+  if (SessionAction.Mode == SessionSelectionResult::Create && Opts.ReadOnly)
+  {
+    std::cerr << "ERROR: A read-only client can only attach to an existing "
+                 "session."
+              << std::endl;
+    return EXIT_InvocationError;
+  }
   if (SessionAction.Mode == SessionSelectionResult::Create)
   {
     assert(Opts.Program && !Opts.Program->Program.empty() &&
@@ -496,8 +1171,12 @@ ExitCode handleSessionCreateOrAttach(Options& Opts)
     // e.g. do not inherit the TERM of the server, but rather the TERM of the
     // client.
 
-    std::optional<std::string> Response = Client.requestMakeSession(
-      SessionAction.SessionName, std::move(*Opts.Program));
+    std::optional<std::string> Response =
+      Client.requestMakeSession(SessionAction.SessionName,
+                                std::move(*Opts.Program),
+                                Opts.ScrollbackSize,
+                                Opts.CoalesceWindow,
+                                Opts.RateLimit);
     if (!Response.has_value() || Response->empty())
     {
       LOG(fatal) << "When creating a new session, the creation failed.";
@@ -512,6 +1191,7 @@ ExitCode handleSessionCreateOrAttach(Options& Opts)
   {
     {
       std::string DataFailure;
+      Client.setCompressOutput(Opts.Compress);
       if (!makeWholeWithData(Client, &DataFailure))
       {
         LOG(fatal) << DataFailure;
@@ -520,7 +1200,9 @@ ExitCode handleSessionCreateOrAttach(Options& Opts)
     }
 
     LOG(debug) << "Attaching to \"" << SessionAction.SessionName << "\"...";
-    bool Attached = Client.requestAttach(std::move(SessionAction.SessionName));
+    Client.setCatchUp(Opts.CatchUp);
+    bool Attached = Client.requestAttach(std::move(SessionAction.SessionName),
+                                         /* Observer =*/Opts.ReadOnly);
     if (!Attached)
     {
       std::cerr << "ERROR: Server reported failure when attaching."
@@ -532,6 +1214,58 @@ ExitCode handleSessionCreateOrAttach(Options& Opts)
   return EXIT_Success;
 }
 
+/// Connects to the server again after the connection was lost, or the server
+/// was replaced by an upgrade, and attaches to the same session again. The
+/// output the client had already received is not sent again, if the server
+/// still has the rest.
+///
+/// \returns whether the client is attached again.
+///
+/// \note The connection of \p Opts is replaced even if attaching fails.
+bool reattach(Options& Opts)
+{
+  const SessionData* Session = Opts.Connection->attachedSession();
+  if (!Session)
+    return false;
+  std::string SessionName = Session->Name;
+  std::optional<ResumePoint> Resume = Opts.Connection->resumePoint();
+
+  // The listening socket is kept open during the upgrade, so connecting
+  // succeeds, but the new server only accepts once it is running.
+  std::chrono::milliseconds Delay = RetryDelayMin;
+  for (std::size_t Attempt = 0; Attempt < MaxRetries; ++Attempt)
+  {
+    std::optional<Client> New;
+    try
+    {
+      New = Client::create(*Opts.SocketPath, nullptr);
+    }
+    catch (const std::system_error&)
+    {}
+    if (!New)
+    {
+      backOff(Delay);
+      continue;
+    }
+
+    // The requests register callbacks that refer to the client, so it must
+    // not be moved after the connection is set up.
+    Opts.Connection = std::move(*New);
+    std::string Failure;
+    Opts.Connection->setCompressOutput(Opts.Compress);
+    if (!makeWholeWithData(*Opts.Connection, &Failure))
+    {
+      LOG(error) << Failure;
+      return false;
+    }
+    Opts.Connection->setCatchUp(Opts.CatchUp);
+    return Opts.Connection->requestAttach(std::move(SessionName),
+                                          /* Observer =*/Opts.ReadOnly,
+                                          std::move(Resume));
+  }
+  return false;
+}
+
 int handleClientExitStatus(const Client& Client)
 {
   std::cout << std::endl;
@@ -572,6 +1306,10 @@ int handleClientExitStatus(const Client& Client)
       if (!Client.exitMessage().empty())
         std::cout << ": " << Client.exitMessage();
       std::cout << ']' << std::endl;
+      return EXIT_Success;
+    case Client::ServerUpgrade:
+      std::cout << "[server upgraded]" << std::endl;
+      return EXIT_Success;
   }
   return EXIT_Success;
 }
@@ -610,6 +1348,19 @@ void coreDumped(SignalHandling::Signal /* SigNum */,
   }
 }
 
+/// Handler for \p SIGINT and \p SIGTERM received while recording, which makes
+/// the recorder stop after writing the output received so far.
+void recorderTerminate(SignalHandling::Signal /* SigNum */,
+                       ::siginfo_t* /* Info */,
+                       const SignalHandling* Handling)
+{
+  const volatile auto* Rec =
+    std::any_cast<Recorder*>(Handling->getObject(RecorderObjName));
+  if (!Rec)
+    return;
+  (*Rec)->terminate();
+}
+
 } // namespace
 
 } // namespace monomux::client
@@ -0,0 +1,400 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <fcntl.h>
+
+#include "monomux/client/Main.hpp"
+#include "monomux/client/Recorder.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("client/Recorder")
+
+namespace monomux::client
+{
+
+/// \returns the file descriptor that the output of the session of \p Client
+/// arrives on.
+static raw_fd outputFD(Client& Client)
+{
+  if (SharedRing* Ring = Client.getOutputRing())
+    return Ring->dataBell();
+  return Client.getDataSocket()->raw();
+}
+
+bool Recorder::record(Client&& Connection,
+                      std::string SessionName,
+                      RecordFile&& File,
+                      std::string* FailureReason)
+{
+  auto C = std::make_unique<Client>(std::move(Connection));
+  if (!makeWholeWithData(*C, FailureReason))
+    return false;
+  if (!C->requestAttach(SessionName, /* Observer =*/true))
+  {
+    if (FailureReason)
+      *FailureReason =
+        "Server reported failure when attaching to '" + SessionName + "'.";
+    return false;
+  }
+
+  LOG(info) << "Recording session '" << SessionName << "'...";
+  auto R = std::make_unique<Recording>(
+    Recording{C.get(), std::nullopt, std::move(SessionName), std::move(File)});
+  R->LastData = std::chrono::steady_clock::now();
+  Connections.emplace_back(std::move(C));
+  Recordings.emplace_back(std::move(R));
+  return true;
+}
+
+bool Recorder::multiplex(Client&& Connection, std::string* FailureReason)
+{
+  auto C = std::make_unique<Client>(std::move(Connection));
+  if (!makeWholeWithData(*C, FailureReason))
+    return false;
+
+  C->setChannelOutputCallback(
+    [this](Client& /* Client */,
+           message::ChannelID Channel,
+           std::string_view Data) {
+      Recording* R = channelRecording(Channel);
+      if (!R)
+        return;
+      try
+      {
+        R->File.append(Data);
+        R->LastData = std::chrono::steady_clock::now();
+      }
+      catch (const std::system_error& Err)
+      {
+        LOG(error) << "Recording session '" << R->SessionName
+                   << "' failed: " << Err.what();
+        finish(*R);
+      }
+    });
+  C->setChannelClosedCallback(
+    [this](Client& /* Client */,
+           const message::notification::ChannelClosed& Closed) {
+      if (Recording* R = channelRecording(Closed.Channel); R && !R->Draining)
+        drain(*R);
+    });
+  Mux = C.get();
+  Connections.emplace_back(std::move(C));
+  return true;
+}
+
+bool Recorder::recordChannel(std::string SessionName, RecordFile& File)
+{
+  if (!Mux || Mux->exitReason() != Client::None)
+    return false;
+  std::optional<message::ChannelID> Channel;
+  try
+  {
+    Channel = Mux->requestOpenChannel(SessionName, /* Observer =*/true);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(warn) << "Opening a channel to session '" << SessionName
+              << "' failed: " << Err.what();
+  }
+  if (!Channel)
+    return false;
+
+  LOG(info) << "Recording session '" << SessionName << "' over channel #"
+            << *Channel << "...";
+  auto R = std::make_unique<Recording>(
+    Recording{Mux, Channel, std::move(SessionName), std::move(File)});
+  R->LastData = std::chrono::steady_clock::now();
+  Recordings.emplace_back(std::move(R));
+  return true;
+}
+
+void Recorder::loop()
+{
+  Poll = std::make_unique<EPoll>(
+    std::max<std::size_t>(Connections.size() * 2, 4));
+  if (Mux)
+  {
+    fd::addStatusFlag(Mux->getControlSocket().raw(), O_NONBLOCK);
+    fd::addStatusFlag(Mux->getDataSocket()->raw(), O_NONBLOCK);
+    Poll->listen(Mux->getControlSocket().raw(),
+                 /* Incoming =*/true,
+                 /* Outgoing =*/false);
+    Poll->listen(Mux->getDataSocket()->raw(),
+                 /* Incoming =*/true,
+                 /* Outgoing =*/false);
+    receiveChannels();
+    if (Mux->exitReason() != Client::None)
+      drainChannels();
+  }
+  for (const auto& R : Recordings)
+  {
+    if (R->Channel)
+    {
+      if (R->Draining)
+        // The channel closed while the others were being opened.
+        Poll->addTimer(DrainTimeout,
+                       [this, &Closed = *R] { drainTimer(Closed); });
+      continue;
+    }
+    Client& C = *R->Connection;
+    fd::addStatusFlag(C.getControlSocket().raw(), O_NONBLOCK);
+    fd::addStatusFlag(C.getDataSocket()->raw(), O_NONBLOCK);
+    Poll->listen(C.getControlSocket().raw(),
+                 /* Incoming =*/true,
+                 /* Outgoing =*/false);
+    Poll->listen(outputFD(C), /* Incoming =*/true, /* Outgoing =*/false);
+    // Output that arrived together with the attach response is already read.
+    receive(*R);
+  }
+  Poll->addTimer(FlushInterval, [this] { flushTimer(); });
+
+  auto Active = [this] {
+    return std::any_of(Recordings.begin(),
+                       Recordings.end(),
+                       [](const auto& R) { return !R->Finished; });
+  };
+  while (!TerminateLoop.get().load() && Active())
+  {
+    for (const auto& R : Recordings)
+      if (!R->Finished)
+        R->Connection->getControlSocket().flushWrites();
+
+    const std::size_t NumTriggeredFDs = Poll->wait();
+    for (std::size_t I = 0; I < NumTriggeredFDs; ++I)
+    {
+      const raw_fd FD = Poll->fdAt(I);
+      if (Poll->isTimer(FD))
+      {
+        Poll->fireTimers();
+        continue;
+      }
+      if (Mux && FD == Mux->getDataSocket()->raw())
+      {
+        receiveChannels();
+        continue;
+      }
+      if (Mux && FD == Mux->getControlSocket().raw())
+      {
+        Mux->controlCallback();
+        if (Mux->exitReason() != Client::None)
+          drainChannels();
+        continue;
+      }
+
+      for (const auto& R : Recordings)
+      {
+        if (R->Finished || R->Channel)
+          continue;
+        Client& C = *R->Connection;
+        if (FD == outputFD(C))
+          receive(*R);
+        else if (!R->Draining && FD == C.getControlSocket().raw())
+          C.controlCallback();
+        else
+          continue;
+
+        if (!R->Draining && C.exitReason() != Client::None)
+          drain(*R);
+        break;
+      }
+    }
+  }
+
+  for (const auto& R : Recordings)
+    if (!R->Finished)
+    {
+      receive(*R);
+      finish(*R);
+    }
+  Poll.reset();
+}
+
+void Recorder::receive(Recording& R)
+{
+  if (R.Channel)
+  {
+    receiveChannels();
+    return;
+  }
+  Client& C = *R.Connection;
+  std::size_t Received = 0;
+  bool Closed = false;
+  try
+  {
+    if (SharedRing* Ring = C.getOutputRing())
+    {
+      Ring->clearDataBell();
+      for (std::string_view Segment = Ring->peek(); !Segment.empty();
+           Segment = Ring->peek())
+      {
+        R.File.append(Segment);
+        Ring->consume(Segment.size());
+        Received += Segment.size();
+      }
+    }
+    else
+    {
+      Socket& DS = *C.getDataSocket();
+      try
+      {
+        DS.load(DS.readSize());
+      }
+      catch (const std::system_error&)
+      {
+        // What was read before the connection closed is still written.
+      }
+      Received = DS.readInBuffer();
+      for (std::string_view Segment : DS.peekRead(Received))
+        R.File.append(Segment);
+      DS.consumeRead(Received);
+      Closed = DS.failed();
+    }
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Recording session '" << R.SessionName
+               << "' failed: " << Err.what();
+    finish(R);
+    return;
+  }
+
+  if (Received)
+    R.LastData = std::chrono::steady_clock::now();
+  if (Closed)
+    // No more output can arrive.
+    finish(R);
+}
+
+void Recorder::receiveChannels()
+{
+  Socket& DS = *Mux->getDataSocket();
+  if (DS.failed())
+    return;
+  try
+  {
+    Mux->receiveChannelOutput();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Receiving the multiplexed sessions failed: " << Err.what();
+  }
+  if (!DS.failed())
+    return;
+
+  // No more output can arrive.
+  if (Poll)
+    Poll->stop(DS.raw());
+  for (const auto& R : Recordings)
+    if (R->Channel && !R->Finished)
+      finish(*R);
+}
+
+Recorder::Recording*
+Recorder::channelRecording(message::ChannelID Channel) noexcept
+{
+  for (const auto& R : Recordings)
+    if (R->Channel == Channel && !R->Finished)
+      return R.get();
+  return nullptr;
+}
+
+void Recorder::drainChannels()
+{
+  Poll->stop(Mux->getControlSocket().raw());
+  for (const auto& R : Recordings)
+    if (R->Channel && !R->Draining && !R->Finished)
+      drain(*R);
+}
+
+void Recorder::drain(Recording& R)
+{
+  LOG(debug) << "Session '" << R.SessionName << "' recording ending";
+  R.Draining = true;
+  if (!Poll)
+    // The drain starts once the loop does.
+    return;
+  if (!R.Channel)
+    Poll->stop(R.Connection->getControlSocket().raw());
+  Poll->addTimer(DrainTimeout, [this, &R] { drainTimer(R); });
+}
+
+void Recorder::drainTimer(Recording& R)
+{
+  if (R.Finished)
+    return;
+
+  const auto Deadline = R.LastData + DrainTimeout;
+  if (std::chrono::steady_clock::now() < Deadline)
+  {
+    Poll->addTimer(Deadline, [this, &R] { drainTimer(R); });
+    return;
+  }
+  receive(R);
+  if (!R.Finished)
+    finish(R);
+}
+
+void Recorder::finish(Recording& R)
+{
+  if (Poll && !R.Channel)
+  {
+    // (The connection of a channel is shared with the other channels.)
+    if (!R.Draining)
+      Poll->stop(R.Connection->getControlSocket().raw());
+    Poll->stop(outputFD(*R.Connection));
+  }
+  R.Finished = true;
+
+  try
+  {
+    R.File.close();
+    LOG(info) << "Session '" << R.SessionName << "' recorded, "
+              << R.File.size() << " bytes";
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Writing the recording of session '" << R.SessionName
+               << "' failed: " << Err.what();
+  }
+}
+
+void Recorder::flushTimer()
+{
+  for (const auto& R : Recordings)
+  {
+    if (R->Finished || !R->File.buffered())
+      continue;
+    try
+    {
+      R->File.flush();
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Writing the recording of session '" << R->SessionName
+                 << "' failed: " << Err.what();
+      finish(*R);
+    }
+  }
+  Poll->addTimer(FlushInterval, [this] { flushTimer(); });
+}
+
+} // namespace monomux::client
+
+#undef LOG
@@ -17,9 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <cassert>
+#include <chrono>
 #include <functional>
 #include <sstream>
 
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 
@@ -66,6 +68,8 @@ void Terminal::engage()
     -1);
 
   In->setNonblocking();
+  // A slow terminal must not block the client, see clientOutputWritable().
+  Out->setNonblocking();
 
   POD<struct ::termios> NewSettings = OriginalTerminalSettings;
   NewSettings->c_iflag &=
@@ -95,6 +99,15 @@ void Terminal::disengage()
     return;
 
   In->setBlocking();
+  Out->setBlocking();
+  try
+  {
+    // Write the rest of the output backlog before the terminal is restored.
+    while (Out->hasBufferedWrite() && Out->flushWrites())
+      ;
+  }
+  catch (const std::system_error&)
+  {}
 
   CheckedPOSIXThrow(
     [this] {
@@ -108,6 +121,21 @@ void Terminal::disengage()
   Engaged = false;
 }
 
+/// \returns whether \p FD became readable within \p Timeout.
+static bool waitReadable(raw_fd FD, std::chrono::microseconds Timeout)
+{
+  POD<struct ::pollfd> P;
+  P->fd = FD;
+  P->events = POLLIN;
+  POD<struct ::timespec> TS;
+  TS->tv_sec = Timeout.count() / 1'000'000;
+  TS->tv_nsec = (Timeout.count() % 1'000'000) * 1'000;
+
+  auto Ready =
+    CheckedPOSIX([&P, &TS] { return ::ppoll(&P, 1, &TS, nullptr); }, -1);
+  return Ready && Ready.get() > 0;
+}
+
 void Terminal::clientInput(Terminal* Term, Client& Client)
 {
   assert(Term->MovedFromCheck &&
@@ -115,16 +143,44 @@ void Terminal::clientInput(Terminal* Term, Client& Client)
   if (Client.getInputFile() != Term->input()->raw())
     throw std::invalid_argument{"Client InputFD != Terminal input"};
 
-  do
+  Pipe& In = *Term->input();
+  In.load(InputBatchMax);
+  if (In.readInBuffer() >= InputBurstSize)
   {
-    static constexpr std::size_t ReadSize = BUFSIZ;
-    std::string Input = Term->input()->read(ReadSize);
-    if (Input.empty())
-      return;
-
-    Client.sendData(Input);
-  } while (Term->input()->hasBufferedRead());
-  Term->input()->tryFreeResources();
+    // A burst, e.g. a paste, is likely followed by more of it right away, and
+    // is better sent in one piece than in many small ones.
+    const auto Deadline = std::chrono::steady_clock::now() + InputBatchLatency;
+    while (In.readInBuffer() < InputBatchMax)
+    {
+      const auto Left = std::chrono::duration_cast<std::chrono::microseconds>(
+        Deadline - std::chrono::steady_clock::now());
+      if (Left <= std::chrono::microseconds::zero() ||
+          !waitReadable(In.raw(), Left))
+        break;
+      if (!In.load(InputBatchMax - In.readInBuffer()))
+        break;
+    }
+  }
+
+  const std::size_t InputSize = In.readInBuffer();
+  for (std::string_view Segment : In.peekRead(InputSize))
+    if (!Segment.empty())
+      Client.sendData(Segment);
+  In.consumeRead(InputSize);
+  In.tryFreeResources();
+}
+
+/// Writes everything buffered for reading on \p From to \p To.
+///
+/// \returns the number of bytes written.
+static std::size_t writeBufferedRead(BufferedChannel& From, Pipe& To)
+{
+  const std::size_t OutputSize = From.readInBuffer();
+  for (std::string_view Segment : From.peekRead(OutputSize))
+    if (!Segment.empty())
+      To.write(Segment);
+  From.consumeRead(OutputSize);
+  return OutputSize;
 }
 
 void Terminal::clientOutput(Terminal* Term, Client& Client)
@@ -132,13 +188,65 @@ void Terminal::clientOutput(Terminal* Term, Client& Client)
   assert(Term->MovedFromCheck &&
          "Terminal object registered as callback was moved.");
 
-  static constexpr std::size_t ReadSize = BUFSIZ;
-  std::string Output = Client.getDataSocket()->read(ReadSize);
-  Term->output()->write(Output);
+  if (Pipe* Pty = Client.getPtyReader())
+  {
+    // The output relayed by the server before the hand-off comes first.
+    Client.countOutput(
+      writeBufferedRead(*Client.getDataSocket(), *Term->output()));
+    bool HungUp = false;
+    try
+    {
+      Pty->load(Pty->readSize());
+    }
+    catch (const std::system_error&)
+    {
+      // The session exited, which the server will report.
+      HungUp = true;
+    }
+    writeBufferedRead(*Pty, *Term->output());
+    if (HungUp)
+      Client.releasePty();
+  }
+  else if (SharedRing* Ring = Client.getOutputRing())
+  {
+    // The output is written straight from the memory shared with the server.
+    // Do not let a session that keeps producing starve the input.
+    std::size_t Written = 0;
+    for (std::string_view Segment = Ring->peek();
+         !Segment.empty() && Written < Ring->capacity() &&
+         Term->output()->writeInBuffer() <= Client::OutputBacklogHighWatermark;
+         Segment = Ring->peek())
+    {
+      Term->output()->write(Segment);
+      Ring->consume(Segment.size());
+      Written += Segment.size();
+    }
+    Client.countOutput(Written);
+  }
+  else if (Client.isOutputCompressed())
+    Client.countOutput(Client.receiveCompressedOutput(*Term->output()));
+  else
+  {
+    Socket& DS = *Client.getDataSocket();
+    DS.load(DS.readSize());
+    Client.countOutput(writeBufferedRead(DS, *Term->output()));
+  }
 
-  while (Term->output()->hasBufferedWrite())
-    Term->output()->flushWrites();
-  Term->output()->tryFreeResources();
+  // What the terminal could not take is written once it becomes writable.
+  Client.notifyOutputBacklog(Term->output()->writeInBuffer());
+  if (!Term->output()->hasBufferedWrite())
+    Term->output()->tryFreeResources();
+}
+
+void Terminal::clientOutputWritable(Terminal* Term, Client& Client)
+{
+  assert(Term->MovedFromCheck &&
+         "Terminal object registered as callback was moved.");
+
+  Term->output()->flushWrites();
+  Client.notifyOutputBacklog(Term->output()->writeInBuffer());
+  if (!Term->output()->hasBufferedWrite())
+    Term->output()->tryFreeResources();
 }
 
 void Terminal::clientEventReady(Terminal* Term, Client& Client)
@@ -166,6 +274,10 @@ void Terminal::setupClient(Client& Client)
   Client.setDataCallback(
     // NOLINTNEXTLINE(modernize-avoid-bind)
     std::bind(&Terminal::clientOutput, this, std::placeholders::_1));
+  Client.setOutputFile(Out->raw());
+  Client.setOutputCallback(
+    // NOLINTNEXTLINE(modernize-avoid-bind)
+    std::bind(&Terminal::clientOutputWritable, this, std::placeholders::_1));
   Client.setExternalEventProcessor(
     // NOLINTNEXTLINE(modernize-avoid-bind)
     std::bind(&Terminal::clientEventReady, this, std::placeholders::_1));
@@ -182,6 +294,8 @@ void Terminal::releaseClient()
   AssociatedClient->setInputCallback({});
   AssociatedClient->setExternalEventProcessor({});
   AssociatedClient->setInputFile(fd::Invalid);
+  AssociatedClient->setOutputCallback({});
+  AssociatedClient->setOutputFile(fd::Invalid);
 
   AssociatedClient = nullptr;
 }
@@ -0,0 +1,1026 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "monomux/control/Message.hpp"
+
+#define DECODE(NAME)                                                           \
+  std::optional<NAME> NAME::decodeBinary(BinaryReader& Buffer)
+#define ENCODE(NAME)                                                           \
+  void NAME::encodeBinary(BinaryWriter& Buffer, const NAME& Object)
+
+/// Returns from the decoder if a field-level read had failed.
+#define GOOD_OR_NONE                                                           \
+  if (!Buffer.good())                                                          \
+    return std::nullopt;
+
+namespace monomux::message
+{
+
+namespace
+{
+
+/// Reads the number of elements of a list from \p Buffer, and returns the
+/// number of elements that are worth reserving space for.
+std::size_t readCount(BinaryReader& Buffer, std::size_t& Count)
+{
+  Count = Buffer.integer<std::uint32_t>();
+  // Every element takes at least one byte, so a malformed count is not
+  // allowed to allocate a huge amount of memory.
+  return std::min(Count, Buffer.remaining());
+}
+
+/// Reads a flag from the end of \p Buffer, which is only encoded if set.
+///
+/// \returns whether the flag is set. Any other trailing data is not consumed,
+/// and makes the message malformed.
+bool readTrailingFlag(BinaryReader& Buffer)
+{
+  BinaryReader Flag = Buffer;
+  if (Buffer.remaining() != 1 || Flag.integer<std::uint8_t>() != 1)
+    return false;
+  Buffer = Flag;
+  return true;
+}
+
+} // namespace
+
+ENCODE(ClientID)
+{
+  Buffer.integer<std::uint64_t>(Object.ID);
+  Buffer.integer<std::uint64_t>(Object.Nonce);
+}
+DECODE(ClientID)
+{
+  ClientID Ret;
+  Ret.ID = Buffer.integer<std::uint64_t>();
+  Ret.Nonce = Buffer.integer<std::uint64_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(ProcessSpawnOptions)
+{
+  Buffer.string(Object.Program);
+  Buffer.integer(static_cast<std::uint32_t>(Object.Arguments.size()));
+  for (const std::string& Arg : Object.Arguments)
+    Buffer.string(Arg);
+  Buffer.integer(static_cast<std::uint32_t>(Object.SetEnvironment.size()));
+  for (const std::pair<std::string, std::string>& EnvKV :
+       Object.SetEnvironment)
+  {
+    Buffer.string(EnvKV.first);
+    Buffer.string(EnvKV.second);
+  }
+  Buffer.integer(static_cast<std::uint32_t>(Object.UnsetEnvironment.size()));
+  for (const std::string& EnvK : Object.UnsetEnvironment)
+    Buffer.string(EnvK);
+}
+DECODE(ProcessSpawnOptions)
+{
+  ProcessSpawnOptions Ret;
+  Ret.Program = Buffer.string();
+
+  std::size_t Count = 0;
+  Ret.Arguments.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count && Buffer.good(); ++I)
+    Ret.Arguments.emplace_back(Buffer.string());
+
+  Ret.SetEnvironment.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count && Buffer.good(); ++I)
+  {
+    std::string_view Var = Buffer.string();
+    std::string_view Val = Buffer.string();
+    Ret.SetEnvironment.emplace_back(Var, Val);
+  }
+
+  Ret.UnsetEnvironment.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count && Buffer.good(); ++I)
+    Ret.UnsetEnvironment.emplace_back(Buffer.string());
+
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(SessionData)
+{
+  Buffer.string(Object.Name);
+  Buffer.integer(static_cast<std::int64_t>(Object.Created));
+}
+DECODE(SessionData)
+{
+  SessionData Ret;
+  Ret.Name = Buffer.string();
+  Ret.Created = static_cast<std::time_t>(Buffer.integer<std::int64_t>());
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(SessionStatus)
+{
+  monomux::message::SessionData::encodeBinary(Buffer, Object.Session);
+  Buffer.integer(static_cast<std::uint32_t>(Object.AttachedClients));
+  Buffer.integer(static_cast<std::int64_t>(Object.LastActive));
+}
+DECODE(SessionStatus)
+{
+  auto Session = monomux::message::SessionData::decodeBinary(Buffer);
+  if (!Session)
+    return std::nullopt;
+  SessionStatus Ret;
+  Ret.Session = std::move(*Session);
+  Ret.AttachedClients = Buffer.integer<std::uint32_t>();
+  Ret.LastActive = static_cast<std::time_t>(Buffer.integer<std::int64_t>());
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Boolean) { Buffer.boolean(Object.Value); }
+DECODE(Boolean)
+{
+  Boolean Ret;
+  Ret.Value = Buffer.boolean();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Metric)
+{
+  Buffer.integer(static_cast<std::uint8_t>(Object.Type));
+  Buffer.string(Object.Name);
+  Buffer.integer(static_cast<std::uint32_t>(Object.Labels.size()));
+  for (const std::pair<std::string, std::string>& Label : Object.Labels)
+  {
+    Buffer.string(Label.first);
+    Buffer.string(Label.second);
+  }
+  Buffer.integer<std::uint64_t>(Object.Value);
+  Buffer.integer(static_cast<std::uint32_t>(Object.Buckets.size()));
+  for (std::uint64_t Bucket : Object.Buckets)
+    Buffer.integer<std::uint64_t>(Bucket);
+}
+DECODE(Metric)
+{
+  Metric Ret;
+  switch (Buffer.integer<std::uint8_t>())
+  {
+    case Metric::Counter:
+      Ret.Type = Metric::Counter;
+      break;
+    case Metric::Gauge:
+      Ret.Type = Metric::Gauge;
+      break;
+    case Metric::Histogram:
+      Ret.Type = Metric::Histogram;
+      break;
+    default:
+      return std::nullopt;
+  }
+  Ret.Name = Buffer.string();
+
+  std::size_t Count = 0;
+  Ret.Labels.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count && Buffer.good(); ++I)
+  {
+    std::string_view Key = Buffer.string();
+    std::string_view Val = Buffer.string();
+    Ret.Labels.emplace_back(Key, Val);
+  }
+
+  Ret.Value = Buffer.integer<std::uint64_t>();
+
+  Ret.Buckets.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count && Buffer.good(); ++I)
+    Ret.Buckets.emplace_back(Buffer.integer<std::uint64_t>());
+
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(SearchMatch)
+{
+  Buffer.string(Object.Session);
+  Buffer.integer<std::uint64_t>(Object.Offset);
+  Buffer.string(Object.Context);
+}
+DECODE(SearchMatch)
+{
+  SearchMatch Ret;
+  Ret.Session = Buffer.string();
+  Ret.Offset = Buffer.integer<std::uint64_t>();
+  Ret.Context = Buffer.string();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+namespace request
+{
+
+ENCODE(ClientID)
+{
+  (void)Buffer;
+  (void)Object;
+}
+DECODE(ClientID)
+{
+  (void)Buffer;
+  return ClientID{};
+}
+
+ENCODE(DataSocket)
+{
+  monomux::message::ClientID::encodeBinary(Buffer, Object.Client);
+}
+DECODE(DataSocket)
+{
+  auto Client = monomux::message::ClientID::decodeBinary(Buffer);
+  if (!Client)
+    return std::nullopt;
+  return DataSocket{*Client};
+}
+
+ENCODE(DataSocketPair)
+{
+  if (Object.Process)
+    Buffer.integer(*Object.Process);
+}
+DECODE(DataSocketPair)
+{
+  DataSocketPair Ret;
+  if (Buffer.remaining())
+    Ret.Process = Buffer.integer<std::int64_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(SessionList)
+{
+  // A request for the entire list is kept empty, as it used to be.
+  if (Object.Prefix.empty() && !Object.Offset && !Object.Limit)
+    return;
+
+  Buffer.string(Object.Prefix);
+  Buffer.integer<std::uint64_t>(Object.Offset);
+  Buffer.boolean(Object.Limit.has_value());
+  if (Object.Limit)
+    Buffer.integer<std::uint64_t>(*Object.Limit);
+}
+DECODE(SessionList)
+{
+  SessionList Ret;
+  if (!Buffer.remaining())
+    return Ret;
+
+  Ret.Prefix = Buffer.string();
+  Ret.Offset = Buffer.integer<std::uint64_t>();
+  if (Buffer.boolean())
+    Ret.Limit = Buffer.integer<std::uint64_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(MakeSession)
+{
+  Buffer.string(Object.Name);
+  monomux::message::ProcessSpawnOptions::encodeBinary(Buffer,
+                                                      Object.SpawnOpts);
+  Buffer.boolean(Object.ScrollbackSize.has_value());
+  if (Object.ScrollbackSize)
+    Buffer.integer<std::uint64_t>(*Object.ScrollbackSize);
+  Buffer.boolean(Object.CoalesceWindow.has_value());
+  if (Object.CoalesceWindow)
+    Buffer.integer<std::uint64_t>(*Object.CoalesceWindow);
+  Buffer.boolean(Object.RateLimit.has_value());
+  if (Object.RateLimit)
+    Buffer.integer<std::uint64_t>(*Object.RateLimit);
+}
+DECODE(MakeSession)
+{
+  MakeSession Ret;
+  Ret.Name = Buffer.string();
+
+  auto Spawn = monomux::message::ProcessSpawnOptions::decodeBinary(Buffer);
+  if (!Spawn)
+    return std::nullopt;
+  Ret.SpawnOpts = std::move(*Spawn);
+
+  if (Buffer.boolean())
+    Ret.ScrollbackSize = Buffer.integer<std::uint64_t>();
+  if (Buffer.boolean())
+    Ret.CoalesceWindow = Buffer.integer<std::uint64_t>();
+  if (Buffer.boolean())
+    Ret.RateLimit = Buffer.integer<std::uint64_t>();
+
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Attach)
+{
+  Buffer.string(Object.Name);
+  Buffer.boolean(Object.Observer);
+  // The resumption and the policies after it are only encoded if requested,
+  // so the request of clients that do not use them is unchanged.
+  if (!Object.Resumable && !Object.ResumeFrom && !Object.CatchUp)
+    return;
+  Buffer.boolean(Object.Resumable);
+  Buffer.boolean(Object.ResumeFrom.has_value());
+  if (Object.ResumeFrom)
+  {
+    Buffer.integer<std::uint64_t>(*Object.ResumeFrom);
+    Buffer.integer(static_cast<std::int64_t>(Object.ResumeCreated));
+  }
+  if (Object.CatchUp)
+    Buffer.boolean(true);
+}
+DECODE(Attach)
+{
+  Attach Ret;
+  Ret.Name = Buffer.string();
+  Ret.Observer = Buffer.boolean();
+  if (Buffer.good() && Buffer.remaining())
+  {
+    Ret.Resumable = Buffer.boolean();
+    if (Buffer.boolean())
+    {
+      Ret.ResumeFrom = Buffer.integer<std::uint64_t>();
+      Ret.ResumeCreated =
+        static_cast<std::time_t>(Buffer.integer<std::int64_t>());
+    }
+    if (Buffer.good() && Buffer.remaining())
+      Ret.CatchUp = Buffer.boolean();
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Detach) { Buffer.integer(static_cast<std::uint8_t>(Object.Mode)); }
+DECODE(Detach)
+{
+  Detach Ret;
+  switch (Buffer.integer<std::uint8_t>())
+  {
+    case Latest:
+      Ret.Mode = Latest;
+      break;
+    case All:
+      Ret.Mode = All;
+      break;
+    default:
+      return std::nullopt;
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Signal) { Buffer.integer(static_cast<std::int32_t>(Object.SigNum)); }
+DECODE(Signal)
+{
+  Signal Ret;
+  Ret.SigNum = Buffer.integer<std::int32_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Statistics)
+{
+  // The flag is only encoded if set, so the request of clients that do not
+  // stream is unchanged.
+  if (Object.Streamed)
+    Buffer.boolean(true);
+}
+DECODE(Statistics)
+{
+  Statistics Ret;
+  Ret.Streamed = readTrailingFlag(Buffer);
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Protocol) { Buffer.integer(Object.BinaryVersion); }
+DECODE(Protocol)
+{
+  Protocol Ret;
+  Ret.BinaryVersion = Buffer.integer<std::uint8_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Subscribe)
+{
+  (void)Buffer;
+  (void)Object;
+}
+DECODE(Subscribe)
+{
+  (void)Buffer;
+  return Subscribe{};
+}
+
+ENCODE(SharedOutput)
+{
+  (void)Buffer;
+  (void)Object;
+}
+DECODE(SharedOutput)
+{
+  (void)Buffer;
+  return SharedOutput{};
+}
+
+ENCODE(Compression)
+{
+  (void)Buffer;
+  (void)Object;
+}
+DECODE(Compression)
+{
+  (void)Buffer;
+  return Compression{};
+}
+
+ENCODE(PtyHandOff)
+{
+  (void)Buffer;
+  (void)Object;
+}
+DECODE(PtyHandOff)
+{
+  (void)Buffer;
+  return PtyHandOff{};
+}
+
+ENCODE(Metrics)
+{
+  // The flag is only encoded if set, so the request of clients that do not
+  // stream is unchanged.
+  if (Object.Streamed)
+    Buffer.boolean(true);
+}
+DECODE(Metrics)
+{
+  Metrics Ret;
+  Ret.Streamed = readTrailingFlag(Buffer);
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Trace)
+{
+  // The flag is only encoded if set, so the request of clients that do not
+  // stream is unchanged.
+  if (Object.Streamed)
+    Buffer.boolean(true);
+}
+DECODE(Trace)
+{
+  Trace Ret;
+  Ret.Streamed = readTrailingFlag(Buffer);
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(RateLimit) { Buffer.integer<std::uint64_t>(Object.BytesPerSecond); }
+DECODE(RateLimit)
+{
+  RateLimit Ret;
+  Ret.BytesPerSecond = Buffer.integer<std::uint64_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(OpenChannel)
+{
+  Buffer.string(Object.Name);
+  Buffer.boolean(Object.Observer);
+}
+DECODE(OpenChannel)
+{
+  OpenChannel Ret;
+  Ret.Name = Buffer.string();
+  Ret.Observer = Buffer.boolean();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Search)
+{
+  Buffer.string(Object.Pattern);
+  Buffer.string(Object.Session);
+  Buffer.integer<std::uint64_t>(Object.MaxMatches);
+}
+DECODE(Search)
+{
+  Search Ret;
+  Ret.Pattern = Buffer.string();
+  Ret.Session = Buffer.string();
+  Ret.MaxMatches = Buffer.integer<std::uint64_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+} // namespace request
+
+namespace response
+{
+
+ENCODE(ClientID)
+{
+  monomux::message::ClientID::encodeBinary(Buffer, Object.Client);
+}
+DECODE(ClientID)
+{
+  auto Client = monomux::message::ClientID::decodeBinary(Buffer);
+  if (!Client)
+    return std::nullopt;
+  return ClientID{*Client};
+}
+
+ENCODE(DataSocket)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+}
+DECODE(DataSocket)
+{
+  auto Success = monomux::message::Boolean::decodeBinary(Buffer);
+  if (!Success)
+    return std::nullopt;
+  return DataSocket{*Success};
+}
+
+ENCODE(DataSocketPair)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+}
+DECODE(DataSocketPair)
+{
+  auto Success = monomux::message::Boolean::decodeBinary(Buffer);
+  if (!Success)
+    return std::nullopt;
+  return DataSocketPair{*Success};
+}
+
+ENCODE(SessionList)
+{
+  Buffer.integer(static_cast<std::uint32_t>(Object.Sessions.size()));
+  for (const SessionData& SD : Object.Sessions)
+    monomux::message::SessionData::encodeBinary(Buffer, SD);
+  // The paging information is only sent in response to paged requests, so
+  // the response to the request for the entire list is unchanged.
+  if (Object.Total)
+  {
+    Buffer.integer<std::uint64_t>(*Object.Total);
+    Buffer.boolean(Object.More);
+  }
+}
+DECODE(SessionList)
+{
+  SessionList Ret;
+  std::size_t Count = 0;
+  Ret.Sessions.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    auto SD = monomux::message::SessionData::decodeBinary(Buffer);
+    if (!SD)
+      return std::nullopt;
+    Ret.Sessions.emplace_back(*std::move(SD));
+  }
+  if (Buffer.good() && Buffer.remaining())
+  {
+    Ret.Total = Buffer.integer<std::uint64_t>();
+    Ret.More = Buffer.boolean();
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(MakeSession)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+  Buffer.string(Object.Name);
+}
+DECODE(MakeSession)
+{
+  MakeSession Ret;
+  Ret.Success = Buffer.boolean();
+  Ret.Name = Buffer.string();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Attach)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+  if (Object.Success)
+    monomux::message::SessionData::encodeBinary(Buffer, Object.Session);
+  if (Object.Success && Object.Offset)
+    Buffer.integer<std::uint64_t>(*Object.Offset);
+}
+DECODE(Attach)
+{
+  Attach Ret;
+  Ret.Success = Buffer.boolean();
+  if (Ret.Success)
+  {
+    auto Session = monomux::message::SessionData::decodeBinary(Buffer);
+    if (!Session)
+      return std::nullopt;
+    Ret.Session = std::move(*Session);
+    if (Buffer.good() && Buffer.remaining())
+      Ret.Offset = Buffer.integer<std::uint64_t>();
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Detach)
+{
+  (void)Buffer;
+  (void)Object;
+}
+DECODE(Detach)
+{
+  (void)Buffer;
+  return Detach{};
+}
+
+ENCODE(Statistics)
+{
+  Buffer.string(Object.Contents);
+  if (Object.More)
+    Buffer.boolean(true);
+}
+DECODE(Statistics)
+{
+  Statistics Ret;
+  Ret.Contents = Buffer.string();
+  Ret.More = readTrailingFlag(Buffer);
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Protocol) { Buffer.integer(Object.BinaryVersion); }
+DECODE(Protocol)
+{
+  Protocol Ret;
+  Ret.BinaryVersion = Buffer.integer<std::uint8_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Subscribe)
+{
+  Buffer.integer(static_cast<std::uint32_t>(Object.Sessions.size()));
+  for (const SessionData& SD : Object.Sessions)
+    monomux::message::SessionData::encodeBinary(Buffer, SD);
+}
+DECODE(Subscribe)
+{
+  Subscribe Ret;
+  std::size_t Count = 0;
+  Ret.Sessions.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    auto SD = monomux::message::SessionData::decodeBinary(Buffer);
+    if (!SD)
+      return std::nullopt;
+    Ret.Sessions.emplace_back(*std::move(SD));
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(SharedOutput)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+}
+DECODE(SharedOutput)
+{
+  auto Success = monomux::message::Boolean::decodeBinary(Buffer);
+  if (!Success)
+    return std::nullopt;
+  return SharedOutput{*Success};
+}
+
+ENCODE(Compression)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+}
+DECODE(Compression)
+{
+  auto Success = monomux::message::Boolean::decodeBinary(Buffer);
+  if (!Success)
+    return std::nullopt;
+  return Compression{*Success};
+}
+
+ENCODE(PtyHandOff)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+}
+DECODE(PtyHandOff)
+{
+  auto Success = monomux::message::Boolean::decodeBinary(Buffer);
+  if (!Success)
+    return std::nullopt;
+  return PtyHandOff{*Success};
+}
+
+ENCODE(Metrics)
+{
+  Buffer.integer(static_cast<std::uint32_t>(Object.Samples.size()));
+  for (const Metric& M : Object.Samples)
+    monomux::message::Metric::encodeBinary(Buffer, M);
+  if (Object.More)
+    Buffer.boolean(true);
+}
+DECODE(Metrics)
+{
+  Metrics Ret;
+  std::size_t Count = 0;
+  Ret.Samples.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    auto M = monomux::message::Metric::decodeBinary(Buffer);
+    if (!M)
+      return std::nullopt;
+    Ret.Samples.emplace_back(*std::move(M));
+  }
+  Ret.More = readTrailingFlag(Buffer);
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Trace)
+{
+  Buffer.integer(static_cast<std::uint32_t>(Object.Records.size()));
+  for (const trace::Record& R : Object.Records)
+  {
+    Buffer.integer<std::uint64_t>(R.Timestamp);
+    Buffer.integer<std::int32_t>(R.FD);
+    Buffer.integer(static_cast<std::uint16_t>(R.Id));
+    Buffer.integer<std::uint16_t>(R.Thread);
+    Buffer.integer<std::uint64_t>(R.Requested);
+    Buffer.integer<std::uint64_t>(R.Bytes);
+  }
+  if (Object.More)
+    Buffer.boolean(true);
+}
+DECODE(Trace)
+{
+  Trace Ret;
+  std::size_t Count = 0;
+  Ret.Records.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count && Buffer.good(); ++I)
+  {
+    trace::Record R{};
+    R.Timestamp = Buffer.integer<std::uint64_t>();
+    R.FD = Buffer.integer<std::int32_t>();
+    const auto EventId = Buffer.integer<std::uint16_t>();
+    if (EventId >= trace::EventCount)
+      return std::nullopt;
+    R.Id = static_cast<trace::Event>(EventId);
+    R.Thread = Buffer.integer<std::uint16_t>();
+    R.Requested = Buffer.integer<std::uint64_t>();
+    R.Bytes = Buffer.integer<std::uint64_t>();
+    Ret.Records.emplace_back(R);
+  }
+  Ret.More = readTrailingFlag(Buffer);
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(RateLimit)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+}
+DECODE(RateLimit)
+{
+  auto Success = monomux::message::Boolean::decodeBinary(Buffer);
+  if (!Success)
+    return std::nullopt;
+  return RateLimit{*Success};
+}
+
+ENCODE(OpenChannel)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+  if (Object.Success)
+  {
+    Buffer.integer<std::uint16_t>(Object.Channel);
+    monomux::message::SessionData::encodeBinary(Buffer, Object.Session);
+  }
+}
+DECODE(OpenChannel)
+{
+  OpenChannel Ret;
+  Ret.Success = Buffer.boolean();
+  if (Ret.Success)
+  {
+    Ret.Channel = Buffer.integer<std::uint16_t>();
+    auto Session = monomux::message::SessionData::decodeBinary(Buffer);
+    if (!Session)
+      return std::nullopt;
+    Ret.Session = std::move(*Session);
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Search)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Success);
+  Buffer.integer(static_cast<std::uint32_t>(Object.Matches.size()));
+  for (const SearchMatch& M : Object.Matches)
+    monomux::message::SearchMatch::encodeBinary(Buffer, M);
+  Buffer.boolean(Object.Truncated);
+}
+DECODE(Search)
+{
+  Search Ret;
+  Ret.Success = Buffer.boolean();
+  std::size_t Count = 0;
+  Ret.Matches.reserve(readCount(Buffer, Count));
+  for (std::size_t I = 0; I < Count; ++I)
+  {
+    auto M = monomux::message::SearchMatch::decodeBinary(Buffer);
+    if (!M)
+      return std::nullopt;
+    Ret.Matches.emplace_back(*std::move(M));
+  }
+  Ret.Truncated = Buffer.boolean();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+} // namespace response
+
+namespace notification
+{
+
+ENCODE(Connection)
+{
+  monomux::message::Boolean::encodeBinary(Buffer, Object.Accepted);
+  if (!Object.Accepted)
+    Buffer.string(Object.Reason);
+}
+DECODE(Connection)
+{
+  Connection Ret;
+  Ret.Accepted = Buffer.boolean();
+  if (!Ret.Accepted)
+    Ret.Reason = Buffer.string();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Detached)
+{
+  Buffer.integer(static_cast<std::uint8_t>(Object.Mode));
+  if (Object.Mode == Exit)
+    Buffer.integer(static_cast<std::int32_t>(Object.ExitCode));
+  if (Object.Mode == Kicked)
+    Buffer.string(Object.Reason);
+}
+DECODE(Detached)
+{
+  Detached Ret;
+  switch (Buffer.integer<std::uint8_t>())
+  {
+    case Detach:
+      Ret.Mode = Detach;
+      break;
+    case Exit:
+      Ret.Mode = Exit;
+      Ret.ExitCode = Buffer.integer<std::int32_t>();
+      break;
+    case ServerShutdown:
+      Ret.Mode = ServerShutdown;
+      break;
+    case Kicked:
+      Ret.Mode = Kicked;
+      Ret.Reason = Buffer.string();
+      break;
+    case ServerUpgrade:
+      Ret.Mode = ServerUpgrade;
+      break;
+    default:
+      return std::nullopt;
+  }
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(Redraw)
+{
+  Buffer.integer<std::uint16_t>(Object.Rows);
+  Buffer.integer<std::uint16_t>(Object.Columns);
+}
+DECODE(Redraw)
+{
+  Redraw Ret;
+  Ret.Rows = Buffer.integer<std::uint16_t>();
+  Ret.Columns = Buffer.integer<std::uint16_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(CloseChannel) { Buffer.integer<std::uint16_t>(Object.Channel); }
+DECODE(CloseChannel)
+{
+  CloseChannel Ret;
+  Ret.Channel = Buffer.integer<std::uint16_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(ChannelClosed)
+{
+  Buffer.integer<std::uint16_t>(Object.Channel);
+  Detached::encodeBinary(Buffer, Object.Reason);
+}
+DECODE(ChannelClosed)
+{
+  ChannelClosed Ret;
+  Ret.Channel = Buffer.integer<std::uint16_t>();
+  auto Reason = Detached::decodeBinary(Buffer);
+  if (!Reason)
+    return std::nullopt;
+  Ret.Reason = std::move(*Reason);
+  return Ret;
+}
+
+ENCODE(ChannelRedraw)
+{
+  Buffer.integer<std::uint16_t>(Object.Channel);
+  Buffer.integer<std::uint16_t>(Object.Rows);
+  Buffer.integer<std::uint16_t>(Object.Columns);
+}
+DECODE(ChannelRedraw)
+{
+  ChannelRedraw Ret;
+  Ret.Channel = Buffer.integer<std::uint16_t>();
+  Ret.Rows = Buffer.integer<std::uint16_t>();
+  Ret.Columns = Buffer.integer<std::uint16_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+ENCODE(SessionEvent)
+{
+  Buffer.integer(static_cast<std::uint8_t>(Object.Event));
+  monomux::message::SessionData::encodeBinary(Buffer, Object.Session);
+  Buffer.integer(static_cast<std::uint32_t>(Object.AttachedClients));
+}
+DECODE(SessionEvent)
+{
+  SessionEvent Ret;
+  switch (Buffer.integer<std::uint8_t>())
+  {
+    case Created:
+      Ret.Event = Created;
+      break;
+    case Destroyed:
+      Ret.Event = Destroyed;
+      break;
+    case Attached:
+      Ret.Event = Attached;
+      break;
+    case Detached:
+      Ret.Event = Detached;
+      break;
+    default:
+      return std::nullopt;
+  }
+  auto Session = monomux::message::SessionData::decodeBinary(Buffer);
+  if (!Session)
+    return std::nullopt;
+  Ret.Session = std::move(*Session);
+  Ret.AttachedClients = Buffer.integer<std::uint32_t>();
+  GOOD_OR_NONE;
+  return Ret;
+}
+
+} // namespace notification
+
+} // namespace monomux::message
+
+#undef GOOD_OR_NONE
+#undef ENCODE
+#undef DECODE
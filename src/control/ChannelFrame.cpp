@@ -0,0 +1,55 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "monomux/control/ChannelFrame.hpp"
+#include "monomux/control/MessageBase.hpp"
+
+namespace monomux::message
+{
+
+void appendChannelFrames(std::string& Buffer,
+                         ChannelID Channel,
+                         std::string_view Data)
+{
+  char ChannelBytes[sizeof(ChannelID)];
+  std::memcpy(ChannelBytes, &Channel, sizeof(ChannelID));
+  while (!Data.empty())
+  {
+    const std::size_t Size = std::min(Data.size(), ChannelFrameDataMax);
+    Buffer.append(Message::sizeToBinaryString(sizeof(ChannelID) + Size));
+    Buffer.append(ChannelBytes, sizeof(ChannelID));
+    Buffer.append(Data.substr(0, Size));
+    Data.remove_prefix(Size);
+  }
+}
+
+std::optional<std::pair<ChannelID, std::string_view>>
+decodeChannelFrame(std::string_view Payload) noexcept
+{
+  if (Payload.size() < sizeof(ChannelID))
+    return std::nullopt;
+  ChannelID Channel;
+  std::memcpy(&Channel, Payload.data(), sizeof(ChannelID));
+  Payload.remove_prefix(sizeof(ChannelID));
+  return std::make_pair(Channel, Payload);
+}
+
+} // namespace monomux::message
@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "monomux/control/MessageBase.hpp"
+#include "monomux/system/Compress.hpp"
+
+#include "monomux/control/CompressedFrame.hpp"
+
+namespace monomux::message
+{
+
+void appendCompressedFrames(std::string& Buffer, std::string_view Data)
+{
+  while (!Data.empty())
+  {
+    const std::string_view Chunk =
+      Data.substr(0, std::min(Data.size(), CompressedFrameDataMax));
+    Data.remove_prefix(Chunk.size());
+
+    const auto Size = static_cast<std::uint32_t>(Chunk.size());
+    char SizeBytes[sizeof(Size)];
+    std::memcpy(SizeBytes, &Size, sizeof(Size));
+
+    std::string Compressed = compress::compressBlock(Chunk);
+    const std::string_view Body =
+      Compressed.size() < Chunk.size() ? std::string_view{Compressed} : Chunk;
+    Buffer.append(Message::sizeToBinaryString(sizeof(Size) + Body.size()));
+    Buffer.append(SizeBytes, sizeof(Size));
+    Buffer.append(Body);
+  }
+}
+
+std::optional<std::string>
+decodeCompressedFrame(std::string_view Payload) noexcept
+{
+  std::uint32_t Size;
+  if (Payload.size() < sizeof(Size))
+    return std::nullopt;
+  std::memcpy(&Size, Payload.data(), sizeof(Size));
+  Payload.remove_prefix(sizeof(Size));
+  if (Size > CompressedFrameDataMax)
+    return std::nullopt;
+
+  try
+  {
+    if (Payload.size() == Size)
+      return std::string{Payload};
+    return compress::decompressBlock(Payload, Size);
+  }
+  catch (const std::bad_alloc&)
+  {
+    return std::nullopt;
+  }
+}
+
+} // namespace monomux::message
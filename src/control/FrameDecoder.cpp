@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string_view>
+#include <utility>
+
+#include "monomux/control/FrameDecoder.hpp"
+#include "monomux/control/MessageBase.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("control/FrameDecoder")
+
+namespace monomux::message
+{
+
+std::optional<std::string> FrameDecoder::next(BufferedChannel& Channel)
+{
+  if (Corrupt)
+    return std::nullopt;
+
+  if (!SizeKnown)
+  {
+    SizePrefixRead += Channel.readInto(SizePrefix.data() + SizePrefixRead,
+                                       SizePrefix.size() - SizePrefixRead);
+    if (SizePrefixRead < SizePrefix.size())
+      return std::nullopt;
+
+    Size = Message::binaryStringToSize(
+      std::string_view{SizePrefix.data(), SizePrefix.size()});
+    SizePrefixRead = 0;
+    if (Size > MaxFrameSize)
+    {
+      LOG(error) << "When reading a frame, got a prefix of " << Size
+                 << " that was deemed too large (>= " << MaxFrameSize
+                 << "). This is likely due to memory corruption.";
+      Corrupt = true;
+      return std::nullopt;
+    }
+    SizeKnown = true;
+    Payload.resize(Size);
+    PayloadRead = 0;
+  }
+
+  if (PayloadRead < Size)
+    PayloadRead +=
+      Channel.readInto(Payload.data() + PayloadRead, Size - PayloadRead);
+  if (PayloadRead < Size)
+    return std::nullopt;
+
+  SizeKnown = false;
+  std::string Frame;
+  std::swap(Frame, Payload);
+  return Frame;
+}
+
+} // namespace monomux::message
+
+#undef LOG
@@ -19,13 +19,15 @@
 #include <cstring>
 #include <sstream>
 
+#include "monomux/control/FrameDecoder.hpp"
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
 
 #include "monomux/Log.hpp"
 #define LOG(SEVERITY) monomux::log::SEVERITY("control/Message")
 
-#define DECODE(NAME) std::optional<NAME> NAME::decode(std::string_view Buffer)
+#define DECODE(NAME)                                                           \
+  std::optional<NAME> NAME::decodeText(std::string_view Buffer)
 #define ENCODE(NAME) std::string NAME::encode(const NAME& Object)
 
 #define DECODE_BASE(NAME)                                                      \
@@ -111,7 +113,9 @@ Message Message::unpack(std::string_view Str) noexcept
 
 std::string readPascalString(BufferedChannel& Channel)
 {
-  static constexpr std::size_t MaxMeaningfulMessageSize = 1 << 24;
+  MONOMUX_ALLOCATION_SCOPE(Message);
+  static constexpr std::size_t MaxMeaningfulMessageSize =
+    FrameDecoder::MaxFrameSize;
 
   std::string SizeStr = Channel.read(sizeof(std::size_t));
   std::size_t Size = Message::binaryStringToSize(SizeStr);
@@ -384,6 +388,38 @@ DECODE_BASE(SessionData)
   return Ret;
 }
 
+ENCODE_BASE(SessionStatus)
+{
+  std::ostringstream Buf;
+  Buf << "<SESSION-STATUS>";
+  Buf << monomux::message::SessionData::encode(Object.Session);
+  Buf << "<ATTACHED>" << Object.AttachedClients << "</ATTACHED>";
+  Buf << "<ACTIVE>" << Object.LastActive << "</ACTIVE>";
+  Buf << "</SESSION-STATUS>";
+  return Buf.str();
+}
+DECODE_BASE(SessionStatus)
+{
+  SessionStatus Ret;
+  HEADER_OR_NONE("<SESSION-STATUS>");
+
+  auto Session = monomux::message::SessionData::decode(View);
+  if (!Session)
+    return std::nullopt;
+  Ret.Session = std::move(*Session);
+
+  CONSUME_OR_NONE("<ATTACHED>");
+  EXTRACT_OR_NONE(Attached, "</ATTACHED>");
+  Ret.AttachedClients = std::stoull(std::string{Attached});
+
+  CONSUME_OR_NONE("<ACTIVE>");
+  EXTRACT_OR_NONE(Active, "</ACTIVE>");
+  Ret.LastActive = static_cast<std::time_t>(std::stoll(std::string{Active}));
+
+  BASE_FOOTER_OR_NONE("</SESSION-STATUS>");
+  return Ret;
+}
+
 ENCODE_BASE(Boolean) { return Object.Value ? "<TRUE />" : "<FALSE />"; }
 DECODE_BASE(Boolean)
 {
@@ -397,6 +433,153 @@ DECODE_BASE(Boolean)
   return Ret;
 }
 
+ENCODE_BASE(Metric)
+{
+  std::ostringstream Buf;
+  Buf << "<METRIC>";
+  Buf << "<KIND>";
+  switch (Object.Type)
+  {
+    case Metric::Counter:
+      Buf << "Counter";
+      break;
+    case Metric::Gauge:
+      Buf << "Gauge";
+      break;
+    case Metric::Histogram:
+      Buf << "Histogram";
+      break;
+  }
+  Buf << "</KIND>";
+  Buf << "<NAME>" << Object.Name << "</NAME>";
+  Buf << "<LABELS Count=\"" << Object.Labels.size() << "\">";
+  for (const std::pair<std::string, std::string>& Label : Object.Labels)
+  {
+    Buf << "<LABEL>";
+    Buf << "<KEY Size=\"" << Label.first.size() << "\">" << Label.first
+        << "</KEY>";
+    Buf << "<VAL Size=\"" << Label.second.size() << "\">" << Label.second
+        << "</VAL>";
+    Buf << "</LABEL>";
+  }
+  Buf << "</LABELS>";
+  Buf << "<VALUE>" << Object.Value << "</VALUE>";
+  Buf << "<BUCKETS Count=\"" << Object.Buckets.size() << "\">";
+  for (std::uint64_t Bucket : Object.Buckets)
+    Buf << "<B>" << Bucket << "</B>";
+  Buf << "</BUCKETS>";
+  Buf << "</METRIC>";
+  return Buf.str();
+}
+DECODE_BASE(Metric)
+{
+  Metric Ret;
+  HEADER_OR_NONE("<METRIC>");
+
+  CONSUME_OR_NONE("<KIND>");
+  EXTRACT_OR_NONE(Kind, "</KIND>");
+  if (Kind == "Counter")
+    Ret.Type = Metric::Counter;
+  else if (Kind == "Gauge")
+    Ret.Type = Metric::Gauge;
+  else if (Kind == "Histogram")
+    Ret.Type = Metric::Histogram;
+  else
+    return std::nullopt;
+
+  CONSUME_OR_NONE("<NAME>");
+  EXTRACT_OR_NONE(Name, "</NAME>");
+  Ret.Name = Name;
+
+  {
+    CONSUME_OR_NONE("<LABELS Count=\"");
+    EXTRACT_OR_NONE(LabelCount, "\">");
+    std::size_t LabelC = std::stoull(std::string{LabelCount});
+    Ret.Labels.resize(LabelC);
+    for (std::size_t I = 0; I < LabelC; ++I)
+    {
+      CONSUME_OR_NONE("<LABEL>");
+
+      CONSUME_OR_NONE("<KEY Size=\"");
+      EXTRACT_OR_NONE(KeySize, "\">");
+      if (std::size_t S = std::stoull(std::string{KeySize}))
+        Ret.Labels.at(I).first = splice(View, S);
+      CONSUME_OR_NONE("</KEY>");
+
+      CONSUME_OR_NONE("<VAL Size=\"");
+      EXTRACT_OR_NONE(ValSize, "\">");
+      if (std::size_t S = std::stoull(std::string{ValSize}))
+        Ret.Labels.at(I).second = splice(View, S);
+      CONSUME_OR_NONE("</VAL>");
+
+      CONSUME_OR_NONE("</LABEL>");
+    }
+    CONSUME_OR_NONE("</LABELS>");
+  }
+
+  CONSUME_OR_NONE("<VALUE>");
+  EXTRACT_OR_NONE(Value, "</VALUE>");
+  Ret.Value = std::stoull(std::string{Value});
+
+  {
+    CONSUME_OR_NONE("<BUCKETS Count=\"");
+    EXTRACT_OR_NONE(BucketCount, "\">");
+    std::size_t BucketC = std::stoull(std::string{BucketCount});
+    Ret.Buckets.resize(BucketC);
+    for (std::size_t I = 0; I < BucketC; ++I)
+    {
+      CONSUME_OR_NONE("<B>");
+      EXTRACT_OR_NONE(Bucket, "</B>");
+      Ret.Buckets.at(I) = std::stoull(std::string{Bucket});
+    }
+    CONSUME_OR_NONE("</BUCKETS>");
+  }
+
+  BASE_FOOTER_OR_NONE("</METRIC>");
+  return Ret;
+}
+
+ENCODE_BASE(SearchMatch)
+{
+  std::ostringstream Buf;
+  Buf << "<MATCH>";
+  Buf << "<SESSION Size=\"" << Object.Session.size() << "\">" << Object.Session
+      << "</SESSION>";
+  Buf << "<OFFSET>" << Object.Offset << "</OFFSET>";
+  Buf << "<CONTEXT Size=\"" << Object.Context.size() << "\">" << Object.Context
+      << "</CONTEXT>";
+  Buf << "</MATCH>";
+  return Buf.str();
+}
+DECODE_BASE(SearchMatch)
+{
+  SearchMatch Ret;
+  HEADER_OR_NONE("<MATCH>");
+
+  CONSUME_OR_NONE("<SESSION Size=\"");
+  {
+    EXTRACT_OR_NONE(SessionSize, "\">");
+    if (std::size_t S = std::stoull(std::string{SessionSize}))
+      Ret.Session = splice(View, S);
+  }
+  CONSUME_OR_NONE("</SESSION>");
+
+  CONSUME_OR_NONE("<OFFSET>");
+  EXTRACT_OR_NONE(Offset, "</OFFSET>");
+  Ret.Offset = std::stoull(std::string{Offset});
+
+  CONSUME_OR_NONE("<CONTEXT Size=\"");
+  {
+    EXTRACT_OR_NONE(ContextSize, "\">");
+    if (std::size_t S = std::stoull(std::string{ContextSize}))
+      Ret.Context = splice(View, S);
+  }
+  CONSUME_OR_NONE("</CONTEXT>");
+
+  BASE_FOOTER_OR_NONE("</MATCH>");
+  return Ret;
+}
+
 #undef BASE_FOOTER_OR_NONE
 #define FOOTER_OR_NONE(LITERAL)                                                \
   if (View != (LITERAL))                                                       \
@@ -441,16 +624,76 @@ DECODE(DataSocket)
   return Ret;
 }
 
+ENCODE(DataSocketPair)
+{
+  if (!Object.Process)
+    return "<DATASOCKET-PAIR />";
+  std::ostringstream Buf;
+  Buf << "<DATASOCKET-PAIR>";
+  Buf << "<PID>" << *Object.Process << "</PID>";
+  Buf << "</DATASOCKET-PAIR>";
+  return Buf.str();
+}
+DECODE(DataSocketPair)
+{
+  if (Buffer == "<DATASOCKET-PAIR />")
+    return DataSocketPair{};
+
+  DataSocketPair Ret;
+  HEADER_OR_NONE("<DATASOCKET-PAIR>");
+
+  CONSUME_OR_NONE("<PID>");
+  EXTRACT_OR_NONE(Process, "</PID>");
+  Ret.Process = std::stoll(std::string{Process});
+
+  FOOTER_OR_NONE("</DATASOCKET-PAIR>");
+  return Ret;
+}
+
 ENCODE(SessionList)
 {
-  (void)Object;
-  return "<SESSION-LIST />";
+  if (Object.Prefix.empty() && !Object.Offset && !Object.Limit)
+    return "<SESSION-LIST />";
+
+  std::ostringstream Buf;
+  Buf << "<SESSION-LIST>";
+  if (!Object.Prefix.empty())
+    Buf << "<PREFIX>" << Object.Prefix << "</PREFIX>";
+  if (Object.Offset)
+    Buf << "<OFFSET>" << Object.Offset << "</OFFSET>";
+  if (Object.Limit)
+    Buf << "<LIMIT>" << *Object.Limit << "</LIMIT>";
+  Buf << "</SESSION-LIST>";
+  return Buf.str();
 }
 DECODE(SessionList)
 {
   if (Buffer == "<SESSION-LIST />")
     return SessionList{};
-  return std::nullopt;
+
+  SessionList Ret;
+  HEADER_OR_NONE("<SESSION-LIST>");
+
+  PEEK_AND_CONSUME("<PREFIX>")
+  {
+    EXTRACT_OR_NONE(Prefix, "</PREFIX>");
+    Ret.Prefix = Prefix;
+  }
+
+  PEEK_AND_CONSUME("<OFFSET>")
+  {
+    EXTRACT_OR_NONE(Offset, "</OFFSET>");
+    Ret.Offset = std::stoull(std::string{Offset});
+  }
+
+  PEEK_AND_CONSUME("<LIMIT>")
+  {
+    EXTRACT_OR_NONE(Limit, "</LIMIT>");
+    Ret.Limit = std::stoull(std::string{Limit});
+  }
+
+  FOOTER_OR_NONE("</SESSION-LIST>");
+  return Ret;
 }
 
 ENCODE(MakeSession)
@@ -462,6 +705,12 @@ ENCODE(MakeSession)
   else
     Buf << "<NAME>" << Object.Name << "</NAME>";
   Buf << monomux::message::ProcessSpawnOptions::encode(Object.SpawnOpts);
+  if (Object.ScrollbackSize)
+    Buf << "<SCROLLBACK>" << *Object.ScrollbackSize << "</SCROLLBACK>";
+  if (Object.CoalesceWindow)
+    Buf << "<COALESCE>" << *Object.CoalesceWindow << "</COALESCE>";
+  if (Object.RateLimit)
+    Buf << "<RATE-LIMIT>" << *Object.RateLimit << "</RATE-LIMIT>";
   Buf << "</MAKE-SESSION>";
   return Buf.str();
 }
@@ -482,6 +731,24 @@ DECODE(MakeSession)
     return std::nullopt;
   Ret.SpawnOpts = std::move(*Spawn);
 
+  PEEK_AND_CONSUME("<SCROLLBACK>")
+  {
+    EXTRACT_OR_NONE(Scrollback, "</SCROLLBACK>");
+    Ret.ScrollbackSize = std::stoull(std::string{Scrollback});
+  }
+
+  PEEK_AND_CONSUME("<COALESCE>")
+  {
+    EXTRACT_OR_NONE(Coalesce, "</COALESCE>");
+    Ret.CoalesceWindow = std::stoull(std::string{Coalesce});
+  }
+
+  PEEK_AND_CONSUME("<RATE-LIMIT>")
+  {
+    EXTRACT_OR_NONE(Rate, "</RATE-LIMIT>");
+    Ret.RateLimit = std::stoull(std::string{Rate});
+  }
+
   FOOTER_OR_NONE("</MAKE-SESSION>");
   return Ret;
 }
@@ -491,6 +758,15 @@ ENCODE(Attach)
   std::ostringstream Buf;
   Buf << "<ATTACH>";
   Buf << "<NAME>" << Object.Name << "</NAME>";
+  if (Object.Observer)
+    Buf << "<OBSERVER />";
+  if (Object.Resumable)
+    Buf << "<RESUMABLE />";
+  if (Object.ResumeFrom)
+    Buf << "<RESUME-FROM>" << *Object.ResumeFrom << "</RESUME-FROM>"
+        << "<RESUME-CREATED>" << Object.ResumeCreated << "</RESUME-CREATED>";
+  if (Object.CatchUp)
+    Buf << "<CATCH-UP />";
   Buf << "</ATTACH>";
   return Buf.str();
 }
@@ -503,6 +779,21 @@ DECODE(Attach)
   EXTRACT_OR_NONE(Name, "</NAME>");
   Ret.Name = Name;
 
+  PEEK_AND_CONSUME("<OBSERVER />") { Ret.Observer = true; }
+  PEEK_AND_CONSUME("<RESUMABLE />") { Ret.Resumable = true; }
+
+  PEEK_AND_CONSUME("<RESUME-FROM>")
+  {
+    EXTRACT_OR_NONE(From, "</RESUME-FROM>");
+    Ret.ResumeFrom = std::stoull(std::string{From});
+
+    CONSUME_OR_NONE("<RESUME-CREATED>");
+    EXTRACT_OR_NONE(Created, "</RESUME-CREATED>");
+    Ret.ResumeCreated = std::stoll(std::string{Created});
+  }
+
+  PEEK_AND_CONSUME("<CATCH-UP />") { Ret.CatchUp = true; }
+
   FOOTER_OR_NONE("</ATTACH>");
   return Ret;
 }
@@ -561,16 +852,203 @@ DECODE(Signal)
 
 ENCODE(Statistics)
 {
-  (void)Object;
+  if (Object.Streamed)
+    return "<SEND-STATISTICS><STREAMED /></SEND-STATISTICS>";
   return "<SEND-STATISTICS />";
 }
 DECODE(Statistics)
 {
   if (Buffer == "<SEND-STATISTICS />")
     return Statistics{};
+  if (Buffer == "<SEND-STATISTICS><STREAMED /></SEND-STATISTICS>")
+    return Statistics{/* Streamed =*/true};
   return std::nullopt;
 }
 
+ENCODE(Protocol)
+{
+  std::ostringstream Buf;
+  Buf << "<PROTOCOL><BINARY>" << static_cast<unsigned>(Object.BinaryVersion)
+      << "</BINARY></PROTOCOL>";
+  return Buf.str();
+}
+DECODE(Protocol)
+{
+  Protocol Ret;
+  HEADER_OR_NONE("<PROTOCOL>");
+
+  CONSUME_OR_NONE("<BINARY>");
+  EXTRACT_OR_NONE(Version, "</BINARY>");
+  Ret.BinaryVersion =
+    static_cast<std::uint8_t>(std::stoul(std::string{Version}));
+
+  FOOTER_OR_NONE("</PROTOCOL>");
+  return Ret;
+}
+
+ENCODE(Subscribe)
+{
+  (void)Object;
+  return "<SUBSCRIBE />";
+}
+DECODE(Subscribe)
+{
+  if (Buffer == "<SUBSCRIBE />")
+    return Subscribe{};
+  return std::nullopt;
+}
+
+ENCODE(SharedOutput)
+{
+  (void)Object;
+  return "<SHARED-OUTPUT />";
+}
+DECODE(SharedOutput)
+{
+  if (Buffer == "<SHARED-OUTPUT />")
+    return SharedOutput{};
+  return std::nullopt;
+}
+
+ENCODE(Compression)
+{
+  (void)Object;
+  return "<COMPRESSION />";
+}
+DECODE(Compression)
+{
+  if (Buffer == "<COMPRESSION />")
+    return Compression{};
+  return std::nullopt;
+}
+
+ENCODE(PtyHandOff)
+{
+  (void)Object;
+  return "<PTY-HANDOFF />";
+}
+DECODE(PtyHandOff)
+{
+  if (Buffer == "<PTY-HANDOFF />")
+    return PtyHandOff{};
+  return std::nullopt;
+}
+
+ENCODE(Metrics)
+{
+  if (Object.Streamed)
+    return "<SEND-METRICS><STREAMED /></SEND-METRICS>";
+  return "<SEND-METRICS />";
+}
+DECODE(Metrics)
+{
+  if (Buffer == "<SEND-METRICS />")
+    return Metrics{};
+  if (Buffer == "<SEND-METRICS><STREAMED /></SEND-METRICS>")
+    return Metrics{/* Streamed =*/true};
+  return std::nullopt;
+}
+
+ENCODE(Trace)
+{
+  if (Object.Streamed)
+    return "<SEND-TRACE><STREAMED /></SEND-TRACE>";
+  return "<SEND-TRACE />";
+}
+DECODE(Trace)
+{
+  if (Buffer == "<SEND-TRACE />")
+    return Trace{};
+  if (Buffer == "<SEND-TRACE><STREAMED /></SEND-TRACE>")
+    return Trace{/* Streamed =*/true};
+  return std::nullopt;
+}
+
+ENCODE(RateLimit)
+{
+  std::ostringstream Buf;
+  Buf << "<RATE-LIMIT>" << Object.BytesPerSecond << "</RATE-LIMIT>";
+  return Buf.str();
+}
+DECODE(RateLimit)
+{
+  RateLimit Ret;
+  HEADER_OR_NONE("<RATE-LIMIT>");
+
+  EXTRACT_OR_NONE(Rate, "<");
+  Ret.BytesPerSecond = std::stoull(std::string{Rate});
+
+  FOOTER_OR_NONE("/RATE-LIMIT>");
+  return Ret;
+}
+
+ENCODE(OpenChannel)
+{
+  std::ostringstream Buf;
+  Buf << "<OPEN-CHANNEL>";
+  Buf << "<NAME>" << Object.Name << "</NAME>";
+  if (Object.Observer)
+    Buf << "<OBSERVER />";
+  Buf << "</OPEN-CHANNEL>";
+  return Buf.str();
+}
+DECODE(OpenChannel)
+{
+  OpenChannel Ret;
+  HEADER_OR_NONE("<OPEN-CHANNEL>");
+
+  CONSUME_OR_NONE("<NAME>");
+  EXTRACT_OR_NONE(Name, "</NAME>");
+  Ret.Name = Name;
+
+  PEEK_AND_CONSUME("<OBSERVER />") { Ret.Observer = true; }
+
+  FOOTER_OR_NONE("</OPEN-CHANNEL>");
+  return Ret;
+}
+
+ENCODE(Search)
+{
+  std::ostringstream Buf;
+  Buf << "<SEARCH>";
+  Buf << "<PATTERN Size=\"" << Object.Pattern.size() << "\">" << Object.Pattern
+      << "</PATTERN>";
+  if (!Object.Session.empty())
+    Buf << "<SESSION Size=\"" << Object.Session.size() << "\">"
+        << Object.Session << "</SESSION>";
+  Buf << "<MAX>" << Object.MaxMatches << "</MAX>";
+  Buf << "</SEARCH>";
+  return Buf.str();
+}
+DECODE(Search)
+{
+  Search Ret;
+  HEADER_OR_NONE("<SEARCH>");
+
+  CONSUME_OR_NONE("<PATTERN Size=\"");
+  {
+    EXTRACT_OR_NONE(PatternSize, "\">");
+    if (std::size_t S = std::stoull(std::string{PatternSize}))
+      Ret.Pattern = splice(View, S);
+  }
+  CONSUME_OR_NONE("</PATTERN>");
+
+  PEEK_AND_CONSUME("<SESSION Size=\"")
+  {
+    EXTRACT_OR_NONE(SessionSize, "\">");
+    if (std::size_t S = std::stoull(std::string{SessionSize}))
+      Ret.Session = splice(View, S);
+    CONSUME_OR_NONE("</SESSION>");
+  }
+
+  CONSUME_OR_NONE("<MAX>");
+  EXTRACT_OR_NONE(Max, "</MAX>");
+  Ret.MaxMatches = std::stoull(std::string{Max});
+
+  FOOTER_OR_NONE("</SEARCH>");
+  return Ret;
+}
+
 } // namespace request
 
 namespace response
@@ -625,12 +1103,40 @@ DECODE(DataSocket)
   return Ret;
 }
 
+ENCODE(DataSocketPair)
+{
+  std::ostringstream Buf;
+  Buf << "<DATASOCKET-PAIR>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  Buf << "</DATASOCKET-PAIR>";
+  return Buf.str();
+}
+DECODE(DataSocketPair)
+{
+  DataSocketPair Ret;
+  HEADER_OR_NONE("<DATASOCKET-PAIR>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  FOOTER_OR_NONE("</DATASOCKET-PAIR>");
+  return Ret;
+}
+
 ENCODE(SessionList)
 {
   std::ostringstream Buf;
   Buf << "<SESSION-LIST Count=\"" << Object.Sessions.size() << "\">";
   for (const SessionData& SD : Object.Sessions)
     Buf << monomux::message::SessionData::encode(SD);
+  if (Object.Total)
+  {
+    Buf << "<TOTAL>" << *Object.Total << "</TOTAL>";
+    if (Object.More)
+      Buf << "<MORE />";
+  }
   Buf << "</SESSION-LIST>";
   return Buf.str();
 }
@@ -652,6 +1158,13 @@ DECODE(SessionList)
     }
   }
 
+  PEEK_AND_CONSUME("<TOTAL>")
+  {
+    EXTRACT_OR_NONE(Total, "</TOTAL>");
+    Ret.Total = std::stoull(std::string{Total});
+    PEEK_AND_CONSUME("<MORE />") { Ret.More = true; }
+  }
+
   FOOTER_OR_NONE("</SESSION-LIST>");
   return Ret;
 }
@@ -690,6 +1203,8 @@ ENCODE(Attach)
   Buf << monomux::message::Boolean::encode(Object.Success);
   if (Object.Success)
     Buf << monomux::message::SessionData::encode(Object.Session);
+  if (Object.Success && Object.Offset)
+    Buf << "<OFFSET>" << *Object.Offset << "</OFFSET>";
   Buf << "</ATTACH>";
   return Buf.str();
 }
@@ -709,6 +1224,12 @@ DECODE(Attach)
     if (!Session)
       return std::nullopt;
     Ret.Session = std::move(*Session);
+
+    PEEK_AND_CONSUME("<OFFSET>")
+    {
+      EXTRACT_OR_NONE(Offset, "</OFFSET>");
+      Ret.Offset = std::stoull(std::string{Offset});
+    }
   }
 
   FOOTER_OR_NONE("</ATTACH>");
@@ -732,6 +1253,8 @@ ENCODE(Statistics)
   std::ostringstream Buf;
   Buf << "<STATISTICS Size=\"" << Object.Contents.size() << "\">";
   Buf << Object.Contents;
+  if (Object.More)
+    Buf << "<MORE />";
   Buf << "</STATISTICS>";
   return Buf.str();
 }
@@ -748,11 +1271,338 @@ DECODE(Statistics)
       Ret.Contents = splice(View, Size);
     }
   }
+  PEEK_AND_CONSUME("<MORE />") { Ret.More = true; }
 
   FOOTER_OR_NONE("</STATISTICS>");
   return Ret;
 }
 
+ENCODE(Protocol)
+{
+  std::ostringstream Buf;
+  Buf << "<PROTOCOL><BINARY>" << static_cast<unsigned>(Object.BinaryVersion)
+      << "</BINARY></PROTOCOL>";
+  return Buf.str();
+}
+DECODE(Protocol)
+{
+  Protocol Ret;
+  HEADER_OR_NONE("<PROTOCOL>");
+
+  CONSUME_OR_NONE("<BINARY>");
+  EXTRACT_OR_NONE(Version, "</BINARY>");
+  Ret.BinaryVersion =
+    static_cast<std::uint8_t>(std::stoul(std::string{Version}));
+
+  FOOTER_OR_NONE("</PROTOCOL>");
+  return Ret;
+}
+
+ENCODE(Subscribe)
+{
+  std::ostringstream Buf;
+  Buf << "<SUBSCRIBED Count=\"" << Object.Sessions.size() << "\">";
+  for (const SessionData& SD : Object.Sessions)
+    Buf << monomux::message::SessionData::encode(SD);
+  Buf << "</SUBSCRIBED>";
+  return Buf.str();
+}
+DECODE(Subscribe)
+{
+  Subscribe Ret;
+  HEADER_OR_NONE("<SUBSCRIBED Count=\"");
+
+  {
+    EXTRACT_OR_NONE(ListCount, "\">");
+    std::size_t ListC = std::stoull(std::string{ListCount});
+    Ret.Sessions.reserve(ListC);
+    for (std::size_t I = 0; I < ListC; ++I)
+    {
+      auto SD = monomux::message::SessionData::decode(View);
+      if (!SD)
+        return std::nullopt;
+      Ret.Sessions.emplace_back(*std::move(SD));
+    }
+  }
+
+  FOOTER_OR_NONE("</SUBSCRIBED>");
+  return Ret;
+}
+
+ENCODE(SharedOutput)
+{
+  std::ostringstream Buf;
+  Buf << "<SHARED-OUTPUT>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  Buf << "</SHARED-OUTPUT>";
+  return Buf.str();
+}
+DECODE(SharedOutput)
+{
+  SharedOutput Ret;
+  HEADER_OR_NONE("<SHARED-OUTPUT>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  FOOTER_OR_NONE("</SHARED-OUTPUT>");
+  return Ret;
+}
+
+ENCODE(Compression)
+{
+  std::ostringstream Buf;
+  Buf << "<COMPRESSION>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  Buf << "</COMPRESSION>";
+  return Buf.str();
+}
+DECODE(Compression)
+{
+  Compression Ret;
+  HEADER_OR_NONE("<COMPRESSION>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  FOOTER_OR_NONE("</COMPRESSION>");
+  return Ret;
+}
+
+ENCODE(PtyHandOff)
+{
+  std::ostringstream Buf;
+  Buf << "<PTY-HANDOFF>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  Buf << "</PTY-HANDOFF>";
+  return Buf.str();
+}
+DECODE(PtyHandOff)
+{
+  PtyHandOff Ret;
+  HEADER_OR_NONE("<PTY-HANDOFF>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  FOOTER_OR_NONE("</PTY-HANDOFF>");
+  return Ret;
+}
+
+ENCODE(Metrics)
+{
+  std::ostringstream Buf;
+  Buf << "<METRICS Count=\"" << Object.Samples.size() << "\">";
+  for (const Metric& M : Object.Samples)
+    Buf << monomux::message::Metric::encode(M);
+  if (Object.More)
+    Buf << "<MORE />";
+  Buf << "</METRICS>";
+  return Buf.str();
+}
+DECODE(Metrics)
+{
+  Metrics Ret;
+  HEADER_OR_NONE("<METRICS Count=\"");
+
+  {
+    EXTRACT_OR_NONE(SampleCount, "\">");
+    std::size_t SampleC = std::stoull(std::string{SampleCount});
+    Ret.Samples.reserve(SampleC);
+    for (std::size_t I = 0; I < SampleC; ++I)
+    {
+      auto M = monomux::message::Metric::decode(View);
+      if (!M)
+        return std::nullopt;
+      Ret.Samples.emplace_back(*std::move(M));
+    }
+  }
+  PEEK_AND_CONSUME("<MORE />") { Ret.More = true; }
+
+  FOOTER_OR_NONE("</METRICS>");
+  return Ret;
+}
+
+ENCODE(Trace)
+{
+  std::ostringstream Buf;
+  Buf << "<TRACE Count=\"" << Object.Records.size() << "\">";
+  for (const trace::Record& R : Object.Records)
+  {
+    Buf << "<RECORD>";
+    Buf << "<T>" << R.Timestamp << "</T>";
+    Buf << "<FD>" << R.FD << "</FD>";
+    Buf << "<EVENT>" << static_cast<std::uint16_t>(R.Id) << "</EVENT>";
+    Buf << "<THREAD>" << R.Thread << "</THREAD>";
+    Buf << "<REQUESTED>" << R.Requested << "</REQUESTED>";
+    Buf << "<BYTES>" << R.Bytes << "</BYTES>";
+    Buf << "</RECORD>";
+  }
+  if (Object.More)
+    Buf << "<MORE />";
+  Buf << "</TRACE>";
+  return Buf.str();
+}
+DECODE(Trace)
+{
+  Trace Ret;
+  HEADER_OR_NONE("<TRACE Count=\"");
+
+  {
+    EXTRACT_OR_NONE(RecordCount, "\">");
+    std::size_t RecordC = std::stoull(std::string{RecordCount});
+    Ret.Records.resize(RecordC);
+    for (trace::Record& R : Ret.Records)
+    {
+      CONSUME_OR_NONE("<RECORD>");
+
+      CONSUME_OR_NONE("<T>");
+      EXTRACT_OR_NONE(Timestamp, "</T>");
+      R.Timestamp = std::stoull(std::string{Timestamp});
+
+      CONSUME_OR_NONE("<FD>");
+      EXTRACT_OR_NONE(FD, "</FD>");
+      R.FD = std::stoi(std::string{FD});
+
+      CONSUME_OR_NONE("<EVENT>");
+      EXTRACT_OR_NONE(Event, "</EVENT>");
+      std::size_t EventId = std::stoull(std::string{Event});
+      if (EventId >= trace::EventCount)
+        return std::nullopt;
+      R.Id = static_cast<trace::Event>(EventId);
+
+      CONSUME_OR_NONE("<THREAD>");
+      EXTRACT_OR_NONE(Thread, "</THREAD>");
+      R.Thread = static_cast<std::uint16_t>(std::stoul(std::string{Thread}));
+
+      CONSUME_OR_NONE("<REQUESTED>");
+      EXTRACT_OR_NONE(Requested, "</REQUESTED>");
+      R.Requested = std::stoull(std::string{Requested});
+
+      CONSUME_OR_NONE("<BYTES>");
+      EXTRACT_OR_NONE(Bytes, "</BYTES>");
+      R.Bytes = std::stoull(std::string{Bytes});
+
+      CONSUME_OR_NONE("</RECORD>");
+    }
+  }
+  PEEK_AND_CONSUME("<MORE />") { Ret.More = true; }
+
+  FOOTER_OR_NONE("</TRACE>");
+  return Ret;
+}
+
+ENCODE(RateLimit)
+{
+  std::ostringstream Buf;
+  Buf << "<RATE-LIMIT>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  Buf << "</RATE-LIMIT>";
+  return Buf.str();
+}
+DECODE(RateLimit)
+{
+  RateLimit Ret;
+  HEADER_OR_NONE("<RATE-LIMIT>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  FOOTER_OR_NONE("</RATE-LIMIT>");
+  return Ret;
+}
+
+ENCODE(OpenChannel)
+{
+  std::ostringstream Buf;
+  Buf << "<OPEN-CHANNEL>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  if (Object.Success)
+  {
+    Buf << "<CHANNEL>" << Object.Channel << "</CHANNEL>";
+    Buf << monomux::message::SessionData::encode(Object.Session);
+  }
+  Buf << "</OPEN-CHANNEL>";
+  return Buf.str();
+}
+DECODE(OpenChannel)
+{
+  OpenChannel Ret;
+  HEADER_OR_NONE("<OPEN-CHANNEL>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  if (Ret.Success)
+  {
+    CONSUME_OR_NONE("<CHANNEL>");
+    EXTRACT_OR_NONE(Channel, "</CHANNEL>");
+    Ret.Channel = static_cast<ChannelID>(std::stoul(std::string{Channel}));
+
+    auto Session = monomux::message::SessionData::decode(View);
+    if (!Session)
+      return std::nullopt;
+    Ret.Session = std::move(*Session);
+  }
+
+  FOOTER_OR_NONE("</OPEN-CHANNEL>");
+  return Ret;
+}
+
+ENCODE(Search)
+{
+  std::ostringstream Buf;
+  Buf << "<SEARCH>";
+  Buf << monomux::message::Boolean::encode(Object.Success);
+  Buf << "<MATCHES Count=\"" << Object.Matches.size() << "\">";
+  for (const SearchMatch& M : Object.Matches)
+    Buf << monomux::message::SearchMatch::encode(M);
+  Buf << "</MATCHES>";
+  if (Object.Truncated)
+    Buf << "<TRUNCATED />";
+  Buf << "</SEARCH>";
+  return Buf.str();
+}
+DECODE(Search)
+{
+  Search Ret;
+  HEADER_OR_NONE("<SEARCH>");
+
+  auto Success = monomux::message::Boolean::decode(View);
+  if (!Success)
+    return std::nullopt;
+  Ret.Success = *Success;
+
+  {
+    CONSUME_OR_NONE("<MATCHES Count=\"");
+    EXTRACT_OR_NONE(MatchCount, "\">");
+    std::size_t MatchC = std::stoull(std::string{MatchCount});
+    for (std::size_t I = 0; I < MatchC; ++I)
+    {
+      auto M = monomux::message::SearchMatch::decode(View);
+      if (!M)
+        return std::nullopt;
+      Ret.Matches.emplace_back(*std::move(M));
+    }
+    CONSUME_OR_NONE("</MATCHES>");
+  }
+
+  PEEK_AND_CONSUME("<TRUNCATED />") { Ret.Truncated = true; }
+
+  FOOTER_OR_NONE("</SEARCH>");
+  return Ret;
+}
+
 } // namespace response
 
 namespace notification
@@ -810,6 +1660,9 @@ ENCODE(Detached)
     case Kicked:
       Buf << "Booted";
       break;
+    case ServerUpgrade:
+      Buf << "Upgrade";
+      break;
   }
   Buf << "</MODE>";
   if (Object.Mode == Exit)
@@ -834,6 +1687,8 @@ DECODE(Detached)
     Ret.Mode = ServerShutdown;
   else if (Mode == "Booted")
     Ret.Mode = Kicked;
+  else if (Mode == "Upgrade")
+    Ret.Mode = ServerUpgrade;
   else
     return std::nullopt;
 
@@ -880,6 +1735,144 @@ DECODE(Redraw)
   return Ret;
 }
 
+ENCODE(CloseChannel)
+{
+  std::ostringstream Buf;
+  Buf << "<CLOSE-CHANNEL>" << Object.Channel << "</CLOSE-CHANNEL>";
+  return Buf.str();
+}
+DECODE(CloseChannel)
+{
+  CloseChannel Ret;
+  HEADER_OR_NONE("<CLOSE-CHANNEL>");
+
+  EXTRACT_OR_NONE(Channel, "<");
+  Ret.Channel = static_cast<ChannelID>(std::stoul(std::string{Channel}));
+
+  FOOTER_OR_NONE("/CLOSE-CHANNEL>");
+  return Ret;
+}
+
+ENCODE(ChannelClosed)
+{
+  std::ostringstream Buf;
+  Buf << "<CHANNEL-CLOSED>";
+  Buf << "<CHANNEL>" << Object.Channel << "</CHANNEL>";
+  Buf << Detached::encode(Object.Reason);
+  Buf << "</CHANNEL-CLOSED>";
+  return Buf.str();
+}
+DECODE(ChannelClosed)
+{
+  static constexpr std::string_view Footer = "</CHANNEL-CLOSED>";
+  ChannelClosed Ret;
+  HEADER_OR_NONE("<CHANNEL-CLOSED>");
+
+  CONSUME_OR_NONE("<CHANNEL>");
+  EXTRACT_OR_NONE(Channel, "</CHANNEL>");
+  Ret.Channel = static_cast<ChannelID>(std::stoul(std::string{Channel}));
+
+  // The reason is a complete message of its own, up to the footer.
+  if (View.size() < Footer.size() ||
+      View.substr(View.size() - Footer.size()) != Footer)
+    return std::nullopt;
+  auto Reason =
+    Detached::decodeText(View.substr(0, View.size() - Footer.size()));
+  if (!Reason)
+    return std::nullopt;
+  Ret.Reason = std::move(*Reason);
+
+  return Ret;
+}
+
+ENCODE(ChannelRedraw)
+{
+  std::ostringstream Buf;
+  Buf << "<CHANNEL-WINDOW-SIZE-CHANGE>";
+  Buf << "<CHANNEL>" << Object.Channel << "</CHANNEL>";
+  Buf << "<ROWS>" << Object.Rows << "</ROWS>";
+  Buf << "<COLS>" << Object.Columns << "</COLS>";
+  Buf << "</CHANNEL-WINDOW-SIZE-CHANGE>";
+  return Buf.str();
+}
+DECODE(ChannelRedraw)
+{
+  ChannelRedraw Ret;
+  HEADER_OR_NONE("<CHANNEL-WINDOW-SIZE-CHANGE>");
+
+  CONSUME_OR_NONE("<CHANNEL>");
+  EXTRACT_OR_NONE(Channel, "</CHANNEL>");
+  Ret.Channel = static_cast<ChannelID>(std::stoul(std::string{Channel}));
+
+  CONSUME_OR_NONE("<ROWS>");
+  EXTRACT_OR_NONE(Rows, "</ROWS>");
+  Ret.Rows = std::stoull(std::string{Rows});
+
+  CONSUME_OR_NONE("<COLS>");
+  EXTRACT_OR_NONE(Cols, "</COLS>");
+  Ret.Columns = std::stoull(std::string{Cols});
+
+  FOOTER_OR_NONE("</CHANNEL-WINDOW-SIZE-CHANGE>");
+  return Ret;
+}
+
+ENCODE(SessionEvent)
+{
+  std::ostringstream Buf;
+  Buf << "<SESSION-EVENT>";
+  Buf << "<EVENT>";
+  switch (Object.Event)
+  {
+    case Created:
+      Buf << "Created";
+      break;
+    case Destroyed:
+      Buf << "Destroyed";
+      break;
+    case Attached:
+      Buf << "Attached";
+      break;
+    case Detached:
+      Buf << "Detached";
+      break;
+  }
+  Buf << "</EVENT>";
+  Buf << monomux::message::SessionData::encode(Object.Session);
+  Buf << "<CLIENTS>" << Object.AttachedClients << "</CLIENTS>";
+  Buf << "</SESSION-EVENT>";
+  return Buf.str();
+}
+DECODE(SessionEvent)
+{
+  SessionEvent Ret;
+  HEADER_OR_NONE("<SESSION-EVENT>");
+  CONSUME_OR_NONE("<EVENT>");
+
+  EXTRACT_OR_NONE(Event, "</EVENT>");
+  if (Event == "Created")
+    Ret.Event = Created;
+  else if (Event == "Destroyed")
+    Ret.Event = Destroyed;
+  else if (Event == "Attached")
+    Ret.Event = Attached;
+  else if (Event == "Detached")
+    Ret.Event = Detached;
+  else
+    return std::nullopt;
+
+  auto Session = monomux::message::SessionData::decode(View);
+  if (!Session)
+    return std::nullopt;
+  Ret.Session = std::move(*Session);
+
+  CONSUME_OR_NONE("<CLIENTS>");
+  EXTRACT_OR_NONE(Clients, "</CLIENTS>");
+  Ret.AttachedClients = std::stoull(std::string{Clients});
+
+  FOOTER_OR_NONE("</SESSION-EVENT>");
+  return Ret;
+}
+
 } // namespace notification
 
 } // namespace monomux::message
@@ -16,21 +16,32 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <system_error>
 #include <thread>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include "monomux/Version.hpp"
+#include "monomux/adt/POD.hpp"
 #include "monomux/client/Main.hpp"
 #include "monomux/server/Main.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
 #include "monomux/system/Crash.hpp"
 #include "monomux/system/Environment.hpp"
+#include "monomux/system/Pipe.hpp"
 #include "monomux/system/Process.hpp"
 #include "monomux/system/Signal.hpp"
 
@@ -47,6 +58,13 @@ namespace
 
 const char ShortOptions[] = "hvqVs:e:u:n:lidDNk";
 
+/// The largest number of worker threads the server may be started with.
+constexpr std::size_t MaxWorkerCount = 256;
+
+/// The name of the signal handler object holding the \p CrashCapture of the
+/// raw crash report, if one was requested.
+constexpr char CrashReportObjName[] = "CrashReport";
+
 // clang-format off
 struct ::option LongOptions[] = {
   {"help",        no_argument,       nullptr, 'h'},
@@ -62,8 +80,48 @@ struct ::option LongOptions[] = {
   {"detach",      no_argument,       nullptr, 'd'},
   {"detach-all",  no_argument,       nullptr, 'D'},
   {"statistics",  no_argument,       nullptr, 0},
+  {"status",      no_argument,       nullptr, 0},
+  {"metrics",     no_argument,       nullptr, 0},
+  {"dump-trace",  no_argument,       nullptr, 0},
+  {"search",      required_argument, nullptr, 0},
+  {"batch",       required_argument, nullptr, 0},
+  {"exclusive",   no_argument,       nullptr, 0},
+  {"read-only",   no_argument,       nullptr, 0},
+  {"catch-up",    no_argument,       nullptr, 0},
+  {"compress",    no_argument,       nullptr, 0},
+  {"record",      required_argument, nullptr, 0},
+  {"record-direct", no_argument,     nullptr, 0},
   {"no-daemon",   no_argument,       nullptr, 'N'},
   {"keepalive",   no_argument,       nullptr, 'k'},
+  {"splice",      no_argument,       nullptr, 0},
+  {"io-uring",    no_argument,       nullptr, 0},
+  {"shared-output", no_argument,     nullptr, 0},
+  {"signalfd",    no_argument,       nullptr, 0},
+  {"fork-server", no_argument,       nullptr, 0},
+  {"no-flow-control", no_argument,   nullptr, 0},
+  {"no-status-page", no_argument,    nullptr, 0},
+  {"async-log",   no_argument,       nullptr, 0},
+  {"scrollback",  required_argument, nullptr, 0},
+  {"default-scrollback", required_argument, nullptr, 0},
+  {"coalesce",    required_argument, nullptr, 0},
+  {"default-coalesce", required_argument, nullptr, 0},
+  {"rate-limit",  required_argument, nullptr, 0},
+  {"set-rate-limit", required_argument, nullptr, 0},
+  {"default-rate-limit", required_argument, nullptr, 0},
+  {"clock-resolution", required_argument, nullptr, 0},
+  {"memory-budget", required_argument, nullptr, 0},
+  {"workers",     required_argument, nullptr, 0},
+  {"session-pool", required_argument, nullptr, 0},
+  {"size-policy", required_argument, nullptr, 0},
+  {"hibernate-after", required_argument, nullptr, 0},
+  {"listen-backlog", required_argument, nullptr, 0},
+  {"stall-deadline", required_argument, nullptr, 0},
+  {"shutdown-grace", required_argument, nullptr, 0},
+  {"record-sessions", required_argument, nullptr, 0},
+  {"readiness-fd", required_argument, nullptr, 0},
+  {"resume-state", required_argument, nullptr, 0},
+  {"crash-report", required_argument, nullptr, 0},
+  {"symbolise-crash-report", required_argument, nullptr, 0},
   {nullptr,       0,                 nullptr, 0}
 };
 // clang-format on
@@ -89,11 +147,20 @@ struct MainOptions
 
   /// \p -v and \p -q translated to \p Severity choice.
   log::Severity Severity;
+
+  /// \p --symbolise-crash-report
+  std::optional<std::string> SymboliseCrashReport;
 };
 
+std::optional<std::size_t> parseSize(std::string_view Str);
+std::optional<std::size_t> parseCount(std::string_view Str);
+std::optional<std::chrono::microseconds>
+parseMicroseconds(std::string_view Str);
+void waitForServer(raw_fd Readiness);
 void printHelp();
 void printVersion();
 void printFeatures();
+int symboliseCrashReport(const std::string& Path);
 void coreDumped(SignalHandling::Signal SigNum,
                 ::siginfo_t* Info,
                 const SignalHandling* Handling);
@@ -135,6 +202,297 @@ int main(int ArgC, char* ArgV[])
           {
             ClientOpts.StatisticsRequest = true;
           }
+          else if (Opt == "status")
+          {
+            ClientOpts.StatusPageRequest = true;
+          }
+          else if (Opt == "metrics")
+          {
+            ClientOpts.MetricsRequest = true;
+          }
+          else if (Opt == "dump-trace")
+          {
+            ClientOpts.TraceDumpRequest = true;
+          }
+          else if (Opt == "search")
+          {
+            if (!*optarg)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be given a non-empty text\n";
+              break;
+            }
+            ClientOpts.SearchRequest.emplace(optarg);
+          }
+          else if (Opt == "batch")
+          {
+            if (!*optarg)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be given a file, or '-'\n";
+              break;
+            }
+            ClientOpts.BatchScript.emplace(optarg);
+          }
+          else if (Opt == "exclusive")
+          {
+            ClientOpts.Exclusive = true;
+          }
+          else if (Opt == "read-only")
+          {
+            ClientOpts.ReadOnly = true;
+          }
+          else if (Opt == "catch-up")
+          {
+            ClientOpts.CatchUp = true;
+          }
+          else if (Opt == "compress")
+          {
+            ClientOpts.Compress = true;
+          }
+          else if (Opt == "record")
+          {
+            std::string_view Arg = optarg;
+            std::string_view::size_type EqualLoc = Arg.find('=');
+            std::string_view Path = EqualLoc == std::string_view::npos
+                                      ? "-"
+                                      : Arg.substr(EqualLoc + 1);
+            std::string_view Session = Arg.substr(0, EqualLoc);
+            if (Session.empty() || Path.empty())
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be specified in the format "
+                            "'SESSION[=FILE]'\n";
+              break;
+            }
+            if (Path == "-" &&
+                std::any_of(ClientOpts.Recordings.begin(),
+                            ClientOpts.Recordings.end(),
+                            [](const auto& R) { return R.second == "-"; }))
+            {
+              ArgError() << "option '--" << Opt
+                         << "' may record only one session to the standard "
+                            "output\n";
+              break;
+            }
+            ClientOpts.Recordings.emplace_back(Session, Path);
+          }
+          else if (Opt == "record-direct")
+          {
+            ClientOpts.RecordDirect = true;
+          }
+          else if (Opt == "splice")
+          {
+            ServerOpts.SpliceRelay = true;
+          }
+          else if (Opt == "io-uring")
+          {
+            ServerOpts.UseIOUring = true;
+          }
+          else if (Opt == "shared-output")
+          {
+            ServerOpts.SharedOutput = true;
+          }
+          else if (Opt == "signalfd")
+          {
+            ServerOpts.SignalEvents = true;
+          }
+          else if (Opt == "fork-server")
+          {
+            ServerOpts.UseForkServer = true;
+          }
+          else if (Opt == "no-flow-control")
+          {
+            ServerOpts.FlowControl = false;
+          }
+          else if (Opt == "no-status-page")
+          {
+            ServerOpts.StatusPage = false;
+          }
+          else if (Opt == "async-log")
+          {
+            ServerOpts.AsyncLog = true;
+          }
+          else if (Opt == "scrollback" || Opt == "default-scrollback")
+          {
+            std::optional<std::size_t> Size = parseSize(optarg);
+            if (!Size)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a size, e.g. '4096', '64K' or '16M'\n";
+              break;
+            }
+            if (Opt == "scrollback")
+              ClientOpts.ScrollbackSize = Size;
+            else
+              ServerOpts.ScrollbackSize = Size;
+          }
+          else if (Opt == "rate-limit" || Opt == "set-rate-limit" ||
+                   Opt == "default-rate-limit")
+          {
+            std::optional<std::size_t> Rate = parseSize(optarg);
+            if (!Rate)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a number of bytes per second, e.g. "
+                            "'65536' or '1M'\n";
+              break;
+            }
+            if (Opt == "rate-limit")
+              ClientOpts.RateLimit = Rate;
+            else if (Opt == "set-rate-limit")
+              ClientOpts.RateLimitRequest = Rate;
+            else
+              ServerOpts.RateLimit = Rate;
+          }
+          else if (Opt == "memory-budget")
+          {
+            std::optional<std::size_t> Size = parseSize(optarg);
+            if (!Size)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a size, e.g. '64M' or '1G'\n";
+              break;
+            }
+            ServerOpts.MemoryBudget = Size;
+          }
+          else if (Opt == "coalesce" || Opt == "default-coalesce" ||
+                   Opt == "clock-resolution")
+          {
+            auto Window = parseMicroseconds(optarg);
+            if (!Window)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a number of microseconds, e.g. '500'\n";
+              break;
+            }
+            if (Opt == "coalesce")
+              ClientOpts.CoalesceWindow = Window;
+            else if (Opt == "default-coalesce")
+              ServerOpts.CoalesceWindow = Window;
+            else
+              ServerOpts.ClockResolution = Window;
+          }
+          else if (Opt == "workers")
+          {
+            std::optional<std::size_t> Count = parseCount(optarg);
+            if (!Count || *Count > MaxWorkerCount)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a number between 0 and "
+                         << MaxWorkerCount << '\n';
+              break;
+            }
+            ServerOpts.WorkerCount = Count;
+          }
+          else if (Opt == "session-pool")
+          {
+            std::optional<std::size_t> Count = parseCount(optarg);
+            if (!Count)
+            {
+              ArgError() << "option '--" << Opt << "' must be a number\n";
+              break;
+            }
+            ServerOpts.SessionPoolSize = Count;
+          }
+          else if (Opt == "size-policy")
+          {
+            std::string Policy = optarg;
+            if (Policy != "latest" && Policy != "smallest" && Policy != "owner")
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be 'latest', 'smallest', or 'owner'\n";
+              break;
+            }
+            ServerOpts.SizePolicy = std::move(Policy);
+          }
+          else if (Opt == "hibernate-after")
+          {
+            std::optional<std::size_t> Count = parseCount(optarg);
+            if (!Count)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a number of seconds, e.g. '600'\n";
+              break;
+            }
+            ServerOpts.HibernateAfter = std::chrono::seconds{*Count};
+          }
+          else if (Opt == "listen-backlog")
+          {
+            std::optional<std::size_t> Count = parseCount(optarg);
+            if (!Count || !*Count || *Count > static_cast<std::size_t>(INT_MAX))
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a positive number\n";
+              break;
+            }
+            ServerOpts.ListenBacklog = Count;
+          }
+          else if (Opt == "stall-deadline")
+          {
+            std::optional<std::size_t> Count = parseCount(optarg);
+            if (!Count)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a number of milliseconds, e.g. '250'\n";
+              break;
+            }
+            ServerOpts.StallDeadline = std::chrono::milliseconds{*Count};
+          }
+          else if (Opt == "shutdown-grace")
+          {
+            std::optional<std::size_t> Count = parseCount(optarg);
+            if (!Count)
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a number of milliseconds, e.g. '3000'\n";
+              break;
+            }
+            ServerOpts.ShutdownGrace = std::chrono::milliseconds{*Count};
+          }
+          else if (Opt == "record-sessions")
+          {
+            std::error_code EC;
+            if (!std::filesystem::is_directory(optarg, EC))
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be an existing directory\n";
+              break;
+            }
+            // The server changes its working directory when it daemonises.
+            ServerOpts.RecordDirectory =
+              std::filesystem::absolute(optarg, EC).string();
+          }
+          else if (Opt == "readiness-fd")
+          {
+            std::optional<std::size_t> FD = parseCount(optarg);
+            if (!FD || *FD > static_cast<std::size_t>(INT_MAX))
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a file descriptor\n";
+              break;
+            }
+            ServerOpts.ReadinessFD = static_cast<raw_fd>(*FD);
+          }
+          else if (Opt == "resume-state")
+          {
+            std::optional<std::size_t> FD = parseCount(optarg);
+            if (!FD || *FD > static_cast<std::size_t>(INT_MAX))
+            {
+              ArgError() << "option '--" << Opt
+                         << "' must be a file descriptor\n";
+              break;
+            }
+            ServerOpts.ResumeStateFD = static_cast<raw_fd>(*FD);
+          }
+          else if (Opt == "crash-report")
+          {
+            ServerOpts.CrashReportPath = optarg;
+          }
+          else if (Opt == "symbolise-crash-report")
+          {
+            MainOpts.SymboliseCrashReport = optarg;
+          }
           else
           {
             ArgError() << "option '--" << Opt
@@ -250,6 +608,8 @@ int main(int ArgC, char* ArgV[])
         printFeatures();
       return EXIT_Success;
     }
+    if (MainOpts.SymboliseCrashReport)
+      return symboliseCrashReport(*MainOpts.SymboliseCrashReport);
 
     {
       using namespace monomux::log;
@@ -283,6 +643,9 @@ int main(int ArgC, char* ArgV[])
     if (ClientOpts.DetachRequestLatest && ClientOpts.DetachRequestAll)
       ArgError() << "option '-D/--detach-all' and '-d/--detach' are mutually "
                     "exclusive!\n";
+    if (ClientOpts.ReadOnly && ClientOpts.Exclusive)
+      ArgError() << "option '--read-only' and '--exclusive' are mutually "
+                    "exclusive!\n";
 
     if (!ServerOpts.ServerMode)
       ClientOpts.ClientMode = true;
@@ -323,6 +686,21 @@ int main(int ArgC, char* ArgV[])
     Sig.registerCallback(SIGSYS, &coreDumped);
     Sig.registerCallback(SIGSTKFLT, &coreDumped);
     Sig.registerObject(SignalHandling::ModuleObjName, "main");
+    if (ServerOpts.CrashReportPath)
+    {
+      auto Capture = std::make_shared<CrashCapture>(
+        *ServerOpts.CrashReportPath, "MonoMux (v" + getFullVersion() + ")");
+      if (Capture->valid())
+      {
+        // The report is symbolised by a fresh instance of this binary, as
+        // the crashed process can not be trusted with doing it.
+        Capture->setHelper("/proc/self/exe",
+                           {ArgV[0],
+                            "--symbolise-crash-report",
+                            *ServerOpts.CrashReportPath});
+        Sig.registerObject(CrashReportObjName, std::move(Capture));
+      }
+    }
     Sig.enable();
   }
 
@@ -352,6 +730,9 @@ int main(int ArgC, char* ArgV[])
   // --------------------- Dispatch to appropriate handler ---------------------
   if (ServerOpts.ServerMode)
     return server::main(ServerOpts);
+  if (ClientOpts.StatusPageRequest)
+    if (std::optional<int> Ret = client::listSessionsFromStatusPage(ClientOpts))
+      return *Ret;
 
   // The default behaviour in the client is to always try establishing a
   // connection to a server. However, it is very likely that the current process
@@ -368,20 +749,39 @@ int main(int ArgC, char* ArgV[])
     catch (...)
     {}
 
-    if (!ToServer && !ClientOpts.isControlMode())
+    if (!ToServer && !ClientOpts.isControlMode() &&
+        ClientOpts.Recordings.empty())
     {
       LOG(info) << "No running server found, starting one automatically...";
       ServerOpts.ServerMode = true;
-      Process::fork([] { /* Parent: noop. */ },
-                    [&ServerOpts, &ArgV] {
-                      // Perform the server restart in the child, so it gets
-                      // disowned when we eventually exit, and we can remain the
-                      // client.
-                      server::exec(ServerOpts, ArgV[0]);
-                    });
+      std::unique_ptr<Pipe> Readiness;
+      try
+      {
+        Pipe::AnonymousPipe P = Pipe::create();
+        ServerOpts.ReadinessFD = P.getWrite()->raw();
+        Process::fork([] { /* Parent: noop. */ },
+                      [&ServerOpts, &ArgV] {
+                        // Perform the server restart in the child, so it gets
+                        // disowned when we eventually exit, and we can remain
+                        // the client.
+                        fd::removeDescriptorFlag(*ServerOpts.ReadinessFD,
+                                                 FD_CLOEXEC);
+                        server::exec(ServerOpts, ArgV[0]);
+                      });
+        // Only the server may hold the write end, so its exit is noticed.
+        Readiness = P.takeRead();
+      }
+      catch (const std::system_error& Err)
+      {
+        LOG(error) << "Setting up the readiness notification failed: "
+                   << Err.what();
+      }
 
       // Give some time for the server to spawn...
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+      if (Readiness)
+        waitForServer(Readiness->raw());
+      else
+        std::this_thread::sleep_for(std::chrono::seconds(1));
 
       try
       {
@@ -407,6 +807,96 @@ int main(int ArgC, char* ArgV[])
 namespace
 {
 
+/// Parses a size given in bytes, with an optional binary multiplier suffix.
+std::optional<std::size_t> parseSize(std::string_view Str)
+{
+  std::size_t Multiplier = 1;
+  if (!Str.empty())
+    switch (Str.back())
+    {
+      case 'G':
+        Multiplier <<= 10;
+        [[fallthrough]];
+      case 'M':
+        Multiplier <<= 10;
+        [[fallthrough]];
+      case 'K':
+        Multiplier <<= 10;
+        Str.remove_suffix(1);
+        break;
+    }
+  if (Str.empty() ||
+      Str.find_first_not_of("0123456789") != std::string_view::npos)
+    return std::nullopt;
+
+  try
+  {
+    return std::stoull(std::string{Str}) * Multiplier;
+  }
+  catch (const std::out_of_range&)
+  {
+    return std::nullopt;
+  }
+}
+
+/// Parses a non-negative number.
+std::optional<std::size_t> parseCount(std::string_view Str)
+{
+  if (Str.empty() ||
+      Str.find_first_not_of("0123456789") != std::string_view::npos)
+    return std::nullopt;
+
+  try
+  {
+    return std::stoull(std::string{Str});
+  }
+  catch (const std::out_of_range&)
+  {
+    return std::nullopt;
+  }
+}
+
+/// Waits until the server started by the client reports on the \p Readiness
+/// pipe that it accepts connections, or exits without reporting.
+void waitForServer(raw_fd Readiness)
+{
+  static constexpr int Timeout = 5000; // ms
+  POD<struct ::pollfd> PFD;
+  PFD->fd = Readiness;
+  PFD->events = POLLIN;
+
+  auto Ready = CheckedPOSIX([&PFD] { return ::poll(&PFD, 1, Timeout); }, -1);
+  if (!Ready || Ready.get() == 0)
+  {
+    LOG(warn) << "Server did not report readiness";
+    return;
+  }
+
+  char Byte;
+  auto Read = CheckedPOSIX(
+    [Readiness, &Byte] { return ::read(Readiness, &Byte, sizeof(Byte)); }, -1);
+  if (!Read || Read.get() == 0)
+    LOG(warn) << "Server exited before becoming ready";
+}
+
+/// Parses a non-negative number of microseconds.
+std::optional<std::chrono::microseconds>
+parseMicroseconds(std::string_view Str)
+{
+  if (Str.empty() ||
+      Str.find_first_not_of("0123456789") != std::string_view::npos)
+    return std::nullopt;
+
+  try
+  {
+    return std::chrono::microseconds(std::stoll(std::string{Str}));
+  }
+  catch (const std::out_of_range&)
+  {
+    return std::nullopt;
+  }
+}
+
 void printHelp()
 {
   std::cout << R"EOF(Usage:
@@ -449,6 +939,17 @@ Options:
     -q, --quiet                 - Decrease the verbosity of the built-in logging
                                   mechanism. Each '-q' supplied disables one
                                   more level. (Meaningless together with '-v'.)
+    --crash-report FILE         - If MonoMux crashes, append the addresses and
+                                  build IDs of the stack frames to FILE, using
+                                  only buffers reserved at startup, so the
+                                  process exits immediately. The report is
+                                  symbolised and appended to FILE by a helper
+                                  process started in the background. A server
+                                  started automatically inherits this option.
+    --symbolise-crash-report FILE
+                                - Symbolise the last report written to FILE by
+                                  '--crash-report', append the result to FILE,
+                                  and exit.
 
 
 Client options:
@@ -496,6 +997,113 @@ Client options:
                                   server. (The default behaviour is to
                                   automatically create a session or attach in
                                   this case.)
+    --status                    - List the sessions that are running on the
+                                  server listening on the socket given to
+                                  '--socket', with the number of clients
+                                  attached to them, and the time of their last
+                                  activity, and exit. The list is read from the
+                                  status page of the server, without
+                                  connecting to it, where available.
+    --metrics                   - Print the counters and histograms the server
+                                  listening on the socket given to '--socket'
+                                  keeps about its event loops and the traffic
+                                  of its sessions and clients, in the text
+                                  format of Prometheus, and exit.
+    --dump-trace                - Print the most recent tracepoint records
+                                  (buffer reads and writes, event loop
+                                  wakeups) of every thread of the server
+                                  listening on the socket given to '--socket',
+                                  and exit. Needs a build with
+                                  MONOMUX_TRACEPOINTS.
+    --search TEXT               - Print the lines of the scrollback of the
+                                  sessions on the server listening on the
+                                  socket given to '--socket' that contain
+                                  TEXT, prefixed with the name of the session
+                                  and the offset of the match in its output,
+                                  and exit. If '--name' is given, only that
+                                  session is searched.
+    --batch FILE                - Execute the control commands listed in FILE,
+                                  or the standard input if '-', one per line,
+                                  over a single connection to the server
+                                  listening on the socket given to '--socket',
+                                  without waiting for each to finish before
+                                  sending the next. The commands are:
+
+                                      create NAME [PROGRAM [ARGS...]]
+                                      signal SESSION SIGNAL
+                                      detach SESSION
+                                      detach-all SESSION
+                                      rate-limit SESSION RATE
+                                      list
+                                      statistics
+
+                                  Results are printed as they arrive, as
+                                  tab-separated LINE, COMMAND, STATUS ('ok',
+                                  'error', or 'data' for a line of output of
+                                  the command), and DETAIL fields.
+    --exclusive                 - Ask the server to hand the PTY of the session
+                                  over to the client while it is the only one
+                                  attached, so the output is read without the
+                                  server relaying it. The session keeps no
+                                  scrollback of what is read this way, and no
+                                  other client may attach until this one
+                                  detaches.
+    --read-only                 - Attach to an existing session only to watch
+                                  it. The client does not send input, does not
+                                  resize the session, and is never "the latest"
+                                  client detached by '-d'. The server serves
+                                  its output after the interactive clients'.
+                                  The terminal is left in its normal mode, so
+                                  Ctrl-C quits the client.
+    --catch-up                  - If the client falls far behind in receiving
+                                  the output of the session, e.g. over a slow
+                                  link, the server discards what the client
+                                  did not receive apart from the last few
+                                  lines, and makes the program in the session
+                                  redraw its screen, instead of buffering the
+                                  output and eventually detaching the client.
+    --compress                  - Compress the output of the session sent to
+                                  the client, if the server is on another
+                                  machine, e.g. because its socket is
+                                  forwarded over SSH. Has no effect when the
+                                  client and the server share the machine.
+    --scrollback SIZE           - The amount of the most recent output of a
+                                  newly created session that the server keeps
+                                  to show to clients attaching later, in bytes,
+                                  or with a 'K', 'M', or 'G' suffix. A size of
+                                  '0' disables the scrollback for the session.
+                                  If the client attaches to an existing session,
+                                  this flag is ignored!
+    --coalesce USEC             - The time, in microseconds, the server waits
+                                  after a newly created session produced output
+                                  to accumulate more of it before relaying it,
+                                  e.g. '500'. This trades latency for fewer
+                                  wakeups with programs printing many small
+                                  pieces of output. Output right after typing
+                                  is always relayed immediately. A window of
+                                  '0' disables coalescing, at most 100000 is
+                                  used. If the client attaches to an existing
+                                  session, this flag is ignored!
+    --rate-limit RATE           - The number of bytes per second, or with a
+                                  'K', 'M', or 'G' suffix, the server reads at
+                                  most from the output of a newly created
+                                  session. Faster output is paced, not
+                                  dropped: the program blocks until the server
+                                  reads on. A rate of '0' disables the limit.
+                                  If the client attaches to an existing
+                                  session, this flag is ignored!
+    --record SESSION[=FILE]     - Attach to the existing SESSION without a
+                                  terminal, and write everything it outputs to
+                                  FILE, or to the standard output if FILE is
+                                  '-' or omitted, until the session exits. The
+                                  recorder never sends input, and does not hold
+                                  back the output of the session while an
+                                  interactive client is attached. This flag may
+                                  be specified multiple times to record several
+                                  sessions at once.
+    --record-direct             - Write the files of '--record' with direct
+                                  I/O, bypassing the page cache, if the file
+                                  system supports it.
 
 
 In-session options:
@@ -503,6 +1111,9 @@ In-session options:
                                   detach the CURRENT client.
     -D, --detach-all            - When executed from within a running session,
                                   detach ALL clients attached to that session.
+    --set-rate-limit RATE       - When executed from within a running session,
+                                  change the rate limit of that session, see
+                                  '--rate-limit'.
 
 
 Server options:
@@ -512,6 +1123,130 @@ Server options:
                                   the only session running in it had exited.
     -N, --no-daemon             - Do not daemonise (put the running server into
                                   the background) automatically. Implies '-k'.
+    --splice                    - Relay the output of sessions with exactly one
+                                  attached client inside the kernel (via
+                                  splice()), without copying the data through
+                                  the server's buffers.
+    --io-uring                  - Wait for connections and sessions to become
+                                  ready with io_uring instead of epoll. Falls
+                                  back to epoll if the kernel does not support
+                                  it.
+    --shared-output             - Relay the output of sessions to the clients
+                                  through a ring in memory shared with each
+                                  client, instead of writing it to the
+                                  client's socket. Output relayed this way is
+                                  never relayed with '--splice'.
+    --signalfd                  - Receive signals through a signalfd, and
+                                  observe the exit of sessions through pidfds,
+                                  as events of the server's event loop,
+                                  instead of through signal handlers. Falls
+                                  back to signal handlers if the kernel does
+                                  not support it.
+    --fork-server               - Spawn the processes of new sessions through
+                                  a helper process started together with the
+                                  server, instead of forking the server
+                                  itself, which gets slower the more memory
+                                  the server holds.
+    --default-scrollback SIZE   - The size of the scrollback kept for sessions
+                                  that were created without '--scrollback'.
+                                  (Defaults to 1M.) Sessions with a scrollback
+                                  are never relayed with '--splice'.
+                                  Scrollback exceeding 512K is spilled to a
+                                  memory-mapped file next to the socket.
+    --default-coalesce USEC     - The coalescing window of sessions that were
+                                  created without '--coalesce'. (Defaults to 0,
+                                  relaying output immediately.)
+    --default-rate-limit RATE   - The rate limit of sessions that were created
+                                  without '--rate-limit'. (Defaults to 0, no
+                                  limit.)
+    --clock-resolution USEC     - The granularity, in microseconds, of the time
+                                  the server reads once per event loop
+                                  iteration and uses as the timestamp of buffer
+                                  accesses and client and session activity.
+                                  Coarse resolutions, e.g. '10000', allow the
+                                  cheaper coarse system clock to be read.
+                                  (Defaults to 0, the precision of the system
+                                  clock.)
+    --no-flow-control           - Do not pause reading the output of a session
+                                  while an attached client is lagging behind.
+                                  Slow clients will be disconnected once the
+                                  server had buffered too much for them.
+    --no-status-page            - Do not publish the state of the sessions in
+                                  a memory-mapped file next to the socket, from
+                                  which '--status' lists them without
+                                  connecting to the server.
+    --memory-budget SIZE        - The amount of memory the buffers of the
+                                  connections, and the output backlog and
+                                  scrollback of the sessions may use in total.
+                                  Near the budget, the server stops reading
+                                  the output of sessions with output pending
+                                  delivery, and spills scrollback to disk.
+                                  (Defaults to 0, no limit.)
+    --async-log                 - Format and write the log messages of the
+                                  server on a background thread, so a slow
+                                  log output does not stall relaying data.
+                                  Messages that do not fit the bounded queue
+                                  are dropped and counted.
+    --workers N                 - Distribute the sessions between N threads,
+                                  each relaying the data of its sessions and
+                                  the clients attached to them, while the main
+                                  thread handles connections and control
+                                  messages. (Defaults to 0, relaying everything
+                                  on the main thread.) The worker threads
+                                  always use epoll.
+    --session-pool N            - Keep N idle sessions running the default
+                                  shell spawned in advance, and hand them out
+                                  to requests for a new session of that shell
+                                  without arguments or environment changes.
+                                  (Defaults to 0, spawning every session on
+                                  request.)
+    --size-policy POLICY        - How the size of a session is decided if its
+                                  clients have terminals of different sizes:
+                                  'latest' uses the client that was typed into
+                                  or resized most recently, 'smallest' fits
+                                  every terminal, and 'owner' uses the client
+                                  attached the longest. Resizes are collected
+                                  for a short while, and the session is only
+                                  resized if its size changes. (Defaults to
+                                  'latest'.)
+    --hibernate-after SEC       - Release the buffers of sessions that had no
+                                  clients attached, no output and no input
+                                  for SEC seconds, and watch them in a
+                                  separate, rarely woken listen-set until
+                                  they produce output or a client attaches.
+                                  (Defaults to 0, never hibernating.)
+    --listen-backlog N          - The number of incoming connections the
+                                  system queues while the server is busy, e.g.
+                                  when many clients reconnect at once. (Defaults
+                                  to 1024, limited by 'net.core.somaxconn'.)
+    --stall-deadline MSEC       - Watch the event loop of the server from a
+                                  separate thread, and if one iteration takes
+                                  longer than MSEC milliseconds, e.g. because
+                                  forking or logging blocked, log the stall
+                                  with the stack of the loop, and count it in
+                                  the metrics. (Defaults to 0, not watched.)
+    --shutdown-grace MSEC       - When the server shuts down, every session is
+                                  sent a SIGHUP at once, and the ones still
+                                  running after MSEC milliseconds are killed.
+                                  (Defaults to 3000.)
+    --record-sessions DIR       - Record the output of every session and the
+                                  input sent to it, with timestamps, into a
+                                  file per session in DIR, which can be
+                                  replayed by the benchmark harness. Recorded
+                                  sessions are never relayed by splice(), nor
+                                  handed over to clients.
+    --readiness-fd FD           - Write a byte to the inherited file descriptor
+                                  FD, and close it, once the server accepts
+                                  connections. (Used by clients that start a
+                                  server automatically.)
+    --resume-state FD           - Resume the sessions whose state is stored in
+                                  the inherited file descriptor FD. (Used by
+                                  the server when it upgrades itself.)
+
+    Sending SIGUSR2 to the server upgrades it in place: the server executes
+    the binary it was started from again (which might have been replaced on
+    disk since), and the new server takes over the running sessions. Attached
+    clients reconnect to their session automatically.
 )EOF";
   std::cout << std::endl;
 }
@@ -526,10 +1261,53 @@ void printFeatures()
   std::cout << "Features:\n" << getHumanReadableConfiguration() << std::endl;
 }
 
+int symboliseCrashReport(const std::string& Path)
+{
+  std::ifstream Report{Path};
+  if (!Report.is_open())
+  {
+    std::cerr << "Opening crash report '" << Path << "' failed\n";
+    return EXIT_SystemError;
+  }
+
+  Backtrace BT{Report};
+  if (BT.getFrames().empty())
+  {
+    std::cerr << "No backtrace found in crash report '" << Path << "'\n";
+    return EXIT_InvocationError;
+  }
+  BT.prettify();
+
+  std::ofstream Out{Path, std::ios::app};
+  printBacktrace(Out, BT);
+  Out << '\n';
+  return EXIT_Success;
+}
+
 void coreDumped(SignalHandling::Signal SigNum,
                 ::siginfo_t* /* Info */,
                 const SignalHandling* Handling)
 {
+  const auto* Capture = std::any_cast<std::shared_ptr<CrashCapture>>(
+    Handling->getObject(CrashReportObjName));
+  if (Capture)
+  {
+    // Nothing that allocates or locks may run in this mode, as the state of
+    // the process can not be trusted.
+    const volatile auto* ModulePtr = std::any_cast<const char*>(
+      Handling->getObject(SignalHandling::ModuleObjName));
+    (*Capture)->capture(SigNum, ModulePtr ? *ModulePtr : "<Unknown>");
+
+    static constexpr char Message[] =
+      "MonoMux has crashed! The backtrace was written to the crash report.\n";
+    (void)::write(STDERR_FILENO, Message, sizeof(Message) - 1);
+
+    // Die from the signal right away, even if it was sent by another process.
+    (void)::signal(SigNum, SIG_DFL);
+    (void)::raise(SigNum);
+    return;
+  }
+
   // Reset the signal handler for the current signal, so all other processes
   // and logics properly receive the fact that we are ending, anyway...
   SignalHandling::get().defaultCallback(SigNum);
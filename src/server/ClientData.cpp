@@ -30,6 +30,11 @@ ClientData::ClientData(std::unique_ptr<Socket> Connection)
     ControlConnection(std::move(Connection)), AttachedSession(nullptr)
 {}
 
+ClientData::ClientData(ClientData& Parent, message::ChannelID Channel)
+  : ID(Parent.ID), Created(std::chrono::system_clock::now()),
+    AttachedSession(nullptr), Parent(&Parent), Channel(Channel)
+{}
+
 static std::size_t NonceCounter = 0; // FIXME: Remove this.
 
 std::size_t ClientData::consumeNonce() noexcept
@@ -55,14 +60,92 @@ void ClientData::subjugateIntoDataSocket(ClientData& Other) noexcept
   assert(!Other.ControlConnection && "Other client stayed alive");
 }
 
+void ClientData::setDataSocket(std::unique_ptr<Socket> Connection) noexcept
+{
+  assert(!DataConnection && "Current client already has a data connection!");
+  DataConnection = std::move(Connection);
+}
+
+SplicePipe& ClientData::createSplicePipe()
+{
+  if (!Splice)
+    Splice = std::make_unique<SplicePipe>();
+  return *Splice;
+}
+
+ClientData* ClientData::openChannel()
+{
+  assert(!Parent && "Channels can not have channels!");
+  for (std::size_t Tries = 0; Tries <= UINT16_MAX; ++Tries, ++NextChannel)
+  {
+    if (!NextChannel || Channels.find(NextChannel) != Channels.end())
+      continue;
+
+    Multiplexed = true;
+    auto Inserted = Channels.try_emplace(
+      NextChannel, std::make_unique<ClientData>(*this, NextChannel));
+    ++NextChannel;
+    return Inserted.first->second.get();
+  }
+  return nullptr;
+}
+
+ClientData* ClientData::getChannel(message::ChannelID Channel) noexcept
+{
+  auto It = Channels.find(Channel);
+  return It != Channels.end() ? It->second.get() : nullptr;
+}
+
+void ClientData::closeChannel(message::ChannelID Channel) noexcept
+{
+  assert((!getChannel(Channel) || !getChannel(Channel)->AttachedSession) &&
+         "Channel closed while attached!");
+  Channels.erase(Channel);
+}
+
+std::vector<ClientData*> ClientData::channelsInTurn()
+{
+  std::vector<ClientData*> Ret;
+  Ret.reserve(Channels.size());
+  auto Turn = Channels.lower_bound(ChannelTurn);
+  for (auto It = Turn; It != Channels.end(); ++It)
+    Ret.emplace_back(It->second.get());
+  for (auto It = Channels.begin(); It != Turn; ++It)
+    Ret.emplace_back(It->second.get());
+  if (!Ret.empty())
+    ChannelTurn = static_cast<message::ChannelID>(Ret.front()->Channel + 1);
+  return Ret;
+}
+
+void ClientData::sendResponsePart()
+{
+  assert(!ResponseStreams.empty() && "No response to send!");
+  // The stream is removed before sending, so a failing send does not leave a
+  // response that would never finish.
+  std::function<ResponsePartFunction> Stream =
+    std::move(ResponseStreams.front());
+  ResponseStreams.pop_front();
+  if (Stream(getControlSocket(), encoding()))
+    ResponseStreams.emplace_front(std::move(Stream));
+}
+
 void ClientData::sendDetachReason(
   monomux::message::notification::Detached::DetachMode R,
   int EC,
   std::string Reason)
 {
+  if (Parent)
+  {
+    message::sendMessage(Parent->getControlSocket(),
+                         monomux::message::notification::ChannelClosed{
+                           Channel, {R, EC, std::move(Reason)}},
+                         Parent->encoding());
+    return;
+  }
   message::sendMessage(
     getControlSocket(),
-    monomux::message::notification::Detached{R, EC, std::move(Reason)});
+    monomux::message::notification::Detached{R, EC, std::move(Reason)},
+    ControlEncoding);
 }
 
 } // namespace monomux::server
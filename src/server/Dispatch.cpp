@@ -16,6 +16,8 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+
 #include "monomux/control/Message.hpp"
 #include "monomux/control/PascalString.hpp"
 #include "monomux/system/Environment.hpp"
@@ -31,14 +33,32 @@ using namespace monomux::message;
 namespace monomux::server
 {
 
-void Server::setUpDispatch()
-{
-#define KIND(E) static_cast<std::uint16_t>(MessageKind::E)
+const Server::DispatchTable Server::BuiltinDispatch = [] {
+  DispatchTable Table{};
+#define KIND(E) static_cast<std::size_t>(MessageKind::E)
 #define MEMBER(NAME) &Server::NAME
-#define DISPATCH(K, FUNCTION) registerMessageHandler(KIND(K), MEMBER(FUNCTION));
+#define DISPATCH(K, FUNCTION) Table[KIND(K)] = MEMBER(FUNCTION);
 #include "monomux/server/Dispatch.ipp"
 #undef MEMBER
 #undef KIND
+  return Table;
+}();
+
+bool Server::dispatch(std::uint16_t Kind,
+                      ClientData& Client,
+                      std::string_view Message)
+{
+  if (Kind < Overrides.size() && Overrides[Kind])
+  {
+    Overrides[Kind](*this, Client, Message);
+    return true;
+  }
+  if (Kind < BuiltinDispatch.size() && BuiltinDispatch[Kind])
+  {
+    BuiltinDispatch[Kind](*this, Client, Message);
+    return true;
+  }
+  return false;
 }
 
 /// Reschedules the overflown buffer identified by \p BO to the next iteration
@@ -91,7 +111,7 @@ HANDLER(requestClientID)
   Resp.Client.ID = Client.id();
   Resp.Client.Nonce = Client.makeNewNonce();
 
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
 }
 
 HANDLER(requestDataSocket)
@@ -103,14 +123,14 @@ HANDLER(requestDataSocket)
   // In this function, Client is the message sender, so the connection that
   // wants to become the data socket.
 
-  auto MainIt = Server.Clients.find(Msg->Client.ID);
-  if (MainIt == Server.Clients.end())
+  ClientData* Main = Server.getClient(Msg->Client.ID);
+  if (!Main)
   {
     sendMessage(Client.getControlSocket(), Resp);
     return;
   }
 
-  ClientData& MainClient = *MainIt->second;
+  ClientData& MainClient = *Main;
   if (MainClient.getDataSocket() != nullptr)
   {
     sendMessage(Client.getControlSocket(), Resp);
@@ -129,22 +149,73 @@ HANDLER(requestDataSocket)
   sendMessage(*MainClient.getDataSocket(), Resp);
 }
 
+HANDLER(requestDataSocketPair)
+{
+  MSG(request::DataSocketPair);
+  response::DataSocketPair Resp;
+  Resp.Success = false;
+
+  if (Msg->Process && !Client.isChannel())
+  {
+    std::optional<::pid_t> Peer = Client.getControlSocket().peerProcess();
+    if (Peer && *Peer != *Msg->Process)
+    {
+      LOG(info) << "Client \"" << Client.id() << "\" is connected through "
+                << "process " << *Peer << ", a relay";
+      Client.setRemote();
+    }
+  }
+
+  // The end of the pair travels with the response, which can not be queued
+  // behind other data.
+  if (Client.getDataSocket() || Client.isChannel() || Client.isRemote() ||
+      Client.getControlSocket().hasBufferedWrite())
+  {
+    sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+    return;
+  }
+
+  try
+  {
+    fd ClientEnd = Server.makeDataSocketPair(Client);
+    Resp.Success = true;
+    Client.getControlSocket().sendFDs(
+      {ClientEnd.get()}, encodeWithSize(Resp, Client.encoding()));
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": failed to create the data connection: " << Err.what();
+    if (!Resp.Success)
+      sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+  }
+}
+
 HANDLER(requestSessionList)
 {
   MSG(request::SessionList);
   response::SessionList Resp;
 
-  for (const auto& SessionElem : Server.Sessions)
+  const std::size_t Limit = Msg->Limit.value_or(Server.SessionsByName.size());
+  const std::vector<SessionData*> Listed =
+    Server.sessionsInOrder(Msg->Prefix, Msg->Offset, Limit, Resp.More);
+  if (Msg->Limit)
+    // Only paged requests are told about the size of the entire list, so the
+    // response to the old request is unchanged.
+    Resp.Total = Server.SessionsByName.size();
+
+  Resp.Sessions.reserve(Listed.size());
+  for (const SessionData* S : Listed)
   {
     monomux::message::SessionData TransmitData;
-    TransmitData.Name = SessionElem.first;
+    TransmitData.Name = S->name();
     TransmitData.Created =
-      std::chrono::system_clock::to_time_t(SessionElem.second->whenCreated());
+      std::chrono::system_clock::to_time_t(S->whenCreated());
 
     Resp.Sessions.emplace_back(std::move(TransmitData));
   }
 
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
 }
 
 HANDLER(requestMakeSession)
@@ -155,24 +226,50 @@ HANDLER(requestMakeSession)
   Resp.Name = Msg->Name;
   Resp.Success = false;
 
-  if (!Msg->Name.empty() && Server.getSession(Msg->Name))
+  if (!Msg->Name.empty() &&
+      (Server.getSession(Msg->Name) || Server.isSpawning(Msg->Name)))
   {
     LOG(debug) << "Session \"" << Msg->Name << "\" already exists";
-    sendMessage(Client.getControlSocket(), Resp);
+    sendMessage(Client.getControlSocket(), Resp, Client.encoding());
     return;
   }
   if (Msg->Name.empty())
   {
     // Generate a default session name, which will just be a numeric ID.
     std::size_t SessionNum = 1;
-    while (Server.getSession(std::to_string(SessionNum)))
+    while (Server.getSession(std::to_string(SessionNum)) ||
+           Server.isSpawning(std::to_string(SessionNum)))
       ++SessionNum;
     Msg->Name = std::to_string(SessionNum);
   }
 
   LOG(info) << "Creating Session \"" << Msg->Name << "\"...";
   Resp.Name = Msg->Name;
-  auto S = std::make_unique<SessionData>(std::move(Msg->Name));
+
+  if (Msg->SpawnOpts.Arguments.empty() &&
+      Msg->SpawnOpts.SetEnvironment.empty() &&
+      Msg->SpawnOpts.UnsetEnvironment.empty())
+    if (SessionData* S =
+          Server.takePooledSession(Msg->SpawnOpts.Program, Msg->Name))
+    {
+      // The pooled process already runs, only the settings must be applied.
+      if (Msg->ScrollbackSize)
+        S->setScrollbackSize(*Msg->ScrollbackSize);
+      if (Msg->CoalesceWindow)
+        S->setCoalesceWindow(std::chrono::microseconds(*Msg->CoalesceWindow));
+      if (Msg->RateLimit)
+        Server.setSessionRateLimit(*S, *Msg->RateLimit);
+      Resp.Success = true;
+      sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+      return;
+    }
+
+  SessionData S{std::move(Msg->Name)};
+  S.setScrollbackSize(Msg->ScrollbackSize.value_or(Server.ScrollbackSize));
+  S.setCoalesceWindow(
+    Msg->CoalesceWindow ? std::chrono::microseconds(*Msg->CoalesceWindow)
+                        : Server.CoalesceWindow);
+  S.setRateLimit(Msg->RateLimit.value_or(Server.RateLimit));
 
   Process::SpawnOptions SOpts;
   SOpts.CreatePTY = true;
@@ -191,21 +288,16 @@ HANDLER(requestMakeSession)
     MonomuxSession MS;
     MS.SessionName = Resp.Name;
     MS.Socket = SocketPath::absolutise(Server.Sock.identifier());
+    // Large scrollbacks are spilled next to the socket.
+    S.setSpillDirectory(MS.Socket.Path);
 
     for (std::pair<std::string, std::string> BuiltinEnvVar : MS.createEnvVars())
       SOpts.Environment[std::move(BuiltinEnvVar.first)] =
         std::move(BuiltinEnvVar.second);
   }
 
-  // TODO: How to detect process creation failing?
-  Process P = Process::spawn(SOpts);
-  S->setProcess(std::move(P));
-
-  auto InsertResult = Server.Sessions.try_emplace(Resp.Name, std::move(S));
-  Server.createCallback(*InsertResult.first->second);
-
-  Resp.Success = true;
-  sendMessage(Client.getControlSocket(), Resp);
+  // The response is sent once the process is running.
+  Server.spawnSession(Client, std::move(S), SOpts);
 }
 
 HANDLER(requestAttach)
@@ -215,17 +307,36 @@ HANDLER(requestAttach)
   Resp.Success = false;
 
   SessionData* S = Server.getSession(Msg->Name);
-  if (!S)
+  if (!S || S->getHandedOffTo() || Client.isMultiplexed())
   {
-    sendMessage(Client.getControlSocket(), Resp);
+    // The data connection of a multiplexing client only carries channels.
+    sendMessage(Client.getControlSocket(), Resp, Client.encoding());
     return;
   }
 
-  Server.clientAttachedCallback(Client, *S);
+  const std::time_t Created =
+    std::chrono::system_clock::to_time_t(S->whenCreated());
+  std::optional<std::size_t> ResumeFrom;
+  if (Msg->ResumeFrom && Msg->ResumeCreated == Created)
+    // Offsets are only meaningful in the same session, not in a new one which
+    // happens to have the same name.
+    ResumeFrom = *Msg->ResumeFrom;
+
+  Client.setObserver(Msg->Observer);
+  Client.setCatchUp(Msg->CatchUp);
+  Server.clientAttachedCallback(Client, *S, ResumeFrom);
   Resp.Success = true;
   Resp.Session.Name = S->name();
-  Resp.Session.Created = std::chrono::system_clock::to_time_t(S->whenCreated());
-  sendMessage(Client.getControlSocket(), Resp);
+  Resp.Session.Created = Created;
+  if (Msg->Resumable)
+    Resp.Offset = Client.outputCursor();
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+
+  if (Socket* DS = Client.getDataSocket();
+      DS && Client.outputCursor() != S->outputEnd())
+    // Replay the scrollback through the event loop, in chunks.
+    Server.pollOf(Client).schedule(
+      DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
 }
 
 HANDLER(requestDetach)
@@ -257,7 +368,7 @@ HANDLER(requestDetach)
     Server.clientDetachedCallback(*C, *S);
   }
 
-  sendMessage(Client.getControlSocket(), Resp);
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
 }
 
 HANDLER(signalSession)
@@ -265,28 +376,347 @@ HANDLER(signalSession)
   (void)Server;
   MSG(request::Signal);
   SessionData* S = Client.getAttachedSession();
-  if (!S || !S->hasProcess())
+  if (!S || !S->hasProcess() || Client.isObserver())
+    // Read-only clients must not affect the session.
     return;
   S->getProcess().signal(Msg->SigNum);
 }
 
+HANDLER(requestRateLimit)
+{
+  MSG(request::RateLimit);
+  response::RateLimit Resp;
+  if (SessionData* S = Client.getAttachedSession())
+  {
+    LOG(info) << "Session \"" << S->name() << "\": rate limit set to "
+              << Msg->BytesPerSecond << " bytes/s";
+    Server.setSessionRateLimit(*S, Msg->BytesPerSecond);
+    Resp.Success = true;
+  }
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+}
+
+HANDLER(requestSearch)
+{
+  MSG(request::Search);
+  if (Msg->Pattern.empty() ||
+      (!Msg->Session.empty() && !Server.getSession(Msg->Session)))
+  {
+    sendMessage(
+      Client.getControlSocket(), response::Search{}, Client.encoding());
+    return;
+  }
+  Server.startSearch(
+    Client, std::move(Msg->Pattern), Msg->Session, Msg->MaxMatches);
+}
+
 HANDLER(redrawNotified)
 {
-  (void)Server;
   MSG(notification::Redraw);
 
   SessionData* S = Client.getAttachedSession();
-  if (!S)
+  if (!S || Client.isObserver())
+    // The window size of a read-only client does not resize the session.
     return;
-  if (S->hasProcess() && S->getProcess().hasPty())
-    S->getProcess().getPty()->setSize(Msg->Rows, Msg->Columns);
+  Client.setWindowSize(Pty::WindowSize{Msg->Rows, Msg->Columns});
+  Client.activity();
+  Server.requestResize(*S);
+}
+
+/// The number of bytes of the \p response::Statistics sent in one part.
+static constexpr std::size_t StatisticsPartSize = 1 << 16;
+/// The number of samples of the \p response::Metrics sent in one part.
+static constexpr std::size_t MetricsPartSize = 1 << 9;
+/// The number of records of the \p response::Trace sent in one part.
+static constexpr std::size_t TracePartSize = 1 << 11;
+
+/// Sends the \p Items as the \p Field of \p Response messages to the
+/// \p Client, in parts of at most \p PartSize elements, each of which is
+/// sent by the event loop \p Poll once the previous one left.
+template <typename Response, typename Container>
+static void streamResponse(EPoll& Poll,
+                           ClientData& Client,
+                           Container Items,
+                           Container Response::*Field,
+                           std::size_t PartSize)
+{
+  Client.queueResponseStream(
+    [Items = std::move(Items), Field, PartSize, Position = std::size_t{0}](
+      Socket& Control, Encoding Encoding) mutable {
+      const std::size_t End = std::min(Items.size(), Position + PartSize);
+      Response Part;
+      Part.*Field = Container(Items.begin() + Position, Items.begin() + End);
+      Position = End;
+      Part.More = Position < Items.size();
+      sendMessage(Control, Part, Encoding);
+      return Part.More;
+    });
+  Poll.schedule(Client.getControlSocket().raw(),
+                /* Incoming =*/false,
+                /* Outgoing =*/true);
 }
 
 HANDLER(statisticsRequest)
 {
   MSG(request::Statistics);
+  if (Msg->Streamed)
+  {
+    streamResponse(*Server.Poll,
+                   Client,
+                   Server.statistics(),
+                   &response::Statistics::Contents,
+                   StatisticsPartSize);
+    return;
+  }
   sendMessage(Client.getControlSocket(),
-              response::Statistics{Server.statistics()});
+              response::Statistics{Server.statistics()},
+              Client.encoding());
+}
+
+HANDLER(metricsRequest)
+{
+  MSG(request::Metrics);
+  if (Msg->Streamed)
+  {
+    streamResponse(*Server.Poll,
+                   Client,
+                   Server.metrics(),
+                   &response::Metrics::Samples,
+                   MetricsPartSize);
+    return;
+  }
+  sendMessage(Client.getControlSocket(),
+              response::Metrics{Server.metrics()},
+              Client.encoding());
+}
+
+HANDLER(traceRequest)
+{
+  MSG(request::Trace);
+  // The workers are paused while the requests are handled, so their rings
+  // are stable.
+  if (Msg->Streamed)
+  {
+    streamResponse(*Server.Poll,
+                   Client,
+                   trace::collect(),
+                   &response::Trace::Records,
+                   TracePartSize);
+    return;
+  }
+  sendMessage(Client.getControlSocket(),
+              response::Trace{trace::collect()},
+              Client.encoding());
+}
+
+HANDLER(requestProtocol)
+{
+  (void)Server;
+  MSG(request::Protocol);
+  response::Protocol Resp;
+  if (Msg->BinaryVersion >= BinaryVersion)
+    Resp.BinaryVersion = BinaryVersion;
+
+  // The response itself is in the text encoding, as the client only learns
+  // from it whether the server understood the request.
+  sendMessage(Client.getControlSocket(), Resp);
+  if (Resp.BinaryVersion)
+    Client.setEncoding(Encoding::Binary);
+}
+
+HANDLER(requestSubscribe)
+{
+  MSG(request::Subscribe);
+  response::Subscribe Resp;
+
+  for (const SessionData* S : Server.sessionsInOrder())
+  {
+    monomux::message::SessionData TransmitData;
+    TransmitData.Name = S->name();
+    TransmitData.Created =
+      std::chrono::system_clock::to_time_t(S->whenCreated());
+
+    Resp.Sessions.emplace_back(std::move(TransmitData));
+  }
+
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+  if (!Client.isSubscribed())
+  {
+    Client.setSubscribed();
+    ++Server.Subscribers;
+  }
+}
+
+HANDLER(requestSharedOutput)
+{
+  MSG(request::SharedOutput);
+  response::SharedOutput Resp;
+  Resp.Success = false;
+
+  Socket* DS = Client.getDataSocket();
+  if (Server.SharedOutput && DS && !DS->hasBufferedWrite() &&
+      !Client.isRemote() && !Client.isCompressed() &&
+      !Client.getOutputRing() && !Client.getAttachedSession())
+  {
+    try
+    {
+      auto Ring = std::make_unique<SharedRing>(SharedRing::create());
+      // The handles must arrive before the response, which tells the client
+      // to receive them.
+      DS->sendFDs({Ring->memory(), Ring->dataBell(), Ring->spaceBell()});
+      Server.enableOutputRing(Client, std::move(Ring));
+      Resp.Success = true;
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Client \"" << Client.id()
+                 << "\": failed to set up shared output: " << Err.what();
+    }
+  }
+
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+}
+
+HANDLER(requestCompression)
+{
+  (void)Server;
+  MSG(request::Compression);
+  response::Compression Resp;
+  Resp.Success = false;
+
+  // Local connections are faster than the compression.
+  if (Client.isRemote() && Client.getDataSocket() && !Client.isChannel() &&
+      !Client.isMultiplexed() && !Client.getOutputRing() &&
+      !Client.getAttachedSession())
+  {
+    LOG(info) << "Client \"" << Client.id() << "\" receives compressed output";
+    Client.setCompressed();
+    Resp.Success = true;
+  }
+
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+}
+
+/// \returns whether the PTY of \p S can be handed over to \p Client without
+/// losing or reordering any of the data in flight.
+static bool canHandOffPty(ClientData& Client, SessionData& S)
+{
+  if (!S.hasProcess() || !S.getProcess().hasPty() || Client.isObserver() ||
+      Client.isRemote())
+    return false;
+  if (S.getHandedOffTo() || S.getAttachedClients().size() != 1 ||
+      S.isOutputThrottled() || S.coalesceDeadline() || S.rateLimit() ||
+      S.getRecording())
+    // (The client would read the output of a rate limited session unpaced,
+    // and the recording would miss the traffic.)
+    return false;
+  if (Client.outputCursor() != S.outputEnd() || Client.hasSpliceResidue())
+    return false;
+  if (S.getReader()->hasBufferedRead() || S.getWriter()->hasBufferedWrite())
+    return false;
+
+  const Socket* DS = Client.getDataSocket();
+  return DS && !DS->failed() && !DS->hasBufferedWrite() &&
+         !Client.getControlSocket().hasBufferedWrite();
+}
+
+HANDLER(requestPtyHandOff)
+{
+  MSG(request::PtyHandOff);
+  response::PtyHandOff Resp;
+  Resp.Success = false;
+
+  SessionData* S = Client.getAttachedSession();
+  if (!S || !canHandOffPty(Client, *S))
+  {
+    sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+    return;
+  }
+
+  raw_fd FD = S->getIdentifyingFD();
+  Server.pollOf(*S).stop(FD);
+  S->setHandedOffTo(&Client);
+  Resp.Success = true;
+  try
+  {
+    // The handle travels with the response, so the client knows where it is.
+    Client.getControlSocket().sendFDs(
+      {FD}, encodeWithSize(Resp, Client.encoding()));
+    LOG(info) << "Client \"" << Client.id() << "\" took over the PTY of \""
+              << S->name() << '"';
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": failed to hand off the PTY: " << Err.what();
+    Server.takeBackPty(*S);
+  }
+}
+
+HANDLER(requestOpenChannel)
+{
+  MSG(request::OpenChannel);
+  response::OpenChannel Resp;
+  Resp.Success = false;
+
+  SessionData* S = Server.getSession(Msg->Name);
+  if (!S || S->getHandedOffTo() || !Client.getDataSocket() ||
+      Client.isCompressed() || Client.getAttachedSession() ||
+      &Server.pollOf(*S) != Server.Poll.get())
+  {
+    // The shared connection is served by the main loop, so the sessions
+    // handled by worker threads can not be multiplexed over it.
+    sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+    return;
+  }
+  ClientData* Channel = Client.openChannel();
+  if (!Channel)
+  {
+    sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+    return;
+  }
+
+  Channel->setObserver(Msg->Observer);
+  Server.clientAttachedCallback(*Channel, *S);
+  Resp.Success = true;
+  Resp.Channel = Channel->channel();
+  Resp.Session.Name = S->name();
+  Resp.Session.Created = std::chrono::system_clock::to_time_t(S->whenCreated());
+  sendMessage(Client.getControlSocket(), Resp, Client.encoding());
+
+  if (Channel->outputCursor() != S->outputEnd())
+    // Replay the scrollback through the event loop, in chunks.
+    Server.Poll->schedule(Client.getDataSocket()->raw(),
+                          /* Incoming =*/false,
+                          /* Outgoing =*/true);
+}
+
+HANDLER(closeChannelNotified)
+{
+  MSG(notification::CloseChannel);
+  ClientData* Channel = Client.getChannel(Msg->Channel);
+  if (!Channel)
+    return;
+
+  LOG(debug) << "Client \"" << Client.id() << "\" closed channel #"
+             << Msg->Channel;
+  Channel->sendDetachReason(notification::Detached::DetachMode::Detach);
+  Server.closeChannel(*Channel);
+}
+
+HANDLER(channelRedrawNotified)
+{
+  MSG(notification::ChannelRedraw);
+
+  ClientData* Channel = Client.getChannel(Msg->Channel);
+  if (!Channel || Channel->isObserver())
+    return;
+  SessionData* S = Channel->getAttachedSession();
+  if (!S)
+    return;
+  Channel->setWindowSize(Pty::WindowSize{Msg->Rows, Msg->Columns});
+  Channel->activity();
+  Server.requestResize(*S);
 }
 
 #undef HANDLER
@@ -0,0 +1,292 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/control/BinaryEncoding.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Pty.hpp"
+
+#include "monomux/server/ForkServer.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("server/ForkServer")
+
+namespace monomux::server
+{
+
+/// Encodes the payload written by \p Fill into a size-prefixed frame, as
+/// expected by \p message::FrameDecoder.
+template <typename Fn> static std::string frame(Fn Fill)
+{
+  std::string Frame(sizeof(std::size_t), '\0');
+  message::BinaryWriter Writer{Frame};
+  Fill(Writer);
+
+  const std::size_t Size = Frame.size() - sizeof(std::size_t);
+  std::memcpy(Frame.data(), &Size, sizeof(std::size_t));
+  return Frame;
+}
+
+static std::string encodeRequest(const Process::SpawnOptions& Opts)
+{
+  return frame([&Opts](message::BinaryWriter& W) {
+    W.string(Opts.Program);
+    W.integer(static_cast<std::uint32_t>(Opts.Arguments.size()));
+    for (const std::string& Arg : Opts.Arguments)
+      W.string(Arg);
+    W.integer(static_cast<std::uint32_t>(Opts.Environment.size()));
+    for (const auto& E : Opts.Environment)
+    {
+      W.string(E.first);
+      W.boolean(E.second.has_value());
+      W.string(E.second.value_or(std::string{}));
+    }
+    W.boolean(Opts.CreatePTY);
+  });
+}
+
+static std::optional<Process::SpawnOptions>
+decodeRequest(std::string_view Payload)
+{
+  message::BinaryReader R{Payload};
+  Process::SpawnOptions Opts;
+  Opts.Program = R.string();
+  for (auto N = R.integer<std::uint32_t>(); N > 0 && R.good(); --N)
+    Opts.Arguments.emplace_back(R.string());
+  for (auto N = R.integer<std::uint32_t>(); N > 0 && R.good(); --N)
+  {
+    std::string Key{R.string()};
+    bool Set = R.boolean();
+    std::string_view Value = R.string();
+    Opts.Environment[std::move(Key)] =
+      Set ? std::optional<std::string>{Value} : std::nullopt;
+  }
+  Opts.CreatePTY = R.boolean();
+  if (!R.done())
+    return std::nullopt;
+  return Opts;
+}
+
+static std::string encodeResult(raw_pid PID,
+                                std::string_view PtyName,
+                                std::string_view Error)
+{
+  return frame([=](message::BinaryWriter& W) {
+    W.integer(static_cast<std::int32_t>(PID));
+    W.string(PtyName);
+    W.string(Error);
+  });
+}
+
+ForkServer::ForkServer(Socket&& Sock, raw_pid Helper)
+  : Sock(std::move(Sock)), Helper(Helper)
+{}
+
+ForkServer ForkServer::start()
+{
+  POD<raw_fd[2]> Ends;
+  CheckedPOSIXThrow(
+    [&Ends] {
+      return ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Ends);
+    },
+    "socketpair()",
+    -1);
+
+  raw_pid ForkResult = CheckedPOSIXThrow(
+    [] { return ::fork(); }, "fork() failed in ForkServer::start()", -1);
+  if (ForkResult == 0)
+  {
+    // We are in the helper.
+    fd::close(Ends[0]);
+    Socket HelperSock = Socket::wrap(fd{Ends[1]}, "<fork-server:helper>");
+    serve(HelperSock);
+  }
+
+  fd::close(Ends[1]);
+  LOG(debug) << "Fork server started as PID " << ForkResult;
+  fd::setNonBlockingCloseOnExec(Ends[0]);
+  Socket ParentSock = Socket::wrap(fd{Ends[0]}, "<fork-server>");
+  ParentSock.setAcceptFDs(true);
+  return ForkServer{std::move(ParentSock), ForkResult};
+}
+
+ForkServer::~ForkServer()
+{
+  if (Helper == Process::Invalid)
+    return;
+
+  {
+    // Closing the connection makes the helper exit.
+    fd Connection = std::move(Sock).release();
+  }
+  Process::adopt(Helper, std::nullopt).wait();
+}
+
+void ForkServer::spawn(const Process::SpawnOptions& Opts)
+{
+  if (!alive())
+    throw std::system_error{
+      std::make_error_code(std::errc::connection_reset),
+      "The fork server is not running"};
+
+  Sock.write(encodeRequest(Opts));
+  ++Pending;
+}
+
+void ForkServer::flushRequests() { Sock.flushWrites(); }
+
+std::vector<ForkServer::Result> ForkServer::results()
+{
+  std::vector<Result> Results;
+  while (alive())
+  {
+    std::optional<std::string> Frame;
+    try
+    {
+      Frame = Frames.next(Sock);
+    }
+    catch (const buffer_overflow&)
+    {}
+    catch (const std::system_error&)
+    {}
+    for (fd& FD : Sock.takeReceivedFDs())
+      ReceivedFDs.emplace_back(std::move(FD));
+    if (!Frame)
+      break;
+
+    message::BinaryReader R{*Frame};
+    auto PID = static_cast<raw_pid>(R.integer<std::int32_t>());
+    std::string_view PtyName = R.string();
+    std::string_view Error = R.string();
+    if (Pending > 0)
+      --Pending;
+
+    Result Res;
+    if (!R.done())
+      Res.Error = "Malformed result from the fork server";
+    else if (!Error.empty())
+    {
+      Res.Error = Error;
+      Res.FailedPID = PID;
+    }
+    else if (PID == Process::Invalid)
+      Res.Error = "The fork server sent no process";
+    else
+    {
+      std::optional<Pty> PTY;
+      if (!PtyName.empty() && !ReceivedFDs.empty())
+      {
+        PTY.emplace(Pty::wrapMaster(std::move(ReceivedFDs.front()),
+                                    std::string{PtyName}));
+        ReceivedFDs.pop_front();
+      }
+      Res.Spawned.emplace(Process::adopt(PID, std::move(PTY)));
+    }
+    Results.emplace_back(std::move(Res));
+  }
+
+  if (!alive())
+  {
+    if (Pending)
+      LOG(error) << "Lost the fork server with " << Pending
+                 << " requests pending";
+    for (; Pending > 0; --Pending)
+      Results.emplace_back(Result{std::nullopt, "The fork server exited"});
+  }
+  return Results;
+}
+
+[[noreturn]] void ForkServer::serve(Socket& Sock)
+{
+  const raw_pid Self = Process::thisProcess();
+  message::FrameDecoder Requests;
+  while (true)
+  {
+    std::optional<std::string> Request;
+    try
+    {
+      Request = Requests.next(Sock);
+    }
+    catch (...)
+    {
+      std::_Exit(EXIT_SUCCESS);
+    }
+    if (Sock.failed() || Requests.corrupt())
+      // The parent closed the connection.
+      std::_Exit(EXIT_SUCCESS);
+    if (!Request)
+      continue;
+
+    std::optional<Process> Spawned;
+    raw_pid FailedPID = Process::Invalid;
+    std::string Error;
+    if (std::optional<Process::SpawnOptions> Opts = decodeRequest(*Request))
+    {
+      Opts->ChildOfParent = true;
+      try
+      {
+        Spawned.emplace(Process::spawn(*Opts));
+      }
+      catch (const Process::SpawnError& SE)
+      {
+        // The child is the parent's to collect, and it must know which one.
+        FailedPID = SE.pid();
+        Error = SE.what();
+      }
+      catch (const std::system_error& SE)
+      {
+        if (Process::thisProcess() != Self)
+          // The spawned process failed to set itself up, it must not return
+          // into serving requests.
+          std::_Exit(EXIT_FAILURE);
+        Error = SE.what();
+      }
+    }
+    else
+      Error = "Malformed request";
+
+    Pty* PTY = Spawned ? Spawned->getPty() : nullptr;
+    std::string Result =
+      encodeResult(Spawned ? Spawned->raw() : FailedPID,
+                   PTY ? std::string_view{PTY->name()} : std::string_view{},
+                   Error);
+    try
+    {
+      if (PTY)
+        Sock.sendFDs({PTY->raw().get()}, Result);
+      else
+        Sock.write(Result);
+    }
+    catch (...)
+    {
+      std::_Exit(EXIT_SUCCESS);
+    }
+    // The master side of the PTY is closed here, the parent has its own copy.
+  }
+}
+
+} // namespace monomux::server
+
+#undef LOG
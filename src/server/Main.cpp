@@ -16,13 +16,18 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <string_view>
 #include <thread>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "monomux/adt/ScopeGuard.hpp"
 #include "monomux/server/Server.hpp"
 #include "monomux/system/Environment.hpp"
 #include "monomux/system/Process.hpp"
 #include "monomux/system/Signal.hpp"
+#include "monomux/system/Time.hpp"
 #include "monomux/unreachable.hpp"
 
 #include "ExitCode.hpp"
@@ -35,7 +40,10 @@ namespace monomux::server
 {
 
 Options::Options()
-  : ServerMode(false), Background(true), ExitOnLastSessionTerminate(true)
+  : ServerMode(false), Background(true), ExitOnLastSessionTerminate(true),
+    SpliceRelay(false), UseIOUring(false), SharedOutput(false),
+    SignalEvents(false), UseForkServer(false), FlowControl(true),
+    StatusPage(true), AsyncLog(false)
 {}
 
 std::vector<std::string> Options::toArgv() const
@@ -53,6 +61,102 @@ std::vector<std::string> Options::toArgv() const
     Ret.emplace_back("--no-daemon");
   if (!ExitOnLastSessionTerminate)
     Ret.emplace_back("--keepalive");
+  if (SpliceRelay)
+    Ret.emplace_back("--splice");
+  if (UseIOUring)
+    Ret.emplace_back("--io-uring");
+  if (SharedOutput)
+    Ret.emplace_back("--shared-output");
+  if (SignalEvents)
+    Ret.emplace_back("--signalfd");
+  if (UseForkServer)
+    Ret.emplace_back("--fork-server");
+  if (!FlowControl)
+    Ret.emplace_back("--no-flow-control");
+  if (!StatusPage)
+    Ret.emplace_back("--no-status-page");
+  if (AsyncLog)
+    Ret.emplace_back("--async-log");
+  if (ScrollbackSize.has_value())
+  {
+    Ret.emplace_back("--default-scrollback");
+    Ret.emplace_back(std::to_string(*ScrollbackSize));
+  }
+  if (CoalesceWindow.has_value())
+  {
+    Ret.emplace_back("--default-coalesce");
+    Ret.emplace_back(std::to_string(CoalesceWindow->count()));
+  }
+  if (RateLimit.has_value())
+  {
+    Ret.emplace_back("--default-rate-limit");
+    Ret.emplace_back(std::to_string(*RateLimit));
+  }
+  if (MemoryBudget.has_value())
+  {
+    Ret.emplace_back("--memory-budget");
+    Ret.emplace_back(std::to_string(*MemoryBudget));
+  }
+  if (WorkerCount.has_value())
+  {
+    Ret.emplace_back("--workers");
+    Ret.emplace_back(std::to_string(*WorkerCount));
+  }
+  if (SessionPoolSize.has_value())
+  {
+    Ret.emplace_back("--session-pool");
+    Ret.emplace_back(std::to_string(*SessionPoolSize));
+  }
+  if (SizePolicy.has_value())
+  {
+    Ret.emplace_back("--size-policy");
+    Ret.emplace_back(*SizePolicy);
+  }
+  if (HibernateAfter.has_value())
+  {
+    Ret.emplace_back("--hibernate-after");
+    Ret.emplace_back(std::to_string(HibernateAfter->count()));
+  }
+  if (ListenBacklog.has_value())
+  {
+    Ret.emplace_back("--listen-backlog");
+    Ret.emplace_back(std::to_string(*ListenBacklog));
+  }
+  if (StallDeadline.has_value())
+  {
+    Ret.emplace_back("--stall-deadline");
+    Ret.emplace_back(std::to_string(StallDeadline->count()));
+  }
+  if (ShutdownGrace.has_value())
+  {
+    Ret.emplace_back("--shutdown-grace");
+    Ret.emplace_back(std::to_string(ShutdownGrace->count()));
+  }
+  if (RecordDirectory.has_value())
+  {
+    Ret.emplace_back("--record-sessions");
+    Ret.emplace_back(*RecordDirectory);
+  }
+  if (ClockResolution.has_value())
+  {
+    Ret.emplace_back("--clock-resolution");
+    Ret.emplace_back(std::to_string(ClockResolution->count()));
+  }
+  if (CrashReportPath.has_value())
+  {
+    Ret.emplace_back("--crash-report");
+    Ret.emplace_back(*CrashReportPath);
+  }
+  if (ReadinessFD.has_value())
+  {
+    Ret.emplace_back("--readiness-fd");
+    Ret.emplace_back(std::to_string(*ReadinessFD));
+  }
+  if (ResumeStateFD.has_value())
+  {
+    Ret.emplace_back("--resume-state");
+    Ret.emplace_back(std::to_string(*ResumeStateFD));
+  }
 
   return Ret;
 }
@@ -77,6 +181,9 @@ constexpr char ServerObjName[] = "Server";
 void serverShutdown(SignalHandling::Signal SigNum,
                     ::siginfo_t* Info,
                     const SignalHandling* Handling);
+void serverUpgrade(SignalHandling::Signal SigNum,
+                   ::siginfo_t* Info,
+                   const SignalHandling* Handling);
 void childExited(SignalHandling::Signal SigNum,
                  ::siginfo_t* Info,
                  const SignalHandling* Handling);
@@ -84,14 +191,40 @@ void coreDumped(SignalHandling::Signal SigNum,
                 ::siginfo_t* Info,
                 const SignalHandling* Handling);
 
+void upgrade(const Options& Opts, Server& S);
+
 } // namespace
 
 int main(Options& Opts)
 {
+  std::optional<UpgradeState> Resumed;
+  if (Opts.ResumeStateFD)
+  {
+    try
+    {
+      Resumed = UpgradeState::load(fd{*Opts.ResumeStateFD});
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(fatal) << "Reading the state of the upgraded server failed:\n\t"
+                 << SE.what();
+      return EXIT_SystemError;
+    }
+    if (!Resumed)
+    {
+      LOG(fatal) << "The state of the upgraded server is not understood";
+      return EXIT_SystemError;
+    }
+  }
+
   std::optional<Socket> ServerSock;
   try
   {
-    ServerSock.emplace(Socket::create(*Opts.SocketPath));
+    if (Resumed)
+      ServerSock.emplace(
+        Socket::adopt(fd{Resumed->Socket}, *Opts.SocketPath));
+    else
+      ServerSock.emplace(Socket::create(*Opts.SocketPath));
   }
   catch (const std::system_error& SE)
   {
@@ -105,6 +238,49 @@ int main(Options& Opts)
 
   Server S = Server(std::move(*ServerSock));
   S.setExitIfNoMoreSessions(Opts.ExitOnLastSessionTerminate);
+  S.setSpliceRelay(Opts.SpliceRelay);
+  S.setIOUring(Opts.UseIOUring);
+  S.setSharedOutput(Opts.SharedOutput);
+  S.setSignalEvents(Opts.SignalEvents);
+  S.setForkServer(Opts.UseForkServer);
+  S.setFlowControl(Opts.FlowControl);
+  S.setStatusPage(Opts.StatusPage);
+  if (Opts.ScrollbackSize)
+    S.setScrollbackSize(*Opts.ScrollbackSize);
+  if (Opts.CoalesceWindow)
+    S.setCoalesceWindow(*Opts.CoalesceWindow);
+  if (Opts.RateLimit)
+    S.setRateLimit(*Opts.RateLimit);
+  if (Opts.MemoryBudget)
+    S.setMemoryBudget(*Opts.MemoryBudget);
+  if (Opts.WorkerCount)
+    S.setWorkerCount(*Opts.WorkerCount);
+  if (Opts.SessionPoolSize)
+    S.setSessionPoolSize(*Opts.SessionPoolSize);
+  if (Opts.SizePolicy == "smallest")
+    S.setSizePolicy(Server::SizePolicy::Smallest);
+  else if (Opts.SizePolicy == "owner")
+    S.setSizePolicy(Server::SizePolicy::Owner);
+  if (Opts.HibernateAfter)
+    S.setHibernateAfter(*Opts.HibernateAfter);
+  if (Opts.ListenBacklog)
+    S.setListenBacklog(*Opts.ListenBacklog);
+  if (Opts.StallDeadline)
+    S.setStallDeadline(*Opts.StallDeadline);
+  if (Opts.ShutdownGrace)
+    S.setShutdownGrace(*Opts.ShutdownGrace);
+  if (Opts.RecordDirectory)
+    S.setRecordDirectory(*Opts.RecordDirectory);
+  if (Opts.ClockResolution)
+    LoopClock::setResolution(*Opts.ClockResolution);
+  if (Opts.ReadinessFD)
+  {
+    // Do not leak the handle into the sessions.
+    fd::addDescriptorFlag(*Opts.ReadinessFD, FD_CLOEXEC);
+    S.setReadinessNotification(fd{*Opts.ReadinessFD});
+  }
+  if (Resumed)
+    S.resume(std::move(*Resumed));
   ScopeGuard Signal{[&S] {
                       SignalHandling& Sig = SignalHandling::get();
                       Sig.registerObject(SignalHandling::ModuleObjName,
@@ -113,6 +289,7 @@ int main(Options& Opts)
                       Sig.registerCallback(SIGHUP, &serverShutdown);
                       Sig.registerCallback(SIGINT, &serverShutdown);
                       Sig.registerCallback(SIGTERM, &serverShutdown);
+                      Sig.registerCallback(SIGUSR2, &serverUpgrade);
                       Sig.registerCallback(SIGCHLD, &childExited);
                       Sig.ignore(SIGPIPE);
                       Sig.enable();
@@ -129,6 +306,7 @@ int main(Options& Opts)
                       SignalHandling& Sig = SignalHandling::get();
                       Sig.unignore(SIGPIPE);
                       Sig.defaultCallback(SIGCHLD);
+                      Sig.defaultCallback(SIGUSR2);
                       Sig.defaultCallback(SIGTERM);
                       Sig.defaultCallback(SIGINT);
                       Sig.defaultCallback(SIGHUP);
@@ -146,7 +324,17 @@ int main(Options& Opts)
     CheckedPOSIXThrow(
       [] { return ::daemon(0, 0); }, "Backgrounding ourselves failed", -1);
 
-  ScopeGuard Server{[&S] { S.loop(); }, [&S] { S.shutdown(); }};
+  // The background thread of the logger would not survive ::daemon().
+  ScopeGuard AsyncLog{[&Opts] {
+                        if (Opts.AsyncLog)
+                          log::Logger::get().setAsynchronous(true);
+                      },
+                      [] { log::Logger::get().setAsynchronous(false); }};
+  {
+    ScopeGuard Server{[&S] { S.loop(); }, [&S] { S.shutdown(); }};
+    if (S.upgradeRequested())
+      upgrade(Opts, S);
+  }
   LOG(info) << "Monomux Server stopped";
   return EXIT_Success;
 }
@@ -166,6 +354,18 @@ void serverShutdown(SignalHandling::Signal /* SigNum */,
   (*Srv)->interrupt();
 }
 
+/// Handler for request to replace the server with a new binary.
+void serverUpgrade(SignalHandling::Signal /* SigNum */,
+                   ::siginfo_t* /* Info */,
+                   const SignalHandling* Handling)
+{
+  const volatile auto* Srv =
+    std::any_cast<Server*>(Handling->getObject(ServerObjName));
+  if (!Srv)
+    return;
+  (*Srv)->requestUpgrade();
+}
+
 /// Handler for \p SIGCHLD when a process spawned by the server quits.
 void childExited(SignalHandling::Signal /* SigNum */,
                  ::siginfo_t* Info,
@@ -188,6 +388,48 @@ void coreDumped(SignalHandling::Signal SigNum,
   serverShutdown(SigNum, Info, Handling);
 }
 
+/// Replaces the server process with a new instance of the binary it was
+/// started from, which resumes serving the sessions of \p S.
+///
+/// \note Only returns if the new binary could not be started, in which case the
+/// server should shut down.
+void upgrade(const Options& Opts, Server& S)
+{
+  std::string Binary = Process::thisProcessPath();
+  // The binary was most likely replaced on disk, which is the reason for the
+  // upgrade, and the kernel reports the original file as deleted.
+  static constexpr std::string_view Deleted = " (deleted)";
+  if (Binary.size() > Deleted.size() &&
+      std::string_view{Binary}.substr(Binary.size() - Deleted.size()) ==
+        Deleted)
+    Binary.erase(Binary.size() - Deleted.size());
+  if (::access(Binary.c_str(), X_OK) != 0)
+  {
+    LOG(error) << "Can not execute '" << Binary << "' for the upgrade";
+    return;
+  }
+
+  Options NewOpts = Opts;
+  // The sessions must stay the children of this process, which had already
+  // been backgrounded, if needed.
+  NewOpts.Background = false;
+  NewOpts.ReadinessFD.reset();
+  try
+  {
+    fd State = S.handOver().store();
+    NewOpts.ResumeStateFD = State.release();
+  }
+  catch (const std::system_error& SE)
+  {
+    LOG(error) << "Storing the state for the upgrade failed:\n\t" << SE.what();
+    return;
+  }
+
+  LOG(info) << "Upgrading to '" << Binary << '\'';
+  log::Logger::get().setAsynchronous(false);
+  exec(NewOpts, Binary.c_str());
+}
+
 } // namespace
 
 } // namespace monomux::server
@@ -0,0 +1,199 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/control/BinaryEncoding.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/fd.hpp"
+
+#include "monomux/server/Recording.hpp"
+
+namespace monomux::server
+{
+
+SessionRecording SessionRecording::create(const std::string& Path)
+{
+  SessionRecording R{RecordFile::create(Path, /* Direct =*/false, BufferSize)};
+  R.File.append(Magic);
+  return R;
+}
+
+SessionRecording::SessionRecording(RecordFile File)
+  : File(std::move(File)), Start(std::chrono::steady_clock::now())
+{}
+
+void SessionRecording::record(Direction D,
+                              const std::array<std::string_view, 2>& Data)
+{
+  const auto Time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - Start);
+  const std::size_t Size = Data[0].size() + Data[1].size();
+
+  std::string Header;
+  Header.reserve(RecordHeaderSize);
+  message::BinaryWriter W{Header};
+  W.integer(static_cast<std::uint8_t>(D));
+  W.integer(static_cast<std::uint64_t>(Time.count()));
+  W.integer(static_cast<std::uint32_t>(Size));
+  File.append(Header);
+  File.append(Data[0]);
+  File.append(Data[1]);
+  ++Records;
+}
+
+RecordingReader RecordingReader::open(const std::string& Path, bool Map)
+{
+  fd Handle = CheckedPOSIXThrow(
+    [&Path] { return ::open(Path.c_str(), O_RDONLY | O_CLOEXEC); },
+    "open(" + Path + ")",
+    -1);
+  POD<struct ::stat> Stat;
+  CheckedPOSIXThrow(
+    [&Handle, &Stat] { return ::fstat(Handle.get(), &Stat); }, "fstat()", -1);
+  const auto Size = static_cast<std::size_t>(Stat->st_size);
+
+  if (Map && Size)
+  {
+    void* Mapping = CheckedPOSIXThrow(
+      [&Handle, Size] {
+        return ::mmap(nullptr,
+                      Size,
+                      PROT_READ,
+                      MAP_PRIVATE | MAP_POPULATE,
+                      Handle.get(),
+                      0);
+      },
+      "mmap(" + Path + ")",
+      MAP_FAILED);
+    return RecordingReader{Mapping, Size};
+  }
+
+  std::string Contents(Size, '\0');
+  std::size_t Done = 0;
+  while (Done < Size)
+  {
+    auto Result = CheckedPOSIX(
+      [&Handle, &Contents, Done, Size] {
+        return ::read(Handle.get(), Contents.data() + Done, Size - Done);
+      },
+      -1);
+    if (!Result)
+    {
+      if (Result.getError() == std::errc::interrupted)
+        continue;
+      throw std::system_error{Result.getError(), "read(" + Path + ")"};
+    }
+    if (!Result.get())
+      break;
+    Done += static_cast<std::size_t>(Result.get());
+  }
+  Contents.resize(Done);
+  return RecordingReader{std::move(Contents)};
+}
+
+RecordingReader::RecordingReader(std::string Contents)
+  : Contents(std::move(Contents))
+{
+  checkMagic();
+}
+
+RecordingReader::RecordingReader(void* Mapping, std::size_t MappingSize)
+  : Mapping(Mapping), MappingSize(MappingSize)
+{
+  // The pages are only read once, in order.
+  ::madvise(Mapping, MappingSize, MADV_SEQUENTIAL);
+  try
+  {
+    checkMagic();
+  }
+  catch (...)
+  {
+    // (The destructor does not run for a constructor that throws.)
+    ::munmap(Mapping, MappingSize);
+    throw;
+  }
+}
+
+RecordingReader::RecordingReader(RecordingReader&& RHS) noexcept
+  : Mapping(std::exchange(RHS.Mapping, nullptr)),
+    MappingSize(std::exchange(RHS.MappingSize, 0)),
+    Contents(std::move(RHS.Contents)), Position(RHS.Position),
+    Corrupt(RHS.Corrupt)
+{}
+
+RecordingReader& RecordingReader::operator=(RecordingReader&& RHS) noexcept
+{
+  if (this == &RHS)
+    return *this;
+  if (Mapping)
+    ::munmap(Mapping, MappingSize);
+  Mapping = std::exchange(RHS.Mapping, nullptr);
+  MappingSize = std::exchange(RHS.MappingSize, 0);
+  Contents = std::move(RHS.Contents);
+  Position = RHS.Position;
+  Corrupt = RHS.Corrupt;
+  return *this;
+}
+
+RecordingReader::~RecordingReader()
+{
+  if (Mapping)
+    ::munmap(Mapping, MappingSize);
+}
+
+void RecordingReader::checkMagic() const
+{
+  if (data().substr(0, SessionRecording::Magic.size()) !=
+      SessionRecording::Magic)
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "Not a session recording"};
+}
+
+std::optional<RecordingReader::Record> RecordingReader::next() noexcept
+{
+  const std::string_view Data = data();
+  if (Corrupt || Position >= Data.size())
+    return std::nullopt;
+
+  message::BinaryReader R{Data.substr(Position)};
+  const auto D = R.integer<std::uint8_t>();
+  const auto Time = R.integer<std::uint64_t>();
+  const std::string_view Payload = R.string();
+  if (!R.good() ||
+      (D != static_cast<std::uint8_t>(SessionRecording::Direction::Output) &&
+       D != static_cast<std::uint8_t>(SessionRecording::Direction::Input)))
+  {
+    Corrupt = true;
+    return std::nullopt;
+  }
+
+  Position = Data.size() - R.remaining();
+  return Record{std::chrono::nanoseconds{static_cast<std::int64_t>(Time)},
+                static_cast<SessionRecording::Direction>(D),
+                Payload};
+}
+
+} // namespace monomux::server
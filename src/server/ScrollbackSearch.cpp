@@ -0,0 +1,114 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "monomux/server/SessionData.hpp"
+#include "monomux/system/Search.hpp"
+
+#include "monomux/server/ScrollbackSearch.hpp"
+
+namespace monomux::server
+{
+
+ScrollbackSearch::ScrollbackSearch(std::string Pattern,
+                                   const SessionData& Session)
+  : Pattern(std::move(Pattern)), End(Session.outputEnd()),
+    WindowBegin(Session.scrollbackBegin()), ScanBegin(WindowBegin)
+{}
+
+bool ScrollbackSearch::step(const SessionData& Session,
+                            std::size_t Budget,
+                            std::vector<Match>& Matches)
+{
+  if (Pattern.empty())
+    return true;
+
+  // The scrollback might have been trimmed since the previous step.
+  if (const std::size_t Begin = Session.scrollbackBegin(); windowEnd() < Begin)
+  {
+    Window.clear();
+    WindowBegin = ScanBegin = Begin;
+  }
+
+  const std::size_t Stop = std::min(End, Session.outputEnd());
+  bool Exhausted = windowEnd() >= Stop;
+  while (!Exhausted && Budget > 0)
+  {
+    std::string_view Chunk = Session.peekOutput(windowEnd());
+    if (Chunk.empty())
+    {
+      Exhausted = true;
+      break;
+    }
+    Chunk = Chunk.substr(0, std::min(Budget, Stop - windowEnd()));
+    Window.append(Chunk);
+    Budget -= Chunk.size();
+    Exhausted = windowEnd() >= Stop;
+  }
+
+  // Unless the end was reached, the matches close to the end of the window
+  // are left for the next step, when the whole of them and the line after
+  // them is loaded.
+  const std::size_t Reserve = Exhausted ? 0 : Pattern.size() + ContextMax;
+  const std::size_t Limit =
+    std::max(ScanBegin, windowEnd() - std::min(windowEnd(), Reserve));
+
+  const std::string_view View{Window};
+  const std::size_t To = Limit - WindowBegin;
+  std::size_t From = ScanBegin - WindowBegin;
+  while (From < To)
+  {
+    std::size_t Position = search::find(
+      View.substr(From, To - From + Pattern.size() - 1), Pattern);
+    if (Position == std::string_view::npos)
+      break;
+    Position += From;
+
+    const std::size_t Before = Position - std::min(Position, ContextMax);
+    std::size_t LineBegin = View.substr(Before, Position - Before).rfind('\n');
+    LineBegin = LineBegin == std::string_view::npos ? Before
+                                                    : Before + LineBegin + 1;
+    const std::size_t MatchEnd = Position + Pattern.size();
+    const std::size_t After = std::min(View.size(), MatchEnd + ContextMax);
+    std::size_t LineEnd = View.substr(MatchEnd, After - MatchEnd).find('\n');
+    const bool Terminated = LineEnd != std::string_view::npos;
+    LineEnd = Terminated ? MatchEnd + LineEnd : After;
+
+    std::string_view Context = View.substr(LineBegin, LineEnd - LineBegin);
+    if (!Context.empty() && Context.back() == '\r')
+      Context.remove_suffix(1);
+    Matches.emplace_back(Match{WindowBegin + Position, std::string{Context}});
+
+    // Every line is only reported once.
+    From = Terminated ? LineEnd + 1 : MatchEnd;
+  }
+  ScanBegin = std::max(Limit, WindowBegin + From);
+
+  // Only keep what the context of the next match might need.
+  if (const std::size_t Keep = ScanBegin - std::min(ScanBegin, ContextMax);
+      Keep > WindowBegin)
+  {
+    Window.erase(0, Keep - WindowBegin);
+    WindowBegin = Keep;
+  }
+
+  return Exhausted;
+}
+
+} // namespace monomux::server
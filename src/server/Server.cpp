@@ -16,15 +16,33 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <set>
-#include <thread>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "monomux/adt/POD.hpp"
+#include "monomux/adt/ScopeGuard.hpp"
+#include "monomux/control/ChannelFrame.hpp"
+#include "monomux/control/CompressedFrame.hpp"
 #include "monomux/control/PascalString.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/Environment.hpp"
+#include "monomux/system/SlabPool.hpp"
 #include "monomux/system/Time.hpp"
+#include "monomux/Allocation.hpp"
+#include "monomux/Trace.hpp"
 
 #include "monomux/server/Server.hpp"
 
@@ -35,9 +53,16 @@ namespace monomux::server
 {
 
 Server::Server(Socket&& Sock)
-  : Sock(std::move(Sock)), ExitIfNoMoreSessions(false)
+  : Sock(std::move(Sock)), ExitIfNoMoreSessions(false), SpliceRelay(false),
+    UseIOUring(false), SignalEvents(false), UseForkServer(false),
+    FlowControl(true),
+    SharedOutput(false), PublishStatus(true), Sizing(SizePolicy::Latest),
+    MemoryBudget(0),
+    ScrollbackSize(DefaultScrollbackSize),
+    CoalesceWindow(0), RateLimit(0), SessionPoolSize(0), HibernateAfter(0),
+    ListenBacklog(DefaultListenBacklog), StallDeadline(0),
+    ShutdownGrace(DefaultShutdownGrace), WorkerCount(0)
 {
-  setUpDispatch();
   DeadChildren.fill(Process::Invalid);
 }
 
@@ -46,7 +71,9 @@ Server::~Server() = default;
 void Server::registerMessageHandler(std::uint16_t Kind,
                                     std::function<HandlerFunction> Handler)
 {
-  Dispatch[Kind] = std::move(Handler);
+  if (Kind >= Overrides.size())
+    Overrides.resize(Kind + 1);
+  Overrides[Kind] = std::move(Handler);
 }
 
 void Server::setExitIfNoMoreSessions(bool ExitIfNoMoreSessions)
@@ -54,13 +81,207 @@ void Server::setExitIfNoMoreSessions(bool ExitIfNoMoreSessions)
   this->ExitIfNoMoreSessions = ExitIfNoMoreSessions;
 }
 
+void Server::setSpliceRelay(bool SpliceRelay)
+{
+  this->SpliceRelay = SpliceRelay;
+}
+
+void Server::setIOUring(bool UseIOUring)
+{
+  this->UseIOUring = UseIOUring;
+}
+
+void Server::setWorkerCount(std::size_t WorkerCount)
+{
+  this->WorkerCount = WorkerCount;
+}
+
+void Server::setSignalEvents(bool SignalEvents)
+{
+  this->SignalEvents = SignalEvents;
+}
+
+void Server::setForkServer(bool UseForkServer)
+{
+  this->UseForkServer = UseForkServer;
+}
+
+void Server::setSessionPoolSize(std::size_t Size)
+{
+  this->SessionPoolSize = Size;
+}
+
+void Server::setHibernateAfter(std::chrono::seconds After)
+{
+  this->HibernateAfter = After;
+}
+
+void Server::setListenBacklog(std::size_t Backlog)
+{
+  this->ListenBacklog = Backlog;
+}
+
+void Server::setStallDeadline(std::chrono::milliseconds Deadline)
+{
+  StallDeadline = Deadline;
+}
+
+void Server::setSizePolicy(SizePolicy Policy) { Sizing = Policy; }
+
+void Server::setShutdownGrace(std::chrono::milliseconds Grace)
+{
+  ShutdownGrace = Grace;
+}
+
+void Server::setRecordDirectory(std::string Directory)
+{
+  RecordDirectory = std::move(Directory);
+}
+
+void Server::setStatusPage(bool StatusPage) { PublishStatus = StatusPage; }
+
+void Server::setFlowControl(bool FlowControl)
+{
+  this->FlowControl = FlowControl;
+}
+
+void Server::setMemoryBudget(std::size_t Budget) { MemoryBudget = Budget; }
+
+std::size_t Server::memoryUsage() noexcept
+{
+  return SlabPool::usedBytes() + SessionData::totalOutputBacklogSize();
+}
+
+void Server::setSharedOutput(bool SharedOutput)
+{
+  this->SharedOutput = SharedOutput;
+}
+
+void Server::setReadinessNotification(fd FD)
+{
+  if (ReadinessNotification.has())
+    fd::close(ReadinessNotification.release());
+  ReadinessNotification = std::move(FD);
+}
+
+void Server::setScrollbackSize(std::size_t ScrollbackSize)
+{
+  this->ScrollbackSize = ScrollbackSize;
+}
+
+void Server::setCoalesceWindow(std::chrono::microseconds Window)
+{
+  this->CoalesceWindow = Window;
+}
+
+void Server::setRateLimit(std::size_t BytesPerSecond)
+{
+  this->RateLimit = BytesPerSecond;
+}
+
+/// Whether the current thread is a worker thread of a \p Server.
+static thread_local bool OnWorkerThread = false;
+/// The counters of the event loop running on the current thread, if any.
+static thread_local LoopMetrics* CurrentLoopMetrics = nullptr;
+/// The number of bytes of output the sessions that are not interactive may
+/// relay in the current iteration of the event loop of the current thread.
+static thread_local std::size_t CurrentSessionQuota = Server::DrainBudget;
+
+/// \returns whether \p Session received input so recently before \p Now that
+/// its output is likely the response to it, e.g. the echo of keystrokes.
+static bool
+isInteractive(const SessionData& Session,
+              std::chrono::steady_clock::time_point Now =
+                std::chrono::steady_clock::now()) noexcept
+{
+  return Now - Session.lastInput() < Server::CoalesceInputBypass;
+}
+
+/// Accounts an iteration of the event loop of \p Poll in \p Metrics, which
+/// handled \p Events since \p Begin.
+static void countIteration(LoopMetrics& Metrics,
+                           const EPoll& Poll,
+                           std::size_t Events,
+                           std::chrono::steady_clock::time_point Begin)
+{
+  ++Metrics.Iterations;
+  Metrics.Events += Events;
+  Metrics.MaxEvents =
+    std::max<std::uint64_t>(Metrics.MaxEvents, Poll.getEventCount());
+  if (Poll.getEventCount() == Poll.getMaxEventCount())
+    ++Metrics.Saturated;
+  Metrics.Rescheduled += Poll.getScheduledCount();
+  Metrics.Syscalls = syscallCount();
+  Metrics.IterationTime.record(
+    std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Begin));
+}
+
+/// Creates an \p eventfd(2) that is used to wake up an event loop.
+static fd makeWakeup()
+{
+  return CheckedPOSIXThrow(
+    [] { return ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); }, "eventfd()", -1);
+}
+
+/// Wakes up the event loop that listens to the \p eventfd(2) \p Wakeup.
+static void notify(const fd& Wakeup) noexcept
+{
+  const std::uint64_t One = 1;
+  // If the counter is saturated, the wakeup is already due.
+  (void)CheckedPOSIX(
+    [&Wakeup, &One] { return ::write(Wakeup, &One, sizeof(One)); }, -1);
+}
+
+/// Resets the \p eventfd(2) \p Wakeup after it woke its event loop up.
+static void drain(const fd& Wakeup) noexcept
+{
+  std::uint64_t Count;
+  (void)CheckedPOSIX(
+    [&Wakeup, &Count] { return ::read(Wakeup, &Count, sizeof(Count)); }, -1);
+}
+
+/// Creates the notification of the \p Event that happened to \p Session.
+static message::notification::SessionEvent
+sessionEvent(message::notification::SessionEvent::EventKind Event,
+             const SessionData& Session)
+{
+  message::notification::SessionEvent Msg;
+  Msg.Event = Event;
+  Msg.Session.Name = Session.name();
+  Msg.Session.Created =
+    std::chrono::system_clock::to_time_t(Session.whenCreated());
+  Msg.AttachedClients = Session.getAttachedClients().size();
+  return Msg;
+}
+
 /// Reschedules the overflown buffer identified by \p BO to the next iteration
 /// of \p Poll.
 static void rescheduleOverflow(EPoll& Poll, const buffer_overflow& BO)
 {
+  if (CurrentLoopMetrics)
+    ++CurrentLoopMetrics->Overflows;
   Poll.schedule(BO.fd(), BO.readOverflow(), BO.writeOverflow());
 }
 
+/// Calls the timers of \p Poll that had expired.
+static void fireTimers(EPoll& Poll)
+{
+  try
+  {
+    Poll.fireTimers();
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Timer handling error:\n\t" << BO.what();
+    rescheduleOverflow(Poll, BO);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Timer handling error:\n\t" << Err.what();
+  }
+}
+
 /// Tries to flush the contents of the socket, and if the flushing fails,
 /// schedules it for the next iteration of \p Poll.
 static void flushAndReschedule(EPoll& Poll, Socket& S)
@@ -70,63 +291,353 @@ static void flushAndReschedule(EPoll& Poll, Socket& S)
     Poll.schedule(S.raw(), /* Incoming =*/false, /* Outgoing =*/true);
 }
 
+/// Sends the next part of the streamed responses of \p Client once the
+/// previous part left, and schedules the rest, and the part that did not fit
+/// into the socket, for the next iteration of \p Poll. Only one part is sent
+/// per iteration, so a large response is interleaved with the rest of the work
+/// of the server.
+static void sendResponsePartAndReschedule(EPoll& Poll, ClientData& Client)
+{
+  Socket& Control = Client.getControlSocket();
+  if (Client.hasResponseStream() && !Control.hasBufferedWrite())
+    Client.sendResponsePart();
+  if (Client.hasResponseStream() || Control.hasBufferedWrite())
+    Poll.schedule(Control.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+/// The amount of data waiting in the buffer of a multiplexed data connection
+/// above which no more output is framed for its channels, so the output of one
+/// session does not pile up in front of the others. The rest is served from the
+/// backlog of the sessions once the connection drains.
+static constexpr std::size_t ChannelBufferHighWatermark = 1ULL << 18;
+
+/// Writes \p Data as frames of the channel \p Client to the data connection of
+/// its parent, either sending or buffering all of it.
+static void writeChannelFrames(Socket& DS,
+                               const ClientData& Client,
+                               const BufferedChannel::BufferView& Data)
+{
+  std::string Frames;
+  for (std::string_view Segment : Data)
+    message::appendChannelFrames(Frames, Client.channel(), Segment);
+  try
+  {
+    DS.write(Frames);
+  }
+  catch (const buffer_overflow&)
+  {
+    // The frames are kept in the buffer regardless, and flow control stops
+    // the sessions from adding more.
+  }
+}
+
+/// Writes \p Data compressed to the data connection \p DS, either sending or
+/// buffering all of it. Each call makes whole frames, so the client can show
+/// everything relayed so far without waiting for more.
+static void writeCompressedFrames(Socket& DS,
+                                  const BufferedChannel::BufferView& Data)
+{
+  std::string Frames;
+  for (std::string_view Segment : Data)
+    message::appendCompressedFrames(Frames, Segment);
+  try
+  {
+    DS.write(Frames);
+  }
+  catch (const buffer_overflow&)
+  {
+    // The frames are kept in the buffer regardless, and flow control stops
+    // the sessions from adding more.
+  }
+}
+
+/// Sends \p Data to \p Client, through the ring shared with the client if it
+/// has one, or its data connection otherwise.
+///
+/// \returns the number of bytes sent.
+static std::size_t sendOutput(ClientData& Client,
+                              const BufferedChannel::BufferView& Data)
+{
+  std::size_t Sent;
+  if (Client.isChannel())
+  {
+    Socket& DS = *Client.getDataSocket();
+    if (DS.writeInBuffer() >= ChannelBufferHighWatermark)
+      return 0;
+    writeChannelFrames(DS, Client, Data);
+    Sent = Data.at(0).size() + Data.at(1).size();
+  }
+  else if (Client.isCompressed())
+  {
+    // The compressed frames are made whole, so like the frames of channels,
+    // they are buffered up to a limit.
+    Socket& DS = *Client.getDataSocket();
+    if (DS.writeInBuffer() >= ChannelBufferHighWatermark)
+      return 0;
+    writeCompressedFrames(DS, Data);
+    Sent = Data.at(0).size() + Data.at(1).size();
+  }
+  else if (SharedRing* Ring = Client.getOutputRing())
+  {
+    Sent = Ring->write(Data.at(0));
+    if (Sent == Data.at(0).size())
+      Sent += Ring->write(Data.at(1));
+  }
+  else
+    Sent = Client.getDataSocket()->tryWrite(Data);
+  Client.countSent(Sent);
+  return Sent;
+}
+
+/// Makes \p Poll resume sending output to \p Client once the client can take
+/// more of it.
+static void rescheduleOutput(EPoll& Poll, ClientData& Client)
+{
+  if (SharedRing* Ring = Client.getOutputRing())
+  {
+    if (Ring->corrupt())
+      // The client is dropped, waiting for it is pointless.
+      return;
+    if (!Ring->awaitSpace())
+      // The client freed up space before it could know it should tell.
+      Poll.schedule(
+        Ring->spaceBell(), /* Incoming =*/true, /* Outgoing =*/false);
+    return;
+  }
+  Poll.schedule(
+    Client.getDataSocket()->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
+/// Sends the output of the session the \p Client is attached to that the client
+/// had not received yet, and if not everything could be sent, schedules the
+/// rest for the next iteration of \p Poll.
+static void flushOutputAndReschedule(EPoll& Poll, ClientData& Client)
+{
+  // Do not let replaying a long scrollback starve the other connections.
+  static constexpr std::size_t FlushLimit = 1ULL << 18; // 256 KiB
+
+  Socket& DS = *Client.getDataSocket();
+  DS.flushWrites();
+
+  if (Client.hasSpliceResidue())
+  {
+    // Data in the kernel pipe precedes everything that is in the backlog.
+    Client.getSplicePipe()->drain(DS.raw());
+    if (Client.hasSpliceResidue())
+    {
+      Poll.schedule(DS.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+      return;
+    }
+  }
+
+  if (SessionData* S = Client.getAttachedSession())
+  {
+    const std::size_t Begin = Client.outputCursor();
+    std::size_t Cursor = Begin;
+    while (Cursor < S->outputEnd() && Cursor - Begin < FlushLimit)
+    {
+      std::string_view Data = S->peekOutput(Cursor);
+      if (Data.empty())
+        break;
+
+      const std::size_t Sent = sendOutput(Client, {Data, {}});
+      Cursor += Sent;
+      if (Sent < Data.size())
+        break;
+    }
+    Client.setOutputCursor(Cursor);
+    S->trimOutput();
+
+    if (Cursor < S->outputEnd())
+    {
+      rescheduleOutput(Poll, Client);
+      return;
+    }
+  }
+
+  if (DS.hasBufferedWrite())
+    Poll.schedule(DS.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+}
+
 void Server::loop()
 {
-  static constexpr std::size_t ListenQueue = 16;
+  // The allocations of the loop are the server's, unless a more specific
+  // scope is entered.
+  MONOMUX_ALLOCATION_SCOPE(Server);
   static constexpr std::size_t EventQueue = 1 << 13;
 
+  if (UseForkServer && !Spawner)
+  {
+    // Fork the helper while the server is still small, and has no threads.
+    try
+    {
+      Spawner = std::make_unique<ForkServer>(ForkServer::start());
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(warn) << "Starting the fork server failed, spawning sessions "
+                   "directly: "
+                << SE.what();
+    }
+  }
+
   WhenStarted = std::chrono::system_clock::now();
-  Sock.listen(ListenQueue);
+  Sock.listen(ListenBacklog);
 
   fd::addStatusFlag(Sock.raw(), O_NONBLOCK);
-  Poll = std::make_unique<EPoll>(EventQueue);
+  Poll = std::make_unique<EPoll>(
+    EventQueue, UseIOUring ? EPoll::Backend::IOUring : EPoll::Backend::EPoll);
   Poll->listen(Sock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  if (Spawner)
+    Poll->listen(Spawner->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+
+  ReserveFD = CheckedPOSIX(
+                [] { return ::open("/dev/null", O_RDONLY | O_CLOEXEC); }, -1)
+                .get();
+  Poll->addTimer(IdleSweepInterval, [this] { sweepIdleResources(); });
+  Poll->addTimer(ScrollbackCompactInterval, [this] { compactScrollback(); });
+  if (MemoryBudget)
+    Poll->addTimer(MemoryBudgetCheckInterval, [this] { checkMemoryBudget(); });
+  if (HibernateAfter.count())
+  {
+    // Nesting an epoll instance is only possible if it is not a ring.
+    ColdPoll = std::make_unique<EPoll>(EventQueue, EPoll::Backend::EPoll);
+    Poll->listen(ColdPoll->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+    hibernateIdleSessions();
+  }
+  if (PublishStatus)
+  {
+    const std::string Path =
+      SocketPath::absolutise(Sock.identifier()).statusPagePath();
+    try
+    {
+      Status.emplace(StatusPage::create(Path));
+      Poll->addTimer(StatusPageInterval, [this] { refreshStatus(); });
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(warn) << "Failed to create the status page '" << Path
+                << "': " << SE.what();
+    }
+  }
 
-  auto NewClient = [this]() -> bool {
-    std::error_code Error;
-    bool Recoverable;
-    std::optional<Socket> ClientSock = Sock.accept(&Error, &Recoverable);
-    if (!ClientSock)
+  auto NewClients = [this]() {
+    const auto Begin = std::chrono::steady_clock::now();
+    // The listening socket is level-triggered, so the connections left over
+    // after the budget ran out are reported again in the next iteration.
+    for (std::size_t I = 0; I < AcceptBudget; ++I)
     {
-      if (Recoverable)
+      std::error_code Error;
+      bool Recoverable = false;
+      std::optional<Socket> ClientSock = Sock.accept(&Error, &Recoverable);
+      if (!ClientSock)
+      {
+        if (Error == std::errc::resource_unavailable_try_again)
+          // Every pending connection was accepted.
+          return;
+        if (!Recoverable)
+        {
+          LOG(error) << "accept() did not succeed: " << Error
+                     << " (not recoverable)";
+          return;
+        }
+
         LOG(warn) << "accept() did not succeed: " << Error;
-      else
-        LOG(error) << "accept() did not succeed: " << Error
-                   << " (not recoverable)";
+        if (shedConnection())
+          return;
+
+        // Stop accepting for a while, without blocking the relay of the
+        // existing sessions, in the hope that resources get freed up.
+        Poll->stop(Sock.raw());
+        Poll->addTimer(AcceptRetryDelay, [this] {
+          Poll->listen(Sock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+        });
+        return;
+      }
 
-      if (Recoverable)
+      // A new client was accepted.
+      if (ClientData* ExistingClient = getClient(ClientSock->raw()))
       {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        return true;
+        // The client with the same socket FD is already known.
+        // TODO: What is the good way of handling this?
+        LOG(debug) << "Stale socket of gone client, " << ClientSock->raw()
+                   << " left behind?";
+        exitCallback(*ExistingClient);
+        removeClient(*ExistingClient);
       }
-      return false;
+
+      ClientData* Client = makeClient(
+        ClientData{std::make_unique<Socket>(std::move(*ClientSock))});
+      acceptCallback(*Client);
+
+      ++MainLoopMetrics.Accepted;
+      MainLoopMetrics.AcceptTime.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - Begin));
     }
+  };
 
-    // A new client was accepted.
-    if (ClientData* ExistingClient = getClient(ClientSock->raw()))
+  ScopeGuard LoopMetricsGuard{[this] { CurrentLoopMetrics = &MainLoopMetrics; },
+                              [] { CurrentLoopMetrics = nullptr; }};
+  ScopeGuard SignalEventsGuard{[this] { startSignalEvents(); },
+                               [this] { stopSignalEvents(); }};
+  ScopeGuard WorkerThreads{[this] { startWorkers(); },
+                           [this] { stopWorkers(); }};
+  {
+    ScopeGuard Paused{[this] { pauseWorkers(); }, [this] { resumeWorkers(); }};
+    for (SessionData* S : ResumedSessions)
+      registerSessionIO(*S);
+    if (!ResumedSessions.empty())
     {
-      // The client with the same socket FD is already known.
-      // TODO: What is the good way of handling this?
-      LOG(debug) << "Stale socket of gone client, " << ClientSock->raw()
-                 << " left behind?";
-      exitCallback(*ExistingClient);
-      removeClient(*ExistingClient);
+      ResumedSessions.clear();
+      // The server did not receive the signals of sessions that exited during
+      // the upgrade.
+      reapExitedChildren();
     }
+    replenishSessionPool();
+    // The page is published before the server is announced ready, so the
+    // sessions resumed after an upgrade are listed right away.
+    publishStatus();
+  }
 
-    ClientData* Client =
-      makeClient(ClientData{std::make_unique<Socket>(std::move(*ClientSock))});
-    acceptCallback(*Client);
-    return false;
-  };
+  if (ReadinessNotification.has())
+  {
+    const char Ready = 1;
+    CheckedPOSIX(
+      [FD = ReadinessNotification.get(), &Ready] {
+        return ::write(FD, &Ready, sizeof(Ready));
+      },
+      -1);
+    fd::close(ReadinessNotification.release());
+  }
 
+  ScopeGuard WatchdogGuard{[this] { startWatchdog(); },
+                           [this] { Watch.reset(); }};
+  std::vector<std::size_t> EventOrder;
   while (!TerminateLoop.get().load())
   {
-    // Process "external" events.
-    reapDeadChildren();
+    {
+      ScopeGuard Paused{[this] { pauseWorkers(); },
+                        [this] { resumeWorkers(); }};
+      // Process "external" events.
+      if (Watch)
+        Watch->enter(Watchdog::Phase::Children);
+      reapDeadChildren();
+    }
 
+    if (Watch)
+      if (std::optional<Watchdog::Stall> Stall = Watch->idle())
+        reportStall(*Stall);
     const std::size_t NumTriggeredFDs = Poll->wait();
-    MONOMUX_TRACE_LOG(LOG(data) << NumTriggeredFDs << " events received!");
-    for (std::size_t I = 0; I < NumTriggeredFDs; ++I)
+    if (Watch)
+      Watch->busy();
+    LoopClock::tick();
+    const auto IterationBegin = std::chrono::steady_clock::now();
+    MONOMUX_TRACEPOINT(LoopWake, -1, 0, NumTriggeredFDs);
+
+    ScopeGuard Paused{[this] { pauseWorkers(); }, [this] { resumeWorkers(); }};
+    CurrentSessionQuota = orderEvents(*Poll, NumTriggeredFDs, EventOrder);
+    for (std::size_t I : EventOrder)
     {
       EPoll::EventWithMode Event;
       try
@@ -143,479 +654,2694 @@ void Server::loop()
                    << " event received but there was no associated file";
         continue;
       }
+      if (Watch)
+        Watch->enter(Watchdog::Phase::Event, Event.FD);
 
       if (Event.FD == Sock.raw())
       {
         // Event occured on the main socket.
-        bool Retry = NewClient();
-        if (Retry)
-          --I;
+        NewClients();
         continue;
       }
-
-      // Event occured on another (connected client or session) socket.
-      MONOMUX_TRACE_LOG(LOG(trace)
-                        << "Event on file descriptor " << Event.FD
-                        << " (incoming: " << std::boolalpha << Event.Incoming
-                        << ", outgoing: " << Event.Outgoing << std::noboolalpha
-                        << ')');
-
-      LookupVariant* Entity = FDLookup.tryGet(Event.FD);
-      if (!Entity)
+      if (Poll->isTimer(Event.FD))
       {
-        LOG(error) << "\tEntity for file descriptor " << Event.FD
-                   << " missing from lookup table? (Possible internal error, "
-                      "race condition, or mid-handling disconnect?)";
+        fireTimers(*Poll);
         continue;
       }
-      try
+      if (Event.FD == Wakeup.get())
       {
-        if (auto* Session = std::get_if<SessionConnection>(Entity))
-        {
-          SessionData& S = **Session;
-          if (Event.Incoming)
-          {
-            // First check for data coming from a session. This is the most
-            // populous in terms of bandwidth.
-            dataCallback(S);
-            S.getReader()->tryFreeResources();
-          }
-          if (Event.Outgoing)
-          {
-            try
-            {
-              S.getWriter()->flushWrites();
-              S.getWriter()->tryFreeResources();
-            }
-            catch (const buffer_overflow& BO)
-            {
-              rescheduleOverflow(*Poll, BO);
-            }
-          }
-          continue;
-        }
-        if (auto* Data = std::get_if<ClientDataConnection>(Entity))
-        {
-          ClientData& C = **Data;
-          auto ClientID = C.id();
-
-          if (Event.Incoming)
-            // Second, try to see if the data is coming from a client, like
-            // keypresses and such. We expect to see many of these, too.
-            dataCallback(C);
-          if (Event.Outgoing)
-            flushAndReschedule(*Poll, *C.getDataSocket());
-
-          if (Clients.find(ClientID) != Clients.end())
-            C.getDataSocket()->tryFreeResources();
-          continue;
-        }
-        if (auto* Control = std::get_if<ClientControlConnection>(Entity))
-        {
-          ClientData& C = **Control;
-          auto ClientID = C.id();
-
-          if (Event.Incoming)
-            // Lastly, check if the receive is happening on the control
-            // connection, where messages are small and far inbetween.
-            controlCallback(C);
-          if (Event.Outgoing)
-            flushAndReschedule(*Poll, C.getControlSocket());
-
-          if (Clients.find(ClientID) != Clients.end())
-            C.getControlSocket().tryFreeResources();
-          continue;
-        }
+        drain(Wakeup);
+        handlePendingSessionEvents();
+        handleLeavingClients();
+        handleFinishedSearches();
+        continue;
       }
-      catch (const buffer_overflow& BO)
+      if (Event.FD == SignalFD.get())
       {
-        LOG(error) << "Generic handling error:\n\t" << BO.what();
-        rescheduleOverflow(*Poll, BO);
+        handleSignalEvents();
+        continue;
       }
-      catch (const std::system_error& Err)
+      if (ColdPoll && Event.FD == ColdPoll->raw())
+      {
+        handleColdEvents();
+        continue;
+      }
+      if (Spawner && Event.FD == Spawner->raw())
       {
-        // Ignore the error on the sockets and pipes, and do not tear the
-        // server down just because of them.
-        LOG(error) << "Generic handling error:\n\t" << Err.what();
+        if (Event.Outgoing)
+        {
+          Spawner->flushRequests();
+          if (Spawner->hasBufferedRequests())
+            Poll->schedule(Event.FD, /* Incoming =*/false, /* Outgoing =*/true);
+        }
+        if (Event.Incoming)
+          handleSpawnResults();
+        continue;
       }
+
+      handleEvent(*Poll, Event);
+    }
+    if (StatusStale.get().exchange(false))
+    {
+      if (Watch)
+        Watch->enter(Watchdog::Phase::Status);
+      publishStatus();
     }
+    countIteration(MainLoopMetrics, *Poll, NumTriggeredFDs, IterationBegin);
   }
+  if (Watch)
+    Watch->idle();
 }
 
-void Server::interrupt() const noexcept { TerminateLoop.get().store(true); }
-
-static void sendKickClient(ClientData& Client, std::string Reason)
+void Server::startRecording(SessionData& Session)
 {
+  if (RecordDirectory.empty())
+    return;
+
+  // Sessions may be named anything, and the same name may be reused, so the
+  // process and the time is part of the name of the file.
+  std::string FileName = Session.name();
+  std::replace(FileName.begin(), FileName.end(), '/', '_');
+  const auto Now = std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch());
+  FileName.append(".")
+    .append(std::to_string(
+      Session.hasProcess() ? Session.getProcess().raw() : Process::Invalid))
+    .append(".")
+    .append(std::to_string(Now.count()))
+    .append(SessionRecording::Extension);
+  const std::string Path = RecordDirectory + '/' + FileName;
   try
   {
-    Client.sendDetachReason(
-      monomux::message::notification::Detached::Kicked, 0, std::move(Reason));
+    Session.startRecording(SessionRecording::create(Path));
+    LOG(info) << "Session \"" << Session.name() << "\" recorded to " << Path;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": failed to start recording: " << Err.what();
   }
-  // Ignore the error. It could be that the client got auto-detached when
-  // their associated session ended.
-  catch (const buffer_overflow&)
-  {}
-  catch (const std::system_error&)
-  {}
 }
 
-void Server::shutdown()
+void Server::record(SessionData& Session,
+                    SessionRecording::Direction D,
+                    const std::array<std::string_view, 2>& Data)
 {
-  LOG(info) << "Detaching all clients...";
-  while (!Clients.empty())
+  SessionRecording* R = Session.getRecording();
+  if (!R)
+    return;
+  try
   {
-    ClientData& Client = *Clients.begin()->second;
-    try
-    {
-      Client.sendDetachReason(
-        monomux::message::notification::Detached::ServerShutdown);
-    }
-    // Ignore the error. It could be that the client got auto-detached when
-    // their associated session ended.
-    catch (const buffer_overflow&)
-    {}
-    catch (const std::system_error&)
-    {}
-    removeClient(Client);
+    R->record(D, Data);
   }
-
-  LOG(info) << "Terminating all sessions...";
-  while (!Sessions.empty())
+  catch (const std::system_error& Err)
   {
-    SessionData& Session = *Sessions.begin()->second;
-    removeSession(Session);
+    LOG(error) << "Session \"" << Session.name()
+               << "\": failed to record, stopping: " << Err.what();
+    Session.stopRecording();
   }
 }
 
-ClientData* Server::getClient(std::size_t ID) noexcept
+void Server::startWatchdog()
 {
-  auto It = Clients.find(ID);
-  return It != Clients.end() ? It->second.get() : nullptr;
+  if (!StallDeadline.count())
+    return;
+  try
+  {
+    Watch = std::make_unique<Watchdog>(StallDeadline);
+    Watch->busy();
+    MONOMUX_TRACE_LOG(LOG(debug) << "Watching the event loop for stalls of "
+                                 << StallDeadline.count() << " ms");
+  }
+  catch (const std::system_error& SE)
+  {
+    LOG(error) << "Failed to start the watchdog of the event loop: "
+               << SE.what();
+  }
 }
 
-SessionData* Server::getSession(std::string_view Name) noexcept
+void Server::reportStall(const Watchdog::Stall& Stall) const
 {
-  auto It =
-    std::find_if(Sessions.begin(), Sessions.end(), [Name](const auto& Elem) {
-      return Elem.first == Name;
-    });
-  return It != Sessions.end() ? It->second.get() : nullptr;
+  std::string Where = Watchdog::name(Stall.At);
+  if (Stall.FD != fd::Invalid)
+  {
+    Where.append(" on file descriptor ").append(std::to_string(Stall.FD));
+    const LookupVariant* Entity = FDLookup.tryGet(Stall.FD);
+    if (Stall.FD == Sock.raw())
+      Where.append(" (the server socket)");
+    else if (const auto* Control =
+               Entity ? std::get_if<ClientControlConnection>(Entity) : nullptr)
+      Where.append(" (control of client \"")
+        .append(std::to_string((*Control)->id()))
+        .append("\")");
+    else if (const auto* Data =
+               Entity ? std::get_if<ClientDataConnection>(Entity) : nullptr)
+      Where.append(" (data of client \"")
+        .append(std::to_string((*Data)->id()))
+        .append("\")");
+    else if (const auto* Session =
+               Entity ? std::get_if<SessionConnection>(Entity) : nullptr)
+      Where.append(" (session \"").append((*Session)->name()).append("\")");
+  }
+  LOG(warn) << "Event loop stalled for "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 Stall.Duration)
+                 .count()
+            << " ms in " << Where;
+}
+
+std::size_t Server::orderEvents(EPoll& Poll,
+                                std::size_t Count,
+                                std::vector<std::size_t>& Order)
+{
+  Order.clear();
+  Order.reserve(Count);
+  auto SessionOf = [this, &Poll](std::size_t I) -> SessionData* {
+    LookupVariant* Entity = FDLookup.tryGet(Poll.fdAt(I));
+    if (!Entity)
+      return nullptr;
+    auto* Session = std::get_if<SessionConnection>(Entity);
+    return Session ? &**Session : nullptr;
+  };
+
+  for (std::size_t I = 0; I < Count; ++I)
+    if (!SessionOf(I))
+      Order.emplace_back(I);
+  if (Order.size() == Count)
+    return DrainBudget;
+
+  const auto Now = std::chrono::steady_clock::now();
+  for (std::size_t I = 0; I < Count; ++I)
+    if (SessionData* S = SessionOf(I); S && isInteractive(*S, Now))
+      Order.emplace_back(I);
+  const std::size_t BulkBegin = Order.size();
+  for (std::size_t I = 0; I < Count; ++I)
+    if (SessionData* S = SessionOf(I); S && !isInteractive(*S, Now))
+      Order.emplace_back(I);
+
+  const std::size_t BulkCount = Order.size() - BulkBegin;
+  if (!BulkCount)
+    return DrainBudget;
+  return std::clamp(
+    IterationOutputBudget / BulkCount, SessionQuotaMin, DrainBudget);
+}
+
+void Server::handleEvent(EPoll& Current, EPoll::EventWithMode Event)
+{
+  // Event occured on another (connected client or session) socket.
+  MONOMUX_TRACEPOINT(LoopEvent,
+                     Event.FD,
+                     (Event.Incoming ? 1 : 0) | (Event.Outgoing ? 2 : 0),
+                     0);
+
+  LookupVariant* Entity = FDLookup.tryGet(Event.FD);
+  if (!Entity)
+  {
+    LOG(error) << "\tEntity for file descriptor " << Event.FD
+               << " missing from lookup table? (Possible internal error, "
+                  "race condition, or mid-handling disconnect?)";
+    return;
+  }
+  try
+  {
+    if (auto* Session = std::get_if<SessionConnection>(Entity))
+    {
+      SessionData& S = **Session;
+      if (&pollOf(S) != &Current)
+        // The event was reported before the file was reassigned.
+        return;
+
+      if (Event.Incoming && !deferOutput(S))
+      {
+        // First check for data coming from a session. This is the most
+        // populous in terms of bandwidth.
+        dataCallback(S);
+        S.getReader()->tryFreeResources();
+      }
+      if (Event.Outgoing)
+      {
+        try
+        {
+          S.getWriter()->flushWrites();
+          if (S.getWriter()->hasBufferedWrite())
+            Current.schedule(Event.FD,
+                             /* Incoming =*/false,
+                             /* Outgoing =*/true);
+          else
+            S.getWriter()->tryFreeResources();
+        }
+        catch (const buffer_overflow& BO)
+        {
+          rescheduleOverflow(Current, BO);
+        }
+      }
+      return;
+    }
+    if (auto* Exit = std::get_if<SessionExitConnection>(Entity))
+    {
+      SessionData& S = **Exit;
+      if (&Current != Poll.get())
+        // Sessions are reaped only by the main loop.
+        return;
+
+      if (!reapSession(S))
+        // The process was collected through another path, and the handle
+        // would stay readable forever.
+        unwatchExit(S);
+      return;
+    }
+    if (auto* Data = std::get_if<ClientDataConnection>(Entity))
+    {
+      ClientData& C = **Data;
+      auto ClientID = C.id();
+      if (&pollOf(C) != &Current)
+        // The client attached to or detached from a session handled by another
+        // event loop since the event was reported.
+        return;
+
+      if (Event.Incoming)
+        // Second, try to see if the data is coming from a client, like
+        // keypresses and such. We expect to see many of these, too.
+        dataCallback(C);
+      if (!getClient(ClientID))
+        // The client disconnected during the read.
+        return;
+      if (Event.Outgoing)
+      {
+        flushOutputAndReschedule(Current, C);
+        if (SessionData* S = C.getAttachedSession())
+          updateFlowControl(*S);
+        // The channels are served from the backlog of their sessions, as the
+        // shared connection can take more.
+        for (ClientData* Channel : C.channelsInTurn())
+        {
+          flushOutputAndReschedule(Current, *Channel);
+          if (SessionData* S = Channel->getAttachedSession())
+            updateFlowControl(*S);
+        }
+      }
+
+      C.getDataSocket()->tryFreeResources();
+      return;
+    }
+    if (auto* Ring = std::get_if<ClientOutputRingConnection>(Entity))
+    {
+      ClientData& C = **Ring;
+      if (&pollOf(C) != &Current)
+        return;
+
+      // The client freed up space in the ring.
+      C.getOutputRing()->clearSpaceBell();
+      flushOutputAndReschedule(Current, C);
+      if (C.getOutputRing()->corrupt())
+      {
+        LOG(error) << "Client \"" << C.id() << "\" corrupted its output ring";
+        dropClient(C);
+        return;
+      }
+      if (SessionData* S = C.getAttachedSession())
+        updateFlowControl(*S);
+      return;
+    }
+    if (auto* Control = std::get_if<ClientControlConnection>(Entity))
+    {
+      ClientData& C = **Control;
+      auto ClientID = C.id();
+      if (&Current != Poll.get())
+        // Control connections are only handled by the main loop.
+        return;
+
+      if (Event.Incoming)
+        // Lastly, check if the receive is happening on the control
+        // connection, where messages are small and far inbetween.
+        controlCallback(C);
+      if (!getClient(ClientID))
+        // The client disconnected, or was turned into a data connection.
+        return;
+      if (Event.Outgoing)
+      {
+        flushAndReschedule(Current, C.getControlSocket());
+        sendResponsePartAndReschedule(Current, C);
+      }
+
+      C.getControlSocket().tryFreeResources();
+      return;
+    }
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Generic handling error:\n\t" << BO.what();
+    rescheduleOverflow(Current, BO);
+  }
+  catch (const std::system_error& Err)
+  {
+    // Ignore the error on the sockets and pipes, and do not tear the
+    // server down just because of them.
+    LOG(error) << "Generic handling error:\n\t" << Err.what();
+  }
+}
+
+void Server::interrupt() const noexcept { TerminateLoop.get().store(true); }
+
+void Server::requestUpgrade() const noexcept
+{
+  UpgradeRequested.get().store(true);
+  interrupt();
+}
+
+/// \returns the set of signals the server receives through its
+/// \p signalfd(2), if enabled.
+static POD<::sigset_t> signalEventSet()
+{
+  POD<::sigset_t> Set;
+  ::sigemptyset(&Set);
+  ::sigaddset(&Set, SIGCHLD);
+  ::sigaddset(&Set, SIGHUP);
+  ::sigaddset(&Set, SIGINT);
+  ::sigaddset(&Set, SIGTERM);
+  ::sigaddset(&Set, SIGUSR2);
+  return Set;
+}
+
+void Server::startSignalEvents()
+{
+  if (!SignalEvents)
+    return;
+
+  POD<::sigset_t> Set = signalEventSet();
+  // Block the signals first, so none of them is delivered to the handlers
+  // between creating the file and starting to watch it.
+  ::pthread_sigmask(SIG_BLOCK, &Set, nullptr);
+  auto SFD = CheckedPOSIX(
+    [&Set] { return ::signalfd(-1, &Set, SFD_NONBLOCK | SFD_CLOEXEC); }, -1);
+  if (!SFD)
+  {
+    LOG(warn) << "signalfd() failed, falling back to signal handlers: "
+              << SFD.getError().message();
+    ::pthread_sigmask(SIG_UNBLOCK, &Set, nullptr);
+    return;
+  }
+
+  SignalFD = SFD.get();
+  Poll->listen(SignalFD.get(), /* Incoming =*/true, /* Outgoing =*/false);
+  MONOMUX_TRACE_LOG(LOG(debug) << "Receiving signals through signalfd "
+                               << SignalFD.get());
+
+  // Children that exited before the signals were blocked are only recorded
+  // by the handler, which is not consulted again.
+  reapExitedChildren();
+}
+
+void Server::stopSignalEvents()
+{
+  if (!SignalFD.has())
+    return;
+
+  Poll->stop(SignalFD.get());
+  SignalFD = fd{};
+  // Signals that are still pending are delivered to the handlers now.
+  POD<::sigset_t> Set = signalEventSet();
+  ::pthread_sigmask(SIG_UNBLOCK, &Set, nullptr);
+}
+
+void Server::handleSignalEvents()
+{
+  bool ChildExited = false;
+  while (true)
+  {
+    POD<struct ::signalfd_siginfo> Info;
+    auto Read = CheckedPOSIX(
+      [this, &Info] { return ::read(SignalFD.get(), &Info, sizeof(Info)); },
+      -1);
+    if (!Read || static_cast<std::size_t>(Read.get()) != sizeof(Info))
+      // Drained the pending signals.
+      break;
+
+    if (Info->ssi_signo == SIGCHLD)
+    {
+      // Signals of the same kind coalesce while pending, so the PID carried
+      // in the signal is not necessarily the only child that exited.
+      ChildExited = true;
+      continue;
+    }
+    if (Info->ssi_signo == SIGUSR2)
+    {
+      LOG(info) << "Received " << ::strsignal(SIGUSR2) << ", upgrading";
+      requestUpgrade();
+      continue;
+    }
+
+    LOG(info) << "Received " << ::strsignal(static_cast<int>(Info->ssi_signo))
+              << ", shutting down";
+    interrupt();
+  }
+
+  if (ChildExited)
+    reapExitedChildren();
+}
+
+void Server::watchExit(SessionData& Session)
+{
+  if (!SignalEvents || !Session.hasProcess())
+    return;
+
+  fd Watch = Session.getProcess().openExitWatch();
+  if (!Watch.has())
+    return;
+
+  Poll->listen(Watch.get(), /* Incoming =*/true, /* Outgoing =*/false);
+  FDLookup[Watch.get()] = SessionExitConnection{&Session};
+  Session.setExitWatch(std::move(Watch));
+}
+
+void Server::unwatchExit(SessionData& Session)
+{
+  raw_fd Watch = Session.exitWatch();
+  if (Watch == fd::Invalid)
+    return;
+
+  Poll->stop(Watch);
+  FDLookup.erase(Watch);
+  Session.setExitWatch({});
+}
+
+static void sendKickClient(ClientData& Client, std::string Reason)
+{
+  try
+  {
+    Client.sendDetachReason(
+      monomux::message::notification::Detached::Kicked, 0, std::move(Reason));
+  }
+  // Ignore the error. It could be that the client got auto-detached when
+  // their associated session ended.
+  catch (const buffer_overflow&)
+  {}
+  catch (const std::system_error&)
+  {}
+}
+
+void Server::shutdown()
+{
+  // Every client learns about the shutdown in the same pass, and the ones
+  // disconnected later are not told about the others leaving.
+  ShuttingDown = true;
+  LOG(info) << "Detaching all clients...";
+  for (ClientData& Client : Clients)
+  {
+    try
+    {
+      Client.sendDetachReason(
+        monomux::message::notification::Detached::ServerShutdown);
+    }
+    // Ignore the error. It could be that the client got auto-detached when
+    // their associated session ended.
+    catch (const buffer_overflow&)
+    {}
+    catch (const std::system_error&)
+    {}
+  }
+  while (!Clients.empty())
+    removeClient(*Clients.begin());
+
+  for (PendingSpawn& P : PendingSpawns)
+    Sessions.erase(*P.Session);
+  PendingSpawns.clear();
+  Spawner.reset();
+
+  terminateSessions();
+}
+
+void Server::terminateSessions()
+{
+  // The exits are collected from a separate event loop, as the handlers of
+  // the main one are not usable anymore, with all the clients gone.
+  EPoll Reaper{Sessions.size() + 1, EPoll::Backend::EPoll};
+  std::unordered_map<raw_fd, SessionData*> Watched;
+  std::vector<fd> Watches;
+  std::set<SessionData*> Running;
+  for (SessionData& S : Sessions)
+  {
+    if (!S.hasProcess() || S.getProcess().dead())
+      continue;
+    Process& Proc = S.getProcess();
+    Proc.signal(SIGHUP);
+    Running.emplace(&S);
+    if (fd Watch = Proc.openExitWatch(); Watch.has())
+    {
+      Reaper.listen(Watch.get(), /* Incoming =*/true, /* Outgoing =*/false);
+      Watched.emplace(Watch.get(), &S);
+      Watches.emplace_back(std::move(Watch));
+    }
+  }
+  LOG(info) << "Terminating " << Running.size() << " sessions...";
+
+  const auto Begin = std::chrono::steady_clock::now();
+  bool Killed = false;
+  bool GaveUp = false;
+  auto Reap = [&Running](SessionData* S) {
+    if (S->getProcess().reapIfDead())
+      Running.erase(S);
+  };
+  // Processes that could not be watched are checked periodically.
+  std::function<void()> ReapAll = [&] {
+    const std::vector<SessionData*> Remaining{Running.begin(), Running.end()};
+    for (SessionData* S : Remaining)
+      Reap(S);
+    Reaper.addTimer(ShutdownReapInterval, ReapAll);
+  };
+  if (Watched.size() < Running.size())
+    Reaper.addTimer(ShutdownReapInterval, ReapAll);
+  Reaper.addTimer(ShutdownGrace, [&] {
+    LOG(warn) << Running.size() << " sessions did not exit in "
+              << ShutdownGrace.count() << " ms, killing them";
+    for (SessionData* S : Running)
+      S->getProcess().signal(SIGKILL);
+    Killed = true;
+    Reaper.addTimer(ShutdownKillWait, [&GaveUp] { GaveUp = true; });
+  });
+
+  while (!Running.empty() && !GaveUp)
+  {
+    const std::size_t Count = Reaper.wait();
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      const raw_fd FD = Reaper.fdAt(I);
+      if (Reaper.isTimer(FD))
+      {
+        Reaper.fireTimers();
+        continue;
+      }
+      if (auto It = Watched.find(FD); It != Watched.end())
+      {
+        // The process might have been collected by someone else already, and
+        // the watch would be reported again.
+        Reaper.stop(FD);
+        Reap(It->second);
+        Running.erase(It->second);
+        Watched.erase(It);
+      }
+    }
+  }
+
+  const auto Took = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - Begin);
+  if (!Running.empty())
+    LOG(error) << Running.size() << " sessions did not exit even after "
+               << "being killed, abandoning them";
+  LOG(info) << "Sessions terminated in " << Took.count() << " ms"
+            << (Killed ? " (some were killed)" : "");
+
+  while (!SessionsByName.empty())
+    removeSession(*SessionsByName.begin()->second);
+  while (!SessionPool.empty())
+    removeSession(*SessionPool.front().Session);
+}
+
+UpgradeState Server::handOver()
+{
+  LOG(info) << "Detaching all clients for the upgrade...";
+  while (!Clients.empty())
+  {
+    ClientData& Client = *Clients.begin();
+    try
+    {
+      Client.sendDetachReason(
+        monomux::message::notification::Detached::ServerUpgrade);
+    }
+    catch (const buffer_overflow&)
+    {}
+    catch (const std::system_error&)
+    {}
+    removeClient(Client);
+  }
+
+  // Pooled sessions were not given out to anyone, so they are not kept.
+  while (!SessionPool.empty())
+    removeSession(*SessionPool.front().Session);
+  for (PendingSpawn& P : PendingSpawns)
+    Sessions.erase(*P.Session);
+  PendingSpawns.clear();
+  Spawner.reset();
+
+  UpgradeState State;
+  State.Socket = Sock.raw();
+  fd::removeDescriptorFlag(State.Socket, FD_CLOEXEC);
+  for (SessionData* Session : sessionsInOrder())
+  {
+    SessionData& S = *Session;
+    if (!S.hasProcess())
+      continue;
+
+    UpgradeState::Session Record;
+    Record.Name = S.name();
+    Record.Alias = S.alias();
+    Record.Created = S.whenCreated();
+    Record.PID = S.getProcess().raw();
+    if (Pty* PTY = S.getProcess().getPty())
+    {
+      Record.PtyMaster = PTY->raw().get();
+      Record.PtyName = PTY->name();
+      fd::removeDescriptorFlag(Record.PtyMaster, FD_CLOEXEC);
+    }
+    Record.ScrollbackSize = S.scrollbackSize();
+    Record.CoalesceWindow = S.coalesceWindow();
+    Record.RateLimit = S.rateLimit();
+    Record.Scrollback = S.copyScrollback();
+    Record.OutputEnd = S.scrollbackBegin() + Record.Scrollback.size();
+    State.Sessions.emplace_back(std::move(Record));
+  }
+
+  LOG(info) << "Handing over " << State.Sessions.size() << " sessions";
+  return State;
+}
+
+void Server::resume(UpgradeState State)
+{
+  const std::string SpillDirectory =
+    SocketPath::absolutise(Sock.identifier()).Path;
+  for (UpgradeState::Session& Record : State.Sessions)
+  {
+    const bool Renamed = !Record.Alias.empty();
+    SessionData& S =
+      Sessions.emplace(Renamed ? std::move(Record.Alias) : Record.Name);
+    if (Renamed)
+      S.rename(std::move(Record.Name));
+    S.setWhenCreated(Record.Created);
+
+    std::optional<Pty> PTY;
+    if (Record.PtyMaster != fd::Invalid)
+      PTY.emplace(
+        Pty::wrapMaster(fd{Record.PtyMaster}, std::move(Record.PtyName)));
+    S.setProcess(Process::adopt(Record.PID, std::move(PTY)));
+
+    S.setScrollbackSize(Record.ScrollbackSize);
+    S.setCoalesceWindow(Record.CoalesceWindow);
+    S.setRateLimit(Record.RateLimit);
+    S.setSpillDirectory(SpillDirectory);
+    if (Record.OutputEnd > Record.Scrollback.size())
+      S.skipOutput(Record.OutputEnd - Record.Scrollback.size());
+    if (!Record.Scrollback.empty())
+    {
+      S.appendOutput({Record.Scrollback, {}}, /* Retain =*/true);
+      S.trimOutput();
+    }
+
+    std::string Name = S.name();
+    SessionData* Added = addSession(S);
+    if (!Added)
+    {
+      LOG(error) << "Session \"" << Name << "\" resumed twice";
+      continue;
+    }
+    LOG(info) << "Session \"" << Name << "\" resumed";
+    startRecording(*Added);
+    ResumedSessions.emplace_back(Added);
+  }
+}
+
+ClientData* Server::getClient(std::size_t ID) noexcept
+{
+  ClientData* const* C = ClientsByID.tryGet(ID);
+  return C ? *C : nullptr;
+}
+
+SessionData* Server::getSession(std::string_view Name) noexcept
+{
+  if (auto It = SessionsByName.find(Name); It != SessionsByName.end())
+    return It->second;
+  // In-session clients find their session by the name in their environment.
+  auto It = SessionsByAlias.find(Name);
+  return It != SessionsByAlias.end() ? It->second : nullptr;
 }
 
 ClientData* Server::makeClient(ClientData Client)
 {
-  std::size_t CID = Client.id();
-  auto InsertRes =
-    Clients.try_emplace(CID, std::make_unique<ClientData>(std::move(Client)));
-  if (!InsertRes.second)
-    return nullptr;
-  return InsertRes.first->second.get();
+  std::size_t CID = Client.id();
+  if (getClient(CID))
+    return nullptr;
+  ClientData* C = &Clients.emplace(std::move(Client));
+  ClientsByID.set(CID, C);
+  return C;
+}
+
+bool Server::isSpawning(std::string_view Name) const noexcept
+{
+  return std::any_of(
+    PendingSpawns.begin(), PendingSpawns.end(), [Name](const PendingSpawn& P) {
+      return P.Session->name() == Name;
+    });
+}
+
+void Server::spawnSession(ClientData& Client,
+                          SessionData Session,
+                          const Process::SpawnOptions& Opts)
+{
+  startSpawn(
+    PendingSpawn{Clients.handle(Client), &Sessions.emplace(std::move(Session))},
+    Opts);
+}
+
+void Server::startSpawn(PendingSpawn Spawn, const Process::SpawnOptions& Opts)
+{
+  if (Spawner)
+  {
+    try
+    {
+      Spawner->spawn(Opts);
+      if (Spawner->hasBufferedRequests())
+        Poll->schedule(
+          Spawner->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+      PendingSpawns.emplace_back(std::move(Spawn));
+      return;
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(error) << "Fork server failed, spawning \"" << Spawn.Session->name()
+                 << "\" directly: " << SE.what();
+    }
+  }
+
+  try
+  {
+    Spawn.Session->setProcess(Process::spawn(Opts));
+  }
+  catch (const std::system_error& SE)
+  {
+    LOG(error) << "Spawning the process of Session \"" << Spawn.Session->name()
+               << "\" failed: " << SE.what();
+  }
+  finishSpawn(std::move(Spawn));
+}
+
+void Server::handleSpawnResults()
+{
+  for (ForkServer::Result& R : Spawner->results())
+  {
+    if (R.FailedPID != Process::Invalid)
+      // The process that failed to exec() is our child, and had exited.
+      Process::adopt(R.FailedPID, std::nullopt).wait();
+    if (PendingSpawns.empty())
+    {
+      LOG(error) << "Fork server sent a result without a request";
+      if (R.Spawned)
+        R.Spawned->signal(SIGHUP);
+      continue;
+    }
+
+    PendingSpawn P = std::move(PendingSpawns.front());
+    PendingSpawns.pop_front();
+    if (R.Spawned)
+      P.Session->setProcess(std::move(*R.Spawned));
+    else if (R.FailedPID != Process::Invalid)
+      LOG(error) << "Spawning the process of Session \"" << P.Session->name()
+                 << "\" failed in PID " << R.FailedPID << ": " << R.Error;
+    else
+      LOG(error) << "Spawning the process of Session \"" << P.Session->name()
+                 << "\" failed: " << R.Error;
+    finishSpawn(std::move(P));
+  }
+
+  if (!Spawner->alive())
+  {
+    LOG(warn) << "Fork server lost, spawning sessions directly";
+    Poll->stop(Spawner->raw());
+    Spawner.reset();
+  }
+
+  // Children that exited before their session was registered were left for
+  // collection until now.
+  reapExitedChildren();
+}
+
+void Server::finishSpawn(PendingSpawn Spawn)
+{
+  if (Spawn.ForPool)
+  {
+    if (!Spawn.Session->hasProcess())
+    {
+      Sessions.erase(*Spawn.Session);
+      return;
+    }
+
+    SessionData& S = *Spawn.Session;
+    SessionsByPID.try_emplace(S.getProcess().raw(), &S);
+    SessionPool.emplace_back(
+      PooledSession{std::move(Spawn.Program), Spawn.Session});
+    registerSessionIO(S);
+    LOG(debug) << "Session \"" << S.name() << "\" added to the pool";
+    return;
+  }
+
+  message::response::MakeSession Resp;
+  Resp.Name = Spawn.Session->name();
+  Resp.Success = false;
+
+  if (Spawn.Session->hasProcess())
+  {
+    Process::raw_handle PID = Spawn.Session->getProcess().raw();
+    if (SessionData* S = addSession(*Spawn.Session))
+    {
+      createCallback(*S);
+      Resp.Success = true;
+    }
+    else
+      Process::signal(PID, SIGHUP);
+  }
+  else
+    Sessions.erase(*Spawn.Session);
+
+  if (ClientData* Client = Clients.get(Spawn.Client))
+    message::sendMessage(Client->getControlSocket(), Resp, Client->encoding());
+}
+
+bool Server::isPooled(const SessionData& Session) const noexcept
+{
+  return std::any_of(
+    SessionPool.begin(), SessionPool.end(), [&Session](const PooledSession& P) {
+      return P.Session == &Session;
+    });
+}
+
+void Server::replenishSessionPool()
+{
+  auto Spawning = [this] {
+    return static_cast<std::size_t>(std::count_if(
+      PendingSpawns.begin(), PendingSpawns.end(), [](const PendingSpawn& P) {
+        return P.ForPool;
+      }));
+  };
+
+  while (SessionPool.size() + Spawning() < SessionPoolSize)
+  {
+    std::string Program = defaultShell();
+    if (Program.empty())
+      return;
+
+    // The name stays the alias of the session once it is given out, as the
+    // process sees it in its environment.
+    SessionData& S =
+      Sessions.emplace("~pool-" + std::to_string(++PooledSessionCount));
+    S.setScrollbackSize(ScrollbackSize);
+    S.setCoalesceWindow(CoalesceWindow);
+    S.setRateLimit(RateLimit);
+
+    Process::SpawnOptions Opts;
+    Opts.CreatePTY = true;
+    Opts.Program = Program;
+    {
+      MonomuxSession MS;
+      MS.SessionName = S.name();
+      MS.Socket = SocketPath::absolutise(Sock.identifier());
+      S.setSpillDirectory(MS.Socket.Path);
+      for (std::pair<std::string, std::string> BuiltinEnvVar :
+           MS.createEnvVars())
+        Opts.Environment[std::move(BuiltinEnvVar.first)] =
+          std::move(BuiltinEnvVar.second);
+    }
+
+    PendingSpawn Spawn{ClientHandle{}, &S, /* ForPool =*/true, Program};
+    const std::size_t PoolBefore = SessionPool.size();
+    startSpawn(std::move(Spawn), Opts);
+    if (!Spawner && SessionPool.size() == PoolBefore)
+      // Spawning directly failed, and would fail again.
+      return;
+  }
+}
+
+SessionData* Server::takePooledSession(std::string_view Program,
+                                       std::string Name)
+{
+  auto It = std::find_if(
+    SessionPool.begin(), SessionPool.end(), [Program](const PooledSession& P) {
+      return P.Program == Program && !P.Session->getProcess().dead();
+    });
+  if (It == SessionPool.end())
+    return nullptr;
+
+  SessionData* Session = It->Session;
+  SessionPool.erase(It);
+  LOG(info) << "Giving pooled Session \"" << Session->name() << "\" out as \""
+            << Name << '"';
+  Session->rename(std::move(Name));
+
+  SessionData* S = addSession(*Session);
+  if (S)
+    startRecording(*S);
+  publishSessionEvent(
+    sessionEvent(message::notification::SessionEvent::Created, *S));
+  replenishSessionPool();
+  return S;
+}
+
+SessionData* Server::makeSession(SessionData Session)
+{
+  return addSession(Sessions.emplace(std::move(Session)));
+}
+
+SessionData* Server::addSession(SessionData& Session)
+{
+  if (!SessionsByName.try_emplace(Session.name(), &Session).second)
+  {
+    Sessions.erase(Session);
+    return nullptr;
+  }
+  SessionsInOrder.try_emplace(Session.name(), &Session);
+
+  if (!Session.alias().empty())
+    SessionsByAlias.try_emplace(Session.alias(), &Session);
+  if (Session.hasProcess())
+    SessionsByPID.try_emplace(Session.getProcess().raw(), &Session);
+  return &Session;
+}
+
+std::vector<SessionData*> Server::sessionsInOrder() const
+{
+  std::vector<SessionData*> Ret;
+  Ret.reserve(SessionsInOrder.size());
+  for (const auto& E : SessionsInOrder)
+    Ret.emplace_back(E.second);
+  return Ret;
+}
+
+std::vector<SessionData*> Server::sessionsInOrder(std::string_view Prefix,
+                                                  std::size_t Offset,
+                                                  std::size_t Limit,
+                                                  bool& More) const
+{
+  const auto Matches = [Prefix](std::string_view Name) {
+    return Name.substr(0, Prefix.size()) == Prefix;
+  };
+
+  std::vector<SessionData*> Ret;
+  // The names starting with the prefix are sorted right after it.
+  auto It = SessionsInOrder.lower_bound(Prefix);
+  const auto HasMatch = [&] {
+    return It != SessionsInOrder.end() && Matches(It->first);
+  };
+  for (; Offset && HasMatch(); --Offset)
+    ++It;
+  for (; Ret.size() < Limit && HasMatch(); ++It)
+    Ret.emplace_back(It->second);
+  More = HasMatch();
+  return Ret;
+}
+
+void Server::removeClient(ClientData& Client)
+{
+  std::size_t CID = Client.id();
+  if (Client.isSubscribed())
+    --Subscribers;
+  for (ClientData* Channel : Client.channelsInTurn())
+    closeChannel(*Channel);
+  if (SessionData* S = Client.getAttachedSession())
+    clientDetachedCallback(Client, *S);
+  ClientsByID.erase(CID);
+  Clients.erase(Client);
+}
+
+void Server::removeSession(SessionData& Session)
+{
+  if (Session.isHibernated())
+  {
+    raw_fd FD = Session.getIdentifyingFD();
+    ColdPoll->stop(FD);
+    HibernatedSessions.erase(FD);
+    Session.setHibernated(false);
+  }
+
+  // Detaching removes the client from the list being iterated.
+  std::vector<ClientData*> Attached = Session.getAttachedClients();
+  for (ClientData* C : Attached)
+    clientDetachedCallback(*C, Session);
+
+  if (Session.hasProcess())
+    if (auto It = SessionsByPID.find(Session.getProcess().raw());
+        It != SessionsByPID.end() && It->second == &Session)
+      SessionsByPID.erase(It);
+
+  if (auto It = std::find_if(SessionPool.begin(),
+                             SessionPool.end(),
+                             [&Session](const PooledSession& P) {
+                               return P.Session == &Session;
+                             });
+      It != SessionPool.end())
+  {
+    SessionPool.erase(It);
+    Sessions.erase(Session);
+    return;
+  }
+
+  SessionsByName.erase(Session.name());
+  SessionsInOrder.erase(Session.name());
+  if (!Session.alias().empty())
+    SessionsByAlias.erase(Session.alias());
+  Sessions.erase(Session);
+
+  if (SessionsByName.empty() && PendingSpawns.empty() && ExitIfNoMoreSessions)
+    TerminateLoop.get().store(true);
+}
+
+void Server::registerDeadChild(Process::raw_handle PID) const noexcept
+{
+  for (std::size_t I = 0; I < DeadChildrenVecSize; ++I)
+    if (DeadChildren.at(I) == Process::Invalid)
+    {
+      DeadChildren.at(I) = PID;
+      return;
+    }
+}
+
+void Server::acceptCallback(ClientData& Client)
+{
+  LOG(info) << "Client \"" << Client.id() << "\" connected";
+  raw_fd FD = Client.getControlSocket().raw();
+
+  // (8 is a good guesstimate because FDLookup usually counts from 5 or 6, not
+  // from 0.)
+  static constexpr std::size_t FDKeepSpare = 8;
+  std::size_t FDCount = FDLookup.size();
+  std::size_t MaxFDs = fd::maxNumFDs() - FDKeepSpare;
+  if (FDCount >= MaxFDs)
+  {
+    // As a full client connection would require *TWO* file descriptors (control
+    // and data socket) and we would need to keep 1 open so we can always
+    // accept() a connection, reject the client if there aren't any space left.
+    LOG(warn) << "Self-defence rejecting client - " << FDCount
+              << " FDs allocated out of the max " << MaxFDs;
+    sendRejectClient(Client, "Not enough file descriptors left on server.");
+    removeClient(Client);
+    return;
+  }
+
+  Poll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
+  FDLookup[FD] = ClientControlConnection{&Client};
+
+  sendAcceptClient(Client);
+}
+
+void Server::controlCallback(ClientData& Client)
+{
+  using namespace monomux::message;
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Client \"" << Client.id() << "\" sent CONTROL!");
+  const std::size_t ClientID = Client.id();
+  Socket& ClientSock = Client.getControlSocket();
+  FrameDecoder& Frames = Client.getControlFrames();
+
+  // Handle every message that arrived since the last wakeup, as clients may
+  // pipeline requests without waiting for the responses.
+  while (true)
+  {
+    std::optional<std::string> Data;
+    try
+    {
+      MONOMUX_ALLOCATION_SCOPE(Message);
+      Data = Frames.next(ClientSock);
+    }
+    catch (const buffer_overflow& BO)
+    {
+      LOG(trace) << "Client \"" << Client.id()
+                 << "\": error when reading CONTROL: "
+                 << "\n\t" << BO.what();
+      rescheduleOverflow(*Poll, BO);
+      return;
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Client \"" << Client.id()
+                 << "\": error when reading CONTROL: " << Err.what();
+    }
+    if (!Data)
+      break;
+
+    Message MB = Message::unpack(*Data);
+    MONOMUX_TRACE_LOG(LOG(data) << "Client \"" << Client.id() << "\"\n"
+                                << MB.RawData);
+    try
+    {
+      if (!dispatch(static_cast<std::uint16_t>(MB.Kind), Client, MB.RawData))
+        MONOMUX_TRACE_LOG(LOG(trace)
+                          << "Client \"" << Client.id()
+                          << "\": unknown message type "
+                          << static_cast<int>(MB.Kind) << " received");
+    }
+    catch (const buffer_overflow& BO)
+    {
+      LOG(trace) << "Client \"" << Client.id()
+                 << "\": error when handling message"
+                 << "\n\t" << BO.what();
+      rescheduleOverflow(*Poll, BO);
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(error) << "Client \"" << Client.id()
+                 << "\": error when handling message";
+      if (ClientSock.failed())
+      {
+        exitCallback(Client);
+        return;
+      }
+    }
+
+    if (getClient(ClientID) != &Client)
+      // The handler tore the client down, or turned its connection into the
+      // data connection of another client.
+      return;
+    if (ClientSock.failed())
+      break;
+  }
+
+  if (ClientSock.failed() || Frames.corrupt())
+  {
+    // We realise the client disconnected during an attempt to read, or the
+    // stream of messages can not be followed anymore.
+    exitCallback(Client);
+    return;
+  }
+
+  if (ClientSock.hasBufferedRead())
+    Poll->schedule(ClientSock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  if (ClientSock.hasBufferedWrite())
+    // A large response did not fit the socket at once, and nothing else would
+    // flush the rest of it.
+    Poll->schedule(ClientSock.raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  else if (!Frames.hasPartialFrame())
+    ClientSock.tryFreeResources();
+}
+
+void Server::dataCallback(ClientData& Client)
+{
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Client \"" << Client.id() << "\" sent DATA!");
+  const std::size_t ClientID = Client.id();
+  std::size_t Relayed = 0;
+  while (Relayed < DrainBudget)
+  {
+    const std::size_t Read = relayInput(Client);
+    if (!Read)
+      // Drained, or the client is gone.
+      return;
+    Relayed += Read;
+  }
+
+  if (getClient(ClientID))
+    pollOf(Client).schedule(
+      Client.getDataSocket()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+}
+
+std::size_t Server::relayInput(ClientData& Client)
+{
+  Socket& DS = *Client.getDataSocket();
+  try
+  {
+    // Bursts of input, e.g. pastes, arrive in large pieces, which are relayed
+    // in one go, straight from the buffer of the connection.
+    if (!DS.hasBufferedRead())
+      DS.load(DrainBudget);
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Client \"" << Client.id() << "\": error when reading DATA: "
+               << "\n\t" << BO.what();
+    sendKickClient(Client,
+                   "Overflow when reading connection, " +
+                     std::to_string(BO.channel().readInBuffer()) +
+                     " bytes already pending");
+    dropClient(Client);
+    return 0;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": error when reading DATA: " << Err.what();
+    return 0;
+  }
+
+  if (DS.failed())
+  {
+    // We realise the client disconnected during an attempt to read.
+    dropClient(Client);
+    return 0;
+  }
+  if (Client.isMultiplexed())
+    return relayChannelInput(Client);
+  const std::size_t Size = DS.readInBuffer();
+  if (!Size)
+    return 0;
+  const BufferedChannel::BufferView Data = DS.peekRead(Size);
+  // (The data is consumed however relaying it turns out.)
+  ScopeGuard Consume{[] {}, [&DS, Size] { DS.consumeRead(Size); }};
+
+  Client.activity();
+  Client.countReceived(Size);
+  if (CurrentLoopMetrics)
+    CurrentLoopMetrics->InputBytes += Size;
+  MONOMUX_TRACE_LOG(LOG(data) << "Client \"" << Client.id()
+                              << "\" data: " << Data.at(0) << Data.at(1));
+
+  if (SessionData* S = Client.getAttachedSession(); S && !Client.isObserver())
+    writeInput(Client, *S, Data);
+  return Size;
+}
+
+std::size_t Server::relayChannelInput(ClientData& Client)
+{
+  Socket& DS = *Client.getDataSocket();
+  message::FrameDecoder& Frames = Client.getDataFrames();
+  std::size_t Size = 0;
+  try
+  {
+    while (Size < DrainBudget)
+    {
+      std::optional<std::string> Frame = Frames.next(DS);
+      if (!Frame)
+        break;
+      Size += Frame->size();
+
+      auto ChannelAndData = message::decodeChannelFrame(*Frame);
+      if (!ChannelAndData)
+        continue;
+      ClientData* Channel = Client.getChannel(ChannelAndData->first);
+      if (!Channel)
+        // The channel was closed while the data was in flight.
+        continue;
+      const std::string_view Data = ChannelAndData->second;
+      Channel->activity();
+      Channel->countReceived(Data.size());
+      if (SessionData* S = Channel->getAttachedSession();
+          S && !Channel->isObserver())
+        writeInput(*Channel, *S, {Data, {}});
+    }
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Client \"" << Client.id() << "\": error when reading DATA: "
+               << "\n\t" << BO.what();
+    sendKickClient(Client,
+                   "Overflow when reading connection, " +
+                     std::to_string(BO.channel().readInBuffer()) +
+                     " bytes already pending");
+    dropClient(Client);
+    return 0;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Client \"" << Client.id()
+               << "\": error when reading DATA: " << Err.what();
+  }
+
+  if (Frames.corrupt())
+  {
+    sendKickClient(Client, "Malformed frame on multiplexed connection");
+    dropClient(Client);
+    return 0;
+  }
+  if (DS.failed())
+  {
+    dropClient(Client);
+    return 0;
+  }
+
+  Client.activity();
+  Client.countReceived(Size);
+  if (CurrentLoopMetrics)
+    CurrentLoopMetrics->InputBytes += Size;
+  return Size;
+}
+
+void Server::writeInput(ClientData& Client,
+                        SessionData& Session,
+                        const BufferedChannel::BufferView& Data)
+{
+  try
+  {
+    if (Session.isHibernated())
+      wake(Session);
+    Session.inputActivity();
+    Session.countInput(Data.at(0).size() + Data.at(1).size());
+    if (Session.coalesceDeadline())
+    {
+      // The response to the input, e.g. the echo of a keystroke, should not
+      // wait for an already open coalescing window.
+      Session.setCoalesceDeadline(std::chrono::steady_clock::now());
+      armCoalesceTimer(Session);
+    }
+    if (Session.getRecording())
+      record(Session, SessionRecording::Direction::Input, Data);
+    for (std::string_view Segment : Data)
+      if (!Segment.empty())
+        Session.getWriter()->write(Segment);
+    if (Session.getWriter()->hasBufferedWrite())
+      // The program did not consume its input fast enough, and there might
+      // not be more input to trigger sending the rest.
+      pollOf(Session).schedule(
+        Session.getIdentifyingFD(), /* Incoming =*/false, /* Outgoing =*/true);
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(trace) << "Session \"" << Session.name()
+               << "\" when relaying input from client \"" << Client.id()
+               << "\"\n\t" << BO.what();
+    rescheduleOverflow(pollOf(Session), BO);
+  }
+}
+
+void Server::exitCallback(ClientData& Client)
+{
+  LOG(info) << "Client \"" << Client.id() << "\" exited";
+
+  for (ClientData* Channel : Client.channelsInTurn())
+    closeChannel(*Channel);
+
+  // Detaching hands the data connection back to the main loop.
+  if (SessionData* S = Client.getAttachedSession())
+    clientDetachedCallback(Client, *S);
+
+  if (const auto* DS = Client.getDataSocket())
+  {
+    Poll->stop(DS->raw());
+    FDLookup.erase(DS->raw());
+  }
+  if (const SharedRing* Ring = Client.getOutputRing())
+  {
+    Poll->stop(Ring->spaceBell());
+    FDLookup.erase(Ring->spaceBell());
+  }
+
+  Poll->stop(Client.getControlSocket().raw());
+  FDLookup.erase(Client.getControlSocket().raw());
+
+  removeClient(Client);
+}
+
+void Server::createCallback(SessionData& Session)
+{
+  LOG(info) << "Session \"" << Session.name() << "\" created";
+  startRecording(Session);
+  registerSessionIO(Session);
+  publishSessionEvent(
+    sessionEvent(message::notification::SessionEvent::Created, Session));
+}
+
+void Server::registerSessionIO(SessionData& Session)
+{
+  Session.setShard(pickShard());
+  if (Session.hasProcess() && Session.getProcess().hasPty())
+  {
+    raw_fd FD = Session.getIdentifyingFD();
+
+    pollOf(Session).listen(FD,
+                           /* Incoming =*/true,
+                           /* Outgoing =*/false,
+                           /* EdgeTriggered =*/true);
+    FDLookup[FD] = SessionConnection{&Session};
+  }
+  watchExit(Session);
+}
+
+void Server::dataCallback(SessionData& Session)
+{
+  MONOMUX_TRACE_LOG(LOG(trace)
+                    << "Session \"" << Session.name() << "\" sent DATA!");
+  const std::size_t Quota =
+    isInteractive(Session) ? DrainBudget : CurrentSessionQuota;
+  const std::size_t Begin = Session.outputEnd();
+  while (Session.outputEnd() - Begin < Quota)
+  {
+    const std::size_t Before = Session.outputEnd();
+    relayOutput(Session);
+    if (Session.outputEnd() == Before)
+      // Drained, throttled, or failed.
+      return;
+  }
+
+  if (FDLookup.contains(Session.getIdentifyingFD()) &&
+      !Session.isOutputThrottled() && !Session.ratePauseDeadline())
+    pollOf(Session).schedule(Session.getIdentifyingFD(),
+                             /* Incoming =*/true,
+                             /* Outgoing =*/false);
+}
+
+void Server::relayOutput(SessionData& Session)
+{
+  if (Session.isOutputThrottled() || Session.getHandedOffTo())
+    // A manually scheduled event might still arrive for a throttled session.
+    return;
+  if (Session.ratePauseDeadline())
+    return;
+  if (relayDetached(Session))
+    return;
+  if (relayBySplice(Session))
+  {
+    updateFlowControl(Session);
+    return;
+  }
+
+  Pipe& Reader = *Session.getReader();
+  std::size_t ReadSize = Reader.readSize();
+  if (Session.rateLimit())
+  {
+    const std::size_t Allowance =
+      Session.rateAllowance(std::chrono::steady_clock::now());
+    if (!Allowance)
+    {
+      pauseForRateLimit(Session);
+      return;
+    }
+    ReadSize = std::min(ReadSize, Allowance);
+  }
+
+  try
+  {
+    // Load the data into the buffer of the reader and relay it from there, so
+    // no intermediate copies have to be made during the fan-out.
+    Reader.load(ReadSize);
+  }
+  catch (const buffer_overflow& BO)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": error when reading DATA: "
+               << "\n\t" << BO.what();
+    rescheduleOverflow(pollOf(Session), BO);
+    return;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": error when reading DATA: " << Err.what();
+    return;
+  }
+
+  const std::size_t DataSize = Reader.readInBuffer();
+  if (!DataSize)
+    return;
+  const BufferedChannel::BufferView Data = Reader.peekRead(DataSize);
+  if (CurrentLoopMetrics)
+    CurrentLoopMetrics->OutputBytes += DataSize;
+  Session.consumeRateAllowance(DataSize);
+  if (Session.getRecording())
+    record(Session, SessionRecording::Direction::Output, Data);
+
+  Session.activity();
+  MONOMUX_TRACE_LOG(LOG(data) << "Session \"" << Session.name()
+                              << "\" data: " << Data.at(0) << Data.at(1));
+
+  // The position of the currently relayed data in the output stream.
+  const std::size_t StreamPosition = Session.outputEnd();
+  // Whether the data has to be kept for a client which could not receive it
+  // directly.
+  bool RetainData = false;
+  // Clients must not be removed while iterating the attached clients.
+  std::vector<ClientData*> OverflownClients;
+  std::vector<ClientData*> CatchingUpClients;
+  std::vector<ClientData*> DisconnectedClients;
+  // Read-only clients are served from the backlog after the interactive ones,
+  // in larger pieces, so they do not add to the latency of those typing.
+  const std::vector<ClientData*>& Attached = Session.getAttachedClients();
+  const bool DeferObservers =
+    std::any_of(Attached.begin(), Attached.end(), [](const ClientData* C) {
+      return C->getDataSocket() && !C->isObserver();
+    });
+
+  for (ClientData* C : Session.getAttachedClients())
+    if (Socket* DS = C->getDataSocket())
+    {
+      if (DeferObservers && C->isObserver() &&
+          C->outputCursor() == StreamPosition && !C->hasSpliceResidue())
+      {
+        RetainData = true;
+        pollOf(Session).schedule(
+          DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+        continue;
+      }
+      if (C->outputCursor() != StreamPosition || C->hasSpliceResidue())
+      {
+        // The client is still lagging behind, and will be served from the
+        // backlog once its connection is writable.
+        RetainData = true;
+        if (C->catchesUp() &&
+            StreamPosition + DataSize - C->outputCursor() > CatchUpThreshold)
+          CatchingUpClients.emplace_back(C);
+        else if (StreamPosition + DataSize - C->outputCursor() >
+                 SessionData::OutputBacklogMax)
+          // This is the part that can usually hang if there is too much data
+          // coming from the session that can't be sent to the clients in a
+          // timely manner.
+          OverflownClients.emplace_back(C);
+        continue;
+      }
+
+      try
+      {
+        const std::size_t Sent = sendOutput(*C, Data);
+        if (const SharedRing* Ring = C->getOutputRing();
+            Ring && Ring->corrupt())
+        {
+          LOG(error) << "Session \"" << Session.name()
+                     << "\": attached client \"" << C->id()
+                     << "\" corrupted its output ring";
+          DisconnectedClients.emplace_back(C);
+          continue;
+        }
+        C->setOutputCursor(StreamPosition + Sent);
+        if (Sent < DataSize)
+        {
+          RetainData = true;
+          rescheduleOutput(pollOf(Session), *C);
+        }
+      }
+      catch (const std::system_error& Err)
+      {
+        LOG(error) << "Session \"" << Session.name()
+                   << "\": error when sending DATA to attached client \""
+                   << C->id() << "\": " << Err.what();
+
+        if (DS->failed())
+          // We realise the client disconnected during an attempt to send.
+          DisconnectedClients.emplace_back(C);
+      }
+    }
+
+  Session.appendOutput(Data, RetainData);
+  Reader.consumeRead(DataSize);
+
+  if (!CatchingUpClients.empty())
+    catchUp(Session, CatchingUpClients);
+
+  for (ClientData* C : DisconnectedClients)
+    dropClient(*C);
+
+  for (ClientData* C : OverflownClients)
+  {
+    sendKickClient(*C,
+                   "Overflow when sending, " +
+                     std::to_string(Session.outputEnd() - C->outputCursor()) +
+                     " bytes already pending");
+    dropClient(*C);
+  }
+
+  updateFlowControl(Session);
+}
+
+void Server::catchUp(SessionData& Session,
+                     const std::vector<ClientData*>& Clients)
+{
+  for (ClientData* C : Clients)
+  {
+    const std::size_t End = Session.outputEnd();
+    std::size_t Tail =
+      std::max(C->outputCursor(), End - std::min(CatchUpTail, End));
+    // Start the tail on a new line, so it is less likely to begin in the
+    // middle of an escape sequence.
+    const std::string_view Head = Session.peekOutput(Tail);
+    if (std::string_view::size_type EOL = Head.find('\n');
+        EOL != std::string_view::npos)
+      Tail += EOL + 1;
+
+    LOG(debug) << "Client \"" << C->id() << "\" skipped "
+               << Tail - C->outputCursor() << " bytes of output of \""
+               << Session.name() << '"';
+    C->setOutputCursor(Tail);
+    if (CurrentLoopMetrics)
+      ++CurrentLoopMetrics->CatchUps;
+  }
+  Session.trimOutput();
+
+  if (!Session.hasProcess() || !Session.getProcess().hasPty())
+    return;
+  try
+  {
+    // The output skipped might have drawn the screen the client now misses.
+    Session.getProcess().getPty()->wiggleSize();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(warn) << "Session \"" << Session.name()
+              << "\": failed to request a redraw: " << Err.what();
+  }
+}
+
+bool Server::relayDetached(SessionData& Session)
+{
+  static constexpr std::size_t DiscardSize = 1ULL << 16; // 64 KiB
+  if (!Session.getAttachedClients().empty() || Session.rateLimit() ||
+      Session.getReader()->hasBufferedRead())
+    return false;
+
+  // Nothing read here outlives the call, so one buffer serves every session
+  // of the thread.
+  static thread_local std::unique_ptr<char[]> Scratch;
+  if (!Scratch)
+    Scratch = std::make_unique<char[]>(DiscardSize);
+
+  auto ReadBytes = CheckedPOSIX(
+    [FD = Session.getIdentifyingFD(), Buffer = Scratch.get()] {
+      return ::read(FD, Buffer, DiscardSize);
+    },
+    -1);
+  if (!ReadBytes)
+  {
+    const auto EC = static_cast<std::errc>(ReadBytes.getError().value());
+    // Let the buffered path deal with the errors, and the interrupted read.
+    return EC == std::errc::operation_would_block ||
+           EC == std::errc::resource_unavailable_try_again;
+  }
+  if (!ReadBytes.get())
+    // Let the buffered path deal with the disconnect.
+    return false;
+
+  const std::size_t DataSize = ReadBytes.get();
+  if (CurrentLoopMetrics)
+    CurrentLoopMetrics->OutputBytes += DataSize;
+  Session.activity();
+  const BufferedChannel::BufferView Data{
+    std::string_view{Scratch.get(), DataSize}, {}};
+  if (Session.getRecording())
+    record(Session, SessionRecording::Direction::Output, Data);
+  // Without a scrollback, this only advances the stream.
+  Session.appendOutput(Data, /* Retain =*/false);
+  updateFlowControl(Session);
+  return true;
+}
+
+bool Server::relayBySplice(SessionData& Session)
+{
+  static constexpr std::size_t SpliceSize = 1ULL << 16; // 64 KiB
+  if (!SpliceRelay || !Session.canSplice() ||
+      Session.getAttachedClients().size() != 1)
+    return false;
+
+  ClientData& Client = *Session.getAttachedClients().front();
+  if (Client.isChannel() || Client.isCompressed())
+    // The output must be framed on the connection.
+    return false;
+  Socket* DS = Client.getDataSocket();
+  if (!DS || DS->failed() || DS->hasBufferedWrite() ||
+      Client.getOutputRing() || Session.getReader()->hasBufferedRead() ||
+      Client.outputCursor() != Session.outputEnd())
+    // Data is already buffered for the client, which must be sent first.
+    return false;
+
+  SplicePipe* SP = Client.getSplicePipe();
+  if (!SP)
+  {
+    try
+    {
+      SP = &Client.createSplicePipe();
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(warn) << "Session \"" << Session.name()
+                << "\": failed to set up splice relay: " << Err.what();
+      Session.disableSplice();
+      return false;
+    }
+  }
+
+  try
+  {
+    if (!SP->empty())
+    {
+      SP->drain(DS->raw());
+      if (!SP->empty())
+        // The client is lagging behind. The buffered path will read the new
+        // data and serve it after the contents of the kernel pipe.
+        return false;
+    }
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": error when sending DATA to attached client \""
+               << Client.id() << "\": " << Err.what();
+    dropClient(Client);
+    return true;
+  }
+
+  std::size_t Moved;
+  try
+  {
+    Moved = SP->fill(Session.getIdentifyingFD(), SpliceSize);
+  }
+  catch (const std::system_error& Err)
+  {
+    if (Err.code() == std::errc::invalid_argument)
+    {
+      LOG(info) << "Session \"" << Session.name()
+                << "\" does not support splice relay";
+      Session.disableSplice();
+    }
+    // Let the buffered path deal with the error.
+    return false;
+  }
+  if (!Moved)
+    return true;
+  Client.countSent(Moved);
+  if (CurrentLoopMetrics)
+    CurrentLoopMetrics->OutputBytes += Moved;
+
+  Session.activity();
+  Session.skipOutput(Moved);
+  Client.setOutputCursor(Session.outputEnd());
+
+  try
+  {
+    SP->drain(DS->raw());
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Session \"" << Session.name()
+               << "\": error when sending DATA to attached client \""
+               << Client.id() << "\": " << Err.what();
+    dropClient(Client);
+    return true;
+  }
+  if (!SP->empty())
+    pollOf(Session).schedule(
+      DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  return true;
+}
+
+void Server::updateFlowControl(SessionData& Session)
+{
+  if (!Poll || !Session.hasProcess() || !Session.getProcess().hasPty())
+    return;
+  raw_fd FD = Session.getIdentifyingFD();
+  if (!FDLookup.contains(FD))
+    // The session is being destroyed.
+    return;
+  if (Session.getHandedOffTo())
+    // The client reads the PTY at its own pace.
+    return;
+
+  std::size_t MaxPending = 0;
+  // Observers lagging behind only pace the session if no other client is
+  // attached, as the output must not be delayed for those watching it.
+  std::size_t MaxObserverPending = 0;
+  bool HasViewer = false;
+  for (const ClientData* C : Session.getAttachedClients())
+  {
+    const Socket* DS = C->getDataSocket();
+    if (!DS || DS->failed())
+      continue;
+
+    // Output that was spilled to disk does not weigh on the memory.
+    std::size_t Pending =
+      Session.outputEnd() -
+      std::max(C->outputCursor(), Session.outputResidentBegin());
+    if (const SplicePipe* SP = C->getSplicePipe())
+      Pending += SP->size();
+    if (!C->isChannel())
+      // The buffer of a shared connection is capped on its own.
+      Pending += DS->writeInBuffer();
+    if (C->isObserver())
+      MaxObserverPending = std::max(MaxObserverPending, Pending);
+    else
+    {
+      HasViewer = true;
+      MaxPending = std::max(MaxPending, Pending);
+    }
+  }
+
+  // Near the memory budget, no session may have more output pending.
+  const bool Pressure = MemoryPressure.get().load(std::memory_order_relaxed);
+  if (Pressure || !HasViewer)
+    MaxPending = std::max(MaxPending, MaxObserverPending);
+  if (!Session.isOutputThrottled())
+  {
+    if (Pressure ? MaxPending == 0
+                 : !FlowControl || MaxPending < FlowControlHighWatermark)
+      return;
+
+    MONOMUX_TRACE_LOG(LOG(trace) << "Session \"" << Session.name()
+                                 << "\": throttled, " << MaxPending
+                                 << " bytes pending");
+    pollOf(Session).stop(FD);
+    Session.setOutputThrottled(true);
+    return;
+  }
+
+  if (Pressure ? MaxPending != 0
+               : FlowControl && MaxPending > FlowControlLowWatermark)
+    return;
+
+  MONOMUX_TRACE_LOG(LOG(trace) << "Session \"" << Session.name()
+                               << "\": resumed, " << MaxPending
+                               << " bytes pending");
+  pollOf(Session).listen(FD,
+                         /* Incoming =*/true,
+                         /* Outgoing =*/false,
+                         /* EdgeTriggered =*/true);
+  Session.setOutputThrottled(false);
 }
 
-SessionData* Server::makeSession(SessionData Session)
+bool Server::deferOutput(SessionData& Session)
 {
-  std::string SN = Session.name();
-  auto InsertRes =
-    Sessions.try_emplace(SN, std::make_unique<SessionData>(std::move(Session)));
-  if (!InsertRes.second)
-    return nullptr;
-  return InsertRes.first->second.get();
+  raw_fd FD = Session.getIdentifyingFD();
+  if (Session.coalesceDeadline() || Session.ratePauseDeadline())
+  {
+    // Reading might have been resumed by flow control while the window is
+    // open, or the session is paused.
+    pollOf(Session).stop(FD);
+    return true;
+  }
+  if (Session.coalesceWindow() == std::chrono::microseconds::zero() ||
+      Session.isOutputThrottled())
+    return false;
+
+  auto Now = std::chrono::steady_clock::now();
+  if (Now - Session.lastInput() < CoalesceInputBypass)
+    // The output is likely the response to what the user had just typed.
+    return false;
+
+  MONOMUX_TRACE_LOG(LOG(trace) << "Session \"" << Session.name()
+                               << "\": coalescing output for "
+                               << Session.coalesceWindow().count() << " us");
+  Session.setCoalesceDeadline(Now + Session.coalesceWindow());
+  pollOf(Session).stop(FD);
+  armCoalesceTimer(Session);
+  return true;
 }
 
-void Server::removeClient(ClientData& Client)
+void Server::endCoalesceWindow(SessionData& Session)
 {
-  std::size_t CID = Client.id();
-  if (SessionData* S = Client.getAttachedSession())
-    clientDetachedCallback(Client, *S);
-  Clients.erase(CID);
+  if (!Session.coalesceDeadline())
+    return;
+  Session.setCoalesceDeadline(std::nullopt);
+
+  raw_fd FD = Session.getIdentifyingFD();
+  if (!FDLookup.contains(FD) || Session.isOutputThrottled() ||
+      Session.ratePauseDeadline())
+    // Flow control will resume reading once the clients caught up, and the
+    // rate limit once the bucket of the session is refilled.
+    return;
+
+  pollOf(Session).listen(FD,
+                         /* Incoming =*/true,
+                         /* Outgoing =*/false,
+                         /* EdgeTriggered =*/true);
+  // Relay the accumulated output right away, as the readiness reported for it
+  // would only open a new window.
+  dataCallback(Session);
+  Session.getReader()->tryFreeResources();
 }
 
-void Server::removeSession(SessionData& Session)
+void Server::armCoalesceTimer(SessionData& Session)
 {
-  for (ClientData* C : Session.getAttachedClients())
-    clientDetachedCallback(*C, Session);
+  const std::chrono::steady_clock::time_point Deadline =
+    *Session.coalesceDeadline();
+  pollOf(Session).addTimer(Deadline, [this, Name = Session.name(), Deadline] {
+    // The window might have been ended early, and a new one opened since.
+    SessionData* S = getSession(Name);
+    if (S && S->coalesceDeadline() == Deadline)
+      endCoalesceWindow(*S);
+  });
+}
 
-  Sessions.erase(Session.name());
+void Server::requestResize(SessionData& Session)
+{
+  if (Session.resizeDeadline())
+    return;
+  const std::chrono::steady_clock::time_point Deadline =
+    std::chrono::steady_clock::now() + ResizeCoalesceWindow;
+  Session.setResizeDeadline(Deadline);
+  Poll->addTimer(Deadline, [this, Name = Session.name(), Deadline] {
+    SessionData* S = getSession(Name);
+    if (S && S->resizeDeadline() == Deadline)
+      resize(*S);
+  });
+}
 
-  if (Sessions.empty() && ExitIfNoMoreSessions)
-    TerminateLoop.get().store(true);
+std::optional<Pty::WindowSize>
+Server::negotiateSize(const SessionData& Session) const
+{
+  std::optional<Pty::WindowSize> Size;
+  switch (Sizing)
+  {
+    case SizePolicy::Latest:
+      if (const ClientData* C = Session.getLatestClient())
+        Size = C->getWindowSize();
+      break;
+    case SizePolicy::Smallest:
+      for (const ClientData* C : Session.getAttachedClients())
+      {
+        if (C->isObserver() || !C->getWindowSize())
+          continue;
+        const Pty::WindowSize& CS = *C->getWindowSize();
+        if (!Size)
+          Size = CS;
+        Size->Rows = std::min(Size->Rows, CS.Rows);
+        Size->Columns = std::min(Size->Columns, CS.Columns);
+      }
+      break;
+    case SizePolicy::Owner:
+      // Clients are kept in the order they attached in.
+      for (const ClientData* C : Session.getAttachedClients())
+        if (!C->isObserver() && C->getWindowSize())
+        {
+          Size = C->getWindowSize();
+          break;
+        }
+      break;
+  }
+  return Size;
 }
 
-void Server::registerDeadChild(Process::raw_handle PID) const noexcept
+void Server::resize(SessionData& Session)
 {
-  for (std::size_t I = 0; I < DeadChildrenVecSize; ++I)
-    if (DeadChildren.at(I) == Process::Invalid)
-    {
-      DeadChildren.at(I) = PID;
-      return;
-    }
+  Session.setResizeDeadline(std::nullopt);
+  if (!Session.hasProcess() || !Session.getProcess().hasPty())
+    return;
+  std::optional<Pty::WindowSize> Size = negotiateSize(Session);
+  if (!Size || Size == Session.appliedSize())
+    // Changing the size of the PTY makes the program redraw its screen, even
+    // if the size did not change in the end.
+    return;
+
+  MONOMUX_TRACE_LOG(LOG(debug) << "Session \"" << Session.name()
+                               << "\" resized to " << Size->Columns << 'x'
+                               << Size->Rows);
+  Session.getProcess().getPty()->setSize(Size->Rows, Size->Columns);
+  Session.setAppliedSize(*Size);
 }
 
-void Server::acceptCallback(ClientData& Client)
+void Server::pauseForRateLimit(SessionData& Session)
 {
-  LOG(info) << "Client \"" << Client.id() << "\" connected";
-  raw_fd FD = Client.getControlSocket().raw();
+  const std::chrono::steady_clock::time_point Deadline =
+    Session.rateRefillTime();
+  MONOMUX_TRACE_LOG(LOG(trace) << "Session \"" << Session.name()
+                               << "\": rate limit of " << Session.rateLimit()
+                               << " bytes/s exhausted");
+  Session.setRatePauseDeadline(Deadline);
+  pollOf(Session).stop(Session.getIdentifyingFD());
+  pollOf(Session).addTimer(Deadline, [this, Name = Session.name(), Deadline] {
+    // The limit might have been lifted, and the session paused again since.
+    SessionData* S = getSession(Name);
+    if (S && S->ratePauseDeadline() == Deadline)
+      endRatePause(*S);
+  });
+}
 
-  // (8 is a good guesstimate because FDLookup usually counts from 5 or 6, not
-  // from 0.)
-  static constexpr std::size_t FDKeepSpare = 8;
-  std::size_t FDCount = FDLookup.size();
-  std::size_t MaxFDs = fd::maxNumFDs() - FDKeepSpare;
-  if (FDCount >= MaxFDs)
+void Server::endRatePause(SessionData& Session)
+{
+  if (!Session.ratePauseDeadline())
+    return;
+  Session.setRatePauseDeadline(std::nullopt);
+
+  raw_fd FD = Session.getIdentifyingFD();
+  if (!FDLookup.contains(FD) || Session.isOutputThrottled() ||
+      Session.coalesceDeadline())
+    // Flow control or the end of the coalescing window resumes reading.
+    return;
+
+  pollOf(Session).listen(FD,
+                         /* Incoming =*/true,
+                         /* Outgoing =*/false,
+                         /* EdgeTriggered =*/true);
+  // The output that arrived during the pause was not reported, as the file
+  // was not listened to.
+  dataCallback(Session);
+  Session.getReader()->tryFreeResources();
+}
+
+void Server::setSessionRateLimit(SessionData& Session,
+                                 std::size_t BytesPerSecond)
+{
+  Session.setRateLimit(BytesPerSecond);
+  // A paused session may continue reading right away with the new limit.
+  endRatePause(Session);
+}
+
+bool Server::shedConnection()
+{
+  if (!ReserveFD.has())
+    return false;
+
+  fd::close(ReserveFD.release());
+  std::optional<Socket> ClientSock = Sock.accept(nullptr, nullptr);
+  const bool Dropped = ClientSock.has_value();
+  if (Dropped)
+    LOG(warn) << "Dropped an incoming connection, the server is out of file "
+                 "descriptors";
+  // The socket is closed here, making its number available for the reserve
+  // again.
+  ClientSock.reset();
+  ReserveFD = CheckedPOSIX(
+                [] { return ::open("/dev/null", O_RDONLY | O_CLOEXEC); }, -1)
+                .get();
+  return Dropped;
+}
+
+void Server::sweepIdleResources()
+{
+  MONOMUX_TRACE_LOG(LOG(trace) << "Sweeping idle buffers...");
+  for (SessionData& S : Sessions)
   {
-    // As a full client connection would require *TWO* file descriptors (control
-    // and data socket) and we would need to keep 1 open so we can always
-    // accept() a connection, reject the client if there aren't any space left.
-    LOG(warn) << "Self-defence rejecting client - " << FDCount
-              << " FDs allocated out of the max " << MaxFDs;
-    sendRejectClient(Client, "Not enough file descriptors left on server.");
-    removeClient(Client);
+    if (Pipe* R = S.getReader())
+      R->tryFreeResources();
+    if (Pipe* W = S.getWriter())
+      W->tryFreeResources();
+  }
+  for (ClientData& C : Clients)
+  {
+    C.getControlSocket().tryFreeResources();
+    if (Socket* DS = C.getDataSocket())
+      DS->tryFreeResources();
+  }
+
+  Poll->addTimer(IdleSweepInterval, [this] { sweepIdleResources(); });
+}
+
+void Server::hibernateIdleSessions()
+{
+  for (SessionData& S : Sessions)
+    hibernate(S);
+
+  // A session is hibernated at most half the period late.
+  Poll->addTimer(std::clamp<std::chrono::seconds>(
+                   HibernateAfter / 2,
+                   std::chrono::seconds{1},
+                   std::chrono::seconds{60}),
+                 [this] { hibernateIdleSessions(); });
+}
+
+bool Server::hibernate(SessionData& Session)
+{
+  if (Session.isHibernated() || !Session.getAttachedClients().empty() ||
+      Session.getHandedOffTo() || !Session.hasProcess() ||
+      !Session.getProcess().hasPty())
+    return false;
+  if (Session.isOutputThrottled() || Session.coalesceDeadline() ||
+      Session.ratePauseDeadline())
+    // Reading the output is already deferred, and will be resumed.
+    return false;
+  if (LoopClock::now() - Session.lastActive() < HibernateAfter ||
+      std::chrono::steady_clock::now() - Session.lastInput() < HibernateAfter)
+    return false;
+
+  raw_fd FD = Session.getIdentifyingFD();
+  Pipe* R = Session.getReader();
+  Pipe* W = Session.getWriter();
+  if (!FDLookup.contains(FD) || R->hasBufferedRead() || W->hasBufferedWrite())
+    return false;
+
+  pollOf(Session).stop(FD);
+  FDLookup.erase(FD);
+  // (Level-triggered, so output that arrived after the last read of the
+  // relaying loop is reported.)
+  ColdPoll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
+  HibernatedSessions[FD] = &Session;
+  Session.setHibernated(true);
+  R->tryFreeResources();
+  W->tryFreeResources();
+  ++HibernationCount;
+  LOG(debug) << "Session \"" << Session.name() << "\" hibernated";
+  return true;
+}
+
+void Server::wake(SessionData& Session)
+{
+  raw_fd FD = Session.getIdentifyingFD();
+  ColdPoll->stop(FD);
+  HibernatedSessions.erase(FD);
+  Session.setHibernated(false);
+  ++WakeupCount;
+
+  EPoll& P = pollOf(Session);
+  P.listen(FD,
+           /* Incoming =*/true,
+           /* Outgoing =*/false,
+           /* EdgeTriggered =*/true);
+  FDLookup[FD] = SessionConnection{&Session};
+  // The output that woke the session might not be reported as a new edge.
+  P.schedule(FD, /* Incoming =*/true, /* Outgoing =*/false);
+  LOG(debug) << "Session \"" << Session.name() << "\" woken up";
+}
+
+void Server::handleColdEvents()
+{
+  const std::size_t Count = ColdPoll->poll();
+  // Waking a session stops listening to it, which must not happen while the
+  // events of the cold set are being iterated.
+  std::vector<SessionData*> Woken;
+  Woken.reserve(Count);
+  for (std::size_t I = 0; I < Count; ++I)
+    if (auto It = HibernatedSessions.find(ColdPoll->fdAt(I));
+        It != HibernatedSessions.end())
+      Woken.emplace_back(It->second);
+  for (SessionData* S : Woken)
+    wake(*S);
+}
+
+void Server::compactScrollback()
+{
+  Poll->addTimer(ScrollbackCompactInterval, [this] { compactScrollback(); });
+  if (Poll->getEventCount() + Poll->getScheduledCount() > 1)
+    // Other events arrived together with the timer, so the loop is not idle.
     return;
+
+  std::size_t Budget = ScrollbackCompactBudget;
+  for (SessionData& S : Sessions)
+  {
+    Budget -= std::min(Budget, S.compactOutput(Budget));
+    if (!Budget)
+      break;
   }
+}
 
-  fd::setNonBlockingCloseOnExec(FD);
-  Poll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
-  FDLookup[FD] = ClientControlConnection{&Client};
+void Server::checkMemoryBudget()
+{
+  const std::size_t Usage = memoryUsage();
+  const std::size_t High = MemoryBudget / 100 * MemoryPressureHighPercent;
+  const std::size_t Low = MemoryBudget / 100 * MemoryPressureLowPercent;
+  if (Usage >= High)
+  {
+    if (!MemoryPressure.get().exchange(true))
+      LOG(warn) << "Memory usage of " << Usage
+                << " bytes is approaching the budget of " << MemoryBudget
+                << " bytes, throttling sessions";
+    relieveMemory(Low);
+  }
+  else if (Usage < Low && MemoryPressure.get().exchange(false))
+  {
+    LOG(info) << "Memory usage dropped to " << Usage
+              << " bytes, resuming sessions";
+    for (SessionData& S : Sessions)
+      if (S.isOutputThrottled())
+        updateFlowControl(S);
+  }
 
-  sendAcceptClient(Client);
+  Poll->addTimer(MemoryBudgetCheckInterval, [this] { checkMemoryBudget(); });
 }
 
-void Server::controlCallback(ClientData& Client)
+void Server::relieveMemory(std::size_t Target)
 {
-  using namespace monomux::message;
-  MONOMUX_TRACE_LOG(LOG(trace)
-                    << "Client \"" << Client.id() << "\" sent CONTROL!");
-  Socket& ClientSock = Client.getControlSocket();
-  std::string Data;
+  // The cached slabs hold no data at all.
+  SlabPool::trim();
 
-  try
+  std::vector<BufferedChannel*> Channels;
+  for (SessionData& S : Sessions)
   {
-    Data = readPascalString(ClientSock);
+    if (Pipe* R = S.getReader())
+      Channels.emplace_back(R);
+    if (Pipe* W = S.getWriter())
+      Channels.emplace_back(W);
   }
-  catch (const buffer_overflow& BO)
+  for (ClientData& C : Clients)
   {
-    LOG(trace) << "Client \"" << Client.id()
-               << "\": error when reading CONTROL: "
-               << "\n\t" << BO.what();
-    rescheduleOverflow(*Poll, BO);
-    return;
+    Channels.emplace_back(&C.getControlSocket());
+    if (Socket* DS = C.getDataSocket())
+      Channels.emplace_back(DS);
   }
-  catch (const std::system_error& Err)
+  std::sort(Channels.begin(),
+            Channels.end(),
+            [](const BufferedChannel* L, const BufferedChannel* R) {
+              return L->allocatedSize() > R->allocatedSize();
+            });
+  for (BufferedChannel* C : Channels)
   {
-    LOG(error) << "Client \"" << Client.id()
-               << "\": error when reading CONTROL: " << Err.what();
+    if (memoryUsage() < Target || !C->allocatedSize())
+      break;
+    C->tryFreeResources();
   }
 
-  if (ClientSock.failed())
+  std::vector<SessionData*> Backlogs;
+  for (SessionData& S : Sessions)
+    if (S.outputBacklogSize())
+      Backlogs.emplace_back(&S);
+  std::sort(
+    Backlogs.begin(), Backlogs.end(), [](SessionData* L, SessionData* R) {
+      return L->outputBacklogSize() > R->outputBacklogSize();
+    });
+  for (SessionData* S : Backlogs)
   {
-    // We realise the client disconnected during an attempt to read.
-    exitCallback(Client);
-    return;
+    if (memoryUsage() < Target)
+      break;
+    S->evictOutput();
   }
+}
 
-  if (ClientSock.hasBufferedRead())
-    Poll->schedule(ClientSock.raw(), /* Incoming =*/true, /* Outgoing =*/false);
-  else
-    ClientSock.tryFreeResources();
+EPoll& Server::pollOf(const SessionData& Session) const noexcept
+{
+  if (std::optional<std::size_t> Shard = Session.shard();
+      Shard && *Shard < Workers.size())
+    return *Workers[*Shard]->Poll;
+  return *Poll;
+}
+
+EPoll& Server::pollOf(const ClientData& Client) const noexcept
+{
+  if (const SessionData* S = Client.getAttachedSession())
+    return pollOf(*S);
+  return *Poll;
+}
 
-  if (Data.empty())
+std::optional<std::size_t> Server::pickShard() const
+{
+  if (Workers.empty())
+    return std::nullopt;
+
+  std::vector<std::size_t> Load(Workers.size(), 0);
+  for (const SessionData& S : Sessions)
+    if (std::optional<std::size_t> Shard = S.shard();
+        Shard && *Shard < Load.size())
+      ++Load[*Shard];
+  return std::min_element(Load.begin(), Load.end()) - Load.begin();
+}
+
+void Server::startWorkers()
+{
+  static constexpr std::size_t WorkerEventQueue = 1 << 10;
+  if (!WorkerCount)
     return;
 
-  Message MB = Message::unpack(Data);
-  auto Action =
-    Dispatch.find(static_cast<decltype(Dispatch)::key_type>(MB.Kind));
-  if (Action == Dispatch.end())
+  Wakeup = makeWakeup();
+  Poll->listen(Wakeup, /* Incoming =*/true, /* Outgoing =*/false);
+
+  // Signals are handled by the main loop. The workers inherit the blocked
+  // set of the thread that starts them.
+  POD<sigset_t> All;
+  POD<sigset_t> Previous;
+  ::sigfillset(&All);
+  ::pthread_sigmask(SIG_SETMASK, &All, &Previous);
+  for (std::size_t I = 0; I < WorkerCount; ++I)
   {
-    MONOMUX_TRACE_LOG(LOG(trace) << "Client \"" << Client.id()
-                                 << "\": unknown message type "
-                                 << static_cast<int>(MB.Kind) << " received");
-    return;
+    Worker& W = *Workers.emplace_back(std::make_unique<Worker>());
+    W.Poll = std::make_unique<EPoll>(WorkerEventQueue);
+    W.Poll->setWaitLock(&W.Lock);
+    W.Wakeup = makeWakeup();
+    W.Poll->listen(W.Wakeup, /* Incoming =*/true, /* Outgoing =*/false);
+    W.Thread = std::thread{[this, &W] { workerLoop(W); }};
   }
+  ::pthread_sigmask(SIG_SETMASK, &Previous, nullptr);
 
-  MONOMUX_TRACE_LOG(LOG(data) << "Client \"" << Client.id() << "\"\n"
-                              << MB.RawData);
-  try
+  LOG(info) << "Started " << Workers.size() << " worker threads";
+}
+
+void Server::stopWorkers()
+{
+  TerminateLoop.get().store(true);
+  for (std::unique_ptr<Worker>& W : Workers)
+    notify(W->Wakeup);
+  for (std::unique_ptr<Worker>& W : Workers)
+    if (W->Thread.joinable())
+      W->Thread.join();
+  // The event loops of the workers are kept, as the connections of the
+  // sessions are still registered in them during shutdown().
+}
+
+void Server::workerLoop(Worker& W)
+{
+  MONOMUX_ALLOCATION_SCOPE(Server);
+  OnWorkerThread = true;
+  CurrentLoopMetrics = &W.Metrics;
+  std::unique_lock<std::mutex> Lock{W.Lock};
+  std::vector<std::size_t> EventOrder;
+  while (!TerminateLoop.get().load())
   {
-    Action->second(*this, Client, MB.RawData);
+    std::size_t NumTriggeredFDs;
+    try
+    {
+      NumTriggeredFDs = W.Poll->wait();
+    }
+    catch (const std::system_error& Err)
+    {
+      LOG(fatal) << "Worker failed to wait for events:\n\t" << Err.what();
+      interrupt();
+      notify(Wakeup);
+      return;
+    }
+    LoopClock::tick();
+    const auto IterationBegin = std::chrono::steady_clock::now();
+    MONOMUX_TRACEPOINT(LoopWake, -1, 0, NumTriggeredFDs);
+
+    CurrentSessionQuota = orderEvents(*W.Poll, NumTriggeredFDs, EventOrder);
+    for (std::size_t I : EventOrder)
+    {
+      if (W.Yield.load(std::memory_order_acquire))
+      {
+        // Let the main loop change the shared state between two events.
+        Lock.unlock();
+        while (W.Yield.load(std::memory_order_acquire))
+          std::this_thread::yield();
+        Lock.lock();
+      }
+
+      EPoll::EventWithMode Event;
+      try
+      {
+        Event = W.Poll->eventAt(I);
+      }
+      catch (...)
+      {
+        continue;
+      }
+      if (Event.FD == fd::Invalid)
+        continue;
+
+      if (Event.FD == W.Wakeup.get())
+      {
+        drain(W.Wakeup);
+        continue;
+      }
+      if (W.Poll->isTimer(Event.FD))
+      {
+        fireTimers(*W.Poll);
+        continue;
+      }
+
+      handleEvent(*W.Poll, Event);
+    }
+    countIteration(W.Metrics, *W.Poll, NumTriggeredFDs, IterationBegin);
   }
-  catch (const buffer_overflow& BO)
+}
+
+void Server::pauseWorkers()
+{
+  for (std::unique_ptr<Worker>& W : Workers)
   {
-    LOG(trace) << "Client \"" << Client.id()
-               << "\": error when handling message"
-               << "\n\t" << BO.what();
-    rescheduleOverflow(*Poll, BO);
+    W->Yield.store(true, std::memory_order_release);
+    W->Lock.lock();
+    W->Yield.store(false, std::memory_order_release);
   }
-  catch (const std::system_error& Err)
+}
+
+void Server::resumeWorkers()
+{
+  for (std::unique_ptr<Worker>& W : Workers)
   {
-    LOG(error) << "Client \"" << Client.id()
-               << "\": error when handling message";
-    if (ClientSock.failed())
-      exitCallback(Client);
+    // The worker might be blocked in a wait that does not know about the
+    // events scheduled for it in the meantime.
+    const bool Wake = W->Poll->hasScheduled();
+    W->Lock.unlock();
+    if (Wake)
+      notify(W->Wakeup);
   }
 }
 
-void Server::dataCallback(ClientData& Client)
+void Server::moveDataConnection(ClientData& Client, EPoll& From, EPoll& To)
 {
+  Socket* DS = Client.getDataSocket();
+  if (!DS || &From == &To)
+    return;
 
-  MONOMUX_TRACE_LOG(LOG(trace)
-                    << "Client \"" << Client.id() << "\" sent DATA!");
-  Socket& DS = *Client.getDataSocket();
-  std::string Data;
-  try
+  From.stop(DS->raw());
+  if (!Client.isObserver())
+    To.listen(DS->raw(),
+              /* Incoming =*/true,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/true);
+  // The readiness of the connection might have only been reported to the
+  // previous event loop.
+  To.schedule(DS->raw(),
+              /* Incoming =*/!Client.isObserver(),
+              /* Outgoing =*/true);
+
+  if (SharedRing* Ring = Client.getOutputRing())
   {
-    Data = DS.read(DS.optimalReadSize());
+    From.stop(Ring->spaceBell());
+    To.listen(Ring->spaceBell(),
+              /* Incoming =*/true,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/true);
+    To.schedule(Ring->spaceBell(), /* Incoming =*/true, /* Outgoing =*/false);
   }
-  catch (const buffer_overflow& BO)
+}
+
+void Server::dropClient(ClientData& Client)
+{
+  if (Client.isChannel())
   {
-    LOG(error) << "Client \"" << Client.id() << "\": error when reading DATA: "
-               << "\n\t" << BO.what();
-    sendKickClient(Client,
-                   "Overflow when reading connection, " +
-                     std::to_string(BO.channel().readInBuffer()) +
-                     " bytes already pending");
-    exitCallback(Client);
+    // Only the channel is gone, not the connection it is multiplexed over.
+    closeChannel(Client);
     return;
   }
-  catch (const std::system_error& Err)
+  if (!OnWorkerThread)
   {
-    LOG(error) << "Client \"" << Client.id()
-               << "\": error when reading DATA: " << Err.what();
+    exitCallback(Client);
     return;
   }
+  if (Client.isLeaving())
+    return;
 
-  if (DS.failed())
+  // The clients are owned by the main loop. Only make sure this one is not
+  // handled by this worker anymore, and let the main loop tear it down.
+  Client.setLeaving();
+  if (SessionData* S = Client.getAttachedSession())
+    clientDetachedCallback(Client, *S);
+  if (LeavingClients.push(Client.id()))
+    notify(Wakeup);
+}
+
+void Server::publishSessionEvent(message::notification::SessionEvent Event)
+{
+  StatusStale.get().store(true);
+  if (!Subscribers || ShuttingDown)
+    return;
+  if (OnWorkerThread)
   {
-    // We realise the client disconnected during an attempt to read.
-    exitCallback(Client);
+    // The control connections are owned by the main loop.
+    if (PendingSessionEvents.push(std::move(Event)))
+      notify(Wakeup);
     return;
   }
 
-  if (DS.hasBufferedRead())
-    Poll->schedule(DS.raw(), /* Incoming =*/true, /* Outgoing =*/false);
-
-  Client.activity();
-  MONOMUX_TRACE_LOG(LOG(data)
-                    << "Client \"" << Client.id() << "\" data: " << Data);
+  for (ClientData& Client : Clients)
+  {
+    if (!Client.isSubscribed() || Client.getControlSocket().failed())
+      continue;
 
-  if (SessionData* S = Client.getAttachedSession())
     try
     {
-      S->getWriter()->write(Data);
+      sendMessage(Client.getControlSocket(), Event, Client.encoding());
+      if (Client.getControlSocket().hasBufferedWrite())
+        Poll->schedule(Client.getControlSocket().raw(),
+                       /* Incoming =*/false,
+                       /* Outgoing =*/true);
     }
     catch (const buffer_overflow& BO)
     {
-      LOG(trace) << "Session \"" << S->name()
-                 << "\" when relaying input from client \"" << Client.id()
-                 << "\"\n\t" << BO.what();
       rescheduleOverflow(*Poll, BO);
     }
+    catch (const std::system_error&)
+    {
+      // The client will be torn down when its connection is handled.
+    }
+  }
 }
 
-void Server::exitCallback(ClientData& Client)
+void Server::handlePendingSessionEvents()
 {
-  LOG(info) << "Client \"" << Client.id() << "\" exited";
+  for (auto& Event : PendingSessionEvents.take())
+    publishSessionEvent(std::move(Event));
+}
 
-  if (const auto* DS = Client.getDataSocket())
+void Server::publishStatus()
+{
+  if (!Status)
+    return;
+
+  std::string Data;
+  message::BinaryWriter Writer{Data};
+  const std::vector<SessionData*> InOrder = sessionsInOrder();
+  Writer.integer(static_cast<std::uint32_t>(InOrder.size()));
+  for (const SessionData* S : InOrder)
   {
-    Poll->stop(DS->raw());
-    FDLookup.erase(DS->raw());
+    message::SessionStatus Record;
+    Record.Session.Name = S->name();
+    Record.Session.Created =
+      std::chrono::system_clock::to_time_t(S->whenCreated());
+    Record.AttachedClients = S->getAttachedClients().size();
+    Record.LastActive = std::chrono::system_clock::to_time_t(S->lastActive());
+    message::SessionStatus::encodeBinary(Writer, Record);
   }
+  if (Data == PublishedStatus)
+    // Readers are not disturbed if nothing changed.
+    return;
 
-  Poll->stop(Client.getControlSocket().raw());
-  FDLookup.erase(Client.getControlSocket().raw());
+  try
+  {
+    Status->publish(Data);
+    PublishedStatus = std::move(Data);
+  }
+  catch (const std::system_error& SE)
+  {
+    LOG(warn) << "Failed to publish the status page: " << SE.what();
+  }
+}
 
-  removeClient(Client);
+void Server::refreshStatus()
+{
+  publishStatus();
+  Poll->addTimer(StatusPageInterval, [this] { refreshStatus(); });
 }
 
-void Server::createCallback(SessionData& Session)
+void Server::startSearch(ClientData& Client,
+                         std::string Pattern,
+                         std::string_view Session,
+                         std::size_t MaxMatches)
 {
-  LOG(info) << "Session \"" << Session.name() << "\" created";
-  if (Session.hasProcess() && Session.getProcess().hasPty())
+  auto Search = std::make_shared<PendingSearch>();
+  Search->Client = Clients.handle(Client);
+  Search->MaxMatches =
+    MaxMatches ? std::min(MaxMatches, SearchMatchesMax) : SearchMatchesMax;
+  if (!Session.empty())
   {
-    raw_fd FD = Session.getIdentifyingFD();
-
-    Poll->listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
-    FDLookup[FD] = SessionConnection{&Session};
+    if (SessionData* S = getSession(Session))
+      Search->Sessions.emplace_back(S->name(), ScrollbackSearch{Pattern, *S});
+  }
+  else
+    for (SessionData* S : sessionsInOrder())
+      Search->Sessions.emplace_back(S->name(), ScrollbackSearch{Pattern, *S});
+  Search->Remaining = Search->Sessions.size();
+  LOG(debug) << "Client \"" << Client.id() << "\" searching "
+             << Search->Sessions.size() << " sessions for \"" << Pattern
+             << '"';
+
+  if (Search->Sessions.empty())
+  {
+    respondToSearch(*Search);
+    return;
   }
+  for (std::size_t I = 0; I < Search->Sessions.size(); ++I)
+    pollOf(*getSession(Search->Sessions.at(I).first))
+      .addTimer(std::chrono::steady_clock::duration::zero(),
+                [this, Search, I] { stepSearch(Search, I); });
 }
 
-void Server::dataCallback(SessionData& Session)
+void Server::stepSearch(const std::shared_ptr<PendingSearch>& Search,
+                        std::size_t Index)
 {
-  MONOMUX_TRACE_LOG(LOG(trace)
-                    << "Session \"" << Session.name() << "\" sent DATA!");
-  std::string Data;
-  try
+  auto& [Name, Scan] = Search->Sessions.at(Index);
+  SessionData* S = getSession(Name);
+  bool Finished = !S;
   {
-    Data = Session.getReader()->read(Session.getReader()->optimalReadSize());
+    std::lock_guard<std::mutex> Lock{Search->Lock};
+    Finished |= Search->Truncated;
   }
-  catch (const buffer_overflow& BO)
+
+  std::vector<ScrollbackSearch::Match> Found;
+  if (!Finished)
+    Finished = Scan.step(*S, SearchStepBudget, Found);
+
+  bool Last = false;
   {
-    LOG(error) << "Session \"" << Session.name()
-               << "\": error when reading DATA: "
-               << "\n\t" << BO.what();
-    rescheduleOverflow(*Poll, BO);
+    std::lock_guard<std::mutex> Lock{Search->Lock};
+    for (ScrollbackSearch::Match& M : Found)
+    {
+      if (Search->Matches.size() == Search->MaxMatches)
+      {
+        Search->Truncated = true;
+        break;
+      }
+      Search->Matches.emplace_back(Index, std::move(M));
+    }
+    Finished |= Search->Truncated;
+    if (Finished)
+      Last = --Search->Remaining == 0;
+  }
+
+  if (!Finished)
+  {
+    // Let the other events of the loop be handled before the next step.
+    pollOf(*S).addTimer(
+      std::chrono::steady_clock::duration::zero(),
+      [this, Search, Index] { stepSearch(Search, Index); });
     return;
   }
-  catch (const std::system_error& Err)
+  if (!Last)
+    return;
+  if (OnWorkerThread)
   {
-    LOG(error) << "Session \"" << Session.name()
-               << "\": error when reading DATA: " << Err.what();
+    // The control connections are owned by the main loop.
+    if (FinishedSearches.push(Search))
+      notify(Wakeup);
     return;
   }
+  respondToSearch(*Search);
+}
 
-  if (Session.getReader()->hasBufferedRead())
-    Poll->schedule(Session.getIdentifyingFD(),
-                   /* Incoming =*/true,
-                   /* Outgoing =*/false);
+void Server::respondToSearch(PendingSearch& Search)
+{
+  ClientData* Client = Clients.get(Search.Client);
+  if (!Client || Client->getControlSocket().failed())
+    return;
 
-  Session.activity();
-  MONOMUX_TRACE_LOG(LOG(data)
-                    << "Session \"" << Session.name() << "\" data: " << Data);
+  // The sessions are in the order of their names.
+  std::sort(Search.Matches.begin(),
+            Search.Matches.end(),
+            [](const auto& LHS, const auto& RHS) {
+              return std::make_pair(LHS.first, LHS.second.Offset) <
+                     std::make_pair(RHS.first, RHS.second.Offset);
+            });
+  message::response::Search Resp;
+  Resp.Success = true;
+  Resp.Truncated = Search.Truncated;
+  Resp.Matches.reserve(Search.Matches.size());
+  for (auto& [Index, M] : Search.Matches)
+    Resp.Matches.emplace_back(message::SearchMatch{
+      Search.Sessions.at(Index).first, M.Offset, std::move(M.Context)});
+  LOG(debug) << "Client \"" << Client->id() << "\" search found "
+             << Resp.Matches.size() << " matches";
 
-  for (ClientData* C : Session.getAttachedClients())
-    if (Socket* DS = C->getDataSocket())
-    {
-      try
-      {
-        DS->write(Data);
-      }
-      catch (const buffer_overflow& BO)
-      {
-        // This is the part that can usually hang if there is too much data
-        // coming from the session that can't be sent to the clients in a
-        // timely manner.
-        sendKickClient(*C,
-                       "Overflow when sending, " +
-                         std::to_string(BO.channel().writeInBuffer()) +
-                         " bytes already pending");
-        exitCallback(*C);
-        continue;
-      }
-      catch (const std::system_error& Err)
-      {
-        LOG(error) << "Session \"" << Session.name()
-                   << "\": error when sending DATA to attached client \""
-                   << C->id() << "\": " << Err.what();
+  try
+  {
+    sendMessage(Client->getControlSocket(), Resp, Client->encoding());
+    if (Client->getControlSocket().hasBufferedWrite())
+      Poll->schedule(Client->getControlSocket().raw(),
+                     /* Incoming =*/false,
+                     /* Outgoing =*/true);
+  }
+  catch (const buffer_overflow& BO)
+  {
+    rescheduleOverflow(*Poll, BO);
+  }
+  catch (const std::system_error&)
+  {
+    // The client will be torn down when its connection is handled.
+  }
+}
 
-        if (DS->failed())
-        {
-          // We realise the client disconnected during an attempt to send.
-          exitCallback(*C);
-          continue;
-        }
-      }
+void Server::handleFinishedSearches()
+{
+  for (std::shared_ptr<PendingSearch>& Search : FinishedSearches.take())
+    respondToSearch(*Search);
+}
 
-      if (DS->hasBufferedWrite())
-        Poll->schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
-    }
+void Server::handleLeavingClients()
+{
+  for (std::size_t ID : LeavingClients.take())
+    // The ID of a client is the number of its socket, which might have been
+    // reused by a new client since.
+    if (ClientData* C = getClient(ID); C && C->isLeaving())
+      exitCallback(*C);
 }
 
-void Server::clientAttachedCallback(ClientData& Client, SessionData& Session)
+void Server::clientAttachedCallback(ClientData& Client,
+                                    SessionData& Session,
+                                    std::optional<std::size_t> ResumeFrom)
 {
   LOG(info) << "Client \"" << Client.id() << "\" attached to \""
             << Session.name() << '"';
+  EPoll& From = pollOf(Client);
+  if (Session.isHibernated())
+    wake(Session);
   Client.attachToSession(Session);
-  Session.attachClient(Client);
+  Session.attachClient(Client, ResumeFrom);
+  if (Client.isChannel())
+  {
+    // The shared connection stays with the client multiplexing over it.
+    publishSessionEvent(
+      sessionEvent(message::notification::SessionEvent::Attached, Session));
+    return;
+  }
+  if (Socket* DS = Client.getDataSocket(); DS && Client.isObserver())
+    // Read-only clients send no input, their connection is only written,
+    // which is scheduled explicitly.
+    From.stop(DS->raw());
+  moveDataConnection(Client, From, pollOf(Client));
+  publishSessionEvent(
+    sessionEvent(message::notification::SessionEvent::Attached, Session));
 }
 
 void Server::clientDetachedCallback(ClientData& Client, SessionData& Session)
@@ -624,8 +3350,103 @@ void Server::clientDetachedCallback(ClientData& Client, SessionData& Session)
     return;
   LOG(info) << "Client \"" << Client.id() << "\" detached from \""
             << Session.name() << '"';
+  EPoll& From = pollOf(Client);
+
+  if (Socket* DS = Client.getDataSocket(); DS && !DS->failed())
+  {
+    // Hand over the output the client did not receive yet to the client's own
+    // connection, as the shared backlog of the session will not serve it
+    // anymore.
+    std::size_t Cursor = Client.outputCursor();
+    try
+    {
+      if (Client.hasSpliceResidue())
+        DS->write(Client.getSplicePipe()->take());
+      while (Cursor < Session.outputEnd())
+      {
+        std::string_view Data = Session.peekOutput(Cursor);
+        if (Data.empty())
+          break;
+        if (Client.isChannel())
+        {
+          writeChannelFrames(*DS, Client, {Data, {}});
+          Cursor += Data.size();
+          continue;
+        }
+        if (Client.getOutputRing())
+        {
+          // The ring can not grow, so whatever does not fit is lost.
+          const std::size_t Sent = sendOutput(Client, {Data, {}});
+          Cursor += Sent;
+          if (Sent < Data.size())
+            break;
+          continue;
+        }
+        if (Client.isCompressed())
+          writeCompressedFrames(*DS, {Data, {}});
+        else
+          DS->write(Data);
+        Cursor += Data.size();
+      }
+    }
+    catch (const buffer_overflow&)
+    {}
+    catch (const std::system_error&)
+    {}
+    Client.setOutputCursor(Cursor);
+  }
+
   Client.detachSession();
   Session.removeClient(Client);
+  if (!OnWorkerThread && !ShuttingDown && !Client.isObserver() &&
+      Client.getWindowSize())
+    // The size might have been decided by the client.
+    requestResize(Session);
+  if (Client.isChannel())
+  {
+    if (Socket* DS = Client.getDataSocket();
+        DS && DS->hasBufferedWrite() && !OnWorkerThread)
+      Poll->schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+    updateFlowControl(Session);
+    publishSessionEvent(
+      sessionEvent(message::notification::SessionEvent::Detached, Session));
+    // A channel exists only while it is attached.
+    Client.getParent()->closeChannel(Client.channel());
+    return;
+  }
+  Client.setCatchUp(false);
+  if (Client.isObserver())
+  {
+    Client.setObserver(false);
+    if (Socket* DS = Client.getDataSocket(); DS && !DS->failed())
+      From.listen(DS->raw(),
+                  /* Incoming =*/true,
+                  /* Outgoing =*/false,
+                  /* EdgeTriggered =*/true);
+  }
+  if (Session.getHandedOffTo() == &Client)
+    takeBackPty(Session);
+  if (Socket* DS = Client.getDataSocket(); DS && &From != Poll.get())
+  {
+    if (OnWorkerThread)
+    {
+      // The main loop can not be changed from a worker. The connection is left
+      // alone until the main loop tears the client down, see dropClient().
+      From.stop(DS->raw());
+      if (SharedRing* Ring = Client.getOutputRing())
+        From.stop(Ring->spaceBell());
+    }
+    else
+      moveDataConnection(Client, From, *Poll);
+  }
+  if (Socket* DS = Client.getDataSocket();
+      DS && DS->hasBufferedWrite() && !OnWorkerThread)
+    // Send the output handed over above as the client can take it.
+    Poll->schedule(DS->raw(), /* Incoming =*/false, /* Outgoing =*/true);
+  // The slowest client might have just left.
+  updateFlowControl(Session);
+  publishSessionEvent(
+    sessionEvent(message::notification::SessionEvent::Detached, Session));
 }
 
 void Server::destroyCallback(SessionData& Session)
@@ -635,11 +3456,24 @@ void Server::destroyCallback(SessionData& Session)
   {
     raw_fd FD = Session.getProcess().getPty()->raw();
 
-    Poll->stop(FD);
+    pollOf(Session).stop(FD);
     FDLookup.erase(FD);
   }
+  unwatchExit(Session);
+  if (isPooled(Session))
+  {
+    LOG(warn) << "Pooled Session \"" << Session.name()
+              << "\" exited before it was used";
+    removeSession(Session);
+    return;
+  }
 
+  // (The session is gone after the removal.)
+  message::notification::SessionEvent Destroyed =
+    sessionEvent(message::notification::SessionEvent::Destroyed, Session);
   removeSession(Session);
+  Destroyed.AttachedClients = 0;
+  publishSessionEvent(std::move(Destroyed));
 }
 
 void Server::turnClientIntoDataOfOtherClient(ClientData& MainClient,
@@ -650,46 +3484,166 @@ void Server::turnClientIntoDataOfOtherClient(ClientData& MainClient,
                     << "\" becoming the DATA connection for Client \""
                     << MainClient.id() << '"');
   MainClient.subjugateIntoDataSocket(DataClient);
-  FDLookup[MainClient.getDataSocket()->raw()] =
-    ClientDataConnection{&MainClient};
+  // The connection was registered as a control connection, but the data
+  // connection is drained by its handler.
+  Poll->stop(MainClient.getDataSocket()->raw());
+  registerDataSocket(MainClient);
 
   // Remove the object from the owning data structure but do not fire the exit
   // handler!
-  Clients.erase(DataClient.id());
+  ClientsByID.erase(DataClient.id());
+  Clients.erase(DataClient);
+}
+
+fd Server::makeDataSocketPair(ClientData& Client)
+{
+  POD<raw_fd[2]> Ends;
+  CheckedPOSIXThrow(
+    [&Ends] {
+      return ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Ends);
+    },
+    "socketpair()",
+    -1);
+  fd ClientEnd{Ends[1]};
+  // (The client's end stays blocking, like a connection the client made.)
+  fd::setNonBlockingCloseOnExec(Ends[0]);
+
+  MONOMUX_TRACE_LOG(LOG(trace) << "Client \"" << Client.id()
+                               << "\" gets a DATA connection pair");
+  Client.setDataSocket(
+    std::make_unique<Socket>(Socket::wrap(fd{Ends[0]}, std::string{})));
+  registerDataSocket(Client);
+  return ClientEnd;
+}
+
+void Server::registerDataSocket(ClientData& Client)
+{
+  Socket& DS = *Client.getDataSocket();
+  FDLookup[DS.raw()] = ClientDataConnection{&Client};
+
+  EPoll& DataPoll = pollOf(Client);
+  DataPoll.listen(DS.raw(),
+                  /* Incoming =*/true,
+                  /* Outgoing =*/false,
+                  /* EdgeTriggered =*/true);
+  if (DS.hasBufferedRead())
+    DataPoll.schedule(DS.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+}
+
+void Server::closeChannel(ClientData& Channel)
+{
+  if (SessionData* S = Channel.getAttachedSession())
+    // (Detaching destroys the channel.)
+    clientDetachedCallback(Channel, *S);
+  else
+    Channel.getParent()->closeChannel(Channel.channel());
+}
+
+void Server::enableOutputRing(ClientData& Client,
+                              std::unique_ptr<SharedRing> Ring)
+{
+  MONOMUX_TRACE_LOG(LOG(trace) << "Client \"" << Client.id()
+                               << "\" receives output through shared memory");
+  const raw_fd SpaceBell = Ring->spaceBell();
+  Client.setOutputRing(std::move(Ring));
+  FDLookup[SpaceBell] = ClientOutputRingConnection{&Client};
+  pollOf(Client).listen(SpaceBell,
+                        /* Incoming =*/true,
+                        /* Outgoing =*/false,
+                        /* EdgeTriggered =*/true);
+}
+
+void Server::takeBackPty(SessionData& Session)
+{
+  if (!Session.getHandedOffTo())
+    return;
+  Session.setHandedOffTo(nullptr);
+
+  raw_fd FD = Session.getIdentifyingFD();
+  if (!FDLookup.contains(FD))
+    return;
+  pollOf(Session).listen(FD,
+                         /* Incoming =*/true,
+                         /* Outgoing =*/false,
+                         /* EdgeTriggered =*/true);
+  // Whatever the client left unread is owed to the scrollback.
+  pollOf(Session).schedule(FD, /* Incoming =*/true, /* Outgoing =*/false);
 }
 
 void Server::reapDeadChildren()
 {
+  bool ChildExited = false;
   for (Process::raw_handle& PID : DeadChildren)
   {
     if (PID == Process::Invalid)
       continue;
+    ChildExited = true;
 
-    auto SessionForProc =
-      std::find_if(Sessions.begin(), Sessions.end(), [PID](auto&& E) {
-        return E.second->hasProcess() && E.second->getProcess().raw() == PID;
-      });
-    if (SessionForProc == Sessions.end())
-      continue;
-    Process& Proc = SessionForProc->second->getProcess();
+    auto SessionForProc = SessionsByPID.find(PID);
+    if (SessionForProc != SessionsByPID.end())
+      reapSession(*SessionForProc->second);
 
-    bool Dead = Proc.reapIfDead();
-    if (Dead)
-    {
-      LOG(debug) << "Child PID " << PID << " of Session \""
-                 << SessionForProc->second->name() << "\" exited with "
-                 << Proc.exitCode();
+    PID = Process::Invalid;
+  }
 
-      for (ClientData* AC : SessionForProc->second->getAttachedClients())
-        AC->sendDetachReason(monomux::message::notification::Detached::Exit,
-                             Proc.exitCode());
-      destroyCallback(*SessionForProc->second);
-    }
+  if (ChildExited)
+    // Signals of the same kind coalesce while pending, so children that
+    // exited at the same time might not have been registered individually.
+    reapExitedChildren();
+}
 
-    PID = Process::Invalid;
+void Server::reapExitedChildren()
+{
+  while (true)
+  {
+    // Peek at the next exited child, and leave collecting it to whoever owns
+    // it, so its exit code is recorded.
+    POD<::siginfo_t> Info;
+    auto Waited = CheckedPOSIX(
+      [&Info] {
+        return ::waitid(P_ALL, 0, &Info, WEXITED | WNOHANG | WNOWAIT);
+      },
+      -1);
+    if (!Waited || Info->si_pid == 0)
+      // No children, or none of them exited.
+      return;
+
+    Process::raw_handle PID = Info->si_pid;
+    auto SessionForProc = SessionsByPID.find(PID);
+    if (SessionForProc != SessionsByPID.end() &&
+        reapSession(*SessionForProc->second))
+      continue;
+
+    if (!PendingSpawns.empty() && (!Spawner || PID != Spawner->pid()))
+      // The child might be running a session that is not registered yet, as
+      // the result of its spawn had not been handled. It is collected once
+      // the session is registered.
+      return;
+
+    // The child is not (or no longer) running a session, but it must still be
+    // collected, otherwise it would be found again and again.
+    LOG(debug) << "Child PID " << PID << " exited outside of a session";
+    if (!CheckedPOSIX([PID] { return ::waitpid(PID, nullptr, WNOHANG); }, -1))
+      return;
   }
 }
 
+bool Server::reapSession(SessionData& Session)
+{
+  Process& Proc = Session.getProcess();
+  if (!Proc.reapIfDead())
+    return false;
+
+  LOG(debug) << "Child PID " << Proc.raw() << " of Session \""
+             << Session.name() << "\" exited with " << Proc.exitCode();
+
+  for (ClientData* AC : Session.getAttachedClients())
+    AC->sendDetachReason(monomux::message::notification::Detached::Exit,
+                         Proc.exitCode());
+  destroyCallback(Session);
+  return true;
+}
+
 std::string Server::statistics() const
 {
   std::ostringstream Output;
@@ -733,12 +3687,25 @@ std::string Server::statistics() const
     [&Output, &AddIndent, &Indented, &Reindent, &IndentScope](
       const ClientData& C) {
       auto X = IndentScope();
+      if (C.isChannel())
+      {
+        Output << "Channel #" << C.channel() << " of client " << '\''
+               << C.id() << '\'' << '\n';
+        AddIndent(2);
+        Indented() << "* LastActive        : " << formatTime(C.lastActive())
+                   << '\n';
+        if (C.isObserver())
+          Indented() << "* Read-only" << '\n';
+        return;
+      }
       Output << "Client " << '\'' << C.id() << '\'' << '\n';
       AddIndent(2);
       Indented() << "* Connected         : " << formatTime(C.whenCreated())
                  << '\n';
       Indented() << "* LastActive        : " << formatTime(C.lastActive())
                  << '\n';
+      if (C.isObserver())
+        Indented() << "* Read-only" << '\n';
 
       auto& Cl = const_cast<ClientData&>(C);
       Indented() << "* Control Connection:" << '\n';
@@ -748,6 +3715,10 @@ std::string Server::statistics() const
         Reindent(Cl.getControlSocket().statistics());
       }
 
+      if (const SplicePipe* SP = Cl.getSplicePipe())
+        Indented() << "* Splice relay      : " << SP->size()
+                   << " bytes pending" << '\n';
+
       if (auto* DS = Cl.getDataSocket())
       {
         Indented() << "* Data    Connection:" << '\n';
@@ -756,6 +3727,8 @@ std::string Server::statistics() const
         AddIndent(4);
         Reindent(DS->statistics());
       }
+      if (std::size_t Channels = C.channelCount())
+        Indented() << "* Channels          : " << Channels << '\n';
     };
 
   Output << "MonoMux Server Statistics\n";
@@ -766,10 +3739,76 @@ std::string Server::statistics() const
   AddIndent(2);
   Output << '\n';
   Indented() << "* Attached clients               : " << Clients.size() << '\n';
-  Indented() << "* Running sessions               : " << Sessions.size()
+  Indented() << "* Running sessions               : " << SessionsByName.size()
              << '\n';
   Indented() << "* Open file descriptors in total : " << FDLookup.size()
              << '\n';
+  if (ColdPoll)
+    Indented() << "* Hibernated sessions            : "
+               << HibernatedSessions.size() << " (" << HibernationCount
+               << " times, " << WakeupCount << " woken up)" << '\n';
+  if (Poll)
+    Indented() << "* Event backend                  : "
+               << (Poll->getBackend() == EPoll::Backend::IOUring ? "io_uring"
+                                                                 : "epoll")
+               << '\n';
+  if (!Workers.empty())
+    Indented() << "* Worker threads                 : " << Workers.size()
+               << '\n';
+  if (SignalFD.has())
+    Indented() << "* Signals received through       : signalfd" << '\n';
+  if (Watch)
+  {
+    Indented() << "* Event loop stalls              : " << Watch->stalls()
+               << " over " << Watch->deadline().count() << " ms";
+    if (std::optional<Watchdog::Stall> Last = Watch->lastStall())
+    {
+      Output << ", last "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                  Last->Duration)
+                  .count()
+             << " ms in " << Watchdog::name(Last->At);
+      if (Last->FD != fd::Invalid)
+        Output << " on file descriptor " << Last->FD;
+    }
+    Output << '\n';
+  }
+  if (Spawner)
+    Indented() << "* Fork server                    : PID " << Spawner->pid()
+               << '\n';
+  if (SessionPoolSize)
+    Indented() << "* Idle sessions in the pool      : " << SessionPool.size()
+               << " / " << SessionPoolSize << '\n';
+  {
+    const SlabPool::Statistics Slabs = SlabPool::statistics();
+    Indented() << "* Memory used by buffers         : " << memoryUsage()
+               << " bytes";
+    if (MemoryBudget)
+      Output << " of " << MemoryBudget << " budget"
+             << (MemoryPressure.get().load() ? " (under pressure)" : "");
+    Output << '\n';
+    Indented() << "* Buffer slabs                   : " << Slabs.Allocations
+               << " allocated, " << Slabs.Reuses << " reused, "
+               << Slabs.Releases << " released, " << Slabs.CachedSlabs
+               << " cached (" << Slabs.CachedBytes << " bytes)" << '\n';
+  }
+  if constexpr (alloc::enabled())
+  {
+    const std::array<alloc::Counters, alloc::TagCount> Allocs =
+      alloc::snapshot();
+    Indented() << "* Allocations                    :" << '\n';
+    IndentRAII Saved{IndentSize};
+    AddIndent(4);
+    for (std::size_t I = 0; I < alloc::TagCount; ++I)
+    {
+      const alloc::Counters& C = Allocs.at(I);
+      Indented() << alloc::name(static_cast<alloc::Tag>(I)) << ": "
+                 << C.LiveBytes << " bytes live in " << C.LiveCount
+                 << " blocks, " << C.PeakBytes << " bytes at peak, "
+                 << C.TotalBytes << " bytes in " << C.TotalCount
+                 << " blocks in total" << '\n';
+    }
+  }
 
   std::set<std::size_t> AlreadyDumpedAttachedClients;
   Output << '\n'
@@ -778,15 +3817,17 @@ std::string Server::statistics() const
          << "- = - = - = - = -" << '\n';
   ResetIndent();
   AddIndent(2);
-  for (const auto& E : Sessions)
+  for (const SessionData* Session : sessionsInOrder())
   {
-    const SessionData& S = *E.second;
+    const SessionData& S = *Session;
     auto X = IndentScope();
 
     Indented() << "# Session " << '\'' << S.name() << '\'' << '\n';
     AddIndent(2);
     Indented() << "* Created     : " << formatTime(S.whenCreated()) << '\n';
     Indented() << "* LastActive  : " << formatTime(S.lastActive()) << '\n';
+    if (S.shard())
+      Indented() << "* Worker      : #" << *S.shard() << '\n';
 
     if (S.hasProcess())
     {
@@ -815,6 +3856,22 @@ std::string Server::statistics() const
     else
       Indented() << "! No process associated with Session\n";
 
+    Indented() << "* Output backlog: " << S.outputBacklogSize()
+               << " bytes in " << S.outputBacklogChunks() << " chunks"
+               << (S.isOutputThrottled() ? " (throttled)" : "") << '\n';
+    if (std::size_t Compressed = S.outputCompressedSize())
+      Indented() << "* Compressed scrollback: " << Compressed << " bytes in "
+                 << S.outputCompressedMemory() << " bytes of memory" << '\n';
+    if (S.rateLimit())
+      Indented() << "* Rate limit: " << S.rateLimit() << " bytes/s"
+                 << (S.ratePauseDeadline() ? " (paused)" : "") << '\n';
+    Indented() << "* Scrollback: " << S.scrollbackSize() << " bytes" << '\n';
+    if (std::size_t Spilled = S.outputSpillSize())
+      Indented() << "* Spilled to disk: " << Spilled << " bytes, "
+                 << S.outputSpillMappedSize() << " bytes mapped" << '\n';
+    if (S.coalesceWindow() != std::chrono::microseconds::zero())
+      Indented() << "* Coalescing window: " << S.coalesceWindow().count()
+                 << " us" << '\n';
     Indented() << "* Attached client #: " << S.getAttachedClients().size()
                << '\n';
     AddIndent(4);
@@ -822,7 +3879,8 @@ std::string Server::statistics() const
     {
       Indented() << '*' << ' ';
       DumpOneClient(*C);
-      AlreadyDumpedAttachedClients.emplace(C->id());
+      if (!C->isChannel())
+        AlreadyDumpedAttachedClients.emplace(C->id());
     }
   }
 
@@ -832,9 +3890,8 @@ std::string Server::statistics() const
          << "- = - = - = - = -" << '\n';
   ResetIndent();
   AddIndent(2);
-  for (const auto& E : Clients)
+  for (const ClientData& C : Clients)
   {
-    const ClientData& C = *E.second;
     if (AlreadyDumpedAttachedClients.find(C.id()) !=
         AlreadyDumpedAttachedClients.end())
       continue;
@@ -846,6 +3903,155 @@ std::string Server::statistics() const
   return Output.str();
 }
 
+/// \returns the size of the memory of the current process that is resident,
+/// or \p 0 if it could not be determined.
+static std::size_t residentBytes()
+{
+  std::ifstream Statm{"/proc/self/statm"};
+  std::size_t Total = 0;
+  std::size_t Resident = 0;
+  if (!(Statm >> Total >> Resident))
+    return 0;
+  return Resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+std::vector<message::Metric> Server::metrics() const
+{
+  using message::Metric;
+  std::vector<Metric> Ret;
+  const auto Add = [&Ret](Metric::MetricKind Kind,
+                          const char* Name,
+                          std::uint64_t Value) -> Metric& {
+    Metric& M = Ret.emplace_back();
+    M.Type = Kind;
+    M.Name = Name;
+    M.Value = Value;
+    return M;
+  };
+
+  LoopMetrics Loops = MainLoopMetrics;
+  for (const std::unique_ptr<Worker>& W : Workers)
+    Loops.merge(W->Metrics);
+
+  Add(Metric::Counter, "monomux_loop_iterations_total", Loops.Iterations);
+  Add(Metric::Counter, "monomux_loop_events_total", Loops.Events);
+  Add(Metric::Counter, "monomux_loop_saturated_total", Loops.Saturated);
+  Add(Metric::Counter, "monomux_loop_rescheduled_total", Loops.Rescheduled);
+  Add(Metric::Counter, "monomux_buffer_overflows_total", Loops.Overflows);
+  Add(Metric::Counter, "monomux_client_catch_ups_total", Loops.CatchUps);
+  Add(Metric::Counter, "monomux_syscalls_total", Loops.Syscalls);
+  Add(Metric::Counter, "monomux_output_bytes_total", Loops.OutputBytes);
+  Add(Metric::Counter, "monomux_input_bytes_total", Loops.InputBytes);
+  Add(Metric::Counter,
+      "monomux_log_dropped_total",
+      log::Logger::get().droppedMessages());
+  {
+    Metric& M = Add(Metric::Histogram,
+                    "monomux_loop_iteration_microseconds",
+                    Loops.IterationTime.sum());
+    M.Buckets.assign(Loops.IterationTime.buckets().begin(),
+                     Loops.IterationTime.buckets().end());
+  }
+  Add(Metric::Counter, "monomux_accepted_total", Loops.Accepted);
+  {
+    Metric& M = Add(Metric::Histogram,
+                    "monomux_accept_microseconds",
+                    Loops.AcceptTime.sum());
+    M.Buckets.assign(Loops.AcceptTime.buckets().begin(),
+                     Loops.AcceptTime.buckets().end());
+  }
+
+  if (Watch)
+  {
+    Add(Metric::Counter, "monomux_loop_stalls_total", Watch->stalls());
+    const DurationHistogram StallTimes = Watch->stallTimes();
+    Metric& M = Add(
+      Metric::Histogram, "monomux_loop_stall_microseconds", StallTimes.sum());
+    M.Buckets.assign(StallTimes.buckets().begin(), StallTimes.buckets().end());
+    if (std::optional<Watchdog::Stall> Last = Watch->lastStall())
+    {
+      Metric& L = Add(Metric::Gauge,
+                      "monomux_loop_last_stall_microseconds",
+                      static_cast<std::uint64_t>(Last->Duration.count()));
+      L.Labels.emplace_back("phase", Watchdog::name(Last->At));
+      L.Labels.emplace_back("fd", std::to_string(Last->FD));
+    }
+  }
+
+  Add(Metric::Gauge, "monomux_loop_events_max", Loops.MaxEvents);
+  Add(Metric::Gauge, "monomux_loop_event_capacity", Poll->getMaxEventCount());
+  Add(Metric::Gauge, "monomux_fd_lookup_entries", FDLookup.size());
+  Add(Metric::Gauge, "monomux_fd_lookup_large", FDLookup.isLarge());
+  Add(Metric::Gauge, "monomux_fd_lookup_paged", FDLookup.isPaged());
+  Add(Metric::Gauge, "monomux_resident_bytes", residentBytes());
+  const SlabPool::Statistics Slabs = SlabPool::statistics();
+  Add(Metric::Gauge, "monomux_memory_usage_bytes", memoryUsage());
+  Add(Metric::Gauge, "monomux_memory_budget_bytes", MemoryBudget);
+  Add(Metric::Gauge,
+      "monomux_memory_pressure",
+      MemoryPressure.get().load(std::memory_order_relaxed));
+  Add(Metric::Counter, "monomux_slab_allocations_total", Slabs.Allocations);
+  Add(Metric::Counter, "monomux_slab_reuses_total", Slabs.Reuses);
+  Add(Metric::Counter, "monomux_slab_releases_total", Slabs.Releases);
+  Add(Metric::Gauge, "monomux_slab_cached", Slabs.CachedSlabs);
+  Add(Metric::Gauge, "monomux_slab_cached_bytes", Slabs.CachedBytes);
+  if constexpr (alloc::enabled())
+  {
+    const std::array<alloc::Counters, alloc::TagCount> Allocs =
+      alloc::snapshot();
+    const auto AddPerTag =
+      [&Add, &Allocs](Metric::MetricKind Kind,
+                      const char* Name,
+                      std::uint64_t alloc::Counters::*Value) {
+        for (std::size_t I = 0; I < alloc::TagCount; ++I)
+          Add(Kind, Name, Allocs.at(I).*Value)
+            .Labels.emplace_back("tag",
+                                 alloc::name(static_cast<alloc::Tag>(I)));
+      };
+    AddPerTag(Metric::Gauge,
+              "monomux_allocation_live_bytes",
+              &alloc::Counters::LiveBytes);
+    AddPerTag(Metric::Gauge,
+              "monomux_allocation_live_blocks",
+              &alloc::Counters::LiveCount);
+    AddPerTag(Metric::Gauge,
+              "monomux_allocation_peak_bytes",
+              &alloc::Counters::PeakBytes);
+    AddPerTag(Metric::Counter,
+              "monomux_allocated_bytes_total",
+              &alloc::Counters::TotalBytes);
+    AddPerTag(Metric::Counter,
+              "monomux_allocations_total",
+              &alloc::Counters::TotalCount);
+  }
+  Add(Metric::Gauge, "monomux_clients", Clients.size());
+  Add(Metric::Gauge, "monomux_sessions", SessionsByName.size());
+  Add(Metric::Gauge, "monomux_pooled_sessions", SessionPool.size());
+  Add(
+    Metric::Gauge, "monomux_hibernated_sessions", HibernatedSessions.size());
+  Add(Metric::Counter, "monomux_hibernations_total", HibernationCount);
+  Add(Metric::Counter, "monomux_hibernation_wakeups_total", WakeupCount);
+  Add(Metric::Gauge, "monomux_workers", Workers.size());
+
+  const std::vector<SessionData*> InOrder = sessionsInOrder();
+  for (const SessionData* S : InOrder)
+    Add(Metric::Counter, "monomux_session_output_bytes_total", S->outputEnd())
+      .Labels.emplace_back("session", S->name());
+  for (const SessionData* S : InOrder)
+    Add(Metric::Counter, "monomux_session_input_bytes_total", S->inputBytes())
+      .Labels.emplace_back("session", S->name());
+  for (const ClientData& C : Clients)
+    Add(Metric::Counter, "monomux_client_sent_bytes_total", C.sentBytes())
+      .Labels.emplace_back("client", std::to_string(C.id()));
+  for (const ClientData& C : Clients)
+    Add(Metric::Counter,
+        "monomux_client_received_bytes_total",
+        C.receivedBytes())
+      .Labels.emplace_back("client", std::to_string(C.id()));
+
+  return Ret;
+}
+
 } // namespace monomux::server
 
 #undef LOG
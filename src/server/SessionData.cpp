@@ -19,6 +19,7 @@
 #include <algorithm>
 
 #include "monomux/server/ClientData.hpp"
+#include "monomux/system/Compress.hpp"
 #include "monomux/system/Pipe.hpp"
 #include "monomux/system/Time.hpp"
 
@@ -30,6 +31,14 @@
 namespace monomux::server
 {
 
+std::atomic<std::size_t> SessionData::TotalOutputBacklogSize;
+
+SessionData::~SessionData()
+{
+  TotalOutputBacklogSize.fetch_sub(OutputBacklogSize + ColdOutputMemory,
+                                   std::memory_order_relaxed);
+}
+
 void SessionData::setProcess(Process&& Process) noexcept
 {
   MainProcess.reset();
@@ -53,7 +62,7 @@ ClientData* SessionData::getLatestClient() const
   std::optional<decltype(std::declval<ClientData>().lastActive())> Time;
   for (ClientData* C : AttachedClients)
   {
-    if (!C->getDataSocket())
+    if (!C->getDataSocket() || C->isObserver())
       continue;
     MONOMUX_TRACE_LOG(LOG(data)
                       << "\tCandidate client \"" << C->id()
@@ -72,9 +81,21 @@ ClientData* SessionData::getLatestClient() const
   return R;
 }
 
-void SessionData::attachClient(ClientData& Client)
+void SessionData::attachClient(ClientData& Client,
+                               std::optional<std::size_t> ResumeFrom)
 {
   AttachedClients.emplace_back(&Client);
+  if (ResumeFrom && *ResumeFrom >= outputRetainedBegin() &&
+      *ResumeFrom <= outputEnd())
+  {
+    // A resuming client only receives the output it had missed.
+    Client.setOutputCursor(*ResumeFrom);
+    return;
+  }
+  // A newly attached client receives the scrollback first, and then the
+  // output produced from now on.
+  const std::size_t Retained = outputEnd() - outputRetainedBegin();
+  Client.setOutputCursor(outputEnd() - std::min(ScrollbackSize, Retained));
 }
 
 void SessionData::removeClient(ClientData& Client) noexcept
@@ -85,6 +106,321 @@ void SessionData::removeClient(ClientData& Client) noexcept
       It = AttachedClients.erase(It);
       break;
     }
+  trimOutput();
+}
+
+void SessionData::appendOutput(const std::array<std::string_view, 2>& Data,
+                               bool Retain)
+{
+  const std::size_t Size = Data.at(0).size() + Data.at(1).size();
+  if (!Size)
+    return;
+  if (!Retain && !ScrollbackSize && OutputBacklog.empty())
+  {
+    OutputBacklogBegin += Size;
+    return;
+  }
+
+  std::string& Chunk = OutputBacklog.emplace_back();
+  Chunk.reserve(Size);
+  Chunk.append(Data.at(0));
+  Chunk.append(Data.at(1));
+  OutputBacklogSize.get() += Size;
+  TotalOutputBacklogSize.fetch_add(Size, std::memory_order_relaxed);
+
+  if (ScrollbackSize)
+    // Without anything lagging, this is what keeps the scrollback bounded.
+    trimOutput();
+}
+
+void SessionData::setScrollbackSize(std::size_t Size) noexcept
+{
+  ScrollbackSize = std::min(Size, OutputBacklogMax);
+  trimOutput();
+}
+
+std::string_view SessionData::peekOutput(std::size_t Position) const noexcept
+{
+  if (Position < outputColdBegin())
+  {
+    if (!Spill || Position < SpillBase)
+      return {};
+    // (A partial write that failed might have left data in the spill file
+    // beyond the beginning of the in-memory part.)
+    return Spill->peek(Position - SpillBase)
+      .substr(0, outputColdBegin() - Position);
+  }
+  if (Position < OutputBacklogBegin)
+  {
+    const std::size_t Offset = Position - outputColdBegin();
+    return peekColdBlock(Offset / ScrollbackBlockSize)
+      .substr(Offset % ScrollbackBlockSize);
+  }
+  if (Position >= outputEnd())
+    return {};
+
+  std::size_t ChunkBegin = OutputBacklogBegin;
+  for (const std::string& Chunk : OutputBacklog)
+  {
+    if (Position < ChunkBegin + Chunk.size())
+      return std::string_view{Chunk}.substr(Position - ChunkBegin);
+    ChunkBegin += Chunk.size();
+  }
+  return {};
+}
+
+std::string_view SessionData::peekColdBlock(std::size_t Index) const noexcept
+{
+  const ColdBlock& Block = ColdOutput.at(Index);
+  if (!Block.Compressed)
+    return Block.Data;
+
+  const std::size_t Begin = outputColdBegin() + Index * ScrollbackBlockSize;
+  if (ColdCacheBegin != Begin)
+  {
+    ColdCacheBegin = -1;
+    try
+    {
+      std::optional<std::string> Data =
+        compress::decompressBlock(Block.Data, ScrollbackBlockSize);
+      if (!Data)
+      {
+        LOG(error) << "Session \"" << Name
+                   << "\": compressed scrollback block is corrupt";
+        return {};
+      }
+      ColdCache = std::move(*Data);
+      ColdCacheBegin = Begin;
+    }
+    catch (const std::bad_alloc&)
+    {
+      return {};
+    }
+  }
+  return ColdCache;
+}
+
+std::size_t SessionData::compactOutput(std::size_t Budget)
+{
+  if (!ScrollbackSize)
+    return 0;
+  // Do not waste time on output that is not needed anymore.
+  trimOutput();
+
+  // Only output every client received already is compressed, so the clients
+  // that are lagging behind are served without decompressing anything.
+  std::size_t Limit = outputEnd() - std::min(ScrollbackBlockSize, outputEnd());
+  for (const ClientData* C : AttachedClients)
+    if (C->getDataSocket())
+      Limit = std::min(Limit, C->outputCursor());
+
+  std::size_t Compacted = 0;
+  while (Compacted < Budget &&
+         OutputBacklogBegin + ScrollbackBlockSize <= Limit)
+  {
+    std::string Raw;
+    Raw.reserve(ScrollbackBlockSize);
+    while (Raw.size() < ScrollbackBlockSize)
+    {
+      std::string& Chunk = OutputBacklog.front();
+      const std::size_t Take =
+        std::min(Chunk.size(), ScrollbackBlockSize - Raw.size());
+      Raw.append(Chunk, 0, Take);
+      if (Take == Chunk.size())
+        OutputBacklog.pop_front();
+      else
+        Chunk.erase(0, Take);
+    }
+
+    ColdBlock Block;
+    Block.Data = compress::compressBlock(Raw);
+    Block.Compressed = Block.Data.size() < Raw.size();
+    if (!Block.Compressed)
+      Block.Data = std::move(Raw);
+    Block.Data.shrink_to_fit();
+
+    OutputBacklogBegin += ScrollbackBlockSize;
+    OutputBacklogSize.get() -= ScrollbackBlockSize;
+    ColdOutputSize += ScrollbackBlockSize;
+    ColdOutputMemory += Block.Data.size();
+    TotalOutputBacklogSize.fetch_sub(ScrollbackBlockSize - Block.Data.size(),
+                                     std::memory_order_relaxed);
+    ColdOutput.emplace_back(std::move(Block));
+    Compacted += ScrollbackBlockSize;
+  }
+  return Compacted;
+}
+
+std::string SessionData::copyScrollback() const
+{
+  std::size_t Position = scrollbackBegin();
+  std::string Ret;
+  Ret.reserve(outputEnd() - Position);
+  while (Position < outputEnd())
+  {
+    std::string_view Chunk = peekOutput(Position);
+    if (Chunk.empty())
+      break;
+    Ret.append(Chunk);
+    Position += Chunk.size();
+  }
+  return Ret;
+}
+
+/// \returns the number of bytes a full rate limiting bucket holds for
+/// \p BytesPerSecond.
+static double rateBucketSize(std::size_t BytesPerSecond) noexcept
+{
+  return std::max(
+    1.0,
+    static_cast<double>(BytesPerSecond) *
+      std::chrono::duration<double>(SessionData::RateLimitBurst).count());
+}
+
+void SessionData::setRateLimit(std::size_t BytesPerSecond) noexcept
+{
+  RateLimit = BytesPerSecond;
+  RateTokens = rateBucketSize(BytesPerSecond);
+  RateRefilled = std::chrono::steady_clock::now();
+}
+
+std::size_t
+SessionData::rateAllowance(std::chrono::steady_clock::time_point Now) noexcept
+{
+  if (!RateLimit)
+    return static_cast<std::size_t>(-1);
+
+  if (Now > RateRefilled)
+  {
+    RateTokens = std::min(
+      rateBucketSize(RateLimit),
+      RateTokens + static_cast<double>(RateLimit) *
+                     std::chrono::duration<double>(Now - RateRefilled).count());
+    RateRefilled = Now;
+  }
+  return RateTokens < 1.0 ? 0 : static_cast<std::size_t>(RateTokens);
+}
+
+void SessionData::consumeRateAllowance(std::size_t Bytes) noexcept
+{
+  if (RateLimit)
+    RateTokens -= static_cast<double>(Bytes);
+}
+
+std::chrono::steady_clock::time_point
+SessionData::rateRefillTime() const noexcept
+{
+  if (!RateLimit)
+    return RateRefilled;
+  const double Missing = std::max(0.0, rateBucketSize(RateLimit) - RateTokens);
+  // Rounded up, so the bucket is surely full once the time is reached.
+  return RateRefilled + std::chrono::ceil<std::chrono::steady_clock::duration>(
+                          std::chrono::duration<double>(
+                            Missing / static_cast<double>(RateLimit)));
+}
+
+void SessionData::trimOutput(std::size_t ResidentMax) noexcept
+{
+  // Clients without a data connection are not served output, and must not
+  // hold back the release of the backlog.
+  std::size_t ClientCursor = outputEnd();
+  for (const ClientData* C : AttachedClients)
+    if (C->getDataSocket())
+      ClientCursor = std::min(ClientCursor, C->outputCursor());
+  const std::size_t MinCursor = std::min(
+    ClientCursor, outputEnd() - std::min(ScrollbackSize, outputEnd()));
+  if (ClientCursor >= OutputBacklogBegin && ColdCache.capacity())
+  {
+    // No client is being replayed the compressed blocks.
+    ColdCacheBegin = -1;
+    std::string{}.swap(ColdCache);
+  }
+
+  // Everything still needed but beyond the memory allowed for the resident
+  // part is spilled, oldest first.
+  const bool CanSpill =
+    !SpillDirectory.empty() && !SpillFailed && ScrollbackSize > ResidentMax;
+  while (!ColdOutput.empty() || !OutputBacklog.empty())
+  {
+    const bool Cold = !ColdOutput.empty();
+    const std::size_t FrontSize =
+      Cold ? ScrollbackBlockSize : OutputBacklog.front().size();
+    const std::size_t FrontMemory =
+      Cold ? ColdOutput.front().Data.size() : FrontSize;
+    if (outputColdBegin() + FrontSize <= MinCursor)
+    {
+      if (Spill)
+        // Everything before this chunk is unneeded too.
+        Spill->discard(Spill->end());
+    }
+    else if (CanSpill &&
+             OutputBacklogSize + ColdOutputMemory - FrontMemory >= ResidentMax)
+    {
+      if (!spillFrontChunk())
+        break;
+    }
+    else
+      break;
+    popFrontChunk();
+  }
+
+  if (Spill && MinCursor > SpillBase)
+    Spill->discard(std::min(MinCursor, outputColdBegin()) - SpillBase);
+}
+
+bool SessionData::spillFrontChunk() noexcept
+{
+  try
+  {
+    if (!Spill)
+    {
+      Spill = std::make_unique<SpillFile>(SpillDirectory);
+      SpillBase = outputColdBegin();
+    }
+    if (ColdOutput.empty())
+      Spill->append(OutputBacklog.front());
+    else
+    {
+      const std::string_view Raw = peekColdBlock(0);
+      if (Raw.empty())
+        // The block is lost either way.
+        return true;
+      Spill->append(Raw);
+    }
+    return true;
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(warn) << "Session \"" << Name
+              << "\": failed to spill output to disk, keeping it in memory: "
+              << Err.what();
+    SpillFailed = true;
+    return false;
+  }
+}
+
+void SessionData::popFrontChunk() noexcept
+{
+  if (!ColdOutput.empty())
+  {
+    const std::size_t Memory = ColdOutput.front().Data.size();
+    ColdOutputSize -= ScrollbackBlockSize;
+    ColdOutputMemory -= Memory;
+    TotalOutputBacklogSize.fetch_sub(Memory, std::memory_order_relaxed);
+    ColdOutput.pop_front();
+  }
+  else
+  {
+    const std::size_t ChunkSize = OutputBacklog.front().size();
+    OutputBacklogBegin += ChunkSize;
+    OutputBacklogSize.get() -= ChunkSize;
+    TotalOutputBacklogSize.fetch_sub(ChunkSize, std::memory_order_relaxed);
+    OutputBacklog.pop_front();
+  }
+
+  if (Spill && Spill->empty())
+    // Keep the (empty) spill file ending at the beginning of the backlog.
+    SpillBase = outputColdBegin() - Spill->end();
 }
 
 } // namespace monomux::server
@@ -0,0 +1,152 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/control/BinaryEncoding.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/server/Upgrade.hpp"
+
+namespace monomux::server
+{
+
+/// Identifies the layout of the encoded state. A binary that does not
+/// understand the layout of the one it replaces must refuse to resume.
+static constexpr std::uint32_t UpgradeStateVersion = 3;
+
+std::string UpgradeState::encode() const
+{
+  std::string Buffer;
+  message::BinaryWriter W{Buffer};
+  W.integer(UpgradeStateVersion);
+  W.integer(static_cast<std::int32_t>(Socket));
+  W.integer(static_cast<std::uint32_t>(Sessions.size()));
+  for (const Session& S : Sessions)
+  {
+    W.string(S.Name);
+    W.string(S.Alias);
+    W.integer(static_cast<std::int64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        S.Created.time_since_epoch())
+        .count()));
+    W.integer(static_cast<std::int32_t>(S.PID));
+    W.integer(static_cast<std::int32_t>(S.PtyMaster));
+    W.string(S.PtyName);
+    W.integer(static_cast<std::uint64_t>(S.ScrollbackSize));
+    W.integer(static_cast<std::int64_t>(S.CoalesceWindow.count()));
+    W.integer(static_cast<std::uint64_t>(S.RateLimit));
+    W.string(S.Scrollback);
+    W.integer(static_cast<std::uint64_t>(S.OutputEnd));
+  }
+  return Buffer;
+}
+
+std::optional<UpgradeState> UpgradeState::decode(std::string_view Buffer)
+{
+  message::BinaryReader R{Buffer};
+  // Version 1 did not record the rate limit of the sessions yet, and
+  // versions before 3 did not record the position of the output stream.
+  const auto Version = R.integer<std::uint32_t>();
+  if (Version < 1 || Version > UpgradeStateVersion)
+    return std::nullopt;
+
+  UpgradeState State;
+  State.Socket = R.integer<std::int32_t>();
+  for (auto N = R.integer<std::uint32_t>(); N > 0 && R.good(); --N)
+  {
+    Session S;
+    S.Name = R.string();
+    S.Alias = R.string();
+    S.Created = std::chrono::system_clock::time_point{
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::microseconds{R.integer<std::int64_t>()})};
+    S.PID = R.integer<std::int32_t>();
+    S.PtyMaster = R.integer<std::int32_t>();
+    S.PtyName = R.string();
+    S.ScrollbackSize = R.integer<std::uint64_t>();
+    S.CoalesceWindow = std::chrono::microseconds{R.integer<std::int64_t>()};
+    if (Version >= 2)
+      S.RateLimit = R.integer<std::uint64_t>();
+    S.Scrollback = R.string();
+    S.OutputEnd = Version >= 3 ? R.integer<std::uint64_t>()
+                               : S.Scrollback.size();
+    State.Sessions.emplace_back(std::move(S));
+  }
+  if (!R.done())
+    return std::nullopt;
+  return State;
+}
+
+fd UpgradeState::store() const
+{
+  // The file must survive the exec(), so it is not created with MFD_CLOEXEC.
+  fd File = CheckedPOSIXThrow(
+    [] { return ::memfd_create("monomux-upgrade", 0); }, "memfd_create()", -1);
+
+  const std::string Buffer = encode();
+  std::string_view Remaining = Buffer;
+  while (!Remaining.empty())
+  {
+    auto Written = CheckedPOSIXThrow(
+      [&File, Remaining] {
+        return ::write(File.get(), Remaining.data(), Remaining.size());
+      },
+      "write()",
+      -1);
+    Remaining.remove_prefix(static_cast<std::size_t>(Written));
+  }
+  CheckedPOSIXThrow(
+    [&File] { return ::lseek(File.get(), 0, SEEK_SET); }, "lseek()", -1);
+  return File;
+}
+
+std::optional<UpgradeState> UpgradeState::load(fd&& FD)
+{
+  fd File = std::move(FD);
+  POD<struct ::stat> Stat;
+  CheckedPOSIXThrow(
+    [&File, &Stat] { return ::fstat(File.get(), &Stat); }, "fstat()", -1);
+
+  std::string Buffer(static_cast<std::size_t>(Stat->st_size), '\0');
+  std::size_t Offset = 0;
+  while (Offset < Buffer.size())
+  {
+    auto Read = CheckedPOSIXThrow(
+      [&File, &Buffer, Offset] {
+        return ::pread(File.get(),
+                       Buffer.data() + Offset,
+                       Buffer.size() - Offset,
+                       static_cast<::off_t>(Offset));
+      },
+      "pread()",
+      -1);
+    if (Read == 0)
+      break;
+    Offset += static_cast<std::size_t>(Read);
+  }
+  Buffer.resize(Offset);
+  return decode(Buffer);
+}
+
+} // namespace monomux::server
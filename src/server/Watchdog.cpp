@@ -0,0 +1,265 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <system_error>
+
+#include <execinfo.h>
+#include <signal.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/server/Watchdog.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("server/Watchdog")
+
+namespace monomux::server
+{
+
+namespace
+{
+
+/// The frames written by the signal handler on the loop thread.
+std::array<void*, Watchdog::FramesMax> CapturedFrames;
+std::atomic<int> CapturedCount = -1;
+/// Serialises the captures of the watchdogs of multiple loops, which share
+/// the signal and the frames.
+std::mutex CaptureLock;
+bool HandlerInstalled = false;
+
+/// The frames of the handler and the signal trampoline, which are skipped.
+constexpr int HandlerFrames = 2;
+/// The time the loop thread has to run the handler.
+constexpr std::chrono::milliseconds CaptureTimeout{200};
+
+extern "C" void captureHandler(int /* SigNum */)
+{
+  const int SavedErrno = errno;
+  CapturedCount.store(
+    ::backtrace(CapturedFrames.data(), static_cast<int>(CapturedFrames.size())),
+    std::memory_order_release);
+  errno = SavedErrno;
+}
+
+std::int64_t now() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+} // namespace
+
+// clang-format off
+static constexpr const char* PhaseName[] = {"Idle",
+                                            "Children",
+                                            "Event",
+                                            "Status"};
+// clang-format on
+
+const char* Watchdog::name(Phase P) noexcept
+{
+  const auto I = static_cast<std::size_t>(P);
+  if (I >= std::size(PhaseName))
+    return "Invalid";
+  return PhaseName[I];
+}
+
+// The real-time signals are not handled by anything else in the program, see
+// SignalHandling::SignalCount.
+int Watchdog::signal() noexcept { return SIGRTMIN; }
+
+Watchdog::Watchdog(std::chrono::milliseconds Deadline)
+  : Deadline(Deadline), Loop(::pthread_self())
+{
+  {
+    std::lock_guard<std::mutex> L{CaptureLock};
+    if (!HandlerInstalled)
+    {
+      // The first call of backtrace() loads the unwinder, which is not safe
+      // to do in a signal handler. The handler stays installed for the rest
+      // of the process, so a capture arriving late does not kill it.
+      void* Frame;
+      (void)::backtrace(&Frame, 1);
+
+      POD<struct ::sigaction> Action;
+      Action->sa_handler = &captureHandler;
+      Action->sa_flags = SA_RESTART;
+      ::sigemptyset(&Action->sa_mask);
+      CheckedPOSIXThrow(
+        [&Action] { return ::sigaction(signal(), &Action, nullptr); },
+        "sigaction()",
+        -1);
+      HandlerInstalled = true;
+    }
+  }
+  POD<::sigset_t> Unblock;
+  ::sigemptyset(&Unblock);
+  ::sigaddset(&Unblock, signal());
+  ::pthread_sigmask(SIG_UNBLOCK, &Unblock, nullptr);
+
+  Thread = std::thread{[this] { run(); }};
+}
+
+Watchdog::~Watchdog()
+{
+  {
+    std::lock_guard<std::mutex> L{Lock};
+    Terminate = true;
+  }
+  Wake.notify_all();
+  Thread.join();
+}
+
+void Watchdog::busy() noexcept
+{
+  BusySince.store(now(), std::memory_order_relaxed);
+  Heartbeat.store(Heartbeat.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+}
+
+std::optional<Watchdog::Stall> Watchdog::idle()
+{
+  const std::uint64_t Beat = Heartbeat.load(std::memory_order_relaxed);
+  const std::chrono::microseconds Took{
+    (now() - BusySince.load(std::memory_order_relaxed)) / 1000};
+  const Phase At = CurrentPhase.load(std::memory_order_relaxed);
+  const raw_fd FD = CurrentFD.load(std::memory_order_relaxed);
+  enter(Phase::Idle);
+  Heartbeat.store(Beat + 1, std::memory_order_release);
+  if (Took < Deadline)
+    return std::nullopt;
+
+  std::lock_guard<std::mutex> L{Lock};
+  ++StallCount;
+  StallTimes.record(Took);
+  if (!Detected || DetectedHeartbeat != Beat)
+  {
+    // The watchdog did not get to look at the loop during the stall.
+    Detected = Stall{Took, At, FD, {}};
+    DetectedHeartbeat = Beat;
+  }
+  Detected->Duration = Took;
+  return Detected;
+}
+
+std::uint64_t Watchdog::stalls() const
+{
+  std::lock_guard<std::mutex> L{Lock};
+  return StallCount;
+}
+
+DurationHistogram Watchdog::stallTimes() const
+{
+  std::lock_guard<std::mutex> L{Lock};
+  return StallTimes;
+}
+
+std::optional<Watchdog::Stall> Watchdog::lastStall() const
+{
+  std::lock_guard<std::mutex> L{Lock};
+  return Detected;
+}
+
+void Watchdog::run()
+{
+  const std::chrono::milliseconds Period =
+    std::max(Deadline / 4, std::chrono::milliseconds{1});
+  std::unique_lock<std::mutex> L{Lock};
+  while (true)
+  {
+    Wake.wait_for(L, Period, [this] { return Terminate; });
+    if (Terminate)
+      return;
+
+    const std::uint64_t Beat = Heartbeat.load(std::memory_order_acquire);
+    if (Beat % 2 == 0 || DetectedHeartbeat == Beat)
+      // Waiting, or already reported.
+      continue;
+    const std::chrono::microseconds Took{
+      (now() - BusySince.load(std::memory_order_relaxed)) / 1000};
+    if (Took < Deadline)
+      continue;
+
+    Stall S{Took,
+            CurrentPhase.load(std::memory_order_relaxed),
+            CurrentFD.load(std::memory_order_relaxed),
+            {}};
+    DetectedHeartbeat = Beat;
+    Detected = S;
+
+    L.unlock();
+    S.Backtrace = captureLoop();
+    std::string Where = name(S.At);
+    if (S.FD != fd::Invalid)
+      Where.append(" on file descriptor ").append(std::to_string(S.FD));
+    std::string Frames;
+    for (const std::string& Frame : S.Backtrace)
+      Frames.append("\n\t").append(Frame);
+    LOG(warn) << "Event loop stuck for "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(Took)
+                   .count()
+              << " ms in " << Where << Frames;
+    L.lock();
+
+    if (DetectedHeartbeat == Beat && Detected)
+      // (The loop might have finished the iteration in the meantime, in which
+      // case the complete duration is already recorded.)
+      Detected->Backtrace = std::move(S.Backtrace);
+  }
+}
+
+std::vector<std::string> Watchdog::captureLoop()
+{
+  std::lock_guard<std::mutex> G{CaptureLock};
+  CapturedCount.store(-1, std::memory_order_relaxed);
+  if (int Error = ::pthread_kill(Loop, signal()))
+  {
+    LOG(error) << "Failed to signal the event loop: "
+               << std::make_error_code(static_cast<std::errc>(Error)).message();
+    return {};
+  }
+
+  const auto Until = std::chrono::steady_clock::now() + CaptureTimeout;
+  while (CapturedCount.load(std::memory_order_acquire) < 0 &&
+         std::chrono::steady_clock::now() < Until)
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  const int Count = CapturedCount.load(std::memory_order_acquire);
+  if (Count <= HandlerFrames)
+    return {};
+
+  std::vector<std::string> Frames;
+  char** Symbols =
+    ::backtrace_symbols(CapturedFrames.data() + HandlerFrames,
+                        Count - HandlerFrames);
+  if (!Symbols)
+    return Frames;
+  for (int I = 0; I < Count - HandlerFrames; ++I)
+    Frames.emplace_back(Symbols[I]);
+  std::free(Symbols);
+  return Frames;
+}
+
+} // namespace monomux::server
+
+#undef LOG
@@ -16,10 +16,19 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cstring>
+#include <memory>
 #include <sstream>
+#include <vector>
 
+#include <sys/uio.h>
+
+#include "monomux/Allocation.hpp"
+#include "monomux/adt/POD.hpp"
 #include "monomux/adt/RingBuffer.hpp"
 #include "monomux/system/Time.hpp"
+#include "monomux/system/Transport.hpp"
+#include "monomux/Trace.hpp"
 
 #include "monomux/system/BufferedChannel.hpp"
 
@@ -47,6 +56,69 @@ static constexpr std::size_t BufferSizeMax = 1ULL << 31; // 2 GiB
 static_assert(BufferedChannel::BufferSize < BufferSizeMax,
               "Default constructed buffer would throw");
 
+/// The number of emptied buffers a thread keeps around for reuse.
+static constexpr std::size_t PooledBuffersMax = 64;
+
+namespace
+{
+
+/// The emptied buffers of the channels used by the current thread.
+struct BufferPool
+{
+  std::vector<std::unique_ptr<detail::BufferedChannelBuffer>> Buffers;
+
+  BufferPool() { Buffers.reserve(PooledBuffersMax); }
+  ~BufferPool();
+};
+
+/// Set when the pool of the thread is destroyed, as channels with static
+/// storage might still release their buffers afterwards.
+thread_local bool BufferPoolDestroyed = false;
+
+BufferPool::~BufferPool() { BufferPoolDestroyed = true; }
+
+} // namespace
+
+/// \returns the pool of the current thread, or \p nullptr if it is gone.
+static BufferPool* bufferPool()
+{
+  thread_local BufferPool Pool;
+  return BufferPoolDestroyed ? nullptr : &Pool;
+}
+
+/// \returns an empty buffer of \p Size, reused from the pool if possible.
+static detail::BufferedChannelBuffer* acquireBuffer(std::size_t Size)
+{
+  MONOMUX_ALLOCATION_SCOPE(Channel);
+  if (BufferPool* Pool = bufferPool())
+    for (auto It = Pool->Buffers.rbegin(); It != Pool->Buffers.rend(); ++It)
+      if ((*It)->originalCapacity() == Size)
+      {
+        detail::BufferedChannelBuffer* Buffer = It->release();
+        std::swap(*It, Pool->Buffers.back());
+        Pool->Buffers.pop_back();
+        return Buffer;
+      }
+  return new detail::BufferedChannelBuffer(Size);
+}
+
+/// Returns the \p Buffer to the pool, or frees it if it can not be reused
+/// as-is.
+static void releaseBuffer(detail::BufferedChannelBuffer* Buffer) noexcept
+{
+  BufferPool* Pool = bufferPool();
+  if (!Pool || !Buffer->empty() ||
+      Buffer->capacity() != Buffer->originalCapacity() ||
+      Pool->Buffers.size() >= PooledBuffersMax)
+  {
+    delete Buffer;
+    return;
+  }
+
+  Buffer->tryCleanup();
+  Pool->Buffers.emplace_back(Buffer);
+}
+
 std::string
 BufferedChannel::OverflowError::craftErrorMessage(const std::string& Identifier,
                                                   std::size_t Size)
@@ -64,42 +136,57 @@ BufferedChannel::BufferedChannel(
   // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
   std::size_t ReadBufferSize,
   std::size_t WriteBufferSize)
-  : Channel(std::move(Handle), std::move(Identifier), NeedsCleanup)
-{
-  if (ReadBufferSize)
-    Read = new OpaqueBufferType(ReadBufferSize);
-  if (WriteBufferSize)
-    Write = new OpaqueBufferType(WriteBufferSize);
-}
+  : Channel(std::move(Handle), std::move(Identifier), NeedsCleanup),
+    ReadBufferSize(ReadBufferSize), WriteBufferSize(WriteBufferSize)
+{}
 
 BufferedChannel::~BufferedChannel()
 {
-  delete Read;
-  delete Write;
+  if (Read)
+    releaseBuffer(Read);
+  if (Write)
+    releaseBuffer(Write);
   Read = nullptr;
   Write = nullptr;
 }
 
+BufferedChannel::OpaqueBufferType& BufferedChannel::readBuffer()
+{
+  if (!Read)
+    Read = acquireBuffer(ReadBufferSize);
+  return *Read;
+}
+BufferedChannel::OpaqueBufferType& BufferedChannel::writeBuffer()
+{
+  if (!Write)
+    Write = acquireBuffer(WriteBufferSize);
+  return *Write;
+}
+
 bool BufferedChannel::hasBufferedRead() const noexcept
 {
-  assert(Read && "Channel does not support reading");
-  return !Read->empty();
+  assert(ReadBufferSize && "Channel does not support reading");
+  return Read && !Read->empty();
 }
 bool BufferedChannel::hasBufferedWrite() const noexcept
 {
-  assert(Write && "Channel does not support writing");
-  return !Write->empty();
+  assert(WriteBufferSize && "Channel does not support writing");
+  return Write && !Write->empty();
 }
 
 std::size_t BufferedChannel::readInBuffer() const noexcept
 {
-  assert(Read && "Channel does not support reading");
-  return Read->size();
+  assert(ReadBufferSize && "Channel does not support reading");
+  return Read ? Read->size() : 0;
 }
 std::size_t BufferedChannel::writeInBuffer() const noexcept
 {
-  assert(Write && "Channel does not support writing");
-  return Write->size();
+  assert(WriteBufferSize && "Channel does not support writing");
+  return Write ? Write->size() : 0;
+}
+std::size_t BufferedChannel::allocatedSize() const noexcept
+{
+  return (Read ? Read->capacity() : 0) + (Write ? Write->capacity() : 0);
 }
 
 static void throwIfFailed(bool Failed)
@@ -108,114 +195,230 @@ static void throwIfFailed(bool Failed)
     throw std::system_error{std::make_error_code(std::errc::io_error),
                             "Channel has failed."};
 }
-static void throwIfNoRead(bool Read)
+static void throwIfNoRead(std::size_t BufferSize)
 {
-  if (!Read)
+  if (!BufferSize)
     throw std::system_error{
       std::make_error_code(std::errc::operation_not_permitted),
       "Channel does not support reading."};
 }
-static void throwIfNoWrite(bool Write)
+static void throwIfNoWrite(std::size_t BufferSize)
 {
-  if (!Write)
+  if (!BufferSize)
     throw std::system_error{
       std::make_error_code(std::errc::operation_not_permitted),
       "Channel does not support writing."};
 }
 
-std::string BufferedChannel::read(std::size_t Bytes)
+/// Fills \p IOV with the descriptors for the non-empty \p Segments of a ring
+/// buffer, so that they might be handled by a single vectored system call.
+///
+/// \returns the number of descriptors filled.
+template <typename SegmentArray>
+static std::size_t fillIOVec(const SegmentArray& Segments, ::iovec* IOV)
 {
-  throwIfFailed(failed());
-  throwIfNoRead(Read);
+  std::size_t Count = 0;
+  for (const auto& Segment : Segments)
+  {
+    if (Segment.empty())
+      continue;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    IOV[Count].iov_base = const_cast<char*>(Segment.Begin);
+    IOV[Count].iov_len = Segment.Size;
+    ++Count;
+  }
+  return Count;
+}
 
-  std::string Return;
-  Return.reserve(Bytes);
+struct BufferedChannel::DynamicIO
+{
+  BufferedChannel& C;
+
+  std::size_t readChunk() const noexcept { return C.optimalReadSize(); }
+  std::size_t writeChunk() const noexcept { return C.optimalWriteSize(); }
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "read(" << Bytes << ")...");
-  if (std::size_t StoredBufferSize = readInBuffer())
+  std::size_t readv(const ::iovec* Buffers, std::size_t Count, bool& Continue)
   {
-    std::size_t BytesFromBuffer = std::min(Bytes, StoredBufferSize);
-    std::vector<char> V = Read->takeFront(BytesFromBuffer);
-    Return.append(V.begin(), V.end());
+    return C.readvImpl(Buffers, Count, Continue);
+  }
+  std::size_t
+  writev(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+  {
+    return C.writevImpl(Buffers, Count, Continue);
+  }
+  std::size_t write(std::string_view Buffer, bool& Continue)
+  {
+    return C.writeImpl(Buffer, Continue);
+  }
+};
 
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "read() "
-                      << "<- " << V.size() << " bytes buffer");
+template <typename Transport> struct BufferedChannel::StaticIO
+{
+  BufferedChannel& C;
 
-    Bytes -= V.size();
+  static constexpr std::size_t readChunk() noexcept
+  {
+    return Transport::ChunkSize;
+  }
+  static constexpr std::size_t writeChunk() noexcept
+  {
+    return Transport::ChunkSize;
   }
-  if (!Bytes)
-    return Return;
 
-  const std::size_t ChunkSize = optimalReadSize();
-  bool ContinueReading = true;
-  while (ContinueReading && Bytes > 0)
+  std::size_t readv(const ::iovec* Buffers, std::size_t Count, bool& Continue)
   {
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(read) "
-                      << "Request " << ChunkSize << " bytes...");
-    std::string Chunk = readImpl(ChunkSize, ContinueReading);
-    if (Chunk.empty())
-    {
-      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "(read) "
-                                                   << "No more data!");
+    return C.receiveWith<Transport>(Buffers, Count, Continue);
+  }
+  std::size_t
+  writev(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+  {
+    return C.sendWith<Transport>(Buffers, Count, Continue);
+  }
+  std::size_t write(std::string_view Buffer, bool& Continue)
+  {
+    POD<::iovec> IOV;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    IOV->iov_base = const_cast<char*>(Buffer.data());
+    IOV->iov_len = Buffer.size();
+    return writev(&IOV, 1, Continue);
+  }
+};
+
+template <typename Fn> std::size_t BufferedChannel::withIO(Fn&& F)
+{
+  // The transport is selected once per operation, and the loops of the
+  // operation are instantiated with direct calls to it.
+  switch (BoundTransport)
+  {
+    case StaticTransport::File:
+      return F(StaticIO<transport::File>{*this});
+    case StaticTransport::Socket:
+      return F(StaticIO<transport::Socket>{*this});
+    case StaticTransport::None:
       break;
+  }
+  return F(DynamicIO{*this});
+}
+
+std::string BufferedChannel::read(std::size_t Bytes)
+{
+  std::string Return;
+  Return.resize(Bytes);
+  Return.resize(readInto(Return.data(), Bytes));
+  return Return;
+}
+
+std::size_t BufferedChannel::readInto(char* Destination, std::size_t Capacity)
+{
+  return withIO(
+    [&](auto IO) { return readIntoWith(IO, Destination, Capacity); });
+}
+
+template <typename IO>
+std::size_t BufferedChannel::readIntoWith(IO Policy,
+                                          char* Destination,
+                                          std::size_t Capacity)
+{
+  throwIfFailed(failed());
+  throwIfNoRead(ReadBufferSize);
+
+  [[maybe_unused]] const std::size_t Requested = Capacity;
+  std::size_t Served = 0;
+  if (hasBufferedRead())
+  {
+    for (const auto& Segment : Read->peekFrontSegments(Capacity))
+    {
+      std::memcpy(Destination + Served, Segment.Begin, Segment.Size);
+      Served += Segment.Size;
     }
+    Read->dropFront(Served);
+  }
+  if (Served == Capacity)
+  {
+    MONOMUX_TRACEPOINT(ChannelRead, raw(), Requested, Served);
+    return Served;
+  }
+
+  const std::size_t ChunkSize =
+    AdaptiveReadSize ? AdaptiveReadSize : Policy.readChunk();
+  const bool HadBuffer = Read != nullptr;
+  std::size_t ReadBytes = 0;
+  bool Saturated = false;
+  bool ContinueReading = true;
+  while (ContinueReading && Served < Capacity)
+  {
+    // Receive straight into the caller's storage. If less space remains there
+    // than a full chunk, the rest of the chunk goes into the free space at the
+    // end of the buffer -- the buffer is necessarily empty at this point.
+    const std::size_t Remaining = Capacity - Served;
+    POD<::iovec[3]> IOV;
+    IOV[0].iov_base = Destination + Served;
+    IOV[0].iov_len = std::min(Remaining, ChunkSize);
+    std::size_t IOVCount = 1;
+    if (Remaining < ChunkSize)
+      IOVCount += fillIOVec(
+        readBuffer().reserveBackSegments(ChunkSize - Remaining), &IOV[1]);
+    const std::size_t ReadSize =
+      Policy.readv(IOV, IOVCount, ContinueReading);
+    if (!ReadSize)
+      break;
 
-    const std::size_t ReadSize = Chunk.size();
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(read) "
-                      << "Received " << ReadSize << " bytes");
+    ReadBytes += ReadSize;
+    Saturated = ReadSize >= ChunkSize;
     if (ReadSize < ChunkSize)
       // Managed to read less data than wanted to for the current chunk.
       // Assume no more data remaining.
       ContinueReading = false;
 
-    // Serve at most the remaining byte count into the return value.
-    const std::size_t BytesFromRead = std::min(Bytes, ReadSize);
-    Return.append(Chunk.begin(), Chunk.begin() + BytesFromRead);
-
-    if (ReadSize > Bytes)
+    if (ReadSize > Remaining)
     {
-      // Buffer anything that remained in the read chunk -- and thus already
-      // consumed from the system resource!
-      const std::size_t BytesToSave = ReadSize - Bytes;
-      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                        << "(read) "
-                        << "Buffering " << BytesToSave << " bytes");
-      Read->putBack(Chunk.data() + BytesFromRead, BytesToSave);
+      // Keep anything that was read over the requested amount -- and thus
+      // already consumed from the system resource!
+      Read->commitBack(ReadSize - Remaining);
       ContinueReading = false;
     }
 
-    Bytes -= BytesFromRead;
+    Served += std::min(ReadSize, Remaining);
+  }
+  adaptReadSize(ChunkSize, ReadBytes, Saturated, Policy.readChunk());
+  if (!HadBuffer && Read && Read->empty())
+  {
+    // The buffer was only taken in case the read overran the request.
+    releaseBuffer(Read);
+    Read = nullptr;
   }
 
-  if (Read->size() > BufferSizeMax)
+  if (readInBuffer() > BufferSizeMax)
   {
+    MONOMUX_TRACEPOINT(ChannelOverflow, raw(), readInBuffer(), 0);
     LOG_WITH_IDENTIFIER(trace) << "(read) "
                                << "Buffer overflow!";
     throw OverflowError(
-      *this, identifier() + "(read)", Read->size(), true, false);
+      *this, identifier() + "(read)", readInBuffer(), true, false);
   }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "read() "
-                                               << "-> " << Return.size());
-  return Return;
+  MONOMUX_TRACEPOINT(ChannelRead, raw(), Requested, Served);
+  return Served;
 }
 
 std::size_t BufferedChannel::write(std::string_view Data)
+{
+  return withIO([&](auto IO) { return writeWith(IO, Data); });
+}
+
+template <typename IO>
+std::size_t BufferedChannel::writeWith(IO Policy, std::string_view Data)
 {
   throwIfFailed(failed());
-  throwIfNoWrite(Write);
+  throwIfNoWrite(WriteBufferSize);
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                    << "write(" << Data.size() << ")...");
-  const std::size_t ChunkSize = optimalWriteSize();
+  [[maybe_unused]] const std::size_t Requested = Data.size();
+  const std::size_t ChunkSize = Policy.writeChunk();
   bool ContinueWriting = true;
 
   // First, try to see if there is data in the write buffer that could be served
   // first.
   if (const std::size_t InWriteBuffer = writeInBuffer(),
-      BufferSent = flushWrites();
+      BufferSent = flushWritesWith(Policy);
       BufferSent < InWriteBuffer)
     // There was data in the buffer and not all of it managed to send. We can't
     // send Data because that would be an out-of-order send.
@@ -223,17 +426,17 @@ std::size_t BufferedChannel::write(std::string_view Data)
 
   if (!ContinueWriting)
   {
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(write) "
-                      << "Buffering " << Data.size() << " bytes");
-    Write->putBack(Data.data(), Data.size());
-    if (Write->size() > BufferSizeMax)
+    writeBuffer().putBack(Data.data(), Data.size());
+    MONOMUX_TRACEPOINT(ChannelBuffer, raw(), writeInBuffer(), Data.size());
+    if (writeInBuffer() > BufferSizeMax)
     {
+      MONOMUX_TRACEPOINT(ChannelOverflow, raw(), writeInBuffer(), 0);
       LOG_WITH_IDENTIFIER(trace) << "(write) "
                                  << "Buffer overflow!";
       throw OverflowError(
-        *this, identifier() + "(write)", Write->size(), false, true);
+        *this, identifier() + "(write)", writeInBuffer(), false, true);
     }
+    MONOMUX_TRACEPOINT(ChannelWrite, raw(), Requested, 0);
     return 0;
   }
   if (Data.empty())
@@ -245,13 +448,8 @@ std::size_t BufferedChannel::write(std::string_view Data)
   while (ContinueWriting && !Data.empty())
   {
     const std::size_t ToSend = std::min(ChunkSize, Data.size());
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "Send " << ToSend << " bytes...");
-
     std::string_view Chunk = Data.substr(0, std::min(ChunkSize, Data.size()));
-    const std::size_t ChunkWrittenSize = writeImpl(Chunk, ContinueWriting);
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "Sent " << ChunkWrittenSize << " bytes");
+    const std::size_t ChunkWrittenSize = Policy.write(Chunk, ContinueWriting);
 
     if (ChunkWrittenSize < ToSend)
       // Managed to write less data than wanted to for the current chunk.
@@ -268,99 +466,205 @@ std::size_t BufferedChannel::write(std::string_view Data)
     // Buffer anything that remained in the write chunk -- and thus already
     // consumed from the client!
     const std::size_t BytesToSave = Data.size();
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "Buffering " << BytesToSave << " bytes");
-    Write->putBack(Data.data(), BytesToSave);
+    writeBuffer().putBack(Data.data(), BytesToSave);
+    MONOMUX_TRACEPOINT(ChannelBuffer, raw(), writeInBuffer(), BytesToSave);
   }
 
-  if (Write->size() > BufferSizeMax)
+  if (writeInBuffer() > BufferSizeMax)
   {
+    MONOMUX_TRACEPOINT(ChannelOverflow, raw(), writeInBuffer(), 0);
     LOG_WITH_IDENTIFIER(trace) << "(write) "
                                << "Buffer overflow!";
     throw OverflowError(
-      *this, identifier() + "(write)", Write->size(), false, true);
+      *this, identifier() + "(write)", writeInBuffer(), false, true);
+  }
+  MONOMUX_TRACEPOINT(ChannelWrite, raw(), Requested, BytesSent);
+  return BytesSent;
+}
+
+std::size_t BufferedChannel::tryWrite(BufferView Data)
+{
+  return withIO([&](auto IO) { return tryWriteWith(IO, Data); });
+}
+
+template <typename IO>
+std::size_t BufferedChannel::tryWriteWith(IO Policy, BufferView Data)
+{
+  throwIfFailed(failed());
+  throwIfNoWrite(WriteBufferSize);
+
+  [[maybe_unused]] const std::size_t Requested =
+    Data.at(0).size() + Data.at(1).size();
+  if (const std::size_t InWriteBuffer = writeInBuffer(),
+      BufferSent = flushWritesWith(Policy);
+      BufferSent < InWriteBuffer)
+  {
+    // There was data in the buffer and not all of it managed to send. We can't
+    // send Data because that would be an out-of-order send.
+    MONOMUX_TRACEPOINT(ChannelTryWrite, raw(), Requested, 0);
+    return 0;
   }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "write() "
-                                               << "-> " << BytesSent);
+
+  std::size_t BytesSent = 0;
+  bool ContinueWriting = true;
+  while (ContinueWriting)
+  {
+    POD<::iovec[2]> IOV;
+    std::size_t IOVCount = 0;
+    for (std::string_view View : Data)
+    {
+      if (View.empty())
+        continue;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+      IOV[IOVCount].iov_base = const_cast<char*>(View.data());
+      IOV[IOVCount].iov_len = View.size();
+      ++IOVCount;
+    }
+    if (!IOVCount)
+      break;
+
+    std::size_t ChunkWrittenSize =
+      Policy.writev(IOV, IOVCount, ContinueWriting);
+    if (!ChunkWrittenSize)
+      break;
+    BytesSent += ChunkWrittenSize;
+
+    for (std::string_view& View : Data)
+    {
+      const std::size_t Consumed = std::min(View.size(), ChunkWrittenSize);
+      View.remove_prefix(Consumed);
+      ChunkWrittenSize -= Consumed;
+    }
+  }
+
+  MONOMUX_TRACEPOINT(ChannelTryWrite, raw(), Requested, BytesSent);
   return BytesSent;
 }
 
 std::size_t BufferedChannel::load(std::size_t Bytes)
+{
+  return withIO([&](auto IO) { return loadWith(IO, Bytes); });
+}
+
+template <typename IO>
+std::size_t BufferedChannel::loadWith(IO Policy, std::size_t Bytes)
 {
   throwIfFailed(failed());
-  throwIfNoRead(Read);
+  throwIfNoRead(ReadBufferSize);
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "load(" << Bytes << ")...");
-  const std::size_t ChunkSize = optimalReadSize();
+  [[maybe_unused]] const std::size_t Requested = Bytes;
+  const std::size_t ChunkSize =
+    AdaptiveReadSize ? AdaptiveReadSize : Policy.readChunk();
   bool ContinueReading = true;
+  bool Saturated = false;
   std::size_t ReadBytes = 0;
   while (ContinueReading && Bytes > 0)
   {
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(load) "
-                      << "Request " << ChunkSize << " bytes...");
-    std::string Chunk = readImpl(ChunkSize, ContinueReading);
-    if (Chunk.empty())
-    {
-      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "(load) "
-                                                   << "No more data!");
+    // Read directly into the free space at the end of the buffer.
+    POD<::iovec[2]> IOV;
+    const std::size_t IOVCount =
+      fillIOVec(readBuffer().reserveBackSegments(ChunkSize), IOV);
+    const std::size_t ReadSize =
+      Policy.readv(IOV, IOVCount, ContinueReading);
+    Read->commitBack(ReadSize);
+    if (!ReadSize)
       break;
-    }
 
-    const std::size_t ReadSize = Chunk.size();
     ReadBytes += ReadSize;
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(load) "
-                      << "Received " << ReadSize << " bytes");
+    Saturated = ReadSize >= ChunkSize;
     if (ReadSize < ChunkSize)
       // Managed to read less data than wanted to for the current chunk.
       // Assume no more data remaining.
       ContinueReading = false;
 
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(load) "
-                      << "Storing " << ReadSize << " bytes");
-    Read->putBack(Chunk.data(), ReadSize);
-
     Bytes -= std::min(ReadSize, Bytes);
   }
+  adaptReadSize(ChunkSize, ReadBytes, Saturated, Policy.readChunk());
 
-  if (Read->size() > BufferSizeMax)
+  if (readInBuffer() > BufferSizeMax)
   {
+    MONOMUX_TRACEPOINT(ChannelOverflow, raw(), readInBuffer(), 0);
     LOG_WITH_IDENTIFIER(trace) << "(load) "
                                << "Buffer overflow!";
     throw OverflowError(
-      *this, identifier() + "(load)", Read->size(), true, false);
+      *this, identifier() + "(load)", readInBuffer(), true, false);
   }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "load() "
-                                               << "-> " << ReadBytes);
+  MONOMUX_TRACEPOINT(ChannelLoad, raw(), Requested, ReadBytes);
   return ReadBytes;
 }
 
+void BufferedChannel::adaptReadSize(std::size_t ChunkSize,
+                                    std::size_t ReadBytes,
+                                    bool Saturated,
+                                    std::size_t MinSize) noexcept
+{
+  std::size_t NewSize = ChunkSize;
+  if (Saturated)
+    // More data was likely left in the kernel. Fewer, larger reads are
+    // cheaper for bulk data.
+    NewSize = std::min(ChunkSize * 2, std::max(ReadSizeMax, MinSize));
+  else if (ReadBytes < ChunkSize / 4)
+    // Interactive traffic does not benefit from large reads.
+    NewSize = std::max(ChunkSize / 2, MinSize);
+
+  MONOMUX_TRACE_LOG(if (NewSize != ChunkSize) LOG_WITH_IDENTIFIER(trace)
+                    << "Read size " << ChunkSize << " -> " << NewSize);
+  AdaptiveReadSize = NewSize;
+}
+
+BufferedChannel::BufferView BufferedChannel::peekRead(std::size_t Bytes) const
+{
+  throwIfNoRead(ReadBufferSize);
+
+  BufferView Views;
+  if (!Read)
+    return Views;
+  auto Segments = Read->peekFrontSegments(Bytes);
+  for (std::size_t I = 0; I < Views.size(); ++I)
+    Views.at(I) = std::string_view{Segments.at(I).Begin, Segments.at(I).Size};
+  return Views;
+}
+
+void BufferedChannel::consumeRead(std::size_t Bytes)
+{
+  throwIfNoRead(ReadBufferSize);
+
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                    << "consume(" << Bytes << ") <- " << readInBuffer()
+                    << " bytes buffer");
+  if (Read)
+    Read->dropFront(Bytes);
+}
+
 std::size_t BufferedChannel::flushWrites()
+{
+  return withIO([&](auto IO) { return flushWritesWith(IO); });
+}
+
+template <typename IO> std::size_t BufferedChannel::flushWritesWith(IO Policy)
 {
   throwIfFailed(failed());
-  throwIfNoWrite(Write);
+  throwIfNoWrite(WriteBufferSize);
   if (!hasBufferedWrite())
     return 0;
 
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                    << "flush(" << writeInBuffer() << ")...");
-  const std::size_t ChunkSize = optimalWriteSize();
+  [[maybe_unused]] const std::size_t Requested = writeInBuffer();
+  const std::size_t ChunkSize = Policy.writeChunk();
   std::size_t BytesSent = 0;
   bool ContinueWriting = true;
   while (ContinueWriting && hasBufferedWrite())
   {
-    std::vector<char> V = Write->peekFront(ChunkSize);
+    // Send from the buffer in-place. If the buffer wraps around, both parts
+    // are sent with a single vectored write.
+    const auto Segments = Write->peekFrontSegments(ChunkSize);
+    const std::size_t PeekedSize = Segments[0].Size + Segments[1].Size;
+    POD<::iovec[2]> IOV;
+    const std::size_t IOVCount = fillIOVec(Segments, IOV);
     const std::size_t ChunkBytesSent =
-      writeImpl(std::string_view{V.data(), V.size()}, ContinueWriting);
+      Policy.writev(IOV, IOVCount, ContinueWriting);
     BytesSent += ChunkBytesSent;
 
-    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
-                      << "(flush) "
-                      << "<- " << ChunkBytesSent << " bytes buffer");
-
-    if (ChunkBytesSent < V.size())
+    if (ChunkBytesSent < PeekedSize)
       // If we managed to send less data then the chunk size, something is
       // wrong and writing should stop. But only the actually sent bytes
       // should be removed from the buffer!
@@ -368,17 +672,55 @@ std::size_t BufferedChannel::flushWrites()
 
     Write->dropFront(ChunkBytesSent);
   }
-  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "flush() "
-                                               << "-> " << BytesSent);
+  MONOMUX_TRACEPOINT(ChannelFlush, raw(), Requested, BytesSent);
+  return BytesSent;
+}
 
+void BufferedChannel::bufferWrite(std::string_view Data)
+{
+  throwIfNoWrite(WriteBufferSize);
+  writeBuffer().putBack(Data.data(), Data.size());
+}
+
+void BufferedChannel::overwriteBufferedWrite(std::size_t Position,
+                                             std::string_view Data) noexcept
+{
+  assert(Write && Position + Data.size() <= Write->size() &&
+         "Overwriting data that is not in the buffer!");
+  for (std::size_t I = 0; I < Data.size(); ++I)
+    Write->at(Position + I) = Data[I];
+}
+
+std::size_t BufferedChannel::commitWrites()
+{
+  const std::size_t BytesSent = flushWrites();
+  if (writeInBuffer() > BufferSizeMax)
+  {
+    LOG_WITH_IDENTIFIER(trace) << "(commit) "
+                               << "Buffer overflow!";
+    throw OverflowError(
+      *this, identifier() + "(write)", writeInBuffer(), false, true);
+  }
   return BytesSent;
 }
 
 void BufferedChannel::tryFreeResources()
 {
-  if (Read)
+  // Most channels relay the data straight through, so the buffers are only
+  // kept while they hold something.
+  if (Read && Read->empty())
+  {
+    releaseBuffer(Read);
+    Read = nullptr;
+  }
+  else if (Read)
     Read->tryCleanup();
-  if (Write)
+  if (Write && Write->empty())
+  {
+    releaseBuffer(Write);
+    Write = nullptr;
+  }
+  else if (Write)
     Write->tryCleanup();
 }
 
@@ -409,9 +751,15 @@ std::string BufferedChannel::statistics() const
     Output << " <- "
            << "Read" << ':' << '\n'
            << "      "
-           << "OptimalChunkSize = " << optimalReadSize() << ',' << ' ';
+           << "OptimalChunkSize = " << optimalReadSize() << ',' << ' '
+           << "ReadSize = " << readSize() << ',' << ' ';
     FormatOneBuffer(*Read);
   }
+  else if (ReadBufferSize)
+  {
+    Output << " <- "
+           << "Read" << ':' << ' ' << "(not allocated)" << '\n';
+  }
 
   if (Write)
   {
@@ -421,6 +769,11 @@ std::string BufferedChannel::statistics() const
            << "OptimalChunkSize = " << optimalWriteSize() << ',' << ' ';
     FormatOneBuffer(*Write);
   }
+  else if (WriteBufferSize)
+  {
+    Output << " -> "
+           << "Write" << ':' << ' ' << "(not allocated)" << '\n';
+  }
 
   return Output.str();
 }
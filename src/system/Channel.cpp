@@ -16,6 +16,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cerrno>
+#include <system_error>
+
 #include "monomux/system/Channel.hpp"
 
 #include "monomux/Log.hpp"
@@ -48,8 +51,23 @@ std::string Channel::read(std::size_t Bytes)
 
   MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
                     << "Reading " << Bytes << " bytes...");
+  std::string Return;
+  Return.resize(Bytes);
+  bool Unused;
+  Return.resize(readIntoImpl(Return.data(), Bytes, Unused));
+  return Return;
+}
+
+std::size_t Channel::readInto(char* Destination, std::size_t Capacity)
+{
+  if (failed())
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Channel has failed."};
+
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                    << "Reading " << Capacity << " bytes in place...");
   bool Unused;
-  return readImpl(Bytes, Unused);
+  return readIntoImpl(Destination, Capacity, Unused);
 }
 
 std::size_t Channel::write(std::string_view Buffer)
@@ -64,6 +82,70 @@ std::size_t Channel::write(std::string_view Buffer)
   return writeImpl(Buffer, Unused);
 }
 
+std::size_t
+Channel::readvImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+{
+  std::size_t ReadBytes = 0;
+  Continue = true;
+  for (std::size_t I = 0; Continue && I < Count; ++I)
+  {
+    const std::size_t Size = Buffers[I].iov_len;
+    const std::size_t DataSize =
+      readIntoImpl(static_cast<char*>(Buffers[I].iov_base), Size, Continue);
+    ReadBytes += DataSize;
+
+    if (DataSize < Size)
+      break;
+  }
+  return ReadBytes;
+}
+
+std::size_t
+Channel::writevImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+{
+  std::size_t WrittenBytes = 0;
+  Continue = true;
+  for (std::size_t I = 0; Continue && I < Count; ++I)
+  {
+    const std::size_t Size = Buffers[I].iov_len;
+    const std::size_t Written = writeImpl(
+      std::string_view{static_cast<const char*>(Buffers[I].iov_base), Size},
+      Continue);
+    WrittenBytes += Written;
+
+    if (Written < Size)
+      break;
+  }
+  return WrittenBytes;
+}
+
+std::size_t
+Channel::transferStopped(::ssize_t Result, bool Reading, bool& Continue)
+{
+  const int Error = errno;
+  Continue = false;
+  if (Result == 0)
+  {
+    LOG_WITH_IDENTIFIER(error) << "Disconnected";
+    setFailed();
+    return 0;
+  }
+
+  const std::error_code EC =
+    std::make_error_code(static_cast<std::errc>(Error));
+  if (Error == EAGAIN || Error == EWOULDBLOCK)
+  {
+    // Not a hard error. No more data left in the stream, or the higher level
+    // API should be allowed to buffer.
+    MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << EC.message());
+    return 0;
+  }
+
+  LOG_WITH_IDENTIFIER(error) << (Reading ? "Read error" : "Write error");
+  setFailed();
+  throw std::system_error{EC};
+}
+
 } // namespace monomux
 
 #undef LOG_WITH_IDENTIFIER
@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "monomux/system/Compress.hpp"
+
+namespace monomux::compress
+{
+
+namespace
+{
+
+/// The number of bits of the hash of the 4-byte sequences looked up for a
+/// match.
+constexpr std::size_t HashBits = 12;
+/// The last bytes of a block are always literals, so matching never reads past
+/// the end of the data.
+constexpr std::size_t LastLiterals = 5;
+/// The saturated value of a nibble of the token.
+constexpr std::size_t NibbleMax = 15;
+
+std::uint32_t read32(const char* Ptr) noexcept
+{
+  std::uint32_t Value;
+  std::memcpy(&Value, Ptr, sizeof(Value));
+  return Value;
+}
+
+std::size_t hash(std::uint32_t Sequence) noexcept
+{
+  return (Sequence * 2654435761U) >> (32 - HashBits);
+}
+
+/// Appends the part of \p Length that does not fit into the nibble of the
+/// token.
+void putLength(std::string& Out, std::size_t Length)
+{
+  Length -= NibbleMax;
+  for (; Length >= 255; Length -= 255)
+    Out.push_back(static_cast<char>(255));
+  Out.push_back(static_cast<char>(Length));
+}
+
+/// Reads the part of a length that did not fit into the nibble of the token,
+/// adding it to \p Length.
+///
+/// \returns whether the input was well-formed.
+bool getLength(std::string_view In, std::size_t& Pos, std::size_t& Length)
+{
+  while (Pos < In.size())
+  {
+    const auto Byte = static_cast<unsigned char>(In[Pos++]);
+    Length += Byte;
+    if (Byte != 255)
+      return true;
+  }
+  return false;
+}
+
+void putSequence(std::string& Out,
+                 std::string_view Literals,
+                 std::size_t Offset,
+                 std::size_t MatchLength)
+{
+  const std::size_t Literal = Literals.size();
+  const std::size_t Match = MatchLength ? MatchLength - MinMatch : 0;
+  Out.push_back(static_cast<char>((std::min(Literal, NibbleMax) << 4) |
+                                  std::min(Match, NibbleMax)));
+  if (Literal >= NibbleMax)
+    putLength(Out, Literal);
+  Out.append(Literals);
+  if (!MatchLength)
+    return;
+
+  Out.push_back(static_cast<char>(Offset & 0xFF));
+  Out.push_back(static_cast<char>(Offset >> 8));
+  if (Match >= NibbleMax)
+    putLength(Out, Match);
+}
+
+} // namespace
+
+std::string compressBlock(std::string_view Data)
+{
+  static constexpr std::uint32_t Unset = UINT32_MAX;
+  assert(Data.size() < Unset && "Block too large!");
+  std::string Out;
+  Out.reserve(Data.size() / 2 + 16);
+  std::array<std::uint32_t, 1ULL << HashBits> Table;
+  Table.fill(Unset);
+
+  const char* Begin = Data.data();
+  const std::size_t End = Data.size();
+  std::size_t Anchor = 0;
+  std::size_t Pos = 0;
+  // Skip faster over data that does not seem to compress.
+  std::size_t Misses = 0;
+  while (Pos + MinMatch + LastLiterals <= End)
+  {
+    const std::uint32_t Sequence = read32(Begin + Pos);
+    std::uint32_t& Slot = Table[hash(Sequence)];
+    const std::size_t Candidate = Slot;
+    Slot = static_cast<std::uint32_t>(Pos);
+    if (Candidate == Unset || Pos - Candidate > MaxOffset ||
+        read32(Begin + Candidate) != Sequence)
+    {
+      Pos += 1 + (Misses++ >> 6);
+      continue;
+    }
+
+    std::size_t Length = MinMatch;
+    while (Pos + Length + LastLiterals < End &&
+           Begin[Candidate + Length] == Begin[Pos + Length])
+      ++Length;
+    putSequence(
+      Out, Data.substr(Anchor, Pos - Anchor), Pos - Candidate, Length);
+    Pos += Length;
+    Anchor = Pos;
+    Misses = 0;
+  }
+  putSequence(Out, Data.substr(Anchor), 0, 0);
+  return Out;
+}
+
+std::optional<std::string> decompressBlock(std::string_view Compressed,
+                                           std::size_t Size)
+{
+  std::string Out(Size, '\0');
+  std::size_t Written = 0;
+  std::size_t Pos = 0;
+  while (Pos < Compressed.size())
+  {
+    const auto Token = static_cast<unsigned char>(Compressed[Pos++]);
+
+    std::size_t Literal = Token >> 4;
+    if (Literal == NibbleMax && !getLength(Compressed, Pos, Literal))
+      return std::nullopt;
+    if (Literal > Compressed.size() - Pos || Literal > Size - Written)
+      return std::nullopt;
+    std::memcpy(Out.data() + Written, Compressed.data() + Pos, Literal);
+    Written += Literal;
+    Pos += Literal;
+    if (Pos == Compressed.size())
+      // The last sequence has no match.
+      break;
+
+    if (Compressed.size() - Pos < 2)
+      return std::nullopt;
+    const std::size_t Offset =
+      static_cast<unsigned char>(Compressed[Pos]) |
+      (static_cast<std::size_t>(static_cast<unsigned char>(Compressed[Pos + 1]))
+       << 8);
+    Pos += 2;
+    std::size_t Match = Token & NibbleMax;
+    if (Match == NibbleMax && !getLength(Compressed, Pos, Match))
+      return std::nullopt;
+    Match += MinMatch;
+    if (!Offset || Offset > Written || Match > Size - Written)
+      return std::nullopt;
+
+    // The match may overlap the data it produces, e.g. for runs of a byte.
+    const std::size_t From = Written - Offset;
+    if (Offset >= Match)
+      std::memcpy(Out.data() + Written, Out.data() + From, Match);
+    else
+      for (std::size_t I = 0; I < Match; ++I)
+        Out[Written + I] = Out[From + I];
+    Written += Match;
+  }
+
+  if (Written != Size)
+    return std::nullopt;
+  return Out;
+}
+
+} // namespace monomux::compress
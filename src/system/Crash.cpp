@@ -18,10 +18,13 @@
  */
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -29,7 +32,12 @@
 #include <vector>
 
 #include <dlfcn.h>
+#include <elf.h>
 #include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "monomux/adt/POD.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
@@ -97,7 +105,7 @@ struct LLVMSymbolizer : public Symboliser
             const std::vector<Backtrace::Frame*>& Frames) const override;
 };
 
-auto makeSymbolisers()
+std::vector<std::unique_ptr<Symboliser>> makeSymbolisers()
 {
   std::vector<std::unique_ptr<Symboliser>> R;
 
@@ -116,6 +124,51 @@ auto makeSymbolisers()
   return R;
 }
 
+/// \returns the symbolisers available on the system. Whether a symboliser is
+/// available is checked only once per process.
+const std::vector<std::unique_ptr<Symboliser>>& symbolisers()
+{
+  static const std::vector<std::unique_ptr<Symboliser>> Symbolisers =
+    makeSymbolisers();
+  return Symbolisers;
+}
+
+/// \returns whether \p Info contains everything a symboliser could give for
+/// a frame, so no other symboliser has to be tried.
+bool isComplete(const std::optional<Backtrace::Symbol>& Info)
+{
+  return Info && !Info->Name.empty() && !Info->Filename.empty() && Info->Line;
+}
+
+// NOLINTNEXTLINE(misc-no-recursion)
+Backtrace::Symbol copySymbol(const Backtrace::Symbol& S)
+{
+  Backtrace::Symbol R{};
+  R.Name = S.Name;
+  R.Filename = S.Filename;
+  R.Line = S.Line;
+  R.Column = S.Column;
+  if (S.InlinedBy)
+    R.InlinedBy = std::make_unique<Backtrace::Symbol>(copySymbol(*S.InlinedBy));
+  return R;
+}
+
+/// The results of earlier symbolisations, keyed by the binary and the address
+/// of the frame.
+struct SymbolCache
+{
+  std::mutex Lock;
+  std::map<std::pair<std::string, const void*>,
+           std::optional<Backtrace::Symbol>>
+    Symbols;
+};
+
+SymbolCache& symbolCache()
+{
+  static SymbolCache Cache;
+  return Cache;
+}
+
 void Symboliser::noSymbolisersMessage()
 {
   MONOMUX_TRACE_LOG(
@@ -677,6 +730,57 @@ Backtrace::Backtrace(std::size_t Depth, std::size_t Ignored)
   }
 }
 
+Backtrace::Backtrace(std::istream& RawReport)
+  : IgnoredFrameCount(0), SymbolDataBuffer(nullptr)
+{
+  // A frame line is "#<index> <binary> <build ID> <offset>".
+  auto IsFrameLine = [](const std::string& Line) {
+    std::size_t DigitsEnd = Line.find_first_not_of("0123456789", 1);
+    return Line.size() > 1 && Line.front() == '#' && DigitsEnd > 1 &&
+           DigitsEnd != std::string::npos && Line.at(DigitsEnd) == ' ';
+  };
+
+  // Only the last block of frame lines is the last report.
+  bool InBlock = false;
+  for (std::string Line; std::getline(RawReport, Line);)
+  {
+    const bool Frame = IsFrameLine(Line);
+    if (Frame && !InBlock)
+      RawReportLines.clear();
+    InBlock = Frame;
+    if (Frame)
+      RawReportLines.emplace_back(std::move(Line));
+  }
+
+  Frames.reserve(RawReportLines.size());
+  for (std::string& Line : RawReportLines)
+  {
+    std::string_view View = Line;
+    std::vector<std::string_view> Fields;
+    while (!View.empty())
+    {
+      const std::size_t Space = View.find(' ');
+      Fields.emplace_back(View.substr(0, Space));
+      View.remove_prefix(Space == std::string_view::npos ? View.size()
+                                                         : Space + 1);
+    }
+    if (Fields.size() < 4)
+      continue;
+
+    Frame F{};
+    F.Index = std::stoull(std::string{Fields.at(0).substr(1)});
+    F.Data.Full = Line;
+    F.Data.Binary = Fields.at(1);
+    F.Data.HexAddress = Fields.at(3);
+    std::istringstream AddressBuf{std::string{F.Data.HexAddress}};
+    void* Address = nullptr;
+    AddressBuf >> Address;
+    F.Address = Address;
+    F.ImageOffset = Address;
+    Frames.emplace_back(std::move(F));
+  }
+}
+
 Backtrace::~Backtrace()
 {
   if (SymbolDataBuffer)
@@ -698,7 +802,7 @@ Backtrace::~Backtrace()
 
 void Backtrace::prettify()
 {
-  std::vector<std::unique_ptr<Symboliser>> Symbolisers = makeSymbolisers();
+  const std::vector<std::unique_ptr<Symboliser>>& Symbolisers = symbolisers();
   if (Symbolisers.empty())
   {
     MONOMUX_TRACE_LOG(Symboliser::noSymbolisersMessage());
@@ -722,32 +826,42 @@ void Backtrace::prettify()
     FramesForBinaryOfThisFrame.emplace_back(&F);
   }
 
+  SymbolCache& Cache = symbolCache();
   for (auto& P : FramesPerBinary)
   {
-    MONOMUX_TRACE_LOG(LOG(data) << "Prettifying " << P.second.size()
-                                << " stack frames from '" << P.first << "'");
     const std::string& Object = P.first;
-    const auto& Frames = P.second;
+    std::vector<Frame*> Frames;
+    {
+      std::lock_guard<std::mutex> L{Cache.Lock};
+      for (Frame* F : P.second)
+      {
+        auto It = Cache.Symbols.find({Object, F->Address});
+        if (It == Cache.Symbols.end())
+          Frames.emplace_back(F);
+        else if (It->second)
+          F->Info = copySymbol(*It->second);
+      }
+    }
+    if (Frames.empty())
+      continue;
+
+    MONOMUX_TRACE_LOG(LOG(data) << "Prettifying " << Frames.size()
+                                << " stack frames from '" << Object << "'");
     putSharedObjectOffsets(Frames);
 
-    auto SymbolisersForThisObject = [&Symbolisers] {
-      std::vector<Symboliser*> SymbPtrs;
-      std::transform(Symbolisers.begin(),
-                     Symbolisers.end(),
-                     std::back_inserter(SymbPtrs),
-                     [](auto&& SPtr) { return SPtr.get(); });
-      return SymbPtrs;
-    }();
-    while (!SymbolisersForThisObject.empty())
+    std::vector<Frame*> Unresolved = Frames;
+    for (auto It = Symbolisers.rbegin();
+         It != Symbolisers.rend() && !Unresolved.empty();
+         ++It)
     {
-      Symboliser* Symboliser = SymbolisersForThisObject.back();
+      Symboliser* Symboliser = It->get();
       MONOMUX_TRACE_LOG(LOG(trace)
                         << "Trying symboliser '" << Symboliser->name()
                         << "' for '" << Object << "'...");
 
       std::vector<std::optional<Symbol>> Symbols =
-        Symboliser->symbolise(Object, Frames);
-      for (std::size_t I = 0; I < Frames.size(); ++I)
+        Symboliser->symbolise(Object, Unresolved);
+      for (std::size_t I = 0; I < Unresolved.size(); ++I)
       {
         if (I >= Symbols.size())
           continue;
@@ -760,20 +874,358 @@ void Backtrace::prettify()
           continue;
         }
 
-        if (!Frames.at(I)->Info)
-          Frames.at(I)->Info = std::move(*Symbols.at(I));
+        if (!Unresolved.at(I)->Info)
+          Unresolved.at(I)->Info = std::move(*Symbols.at(I));
         else
-          Frames.at(I)->Info->mergeFrom(std::move(*Symbols.at(I)));
+          Unresolved.at(I)->Info->mergeFrom(std::move(*Symbols.at(I)));
       }
 
-      SymbolisersForThisObject.pop_back();
+      // Only the frames the symboliser could not fully resolve are given to
+      // the next one.
+      Unresolved.erase(
+        std::remove_if(Unresolved.begin(),
+                       Unresolved.end(),
+                       [](const Frame* F) { return isComplete(F->Info); }),
+        Unresolved.end());
     }
+
+    std::lock_guard<std::mutex> L{Cache.Lock};
+    for (const Frame* F : Frames)
+      Cache.Symbols.try_emplace(
+        {Object, F->Address},
+        F->Info ? std::optional<Symbol>{copySymbol(*F->Info)} : std::nullopt);
   }
 }
 
 namespace
 {
 
+/// The binary loaded into the memory of the process that contains an address.
+struct LoadedObject
+{
+  std::uintptr_t Address;
+
+  std::string Name;
+  std::uintptr_t LoadBias = 0;
+  std::string BuildID;
+};
+
+/// \returns the hexadecimal build ID in the \p PT_NOTE segment \p Note of
+/// \p Size bytes, or an empty string.
+std::string readBuildID(const char* Note, std::size_t Size)
+{
+  static constexpr auto Align = [](std::size_t N) { return (N + 3) & ~3UL; };
+  const char* const End = Note + Size;
+  while (Note + sizeof(ElfW(Nhdr)) <= End)
+  {
+    const auto* Header = reinterpret_cast<const ElfW(Nhdr)*>(Note);
+    const char* Name = Note + sizeof(ElfW(Nhdr));
+    const char* Desc = Name + Align(Header->n_namesz);
+    if (Desc + Header->n_descsz > End)
+      break;
+
+    if (Header->n_type == NT_GNU_BUILD_ID && Header->n_namesz == 4 &&
+        std::string_view{Name, 3} == "GNU")
+    {
+      static constexpr char Digits[] = "0123456789abcdef";
+      std::string ID;
+      ID.reserve(2 * Header->n_descsz);
+      for (std::size_t I = 0; I < Header->n_descsz; ++I)
+      {
+        const auto Byte = static_cast<unsigned char>(Desc[I]);
+        ID.push_back(Digits[Byte >> 4]);
+        ID.push_back(Digits[Byte & 0xF]);
+      }
+      return ID;
+    }
+
+    Note = Desc + Align(Header->n_descsz);
+  }
+  return {};
+}
+
+/// Callback for \p dl_iterate_phdr() that fills the \p LoadedObject in
+/// \p Data if the object contains the address sought.
+int findLoadedObject(struct ::dl_phdr_info* Info,
+                     std::size_t /* Size */,
+                     void* Data)
+{
+  auto& Obj = *static_cast<LoadedObject*>(Data);
+  bool Contains = false;
+  for (std::size_t I = 0; I < Info->dlpi_phnum && !Contains; ++I)
+  {
+    const ElfW(Phdr)& Segment = Info->dlpi_phdr[I];
+    const std::uintptr_t Begin = Info->dlpi_addr + Segment.p_vaddr;
+    Contains = Segment.p_type == PT_LOAD && Obj.Address >= Begin &&
+               Obj.Address < Begin + Segment.p_memsz;
+  }
+  if (!Contains)
+    return 0;
+
+  Obj.Name = Info->dlpi_name;
+  Obj.LoadBias = Info->dlpi_addr;
+  for (std::size_t I = 0; I < Info->dlpi_phnum && Obj.BuildID.empty(); ++I)
+  {
+    const ElfW(Phdr)& Segment = Info->dlpi_phdr[I];
+    if (Segment.p_type == PT_NOTE)
+      Obj.BuildID = readBuildID(
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        reinterpret_cast<const char*>(Info->dlpi_addr + Segment.p_vaddr),
+        Segment.p_memsz);
+  }
+  return 1;
+}
+
+/// \returns the path of the currently running executable.
+std::string currentExecutable()
+{
+  std::string Path(BinaryPipeCommunicationSize, 0);
+  const ::ssize_t Size = ::readlink("/proc/self/exe", Path.data(), Path.size());
+  if (Size <= 0)
+    return {};
+  Path.resize(static_cast<std::size_t>(Size));
+  return Path;
+}
+
+} // namespace
+
+void Backtrace::writeRaw(std::ostream& OS) const
+{
+  for (const Frame& F : Frames)
+  {
+    LoadedObject Obj{};
+    Obj.Address = reinterpret_cast<std::uintptr_t>(F.Address);
+    OS << '#' << F.Index << ' ';
+    if (!::dl_iterate_phdr(&findLoadedObject, &Obj))
+    {
+      OS << (F.Data.Binary.empty() ? "?" : F.Data.Binary) << " - "
+         << F.Address << '\n';
+      continue;
+    }
+
+    if (Obj.Name.empty())
+      // The main executable is reported without a name.
+      Obj.Name = currentExecutable();
+    OS << Obj.Name << ' ' << (Obj.BuildID.empty() ? "-" : Obj.BuildID)
+       << " 0x" << std::hex << (Obj.Address - Obj.LoadBias) << std::dec
+       << '\n';
+  }
+  OS.flush();
+}
+
+namespace
+{
+
+/// Formats a line of a raw report into a fixed buffer with async-signal-safe
+/// operations. Overlong lines are truncated.
+class LineFormatter
+{
+  char* Begin;
+  char* Position;
+  char* End;
+
+public:
+  template <std::size_t N>
+  LineFormatter(std::array<char, N>& Buffer)
+    : Begin(Buffer.data()), Position(Buffer.data()),
+      End(Buffer.data() + Buffer.size())
+  {}
+
+  LineFormatter& operator<<(const char* Str) noexcept
+  {
+    while (*Str && Position != End)
+      *Position++ = *Str++;
+    return *this;
+  }
+  LineFormatter& operator<<(char Ch) noexcept
+  {
+    if (Position != End)
+      *Position++ = Ch;
+    return *this;
+  }
+  LineFormatter& decimal(std::uintmax_t Value) noexcept
+  {
+    return number(Value, 10);
+  }
+  LineFormatter& hex(std::uintmax_t Value) noexcept
+  {
+    *this << "0x";
+    return number(Value, 16);
+  }
+
+  /// Writes the formatted line to \p FD.
+  void write(int FD) noexcept
+  {
+    for (const char* Data = Begin; Data < Position;)
+    {
+      const ::ssize_t Written = ::write(FD, Data, Position - Data);
+      if (Written <= 0 && errno != EINTR)
+        break;
+      if (Written > 0)
+        Data += Written;
+    }
+    Position = Begin;
+  }
+
+private:
+  LineFormatter& number(std::uintmax_t Value, unsigned Base) noexcept
+  {
+    char Digits[sizeof(std::uintmax_t) * 8];
+    std::size_t Count = 0;
+    do
+    {
+      Digits[Count++] = "0123456789abcdef"[Value % Base];
+      Value /= Base;
+    } while (Value);
+    while (Count)
+      *this << Digits[--Count];
+    return *this;
+  }
+};
+
+void copyString(std::string_view Str, char* Buffer, std::size_t Size)
+{
+  const std::size_t Length = std::min(Str.size(), Size - 1);
+  std::copy_n(Str.data(), Length, Buffer);
+  Buffer[Length] = '\0';
+}
+
+} // namespace
+
+CrashCapture::CrashCapture(const std::string& ReportPath,
+                           std::string_view Header)
+  : ReportFD(::open(ReportPath.c_str(),
+                    O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                    0600)),
+    Header(Header), ObjectCount(0)
+{
+  if (!valid())
+  {
+    LOG(error) << "Opening crash report '" << ReportPath
+               << "' failed: " << std::strerror(errno);
+    return;
+  }
+
+  snapshotObjects();
+  // The first call of backtrace() loads the unwinder, which is not safe to do
+  // in a signal handler.
+  (void)::backtrace(Addresses.data(), 1);
+}
+
+CrashCapture::~CrashCapture()
+{
+  if (valid())
+    ::close(ReportFD);
+}
+
+void CrashCapture::snapshotObjects()
+{
+  auto Visit = [](struct ::dl_phdr_info* Info,
+                  std::size_t /* Size */,
+                  void* Data) -> int {
+    auto& Self = *static_cast<CrashCapture*>(Data);
+    if (Self.ObjectCount == ObjectCountMax)
+      return 1;
+
+    LoadedObject& Obj = Self.Objects.at(Self.ObjectCount);
+    Obj.Begin = UINTPTR_MAX;
+    Obj.End = 0;
+    Obj.LoadBias = Info->dlpi_addr;
+    std::string BuildID;
+    for (std::size_t I = 0; I < Info->dlpi_phnum; ++I)
+    {
+      const ElfW(Phdr)& Segment = Info->dlpi_phdr[I];
+      const std::uintptr_t Begin = Info->dlpi_addr + Segment.p_vaddr;
+      if (Segment.p_type == PT_LOAD)
+      {
+        Obj.Begin = std::min(Obj.Begin, Begin);
+        Obj.End = std::max(Obj.End, Begin + Segment.p_memsz);
+      }
+      else if (Segment.p_type == PT_NOTE && BuildID.empty())
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        BuildID = readBuildID(reinterpret_cast<const char*>(Begin),
+                              Segment.p_memsz);
+    }
+    if (Obj.Begin >= Obj.End)
+      return 0;
+
+    const std::string Name =
+      *Info->dlpi_name ? Info->dlpi_name : currentExecutable();
+    copyString(Name, Obj.Name.data(), Obj.Name.size());
+    copyString(BuildID.empty() ? "-" : BuildID,
+               Obj.BuildID.data(),
+               Obj.BuildID.size());
+    ++Self.ObjectCount;
+    return 0;
+  };
+  ::dl_iterate_phdr(Visit, this);
+
+  MONOMUX_TRACE_LOG(LOG(debug) << "Crash capture knows " << ObjectCount
+                               << " loaded binaries");
+}
+
+void CrashCapture::setHelper(std::string Program,
+                             std::vector<std::string> Arguments)
+{
+  HelperProgram = std::move(Program);
+  HelperArguments = std::move(Arguments);
+  HelperArgv.clear();
+  for (std::string& Arg : HelperArguments)
+    HelperArgv.emplace_back(Arg.data());
+  HelperArgv.emplace_back(nullptr);
+}
+
+void CrashCapture::capture(int SigNum, const char* Module) noexcept
+{
+  if (!valid())
+    return;
+
+  LineFormatter Out{Line};
+  Out << Header.c_str() << " in '" << Module << "', PID ";
+  Out.decimal(static_cast<std::uintmax_t>(::getpid())) << ", signal ";
+  Out.decimal(static_cast<std::uintmax_t>(SigNum)) << '\n';
+  Out.write(ReportFD);
+
+  const int Count = ::backtrace(Addresses.data(), Addresses.size());
+  for (int I = 0; I < Count; ++I)
+  {
+    const auto Address = reinterpret_cast<std::uintptr_t>(Addresses.at(I));
+    const LoadedObject* Obj = nullptr;
+    for (std::size_t O = 0; O < ObjectCount && !Obj; ++O)
+      if (Address >= Objects.at(O).Begin && Address < Objects.at(O).End)
+        Obj = &Objects.at(O);
+
+    Out << '#';
+    Out.decimal(static_cast<std::uintmax_t>(Count - 1 - I)) << ' ';
+    if (Obj)
+      Out << Obj->Name.data() << ' ' << Obj->BuildID.data() << ' ';
+    else
+      Out << "? - ";
+    Out.hex(Obj ? Address - Obj->LoadBias : Address) << '\n';
+    Out.write(ReportFD);
+  }
+  Out << '\n';
+  Out.write(ReportFD);
+  ::fsync(ReportFD);
+
+  if (HelperArgv.empty())
+    return;
+  const ::pid_t Child = ::fork();
+  if (Child != 0)
+    return;
+
+  // Only the standard streams are kept, so the helper does not keep any other
+  // resource of the crashed process, such as the server socket, alive.
+  if (::syscall(SYS_close_range, 3U, ~0U, 0U) != 0)
+    for (int FD = 3; FD < static_cast<int>(PathSizeMax); ++FD)
+      ::close(FD);
+  ::execv(HelperProgram.c_str(), HelperArgv.data());
+  ::_exit(EXIT_FAILURE);
+}
+
+namespace
+{
+
 namespace ranges
 {
 
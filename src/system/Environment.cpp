@@ -187,6 +187,11 @@ std::string SocketPath::toString() const
   return Buf.str();
 }
 
+std::string SocketPath::statusPagePath() const
+{
+  return toString() + ".status";
+}
+
 std::vector<std::pair<std::string, std::string>>
 MonomuxSession::createEnvVars() const
 {
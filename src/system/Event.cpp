@@ -16,101 +16,137 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cerrno>
+#include <exception>
 #include <iomanip>
 
-#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
-#include "monomux/adt/UniqueScalar.hpp"
+#include "monomux/Allocation.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
 
 #include "monomux/system/Event.hpp"
 
 #include "monomux/Log.hpp"
 #define LOG(SEVERITY) monomux::log::SEVERITY("system/Event")
-#define LOG_WITH_IDENTIFIER(SEVERITY) LOG(SEVERITY) << MasterFD << ": "
+#define LOG_WITH_IDENTIFIER(SEVERITY)                                          \
+  LOG(SEVERITY) << (Ring ? Ring->raw() : MasterFD.get()) << ": "
 
 namespace monomux
 {
 
-EPoll::EPoll(std::size_t EventCount)
+/// \returns the \p epoll(7) event mask to listen for.
+static std::uint32_t listenEvents(bool Incoming, bool Outgoing) noexcept
+{
+  std::uint32_t Events = EPOLLHUP | EPOLLRDHUP;
+  if (Incoming)
+    Events |= EPOLLIN;
+  if (Outgoing)
+    Events |= EPOLLOUT;
+  return Events;
+}
+
+EPoll::EPoll(std::size_t EventCount, Backend Engine)
 {
   Notifications.resize(EventCount);
   ScheduledResult.reserve(EventCount);
   ScheduledWaiting.reserve(EventCount);
 
+  if (Engine == Backend::IOUring)
+  {
+    try
+    {
+      Ring = std::make_unique<IOUring>(EventCount);
+      LOG_WITH_IDENTIFIER(debug) << "Created io_uring backend with "
+                                 << EventCount << " events";
+      return;
+    }
+    catch (const std::system_error& SE)
+    {
+      LOG(warn) << "io_uring is not available, falling back to epoll: "
+                << SE.what();
+    }
+  }
+
   MasterFD = CheckedPOSIXThrow(
     [EventCount] { return ::epoll_create(EventCount); }, "epoll_create()", -1);
   fd::setNonBlockingCloseOnExec(MasterFD.get());
 
   LOG_WITH_IDENTIFIER(debug) << "Created with " << EventCount << " events";
-
-  ScheduleFD = CheckedPOSIXThrow(
-    [] { return ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); }, "eventfd()", -1);
-  LOG_WITH_IDENTIFIER(debug) << "Created eventfd token at " << ScheduleFD;
-  listen(ScheduleFD.get(), /* Incoming =*/true, /* Outgoing =*/false);
 }
 
 EPoll::~EPoll() { LOG_WITH_IDENTIFIER(debug) << "~EPoll"; }
 
 std::size_t EPoll::wait()
+{
+  // If there are scheduled events, they are ready to be handled, and waiting
+  // for the system to report something else would delay them.
+  return collect(ScheduledWaiting.empty());
+}
+
+std::size_t EPoll::poll() { return collect(/* Block =*/false); }
+
+std::size_t EPoll::collect(bool Block)
 {
   ScheduledResult.clear();
-  ScheduleFDNotifiedAtIndex.reset();
+
+  const int Timeout = Block ? -1 : 0;
+  if (Ring)
+  {
+    try
+    {
+      NotificationCount = Ring->wait(Notifications, /* Block =*/Timeout != 0);
+    }
+    catch (const std::system_error& SE)
+    {
+      if (SE.code() == std::errc::interrupted /* EINTR */)
+        return 0;
+      throw;
+    }
+    return collectScheduled();
+  }
 
   MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "epoll_wait()...");
   auto MaybeFiredEventCount = CheckedPOSIX(
-    [this] {
-      return ::epoll_wait(
-        MasterFD, &(*Notifications.data()), getMaxEventCount(), -1);
+    [this, Timeout] {
+      if (!WaitLock)
+        return ::epoll_wait(
+          MasterFD, &(*Notifications.data()), getMaxEventCount(), Timeout);
+
+      WaitLock->unlock();
+      int R = ::epoll_wait(
+        MasterFD, &(*Notifications.data()), getMaxEventCount(), Timeout);
+      int Errno = errno;
+      WaitLock->lock();
+      errno = Errno;
+      return R;
     },
     -1);
   if (!MaybeFiredEventCount)
   {
     std::error_code EC = MaybeFiredEventCount.getError();
     if (EC == std::errc::interrupted /* EINTR */)
-      // Interrupting epoll_wait() is not an issue.
+      // Interrupting epoll_wait() is not an issue. The scheduled events are
+      // delivered by the next call.
       return 0;
     throw std::system_error{EC, "epoll_wait()"};
   }
   NotificationCount = MaybeFiredEventCount.get();
-  if (!ScheduledWaiting.empty())
-  {
-    // If there are scheduled results, the 'eventfd' will trigger and that
-    // will count as a nofication, but this would destroy our calculations.
-    --NotificationCount;
-
-    // Consume the scheduled event token.
-    POD<std::uint64_t> ScheduledCount;
-    CheckedPOSIX(
-      [Token = ScheduleFD.get(), &ScheduledCount] {
-        return ::read(Token, &ScheduledCount, sizeof(ScheduledCount));
-      },
-      -1);
-    if (ScheduledCount != ScheduledWaiting.size())
-      LOG_WITH_IDENTIFIER(debug) << "eventfd_read() -> " << ScheduledCount
-                                 << " != expected " << ScheduledWaiting.size();
-
-    // Save where the ScheduleFD was triggered at. The client should not be
-    // allowed to directly see that event.
-    for (std::size_t I = 0; I < NotificationCount + 1; ++I)
-    {
-      const struct ::epoll_event& E = **(Notifications.begin() + I);
-      if (E.data.fd == ScheduleFD)
-      {
-        ScheduleFDNotifiedAtIndex.emplace(I);
-        break;
-      }
-    }
-  }
 
   MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
                     << "epoll_wait()"
                     << " -> " << NotificationCount << " events");
+  return collectScheduled();
+}
 
+std::size_t EPoll::collectScheduled()
+{
   // Move the events that were scheduled before wait() into the result set.
   ScheduledWaiting.swap(ScheduledResult);
-  ScheduledWaitingMap.clear();
+  for (const POD<struct ::epoll_event>& E : ScheduledResult)
+    FDTable[E->data.fd].Scheduled = 0;
   MONOMUX_TRACE_LOG({
     if (!ScheduledResult.empty())
       LOG_WITH_IDENTIFIER(trace)
@@ -123,6 +159,7 @@ std::size_t EPoll::wait()
 
 void EPoll::schedule(raw_fd FD, bool Incoming, bool Outgoing)
 {
+  MONOMUX_ALLOCATION_SCOPE(Poll);
   auto SetupEvent = [=](struct ::epoll_event& E) {
     E.data.fd = FD;
     if (Incoming)
@@ -131,22 +168,148 @@ void EPoll::schedule(raw_fd FD, bool Incoming, bool Outgoing)
       E.events |= EPOLLOUT;
   };
 
-  auto* MaybeIt = ScheduledWaitingMap.tryGet(FD);
-  if (!MaybeIt)
+  FDState& State = state(FD);
+  if (!State.Scheduled)
   {
-    CheckedPOSIX(
-      [Token = ScheduleFD.get()] {
-        static UniqueScalar<std::uint64_t, 1> One;
-        return ::write(Token, &One, sizeof(One));
+    SetupEvent(*ScheduledWaiting.emplace_back());
+    State.Scheduled = ScheduledWaiting.size();
+    return;
+  }
+  SetupEvent(*ScheduledWaiting[State.Scheduled - 1]);
+}
+
+EPoll::FDState& EPoll::state(raw_fd FD)
+{
+  MONOMUX_ALLOCATION_SCOPE(Poll);
+  assert(FD >= 0 && "Invalid file descriptor!");
+  const auto Index = static_cast<std::size_t>(FD);
+  if (Index >= FDTable.size())
+    FDTable.resize(std::max(Index + 1, FDTable.size() * 2));
+  return FDTable[Index];
+}
+
+EPoll::TimerID EPoll::addTimer(std::chrono::steady_clock::time_point Deadline,
+                              TimerCallback Callback)
+{
+  MONOMUX_ALLOCATION_SCOPE(Poll);
+  if (!TimerFD.has())
+  {
+    TimerFD = CheckedPOSIXThrow(
+      [] {
+        return ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
       },
+      "timerfd_create()",
       -1);
+    listen(TimerFD, /* Incoming =*/true, /* Outgoing =*/false);
+  }
 
-    struct ::epoll_event& E = ScheduledWaiting.emplace_back();
-    ScheduledWaitingMap.set(FD, ScheduledWaiting.end() - 1);
-    SetupEvent(E);
+  const TimerID ID = NextTimerID++;
+  TimerCallbacks.try_emplace(ID, std::move(Callback));
+  TimerHeap.emplace_back(Deadline, ID);
+  std::push_heap(
+    TimerHeap.begin(), TimerHeap.end(), std::greater<TimerDeadline>{});
+  if (!TimerArmedFor || Deadline < *TimerArmedFor)
+    armTimer();
+  return ID;
+}
+
+void EPoll::cancelTimer(TimerID Timer)
+{
+  // Expiring early for a cancelled timer is harmless, so TimerFD is left
+  // alone.
+  TimerCallbacks.erase(Timer);
+}
+
+void EPoll::fireTimers()
+{
+  POD<std::uint64_t> Expirations;
+  CheckedPOSIX(
+    [this, &Expirations] {
+      return ::read(TimerFD, &Expirations, sizeof(Expirations));
+    },
+    -1);
+  TimerArmedFor.reset();
+
+  // Collect the expired timers first, so the ones the callbacks add are not
+  // fired in the same round, even if they are already due.
+  const auto Now = std::chrono::steady_clock::now();
+  std::vector<TimerCallback> Expired;
+  while (!TimerHeap.empty() && TimerHeap.front().first <= Now)
+  {
+    const TimerID ID = TimerHeap.front().second;
+    std::pop_heap(
+      TimerHeap.begin(), TimerHeap.end(), std::greater<TimerDeadline>{});
+    TimerHeap.pop_back();
+
+    auto It = TimerCallbacks.find(ID);
+    if (It == TimerCallbacks.end())
+      // Cancelled.
+      continue;
+    Expired.emplace_back(std::move(It->second));
+    TimerCallbacks.erase(It);
+  }
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                    << Expired.size() << " timers expired");
+
+  // Arm for the remaining timers before the callbacks, so an exception from
+  // them does not leave the timers stalled.
+  armTimer();
+  std::exception_ptr FirstError;
+  for (TimerCallback& Callback : Expired)
+    try
+    {
+      Callback();
+    }
+    catch (...)
+    {
+      // The rest of the expired timers must still be fired, as nothing would
+      // call them later.
+      if (!FirstError)
+        FirstError = std::current_exception();
+    }
+  if (FirstError)
+    std::rethrow_exception(FirstError);
+}
+
+void EPoll::armTimer()
+{
+  while (!TimerHeap.empty() &&
+         TimerCallbacks.find(TimerHeap.front().second) == TimerCallbacks.end())
+  {
+    std::pop_heap(
+      TimerHeap.begin(), TimerHeap.end(), std::greater<TimerDeadline>{});
+    TimerHeap.pop_back();
+  }
+
+  std::optional<std::chrono::steady_clock::time_point> Deadline;
+  if (!TimerHeap.empty())
+    Deadline = TimerHeap.front().first;
+  if (Deadline == TimerArmedFor)
     return;
+
+  // An all-zero timer value disarms the timer.
+  POD<struct ::itimerspec> Value;
+  if (Deadline)
+  {
+    auto SinceEpoch = Deadline->time_since_epoch();
+    auto Seconds = std::chrono::duration_cast<std::chrono::seconds>(SinceEpoch);
+    Value->it_value.tv_sec = Seconds.count();
+    Value->it_value.tv_nsec =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(SinceEpoch -
+                                                           Seconds)
+        .count();
+    if (!Value->it_value.tv_sec && !Value->it_value.tv_nsec)
+      // A deadline at the epoch would disarm the timer instead.
+      Value->it_value.tv_nsec = 1;
   }
-  SetupEvent(**MaybeIt);
+
+  CheckedPOSIXThrow(
+    [this, &Value] {
+      return ::timerfd_settime(TimerFD, TFD_TIMER_ABSTIME, &Value, nullptr);
+    },
+    "timerfd_settime()",
+    -1);
+  TimerArmedFor = Deadline;
 }
 
 bool EPoll::isValidIndex(std::size_t I) const noexcept
@@ -165,13 +328,7 @@ const struct ::epoll_event& EPoll::at(std::size_t Index) const
     return *ScheduledResult.at(Index);
 
   // The rest of the buffer should be taken from the real system result set.
-  Index -= ScheduledCount;
-  // Skipping (as if never existed) the position where the eventfd(2) trigger
-  // arrived.
-  if (!ScheduleFDNotifiedAtIndex.has_value() ||
-      Index < *ScheduleFDNotifiedAtIndex)
-    return *Notifications.at(Index);
-  return *Notifications.at(Index + 1);
+  return *Notifications.at(Index - ScheduledCount);
 }
 
 raw_fd EPoll::fdAt(std::size_t Index) noexcept
@@ -190,65 +347,72 @@ EPoll::EventWithMode EPoll::eventAt(std::size_t Index) noexcept
           (E.events & EPOLLOUT) == EPOLLOUT};
 }
 
-void EPoll::listen(raw_fd FD, bool Incoming, bool Outgoing)
+void EPoll::listen(raw_fd FD, bool Incoming, bool Outgoing, bool EdgeTriggered)
 {
-  Listeners.try_emplace(FD, *this, FD, Incoming, Outgoing);
-}
+  MONOMUX_ALLOCATION_SCOPE(Poll);
+  const std::uint32_t Events = listenEvents(Incoming, Outgoing);
+  if (Ring)
+    Ring->add(FD, Events, EdgeTriggered);
+  else
+  {
+    FDState& State = state(FD);
+    if (State.Listened)
+      return;
+
+    POD<struct ::epoll_event> Control;
+    Control->data.fd = FD;
+    Control->events = Events;
+    if (EdgeTriggered)
+      Control->events |= EPOLLET;
+
+    CheckedPOSIXThrow(
+      [this, &Control, FD] {
+        return ::epoll_ctl(MasterFD, EPOLL_CTL_ADD, FD, &Control);
+      },
+      "epoll_ctl registering file",
+      -1);
+    State.Listened = true;
+  }
 
-void EPoll::stop(raw_fd FD)
-{
-  auto It = Listeners.find(FD);
-  if (It == Listeners.end())
-    return;
-  Listeners.erase(It);
+  LOG_WITH_IDENTIFIER(trace)
+    << "Listen for FD " << FD << "(incoming: " << std::boolalpha << Incoming
+    << ", outgoing: " << Outgoing << ", edge-triggered: " << EdgeTriggered
+    << std::noboolalpha << ')';
 }
 
-void EPoll::clear()
+void EPoll::stop(raw_fd FD)
 {
-  for (auto It = Listeners.begin(); It != Listeners.end();)
-    It = Listeners.erase(It);
-}
+  if (Ring)
+    Ring->remove(FD);
+  else
+  {
+    if (FD < 0 || static_cast<std::size_t>(FD) >= FDTable.size() ||
+        !FDTable[FD].Listened)
+      return;
+    FDTable[FD].Listened = false;
 
-EPoll::Listener::Listener(EPoll& Master,
-                          raw_fd FD,
-                          bool Incoming,
-                          bool Outgoing)
-  : Master(Master), FDToListenFor(FD)
-{
-  POD<struct ::epoll_event> Control;
-  Control->data.fd = FD;
-  Control->events = EPOLLHUP | EPOLLRDHUP;
-  if (Incoming)
-    Control->events |= EPOLLIN;
-  if (Outgoing)
-    Control->events |= EPOLLOUT;
+    POD<struct ::epoll_event> Control;
+    CheckedPOSIX(
+      [this, &Control, FD] {
+        return ::epoll_ctl(MasterFD, EPOLL_CTL_DEL, FD, &Control);
+      },
+      -1);
+  }
 
-  CheckedPOSIXThrow(
-    [&Master, &Control, FD] {
-      return ::epoll_ctl(Master.MasterFD, EPOLL_CTL_ADD, FD, &Control);
-    },
-    "epoll_ctl registering file",
-    -1);
-  LOG(trace) << Master.MasterFD << ": "
-             << "Listen for FD " << FD << "(incoming: " << std::boolalpha
-             << Incoming << ", outgoing: " << Outgoing << std::noboolalpha
-             << ')';
+  LOG_WITH_IDENTIFIER(trace) << "Stop listening for FD " << FD;
 }
 
-EPoll::Listener::~Listener()
+void EPoll::clear()
 {
-  if (FDToListenFor == fd::Invalid)
+  if (Ring)
+  {
+    Ring->clear();
     return;
+  }
 
-  POD<struct ::epoll_event> Control;
-  CheckedPOSIX(
-    [this, &Control] {
-      return ::epoll_ctl(
-        Master.MasterFD, EPOLL_CTL_DEL, FDToListenFor, &Control);
-    },
-    -1);
-  LOG(trace) << Master.MasterFD << ": "
-             << "Stop listening for FD " << FDToListenFor;
+  for (std::size_t FD = 0; FD < FDTable.size(); ++FD)
+    if (FDTable[FD].Listened)
+      stop(static_cast<raw_fd>(FD));
 }
 
 } // namespace monomux
@@ -0,0 +1,370 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include <endian.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/IOUring.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/IOUring")
+#define LOG_WITH_IDENTIFIER(SEVERITY) LOG(SEVERITY) << RingFD.get() << ": "
+
+namespace monomux
+{
+
+namespace
+{
+
+/// The completion of requests with this identifier is not reported, e.g.
+/// cancellations.
+constexpr std::uint64_t InternalUserData = 0;
+
+constexpr std::uint64_t userData(raw_fd FD, std::uint32_t Generation) noexcept
+{
+  return (static_cast<std::uint64_t>(Generation) << 32) |
+         static_cast<std::uint32_t>(FD);
+}
+
+unsigned loadAcquire(const unsigned* P) noexcept
+{
+  return __atomic_load_n(P, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* P, unsigned Value) noexcept
+{
+  __atomic_store_n(P, Value, __ATOMIC_RELEASE);
+}
+
+std::uint32_t pollEvents(std::uint32_t Events) noexcept
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+  // The kernel reads the mask as two swapped 16-bit halves.
+  Events = (Events << 16) | (Events >> 16);
+#endif
+  return Events;
+}
+
+void* mapRing(raw_fd FD, std::size_t Size, off_t Offset)
+{
+  return CheckedPOSIXThrow(
+    [=] {
+      return ::mmap(nullptr,
+                    Size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,
+                    FD,
+                    Offset);
+    },
+    "mmap() io_uring",
+    MAP_FAILED);
+}
+
+template <typename T> T* at(void* Base, std::size_t Offset) noexcept
+{
+  return reinterpret_cast<T*>(static_cast<char*>(Base) + Offset);
+}
+
+} // namespace
+
+IOUring::IOUring(std::size_t EntryCount)
+{
+  POD<struct ::io_uring_params> Params;
+  Params->flags = IORING_SETUP_CLAMP;
+  RingFD = fd{CheckedPOSIXThrow(
+    [EntryCount, &Params] {
+      return static_cast<int>(
+        ::syscall(__NR_io_uring_setup, EntryCount, &Params));
+    },
+    "io_uring_setup()",
+    -1)};
+  // Multishot polling has no feature flag of its own, but it became available
+  // in the same release as resource tags.
+  if (!(Params->features & IORING_FEAT_RSRC_TAGS))
+    throw std::system_error{
+      std::make_error_code(std::errc::function_not_supported),
+      "io_uring multishot poll"};
+
+  try
+  {
+    SQRingSize = Params->sq_off.array + Params->sq_entries * sizeof(unsigned);
+    CQRingSize =
+      Params->cq_off.cqes + Params->cq_entries * sizeof(struct ::io_uring_cqe);
+    const bool SingleMap = Params->features & IORING_FEAT_SINGLE_MMAP;
+    if (SingleMap)
+      SQRingSize = CQRingSize = std::max(SQRingSize, CQRingSize);
+
+    SQRing = mapRing(RingFD, SQRingSize, IORING_OFF_SQ_RING);
+    CQRing =
+      SingleMap ? SQRing : mapRing(RingFD, CQRingSize, IORING_OFF_CQ_RING);
+    SQEsSize = Params->sq_entries * sizeof(struct ::io_uring_sqe);
+    SQEs = static_cast<struct ::io_uring_sqe*>(
+      mapRing(RingFD, SQEsSize, IORING_OFF_SQES));
+  }
+  catch (...)
+  {
+    unmap();
+    throw;
+  }
+
+  SQHead = at<unsigned>(SQRing, Params->sq_off.head);
+  SQTail = at<unsigned>(SQRing, Params->sq_off.tail);
+  SQMask = *at<unsigned>(SQRing, Params->sq_off.ring_mask);
+  SQEntries = Params->sq_entries;
+  SQFlags = at<unsigned>(SQRing, Params->sq_off.flags);
+  // Submission queue entries are always used in order, so the indirection
+  // array is set up once.
+  unsigned* SQArray = at<unsigned>(SQRing, Params->sq_off.array);
+  for (unsigned I = 0; I < SQEntries; ++I)
+    SQArray[I] = I;
+
+  CQHead = at<unsigned>(CQRing, Params->cq_off.head);
+  CQTail = at<unsigned>(CQRing, Params->cq_off.tail);
+  CQMask = *at<unsigned>(CQRing, Params->cq_off.ring_mask);
+  CQEs = at<struct ::io_uring_cqe>(CQRing, Params->cq_off.cqes);
+
+  LOG_WITH_IDENTIFIER(debug) << "Created with " << SQEntries << " entries";
+}
+
+IOUring::~IOUring()
+{
+  LOG_WITH_IDENTIFIER(debug) << "~IOUring";
+  unmap();
+}
+
+void IOUring::unmap() noexcept
+{
+  if (SQEs)
+    ::munmap(SQEs, SQEsSize);
+  if (CQRing && CQRing != SQRing)
+    ::munmap(CQRing, CQRingSize);
+  if (SQRing)
+    ::munmap(SQRing, SQRingSize);
+  SQEs = nullptr;
+  CQRing = nullptr;
+  SQRing = nullptr;
+}
+
+void IOUring::add(raw_fd FD, std::uint32_t Events, bool EdgeTriggered)
+{
+  if (find(FD))
+    return;
+  const auto Index = static_cast<std::size_t>(FD);
+  if (Index >= Watches.size())
+    Watches.resize(std::max(Index + 1, Watches.size() * 2));
+
+  Watch& W = Watches[Index];
+  W.Generation = NextGeneration;
+  W.Events = Events;
+  W.EdgeTriggered = EdgeTriggered;
+  if (++NextGeneration == 0)
+    NextGeneration = 1;
+  arm(FD, W);
+}
+
+void IOUring::remove(raw_fd FD)
+{
+  Watch* W = find(FD);
+  if (!W)
+    return;
+
+  const bool Armed = W->Armed;
+  if (Armed)
+    cancel(FD, *W);
+  *W = Watch{};
+  if (!Armed)
+    return;
+
+  if (std::error_code EC = enter(0))
+    LOG_WITH_IDENTIFIER(error) << "Submitting the removal of FD " << FD
+                               << " failed: " << EC.message();
+}
+
+void IOUring::clear()
+{
+  for (std::size_t FD = 0; FD < Watches.size(); ++FD)
+    if (Watches[FD].Armed)
+      cancel(static_cast<raw_fd>(FD), Watches[FD]);
+  Watches.clear();
+  Rearm.clear();
+
+  if (std::error_code EC = enter(0))
+    LOG_WITH_IDENTIFIER(error) << "Submitting removals failed: "
+                               << EC.message();
+}
+
+std::size_t IOUring::wait(std::vector<POD<struct ::epoll_event>>& Events,
+                          bool Block)
+{
+  for (raw_fd FD : Rearm)
+  {
+    Watch* W = find(FD);
+    if (W && !W->Armed)
+      arm(FD, *W);
+  }
+  Rearm.clear();
+
+  // Completions that did not fit into the previous result are ready already.
+  const bool Pending = loadAcquire(CQTail) != *CQHead;
+  // Completions that did not fit into the completion queue are held back by
+  // the kernel until they are asked for, which a loop that never blocks would
+  // otherwise never do.
+  const bool Overflown = loadAcquire(SQFlags) & IORING_SQ_CQ_OVERFLOW;
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "io_uring_enter()...");
+  if (std::error_code EC = enter(Block && !Pending ? 1 : 0, Overflown))
+    throw std::system_error{EC, "io_uring_enter()"};
+
+  // A multishot request completes on every wakeup of a busy file, and the
+  // completions of the other files would queue up behind them without bound.
+  // The completions of the same file are merged into one event instead.
+  if (++WaitRound == 0)
+    WaitRound = 1;
+  std::size_t Count = 0;
+  unsigned Head = *CQHead;
+  const unsigned Tail = loadAcquire(CQTail);
+  for (; Head != Tail; ++Head)
+  {
+    const struct ::io_uring_cqe& C = CQEs[Head & CQMask];
+    if (C.user_data == InternalUserData)
+      continue;
+    const auto FD = static_cast<raw_fd>(C.user_data & 0xFFFFFFFFULL);
+    const auto Generation = static_cast<std::uint32_t>(C.user_data >> 32);
+    Watch* MaybeW = find(FD);
+    if (!MaybeW || MaybeW->Generation != Generation)
+      // The completion of a request that was cancelled since.
+      continue;
+
+    Watch& W = *MaybeW;
+    const bool Reported = W.ReportedRound == WaitRound;
+    if (!Reported && Count == Events.size())
+      // Left for the next call.
+      break;
+    if (!(C.flags & IORING_CQE_F_MORE))
+      W.Armed = false;
+    if (C.res < 0)
+    {
+      if (C.res == -ECANCELED)
+        // Multishot requests are cancelled by the kernel if the completion
+        // queue overflows.
+        Rearm.emplace_back(FD);
+      else
+        LOG_WITH_IDENTIFIER(error) << "Polling FD " << FD
+                                   << " failed: " << std::strerror(-C.res);
+      continue;
+    }
+    if (!W.Armed)
+      Rearm.emplace_back(FD);
+
+    if (Reported)
+    {
+      Events[W.ReportedAt]->events |= static_cast<std::uint32_t>(C.res);
+      continue;
+    }
+    W.ReportedRound = WaitRound;
+    W.ReportedAt = Count;
+    struct ::epoll_event& E = *Events[Count++];
+    E.events = static_cast<std::uint32_t>(C.res);
+    E.data.fd = FD;
+  }
+  storeRelease(CQHead, Head);
+
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "io_uring_enter()"
+                                               << " -> " << Count << " events");
+  return Count;
+}
+
+IOUring::Watch* IOUring::find(raw_fd FD) noexcept
+{
+  if (FD < 0 || static_cast<std::size_t>(FD) >= Watches.size())
+    return nullptr;
+  Watch& W = Watches[FD];
+  return W.Generation ? &W : nullptr;
+}
+
+struct ::io_uring_sqe& IOUring::nextSQE()
+{
+  const unsigned Tail = *SQTail;
+  if (Tail - loadAcquire(SQHead) == SQEntries)
+    if (std::error_code EC = enter(0))
+      throw std::system_error{EC, "io_uring_enter() submitting a full queue"};
+
+  // Without a kernel-side polling thread, the queue is only read during
+  // io_uring_enter(), so the entry can be published before it is filled.
+  storeRelease(SQTail, Tail + 1);
+  struct ::io_uring_sqe& E = SQEs[Tail & SQMask];
+  std::memset(&E, 0, sizeof(E));
+  return E;
+}
+
+void IOUring::arm(raw_fd FD, Watch& W)
+{
+  struct ::io_uring_sqe& E = nextSQE();
+  E.opcode = IORING_OP_POLL_ADD;
+  E.fd = FD;
+  E.poll32_events = pollEvents(W.Events);
+  // Multishot requests are edge-triggered.
+  E.len = W.EdgeTriggered ? IORING_POLL_ADD_MULTI : 0;
+  E.user_data = userData(FD, W.Generation);
+  W.Armed = true;
+}
+
+void IOUring::cancel(raw_fd FD, const Watch& W)
+{
+  struct ::io_uring_sqe& E = nextSQE();
+  E.opcode = IORING_OP_POLL_REMOVE;
+  E.fd = -1;
+  E.addr = userData(FD, W.Generation);
+  E.user_data = InternalUserData;
+}
+
+std::error_code IOUring::enter(unsigned MinComplete, bool Flush) noexcept
+{
+  const unsigned ToSubmit = *SQTail - loadAcquire(SQHead);
+  if (!ToSubmit && !MinComplete && !Flush)
+    // Completions are posted to the shared ring without entering the kernel.
+    return {};
+
+  const unsigned Flags = MinComplete || Flush ? IORING_ENTER_GETEVENTS : 0;
+  auto Result = CheckedPOSIX(
+    [this, ToSubmit, MinComplete, Flags] {
+      return static_cast<int>(::syscall(__NR_io_uring_enter,
+                                        RingFD.get(),
+                                        ToSubmit,
+                                        MinComplete,
+                                        Flags,
+                                        nullptr,
+                                        0));
+    },
+    -1);
+  if (!Result)
+    return Result.getError();
+  return {};
+}
+
+} // namespace monomux
+
+#undef LOG_WITH_IDENTIFIER
+#undef LOG
@@ -20,6 +20,7 @@
 #include <sstream>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "monomux/adt/POD.hpp"
@@ -43,10 +44,18 @@ Pipe::Pipe(fd Handle, std::string Identifier, bool NeedsCleanup, Mode OpenMode)
                     OpenMode == Read ? BUFSIZ : 0,
                     OpenMode == Write ? BUFSIZ : 0),
     OpenedAs(OpenMode)
-{}
+{
+  setStaticTransport(StaticTransport::File);
+}
 
-std::size_t Pipe::optimalReadSize() const noexcept { return BUFSIZ; }
-std::size_t Pipe::optimalWriteSize() const noexcept { return BUFSIZ; }
+std::size_t Pipe::optimalReadSize() const noexcept
+{
+  return transport::File::ChunkSize;
+}
+std::size_t Pipe::optimalWriteSize() const noexcept
+{
+  return transport::File::ChunkSize;
+}
 
 Pipe Pipe::create(std::string Path, bool InheritInChild)
 {
@@ -193,21 +202,17 @@ void Pipe::setNonblocking()
   Nonblock = true;
 }
 
-static std::string read(raw_fd FD, std::size_t Bytes, bool* Success)
+static std::size_t
+read(raw_fd FD, char* Destination, std::size_t Bytes, bool* Success)
 {
-  static constexpr std::size_t BufferSize = BUFSIZ;
-  std::string Return;
-  Return.reserve(Bytes);
-
-  std::size_t RemainingBytes = Bytes;
+  std::size_t ReadSoFar = 0;
 
   bool ContinueReading = true;
-  while (ContinueReading && RemainingBytes > 0 && RemainingBytes <= Bytes)
+  while (ContinueReading && ReadSoFar < Bytes)
   {
-    POD<char[BufferSize]> RawBuffer;
     auto ReadBytes = CheckedPOSIX(
-      [FD, ReadSize = std::min(BufferSize, RemainingBytes), &RawBuffer] {
-        return ::read(FD, &RawBuffer, ReadSize);
+      [FD, Buffer = Destination + ReadSoFar, ReadSize = Bytes - ReadSoFar] {
+        return ::read(FD, Buffer, ReadSize);
       },
       -1);
     if (!ReadBytes)
@@ -236,18 +241,13 @@ static std::string read(raw_fd FD, std::size_t Bytes, bool* Success)
       break;
     }
 
-    std::size_t BytesToAppendFromCurrentRead =
-      std::min(static_cast<std::size_t>(ReadBytes.get()), RemainingBytes);
-    Return.append(RawBuffer, BytesToAppendFromCurrentRead);
-
-    RemainingBytes -= BytesToAppendFromCurrentRead;
+    ReadSoFar += ReadBytes.get();
   }
-
-  if (!ContinueReading && Return.empty() && Success)
+  if (!ContinueReading && !ReadSoFar && Success)
     *Success = false;
   else if (Success)
     *Success = true;
-  return Return;
+  return ReadSoFar;
 }
 
 static std::size_t write(raw_fd FD, std::string_view Buffer, bool* Success)
@@ -303,7 +303,8 @@ static std::size_t write(raw_fd FD, std::string_view Buffer, bool* Success)
   return BytesSent;
 }
 
-std::string Pipe::readImpl(std::size_t Bytes, bool& Continue)
+std::size_t
+Pipe::readIntoImpl(char* Destination, std::size_t Capacity, bool& Continue)
 {
   if (failed())
     throw std::system_error{std::make_error_code(std::errc::io_error),
@@ -314,14 +315,13 @@ std::string Pipe::readImpl(std::size_t Bytes, bool& Continue)
       "Not readable."};
 
   bool Success;
-  std::string Data = monomux::read(Handle, Bytes, &Success);
+  std::size_t Bytes = monomux::read(Handle, Destination, Capacity, &Success);
   if (!Success)
   {
     setFailed();
     Continue = false;
   }
-
-  return Data;
+  return Bytes;
 }
 
 std::size_t Pipe::writeImpl(std::string_view Buffer, bool& Continue)
@@ -344,6 +344,34 @@ std::size_t Pipe::writeImpl(std::string_view Buffer, bool& Continue)
   return Bytes;
 }
 
+std::size_t
+Pipe::readvImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+{
+  if (failed())
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Pipe failed."};
+  if (OpenedAs != Read)
+    throw std::system_error{
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Not readable."};
+
+  return receiveWith<transport::File>(Buffers, Count, Continue);
+}
+
+std::size_t
+Pipe::writevImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+{
+  if (failed())
+    throw std::system_error{std::make_error_code(std::errc::io_error),
+                            "Pipe failed."};
+  if (OpenedAs != Write)
+    throw std::system_error{
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Not writable."};
+
+  return sendWith<transport::File>(Buffers, Count, Continue);
+}
+
 std::unique_ptr<Pipe> Pipe::AnonymousPipe::takeRead()
 {
   if (!Read)
@@ -16,19 +16,29 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cerrno>
 #include <csignal>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include <linux/limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <utmp.h>
 
 #include "monomux/adt/POD.hpp"
+#include "monomux/adt/ScopeGuard.hpp"
 #include "monomux/system/CheckedPOSIX.hpp"
 #include "monomux/system/Pty.hpp"
-#include "monomux/unreachable.hpp"
 
 #include "monomux/system/Process.hpp"
 
@@ -38,64 +48,77 @@
 namespace monomux
 {
 
-static void allocCopyString(const std::string& Source,
-                            char* DestinationStringArray[],
-                            std::size_t Index)
+/// The argument and environment vectors of a process to execute, laid out in
+/// one contiguous arena, so that executing it allocates no memory.
+class ExecImage
 {
-  DestinationStringArray[Index] =
-    reinterpret_cast<char*>(std::calloc(Source.size() + 1, 1));
-  std::strncpy(
-    DestinationStringArray[Index], Source.c_str(), Source.size() + 1);
-}
+public:
+  explicit ExecImage(const Process::SpawnOptions& Opts)
+  {
+    std::vector<std::size_t> ArgOffsets;
+    std::vector<std::size_t> EnvOffsets;
+    auto Append = [this](std::vector<std::size_t>& Offsets,
+                         std::string_view Str) {
+      Offsets.emplace_back(Arena.size());
+      Arena.append(Str);
+      Arena.push_back('\0');
+    };
 
-Process::raw_handle Process::thisProcess()
-{
-  return CheckedPOSIXThrow([] { return ::getpid(); }, "getpid()", -1);
-}
+    Append(ArgOffsets, Opts.Program);
+    for (const std::string& Arg : Opts.Arguments)
+      Append(ArgOffsets, Arg);
 
-std::string Process::thisProcessPath()
-{
-  POD<char[PATH_MAX]> Binary;
-  CheckedPOSIXThrow(
-    [&Binary] { return ::readlink("/proc/self/exe", Binary, PATH_MAX); },
-    "readlink(\"/proc/self/exe\")",
-    -1);
-  return {Binary};
-}
+    // The inherited variables come first, except those that are overridden.
+    for (char** Env = environ; Env && *Env; ++Env)
+    {
+      std::string_view Var{*Env};
+      std::string_view Key = Var.substr(0, Var.find('='));
+      if (Opts.Environment.find(std::string{Key}) == Opts.Environment.end())
+        Append(EnvOffsets, Var);
+    }
+    for (const auto& E : Opts.Environment)
+    {
+      if (!E.second)
+        continue;
+      EnvOffsets.emplace_back(Arena.size());
+      Arena.append(E.first);
+      Arena.push_back('=');
+      Arena.append(*E.second);
+      Arena.push_back('\0');
+    }
 
-[[noreturn]] void Process::exec(const SpawnOptions& Opts)
-{
-  LOG(debug) << "----- Process::exec() "
-             << "was called -----";
+    // The arena is no longer resized, the pointers into it are stable.
+    for (std::size_t Offset : ArgOffsets)
+      Argv.emplace_back(Arena.data() + Offset);
+    Argv.emplace_back(nullptr);
+    for (std::size_t Offset : EnvOffsets)
+      Envp.emplace_back(Arena.data() + Offset);
+    Envp.emplace_back(nullptr);
+  }
+
+  char* const* argv() const noexcept { return Argv.data(); }
+  char* const* envp() const noexcept { return Envp.data(); }
 
-  char** NewArgv = new char*[Opts.Arguments.size() + 2];
-  allocCopyString(Opts.Program, NewArgv, 0);
+private:
+  std::string Arena;
+  std::vector<char*> Argv;
+  std::vector<char*> Envp;
+};
+
+static void logSpawnOptions(const Process::SpawnOptions& Opts)
+{
   LOG(debug) << "        Program: " << Opts.Program;
-  NewArgv[Opts.Arguments.size() + 1] = nullptr;
   for (std::size_t I = 0; I < Opts.Arguments.size(); ++I)
-  {
-    allocCopyString(Opts.Arguments[I], NewArgv, I + 1);
     LOG(debug) << "        Arg "
                << std::setw(log::Logger::digits(Opts.Arguments.size())) << I
                << ": " << Opts.Arguments[I];
-  }
 
   for (const auto& E : Opts.Environment)
   {
     if (!E.second.has_value())
-    {
       LOG(debug) << "        Env unset: " << E.first;
-      CheckedPOSIX([&K = E.first] { return ::unsetenv(K.c_str()); }, -1);
-    }
     else
-    {
       LOG(debug) << "        Env   set: " << E.first << " = " << *E.second;
-      CheckedPOSIX(
-        [&K = E.first, &V = E.second] {
-          return ::setenv(K.c_str(), V->c_str(), 1);
-        },
-        -1);
-    }
   }
 
   if (Opts.CreatePTY)
@@ -109,73 +132,225 @@ std::string Process::thisProcessPath()
     if (Opts.StandardError)
       LOG(debug) << "       stderr: " << *Opts.StandardError;
   }
+}
+
+/// Replaces the standard streams of the current process as requested by
+/// \p Opts.
+///
+/// \returns \p 0, or the \p errno of the failing call.
+///
+/// \note This function is async-signal-safe.
+static int replaceStandardStreams(const Process::SpawnOptions& Opts) noexcept
+{
+  // Replaces the "Original" file descriptor with the new "With" one.
+  auto ReplaceFD = [](raw_fd Original, raw_fd With) {
+    if (With == fd::Invalid)
+    {
+      ::close(Original);
+      return 0;
+    }
+    if (::dup2(With, Original) == -1)
+      return errno;
+    ::close(With);
+    return 0;
+  };
+  int Error = 0;
+  if (Opts.StandardInput && !Error)
+    Error = ReplaceFD(STDIN_FILENO, *Opts.StandardInput);
+  if (Opts.StandardError && !Error)
+    Error = ReplaceFD(STDERR_FILENO, *Opts.StandardError);
+  if (Opts.StandardOutput && !Error)
+    Error = ReplaceFD(STDOUT_FILENO, *Opts.StandardOutput);
+  return Error;
+}
 
+Process::raw_handle Process::thisProcess()
+{
+  return CheckedPOSIXThrow([] { return ::getpid(); }, "getpid()", -1);
+}
+
+std::string Process::thisProcessPath()
+{
+  POD<char[PATH_MAX]> Binary;
+  CheckedPOSIXThrow(
+    [&Binary] { return ::readlink("/proc/self/exe", Binary, PATH_MAX); },
+    "readlink(\"/proc/self/exe\")",
+    -1);
+  return {Binary};
+}
+
+[[noreturn]] void Process::exec(const SpawnOptions& Opts)
+{
+  LOG(debug) << "----- Process::exec() "
+             << "was called -----";
+  logSpawnOptions(Opts);
   LOG(debug) << "----- Process::exec() "
              << "firing... -----";
 
+  ExecImage Image{Opts};
+  int Error = 0;
   if (!Opts.CreatePTY)
+    Error = replaceStandardStreams(Opts);
+  if (!Error)
   {
-    // Replaces the "Original" file descriptor with the new "With" one.
-    auto ReplaceFD = [](raw_fd Original, raw_fd With) {
-      if (With == fd::Invalid)
-        CheckedPOSIX([Original] { return ::close(Original); }, -1);
-      else
-      {
-        CheckedPOSIXThrow([=] { return ::dup2(With, Original); }, "dup2()", -1);
-        CheckedPOSIX([With] { return ::close(With); }, -1);
-      }
-    };
-    if (Opts.StandardInput)
-      ReplaceFD(fd::fileno(stdin), *Opts.StandardInput);
-    if (Opts.StandardError)
-      ReplaceFD(fd::fileno(stderr), *Opts.StandardError);
-    if (Opts.StandardOutput)
-      ReplaceFD(fd::fileno(stdout), *Opts.StandardOutput);
+    ::execvpe(Image.argv()[0], Image.argv(), Image.envp());
+    Error = errno;
+  }
+
+  MONOMUX_TRACE_LOG(LOG(fatal) << "'exec()' failed: " << Error << ' '
+                               << std::strerror(Error));
+  std::_Exit(-SIGCHLD);
+}
+
+namespace
+{
+
+/// The state shared between \p Process::spawn() and the child it creates in
+/// the same memory.
+struct SpawnContext
+{
+  const Process::SpawnOptions* Opts;
+  const ExecImage* Image;
+  /// The slave side of the PTY to set up in the child, if any.
+  raw_fd PtySlave;
+  /// Set by the child to the \p errno of the call that failed before the
+  /// \p exec() could happen.
+  int Error;
+};
+
+/// The body of the child created by \p Process::spawn(). The child runs in the
+/// memory of the parent (which is suspended until the \p exec()), so only
+/// async-signal-safe calls are allowed, and nothing may be allocated.
+int spawnedChild(void* Arg)
+{
+  auto* Ctx = static_cast<SpawnContext*>(Arg);
+
+  // Handlers of the parent must not run in its memory. Ignored signals stay
+  // ignored, as through fork() and exec().
+  for (int Sig = 1; Sig < NSIG; ++Sig)
+  {
+    struct ::sigaction Action;
+    if (::sigaction(Sig, nullptr, &Action) == -1 ||
+        Action.sa_handler == SIG_IGN || Action.sa_handler == SIG_DFL)
+      continue;
+    Action.sa_handler = SIG_DFL;
+    Action.sa_flags = 0;
+    ::sigaction(Sig, &Action, nullptr);
   }
+  // The parent might have blocked signals to receive them through a file
+  // descriptor, but the mask would be inherited through exec().
+  ::sigset_t NoSignals;
+  ::sigemptyset(&NoSignals);
+  ::sigprocmask(SIG_SETMASK, &NoSignals, nullptr);
 
-  auto ExecSuccessful =
-    CheckedPOSIX([NewArgv] { return ::execvp(NewArgv[0], NewArgv); }, -1);
-  if (!ExecSuccessful)
+  if (::setsid() == -1)
   {
-    MONOMUX_TRACE_LOG(LOG(fatal)
-                      << "'exec()' failed: " << ExecSuccessful.getError() << ' '
-                      << ExecSuccessful.getError().message());
+    Ctx->Error = errno;
     std::_Exit(-SIGCHLD);
   }
-  unreachable("::exec() should've started a new process");
+  if (Ctx->PtySlave != fd::Invalid)
+  {
+    if (::login_tty(Ctx->PtySlave) == -1)
+    {
+      Ctx->Error = errno;
+      std::_Exit(-SIGCHLD);
+    }
+  }
+  else if (int Error = replaceStandardStreams(*Ctx->Opts))
+  {
+    Ctx->Error = Error;
+    std::_Exit(-SIGCHLD);
+  }
+
+  ::execvpe(Ctx->Image->argv()[0], Ctx->Image->argv(), Ctx->Image->envp());
+  Ctx->Error = errno;
+  std::_Exit(-SIGCHLD);
 }
 
+} // namespace
+
 Process Process::spawn(const SpawnOptions& Opts)
 {
+  static constexpr std::size_t ChildStackSize = 1 << 16; // 64 KiB
+
+  MONOMUX_TRACE_LOG(LOG(debug) << "----- Process::spawn() -----");
+  MONOMUX_TRACE_LOG(logSpawnOptions(Opts));
+
   std::optional<Pty> PTY;
   if (Opts.CreatePTY)
     PTY.emplace(Pty{});
 
-  raw_handle ForkResult =
-    CheckedPOSIXThrow([] { return ::fork(); }, "fork() failed in spawn()", -1);
-  if (ForkResult != 0)
-  {
-    // We are in the parent.
-    Process P;
-    P.Handle = ForkResult;
-    MONOMUX_TRACE_LOG(LOG(debug) << "PID " << P.Handle << " spawned.");
-
-    if (PTY)
-    {
-      PTY->setupParentSide();
-      P.PTY = std::move(PTY);
-    }
+  // Everything the child needs is prepared here, so it only has to set up its
+  // session and exec().
+  ExecImage Image{Opts};
+  SpawnContext Ctx{&Opts, &Image, PTY ? PTY->raw().get() : fd::Invalid, 0};
+
+  void* Stack = CheckedPOSIXThrow(
+    [] {
+      return ::mmap(nullptr,
+                    ChildStackSize,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                    -1,
+                    0);
+    },
+    "mmap() of the stack in spawn()",
+    MAP_FAILED);
+  ScopeGuard FreeStack{[] {}, [Stack] { ::munmap(Stack, ChildStackSize); }};
+
+  // No handler may run in the child before it resets them.
+  POD<::sigset_t> AllSignals;
+  POD<::sigset_t> OldSignals;
+  ::sigfillset(&AllSignals);
+  ::pthread_sigmask(SIG_SETMASK, &AllSignals, &OldSignals);
+
+  // The parent is suspended until the child exec()s or exits, so the memory is
+  // not copied, no matter how large the parent is.
+  int Flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+  if (Opts.ChildOfParent)
+    Flags |= CLONE_PARENT;
+  auto ForkResult = CheckedPOSIX(
+    [&] {
+      return ::clone(&spawnedChild,
+                     static_cast<char*>(Stack) + ChildStackSize,
+                     Flags,
+                     &Ctx);
+    },
+    -1);
+  ::pthread_sigmask(SIG_SETMASK, &OldSignals, nullptr);
+  if (!ForkResult)
+    throw std::system_error{ForkResult.getError(), "clone() failed in spawn()"};
 
-    return P;
+  Process P;
+  P.Handle = ForkResult.get();
+  if (Ctx.Error)
+  {
+    LOG(error) << "Spawning '" << Opts.Program
+               << "' failed: " << std::strerror(Ctx.Error);
+    // The child had already exited. If it was created as the child of our
+    // parent, only the parent can collect it.
+    if (!Opts.ChildOfParent)
+      P.wait();
+    throw SpawnError{std::error_code{Ctx.Error, std::system_category()},
+                     P.Handle};
   }
+  MONOMUX_TRACE_LOG(LOG(debug) << "PID " << P.Handle << " spawned.");
 
-  // We are in the child.
-  CheckedPOSIXThrow([] { return ::setsid(); }, "setsid()", -1);
   if (PTY)
-    PTY->setupChildrenSide();
+  {
+    PTY->setupParentSide();
+    P.PTY = std::move(PTY);
+  }
 
-  Process::exec(Opts);
-  unreachable("Process::exec() should've replaced the process.");
+  return P;
+}
+
+Process Process::adopt(raw_handle Handle, std::optional<Pty> PTY)
+{
+  Process P;
+  P.Handle = Handle;
+  P.PTY = std::move(PTY);
+  return P;
 }
 
 static std::pair<bool, int> reapAndGetExitCode(Process::raw_handle PID,
@@ -227,6 +402,25 @@ bool Process::reapIfDead()
   return true;
 }
 
+fd Process::openExitWatch() const
+{
+#ifdef SYS_pidfd_open
+  if (Handle == Invalid || Dead)
+    return {};
+
+  auto PidFD = CheckedPOSIX(
+    [this] {
+      return static_cast<raw_fd>(::syscall(SYS_pidfd_open, Handle, 0));
+    },
+    -1);
+  if (PidFD)
+    return PidFD.get();
+  MONOMUX_TRACE_LOG(LOG(debug) << "pidfd_open(" << Handle
+                               << ") failed: " << PidFD.getError().message());
+#endif
+  return {};
+}
+
 void Process::wait()
 {
   if (Handle == Invalid)
@@ -18,6 +18,7 @@
  */
 #include <sstream>
 
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <pty.h>
 #include <unistd.h>
@@ -51,11 +52,28 @@ Pty::Pty()
   LOG(debug) << "Opened " << DeviceName << " (master: " << MasterFD
              << ", slave: " << SlaveFD << ')';
 
+  // Neither side may leak into other processes spawned while the pair is
+  // being set up. (The child's standard streams are duplicates of the slave.)
+  fd::addDescriptorFlag(MasterFD, FD_CLOEXEC);
+  fd::addDescriptorFlag(SlaveFD, FD_CLOEXEC);
+
   Master = MasterFD;
   Slave = SlaveFD;
   Name = DeviceName;
 }
 
+Pty::Pty(fd&& Master, std::string Name)
+  : IsMaster(true), Master(std::move(Master)), Name(std::move(Name))
+{
+  fd::setNonBlockingCloseOnExec(this->Master);
+  makePipes();
+}
+
+Pty Pty::wrapMaster(fd&& Master, std::string Name)
+{
+  return Pty{std::move(Master), std::move(Name)};
+}
+
 void Pty::setupParentSide()
 {
   MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
@@ -67,7 +85,11 @@ void Pty::setupParentSide()
 
   IsMaster = true;
   fd::setNonBlockingCloseOnExec(Master);
+  makePipes();
+}
 
+void Pty::makePipes()
+{
   std::ostringstream InName;
   std::ostringstream OutName;
   InName << "<r:pty:" << name() << '>';
@@ -112,6 +134,24 @@ void Pty::setSize(unsigned short Rows, unsigned short Columns)
     -1);
 }
 
+void Pty::wiggleSize()
+{
+  if (!isMaster())
+    throw std::invalid_argument{"wiggleSize() not allowed on slave device."};
+
+  POD<struct ::winsize> Size;
+  CheckedPOSIXThrow(
+    [RawFD = Master.get(), &Size] { return ::ioctl(RawFD, TIOCGWINSZ, &Size); },
+    "ioctl(PTMX, TIOCGWINSZ /* get window size*/);",
+    -1);
+  MONOMUX_TRACE_LOG(LOG(data) << Master << ": wiggleSize(Rows=" << Size->ws_row
+                              << ", Columns=" << Size->ws_col << ')');
+  // The kernel only signals the foreground process if the size changed.
+  const unsigned short Rows = Size->ws_row;
+  setSize(Rows > 1 ? Rows - 1 : Rows + 1, Size->ws_col);
+  setSize(Rows, Size->ws_col);
+}
+
 } // namespace monomux
 
 #undef LOG_WITH_IDENTIFIER
@@ -0,0 +1,198 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/RecordFile.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/RecordFile")
+
+namespace monomux
+{
+
+void RecordFile::FreeBuffer::operator()(char* Buffer) const noexcept
+{
+  std::free(Buffer); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+RecordFile RecordFile::create(const std::string& Path,
+                              bool Direct,
+                              std::size_t BufferSize)
+{
+  static constexpr fd::flag_t Flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  static constexpr ::mode_t Mode = 0644;
+  if (Direct)
+  {
+    auto Handle = CheckedPOSIX(
+      [&Path] { return ::open(Path.c_str(), Flags | O_DIRECT, Mode); }, -1);
+    if (Handle)
+      return RecordFile{fd{Handle.get()}, true, BufferSize};
+    if (Handle.getError() != std::errc::invalid_argument)
+      throw std::system_error{Handle.getError(), "open(" + Path + ")"};
+    LOG(warn) << "The file system of " << Path
+              << " does not support direct I/O, writing through the cache";
+  }
+
+  fd Handle = CheckedPOSIXThrow(
+    [&Path] { return ::open(Path.c_str(), Flags, Mode); },
+    "open(" + Path + ")",
+    -1);
+  return RecordFile{std::move(Handle), false, BufferSize};
+}
+
+RecordFile::RecordFile(fd Handle, std::size_t BufferSize)
+  : RecordFile(std::move(Handle), false, BufferSize)
+{}
+
+RecordFile::RecordFile(fd Handle, bool Direct, std::size_t BufferSize)
+  : Handle(std::move(Handle)), Direct(Direct),
+    Capacity(std::max((BufferSize + BlockSize - 1) / BlockSize * BlockSize,
+                      BlockSize))
+{
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  Buffer.reset(static_cast<char*>(std::aligned_alloc(BlockSize, Capacity)));
+  if (!Buffer)
+    throw std::bad_alloc{};
+
+  POD<struct ::stat> Stat;
+  if (CheckedPOSIX(
+        [this, &Stat] { return ::fstat(this->Handle.get(), &Stat); }, -1))
+    Regular = S_ISREG(Stat->st_mode);
+  if (Regular)
+    Written = static_cast<std::uint64_t>(
+      CheckedPOSIX([this] { return ::lseek(this->Handle.get(), 0, SEEK_CUR); },
+                   -1)
+        .get());
+}
+
+RecordFile::~RecordFile()
+{
+  if (!Handle.has())
+    return;
+  try
+  {
+    close();
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Failed to write the end of the recording: " << Err.what();
+  }
+}
+
+void RecordFile::append(std::string_view Data)
+{
+  while (!Data.empty())
+  {
+    const std::size_t Chunk = std::min(Data.size(), Capacity - Used);
+    std::memcpy(Buffer.get() + Used, Data.data(), Chunk);
+    Used += Chunk;
+    Data.remove_prefix(Chunk);
+    if (Used == Capacity)
+      write(Used);
+  }
+}
+
+void RecordFile::flush()
+{
+  write(Direct ? Used / BlockSize * BlockSize : Used);
+}
+
+void RecordFile::close()
+{
+  if (!Handle.has())
+    return;
+
+  const std::uint64_t Size = size();
+  if (Direct && Used % BlockSize)
+  {
+    // The last write must cover a whole block, the padding is trimmed below.
+    const std::size_t Padded = (Used + BlockSize - 1) / BlockSize * BlockSize;
+    std::memset(Buffer.get() + Used, 0, Padded - Used);
+    Used = Padded;
+  }
+  write(Used);
+
+  if (Regular)
+    CheckedPOSIXThrow(
+      [this, Size] {
+        return ::ftruncate(Handle.get(), static_cast<::off_t>(Size));
+      },
+      "ftruncate()",
+      -1);
+  fd::close(Handle.release());
+}
+
+void RecordFile::write(std::size_t Bytes)
+{
+  if (!Bytes)
+    return;
+
+  if (Regular && Written + Bytes > Allocated)
+  {
+    // Allocating the storage in large extents keeps the file contiguous on
+    // disk. The size of the file only grows with the written data.
+    Allocated = std::max(Allocated, Written);
+    if (CheckedPOSIX(
+          [this] {
+            return ::fallocate(Handle.get(),
+                               FALLOC_FL_KEEP_SIZE,
+                               static_cast<::off_t>(Allocated),
+                               static_cast<::off_t>(PreallocateSize));
+          },
+          -1))
+      Allocated += PreallocateSize;
+    else
+      // Do not try again, e.g. if the file system does not support it.
+      Allocated = static_cast<std::uint64_t>(-1);
+  }
+
+  std::size_t Done = 0;
+  while (Done < Bytes)
+  {
+    auto Result = CheckedPOSIX(
+      [this, Done, Bytes] {
+        return ::write(Handle.get(), Buffer.get() + Done, Bytes - Done);
+      },
+      -1);
+    if (!Result)
+    {
+      if (Result.getError() == std::errc::interrupted)
+        continue;
+      throw std::system_error{Result.getError(), "write()"};
+    }
+    Done += static_cast<std::size_t>(Result.get());
+  }
+
+  Written += Bytes;
+  Used -= Bytes;
+  std::memmove(Buffer.get(), Buffer.get() + Bytes, Used);
+}
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <cstring>
+
+#include "monomux/system/Search.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define MONOMUX_SEARCH_X86
+#endif
+
+namespace monomux::search
+{
+
+namespace
+{
+
+/// \returns the position of \p Needle in \p Haystack, starting at \p From.
+std::size_t findScalar(std::string_view Haystack,
+                       std::string_view Needle,
+                       std::size_t From = 0) noexcept
+{
+  return Haystack.find(Needle, From);
+}
+
+#ifdef MONOMUX_SEARCH_X86
+/// \returns whether \p Needle, whose first and last bytes had already matched
+/// at \p Candidate, occurs there entirely.
+bool matchesAt(const char* Candidate, std::string_view Needle) noexcept
+{
+  return std::memcmp(Candidate + 1, Needle.data() + 1, Needle.size() - 2) == 0;
+}
+
+/// \returns the position of the first candidate in \p Mask, the bits of which
+/// are the positions from \p Block whose first and last bytes matched, that
+/// \p Needle fully matches at, or \p npos.
+std::size_t verifyCandidates(std::string_view Haystack,
+                             std::string_view Needle,
+                             std::size_t Block,
+                             std::uint32_t Mask) noexcept
+{
+  for (; Mask; Mask &= Mask - 1)
+  {
+    const std::size_t Candidate = Block + __builtin_ctz(Mask);
+    if (matchesAt(Haystack.data() + Candidate, Needle))
+      return Candidate;
+  }
+  return std::string_view::npos;
+}
+
+std::size_t findSSE2(std::string_view Haystack,
+                     std::string_view Needle) noexcept
+{
+  constexpr std::size_t Width = sizeof(__m128i);
+  const std::size_t Last = Needle.size() - 1;
+  const __m128i First = _mm_set1_epi8(Needle.front());
+  const __m128i Final = _mm_set1_epi8(Needle.back());
+
+  std::size_t Block = 0;
+  for (; Block + Last + Width <= Haystack.size(); Block += Width)
+  {
+    const __m128i Begins = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(Haystack.data() + Block));
+    const __m128i Ends = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(Haystack.data() + Block + Last));
+    const auto Mask = static_cast<std::uint32_t>(
+      _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(Begins, First),
+                                      _mm_cmpeq_epi8(Ends, Final))));
+    if (!Mask)
+      continue;
+    if (std::size_t Match = verifyCandidates(Haystack, Needle, Block, Mask);
+        Match != std::string_view::npos)
+      return Match;
+  }
+  return findScalar(Haystack, Needle, Block);
+}
+
+__attribute__((target("avx2"))) std::size_t
+findAVX2(std::string_view Haystack, std::string_view Needle) noexcept
+{
+  constexpr std::size_t Width = sizeof(__m256i);
+  const std::size_t Last = Needle.size() - 1;
+  const __m256i First = _mm256_set1_epi8(Needle.front());
+  const __m256i Final = _mm256_set1_epi8(Needle.back());
+
+  std::size_t Block = 0;
+  for (; Block + Last + Width <= Haystack.size(); Block += Width)
+  {
+    const __m256i Begins = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(Haystack.data() + Block));
+    const __m256i Ends = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(Haystack.data() + Block + Last));
+    const auto Mask = static_cast<std::uint32_t>(
+      _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(Begins, First),
+                                            _mm256_cmpeq_epi8(Ends, Final))));
+    if (!Mask)
+      continue;
+    if (std::size_t Match = verifyCandidates(Haystack, Needle, Block, Mask);
+        Match != std::string_view::npos)
+      return Match;
+  }
+  // (The tail is shorter than a vector, which the SSE2 search can still
+  // cover in part.)
+  if (std::size_t Match = findSSE2(Haystack.substr(Block), Needle);
+      Match != std::string_view::npos)
+    return Block + Match;
+  return std::string_view::npos;
+}
+#endif
+
+Implementation detect() noexcept
+{
+#ifdef MONOMUX_SEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return Implementation::AVX2;
+  return Implementation::SSE2;
+#else
+  return Implementation::Scalar;
+#endif
+}
+
+} // namespace
+
+Implementation best() noexcept
+{
+  static const Implementation Best = detect();
+  return Best;
+}
+
+bool supported(Implementation Impl) noexcept
+{
+  return Impl <= best();
+}
+
+std::size_t find(std::string_view Haystack, std::string_view Needle) noexcept
+{
+  return find(Haystack, Needle, best());
+}
+
+std::size_t find(std::string_view Haystack,
+                 std::string_view Needle,
+                 Implementation Impl) noexcept
+{
+  if (Needle.size() > Haystack.size())
+    return std::string_view::npos;
+  if (Needle.size() < 2)
+    // (Single bytes are best found by the C library.)
+    return findScalar(Haystack, Needle);
+
+#ifdef MONOMUX_SEARCH_X86
+  if (supported(Impl))
+    switch (Impl)
+    {
+      case Implementation::Scalar:
+        break;
+      case Implementation::SSE2:
+        return findSSE2(Haystack, Needle);
+      case Implementation::AVX2:
+        return findAVX2(Haystack, Needle);
+    }
+#else
+  (void)Impl;
+#endif
+  return findScalar(Haystack, Needle);
+}
+
+} // namespace monomux::search
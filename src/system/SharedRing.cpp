@@ -0,0 +1,297 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/SharedRing.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/SharedRing")
+
+namespace monomux
+{
+
+/// The control block at the beginning of the shared memory. The positions are
+/// absolute, counting every byte ever written, and are reduced to an offset
+/// into the data area only when accessing it.
+struct SharedRing::Header
+{
+  /// The position up to which the producer had written. Changed only by the
+  /// producer.
+  alignas(64) std::atomic<std::uint64_t> Head;
+  /// The position up to which the consumer had read. Changed only by the
+  /// consumer.
+  alignas(64) std::atomic<std::uint64_t> Tail;
+  /// Set by the consumer if it found the ring empty, and waits for the data
+  /// doorbell.
+  alignas(64) std::atomic<std::uint32_t> ConsumerWaiting;
+  /// Set by the producer if it found the ring full, and waits for the space
+  /// doorbell.
+  std::atomic<std::uint32_t> ProducerWaiting;
+  std::uint64_t Capacity;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                std::atomic<std::uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must not rely on locks!");
+
+/// The size of the area before the data, which keeps the data page-aligned.
+static constexpr std::size_t HeaderSize = 4096;
+
+static fd makeDoorbell()
+{
+  return fd{CheckedPOSIXThrow(
+    [] { return ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); }, "eventfd()", -1)};
+}
+
+static void ring(raw_fd Doorbell) noexcept
+{
+  std::uint64_t One = 1;
+  CheckedPOSIX(
+    [Doorbell, &One] { return ::write(Doorbell, &One, sizeof(One)); }, -1);
+}
+
+static void clear(raw_fd Doorbell) noexcept
+{
+  std::uint64_t Count;
+  CheckedPOSIX(
+    [Doorbell, &Count] { return ::read(Doorbell, &Count, sizeof(Count)); }, -1);
+}
+
+SharedRing::SharedRing(fd Memory,
+                       fd DataBell,
+                       fd SpaceBell,
+                       std::size_t Capacity)
+  : Memory(std::move(Memory)), DataBell(std::move(DataBell)),
+    SpaceBell(std::move(SpaceBell)), Capacity(Capacity)
+{}
+
+SharedRing SharedRing::create(std::size_t Capacity)
+{
+  if (Capacity == 0 || (Capacity & (Capacity - 1)) != 0)
+    throw std::invalid_argument{"Capacity must be a power of 2."};
+
+  fd Memory{CheckedPOSIXThrow(
+    [] { return ::memfd_create("monomux-ring", MFD_CLOEXEC); },
+    "memfd_create()",
+    -1)};
+  CheckedPOSIXThrow(
+    [&Memory, Capacity] {
+      return ::ftruncate(Memory.get(),
+                         static_cast<::off_t>(HeaderSize + Capacity));
+    },
+    "ftruncate()",
+    -1);
+
+  SharedRing Ring{std::move(Memory), makeDoorbell(), makeDoorbell(), Capacity};
+  Ring.map();
+  static_assert(sizeof(Header) <= HeaderSize);
+  Header* H = new (Ring.Mapping) Header{};
+  H->Capacity = Capacity;
+  // The consumer has not seen any data yet, so it must be woken up for the
+  // first write.
+  H->ConsumerWaiting.store(1);
+
+  MONOMUX_TRACE_LOG(LOG(debug) << "Created ring of " << Capacity
+                               << " bytes as " << Ring.memory());
+  return Ring;
+}
+
+SharedRing SharedRing::open(fd Memory, fd DataBell, fd SpaceBell)
+{
+  POD<struct ::stat> Stat;
+  CheckedPOSIXThrow(
+    [&Memory, &Stat] { return ::fstat(Memory.get(), &Stat); }, "fstat()", -1);
+  const auto Size = static_cast<std::size_t>(Stat->st_size);
+  if (Size <= HeaderSize)
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "Shared memory is too small for a ring"};
+
+  const std::size_t Capacity = Size - HeaderSize;
+  SharedRing Ring{
+    std::move(Memory), std::move(DataBell), std::move(SpaceBell), Capacity};
+  Ring.map();
+  if (Ring.header().Capacity != Capacity ||
+      (Capacity & (Capacity - 1)) != 0)
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "Shared memory is not laid out as a ring"};
+  return Ring;
+}
+
+SharedRing::SharedRing(SharedRing&& RHS) noexcept
+  : Memory(std::move(RHS.Memory)), DataBell(std::move(RHS.DataBell)),
+    SpaceBell(std::move(RHS.SpaceBell)), Capacity(RHS.Capacity),
+    Mapping(std::exchange(RHS.Mapping, nullptr))
+{}
+
+SharedRing& SharedRing::operator=(SharedRing&& RHS) noexcept
+{
+  if (this == &RHS)
+    return *this;
+  unmap();
+  Memory = std::move(RHS.Memory);
+  DataBell = std::move(RHS.DataBell);
+  SpaceBell = std::move(RHS.SpaceBell);
+  Capacity = RHS.Capacity;
+  Mapping = std::exchange(RHS.Mapping, nullptr);
+  return *this;
+}
+
+SharedRing::~SharedRing() noexcept { unmap(); }
+
+void SharedRing::map()
+{
+  Mapping = CheckedPOSIXThrow(
+    [this] {
+      return ::mmap(nullptr,
+                    HeaderSize + Capacity,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    Memory.get(),
+                    0);
+    },
+    "mmap()",
+    MAP_FAILED);
+}
+
+void SharedRing::unmap() noexcept
+{
+  if (!Mapping)
+    return;
+  CheckedPOSIX([this] { return ::munmap(Mapping, HeaderSize + Capacity); },
+               -1);
+  Mapping = nullptr;
+}
+
+SharedRing::Header& SharedRing::header() const noexcept
+{
+  return *static_cast<Header*>(Mapping);
+}
+
+char* SharedRing::data() const noexcept
+{
+  return static_cast<char*>(Mapping) + HeaderSize;
+}
+
+std::size_t SharedRing::size() const noexcept
+{
+  const Header& H = header();
+  return H.Head.load(std::memory_order_acquire) -
+         H.Tail.load(std::memory_order_acquire);
+}
+
+std::size_t SharedRing::write(std::string_view Data) noexcept
+{
+  Header& H = header();
+  const std::uint64_t Head = H.Head.load(std::memory_order_relaxed);
+  // The consumer owns the tail, so it is not trusted to be behind the head.
+  const std::uint64_t Tail = H.Tail.load(std::memory_order_acquire);
+  if (Head - Tail > Capacity)
+    return 0;
+  const std::size_t Size =
+    std::min<std::size_t>(Data.size(), Capacity - (Head - Tail));
+  if (!Size)
+    return 0;
+
+  const std::size_t Offset = Head & (Capacity - 1);
+  const std::size_t First = std::min(Size, Capacity - Offset);
+  std::memcpy(data() + Offset, Data.data(), First);
+  std::memcpy(data(), Data.data() + First, Size - First);
+
+  // Publishing the data and checking whether the consumer sleeps must not be
+  // reordered, see peek().
+  H.Head.store(Head + Size, std::memory_order_seq_cst);
+  if (H.ConsumerWaiting.exchange(0, std::memory_order_seq_cst))
+    ring(DataBell.get());
+  return Size;
+}
+
+bool SharedRing::corrupt() const noexcept
+{
+  const Header& H = header();
+  return H.Head.load(std::memory_order_acquire) -
+           H.Tail.load(std::memory_order_acquire) >
+         Capacity;
+}
+
+bool SharedRing::awaitSpace() noexcept
+{
+  Header& H = header();
+  H.ProducerWaiting.store(1, std::memory_order_seq_cst);
+  // The consumer might have freed up space before it could see the flag.
+  return H.Head.load(std::memory_order_relaxed) -
+           H.Tail.load(std::memory_order_seq_cst) ==
+         Capacity;
+}
+
+std::string_view SharedRing::peek() noexcept
+{
+  Header& H = header();
+  const std::uint64_t Tail = H.Tail.load(std::memory_order_relaxed);
+  std::uint64_t Head = H.Head.load(std::memory_order_acquire);
+  if (Head == Tail)
+  {
+    // Announce the wait before going to sleep, and check once more. Either the
+    // producer sees the announcement after publishing its data, and rings the
+    // doorbell, or the data is seen here.
+    H.ConsumerWaiting.store(1, std::memory_order_seq_cst);
+    Head = H.Head.load(std::memory_order_seq_cst);
+    if (Head == Tail)
+      return {};
+  }
+
+  if (Head - Tail > Capacity)
+    // The producer owns the head, and it is not trusted either.
+    return {};
+
+  const std::size_t Offset = Tail & (Capacity - 1);
+  return {data() + Offset,
+          std::min<std::size_t>(Head - Tail, Capacity - Offset)};
+}
+
+void SharedRing::consume(std::size_t Bytes) noexcept
+{
+  Header& H = header();
+  const std::uint64_t Tail = H.Tail.load(std::memory_order_relaxed);
+  H.Tail.store(Tail + Bytes, std::memory_order_seq_cst);
+  if (H.ProducerWaiting.exchange(0, std::memory_order_seq_cst))
+    ring(SpaceBell.get());
+}
+
+void SharedRing::clearDataBell() noexcept { clear(DataBell.get()); }
+
+void SharedRing::clearSpaceBell() noexcept { clear(SpaceBell.get()); }
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,241 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "monomux/Allocation.hpp"
+
+#include "monomux/system/SlabPool.hpp"
+
+namespace monomux
+{
+
+namespace
+{
+
+constexpr std::size_t log2(std::size_t N) noexcept
+{
+  std::size_t R = 0;
+  while (N >>= 1)
+    ++R;
+  return R;
+}
+
+constexpr std::size_t ClassCount =
+  log2(SlabPool::CachedSizeMax) - log2(SlabPool::MinSize) + 1;
+
+/// The number of bytes in heap-allocated slabs a thread caches per class.
+constexpr std::size_t CachedHeapBytesMax = 1ULL << 20; // 1 MiB
+/// The number of slabs a thread caches per class.
+constexpr std::size_t CachedSlabsMax = 64;
+/// The number of mapped slabs a thread caches per class. These do not keep
+/// memory resident.
+constexpr std::size_t CachedMappedSlabsMax = 4;
+
+std::atomic<std::size_t> Allocations;
+std::atomic<std::size_t> Reuses;
+std::atomic<std::size_t> Releases;
+std::atomic<std::size_t> UsedBytes;
+std::atomic<std::size_t> CachedSlabs;
+std::atomic<std::size_t> CachedBytes;
+
+std::size_t classIndex(std::size_t Size) noexcept
+{
+  return log2(Size) - log2(SlabPool::MinSize);
+}
+
+std::size_t cacheLimit(std::size_t Size) noexcept
+{
+  if (Size >= SlabPool::MappedSize)
+    return CachedMappedSlabsMax;
+  return std::min(CachedSlabsMax, CachedHeapBytesMax / Size);
+}
+
+void* obtain(std::size_t Size)
+{
+  void* Ptr;
+  if (Size >= SlabPool::MappedSize)
+  {
+    Ptr = ::mmap(nullptr,
+                 Size,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1,
+                 0);
+    if (Ptr == MAP_FAILED)
+      throw std::bad_alloc{};
+  }
+  else
+  {
+    Ptr = std::malloc(Size);
+    if (!Ptr)
+      throw std::bad_alloc{};
+  }
+
+  Allocations.fetch_add(1, std::memory_order_relaxed);
+  return Ptr;
+}
+
+void giveBack(void* Ptr, std::size_t Size) noexcept
+{
+  if (Size >= SlabPool::MappedSize)
+    ::munmap(Ptr, Size);
+  else
+    std::free(Ptr);
+  Releases.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// The slabs freed by the current thread.
+struct Cache
+{
+  std::array<std::vector<void*>, ClassCount> Slabs;
+
+  ~Cache();
+
+  /// Returns every cached slab to the system.
+  void clear() noexcept;
+};
+
+/// Set when the cache of the thread is destroyed, as objects with static
+/// storage might still free their buffers afterwards.
+thread_local bool CacheDestroyed = false;
+
+Cache::~Cache()
+{
+  CacheDestroyed = true;
+  clear();
+}
+
+void Cache::clear() noexcept
+{
+  for (std::size_t I = 0; I < Slabs.size(); ++I)
+  {
+    const std::size_t Size = SlabPool::MinSize << I;
+    for (void* Ptr : Slabs.at(I))
+    {
+      giveBack(Ptr, Size);
+      CachedSlabs.fetch_sub(1, std::memory_order_relaxed);
+      CachedBytes.fetch_sub(Size, std::memory_order_relaxed);
+    }
+    Slabs.at(I).clear();
+  }
+}
+
+/// \returns the cache of the current thread, or \p nullptr if it is gone.
+Cache* cache() noexcept
+{
+  thread_local Cache C;
+  return CacheDestroyed ? nullptr : &C;
+}
+
+} // namespace
+
+std::size_t SlabPool::sizeClass(std::size_t Bytes) noexcept
+{
+  std::size_t Size = MinSize;
+  while (Size < Bytes)
+    Size <<= 1;
+  return Size;
+}
+
+void* SlabPool::allocate(std::size_t Bytes)
+{
+  const std::size_t Size = sizeClass(Bytes);
+  void* Ptr = nullptr;
+  if (Cache* C = Size <= CachedSizeMax ? cache() : nullptr)
+    if (auto& Slabs = C->Slabs.at(classIndex(Size)); !Slabs.empty())
+    {
+      Ptr = Slabs.back();
+      Slabs.pop_back();
+      Reuses.fetch_add(1, std::memory_order_relaxed);
+      CachedSlabs.fetch_sub(1, std::memory_order_relaxed);
+      CachedBytes.fetch_sub(Size, std::memory_order_relaxed);
+    }
+  if (!Ptr)
+    Ptr = obtain(Size);
+
+  UsedBytes.fetch_add(Size, std::memory_order_relaxed);
+  if constexpr (alloc::enabled())
+    // The slabs are only used by the rings of the channels.
+    alloc::account(alloc::Tag::Channel, Size);
+  return Ptr;
+}
+
+void SlabPool::deallocate(void* Ptr, std::size_t Bytes) noexcept
+{
+  if (!Ptr)
+    return;
+
+  const std::size_t Size = sizeClass(Bytes);
+  UsedBytes.fetch_sub(Size, std::memory_order_relaxed);
+  if constexpr (alloc::enabled())
+    alloc::release(alloc::Tag::Channel, Size);
+  Cache* C = Size <= CachedSizeMax ? cache() : nullptr;
+  if (!C || C->Slabs.at(classIndex(Size)).size() >= cacheLimit(Size))
+  {
+    giveBack(Ptr, Size);
+    return;
+  }
+
+  try
+  {
+    C->Slabs.at(classIndex(Size)).push_back(Ptr);
+  }
+  catch (const std::bad_alloc&)
+  {
+    giveBack(Ptr, Size);
+    return;
+  }
+  if (Size >= MappedSize)
+    // Keep the mapping, but not the memory behind it.
+    (void)::madvise(Ptr, Size, MADV_DONTNEED);
+  CachedSlabs.fetch_add(1, std::memory_order_relaxed);
+  CachedBytes.fetch_add(Size, std::memory_order_relaxed);
+}
+
+void SlabPool::trim() noexcept
+{
+  if (Cache* C = cache())
+    C->clear();
+}
+
+std::size_t SlabPool::usedBytes() noexcept
+{
+  return UsedBytes.load(std::memory_order_relaxed);
+}
+
+SlabPool::Statistics SlabPool::statistics() noexcept
+{
+  Statistics S;
+  S.Allocations = Allocations.load(std::memory_order_relaxed);
+  S.Reuses = Reuses.load(std::memory_order_relaxed);
+  S.Releases = Releases.load(std::memory_order_relaxed);
+  S.UsedBytes = usedBytes();
+  S.CachedSlabs = CachedSlabs.load(std::memory_order_relaxed);
+  S.CachedBytes = CachedBytes.load(std::memory_order_relaxed);
+  return S;
+}
+
+} // namespace monomux
@@ -17,7 +17,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <cstdio>
+#include <cstring>
+#include <stdexcept>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -36,10 +39,18 @@ namespace monomux
 Socket::Socket(fd Handle, std::string Identifier, bool NeedsCleanup)
   : BufferedChannel(
       std::move(Handle), std::move(Identifier), NeedsCleanup, BUFSIZ, BUFSIZ)
-{}
+{
+  setStaticTransport(StaticTransport::Socket);
+}
 
-std::size_t Socket::optimalReadSize() const noexcept { return BUFSIZ; }
-std::size_t Socket::optimalWriteSize() const noexcept { return BUFSIZ; }
+std::size_t Socket::optimalReadSize() const noexcept
+{
+  return transport::Socket::ChunkSize;
+}
+std::size_t Socket::optimalWriteSize() const noexcept
+{
+  return transport::Socket::ChunkSize;
+}
 
 Socket Socket::create(std::string Path, bool InheritInChild)
 {
@@ -117,6 +128,16 @@ Socket Socket::wrap(fd&& FD, std::string Identifier)
   return S;
 }
 
+Socket Socket::adopt(fd&& FD, std::string Path)
+{
+  LOG(debug) << "Adopted '" << Path << "' as FD " << FD.get();
+
+  fd::setNonBlockingCloseOnExec(FD);
+  Socket S{std::move(FD), std::move(Path), true};
+  S.Owning = true;
+  return S;
+}
+
 Socket::~Socket() noexcept
 {
   if (needsCleanup())
@@ -158,9 +179,10 @@ std::optional<Socket> Socket::accept(std::error_code* Error, bool* Recoverable)
 
   auto MaybeClient = CheckedPOSIX(
     [this, &SocketAddr, &SocketAddrLen] {
-      return ::accept(raw(),
-                      reinterpret_cast<struct ::sockaddr*>(&SocketAddr),
-                      &SocketAddrLen);
+      return ::accept4(raw(),
+                       reinterpret_cast<struct ::sockaddr*>(&SocketAddr),
+                       &SocketAddrLen,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
     },
     -1);
   if (!MaybeClient)
@@ -178,8 +200,11 @@ std::optional<Socket> Socket::accept(std::error_code* Error, bool* Recoverable)
         << MaybeClient.getError().message();
       ConsiderRecoverable = true;
     }
-    else if (EC == std::errc::resource_unavailable_try_again /* EAGAIN */ ||
-             EC == std::errc::interrupted /* EINTR */ ||
+    else if (EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+      // The queue of pending connections ran empty, which is how accepting in a
+      // loop ends.
+      MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace) << "No more clients.");
+    else if (EC == std::errc::interrupted /* EINTR */ ||
              EC == std::errc::connection_aborted /* ECONNABORTED */ ||
              static_cast<int>(EC) != 0)
     {
@@ -200,20 +225,186 @@ std::optional<Socket> Socket::accept(std::error_code* Error, bool* Recoverable)
   return Socket::wrap(MaybeClient.get(), std::move(ClientPath));
 }
 
-std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
+std::optional<::pid_t> Socket::peerProcess() const noexcept
+{
+  POD<struct ::ucred> Credentials;
+  ::socklen_t Size = sizeof(struct ::ucred);
+  auto Result = CheckedPOSIX(
+    [this, &Credentials, &Size] {
+      return ::getsockopt(raw(), SOL_SOCKET, SO_PEERCRED, &Credentials, &Size);
+    },
+    -1);
+  if (!Result || !Credentials->pid)
+    return std::nullopt;
+  return Credentials->pid;
+}
+
+void Socket::sendFDs(const std::vector<raw_fd>& FDs, std::string_view Data)
+{
+  if (hasBufferedWrite())
+    throw std::logic_error{"Sending file descriptors behind buffered data."};
+
+  char Payload = 0;
+  if (Data.empty())
+    Data = std::string_view{&Payload, sizeof(Payload)};
+  POD<::iovec> IOV;
+  IOV->iov_base = const_cast<char*>(Data.data());
+  IOV->iov_len = Data.size();
+
+  const std::size_t FDsSize = FDs.size() * sizeof(raw_fd);
+  std::vector<char> Control(CMSG_SPACE(FDsSize));
+  POD<::msghdr> Msg;
+  Msg->msg_iov = &IOV;
+  Msg->msg_iovlen = 1;
+  Msg->msg_control = Control.data();
+  Msg->msg_controllen = Control.size();
+
+  ::cmsghdr* Header = CMSG_FIRSTHDR(&Msg);
+  Header->cmsg_level = SOL_SOCKET;
+  Header->cmsg_type = SCM_RIGHTS;
+  Header->cmsg_len = CMSG_LEN(FDsSize);
+  std::memcpy(CMSG_DATA(Header), FDs.data(), FDsSize);
+
+  std::size_t SentBytes = 0;
+  while (true)
+  {
+    auto Sent = CheckedPOSIX(
+      [this, &Msg] { return ::sendmsg(raw(), &Msg, MSG_NOSIGNAL); }, -1);
+    if (Sent)
+    {
+      SentBytes = Sent.get();
+      break;
+    }
+    if (Sent.getError() == std::errc::interrupted /* EINTR */)
+      continue;
+
+    LOG_WITH_IDENTIFIER(error) << "Failed to send file descriptors";
+    throw std::system_error{Sent.getError(), "sendmsg()"};
+  }
+  if (SentBytes < Data.size() && Data.data() != &Payload)
+    // The descriptors went with the first byte already.
+    write(Data.substr(SentBytes));
+  MONOMUX_TRACE_LOG(LOG_WITH_IDENTIFIER(trace)
+                    << "Sent " << FDs.size() << " file descriptors");
+}
+
+std::vector<fd> Socket::receiveFDs(std::size_t Count)
+{
+  if (hasBufferedRead())
+    throw std::logic_error{"Receiving file descriptors behind buffered data."};
+
+  char Payload = 0;
+  POD<::iovec> IOV;
+  IOV->iov_base = &Payload;
+  IOV->iov_len = sizeof(Payload);
+
+  std::vector<char> Control(CMSG_SPACE(Count * sizeof(raw_fd)));
+  POD<::msghdr> Msg;
+  Msg->msg_iov = &IOV;
+  Msg->msg_iovlen = 1;
+  Msg->msg_control = Control.data();
+  Msg->msg_controllen = Control.size();
+
+  while (true)
+  {
+    auto Received = CheckedPOSIX(
+      [this, &Msg] { return ::recvmsg(raw(), &Msg, MSG_CMSG_CLOEXEC); }, -1);
+    if (Received)
+    {
+      if (Received.get() == 0)
+      {
+        LOG_WITH_IDENTIFIER(error) << "Disconnected";
+        setFailed();
+        throw std::system_error{
+          std::make_error_code(std::errc::connection_reset), "recvmsg()"};
+      }
+      break;
+    }
+    if (Received.getError() == std::errc::interrupted /* EINTR */)
+      continue;
+
+    LOG_WITH_IDENTIFIER(error) << "Failed to receive file descriptors";
+    throw std::system_error{Received.getError(), "recvmsg()"};
+  }
+
+  // The descriptors are owned by the process as soon as they arrived, so they
+  // must be wrapped even if there are more than expected.
+  std::vector<fd> FDs;
+  for (::cmsghdr* Header = CMSG_FIRSTHDR(&Msg); Header;
+       Header = CMSG_NXTHDR(&Msg, Header))
+  {
+    if (Header->cmsg_level != SOL_SOCKET || Header->cmsg_type != SCM_RIGHTS)
+      continue;
+    const std::size_t N = (Header->cmsg_len - CMSG_LEN(0)) / sizeof(raw_fd);
+    for (std::size_t I = 0; I < N; ++I)
+    {
+      raw_fd FD;
+      std::memcpy(&FD, CMSG_DATA(Header) + I * sizeof(raw_fd), sizeof(FD));
+      FDs.emplace_back(FD);
+    }
+  }
+  if (Msg->msg_flags & MSG_CTRUNC)
+    throw std::system_error{std::make_error_code(std::errc::message_size),
+                            "Received more file descriptors than expected"};
+  return FDs;
+}
+
+void Socket::setAcceptFDs(bool AcceptFDs) noexcept
 {
-  static constexpr std::size_t BufferSize = BUFSIZ;
+  this->AcceptFDs = AcceptFDs;
+  // The descriptors are only kept by the virtual implementation.
+  setStaticTransport(AcceptFDs ? StaticTransport::None
+                               : StaticTransport::Socket);
+}
 
-  std::string Return;
-  Return.reserve(Bytes);
+std::vector<fd> Socket::takeReceivedFDs() noexcept
+{
+  return std::exchange(ReceivedFDs, {});
+}
 
-  POD<char[BufferSize]> RawBuffer;
-  if (Bytes > BufferSize)
-    Bytes = BufferSize;
+::ssize_t Socket::receiveWithFDs(::iovec* Buffers, std::size_t Count)
+{
+  static constexpr std::size_t MaxFDs = 4;
+  alignas(::cmsghdr) char Control[CMSG_SPACE(MaxFDs * sizeof(raw_fd))];
+  POD<::msghdr> Msg;
+  Msg->msg_iov = Buffers;
+  Msg->msg_iovlen = Count;
+  Msg->msg_control = Control;
+  Msg->msg_controllen = sizeof(Control);
+
+  ::ssize_t Received = ::recvmsg(raw(), &Msg, MSG_CMSG_CLOEXEC);
+  if (Received <= 0)
+    return Received;
+
+  for (::cmsghdr* Header = CMSG_FIRSTHDR(&Msg); Header;
+       Header = CMSG_NXTHDR(&Msg, Header))
+  {
+    if (Header->cmsg_level != SOL_SOCKET || Header->cmsg_type != SCM_RIGHTS)
+      continue;
+    const std::size_t N = (Header->cmsg_len - CMSG_LEN(0)) / sizeof(raw_fd);
+    for (std::size_t I = 0; I < N; ++I)
+    {
+      raw_fd FD;
+      std::memcpy(&FD, CMSG_DATA(Header) + I * sizeof(raw_fd), sizeof(FD));
+      ReceivedFDs.emplace_back(FD);
+    }
+  }
+  if (Msg->msg_flags & MSG_CTRUNC)
+    LOG_WITH_IDENTIFIER(warn) << "Received file descriptors were truncated";
+  return Received;
+}
 
+std::size_t
+Socket::readIntoImpl(char* Destination, std::size_t Capacity, bool& Continue)
+{
   auto ReadBytes = CheckedPOSIX(
-    [FD = Handle.get(), Bytes, &RawBuffer] {
-      return ::recv(FD, &RawBuffer, Bytes, 0);
+    [this, Destination, Capacity] {
+      if (!AcceptFDs)
+        return ::recv(raw(), Destination, Capacity, 0);
+      POD<::iovec> IOV;
+      IOV->iov_base = Destination;
+      IOV->iov_len = Capacity;
+      return receiveWithFDs(&IOV, 1);
     },
     -1);
   if (!ReadBytes)
@@ -223,14 +414,14 @@ std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
     {
       // Not an error, continue.
       Continue = true;
-      return {};
+      return 0;
     }
     if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
         EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
     {
       // No more data left in the stream.
       Continue = false;
-      return {};
+      return 0;
     }
 
     LOG_WITH_IDENTIFIER(error) << "Read error";
@@ -239,7 +430,6 @@ std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
     throw std::system_error{std::make_error_code(EC)};
   }
 
-  Return.append(RawBuffer, ReadBytes.get());
   Continue = true;
   if (ReadBytes.get() == 0)
   {
@@ -247,7 +437,7 @@ std::string Socket::readImpl(std::size_t Bytes, bool& Continue)
     setFailed();
     Continue = false;
   }
-  return Return;
+  return ReadBytes.get();
 }
 
 std::size_t Socket::writeImpl(std::string_view Buffer, bool& Continue)
@@ -294,6 +484,30 @@ std::size_t Socket::writeImpl(std::string_view Buffer, bool& Continue)
   return SentBytes.get();
 }
 
+std::size_t
+Socket::readvImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+{
+  if (!AcceptFDs)
+    return receiveWith<transport::Socket>(Buffers, Count, Continue);
+
+  const ::ssize_t Result = transport::retryInterrupted([this, Buffers, Count] {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    return receiveWithFDs(const_cast<::iovec*>(Buffers), Count);
+  });
+  if (Result > 0)
+  {
+    Continue = true;
+    return static_cast<std::size_t>(Result);
+  }
+  return transferStopped(Result, /* Reading =*/true, Continue);
+}
+
+std::size_t
+Socket::writevImpl(const ::iovec* Buffers, std::size_t Count, bool& Continue)
+{
+  return sendWith<transport::Socket>(Buffers, Count, Continue);
+}
+
 } // namespace monomux
 
 #undef LOG_WITH_IDENTIFIER
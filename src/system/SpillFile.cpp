@@ -0,0 +1,189 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/SpillFile.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/SpillFile")
+
+namespace monomux
+{
+
+SpillFile::SpillFile(const std::string& Directory, std::size_t SegmentSize)
+  : SegmentSize(SegmentSize)
+{
+  std::string Template = Directory + "/.mnmx-spill-XXXXXX";
+  std::vector<char> Path{Template.begin(), Template.end()};
+  Path.emplace_back(0);
+
+  Handle = fd{CheckedPOSIXThrow(
+    [&Path] { return ::mkostemp(Path.data(), O_CLOEXEC); }, "mkostemp()", -1)};
+  // The file is only ever accessed through the open handle.
+  CheckedPOSIX([&Path] { return ::unlink(Path.data()); }, -1);
+
+  MONOMUX_TRACE_LOG(LOG(debug) << "Created spill file " << Path.data()
+                               << " as " << Handle.get());
+}
+
+std::size_t SpillFile::mappedSize() const noexcept
+{
+  std::size_t Size = WriteMap.Length;
+  for (const Mapping& Map : ReadMaps)
+    Size += Map.Length;
+  return Size;
+}
+
+void SpillFile::Mapping::unmap() noexcept
+{
+  if (!has())
+    return;
+  CheckedPOSIX([this] { return ::munmap(Address, Length); }, -1);
+  Address = nullptr;
+  Length = 0;
+}
+
+void SpillFile::map(Mapping& Map, std::size_t Segment, bool Writable)
+{
+  Map.unmap();
+  void* Address = CheckedPOSIXThrow(
+    [this, Segment, Writable] {
+      return ::mmap(nullptr,
+                    SegmentSize,
+                    Writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_SHARED,
+                    Handle.get(),
+                    static_cast<::off_t>(Segment * SegmentSize));
+    },
+    "mmap()",
+    MAP_FAILED);
+  Map.Address = static_cast<char*>(Address);
+  Map.Length = SegmentSize;
+  Map.Segment = Segment;
+}
+
+void SpillFile::release(std::size_t Segment) noexcept
+{
+  if (WriteMap.has() && WriteMap.Segment == Segment)
+    WriteMap.unmap();
+  for (Mapping& Map : ReadMaps)
+    if (Map.has() && Map.Segment == Segment)
+      Map.unmap();
+
+  // The file keeps its size, so the offsets of the later segments are not
+  // affected.
+  CheckedPOSIX(
+    [this, Segment] {
+      return ::fallocate(Handle.get(),
+                         FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                         static_cast<::off_t>(Segment * SegmentSize),
+                         static_cast<::off_t>(SegmentSize));
+    },
+    -1);
+}
+
+void SpillFile::append(std::string_view Data)
+{
+  if (End + Data.size() > Allocated)
+  {
+    // Allocate the storage of the new segments up front. Writing a sparse file
+    // through a mapping would raise SIGBUS if the file system is full.
+    const std::size_t NewAllocated =
+      (End + Data.size() + SegmentSize - 1) / SegmentSize * SegmentSize;
+    if (int EC =
+          ::posix_fallocate(Handle.get(),
+                            static_cast<::off_t>(Allocated),
+                            static_cast<::off_t>(NewAllocated - Allocated)))
+      throw std::system_error{EC, std::generic_category(), "posix_fallocate()"};
+    Allocated = NewAllocated;
+  }
+
+  while (!Data.empty())
+  {
+    const std::size_t Segment = End / SegmentSize;
+    const std::size_t InSegment = End % SegmentSize;
+    if (!WriteMap.has())
+      map(WriteMap, Segment, true);
+
+    const std::size_t Chunk = std::min(Data.size(), SegmentSize - InSegment);
+    std::memcpy(WriteMap.Address + InSegment, Data.data(), Chunk);
+    Data.remove_prefix(Chunk);
+    End += Chunk;
+
+    if (End % SegmentSize == 0)
+      // A full segment is left to the kernel to write back and page out.
+      WriteMap.unmap();
+  }
+}
+
+std::string_view SpillFile::peek(std::size_t Offset) noexcept
+{
+  if (Offset < Begin || Offset >= End)
+    return {};
+
+  const std::size_t Segment = Offset / SegmentSize;
+  const std::size_t InSegment = Offset % SegmentSize;
+  const std::size_t Size =
+    std::min(SegmentSize - InSegment, End - Offset);
+
+  if (WriteMap.has() && WriteMap.Segment == Segment)
+    return {WriteMap.Address + InSegment, Size};
+  for (const Mapping& Map : ReadMaps)
+    if (Map.has() && Map.Segment == Segment)
+      return {Map.Address + InSegment, Size};
+
+  Mapping& Map = ReadMaps.at(NextReadMap);
+  NextReadMap = (NextReadMap + 1) % ReadMaps.size();
+  try
+  {
+    map(Map, Segment, false);
+  }
+  catch (const std::system_error& Err)
+  {
+    LOG(error) << "Failed to map segment " << Segment
+               << " of spill file: " << Err.what();
+    return {};
+  }
+  return {Map.Address + InSegment, Size};
+}
+
+void SpillFile::discard(std::size_t Offset) noexcept
+{
+  Offset = std::min(Offset, End);
+  if (Offset <= Begin)
+    return;
+
+  for (std::size_t Segment = Begin / SegmentSize;
+       Segment < Offset / SegmentSize;
+       ++Segment)
+    release(Segment);
+  Begin = Offset;
+}
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,134 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+
+#include "monomux/system/SplicePipe.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/SplicePipe")
+
+namespace monomux
+{
+
+SplicePipe::SplicePipe()
+{
+  POD<raw_fd[2]> PipeFDs;
+  CheckedPOSIXThrow(
+    [&PipeFDs] { return ::pipe2(PipeFDs, O_CLOEXEC | O_NONBLOCK); },
+    "pipe2()",
+    -1);
+  Read = fd{PipeFDs[0]};
+  Write = fd{PipeFDs[1]};
+
+  MONOMUX_TRACE_LOG(LOG(trace) << "Created splice pipe " << Read.get() << ','
+                               << Write.get());
+}
+
+/// Executes \p splice() from \p From to \p To, retrying on \p EINTR.
+///
+/// \returns the number of bytes moved, or \p 0 if the operation would have
+/// blocked.
+static std::size_t spliceNonblock(raw_fd From, raw_fd To, std::size_t Bytes)
+{
+  while (true)
+  {
+    auto Moved = CheckedPOSIX(
+      [From, To, Bytes] {
+        return ::splice(From,
+                        nullptr,
+                        To,
+                        nullptr,
+                        Bytes,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      },
+      -1);
+    if (Moved)
+      return Moved.get();
+
+    std::errc EC = static_cast<std::errc>(Moved.getError().value());
+    if (EC == std::errc::interrupted /* EINTR */)
+      continue;
+    if (EC == std::errc::operation_would_block /* EWOULDBLOCK */ ||
+        EC == std::errc::resource_unavailable_try_again /* EAGAIN */)
+      return 0;
+
+    throw std::system_error{std::make_error_code(EC), "splice()"};
+  }
+}
+
+std::size_t SplicePipe::fill(raw_fd From, std::size_t Bytes)
+{
+  std::size_t Moved = spliceNonblock(From, Write, Bytes);
+  Size += Moved;
+  MONOMUX_TRACE_LOG(LOG(data) << "Splice " << From << " -> pipe: " << Moved
+                              << " bytes");
+  return Moved;
+}
+
+std::size_t SplicePipe::drain(raw_fd To)
+{
+  std::size_t Moved = 0;
+  while (!empty())
+  {
+    std::size_t Chunk = spliceNonblock(Read, To, Size);
+    if (!Chunk)
+      break;
+    Moved += Chunk;
+    Size -= Chunk;
+  }
+  MONOMUX_TRACE_LOG(LOG(data) << "Splice pipe -> " << To << ": " << Moved
+                              << " bytes");
+  return Moved;
+}
+
+std::string SplicePipe::take()
+{
+  std::string Data;
+  Data.resize(Size);
+  std::size_t Position = 0;
+  while (Position < Data.size())
+  {
+    auto ReadBytes = CheckedPOSIX(
+      [this, &Data, Position] {
+        return ::read(Read, Data.data() + Position, Data.size() - Position);
+      },
+      -1);
+    if (!ReadBytes)
+    {
+      if (ReadBytes.getError() == std::errc::interrupted /* EINTR */)
+        continue;
+      break;
+    }
+    if (ReadBytes.get() == 0)
+      break;
+    Position += ReadBytes.get();
+  }
+
+  Data.resize(Position);
+  Size = 0;
+  return Data;
+}
+
+} // namespace monomux
+
+#undef LOG
@@ -0,0 +1,292 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monomux/adt/POD.hpp"
+#include "monomux/system/CheckedPOSIX.hpp"
+#include "monomux/system/fd.hpp"
+
+#include "monomux/system/StatusPage.hpp"
+
+#include "monomux/Log.hpp"
+#define LOG(SEVERITY) monomux::log::SEVERITY("system/StatusPage")
+
+namespace monomux
+{
+
+/// The control block at the beginning of the file.
+struct StatusPage::Header
+{
+  /// Identifies the file as a page, see \p PageMagic.
+  std::uint64_t Magic;
+  std::uint64_t Capacity;
+  /// The process that created the file, and is the only one writing it.
+  std::int64_t Owner;
+  /// Odd while the writer is overwriting the snapshot.
+  alignas(64) std::atomic<std::uint64_t> Sequence;
+  /// The number of bytes of the snapshot.
+  std::atomic<std::uint64_t> Size;
+  /// Set when the writer moved to another file, or stopped.
+  std::atomic<std::uint32_t> Retired;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                std::atomic<std::uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must not rely on locks!");
+
+/// The size of the area before the data.
+static constexpr std::size_t HeaderSize = 4096;
+
+static constexpr std::uint64_t PageMagic = 0x5441'5453'584D'4E4D; // "MNMXSTAT"
+
+StatusPage::StatusPage(std::string Path, bool Owning)
+  : Path(std::move(Path)), Owning(Owning)
+{}
+
+StatusPage StatusPage::create(std::string Path, std::size_t Capacity)
+{
+  StatusPage Page{std::move(Path), true};
+  Page.Capacity = Capacity;
+  Page.makeFile();
+
+  MONOMUX_TRACE_LOG(LOG(debug) << "Created status page of " << Capacity
+                               << " bytes at " << Page.Path);
+  return Page;
+}
+
+StatusPage StatusPage::open(std::string Path)
+{
+  fd File{CheckedPOSIXThrow(
+    [&Path] { return ::open(Path.c_str(), O_RDONLY | O_CLOEXEC); },
+    "open()",
+    -1)};
+  POD<struct ::stat> Stat;
+  CheckedPOSIXThrow(
+    [&File, &Stat] { return ::fstat(File.get(), &Stat); }, "fstat()", -1);
+  const auto Size = static_cast<std::size_t>(Stat->st_size);
+  if (Size <= HeaderSize)
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "File is too small for a status page"};
+
+  StatusPage Page{std::move(Path), false};
+  Page.Capacity = Size - HeaderSize;
+  Page.Mapping = CheckedPOSIXThrow(
+    [&File, Size] {
+      return ::mmap(nullptr, Size, PROT_READ, MAP_SHARED, File.get(), 0);
+    },
+    "mmap()",
+    MAP_FAILED);
+
+  const Header& H = Page.header();
+  if (H.Magic != PageMagic || H.Capacity != Page.Capacity)
+    throw std::system_error{std::make_error_code(std::errc::invalid_argument),
+                            "File is not laid out as a status page"};
+  if (::kill(static_cast<::pid_t>(H.Owner), 0) == -1 && errno == ESRCH)
+    // The writer did not get to remove the file.
+    throw std::system_error{std::make_error_code(std::errc::no_such_process),
+                            "Status page is stale"};
+  return Page;
+}
+
+StatusPage::StatusPage(StatusPage&& RHS) noexcept
+  : Path(std::move(RHS.Path)), Owning(std::exchange(RHS.Owning, false)),
+    Capacity(RHS.Capacity), Mapping(std::exchange(RHS.Mapping, nullptr))
+{}
+
+StatusPage& StatusPage::operator=(StatusPage&& RHS) noexcept
+{
+  if (this == &RHS)
+    return *this;
+  release();
+  Path = std::move(RHS.Path);
+  Owning = std::exchange(RHS.Owning, false);
+  Capacity = RHS.Capacity;
+  Mapping = std::exchange(RHS.Mapping, nullptr);
+  return *this;
+}
+
+StatusPage::~StatusPage() noexcept { release(); }
+
+void StatusPage::release() noexcept
+{
+  if (!Mapping)
+    return;
+  if (Owning)
+  {
+    header().Retired.store(1, std::memory_order_release);
+    CheckedPOSIX([this] { return ::unlink(Path.c_str()); }, -1);
+  }
+  unmap();
+}
+
+void StatusPage::makeFile()
+{
+  // The new file is set up under a temporary name, and then atomically put in
+  // place of the old one, so readers never see a half-initialised page.
+  std::string Template = Path + ".XXXXXX";
+  std::vector<char> TempPath{Template.begin(), Template.end()};
+  TempPath.emplace_back(0);
+  fd File{CheckedPOSIXThrow(
+    [&TempPath] { return ::mkostemp(TempPath.data(), O_CLOEXEC); },
+    "mkostemp()",
+    -1)};
+
+  void* NewMapping = nullptr;
+  try
+  {
+    CheckedPOSIXThrow(
+      [&File, this] {
+        return ::ftruncate(File.get(),
+                           static_cast<::off_t>(HeaderSize + Capacity));
+      },
+      "ftruncate()",
+      -1);
+    NewMapping = CheckedPOSIXThrow(
+      [&File, this] {
+        return ::mmap(nullptr,
+                      HeaderSize + Capacity,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      File.get(),
+                      0);
+      },
+      "mmap()",
+      MAP_FAILED);
+    static_assert(sizeof(Header) <= HeaderSize);
+    Header* H = new (NewMapping) Header{};
+    H->Magic = PageMagic;
+    H->Capacity = Capacity;
+    H->Owner = ::getpid();
+
+    CheckedPOSIXThrow(
+      [&TempPath, this] { return ::rename(TempPath.data(), Path.c_str()); },
+      "rename()",
+      -1);
+  }
+  catch (...)
+  {
+    if (NewMapping)
+      ::munmap(NewMapping, HeaderSize + Capacity);
+    ::unlink(TempPath.data());
+    throw;
+  }
+  Mapping = NewMapping;
+}
+
+void StatusPage::unmap() noexcept
+{
+  if (!Mapping)
+    return;
+  CheckedPOSIX([this] { return ::munmap(Mapping, HeaderSize + Capacity); },
+               -1);
+  Mapping = nullptr;
+}
+
+StatusPage::Header& StatusPage::header() const noexcept
+{
+  return *static_cast<Header*>(Mapping);
+}
+
+char* StatusPage::data() const noexcept
+{
+  return static_cast<char*>(Mapping) + HeaderSize;
+}
+
+void StatusPage::publish(std::string_view Data)
+{
+  if (Data.size() > Capacity)
+  {
+    std::size_t NewCapacity = Capacity;
+    while (NewCapacity < Data.size())
+      NewCapacity *= 2;
+
+    void* OldMapping = std::exchange(Mapping, nullptr);
+    const std::size_t OldCapacity = std::exchange(Capacity, NewCapacity);
+    try
+    {
+      makeFile();
+    }
+    catch (...)
+    {
+      Mapping = OldMapping;
+      Capacity = OldCapacity;
+      throw;
+    }
+
+    static_cast<Header*>(OldMapping)
+      ->Retired.store(1, std::memory_order_release);
+    CheckedPOSIX(
+      [OldMapping, OldCapacity] {
+        return ::munmap(OldMapping, HeaderSize + OldCapacity);
+      },
+      -1);
+    LOG(debug) << "Status page grew to " << Capacity << " bytes";
+  }
+
+  Header& H = header();
+  const std::uint64_t Sequence = H.Sequence.load(std::memory_order_relaxed);
+  H.Sequence.store(Sequence + 1, std::memory_order_relaxed);
+  // The odd sequence must be visible before any of the data is overwritten.
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(data(), Data.data(), Data.size());
+  H.Size.store(Data.size(), std::memory_order_relaxed);
+  H.Sequence.store(Sequence + 2, std::memory_order_release);
+}
+
+std::optional<std::string> StatusPage::read() const
+{
+  const Header& H = header();
+  for (std::size_t I = 0; I < ReadAttempts; ++I)
+  {
+    if (H.Retired.load(std::memory_order_acquire))
+      return std::nullopt;
+
+    const std::uint64_t Before = H.Sequence.load(std::memory_order_acquire);
+    if (Before % 2)
+      // The writer is in the middle of publishing.
+      continue;
+    const std::uint64_t Size = H.Size.load(std::memory_order_relaxed);
+    if (Size > Capacity)
+      continue;
+
+    std::string Data{data(), Size};
+    // The data must be copied before the sequence is checked again.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (H.Sequence.load(std::memory_order_relaxed) == Before)
+      return Data;
+  }
+  return std::nullopt;
+}
+
+} // namespace monomux
+
+#undef LOG
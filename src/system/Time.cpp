@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <time.h>
+
+#include "monomux/adt/POD.hpp"
+
+#include "monomux/system/Time.hpp"
+
+namespace monomux
+{
+
+static std::chrono::nanoseconds toDuration(const struct ::timespec& TS)
+{
+  return std::chrono::seconds(TS.tv_sec) + std::chrono::nanoseconds(TS.tv_nsec);
+}
+
+void LoopClock::tick() noexcept
+{
+  POD<struct ::timespec> TS;
+  const clockid_t Clock = Coarse ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME;
+  if (::clock_gettime(Clock, &TS) != 0)
+    return;
+
+  std::chrono::nanoseconds SinceEpoch = toDuration(TS);
+  if (Resolution.count() > 0)
+    SinceEpoch -= SinceEpoch % Resolution;
+
+  const time_point Time{
+    std::chrono::duration_cast<clock::duration>(SinceEpoch)};
+  if (Time > Now.load(std::memory_order_relaxed))
+    Now.store(Time, std::memory_order_relaxed);
+}
+
+void LoopClock::setResolution(std::chrono::microseconds Resolution) noexcept
+{
+  LoopClock::Resolution = std::max(Resolution, decltype(Resolution)::zero());
+
+  POD<struct ::timespec> CoarseResolution;
+  Coarse = LoopClock::Resolution.count() > 0 &&
+           ::clock_getres(CLOCK_REALTIME_COARSE, &CoarseResolution) == 0 &&
+           LoopClock::Resolution >= toDuration(CoarseResolution);
+}
+
+} // namespace monomux
@@ -0,0 +1,87 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "monomux/Allocation.hpp"
+
+using namespace monomux::alloc;
+
+TEST(Allocation, ScopesNest)
+{
+  const Tag Outside = current();
+  {
+    Scope S{Tag::Server};
+    EXPECT_EQ(current(), Tag::Server);
+    {
+      Scope S2{Tag::Message};
+      EXPECT_EQ(current(), Tag::Message);
+    }
+    EXPECT_EQ(current(), Tag::Server);
+  }
+  EXPECT_EQ(current(), Outside);
+}
+
+TEST(Allocation, AccountedOutsideOperatorNew)
+{
+  const Counters Before = snapshot().at(static_cast<std::size_t>(Tag::Poll));
+  account(Tag::Poll, 100);
+  account(Tag::Poll, 50);
+  release(Tag::Poll, 100);
+
+  const Counters After = snapshot().at(static_cast<std::size_t>(Tag::Poll));
+  EXPECT_EQ(After.TotalCount - Before.TotalCount, 2);
+  EXPECT_EQ(After.TotalBytes - Before.TotalBytes, 150);
+  EXPECT_EQ(After.LiveCount - Before.LiveCount, 1);
+  EXPECT_EQ(After.LiveBytes - Before.LiveBytes, 50);
+  EXPECT_GE(After.PeakBytes, Before.LiveBytes + 150);
+  release(Tag::Poll, 50);
+}
+
+TEST(Allocation, OperatorNewAccountedToScope)
+{
+  if (!enabled())
+    GTEST_SKIP() << "Built without MONOMUX_ALLOCATION_ACCOUNTING";
+
+  // Nothing else in the tests allocates in the scope of the logs.
+  const auto I = static_cast<std::size_t>(Tag::Log);
+  const Counters Before = snapshot().at(I);
+  std::unique_ptr<char[]> Block;
+  {
+    Scope S{Tag::Log};
+    Block = std::make_unique<char[]>(4096);
+  }
+  const Counters During = snapshot().at(I);
+  EXPECT_EQ(During.LiveBytes - Before.LiveBytes, 4096);
+  EXPECT_EQ(During.TotalCount - Before.TotalCount, 1);
+
+  // Freed outside the scope, but still from the tag.
+  Block.reset();
+  const Counters After = snapshot().at(I);
+  EXPECT_EQ(After.LiveBytes, Before.LiveBytes);
+  EXPECT_GE(After.PeakBytes, Before.LiveBytes + 4096);
+}
+
+TEST(Allocation, TagNames)
+{
+  EXPECT_STREQ(name(Tag::Channel), "Channel");
+  EXPECT_STREQ(name(Tag::Log), "Log");
+  EXPECT_STREQ(name(static_cast<Tag>(TagCount)), "Invalid");
+}
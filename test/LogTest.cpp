@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/Log.hpp"
+
+using namespace monomux::log;
+
+static std::size_t countLines(const std::string& S)
+{
+  std::size_t N = 0;
+  for (char C : S)
+    if (C == '\n')
+      ++N;
+  return N;
+}
+
+TEST(Log, SynchronousWritesImmediately)
+{
+  std::ostringstream OS;
+  Logger L{Info, OS};
+  L(Info, "test") << "Hello " << 42;
+  L(Debug, "test") << "Discarded";
+
+  const std::string S = OS.str();
+  EXPECT_NE(S.find("test: Hello 42\n"), std::string::npos);
+  EXPECT_EQ(S.find("Discarded"), std::string::npos);
+  EXPECT_EQ(countLines(S), 1);
+}
+
+TEST(Log, AsynchronousKeepsOrder)
+{
+  std::ostringstream OS;
+  Logger L{Info, OS};
+  L.setAsynchronous(true);
+  EXPECT_TRUE(L.isAsynchronous());
+  for (int I = 0; I < 100; ++I) // NOLINT(readability-magic-numbers)
+    L(Info, "test") << "Message " << I;
+  L.flush();
+
+  const std::string S = OS.str();
+  EXPECT_EQ(countLines(S), 100);
+  EXPECT_LT(S.find("Message 1\n"), S.find("Message 2\n"));
+  EXPECT_LT(S.find("Message 2\n"), S.find("Message 99\n"));
+  EXPECT_EQ(L.droppedMessages(), 0);
+
+  L.setAsynchronous(false);
+  EXPECT_FALSE(L.isAsynchronous());
+  L(Info, "test") << "After";
+  EXPECT_NE(OS.str().find("test: After\n"), std::string::npos);
+}
+
+TEST(Log, AsynchronousDropsWhenFull)
+{
+  std::ostringstream OS;
+  Logger L{Info, OS};
+  // Too small for any message to fit.
+  L.setAsynchronous(true, 1);
+  L(Info, "test") << "Dropped";
+  L(Info, "test") << "Dropped too";
+  L(Fatal, "test") << "Fatal";
+  L.flush();
+
+  EXPECT_EQ(L.droppedMessages(), 2);
+  const std::string S = OS.str();
+  EXPECT_EQ(S.find("Dropped"), std::string::npos);
+  EXPECT_NE(S.find("test: Fatal\n"), std::string::npos);
+
+  L.setAsynchronous(false);
+  EXPECT_EQ(L.droppedMessages(), 2);
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "monomux/Trace.hpp"
+
+using namespace monomux::trace;
+
+TEST(Trace, RingKeepsMostRecent)
+{
+  auto R = std::make_unique<Ring>();
+  std::vector<Record> Out;
+  R->snapshot(Out);
+  EXPECT_TRUE(Out.empty());
+
+  for (std::uint64_t I = 0; I < Ring::Capacity + 3; ++I)
+    R->push(Record{I, 1, Event::ChannelRead, 0, I, I});
+  EXPECT_EQ(R->written(), Ring::Capacity + 3);
+
+  R->snapshot(Out);
+  ASSERT_EQ(Out.size(), Ring::Capacity);
+  EXPECT_EQ(Out.front().Timestamp, 3);
+  EXPECT_EQ(Out.back().Timestamp, Ring::Capacity + 2);
+}
+
+TEST(Trace, CollectFromThreads)
+{
+  // Other tests might have left records behind, so only look at our own.
+  const auto IsOurs = [](const Record& R) { return R.FD == -42; };
+
+  record(Event::LoopWake, -42, 0, 1);
+  std::thread T{[] { record(Event::ChannelWrite, -42, 8, 4); }};
+  T.join();
+  record(Event::LoopWake, -42, 0, 2);
+
+  std::vector<Record> Ours;
+  for (const Record& R : collect())
+    if (IsOurs(R))
+      Ours.emplace_back(R);
+
+  ASSERT_EQ(Ours.size(), 3);
+  EXPECT_EQ(Ours.at(0).Id, Event::LoopWake);
+  EXPECT_EQ(Ours.at(0).Bytes, 1);
+  EXPECT_EQ(Ours.at(1).Id, Event::ChannelWrite);
+  EXPECT_EQ(Ours.at(1).Requested, 8);
+  EXPECT_EQ(Ours.at(1).Bytes, 4);
+  EXPECT_EQ(Ours.at(2).Bytes, 2);
+  // The records of the main thread come from the same ring.
+  EXPECT_EQ(Ours.at(0).Thread, Ours.at(2).Thread);
+  EXPECT_NE(Ours.at(0).Thread, Ours.at(1).Thread);
+  EXPECT_LE(Ours.at(0).Timestamp, Ours.at(1).Timestamp);
+  EXPECT_LE(Ours.at(1).Timestamp, Ours.at(2).Timestamp);
+}
+
+TEST(Trace, EventNames)
+{
+  EXPECT_STREQ(name(Event::ChannelFlush), "ChannelFlush");
+  EXPECT_STREQ(name(Event::ChannelOverflow), "ChannelOverflow");
+  EXPECT_STREQ(name(static_cast<Event>(EventCount)), "Invalid");
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/HandoffQueue.hpp"
+
+using namespace monomux;
+
+TEST(HandoffQueue, ConsumeInOrder)
+{
+  HandoffQueue<int> Q;
+  EXPECT_TRUE(Q.empty());
+  EXPECT_TRUE(Q.take().empty());
+
+  EXPECT_TRUE(Q.push(1));
+  EXPECT_FALSE(Q.push(2));
+  EXPECT_FALSE(Q.push(3));
+  EXPECT_FALSE(Q.empty());
+
+  std::vector<int> Expected = {1, 2, 3};
+  EXPECT_EQ(Q.take(), Expected);
+  EXPECT_TRUE(Q.empty());
+
+  EXPECT_TRUE(Q.push(4));
+  Expected = {4};
+  EXPECT_EQ(Q.take(), Expected);
+}
+
+TEST(HandoffQueue, ManyProducers)
+{
+  static constexpr int Producers = 4;
+  static constexpr int PerProducer = 10000;
+
+  HandoffQueue<int> Q;
+  std::vector<std::thread> Threads;
+  for (int P = 0; P < Producers; ++P)
+    Threads.emplace_back([&Q, P] {
+      for (int I = 0; I < PerProducer; ++I)
+        Q.push(P * PerProducer + I);
+    });
+
+  std::vector<int> Received;
+  while (Received.size() < Producers * PerProducer)
+    for (int V : Q.take())
+      Received.push_back(V);
+  for (std::thread& T : Threads)
+    T.join();
+  EXPECT_TRUE(Q.empty());
+
+  // Every element arrives exactly once, and the elements of a single producer
+  // keep their order.
+  std::vector<int> Next(Producers, 0);
+  for (int V : Received)
+  {
+    int P = V / PerProducer;
+    ASSERT_EQ(V % PerProducer, Next[P]);
+    ++Next[P];
+  }
+  for (int N : Next)
+    EXPECT_EQ(N, PerProducer);
+}
@@ -247,3 +247,183 @@ TEST(RingBuffer, PeekAndDrop)
   EXPECT_EQ(RB[0], 3);
   EXPECT_EQ(RB[1], 4);
 }
+
+TEST(RingBuffer, PeekSegments)
+{
+  RingBuffer<int> RB(static_cast<std::size_t>(8));
+  auto Segments = RB.peekFrontSegments(4);
+  EXPECT_TRUE(Segments[0].empty());
+  EXPECT_TRUE(Segments[1].empty());
+
+  RB.putBack({1, 2, 3, 4, 5, 6});
+  RB.dropFront(4);
+  // [-, -, -, -, *5, 6, -, -]
+  Segments = RB.peekFrontSegments(Magic32);
+  EXPECT_EQ(Segments[0].Size, 2);
+  EXPECT_EQ(Segments[0].Begin[0], 5);
+  EXPECT_EQ(Segments[0].Begin[1], 6);
+  EXPECT_TRUE(Segments[1].empty());
+
+  RB.putBack({7, 8, 9, 10});
+  // [9, 10, -, -, *5, 6, 7, 8]
+  EXPECT_EQ(RB.capacity(), 8);
+  Segments = RB.peekFrontSegments(5);
+  EXPECT_EQ(Segments[0].Size, 4);
+  EXPECT_EQ(Segments[0].Begin[0], 5);
+  EXPECT_EQ(Segments[0].Begin[3], 8);
+  EXPECT_EQ(Segments[1].Size, 1);
+  EXPECT_EQ(Segments[1].Begin[0], 9);
+  EXPECT_EQ(RB.size(), 6);
+
+  RB.dropFront(Segments[0].Size);
+  // [*9, 10, -, -, -, -, -, -]
+  Segments = RB.peekFrontSegments(Magic32);
+  EXPECT_EQ(Segments[0].Size, 2);
+  EXPECT_EQ(Segments[0].Begin[1], 10);
+  EXPECT_TRUE(Segments[1].empty());
+}
+
+TEST(RingBuffer, ReserveAndCommit)
+{
+  RingBuffer<int> RB(static_cast<std::size_t>(8));
+  auto Slots = RB.reserveBackSegments(3);
+  EXPECT_EQ(Slots[0].Size, 3);
+  EXPECT_TRUE(Slots[1].empty());
+  Slots[0].Begin[0] = 1;
+  Slots[0].Begin[1] = 2;
+  RB.commitBack(2);
+  // [*1, 2, -, -, -, -, -, -]
+  EXPECT_EQ(RB.size(), 2);
+  EXPECT_EQ(RB.front(), 1);
+  EXPECT_EQ(RB.back(), 2);
+
+  RB.putBack({3, 4, 5, 6});
+  RB.dropFront(5);
+  // [-, -, -, -, -, *6, -, -]
+  Slots = RB.reserveBackSegments(4);
+  EXPECT_EQ(RB.capacity(), 8);
+  EXPECT_EQ(Slots[0].Size, 2);
+  EXPECT_EQ(Slots[1].Size, 2);
+  Slots[0].Begin[0] = 7;
+  Slots[0].Begin[1] = 8;
+  Slots[1].Begin[0] = 9;
+  Slots[1].Begin[1] = 10;
+  RB.commitBack(4);
+  // [9, 10, -, -, -, *6, 7, 8]
+  EXPECT_EQ(RB.size(), 5);
+  EXPECT_EQ(RB[0], 6);
+  EXPECT_EQ(RB[3], 9);
+  EXPECT_EQ(RB.back(), 10);
+
+  Slots = RB.reserveBackSegments(Magic32);
+  // Grows, which linearises the storage.
+  EXPECT_EQ(RB.capacity(), 64);
+  EXPECT_EQ(Slots[0].Size, Magic32);
+  EXPECT_TRUE(Slots[1].empty());
+  RB.commitBack(0);
+  EXPECT_EQ(RB.size(), 5);
+  EXPECT_EQ(RB.front(), 6);
+  EXPECT_EQ(RB.back(), 10);
+}
+
+TEST(RingBuffer, GrowWrapped)
+{
+  // Trivial elements are grown in place, others are rotated to the physical
+  // beginning. The logical contents must be the same either way.
+  RingBuffer<char> RBC(static_cast<std::size_t>(8));
+  RingBuffer<std::string> RBS(static_cast<std::size_t>(8));
+  for (char C = 'a'; C < 'g'; ++C)
+  {
+    RBC.push_back(C);
+    RBS.push_back(std::string(1, C));
+  }
+  RBC.dropFront(4);
+  RBS.dropFront(4);
+  RBC.putBack("ghij", 4);
+  RBS.putBack({"g", "h", "i", "j"});
+  // [i, j, -, -, *e, f, g, h]
+  EXPECT_EQ(RBC.capacity(), 8);
+  EXPECT_EQ(RBS.capacity(), 8);
+
+  // Grows to the growing storage.
+  RBC.putBack("klmnopq", 7);
+  RBS.putBack({"k", "l", "m", "n", "o", "p", "q"});
+  EXPECT_EQ(RBC.capacity(), 16);
+  EXPECT_EQ(RBS.capacity(), 16);
+  EXPECT_EQ(RBC.size(), 13);
+  EXPECT_EQ(RBS.size(), 13);
+
+  RBC.dropFront(10);
+  RBS.dropFront(10);
+  RBC.putBack("rstuvwxyz", 9);
+  RBS.putBack({"r", "s", "t", "u", "v", "w", "x", "y", "z"});
+  EXPECT_EQ(RBC.capacity(), 16);
+
+  // Grows the growing storage while the elements wrap around.
+  RBC.putBack("0123456789", 10);
+  RBS.putBack({"0", "1", "2", "3", "4", "5", "6", "7", "8", "9"});
+  EXPECT_EQ(RBC.capacity(), 32);
+  EXPECT_EQ(RBS.capacity(), 32);
+
+  const std::string Expected = "opqrstuvwxyz0123456789";
+  ASSERT_EQ(RBC.size(), Expected.size());
+  ASSERT_EQ(RBS.size(), Expected.size());
+  std::vector<char> VC = RBC.peekFront(Expected.size());
+  EXPECT_EQ(std::string(VC.begin(), VC.end()), Expected);
+  for (std::size_t I = 0; I < Expected.size(); ++I)
+    EXPECT_EQ(RBS[I], std::string(1, Expected[I]));
+
+  auto Segments = RBC.peekFrontSegments(Expected.size());
+  EXPECT_EQ(Segments[0].Size, Expected.size());
+  EXPECT_TRUE(Segments[1].empty());
+}
+
+TEST(RingBuffer, BulkThroughput)
+{
+  // Relays a stream through a buffer in chunks of varying size, emulating a
+  // channel that is written and read at different rates.
+  static constexpr std::size_t StreamSize = 1ULL << 26; // 64 MiB
+  static constexpr std::size_t ChunkSizes[] = {4096, 65536, 1500, 16384, 7};
+
+  std::string Chunk(65536, 0);
+  for (std::size_t I = 0; I < Chunk.size(); ++I)
+    Chunk[I] = static_cast<char>(I % 251);
+
+  RingBuffer<char> RB(static_cast<std::size_t>(4096));
+  std::size_t Written = 0;
+  std::size_t Read = 0;
+  std::size_t Step = 0;
+  bool Mismatch = false;
+  auto Begin = std::chrono::steady_clock::now();
+  while (Read < StreamSize)
+  {
+    const std::size_t WriteSize = ChunkSizes[Step % std::size(ChunkSizes)];
+    const std::size_t ReadSize =
+      ChunkSizes[(Step + 2) % std::size(ChunkSizes)];
+    ++Step;
+
+    if (Written < StreamSize)
+    {
+      // Keep the pattern continuous over the stream.
+      const std::size_t Offset = Written % 251;
+      RB.putBack(Chunk.data() + Offset,
+                 std::min(WriteSize, Chunk.size() - Offset));
+      Written += std::min(WriteSize, Chunk.size() - Offset);
+    }
+
+    std::size_t Consumed = 0;
+    for (const auto& S : RB.peekFrontSegments(ReadSize))
+      for (std::size_t I = 0; I < S.Size; ++I, ++Consumed)
+        Mismatch |= S.Begin[I] != static_cast<char>((Read + Consumed) % 251);
+    RB.dropFront(Consumed);
+    Read += Consumed;
+  }
+  auto Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - Begin);
+
+  EXPECT_FALSE(Mismatch);
+  EXPECT_EQ(Read, Written);
+  EXPECT_TRUE(RB.empty());
+  RecordProperty("BytesPerMicrosecond",
+                 std::to_string(StreamSize / (Elapsed.count() + 1)));
+}
@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/adt/SlotMap.hpp"
+
+using namespace monomux;
+
+TEST(SlotMap, EmplaceAndErase)
+{
+  SlotMap<std::string, 4> M;
+  EXPECT_TRUE(M.empty());
+  EXPECT_FALSE(SlotMap<std::string>::Handle{});
+
+  std::string& A = M.emplace("a");
+  std::string& B = M.emplace(3, 'b');
+  EXPECT_EQ(M.size(), 2);
+  EXPECT_EQ(B, "bbb");
+
+  auto HA = M.handle(A);
+  auto HB = M.handle(B);
+  EXPECT_TRUE(HA);
+  EXPECT_NE(HA, HB);
+  EXPECT_EQ(M.get(HA), &A);
+  EXPECT_EQ(M.get(HB), &B);
+
+  M.erase(A);
+  EXPECT_EQ(M.size(), 1);
+  EXPECT_EQ(M.get(HA), nullptr);
+  EXPECT_EQ(M.get(HB), &B);
+  // Erasing again is harmless.
+  M.erase(HA);
+  EXPECT_EQ(M.size(), 1);
+}
+
+TEST(SlotMap, ReusedSlotIsNewGeneration)
+{
+  SlotMap<int, 4> M;
+  int& First = M.emplace(1);
+  auto Old = M.handle(First);
+  M.erase(Old);
+
+  int& Second = M.emplace(2);
+  EXPECT_EQ(&First, &Second);
+  EXPECT_EQ(M.capacity(), 4);
+  auto New = M.handle(Second);
+  EXPECT_EQ(New.Index, Old.Index);
+  EXPECT_NE(New, Old);
+  EXPECT_EQ(M.get(Old), nullptr);
+  EXPECT_EQ(*M.get(New), 2);
+}
+
+TEST(SlotMap, StableAddressesAcrossChunks)
+{
+  SlotMap<int, 4> M;
+  std::vector<int*> Addresses;
+  for (int I = 0; I < 100; ++I)
+    Addresses.emplace_back(&M.emplace(I));
+  EXPECT_EQ(M.capacity(), 100);
+  for (int I = 0; I < 100; ++I)
+  {
+    EXPECT_EQ(*Addresses[I], I);
+    EXPECT_EQ(M.get(M.handle(*Addresses[I])), Addresses[I]);
+  }
+
+  int Outside = 0;
+  EXPECT_FALSE(M.handle(Outside));
+}
+
+TEST(SlotMap, IterateLive)
+{
+  SlotMap<int, 4> M;
+  std::vector<int*> Elements;
+  for (int I = 0; I < 10; ++I)
+    Elements.emplace_back(&M.emplace(I));
+  for (int I = 0; I < 10; I += 3)
+    M.erase(*Elements[I]);
+
+  std::vector<int> Visited;
+  for (int E : M)
+    Visited.emplace_back(E);
+  EXPECT_EQ(Visited, (std::vector<int>{1, 2, 4, 5, 7, 8}));
+
+  // The most recently freed slot is reused first.
+  M.emplace(42);
+  EXPECT_EQ(*Elements[9], 42);
+  const auto& CM = M;
+  EXPECT_EQ(std::distance(CM.begin(), CM.end()), 7);
+}
+
+TEST(SlotMap, DestroysElements)
+{
+  auto Counter = std::make_shared<int>(0);
+  {
+    SlotMap<std::shared_ptr<int>, 2> M;
+    for (int I = 0; I < 5; ++I)
+      M.emplace(Counter);
+    EXPECT_EQ(Counter.use_count(), 6);
+    M.erase(*M.begin());
+    EXPECT_EQ(Counter.use_count(), 5);
+  }
+  EXPECT_EQ(Counter.use_count(), 1);
+}
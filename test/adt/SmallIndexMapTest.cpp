@@ -17,6 +17,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <utility>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "monomux/adt/SmallIndexMap.hpp"
@@ -452,3 +455,145 @@ TEST(SmallIndexMap, LargeMap)
   EXPECT_EQ(M.size(), 4096 / 2);
   EXPECT_TRUE(M.isSmall());
 }
+
+TEST(SmallIndexMap, PagedMap)
+{
+  SmallIndexMap<int,
+                4,
+                /* StoreInPlace =*/true,
+                /* IntrusiveDefaultSentinel =*/false,
+                std::size_t,
+                /* PageCount =*/Magic32>
+    M;
+  M[0] = 1;
+  EXPECT_TRUE(M.isSmall());
+
+  // Keys up to 4 * 32 are indexed by pages.
+  M[Magic64] = Magic64;
+  M[Magic64 + 1] = Magic64 + 1;
+  M.set(Magic32, Magic32);
+  EXPECT_EQ(M.size(), 4);
+  EXPECT_TRUE(M.isPaged());
+  EXPECT_EQ(M.get(0), 1);
+  EXPECT_EQ(M.get(Magic64), Magic64);
+  EXPECT_EQ(M.get(Magic32), Magic32);
+  EXPECT_FALSE(M.contains(Magic64 + 2));
+  EXPECT_FALSE(M.contains(Magic128 - 1));
+  EXPECT_EQ(M.tryGet(Magic256), nullptr);
+
+  // Keys beyond the pages need the large representation.
+  M[Magic256] = Magic256;
+  EXPECT_EQ(M.size(), 5);
+  EXPECT_TRUE(M.isLarge());
+  EXPECT_EQ(M.get(Magic64 + 1), Magic64 + 1);
+
+  M.erase(Magic256);
+  EXPECT_EQ(M.size(), 4);
+  EXPECT_TRUE(M.isPaged());
+  EXPECT_EQ(M.get(Magic64 + 1), Magic64 + 1);
+  EXPECT_EQ(M.get(0), 1);
+
+  M.erase(Magic64);
+  M.erase(Magic64 + 1);
+  EXPECT_TRUE(M.isPaged());
+  M.erase(Magic32);
+  EXPECT_EQ(M.size(), 1);
+  EXPECT_TRUE(M.isSmall());
+  EXPECT_EQ(M.get(0), 1);
+
+  M[Magic128 - 1] = 2;
+  EXPECT_TRUE(M.isPaged());
+  M.clear();
+  EXPECT_EQ(M.size(), 0);
+  EXPECT_TRUE(M.isSmall());
+}
+
+TEST(SmallIndexMap, PagedMapNotInPlace)
+{
+  struct S
+  {
+    int I{};
+    S() = default;
+    S(int I) : I(I) {}
+  };
+
+  SmallIndexMap<S,
+                Magic32,
+                /* StoreInPlace =*/false,
+                /* IntrusiveDefaultSentinel =*/false,
+                std::size_t,
+                /* PageCount =*/Magic256>
+    M;
+  S* Zero = &(M[0] = 0);
+  for (int I = 1; I < Magic4096; I += 3)
+    M[I] = I;
+  EXPECT_TRUE(M.isPaged());
+  EXPECT_EQ(M.tryGet(0), Zero);
+  for (int I = 1; I < Magic4096; ++I)
+  {
+    if (I % 3 == 1)
+      EXPECT_EQ(M.get(I).I, I);
+    else
+      EXPECT_FALSE(M.contains(I));
+  }
+
+  for (int I = 1; I < Magic4096; I += 3)
+    M.erase(I);
+  EXPECT_EQ(M.size(), 1);
+  EXPECT_TRUE(M.isSmall());
+  EXPECT_EQ(M.tryGet(0), Zero);
+}
+
+template <bool TrackOccupancy> static void testOccupancy()
+{
+  SmallIndexMap<int,
+                Magic128,
+                /* StoreInPlace =*/true,
+                /* IntrusiveDefaultSentinel =*/false,
+                std::size_t,
+                /* PageCount =*/4,
+                TrackOccupancy>
+    M;
+  using Visited = std::vector<std::pair<std::size_t, int>>;
+  auto Collect = [&M] {
+    Visited V;
+    M.forEach([&V](std::size_t K, const int& I) { V.emplace_back(K, I); });
+    return V;
+  };
+
+  M[Magic64 + 1] = 1;
+  M[3] = 2;
+  M[Magic64] = 3;
+  M.erase(3);
+  EXPECT_TRUE(M.isSmall());
+  EXPECT_EQ(Collect(), (Visited{{Magic64, 3}, {Magic64 + 1, 1}}));
+
+  M[Magic256 + 1] = 4;
+  EXPECT_TRUE(M.isPaged());
+  EXPECT_EQ(Collect(), (Visited{{Magic64, 3}, {Magic64 + 1, 1}, {257, 4}}));
+
+  M[Magic4096] = 5;
+  EXPECT_TRUE(M.isLarge());
+  M.forEach([](std::size_t /* K */, int& I) { I *= 2; });
+  EXPECT_EQ(Collect(),
+            (Visited{{Magic64, 6}, {Magic64 + 1, 2}, {257, 8}, {4096, 10}}));
+
+  M.erase(Magic4096);
+  M.erase(Magic256 + 1);
+  EXPECT_TRUE(M.isSmall());
+  EXPECT_EQ(Collect(), (Visited{{Magic64, 6}, {Magic64 + 1, 2}}));
+
+  M.clear();
+  EXPECT_EQ(M.size(), 0);
+  EXPECT_TRUE(Collect().empty());
+  EXPECT_FALSE(M.contains(Magic64));
+
+  M[0] = 7;
+  EXPECT_EQ(Collect(), (Visited{{0, 7}}));
+}
+
+TEST(SmallIndexMap, Occupancy)
+{
+  testOccupancy</* TrackOccupancy =*/false>();
+  testOccupancy</* TrackOccupancy =*/true>();
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <csignal>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/client/ControlClient.hpp"
+
+using namespace monomux;
+using namespace monomux::client;
+
+using BatchCommand = ControlClient::BatchCommand;
+
+TEST(BatchCommand, SkipsBlankAndCommentLines)
+{
+  EXPECT_FALSE(BatchCommand::parse("", 1));
+  EXPECT_FALSE(BatchCommand::parse("   \t", 2));
+  EXPECT_FALSE(BatchCommand::parse("# create foo", 3));
+  EXPECT_FALSE(BatchCommand::parse("  # list", 4));
+}
+
+TEST(BatchCommand, ParsesCommands)
+{
+  auto Create = BatchCommand::parse("create  foo /bin/echo  hello world", 7);
+  ASSERT_TRUE(Create);
+  EXPECT_EQ(Create->Kind, BatchCommand::Create);
+  EXPECT_EQ(Create->Line, 7);
+  EXPECT_EQ(Create->Session, "foo");
+  EXPECT_EQ(Create->Program,
+            (std::vector<std::string>{"/bin/echo", "hello", "world"}));
+
+  auto Shell = BatchCommand::parse("create bar", 8);
+  ASSERT_TRUE(Shell);
+  EXPECT_TRUE(Shell->Program.empty());
+
+  auto Signal = BatchCommand::parse("signal foo SIGTERM", 9);
+  ASSERT_TRUE(Signal);
+  EXPECT_EQ(Signal->Kind, BatchCommand::Signal);
+  EXPECT_EQ(Signal->Number, static_cast<std::size_t>(SIGTERM));
+  Signal = BatchCommand::parse("signal foo WINCH", 10);
+  ASSERT_TRUE(Signal);
+  EXPECT_EQ(Signal->Number, static_cast<std::size_t>(SIGWINCH));
+  Signal = BatchCommand::parse("signal foo 9", 11);
+  ASSERT_TRUE(Signal);
+  EXPECT_EQ(Signal->Number, static_cast<std::size_t>(SIGKILL));
+
+  auto Rate = BatchCommand::parse("rate-limit foo 4096", 12);
+  ASSERT_TRUE(Rate);
+  EXPECT_EQ(Rate->Kind, BatchCommand::RateLimit);
+  EXPECT_EQ(Rate->Number, 4096);
+
+  EXPECT_EQ(BatchCommand::parse("detach foo", 13)->Kind,
+            BatchCommand::Detach);
+  EXPECT_EQ(BatchCommand::parse("detach-all foo", 14)->Kind,
+            BatchCommand::DetachAll);
+  EXPECT_EQ(BatchCommand::parse("list", 15)->Kind, BatchCommand::List);
+  EXPECT_EQ(BatchCommand::parse("statistics", 16)->Kind,
+            BatchCommand::Statistics);
+}
+
+TEST(BatchCommand, RejectsMalformedCommands)
+{
+  EXPECT_THROW(BatchCommand::parse("frobnicate", 1), std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("create", 1), std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("signal foo", 1), std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("signal foo SIGNOPE", 1),
+               std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("signal foo 0", 1), std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("rate-limit foo fast", 1),
+               std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("detach", 1), std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("detach foo bar", 1),
+               std::invalid_argument);
+  EXPECT_THROW(BatchCommand::parse("list foo", 1), std::invalid_argument);
+}
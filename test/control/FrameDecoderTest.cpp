@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/control/ChannelFrame.hpp"
+#include "monomux/control/CompressedFrame.hpp"
+#include "monomux/control/FrameDecoder.hpp"
+#include "monomux/control/MessageBase.hpp"
+#include "monomux/system/Pipe.hpp"
+
+using namespace monomux;
+using namespace monomux::message;
+
+namespace
+{
+
+std::string frame(const std::string& Payload)
+{
+  return Message::sizeToBinaryString(Payload.size()) + Payload;
+}
+
+} // namespace
+
+TEST(FrameDecoder, PartialFrame)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+  FrameDecoder Frames;
+
+  const std::string Data = frame("Hello!");
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+  EXPECT_FALSE(Frames.hasPartialFrame());
+
+  AP.getWrite()->write(Data.substr(0, 3));
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+  EXPECT_TRUE(Frames.hasPartialFrame());
+
+  AP.getWrite()->write(Data.substr(3, 7));
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+  EXPECT_TRUE(Frames.hasPartialFrame());
+
+  AP.getWrite()->write(Data.substr(10));
+  EXPECT_EQ(Frames.next(*AP.getRead()), "Hello!");
+  EXPECT_FALSE(Frames.hasPartialFrame());
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+}
+
+TEST(FrameDecoder, PipelinedFrames)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+  FrameDecoder Frames;
+
+  std::string Data;
+  for (int I = 0; I < 100; ++I)
+    Data += frame(std::to_string(I));
+  Data += frame("").substr(0, 4);
+  AP.getWrite()->write(Data);
+
+  for (int I = 0; I < 100; ++I)
+    EXPECT_EQ(Frames.next(*AP.getRead()), std::to_string(I));
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+  EXPECT_TRUE(Frames.hasPartialFrame());
+
+  AP.getWrite()->write(frame("").substr(4));
+  EXPECT_EQ(Frames.next(*AP.getRead()), "");
+}
+
+TEST(FrameDecoder, CorruptSize)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+  FrameDecoder Frames;
+
+  AP.getWrite()->write(
+    Message::sizeToBinaryString(FrameDecoder::MaxFrameSize + 1) + "Foo");
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+  EXPECT_TRUE(Frames.corrupt());
+
+  AP.getWrite()->write(frame("Foo"));
+  EXPECT_FALSE(Frames.next(*AP.getRead()));
+}
+
+TEST(FrameDecoder, ChannelFrames)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+  FrameDecoder Frames;
+
+  const std::string Large(ChannelFrameDataMax + 1, 'x');
+  std::string Data;
+  appendChannelFrames(Data, 1, "Hello!");
+  appendChannelFrames(Data, 2, {});
+  appendChannelFrames(Data, 65535, Large);
+  AP.getWrite()->write(Data);
+
+  std::optional<std::string> Frame = Frames.next(*AP.getRead());
+  ASSERT_TRUE(Frame);
+  auto Decoded = decodeChannelFrame(*Frame);
+  ASSERT_TRUE(Decoded);
+  EXPECT_EQ(Decoded->first, 1);
+  EXPECT_EQ(Decoded->second, "Hello!");
+
+  // Empty data produces no frames, and large data is split.
+  std::string Reassembled;
+  for (int Round = 0; Round < 64 && Reassembled.size() < Large.size(); ++Round)
+  {
+    // (More data was written than the pipe can hold.)
+    AP.getWrite()->flushWrites();
+    if (!(Frame = Frames.next(*AP.getRead())))
+      continue;
+    Decoded = decodeChannelFrame(*Frame);
+    ASSERT_TRUE(Decoded);
+    EXPECT_EQ(Decoded->first, 65535);
+    EXPECT_LE(Decoded->second.size(), ChannelFrameDataMax);
+    Reassembled.append(Decoded->second);
+  }
+  EXPECT_EQ(Reassembled, Large);
+
+  EXPECT_FALSE(decodeChannelFrame("x"));
+}
+
+TEST(FrameDecoder, CompressedFrames)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+  FrameDecoder Frames;
+
+  std::string Text;
+  for (int I = 0; Text.size() <= CompressedFrameDataMax; ++I)
+    Text.append("\033[1;32muser@host\033[0m:~$ ls ").append(std::to_string(I));
+  std::string Data;
+  appendCompressedFrames(Data, Text);
+  // The escape sequences and prompts repeat, so the frames are much smaller.
+  EXPECT_LT(Data.size(), Text.size() / 4);
+  // Short data does not shrink, and is stored as is.
+  appendCompressedFrames(Data, "Hi!");
+  AP.getWrite()->write(Data);
+
+  std::string Reassembled;
+  std::optional<std::string> Frame;
+  for (int Round = 0; Round < 64 && Reassembled.size() < Text.size(); ++Round)
+  {
+    AP.getWrite()->flushWrites();
+    if (!(Frame = Frames.next(*AP.getRead())))
+      continue;
+    std::optional<std::string> Decoded = decodeCompressedFrame(*Frame);
+    ASSERT_TRUE(Decoded);
+    EXPECT_LE(Decoded->size(), CompressedFrameDataMax);
+    Reassembled.append(*Decoded);
+  }
+  EXPECT_EQ(Reassembled, Text);
+
+  Frame = Frames.next(*AP.getRead());
+  ASSERT_TRUE(Frame);
+  EXPECT_EQ(Frame->size(), 4 + 3);
+  EXPECT_EQ(decodeCompressedFrame(*Frame), "Hi!");
+
+  EXPECT_FALSE(decodeCompressedFrame("x"));
+  // The original size does not match the data.
+  EXPECT_FALSE(decodeCompressedFrame(std::string{"\x10\0\0\0", 4} + "xyz"));
+}
@@ -22,6 +22,8 @@
 #include <ctime>
 
 #include "monomux/control/Message.hpp"
+#include "monomux/control/PascalString.hpp"
+#include "monomux/system/Pipe.hpp"
 
 /// Helper function for removing the explicit terminator from the created buffer
 /// for ease of testing.
@@ -44,6 +46,18 @@ template <typename Msg> static Msg codec(const Msg& M)
   return *Decode;
 }
 
+/// Encodes \p M in the binary encoding, and decodes it back.
+template <typename Msg> static Msg binaryCodec(const Msg& M)
+{
+  using namespace monomux::message;
+
+  std::string Data = monomux::message::encode(M, Encoding::Binary);
+  EXPECT_TRUE(isBinaryBody(Message::unpack(Data).RawData));
+  std::optional<Msg> Decode = decode<Msg>(Data);
+  EXPECT_TRUE(Decode && "Decoding just encoded message should succeed!");
+  return *Decode;
+}
+
 TEST(ControlMessageSerialisation, ConnectionNotification)
 {
   monomux::message::notification::Connection Obj;
@@ -122,10 +136,56 @@ TEST(ControlMessageSerialisation, DataSocketRespons)
   }
 }
 
+TEST(ControlMessageSerialisation, DataSocketPairRequest)
+{
+  monomux::message::request::DataSocketPair Obj;
+  EXPECT_EQ(encode(Obj), "<DATASOCKET-PAIR />");
+  EXPECT_FALSE(codec(Obj).Process);
+  EXPECT_FALSE(binaryCodec(Obj).Process);
+
+  Obj.Process = 4242;
+  EXPECT_EQ(encode(Obj), "<DATASOCKET-PAIR><PID>4242</PID></DATASOCKET-PAIR>");
+  EXPECT_EQ(codec(Obj).Process, 4242);
+  EXPECT_EQ(binaryCodec(Obj).Process, 4242);
+}
+
+TEST(ControlMessageSerialisation, DataSocketPairResponse)
+{
+  monomux::message::response::DataSocketPair Obj;
+  Obj.Success = true;
+  EXPECT_EQ(encode(Obj), "<DATASOCKET-PAIR><TRUE /></DATASOCKET-PAIR>");
+  EXPECT_TRUE(codec(Obj).Success);
+  EXPECT_TRUE(binaryCodec(Obj).Success);
+
+  Obj.Success = false;
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+}
+
 TEST(ControlMessageSerialisation, SessionListRequest)
 {
   EXPECT_EQ(encode(monomux::message::request::SessionList{}),
             "<SESSION-LIST />");
+
+  monomux::message::request::SessionList Obj;
+  Obj.Prefix = "Foo";
+  Obj.Offset = 20;
+  Obj.Limit = 10;
+  EXPECT_EQ(encode(Obj),
+            "<SESSION-LIST><PREFIX>Foo</PREFIX><OFFSET>20</OFFSET>"
+            "<LIMIT>10</LIMIT></SESSION-LIST>");
+
+  auto Decode = codec(Obj);
+  EXPECT_EQ(Decode.Prefix, "Foo");
+  EXPECT_EQ(Decode.Offset, 20);
+  EXPECT_EQ(Decode.Limit, 10);
+
+  Obj.Prefix.clear();
+  Obj.Offset = 0;
+  Decode = codec(Obj);
+  EXPECT_TRUE(Decode.Prefix.empty());
+  EXPECT_EQ(Decode.Offset, 0);
+  EXPECT_EQ(Decode.Limit, 10);
 }
 
 TEST(ControlMessageSerialisation, SessionListResponse)
@@ -158,6 +218,17 @@ TEST(ControlMessageSerialisation, SessionListResponse)
     EXPECT_EQ(Decode.Sessions.at(0).Created, CurrentTimeEncoded);
     EXPECT_EQ(Decode.Sessions.at(1).Name, "Bar");
     EXPECT_EQ(Decode.Sessions.at(1).Created, CurrentTimeEncoded2);
+    EXPECT_FALSE(Decode.Total);
+    EXPECT_FALSE(Decode.More);
+  }
+
+  Obj.Total = 1000;
+  Obj.More = true;
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.Sessions.size(), 2);
+    EXPECT_EQ(Decode.Total, 1000);
+    EXPECT_TRUE(Decode.More);
   }
 }
 
@@ -173,6 +244,8 @@ TEST(ControlMessageSerialisation, MakeSessionRequest)
     EXPECT_TRUE(Decode.SpawnOpts.Arguments.empty());
     EXPECT_TRUE(Decode.SpawnOpts.SetEnvironment.empty());
     EXPECT_TRUE(Decode.SpawnOpts.UnsetEnvironment.empty());
+    EXPECT_FALSE(Decode.ScrollbackSize.has_value());
+    EXPECT_FALSE(Decode.CoalesceWindow.has_value());
   }
 
   Obj.Name = "Foo";
@@ -203,6 +276,41 @@ TEST(ControlMessageSerialisation, MakeSessionRequest)
     EXPECT_EQ(Decode.SpawnOpts.SetEnvironment.at(0).second, "8");
     EXPECT_EQ(Decode.SpawnOpts.UnsetEnvironment.size(), 1);
     EXPECT_EQ(Decode.SpawnOpts.UnsetEnvironment.at(0), "TERM");
+    EXPECT_FALSE(Decode.ScrollbackSize.has_value());
+  }
+
+  Obj.ScrollbackSize = 0;
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.Name, "Foo");
+    EXPECT_EQ(Decode.SpawnOpts.Arguments.size(), 2);
+    EXPECT_EQ(Decode.ScrollbackSize, 0);
+  }
+
+  Obj.ScrollbackSize = 1ULL << 24;
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.SpawnOpts.UnsetEnvironment.size(), 1);
+    EXPECT_EQ(Decode.ScrollbackSize, 1ULL << 24);
+  }
+
+  Obj.CoalesceWindow = 500;
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.ScrollbackSize, 1ULL << 24);
+    EXPECT_EQ(Decode.CoalesceWindow, 500);
+    EXPECT_FALSE(Decode.RateLimit.has_value());
+  }
+
+  Obj.RateLimit = 1ULL << 16;
+
+  {
+    auto Decode = codec(Obj);
+    EXPECT_EQ(Decode.CoalesceWindow, 500);
+    EXPECT_EQ(Decode.RateLimit, 1ULL << 16);
   }
 }
 
@@ -250,6 +358,51 @@ TEST(ControlMessageSerialisation, AttachRequest)
   {
     auto Decode = codec(Obj);
     EXPECT_EQ(Decode.Name, "Bar");
+    EXPECT_FALSE(Decode.Observer);
+  }
+
+  Obj.Observer = true;
+
+  EXPECT_EQ(encode(Obj), "<ATTACH><NAME>Bar</NAME><OBSERVER /></ATTACH>");
+
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Name, "Bar");
+    EXPECT_TRUE(Decode.Observer);
+    EXPECT_FALSE(Decode.Resumable);
+    EXPECT_FALSE(Decode.ResumeFrom);
+  }
+
+  Obj.Observer = false;
+  Obj.Resumable = true;
+  Obj.ResumeFrom = 1ULL << 33;
+  Obj.ResumeCreated = 1'700'000'000;
+
+  EXPECT_EQ(encode(Obj),
+            "<ATTACH><NAME>Bar</NAME><RESUMABLE />"
+            "<RESUME-FROM>8589934592</RESUME-FROM>"
+            "<RESUME-CREATED>1700000000</RESUME-CREATED></ATTACH>");
+
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_FALSE(Decode.Observer);
+    EXPECT_TRUE(Decode.Resumable);
+    EXPECT_EQ(Decode.ResumeFrom, Obj.ResumeFrom);
+    EXPECT_EQ(Decode.ResumeCreated, Obj.ResumeCreated);
+    EXPECT_FALSE(Decode.CatchUp);
+  }
+
+  Obj.Resumable = false;
+  Obj.ResumeFrom.reset();
+  Obj.CatchUp = true;
+
+  EXPECT_EQ(encode(Obj), "<ATTACH><NAME>Bar</NAME><CATCH-UP /></ATTACH>");
+
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_FALSE(Decode.Resumable);
+    EXPECT_FALSE(Decode.ResumeFrom);
+    EXPECT_TRUE(Decode.CatchUp);
   }
 }
 
@@ -277,6 +430,19 @@ TEST(ControlMessageSerialisation, AttachResponse)
     EXPECT_TRUE(Decode.Success);
     EXPECT_EQ(Decode.Session.Name, Obj.Session.Name);
     EXPECT_EQ(Decode.Session.Created, Obj.Session.Created);
+    EXPECT_FALSE(Decode.Offset);
+  }
+
+  Obj.Offset = 4096;
+
+  EXPECT_NE(encode(Obj).find("<OFFSET>4096</OFFSET></ATTACH>"),
+            std::string::npos);
+
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_TRUE(Decode.Success);
+    EXPECT_EQ(Decode.Session.Name, Obj.Session.Name);
+    EXPECT_EQ(Decode.Offset, Obj.Offset);
   }
 }
 
@@ -331,6 +497,11 @@ TEST(ControlMessageSerialisation, DetachedNotification)
   EXPECT_EQ(codec(Obj).Mode, Detached::Kicked);
   EXPECT_EQ(codec(Obj).ExitCode, 0);
   EXPECT_EQ(codec(Obj).Reason, Obj.Reason);
+
+  Obj.Mode = Detached::ServerUpgrade;
+  EXPECT_EQ(encode(Obj), "<DETACHED><MODE>Upgrade</MODE></DETACHED>");
+  EXPECT_EQ(codec(Obj).Mode, Detached::ServerUpgrade);
+  EXPECT_TRUE(codec(Obj).Reason.empty());
 }
 
 TEST(ControlMessageSerialisation, SignalRequest)
@@ -361,6 +532,13 @@ TEST(ControlMessageSerialisation, StatisticsRequest)
 {
   monomux::message::request::Statistics Obj;
   EXPECT_EQ(encode(Obj), "<SEND-STATISTICS />");
+  EXPECT_FALSE(codec(Obj).Streamed);
+  EXPECT_FALSE(binaryCodec(Obj).Streamed);
+
+  Obj.Streamed = true;
+  EXPECT_EQ(encode(Obj), "<SEND-STATISTICS><STREAMED /></SEND-STATISTICS>");
+  EXPECT_TRUE(codec(Obj).Streamed);
+  EXPECT_TRUE(binaryCodec(Obj).Streamed);
 }
 
 TEST(ControlMessageSerialisation, StatisticsResponse)
@@ -372,5 +550,617 @@ TEST(ControlMessageSerialisation, StatisticsResponse)
     auto Decode = codec(Obj);
     EXPECT_EQ(encode(Obj), "<STATISTICS Size=\"3\">Foo</STATISTICS>");
     EXPECT_EQ(Decode.Contents, Obj.Contents);
+    EXPECT_FALSE(Decode.More);
+  }
+
+  Obj.More = true;
+  EXPECT_EQ(encode(Obj), "<STATISTICS Size=\"3\">Foo<MORE /></STATISTICS>");
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Contents, Obj.Contents);
+    EXPECT_TRUE(Decode.More);
+  }
+}
+
+TEST(ControlMessageSerialisation, ProtocolRequest)
+{
+  monomux::message::request::Protocol Obj;
+  Obj.BinaryVersion = 1;
+  EXPECT_EQ(encode(Obj), "<PROTOCOL><BINARY>1</BINARY></PROTOCOL>");
+  EXPECT_EQ(codec(Obj).BinaryVersion, 1);
+  EXPECT_EQ(binaryCodec(Obj).BinaryVersion, 1);
+}
+
+TEST(ControlMessageSerialisation, SubscribeRequest)
+{
+  monomux::message::request::Subscribe Obj;
+  EXPECT_EQ(encode(Obj), "<SUBSCRIBE />");
+  codec(Obj);
+  binaryCodec(Obj);
+}
+
+TEST(ControlMessageSerialisation, SubscribeResponse)
+{
+  monomux::message::response::Subscribe Obj;
+  EXPECT_EQ(encode(Obj), "<SUBSCRIBED Count=\"0\"></SUBSCRIBED>");
+  EXPECT_TRUE(codec(Obj).Sessions.empty());
+
+  Obj.Sessions.push_back({});
+  Obj.Sessions.at(0).Name = "Foo";
+  Obj.Sessions.at(0).Created = 42; // NOLINT(readability-magic-numbers)
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Sessions.size(), 1);
+    EXPECT_EQ(Decode.Sessions.at(0).Name, "Foo");
+    EXPECT_EQ(Decode.Sessions.at(0).Created, 42);
+  }
+}
+
+TEST(ControlMessageSerialisation, SessionEventNotification)
+{
+  using namespace monomux::message::notification;
+  SessionEvent Obj;
+  Obj.Event = SessionEvent::Attached;
+  Obj.Session.Name = "Foo";
+  Obj.Session.Created = 42; // NOLINT(readability-magic-numbers)
+  Obj.AttachedClients = 2;
+  EXPECT_EQ(encode(Obj),
+            "<SESSION-EVENT><EVENT>Attached</EVENT>"
+            "<SESSION><NAME>Foo</NAME><CREATED>42</CREATED></SESSION>"
+            "<CLIENTS>2</CLIENTS></SESSION-EVENT>");
+
+  for (SessionEvent::EventKind E : {SessionEvent::Created,
+                                    SessionEvent::Destroyed,
+                                    SessionEvent::Attached,
+                                    SessionEvent::Detached})
+  {
+    Obj.Event = E;
+    for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+    {
+      EXPECT_EQ(Decode.Event, E);
+      EXPECT_EQ(Decode.Session.Name, "Foo");
+      EXPECT_EQ(Decode.Session.Created, 42);
+      EXPECT_EQ(Decode.AttachedClients, 2);
+    }
+  }
+}
+
+TEST(ControlMessageSerialisation, SessionStatus)
+{
+  using namespace monomux::message;
+  SessionStatus Obj;
+  Obj.Session.Name = "Foo";
+  Obj.Session.Created = 42; // NOLINT(readability-magic-numbers)
+  Obj.AttachedClients = 2;
+  Obj.LastActive = 1337; // NOLINT(readability-magic-numbers)
+  std::string Text = SessionStatus::encode(Obj);
+  EXPECT_EQ(Text,
+            "<SESSION-STATUS>"
+            "<SESSION><NAME>Foo</NAME><CREATED>42</CREATED></SESSION>"
+            "<ATTACHED>2</ATTACHED><ACTIVE>1337</ACTIVE></SESSION-STATUS>");
+  // A base is decoded from the middle of an enclosing message.
+  Text.append("</STATUS>");
+  std::string_view View = Text;
+  std::optional<SessionStatus> TextDecode = SessionStatus::decode(View);
+  EXPECT_EQ(View, "</STATUS>");
+
+  std::string Binary;
+  BinaryWriter Writer{Binary};
+  SessionStatus::encodeBinary(Writer, Obj);
+  BinaryReader Reader{Binary};
+  std::optional<SessionStatus> BinaryDecode =
+    SessionStatus::decodeBinary(Reader);
+  EXPECT_TRUE(Reader.done());
+
+  for (const auto& Decode : {TextDecode, BinaryDecode})
+  {
+    ASSERT_TRUE(Decode);
+    EXPECT_EQ(Decode->Session.Name, "Foo");
+    EXPECT_EQ(Decode->Session.Created, 42);
+    EXPECT_EQ(Decode->AttachedClients, 2);
+    EXPECT_EQ(Decode->LastActive, 1337);
+  }
+}
+
+TEST(ControlMessageSerialisation, SharedOutputRequest)
+{
+  monomux::message::request::SharedOutput Obj;
+  EXPECT_EQ(encode(Obj), "<SHARED-OUTPUT />");
+  codec(Obj);
+  binaryCodec(Obj);
+}
+
+TEST(ControlMessageSerialisation, SharedOutputResponse)
+{
+  monomux::message::response::SharedOutput Obj;
+  Obj.Success = true;
+  EXPECT_EQ(encode(Obj), "<SHARED-OUTPUT><TRUE /></SHARED-OUTPUT>");
+  EXPECT_TRUE(codec(Obj).Success);
+  EXPECT_TRUE(binaryCodec(Obj).Success);
+
+  Obj.Success = false;
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+}
+
+TEST(ControlMessageSerialisation, CompressionRequest)
+{
+  monomux::message::request::Compression Obj;
+  EXPECT_EQ(encode(Obj), "<COMPRESSION />");
+  codec(Obj);
+  binaryCodec(Obj);
+}
+
+TEST(ControlMessageSerialisation, CompressionResponse)
+{
+  monomux::message::response::Compression Obj;
+  Obj.Success = true;
+  EXPECT_EQ(encode(Obj), "<COMPRESSION><TRUE /></COMPRESSION>");
+  EXPECT_TRUE(codec(Obj).Success);
+  EXPECT_TRUE(binaryCodec(Obj).Success);
+
+  Obj.Success = false;
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+}
+
+TEST(ControlMessageSerialisation, PtyHandOffRequest)
+{
+  monomux::message::request::PtyHandOff Obj;
+  EXPECT_EQ(encode(Obj), "<PTY-HANDOFF />");
+  codec(Obj);
+  binaryCodec(Obj);
+}
+
+TEST(ControlMessageSerialisation, PtyHandOffResponse)
+{
+  monomux::message::response::PtyHandOff Obj;
+  Obj.Success = true;
+  EXPECT_EQ(encode(Obj), "<PTY-HANDOFF><TRUE /></PTY-HANDOFF>");
+  EXPECT_TRUE(codec(Obj).Success);
+  EXPECT_TRUE(binaryCodec(Obj).Success);
+
+  Obj.Success = false;
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+}
+
+TEST(ControlMessageSerialisation, MetricsRequest)
+{
+  monomux::message::request::Metrics Obj;
+  EXPECT_EQ(encode(Obj), "<SEND-METRICS />");
+  codec(Obj);
+  binaryCodec(Obj);
+
+  Obj.Streamed = true;
+  EXPECT_EQ(encode(Obj), "<SEND-METRICS><STREAMED /></SEND-METRICS>");
+  EXPECT_TRUE(codec(Obj).Streamed);
+  EXPECT_TRUE(binaryCodec(Obj).Streamed);
+}
+
+TEST(ControlMessageSerialisation, MetricsResponse)
+{
+  using monomux::message::Metric;
+  monomux::message::response::Metrics Obj;
+  EXPECT_EQ(encode(Obj), "<METRICS Count=\"0\"></METRICS>");
+  EXPECT_TRUE(codec(Obj).Samples.empty());
+
+  Metric& C = Obj.Samples.emplace_back();
+  C.Name = "foo_total";
+  C.Labels.emplace_back("session", "Bar");
+  C.Value = 42; // NOLINT(readability-magic-numbers)
+  EXPECT_EQ(encode(Obj),
+            "<METRICS Count=\"1\"><METRIC><KIND>Counter</KIND>"
+            "<NAME>foo_total</NAME><LABELS Count=\"1\"><LABEL>"
+            "<KEY Size=\"7\">session</KEY><VAL Size=\"3\">Bar</VAL>"
+            "</LABEL></LABELS><VALUE>42</VALUE><BUCKETS Count=\"0\">"
+            "</BUCKETS></METRIC></METRICS>");
+
+  Metric& H = Obj.Samples.emplace_back();
+  H.Type = Metric::Histogram;
+  H.Name = "baz";
+  H.Value = 7;
+  H.Buckets = {1, 0, 2};
+
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    ASSERT_EQ(Decode.Samples.size(), 2);
+    EXPECT_EQ(Decode.Samples.at(0).Type, Metric::Counter);
+    EXPECT_EQ(Decode.Samples.at(0).Name, "foo_total");
+    ASSERT_EQ(Decode.Samples.at(0).Labels.size(), 1);
+    EXPECT_EQ(Decode.Samples.at(0).Labels.at(0).first, "session");
+    EXPECT_EQ(Decode.Samples.at(0).Labels.at(0).second, "Bar");
+    EXPECT_EQ(Decode.Samples.at(0).Value, 42);
+    EXPECT_TRUE(Decode.Samples.at(0).Buckets.empty());
+
+    EXPECT_EQ(Decode.Samples.at(1).Type, Metric::Histogram);
+    EXPECT_EQ(Decode.Samples.at(1).Name, "baz");
+    EXPECT_TRUE(Decode.Samples.at(1).Labels.empty());
+    EXPECT_EQ(Decode.Samples.at(1).Value, 7);
+    EXPECT_EQ(Decode.Samples.at(1).Buckets,
+              (std::vector<std::uint64_t>{1, 0, 2}));
+    EXPECT_FALSE(Decode.More);
+  }
+
+  Obj.More = true;
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Samples.size(), 2);
+    EXPECT_TRUE(Decode.More);
+  }
+}
+
+TEST(ControlMessageSerialisation, TraceRequest)
+{
+  monomux::message::request::Trace Obj;
+  EXPECT_EQ(encode(Obj), "<SEND-TRACE />");
+  codec(Obj);
+  binaryCodec(Obj);
+
+  Obj.Streamed = true;
+  EXPECT_EQ(encode(Obj), "<SEND-TRACE><STREAMED /></SEND-TRACE>");
+  EXPECT_TRUE(codec(Obj).Streamed);
+  EXPECT_TRUE(binaryCodec(Obj).Streamed);
+}
+
+TEST(ControlMessageSerialisation, TraceResponse)
+{
+  using monomux::trace::Event;
+  monomux::message::response::Trace Obj;
+  EXPECT_EQ(encode(Obj), "<TRACE Count=\"0\"></TRACE>");
+  EXPECT_TRUE(codec(Obj).Records.empty());
+
+  Obj.Records.push_back({1, -1, Event::LoopWake, 0, 0, 2});
+  Obj.Records.push_back({5, 7, Event::ChannelFlush, 1, 64, 32});
+  EXPECT_EQ(encode(Obj),
+            "<TRACE Count=\"2\"><RECORD><T>1</T><FD>-1</FD><EVENT>1</EVENT>"
+            "<THREAD>0</THREAD><REQUESTED>0</REQUESTED><BYTES>2</BYTES>"
+            "</RECORD><RECORD><T>5</T><FD>7</FD><EVENT>7</EVENT>"
+            "<THREAD>1</THREAD><REQUESTED>64</REQUESTED><BYTES>32</BYTES>"
+            "</RECORD></TRACE>");
+
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    ASSERT_EQ(Decode.Records.size(), 2);
+    EXPECT_EQ(Decode.Records.at(0).FD, -1);
+    EXPECT_EQ(Decode.Records.at(0).Id, Event::LoopWake);
+    EXPECT_EQ(Decode.Records.at(0).Bytes, 2);
+    EXPECT_EQ(Decode.Records.at(1).Timestamp, 5);
+    EXPECT_EQ(Decode.Records.at(1).FD, 7);
+    EXPECT_EQ(Decode.Records.at(1).Id, Event::ChannelFlush);
+    EXPECT_EQ(Decode.Records.at(1).Thread, 1);
+    EXPECT_EQ(Decode.Records.at(1).Requested, 64);
+    EXPECT_EQ(Decode.Records.at(1).Bytes, 32);
+    EXPECT_FALSE(Decode.More);
+  }
+
+  Obj.More = true;
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Records.size(), 2);
+    EXPECT_TRUE(Decode.More);
+  }
+}
+
+TEST(ControlMessageSerialisation, RateLimitRequest)
+{
+  monomux::message::request::RateLimit Obj;
+  EXPECT_EQ(encode(Obj), "<RATE-LIMIT>0</RATE-LIMIT>");
+  EXPECT_EQ(codec(Obj).BytesPerSecond, 0);
+
+  Obj.BytesPerSecond = 1ULL << 20;
+  EXPECT_EQ(encode(Obj), "<RATE-LIMIT>1048576</RATE-LIMIT>");
+  EXPECT_EQ(codec(Obj).BytesPerSecond, 1ULL << 20);
+  EXPECT_EQ(binaryCodec(Obj).BytesPerSecond, 1ULL << 20);
+}
+
+TEST(ControlMessageSerialisation, RateLimitResponse)
+{
+  monomux::message::response::RateLimit Obj;
+  Obj.Success = true;
+  EXPECT_EQ(encode(Obj), "<RATE-LIMIT><TRUE /></RATE-LIMIT>");
+  EXPECT_TRUE(codec(Obj).Success);
+  EXPECT_TRUE(binaryCodec(Obj).Success);
+
+  Obj.Success = false;
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+}
+
+TEST(ControlMessageSerialisation, OpenChannelRequest)
+{
+  monomux::message::request::OpenChannel Obj;
+  Obj.Name = "Foo";
+  EXPECT_EQ(encode(Obj), "<OPEN-CHANNEL><NAME>Foo</NAME></OPEN-CHANNEL>");
+  EXPECT_EQ(codec(Obj).Name, "Foo");
+  EXPECT_FALSE(codec(Obj).Observer);
+
+  Obj.Observer = true;
+  EXPECT_EQ(encode(Obj),
+            "<OPEN-CHANNEL><NAME>Foo</NAME><OBSERVER /></OPEN-CHANNEL>");
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Name, "Foo");
+    EXPECT_TRUE(Decode.Observer);
+  }
+}
+
+TEST(ControlMessageSerialisation, OpenChannelResponse)
+{
+  monomux::message::response::OpenChannel Obj;
+  Obj.Success = false;
+  EXPECT_EQ(encode(Obj), "<OPEN-CHANNEL><FALSE /></OPEN-CHANNEL>");
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+
+  Obj.Success = true;
+  Obj.Channel = 65535; // NOLINT(readability-magic-numbers)
+  Obj.Session.Name = "Foo";
+  Obj.Session.Created =
+    std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_TRUE(Decode.Success);
+    EXPECT_EQ(Decode.Channel, Obj.Channel);
+    EXPECT_EQ(Decode.Session.Name, Obj.Session.Name);
+    EXPECT_EQ(Decode.Session.Created, Obj.Session.Created);
+  }
+}
+
+TEST(ControlMessageSerialisation, CloseChannelNotification)
+{
+  monomux::message::notification::CloseChannel Obj;
+  Obj.Channel = 3;
+  EXPECT_EQ(encode(Obj), "<CLOSE-CHANNEL>3</CLOSE-CHANNEL>");
+  EXPECT_EQ(codec(Obj).Channel, 3);
+  EXPECT_EQ(binaryCodec(Obj).Channel, 3);
+}
+
+TEST(ControlMessageSerialisation, ChannelClosedNotification)
+{
+  using namespace monomux::message::notification;
+  ChannelClosed Obj;
+  Obj.Channel = 2;
+  Obj.Reason.Mode = Detached::Exit;
+  Obj.Reason.ExitCode = 1;
+  EXPECT_EQ(encode(Obj),
+            "<CHANNEL-CLOSED><CHANNEL>2</CHANNEL>"
+            "<DETACHED><MODE>Exit</MODE><CODE>1</CODE></DETACHED>"
+            "</CHANNEL-CLOSED>");
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Channel, 2);
+    EXPECT_EQ(Decode.Reason.Mode, Detached::Exit);
+    EXPECT_EQ(Decode.Reason.ExitCode, 1);
+  }
+
+  Obj.Reason.Mode = Detached::Kicked;
+  Obj.Reason.Reason = "Test";
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Reason.Mode, Detached::Kicked);
+    EXPECT_EQ(Decode.Reason.Reason, "Test");
+  }
+
+  EXPECT_FALSE(ChannelClosed::decode("<CHANNEL-CLOSED><CHANNEL>2</CHANNEL>"
+                                     "<DETACHED><MODE>Exit</MODE></DETACHED>"));
+}
+
+TEST(ControlMessageSerialisation, ChannelRedrawNotification)
+{
+  monomux::message::notification::ChannelRedraw Obj;
+  Obj.Channel = 1;
+  Obj.Columns = 80; // NOLINT(readability-magic-numbers)
+  Obj.Rows = 24;    // NOLINT(readability-magic-numbers)
+  EXPECT_EQ(encode(Obj),
+            "<CHANNEL-WINDOW-SIZE-CHANGE><CHANNEL>1</CHANNEL>"
+            "<ROWS>24</ROWS><COLS>80</COLS></CHANNEL-WINDOW-SIZE-CHANGE>");
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Channel, Obj.Channel);
+    EXPECT_EQ(Decode.Rows, Obj.Rows);
+    EXPECT_EQ(Decode.Columns, Obj.Columns);
+  }
+}
+
+TEST(ControlMessageSerialisation, SearchRequest)
+{
+  monomux::message::request::Search Obj;
+  Obj.Pattern = "</PATTERN>";
+  EXPECT_EQ(encode(Obj),
+            "<SEARCH><PATTERN Size=\"10\"></PATTERN></PATTERN>"
+            "<MAX>0</MAX></SEARCH>");
+  EXPECT_EQ(codec(Obj).Pattern, Obj.Pattern);
+  EXPECT_TRUE(codec(Obj).Session.empty());
+
+  Obj.Session = "Foo";
+  Obj.MaxMatches = 8;
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_EQ(Decode.Pattern, Obj.Pattern);
+    EXPECT_EQ(Decode.Session, "Foo");
+    EXPECT_EQ(Decode.MaxMatches, 8);
+  }
+}
+
+TEST(ControlMessageSerialisation, SearchResponse)
+{
+  monomux::message::response::Search Obj;
+  Obj.Success = false;
+  EXPECT_EQ(encode(Obj),
+            "<SEARCH><FALSE /><MATCHES Count=\"0\"></MATCHES></SEARCH>");
+  EXPECT_FALSE(codec(Obj).Success);
+  EXPECT_FALSE(binaryCodec(Obj).Success);
+
+  Obj.Success = true;
+  Obj.Matches.emplace_back(
+    monomux::message::SearchMatch{"Foo", 1ULL << 40, "error: <MATCH>"});
+  Obj.Matches.emplace_back(monomux::message::SearchMatch{"Bar", 0, ""});
+  Obj.Truncated = true;
+  for (const auto& Decode : {codec(Obj), binaryCodec(Obj)})
+  {
+    EXPECT_TRUE(Decode.Success);
+    ASSERT_EQ(Decode.Matches.size(), 2);
+    EXPECT_EQ(Decode.Matches.at(0).Session, "Foo");
+    EXPECT_EQ(Decode.Matches.at(0).Offset, 1ULL << 40);
+    EXPECT_EQ(Decode.Matches.at(0).Context, "error: <MATCH>");
+    EXPECT_EQ(Decode.Matches.at(1).Session, "Bar");
+    EXPECT_TRUE(Decode.Matches.at(1).Context.empty());
+    EXPECT_TRUE(Decode.Truncated);
+  }
+}
+
+TEST(ControlMessageSerialisation, BinaryLayout)
+{
+  using namespace monomux::message;
+  notification::Redraw Obj;
+  Obj.Rows = 0x0102;    // NOLINT(readability-magic-numbers)
+  Obj.Columns = 0x0304; // NOLINT(readability-magic-numbers)
+
+  std::string Data = monomux::message::encode(Obj, Encoding::Binary);
+  std::string_view Body = Message::unpack(Data).RawData;
+  EXPECT_EQ(Body, std::string_view("\x01\x02\x01\x04\x03", 5));
+
+  response::Attach Resp;
+  Resp.Success = true;
+  Resp.Session.Name = "Foo";
+  Resp.Session.Created = 1;
+  Data = monomux::message::encode(Resp, Encoding::Binary);
+  Body = Message::unpack(Data).RawData;
+  EXPECT_EQ(Body,
+            std::string_view("\x01\x01"
+                             "\x03\0\0\0Foo"
+                             "\x01\0\0\0\0\0\0\0",
+                             2 + 4 + 3 + 8));
+}
+
+TEST(ControlMessageSerialisation, BinaryMakeSessionRequest)
+{
+  monomux::message::request::MakeSession Obj;
+  Obj.Name = "Foo";
+  Obj.SpawnOpts.Program = "/bin/sh";
+  Obj.SpawnOpts.Arguments = {"-c", "", "echo <FOO>"};
+  Obj.SpawnOpts.SetEnvironment = {{"A", "B"}, {"C", ""}};
+  Obj.SpawnOpts.UnsetEnvironment = {"D"};
+  Obj.CoalesceWindow = 500;
+  Obj.RateLimit = 0;
+
+  auto Decode = binaryCodec(Obj);
+  EXPECT_EQ(Decode.Name, Obj.Name);
+  EXPECT_EQ(Decode.SpawnOpts.Program, Obj.SpawnOpts.Program);
+  EXPECT_EQ(Decode.SpawnOpts.Arguments, Obj.SpawnOpts.Arguments);
+  EXPECT_EQ(Decode.SpawnOpts.SetEnvironment, Obj.SpawnOpts.SetEnvironment);
+  EXPECT_EQ(Decode.SpawnOpts.UnsetEnvironment, Obj.SpawnOpts.UnsetEnvironment);
+  EXPECT_FALSE(Decode.ScrollbackSize);
+  EXPECT_EQ(Decode.CoalesceWindow, 500);
+  EXPECT_EQ(Decode.RateLimit, 0);
+}
+
+TEST(ControlMessageSerialisation, BinarySessionListResponse)
+{
+  monomux::message::response::SessionList Obj;
+  Obj.Sessions.push_back({"Foo", 1});
+  Obj.Sessions.push_back({"</SESSION>", -1});
+
+  auto Decode = binaryCodec(Obj);
+  ASSERT_EQ(Decode.Sessions.size(), 2);
+  EXPECT_EQ(Decode.Sessions.at(0).Name, "Foo");
+  EXPECT_EQ(Decode.Sessions.at(0).Created, 1);
+  EXPECT_EQ(Decode.Sessions.at(1).Name, "</SESSION>");
+  EXPECT_EQ(Decode.Sessions.at(1).Created, -1);
+  EXPECT_FALSE(Decode.Total);
+
+  Obj.Total = 1000;
+  Obj.More = true;
+  Decode = binaryCodec(Obj);
+  EXPECT_EQ(Decode.Sessions.size(), 2);
+  EXPECT_EQ(Decode.Total, 1000);
+  EXPECT_TRUE(Decode.More);
+}
+
+TEST(ControlMessageSerialisation, BinarySessionListRequest)
+{
+  using namespace monomux::message;
+  // The request for the entire list has no body, as it used to.
+  std::string Data = encode(request::SessionList{}, Encoding::Binary);
+  EXPECT_EQ(Message::unpack(Data).RawData.size(), 1);
+  EXPECT_FALSE(binaryCodec(request::SessionList{}).Limit);
+
+  request::SessionList Obj;
+  Obj.Prefix = "<Foo>";
+  Obj.Offset = 20;
+  Obj.Limit = 0;
+  auto Decode = binaryCodec(Obj);
+  EXPECT_EQ(Decode.Prefix, "<Foo>");
+  EXPECT_EQ(Decode.Offset, 20);
+  EXPECT_EQ(Decode.Limit, 0);
+}
+
+TEST(ControlMessageSerialisation, BinaryDetachedNotification)
+{
+  using namespace monomux::message::notification;
+  Detached Obj;
+  Obj.Mode = Detached::Exit;
+  Obj.ExitCode = -9; // NOLINT(readability-magic-numbers)
+  {
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Mode, Detached::Exit);
+    EXPECT_EQ(Decode.ExitCode, -9);
+  }
+
+  Obj.Mode = Detached::Kicked;
+  Obj.Reason = "Bad intent";
+  {
+    auto Decode = binaryCodec(Obj);
+    EXPECT_EQ(Decode.Mode, Detached::Kicked);
+    EXPECT_EQ(Decode.Reason, "Bad intent");
+  }
+
+  Obj.Mode = Detached::ServerUpgrade;
+  EXPECT_EQ(binaryCodec(Obj).Mode, Detached::ServerUpgrade);
+}
+
+TEST(ControlMessageSerialisation, BinaryRejectsMalformed)
+{
+  using namespace monomux::message;
+  response::Statistics Obj;
+  Obj.Contents = "Foo";
+
+  std::string Data = monomux::message::encode(Obj, Encoding::Binary);
+  std::string_view Body = Message::unpack(Data).RawData;
+  EXPECT_TRUE(response::Statistics::decode(Body));
+
+  // Truncated string.
+  EXPECT_FALSE(response::Statistics::decode(Body.substr(0, Body.size() - 1)));
+  // Trailing garbage.
+  EXPECT_FALSE(response::Statistics::decode(std::string{Body} + "X"));
+
+  // A list whose count claims more elements than there is data for.
+  response::SessionList List;
+  List.Sessions.push_back({"Foo", 1});
+  Data = monomux::message::encode(List, Encoding::Binary);
+  std::string Broken{Message::unpack(Data).RawData};
+  Broken[1] = '\x7F';
+  EXPECT_FALSE(response::SessionList::decode(Broken));
+}
+
+TEST(ControlMessageSerialisation, SendInPlace)
+{
+  using namespace monomux;
+  using namespace monomux::message;
+  Pipe::AnonymousPipe AP = Pipe::create();
+  AP.getRead()->setNonblocking();
+  AP.getWrite()->setNonblocking();
+
+  request::MakeSession Obj;
+  Obj.Name = "Foo";
+  Obj.SpawnOpts.Program = "/bin/bash";
+  Obj.SpawnOpts.Arguments.emplace_back("--norc");
+
+  for (Encoding E : {Encoding::Text, Encoding::Binary})
+  {
+    const std::string Expected = encodeWithSize(Obj, E);
+    EXPECT_EQ(sendMessage(*AP.getWrite(), Obj, E), Expected.size());
+    EXPECT_EQ(AP.getRead()->read(Expected.size()), Expected);
   }
 }
@@ -0,0 +1,156 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/ForkServer.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+
+/// Waits for the results of the \p Count requests sent to \p FS.
+static std::vector<ForkServer::Result> waitResults(ForkServer& FS,
+                                                   std::size_t Count)
+{
+  std::vector<ForkServer::Result> Results;
+  while (Results.size() < Count && FS.alive())
+  {
+    ::pollfd PFD{FS.raw(), POLLIN, 0};
+    if (::poll(&PFD, 1, 5000) <= 0)
+      break;
+    for (ForkServer::Result& R : FS.results())
+      Results.emplace_back(std::move(R));
+  }
+  return Results;
+}
+
+/// Reads the output of \p P from its PTY until \p Expected is seen.
+static std::string readUntil(Process& P, const std::string& Expected)
+{
+  std::string Output;
+  auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (Output.find(Expected) == std::string::npos &&
+         std::chrono::steady_clock::now() < Deadline)
+  {
+    try
+    {
+      Output.append(P.getPty()->reader().read(64));
+    }
+    catch (const std::system_error&)
+    {
+      // The other side of the PTY had closed.
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return Output;
+}
+
+TEST(ForkServer, SpawnsChildOfCaller)
+{
+  ForkServer FS = ForkServer::start();
+  EXPECT_TRUE(FS.alive());
+
+  Process::SpawnOptions Opts;
+  Opts.Program = "/bin/sh";
+  Opts.Arguments = {"-c", "echo \"$MONOMUX_TEST\"; read -r X; exit 3"};
+  Opts.Environment["MONOMUX_TEST"] = "forked";
+  Opts.CreatePTY = true;
+  FS.spawn(Opts);
+  EXPECT_EQ(FS.pending(), 1);
+
+  std::vector<ForkServer::Result> Results = waitResults(FS, 1);
+  ASSERT_EQ(Results.size(), 1);
+  EXPECT_EQ(FS.pending(), 0);
+  ASSERT_TRUE(Results.front().Spawned);
+  Process& P = *Results.front().Spawned;
+  EXPECT_NE(P.raw(), FS.pid());
+  ASSERT_TRUE(P.hasPty());
+  EXPECT_TRUE(P.getPty()->isMaster());
+
+  EXPECT_NE(readUntil(P, "forked").find("forked"), std::string::npos);
+  P.getPty()->writer().write("\n");
+
+  // The process is the child of the caller, not of the helper.
+  P.wait();
+  EXPECT_EQ(P.exitCode(), 3);
+}
+
+TEST(ForkServer, ResultsInOrder)
+{
+  ForkServer FS = ForkServer::start();
+
+  Process::SpawnOptions Opts;
+  Opts.Program = "/bin/sh";
+  Opts.CreatePTY = true;
+  for (int I = 0; I < 3; ++I)
+  {
+    Opts.Arguments = {"-c", "exit " + std::to_string(I)};
+    FS.spawn(Opts);
+  }
+
+  std::vector<ForkServer::Result> Results = waitResults(FS, 3);
+  ASSERT_EQ(Results.size(), 3);
+  for (std::size_t I = 0; I < Results.size(); ++I)
+  {
+    ASSERT_TRUE(Results[I].Spawned);
+    Results[I].Spawned->wait();
+    EXPECT_EQ(Results[I].Spawned->exitCode(), I);
+  }
+}
+
+TEST(ForkServer, ExecFailureIsCallersToCollect)
+{
+  ForkServer FS = ForkServer::start();
+
+  Process::SpawnOptions Opts;
+  Opts.Program = "/nonexistent/monomux-test-program";
+  Opts.CreatePTY = true;
+  FS.spawn(Opts);
+
+  std::vector<ForkServer::Result> Results = waitResults(FS, 1);
+  ASSERT_EQ(Results.size(), 1);
+  const ForkServer::Result& R = Results.front();
+  EXPECT_FALSE(R.Spawned);
+  EXPECT_FALSE(R.Error.empty());
+  ASSERT_NE(R.FailedPID, Process::Invalid);
+  EXPECT_NE(R.FailedPID, FS.pid());
+
+  // The failed process is the child of the caller, and was left for it.
+  int Status = 0;
+  EXPECT_EQ(::waitpid(R.FailedPID, &Status, 0), R.FailedPID);
+  EXPECT_TRUE(WIFEXITED(Status));
+
+  // The helper keeps serving.
+  EXPECT_TRUE(FS.alive());
+  Opts.Program = "/bin/sh";
+  Opts.Arguments = {"-c", "exit 0"};
+  FS.spawn(Opts);
+  Results = waitResults(FS, 1);
+  ASSERT_EQ(Results.size(), 1);
+  ASSERT_TRUE(Results.front().Spawned);
+  Results.front().Spawned->wait();
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/Metrics.hpp"
+
+using namespace monomux::server;
+using namespace std::chrono_literals;
+
+TEST(Metrics, HistogramBuckets)
+{
+  DurationHistogram H;
+  H.record(0us);
+  H.record(1us);
+  H.record(2us);
+  H.record(3us);
+  H.record(1000us);
+  H.record(std::chrono::hours{1});
+
+  const auto& B = H.buckets();
+  EXPECT_EQ(B.at(0), 2); // 0, 1
+  EXPECT_EQ(B.at(1), 1); // 2
+  EXPECT_EQ(B.at(2), 1); // 3
+  EXPECT_EQ(B.at(10), 1); // 1000 <= 1024
+  EXPECT_EQ(B.back(), 1);
+  EXPECT_EQ(H.sum(), 0 + 1 + 2 + 3 + 1000 + 3'600'000'000ULL);
+
+  // Negative durations, e.g. from a clock going backwards, count as 0.
+  H.record(-5us);
+  EXPECT_EQ(H.buckets().at(0), 3);
+}
+
+TEST(Metrics, LoopMerge)
+{
+  LoopMetrics A;
+  A.Iterations = 2;
+  A.OutputBytes = 10;
+  A.IterationTime.record(4us);
+
+  LoopMetrics B;
+  B.Iterations = 3;
+  B.InputBytes = 7;
+  B.IterationTime.record(4us);
+  B.IterationTime.record(5us);
+  B.Accepted = 1;
+  B.AcceptTime.record(1us);
+
+  A.merge(B);
+  EXPECT_EQ(A.Iterations, 5);
+  EXPECT_EQ(A.OutputBytes, 10);
+  EXPECT_EQ(A.InputBytes, 7);
+  EXPECT_EQ(A.IterationTime.buckets().at(2), 2);
+  EXPECT_EQ(A.IterationTime.buckets().at(3), 1);
+  EXPECT_EQ(A.IterationTime.sum(), 13);
+  EXPECT_EQ(A.Accepted, 1);
+  EXPECT_EQ(A.AcceptTime.buckets().at(0), 1);
+}
@@ -0,0 +1,122 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include "monomux/server/Recording.hpp"
+
+using namespace monomux::server;
+
+using Direction = SessionRecording::Direction;
+
+static std::string readFile(const std::string& Path)
+{
+  std::ifstream F{Path, std::ios::binary};
+  std::ostringstream S;
+  S << F.rdbuf();
+  return S.str();
+}
+
+static std::string recordingPath()
+{
+  return "/tmp/monomux-RecordingTest-" + std::to_string(::getpid()) +
+         std::string{SessionRecording::Extension};
+}
+
+/// Records a few pieces of traffic to \p Path, the output in two parts as
+/// the ring of a channel would give it.
+static void writeRecording(const std::string& Path)
+{
+  SessionRecording R = SessionRecording::create(Path);
+  R.record(Direction::Output, {"$ ", {}});
+  R.record(Direction::Input, {"ls\r", {}});
+  R.record(Direction::Output, {"file", "s\r\n"});
+  R.record(Direction::Output, {std::string_view{}, std::string_view{}});
+  EXPECT_EQ(R.records(), 4);
+}
+
+static void readRecording(RecordingReader& R)
+{
+  std::chrono::nanoseconds Previous{0};
+  auto expect = [&R, &Previous](Direction D, std::string_view Data) {
+    auto Rec = R.next();
+    ASSERT_TRUE(Rec);
+    EXPECT_EQ(Rec->Direction, D);
+    EXPECT_EQ(Rec->Data, Data);
+    EXPECT_GE(Rec->Time, Previous);
+    Previous = Rec->Time;
+  };
+  expect(Direction::Output, "$ ");
+  expect(Direction::Input, "ls\r");
+  expect(Direction::Output, "files\r\n");
+  expect(Direction::Output, "");
+  EXPECT_FALSE(R.next());
+  EXPECT_FALSE(R.corrupt());
+}
+
+TEST(SessionRecording, RoundTripMapped)
+{
+  const std::string Path = recordingPath();
+  writeRecording(Path);
+
+  RecordingReader R = RecordingReader::open(Path, /* Map =*/true);
+  EXPECT_TRUE(R.isMapped());
+  readRecording(R);
+  R.rewind();
+  readRecording(R);
+  ::unlink(Path.c_str());
+}
+
+TEST(SessionRecording, RoundTripRead)
+{
+  const std::string Path = recordingPath();
+  writeRecording(Path);
+
+  RecordingReader R = RecordingReader::open(Path, /* Map =*/false);
+  EXPECT_FALSE(R.isMapped());
+  readRecording(R);
+  ::unlink(Path.c_str());
+}
+
+TEST(SessionRecording, TruncatedRecordIsCorrupt)
+{
+  const std::string Path = recordingPath();
+  writeRecording(Path);
+  std::string Contents = readFile(Path);
+  ::unlink(Path.c_str());
+
+  // Cut into the data of the last non-empty record.
+  Contents.resize(Contents.size() - SessionRecording::RecordHeaderSize - 2);
+  RecordingReader R{std::move(Contents)};
+  EXPECT_TRUE(R.next());
+  EXPECT_TRUE(R.next());
+  EXPECT_FALSE(R.next());
+  EXPECT_TRUE(R.corrupt());
+}
+
+TEST(SessionRecording, NotARecording)
+{
+  EXPECT_THROW(RecordingReader{"Hello World!"}, std::system_error);
+}
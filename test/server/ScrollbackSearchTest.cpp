@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/ScrollbackSearch.hpp"
+#include "monomux/server/SessionData.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+
+static void append(SessionData& S, std::string_view Data)
+{
+  S.appendOutput({Data, std::string_view{}}, /* Retain =*/true);
+}
+
+/// Runs \p Search to completion in steps of \p Budget bytes.
+static std::vector<ScrollbackSearch::Match>
+runSearch(const SessionData& S, std::string Pattern, std::size_t Budget)
+{
+  ScrollbackSearch Search{std::move(Pattern), S};
+  std::vector<ScrollbackSearch::Match> Matches;
+  while (!Search.step(S, Budget, Matches))
+    ;
+  return Matches;
+}
+
+TEST(ScrollbackSearch, FindsLines)
+{
+  SessionData S{"test"};
+  S.setScrollbackSize(1 << 20);
+  append(S, "make: Entering directory\r\n");
+  append(S, "src/a.cpp:1: error: oops, another error\r\n");
+  append(S, "src/b.cpp:2: warning\r\nsrc/c.cpp:3: err");
+  append(S, "or: again");
+
+  for (std::size_t Budget : {1, 7, 1 << 20})
+  {
+    SCOPED_TRACE(Budget);
+    std::vector<ScrollbackSearch::Match> Matches = runSearch(S, "error", Budget);
+    ASSERT_EQ(Matches.size(), 2);
+    EXPECT_EQ(Matches.at(0).Offset, 39);
+    EXPECT_EQ(Matches.at(0).Context,
+              "src/a.cpp:1: error: oops, another error");
+    EXPECT_EQ(Matches.at(1).Offset, 102);
+    EXPECT_EQ(Matches.at(1).Context, "src/c.cpp:3: error: again");
+  }
+
+  EXPECT_TRUE(runSearch(S, "fatal", 1 << 20).empty());
+  EXPECT_TRUE(runSearch(S, "", 1 << 20).empty());
+}
+
+TEST(ScrollbackSearch, ClipsContext)
+{
+  SessionData S{"test"};
+  S.setScrollbackSize(1 << 20);
+  const std::string Padding(ScrollbackSearch::ContextMax * 2, '.');
+  append(S, Padding + "needle" + Padding);
+
+  std::vector<ScrollbackSearch::Match> Matches = runSearch(S, "needle", 64);
+  ASSERT_EQ(Matches.size(), 1);
+  EXPECT_EQ(Matches.at(0).Offset, Padding.size());
+  EXPECT_EQ(Matches.at(0).Context.size(),
+            2 * ScrollbackSearch::ContextMax + 6);
+}
+
+TEST(ScrollbackSearch, OnlyOutputBeforeStart)
+{
+  SessionData S{"test"};
+  S.setScrollbackSize(1 << 20);
+  append(S, "one match\n");
+
+  ScrollbackSearch Search{"match", S};
+  append(S, "another match\n");
+  std::vector<ScrollbackSearch::Match> Matches;
+  EXPECT_TRUE(Search.step(S, 1 << 20, Matches));
+  ASSERT_EQ(Matches.size(), 1);
+  EXPECT_EQ(Matches.at(0).Offset, 4);
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <array>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/SessionData.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+
+static void append(SessionData& S, std::string_view Data)
+{
+  S.appendOutput({Data, std::string_view{}}, /* Retain =*/true);
+}
+
+TEST(SessionData, TotalOutputBacklogSize)
+{
+  const std::size_t Before = SessionData::totalOutputBacklogSize();
+  {
+    SessionData S{"test"};
+    append(S, "Hello ");
+    append(S, "World!");
+    EXPECT_EQ(S.outputBacklogSize(), 12);
+    EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before + 12);
+
+    // No client is attached and there is no scrollback to keep.
+    S.trimOutput();
+    EXPECT_EQ(S.outputBacklogSize(), 0);
+    EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before);
+
+    append(S, "Again");
+    EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before + 5);
+  }
+  EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before);
+}
+
+TEST(SessionData, EvictOutput)
+{
+  const std::size_t Before = SessionData::totalOutputBacklogSize();
+  {
+    SessionData S{"test"};
+    S.setScrollbackSize(1024);
+    append(S, "Hello ");
+    append(S, "World!");
+
+    // Without a spill directory, the scrollback stays in memory.
+    S.evictOutput();
+    EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before + 12);
+
+    S.setSpillDirectory("/tmp");
+    S.evictOutput();
+    EXPECT_EQ(S.outputBacklogSize(), 0);
+    EXPECT_EQ(S.outputSpillSize(), 12);
+    EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before);
+    EXPECT_EQ(S.peekOutput(0), "Hello World!");
+  }
+  EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before);
+}
+
+TEST(SessionData, CopyScrollback)
+{
+  SessionData S{"test"};
+  S.setScrollbackSize(8);
+  S.setSpillDirectory("/tmp");
+  append(S, "Hello ");
+  S.evictOutput();
+  append(S, "World!");
+
+  // Part of the scrollback is read back from the spill file.
+  EXPECT_EQ(S.copyScrollback(), "o World!");
+  // Output that was released is not retained again.
+  S.setScrollbackSize(1024);
+  EXPECT_EQ(S.copyScrollback(), "o World!");
+}
+
+TEST(SessionData, CompactOutput)
+{
+  const std::size_t Before = SessionData::totalOutputBacklogSize();
+  {
+    static constexpr std::size_t Block = SessionData::ScrollbackBlockSize;
+    SessionData S{"test"};
+    S.setScrollbackSize(8 * Block);
+    std::string Output;
+    for (std::size_t I = 0; Output.size() < 4 * Block + 100; ++I)
+      Output += "\x1b[32m" + std::to_string(I) + "\x1b[0m: some log line\r\n";
+    // Chunks that do not line up with the blocks.
+    for (std::size_t I = 0; I < Output.size(); I += 1000)
+      append(S, std::string_view{Output}.substr(I, 1000));
+
+    // The newest block stays uncompressed.
+    EXPECT_EQ(S.compactOutput(-1), 3 * Block);
+    EXPECT_EQ(S.outputCompressedSize(), 3 * Block);
+    EXPECT_EQ(S.outputResidentBegin(), 3 * Block);
+    EXPECT_LT(S.outputCompressedMemory() * 5, 3 * Block);
+    EXPECT_EQ(SessionData::totalOutputBacklogSize(),
+              Before + S.outputBacklogSize() + S.outputCompressedMemory());
+    EXPECT_EQ(S.compactOutput(-1), 0);
+
+    EXPECT_EQ(S.copyScrollback(), Output);
+    EXPECT_EQ(S.peekOutput(Block + 10), Output.substr(Block + 10, Block - 10));
+
+    // Compressed blocks are spilled like the rest.
+    S.setSpillDirectory("/tmp");
+    S.evictOutput();
+    EXPECT_EQ(S.outputCompressedSize(), 0);
+    EXPECT_EQ(S.outputSpillSize(), Output.size());
+    EXPECT_EQ(S.copyScrollback(), Output);
+  }
+  EXPECT_EQ(SessionData::totalOutputBacklogSize(), Before);
+}
+
+TEST(SessionData, RateLimit)
+{
+  using namespace std::chrono_literals;
+  SessionData S{"test"};
+  EXPECT_EQ(S.rateAllowance(std::chrono::steady_clock::now()),
+            static_cast<std::size_t>(-1));
+
+  // 100 ms of output fit into the bucket.
+  S.setRateLimit(10'000); // NOLINT(readability-magic-numbers)
+  const auto Now = std::chrono::steady_clock::now();
+  EXPECT_EQ(S.rateAllowance(Now), 1'000);
+
+  // A read may overdraw the bucket, which must first be paid back.
+  S.consumeRateAllowance(1'500); // NOLINT(readability-magic-numbers)
+  EXPECT_EQ(S.rateAllowance(Now), 0);
+  EXPECT_GE(S.rateRefillTime(), Now + 150ms);
+  EXPECT_LT(S.rateRefillTime(), Now + 150ms + 1us);
+  EXPECT_EQ(S.rateAllowance(Now + 100ms), 500);
+  EXPECT_GE(S.rateRefillTime(), Now + 150ms);
+  EXPECT_LT(S.rateRefillTime(), Now + 150ms + 1us);
+
+  // The bucket does not grow beyond its size while the session is quiet.
+  EXPECT_EQ(S.rateAllowance(Now + 10s), 1'000);
+
+  S.setRateLimit(0);
+  EXPECT_EQ(S.rateAllowance(Now), static_cast<std::size_t>(-1));
+}
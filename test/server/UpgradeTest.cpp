@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/Upgrade.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+
+static UpgradeState makeState()
+{
+  UpgradeState State;
+  State.Socket = 3;
+
+  UpgradeState::Session Plain;
+  Plain.Name = "plain";
+  Plain.Created = std::chrono::system_clock::time_point{
+    std::chrono::seconds{1'700'000'000}};
+  Plain.PID = 42; // NOLINT(readability-magic-numbers)
+  Plain.ScrollbackSize = 0;
+  Plain.CoalesceWindow = std::chrono::microseconds{0};
+  State.Sessions.emplace_back(Plain);
+
+  UpgradeState::Session Renamed;
+  Renamed.Name = "renamed";
+  Renamed.Alias = "~pool-1";
+  Renamed.Created = std::chrono::system_clock::time_point{
+    std::chrono::microseconds{1'700'000'000'123'456}};
+  Renamed.PID = 43; // NOLINT(readability-magic-numbers)
+  Renamed.PtyMaster = 7;
+  Renamed.PtyName = "/dev/pts/7";
+  Renamed.ScrollbackSize = 1024; // NOLINT(readability-magic-numbers)
+  Renamed.CoalesceWindow = std::chrono::microseconds{500};
+  Renamed.RateLimit = 65536; // NOLINT(readability-magic-numbers)
+  Renamed.Scrollback = std::string{"Hello\0World", 11};
+  Renamed.OutputEnd = 1ULL << 40;
+  State.Sessions.emplace_back(Renamed);
+  return State;
+}
+
+static void expectEqual(const UpgradeState& Expected,
+                        const UpgradeState& Actual)
+{
+  EXPECT_EQ(Actual.Socket, Expected.Socket);
+  ASSERT_EQ(Actual.Sessions.size(), Expected.Sessions.size());
+  for (std::size_t I = 0; I < Expected.Sessions.size(); ++I)
+  {
+    SCOPED_TRACE(I);
+    const UpgradeState::Session& E = Expected.Sessions.at(I);
+    const UpgradeState::Session& A = Actual.Sessions.at(I);
+    EXPECT_EQ(A.Name, E.Name);
+    EXPECT_EQ(A.Alias, E.Alias);
+    EXPECT_EQ(A.Created, E.Created);
+    EXPECT_EQ(A.PID, E.PID);
+    EXPECT_EQ(A.PtyMaster, E.PtyMaster);
+    EXPECT_EQ(A.PtyName, E.PtyName);
+    EXPECT_EQ(A.ScrollbackSize, E.ScrollbackSize);
+    EXPECT_EQ(A.CoalesceWindow, E.CoalesceWindow);
+    EXPECT_EQ(A.RateLimit, E.RateLimit);
+    EXPECT_EQ(A.Scrollback, E.Scrollback);
+    EXPECT_EQ(A.OutputEnd, E.OutputEnd);
+  }
+}
+
+TEST(UpgradeState, Codec)
+{
+  const UpgradeState State = makeState();
+  std::optional<UpgradeState> Decoded = UpgradeState::decode(State.encode());
+  ASSERT_TRUE(Decoded);
+  expectEqual(State, *Decoded);
+}
+
+TEST(UpgradeState, RejectsMalformed)
+{
+  const std::string Buffer = makeState().encode();
+  EXPECT_FALSE(UpgradeState::decode({}));
+  EXPECT_FALSE(UpgradeState::decode(Buffer.substr(0, Buffer.size() - 1)));
+  EXPECT_FALSE(UpgradeState::decode(Buffer + "x"));
+
+  // A state written by an incompatible version.
+  std::string OtherVersion = Buffer;
+  OtherVersion.at(0) = static_cast<char>(OtherVersion.at(0) + 1);
+  EXPECT_FALSE(UpgradeState::decode(OtherVersion));
+}
+
+TEST(UpgradeState, StoreAndLoad)
+{
+  const UpgradeState State = makeState();
+  std::optional<UpgradeState> Loaded = UpgradeState::load(State.store());
+  ASSERT_TRUE(Loaded);
+  expectEqual(State, *Loaded);
+}
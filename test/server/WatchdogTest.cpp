@@ -0,0 +1,69 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "monomux/server/Watchdog.hpp"
+
+using namespace monomux;
+using namespace monomux::server;
+
+TEST(Watchdog, QuickIterationsAreNotStalls)
+{
+  Watchdog W{std::chrono::milliseconds{500}};
+  for (int I = 0; I < 100; ++I)
+  {
+    W.busy();
+    W.enter(Watchdog::Phase::Event, 42);
+    EXPECT_FALSE(W.idle().has_value());
+  }
+  // Waiting for events is not a stall either.
+  std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  EXPECT_EQ(W.stalls(), 0);
+  EXPECT_FALSE(W.lastStall().has_value());
+}
+
+TEST(Watchdog, StallIsReportedWithStack)
+{
+  Watchdog W{std::chrono::milliseconds{20}};
+  W.busy();
+  W.enter(Watchdog::Phase::Event, 42);
+  // The watchdog interrupts the sleep to capture the stack, which only
+  // restarts it.
+  std::this_thread::sleep_for(std::chrono::milliseconds{300});
+  W.enter(Watchdog::Phase::Status);
+
+  std::optional<Watchdog::Stall> Stall = W.idle();
+  ASSERT_TRUE(Stall.has_value());
+  EXPECT_GE(Stall->Duration, std::chrono::milliseconds{300});
+  // What the loop did when the stall was detected is reported, not what it
+  // did last.
+  EXPECT_EQ(Stall->At, Watchdog::Phase::Event);
+  EXPECT_EQ(Stall->FD, 42);
+  EXPECT_EQ(W.stalls(), 1);
+  EXPECT_EQ(W.stallTimes().sum(),
+            static_cast<std::uint64_t>(Stall->Duration.count()));
+
+  std::optional<Watchdog::Stall> Last = W.lastStall();
+  ASSERT_TRUE(Last.has_value());
+  EXPECT_EQ(Last->Duration, Stall->Duration);
+  EXPECT_FALSE(Last->Backtrace.empty());
+}
@@ -0,0 +1,149 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+
+#include "monomux/system/Pipe.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+
+TEST(BufferedChannel, AdaptiveReadSize)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  Pipe* Read = AP.getRead();
+  Pipe* Write = AP.getWrite();
+  Read->setNonblocking();
+  Write->setNonblocking();
+
+  const std::size_t InitialSize = Read->readSize();
+  EXPECT_EQ(InitialSize, Read->optimalReadSize());
+
+  // Bulk data available at once makes reads larger.
+  const std::string Bulk(InitialSize * 4, 'x');
+  Write->write(Bulk);
+  EXPECT_EQ(Read->read(Bulk.size()), Bulk);
+  EXPECT_GT(Read->readSize(), InitialSize);
+  EXPECT_LE(Read->readSize(), BufferedChannel::ReadSizeMax);
+
+  // Interactive traffic shrinks them back.
+  for (int I = 0; I < 8; ++I)
+  {
+    Write->write("a");
+    EXPECT_EQ(Read->read(Read->readSize()), "a");
+  }
+  EXPECT_EQ(Read->readSize(), InitialSize);
+}
+
+TEST(BufferedChannel, LazyBuffers)
+{
+  static constexpr char NotAllocated[] = "(not allocated)";
+  Pipe::AnonymousPipe AP = Pipe::create();
+  Pipe* Read = AP.getRead();
+  Pipe* Write = AP.getWrite();
+  Read->setNonblocking();
+  Write->setNonblocking();
+
+  // Data relayed straight through does not need the buffers.
+  Write->write("abc");
+  EXPECT_EQ(Read->read(3), "abc");
+  EXPECT_NE(Read->statistics().find(NotAllocated), std::string::npos);
+  EXPECT_NE(Write->statistics().find(NotAllocated), std::string::npos);
+  EXPECT_FALSE(Read->hasBufferedRead());
+  EXPECT_FALSE(Write->hasBufferedWrite());
+
+  Write->write("def");
+  EXPECT_EQ(Read->load(3), 3);
+  EXPECT_EQ(Read->statistics().find(NotAllocated), std::string::npos);
+  EXPECT_EQ(Read->readInBuffer(), 3);
+
+  // The buffer is kept while it holds data.
+  Read->tryFreeResources();
+  EXPECT_EQ(Read->read(3), "def");
+  Read->tryFreeResources();
+  EXPECT_NE(Read->statistics().find(NotAllocated), std::string::npos);
+
+  // A new buffer is taken when needed again.
+  Write->write("ghi");
+  EXPECT_EQ(Read->load(3), 3);
+  EXPECT_EQ(Read->read(3), "ghi");
+}
+
+TEST(BufferedChannel, ReadInto)
+{
+  Pipe::AnonymousPipe AP = Pipe::create();
+  Pipe* Read = AP.getRead();
+  Pipe* Write = AP.getWrite();
+  Read->setNonblocking();
+  Write->setNonblocking();
+
+  // The tail end of the low-level read over the requested size is kept.
+  char Buffer[8] = {};
+  Write->write("abcdef");
+  EXPECT_EQ(Read->readInto(Buffer, 2), 2);
+  EXPECT_EQ(std::string(Buffer, 2), "ab");
+  EXPECT_EQ(Read->readInBuffer(), 4);
+
+  // Buffered data is served first, followed by newly available data.
+  Write->write("gh");
+  EXPECT_EQ(Read->readInto(Buffer, sizeof(Buffer)), 6);
+  EXPECT_EQ(std::string(Buffer, 6), "cdefgh");
+  EXPECT_FALSE(Read->hasBufferedRead());
+
+  EXPECT_EQ(Read->readInto(Buffer, sizeof(Buffer)), 0);
+}
+
+TEST(BufferedChannel, SocketTransports)
+{
+  raw_fd FDs[2];
+  ASSERT_EQ(
+    ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, FDs),
+    0);
+  Socket A = Socket::wrap(fd{FDs[0]}, "a");
+  Socket B = Socket::wrap(fd{FDs[1]}, "b");
+
+  // Keeping the received descriptors goes through the virtual implementation,
+  // and switching back binds the transport again.
+  for (bool AcceptFDs : {false, true, false})
+  {
+    SCOPED_TRACE(AcceptFDs);
+    B.setAcceptFDs(AcceptFDs);
+    const std::string Left = "left", Right = "right";
+    EXPECT_EQ(A.tryWrite({Left, Right}), Left.size() + Right.size());
+    EXPECT_EQ(B.read(Left.size()), Left);
+    EXPECT_EQ(B.readInBuffer(), Right.size());
+    EXPECT_EQ(B.load(1), 0);
+    EXPECT_EQ(B.read(Right.size()), Right);
+    EXPECT_TRUE(B.takeReceivedFDs().empty());
+    EXPECT_FALSE(B.failed());
+  }
+
+  A.write("x");
+  {
+    // Close the other end.
+    fd Peer = std::move(A).release();
+  }
+  EXPECT_EQ(B.read(4), "x");
+  EXPECT_FALSE(B.failed());
+  EXPECT_EQ(B.read(4), "");
+  EXPECT_TRUE(B.failed());
+}
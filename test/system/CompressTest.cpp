@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Compress.hpp"
+
+using namespace monomux;
+using namespace monomux::compress;
+
+/// \returns \p Lines lines of output like a terminal would show for a build.
+static std::string terminalOutput(std::size_t Lines)
+{
+  std::string S;
+  for (std::size_t I = 0; I < Lines; ++I)
+    S += "\x1b[1;32m[" + std::to_string(I) +
+         "/9999]\x1b[0m Building CXX object src/server/Server.cpp.o\r\n";
+  return S;
+}
+
+static void expectRoundTrip(const std::string& Data)
+{
+  const std::string Compressed = compressBlock(Data);
+  std::optional<std::string> Decompressed =
+    decompressBlock(Compressed, Data.size());
+  ASSERT_TRUE(Decompressed.has_value());
+  EXPECT_EQ(*Decompressed, Data);
+}
+
+TEST(Compress, RoundTrip)
+{
+  expectRoundTrip("");
+  expectRoundTrip("x");
+  expectRoundTrip("Hello World!");
+  // Runs of the same byte are matches overlapping the data they produce.
+  expectRoundTrip(std::string(100000, 'a'));
+  expectRoundTrip("ab" + std::string(300, 'c') + "ab" + std::string(20, 'c'));
+}
+
+TEST(Compress, TerminalOutputShrinks)
+{
+  const std::string Data = terminalOutput(1000).substr(0, 1 << 16);
+  const std::string Compressed = compressBlock(Data);
+  EXPECT_LT(Compressed.size() * 5, Data.size());
+  expectRoundTrip(Data);
+}
+
+TEST(Compress, RandomDataBarelyGrows)
+{
+  std::mt19937 Random{42};
+  std::string Data(1 << 16, 0);
+  for (char& C : Data)
+    C = static_cast<char>(Random());
+
+  const std::string Compressed = compressBlock(Data);
+  EXPECT_LE(Compressed.size(), Data.size() + Data.size() / 255 + 16);
+  expectRoundTrip(Data);
+}
+
+TEST(Compress, MalformedRejected)
+{
+  const std::string Data = terminalOutput(100);
+  const std::string Compressed = compressBlock(Data);
+
+  // The size must match exactly.
+  EXPECT_FALSE(decompressBlock(Compressed, Data.size() - 1));
+  EXPECT_FALSE(decompressBlock(Compressed, Data.size() + 1));
+  // Truncated input.
+  EXPECT_FALSE(
+    decompressBlock(Compressed.substr(0, Compressed.size() / 2), Data.size()));
+  // A match pointing before the beginning of the data.
+  EXPECT_FALSE(decompressBlock(std::string{"\x10" "a" "\x05\x00", 4}, 5));
+  // A zero offset.
+  EXPECT_FALSE(decompressBlock(std::string{"\x10" "a" "\x00\x00", 4}, 5));
+}
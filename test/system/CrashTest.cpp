@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Crash.hpp"
+
+using namespace monomux;
+
+TEST(Backtrace, WriteRaw)
+{
+  Backtrace BT{4};
+  ASSERT_FALSE(BT.getFrames().empty());
+
+  std::ostringstream OS;
+  BT.writeRaw(OS);
+  std::istringstream IS{OS.str()};
+  std::size_t Lines = 0;
+  for (std::string Line; std::getline(IS, Line); ++Lines)
+  {
+    SCOPED_TRACE(Line);
+    std::istringstream Fields{Line};
+    std::string Index, Binary, BuildID, Offset;
+    Fields >> Index >> Binary >> BuildID >> Offset;
+    EXPECT_EQ(Index.front(), '#');
+    EXPECT_FALSE(Binary.empty());
+    EXPECT_FALSE(BuildID.empty());
+    EXPECT_EQ(Offset.substr(0, 2), "0x");
+  }
+  EXPECT_EQ(Lines, BT.getFrames().size());
+
+  // The innermost frame is in the test binary itself.
+  std::string First = OS.str().substr(0, OS.str().find('\n'));
+  EXPECT_NE(First.find("monomux_tests"), std::string::npos);
+}
+
+TEST(CrashCapture, CaptureAndReadBack)
+{
+  const std::string Path =
+    "/tmp/monomux-crash-test-" + std::to_string(::getpid());
+  {
+    CrashCapture Capture{Path, "Header"};
+    ASSERT_TRUE(Capture.valid());
+    Capture.capture(SIGSEGV, "test");
+    Capture.capture(SIGABRT, "test");
+  }
+
+  std::ifstream Report{Path};
+  std::string Header;
+  std::getline(Report, Header);
+  EXPECT_EQ(Header.substr(0, Header.find(", PID")), "Header in 'test'");
+
+  // Only the last report is read back.
+  Report.seekg(0);
+  Backtrace BT{Report};
+  ASSERT_FALSE(BT.getFrames().empty());
+  const Backtrace::Frame& Innermost = BT.getFrames().front();
+  EXPECT_EQ(Innermost.Index, BT.getFrames().size() - 1);
+  EXPECT_NE(Innermost.Data.Binary.find("monomux_tests"), std::string::npos);
+  EXPECT_NE(Innermost.ImageOffset, nullptr);
+
+  std::ostringstream OS;
+  BT.writeRaw(OS);
+  const std::string Raw = OS.str();
+  EXPECT_EQ(std::count(Raw.begin(), Raw.end(), '\n'), BT.getFrames().size());
+  std::remove(Path.c_str());
+}
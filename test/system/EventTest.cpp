@@ -0,0 +1,242 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Event.hpp"
+#include "monomux/system/Pipe.hpp"
+
+using namespace monomux;
+
+/// An arbitrary file descriptor number used as a manually scheduled event,
+/// which makes \p EPoll::wait() return without blocking.
+static constexpr raw_fd Token = 1000;
+
+static const EPoll::Backend Backends[] = {EPoll::Backend::EPoll,
+                                          EPoll::Backend::IOUring};
+
+TEST(EPoll, ScheduleDoesNotBlock)
+{
+  for (EPoll::Backend B : Backends)
+  {
+    SCOPED_TRACE(static_cast<int>(B));
+    EPoll Poll{4, B};
+    Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+    Poll.schedule(Token, /* Incoming =*/false, /* Outgoing =*/true);
+
+    ASSERT_EQ(Poll.wait(), 1);
+    EXPECT_EQ(Poll.getScheduledCount(), 1);
+    EXPECT_EQ(Poll.getEventCount(), 0);
+    EPoll::EventWithMode Event = Poll.eventAt(0);
+    EXPECT_EQ(Event.FD, Token);
+    EXPECT_TRUE(Event.Incoming);
+    EXPECT_TRUE(Event.Outgoing);
+  }
+}
+
+TEST(EPoll, ScheduleManyDeduplicated)
+{
+  static constexpr raw_fd Count = 1024;
+  EPoll Poll{4};
+  for (raw_fd FD = 0; FD < Count; ++FD)
+    Poll.schedule(FD, /* Incoming =*/true, /* Outgoing =*/false);
+  for (raw_fd FD = 0; FD < Count; FD += 2)
+    Poll.schedule(FD, /* Incoming =*/false, /* Outgoing =*/true);
+
+  ASSERT_EQ(Poll.wait(), Count);
+  for (raw_fd FD = 0; FD < Count; ++FD)
+  {
+    EPoll::EventWithMode Event = Poll.eventAt(FD);
+    EXPECT_EQ(Event.FD, FD);
+    EXPECT_TRUE(Event.Incoming);
+    EXPECT_EQ(Event.Outgoing, FD % 2 == 0);
+  }
+
+  // The de-duplication is reset after the events were delivered.
+  Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+  EXPECT_EQ(Poll.wait(), 1);
+}
+
+TEST(EPoll, LevelAndEdgeTriggered)
+{
+  for (EPoll::Backend B : Backends)
+  {
+    SCOPED_TRACE(static_cast<int>(B));
+    Pipe::AnonymousPipe Level = Pipe::create();
+    Pipe::AnonymousPipe Edge = Pipe::create();
+    EPoll Poll{4, B};
+    Poll.listen(
+      Level.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+    Poll.listen(Edge.getRead()->raw(),
+                /* Incoming =*/true,
+                /* Outgoing =*/false,
+                /* EdgeTriggered =*/true);
+
+    Level.getWrite()->write("x");
+    Edge.getWrite()->write("x");
+
+    Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+    ASSERT_EQ(Poll.wait(), 3);
+    EXPECT_EQ(Poll.fdAt(0), Token);
+    EXPECT_EQ(Poll.getEventCount(), 2);
+
+    // The data was not consumed, but only the level-triggered file reports it
+    // again.
+    Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+    ASSERT_EQ(Poll.wait(), 2);
+    EXPECT_EQ(Poll.fdAt(1), Level.getRead()->raw());
+
+    // New data is a new edge.
+    Edge.getWrite()->write("y");
+    Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+    EXPECT_EQ(Poll.wait(), 3);
+  }
+}
+
+TEST(EPoll, NestedListenSet)
+{
+  for (EPoll::Backend B : Backends)
+  {
+    SCOPED_TRACE(static_cast<int>(B));
+    Pipe::AnonymousPipe P = Pipe::create();
+    EPoll Inner{4};
+    Inner.listen(P.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+    ASSERT_NE(Inner.raw(), fd::Invalid);
+    EXPECT_EQ(Inner.poll(), 0);
+
+    EPoll Outer{4, B};
+    Outer.listen(Inner.raw(), /* Incoming =*/true, /* Outgoing =*/false);
+    P.getWrite()->write("x");
+
+    ASSERT_EQ(Outer.wait(), 1);
+    EXPECT_EQ(Outer.fdAt(0), Inner.raw());
+    ASSERT_EQ(Inner.poll(), 1);
+    EXPECT_EQ(Inner.fdAt(0), P.getRead()->raw());
+
+    // The inner set stays readable while its files are.
+    Outer.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+    EXPECT_EQ(Outer.wait(), 2);
+    Inner.stop(P.getRead()->raw());
+    EXPECT_EQ(Inner.poll(), 0);
+  }
+}
+
+TEST(EPoll, IOUringRelisten)
+{
+  EPoll Poll{4, EPoll::Backend::IOUring};
+  if (Poll.getBackend() != EPoll::Backend::IOUring)
+    GTEST_SKIP() << "io_uring is not supported by the kernel";
+
+  Pipe::AnonymousPipe P = Pipe::create();
+  const raw_fd FD = P.getRead()->raw();
+  P.getWrite()->write("x");
+  Poll.listen(FD, /* Incoming =*/true, /* Outgoing =*/false);
+  ASSERT_EQ(Poll.wait(), 1);
+
+  // The completion of the cancelled request must not be reported for the new
+  // registration of the same file.
+  Poll.stop(FD);
+  Poll.listen(FD,
+              /* Incoming =*/true,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/true);
+  ASSERT_EQ(Poll.wait(), 1);
+  EXPECT_EQ(Poll.fdAt(0), FD);
+
+  Poll.stop(FD);
+  Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+  EXPECT_EQ(Poll.wait(), 1);
+  EXPECT_EQ(Poll.fdAt(0), Token);
+}
+
+TEST(EPoll, IOUringMergesBusyFile)
+{
+  EPoll Poll{4, EPoll::Backend::IOUring};
+  if (Poll.getBackend() != EPoll::Backend::IOUring)
+    GTEST_SKIP() << "io_uring is not supported by the kernel";
+
+  Pipe::AnonymousPipe Busy = Pipe::create();
+  Pipe::AnonymousPipe Quiet = Pipe::create();
+  Poll.listen(Busy.getRead()->raw(),
+              /* Incoming =*/true,
+              /* Outgoing =*/false,
+              /* EdgeTriggered =*/true);
+  Poll.listen(
+    Quiet.getRead()->raw(), /* Incoming =*/true, /* Outgoing =*/false);
+  // Submit the requests before the files become ready.
+  Poll.schedule(Token, /* Incoming =*/true, /* Outgoing =*/false);
+  ASSERT_EQ(Poll.wait(), 1);
+
+  // Every write completes the multishot request of the busy file again, but
+  // the file must be reported once, so the other file does not wait behind
+  // its completions.
+  for (int I = 0; I < 16; ++I)
+    Busy.getWrite()->write("x");
+  Quiet.getWrite()->write("x");
+
+  bool QuietReported = false;
+  for (int Round = 0; Round < 2 && !QuietReported; ++Round)
+  {
+    SCOPED_TRACE(Round);
+    const std::size_t Count = Poll.wait();
+    std::set<raw_fd> Reported;
+    for (std::size_t I = 0; I < Count; ++I)
+    {
+      EXPECT_TRUE(Reported.insert(Poll.fdAt(I)).second);
+      QuietReported |= Poll.fdAt(I) == Quiet.getRead()->raw();
+    }
+  }
+  EXPECT_TRUE(QuietReported);
+}
+
+TEST(EPoll, Timers)
+{
+  using namespace std::chrono_literals;
+  for (EPoll::Backend B : Backends)
+  {
+    SCOPED_TRACE(static_cast<int>(B));
+    EPoll Poll{4, B};
+    std::vector<int> Fired;
+    const auto Now = std::chrono::steady_clock::now();
+
+    Poll.addTimer(Now + 50ms, [&Fired] { Fired.emplace_back(3); });
+    EPoll::TimerID Cancelled =
+      Poll.addTimer(Now + 1ms, [&Fired] { Fired.emplace_back(0); });
+    Poll.addTimer(Now + 1ms, [&Fired, &Poll, Now] {
+      Fired.emplace_back(1);
+      // Already expired, but fires in the next round.
+      Poll.addTimer(Now, [&Fired] { Fired.emplace_back(2); });
+      EXPECT_EQ(Fired.size(), 1);
+    });
+    Poll.cancelTimer(Cancelled);
+
+    for (std::size_t Round = 0; Fired.size() < 3 && Round < 16; ++Round)
+    {
+      const std::size_t EventCount = Poll.wait();
+      for (std::size_t I = 0; I < EventCount; ++I)
+        if (Poll.isTimer(Poll.fdAt(I)))
+          Poll.fireTimers();
+    }
+    EXPECT_EQ(Fired, (std::vector<int>{1, 2, 3}));
+    EXPECT_GE(std::chrono::steady_clock::now(), Now + 50ms);
+  }
+}
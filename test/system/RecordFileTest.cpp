@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monomux/system/RecordFile.hpp"
+
+using namespace monomux;
+
+static std::string pattern(std::size_t Size)
+{
+  std::string S(Size, 0);
+  for (std::size_t I = 0; I < Size; ++I)
+    S[I] = static_cast<char>('a' + (I % 26));
+  return S;
+}
+
+static std::string readFile(const std::string& Path)
+{
+  std::ifstream F{Path, std::ios::binary};
+  std::ostringstream S;
+  S << F.rdbuf();
+  return S.str();
+}
+
+/// Writes \p Data in pieces of uneven size, so the buffer fills up
+/// mid-append, and checks the contents of the file after closing it.
+static void roundTrip(bool Direct)
+{
+  const std::string Path =
+    "/tmp/monomux-RecordFileTest-" + std::to_string(::getpid());
+  const std::string Data =
+    pattern(RecordFile::BlockSize * 7 + RecordFile::BlockSize / 3);
+  {
+    RecordFile RF =
+      RecordFile::create(Path, Direct, RecordFile::BlockSize * 2);
+    for (std::size_t I = 0; I < Data.size(); I += 1000)
+      RF.append(std::string_view{Data}.substr(I, 1000));
+    EXPECT_EQ(RF.size(), Data.size());
+    EXPECT_LT(RF.buffered(), RecordFile::BlockSize * 2);
+
+    RF.flush();
+    if (RF.isDirect())
+      EXPECT_EQ(RF.buffered(), Data.size() % RecordFile::BlockSize);
+    else
+      EXPECT_EQ(RF.buffered(), 0);
+
+    RF.close();
+    EXPECT_EQ(RF.raw(), fd::Invalid);
+  }
+
+  EXPECT_EQ(readFile(Path), Data);
+  ::unlink(Path.c_str());
+}
+
+TEST(RecordFile, Buffered) { roundTrip(false); }
+
+TEST(RecordFile, Direct) { roundTrip(true); }
+
+TEST(RecordFile, DestructorWritesTail)
+{
+  const std::string Path =
+    "/tmp/monomux-RecordFileTest-" + std::to_string(::getpid());
+  {
+    RecordFile RF = RecordFile::create(Path, /* Direct =*/true);
+    RF.append("Hello");
+    RecordFile Moved = std::move(RF);
+    Moved.append(" World");
+  }
+  EXPECT_EQ(readFile(Path), "Hello World");
+  ::unlink(Path.c_str());
+}
+
+TEST(RecordFile, WrapsOpenFile)
+{
+  int Pipe[2];
+  ASSERT_EQ(::pipe(Pipe), 0);
+  {
+    RecordFile RF{fd{Pipe[1]}};
+    RF.append("Hello");
+    RF.flush();
+  }
+
+  char Buffer[16] = {0};
+  EXPECT_EQ(::read(Pipe[0], Buffer, sizeof(Buffer)), 5);
+  EXPECT_EQ(std::string{Buffer}, "Hello");
+  // The write end was closed with the recording.
+  EXPECT_EQ(::read(Pipe[0], Buffer, sizeof(Buffer)), 0);
+  ::close(Pipe[0]);
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Search.hpp"
+
+using namespace monomux;
+using namespace monomux::search;
+
+static const Implementation Implementations[] = {
+  Implementation::Scalar, Implementation::SSE2, Implementation::AVX2};
+
+TEST(Search, Basic)
+{
+  for (Implementation Impl : Implementations)
+  {
+    SCOPED_TRACE(static_cast<int>(Impl));
+    EXPECT_EQ(search::find("", "", Impl), 0);
+    EXPECT_EQ(search::find("abc", "", Impl), 0);
+    EXPECT_EQ(search::find("", "a", Impl), std::string_view::npos);
+    EXPECT_EQ(search::find("ab", "abc", Impl), std::string_view::npos);
+    EXPECT_EQ(search::find("abc", "c", Impl), 2);
+    EXPECT_EQ(search::find("abc", "abc", Impl), 0);
+    EXPECT_EQ(search::find("aXa aXb", "aXb", Impl), 4);
+  }
+}
+
+TEST(Search, EveryPositionAndLength)
+{
+  // The first and last bytes of the needle occur everywhere, so the full
+  // comparison rejects most of the candidates.
+  std::string Haystack(200, 'a');
+  for (std::size_t I = 0; I < Haystack.size(); I += 3)
+    Haystack[I] = 'b';
+
+  for (Implementation Impl : Implementations)
+    for (std::size_t Length = 2; Length < 70; Length += 7)
+      for (std::size_t Pos = 0; Pos + Length <= Haystack.size(); ++Pos)
+      {
+        SCOPED_TRACE(static_cast<int>(Impl));
+        SCOPED_TRACE(Length);
+        SCOPED_TRACE(Pos);
+        std::string Needle(Length, 'a');
+        Needle[Length / 2] = 'X';
+        std::string H = Haystack;
+        H.replace(Pos, Length, Needle);
+        EXPECT_EQ(search::find(H, Needle, Impl), Pos);
+      }
+}
+
+TEST(Search, AgreesWithStandardLibrary)
+{
+  std::mt19937 Random{42}; // NOLINT(readability-magic-numbers)
+  std::uniform_int_distribution<int> Byte{'a', 'd'};
+  std::string Haystack(1 << 16, '\0');
+  for (char& C : Haystack)
+    C = static_cast<char>(Byte(Random));
+
+  for (std::size_t Length = 1; Length < 12; ++Length)
+  {
+    SCOPED_TRACE(Length);
+    std::string Needle = Haystack.substr(Haystack.size() - Length);
+    for (Implementation Impl : Implementations)
+      EXPECT_EQ(search::find(Haystack, Needle, Impl), Haystack.find(Needle));
+  }
+  EXPECT_EQ(search::find(Haystack, "e"), std::string_view::npos);
+  EXPECT_EQ(search::find(Haystack, "abcde"), std::string_view::npos);
+}
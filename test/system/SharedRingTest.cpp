@@ -0,0 +1,154 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/SharedRing.hpp"
+#include "monomux/system/Socket.hpp"
+
+using namespace monomux;
+
+static constexpr std::size_t Capacity = 16;
+
+/// Opens the consumer side of \p Producer on duplicates of its handles, as if
+/// they were received by another process.
+static SharedRing consumerOf(const SharedRing& Producer)
+{
+  return SharedRing::open(fd::dup(Producer.memory()),
+                          fd::dup(Producer.dataBell()),
+                          fd::dup(Producer.spaceBell()));
+}
+
+static bool rung(raw_fd Doorbell)
+{
+  ::pollfd P{Doorbell, POLLIN, 0};
+  return ::poll(&P, 1, 0) == 1;
+}
+
+/// Reads everything from the ring, crossing the end of the memory area.
+static std::string readAll(SharedRing& Ring)
+{
+  std::string Data;
+  for (std::string_view View = Ring.peek(); !View.empty(); View = Ring.peek())
+  {
+    Data.append(View);
+    Ring.consume(View.size());
+  }
+  return Data;
+}
+
+TEST(SharedRing, WriteRead)
+{
+  SharedRing Producer = SharedRing::create(Capacity);
+  SharedRing Consumer = consumerOf(Producer);
+  EXPECT_EQ(Consumer.capacity(), Capacity);
+  EXPECT_TRUE(Consumer.peek().empty());
+
+  EXPECT_EQ(Producer.write("Hello"), 5);
+  EXPECT_EQ(Consumer.size(), 5);
+  EXPECT_EQ(Consumer.peek(), "Hello");
+  Consumer.consume(2);
+  EXPECT_EQ(Consumer.peek(), "llo");
+  Consumer.consume(3);
+  EXPECT_TRUE(Producer.empty());
+
+  // The data wraps around the end of the memory.
+  EXPECT_EQ(Producer.write("abcdefghijklmnopqrstuvwxyz"), Capacity);
+  EXPECT_EQ(Producer.write("X"), 0);
+  EXPECT_EQ(Consumer.peek().size(), Capacity - 5);
+  EXPECT_EQ(readAll(Consumer), "abcdefghijklmnop");
+}
+
+TEST(SharedRing, Doorbells)
+{
+  SharedRing Producer = SharedRing::create(Capacity);
+  SharedRing Consumer = consumerOf(Producer);
+
+  // The data doorbell is rung only if the consumer found the ring empty, which
+  // is initially the case.
+  Producer.write("A");
+  EXPECT_TRUE(rung(Consumer.dataBell()));
+  Consumer.clearDataBell();
+  Producer.write("A");
+  EXPECT_FALSE(rung(Consumer.dataBell()));
+  EXPECT_EQ(readAll(Consumer), "AA");
+  Producer.write("B");
+  EXPECT_TRUE(rung(Consumer.dataBell()));
+  Consumer.clearDataBell();
+  EXPECT_FALSE(rung(Consumer.dataBell()));
+  Producer.write("C");
+  EXPECT_FALSE(rung(Consumer.dataBell()));
+  EXPECT_EQ(readAll(Consumer), "BC");
+
+  // The space doorbell is rung only if the producer waits for it.
+  Producer.write(std::string(Capacity, 'x'));
+  Consumer.consume(1);
+  EXPECT_FALSE(rung(Producer.spaceBell()));
+  EXPECT_FALSE(Producer.awaitSpace());
+  Producer.write("y");
+  EXPECT_TRUE(Producer.awaitSpace());
+  Consumer.consume(1);
+  EXPECT_TRUE(rung(Producer.spaceBell()));
+  Producer.clearSpaceBell();
+  EXPECT_FALSE(rung(Producer.spaceBell()));
+}
+
+TEST(SharedRing, AcrossSocket)
+{
+  int Pair[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Pair), 0);
+  Socket Sender = Socket::wrap(fd{Pair[0]}, "sender");
+  Socket Receiver = Socket::wrap(fd{Pair[1]}, "receiver");
+
+  SharedRing Producer = SharedRing::create(Capacity);
+  Sender.sendFDs(
+    {Producer.memory(), Producer.dataBell(), Producer.spaceBell()});
+  std::vector<fd> FDs = Receiver.receiveFDs(3);
+  ASSERT_EQ(FDs.size(), 3);
+
+  SharedRing Consumer = SharedRing::open(
+    std::move(FDs.at(0)), std::move(FDs.at(1)), std::move(FDs.at(2)));
+  EXPECT_TRUE(Consumer.peek().empty());
+  Producer.write("Hello");
+  EXPECT_TRUE(rung(Consumer.dataBell()));
+  EXPECT_EQ(readAll(Consumer), "Hello");
+
+  // The byte carrying the descriptors is not part of the stream.
+  Sender.write("Data");
+  EXPECT_EQ(Receiver.read(4), "Data");
+}
+
+TEST(SharedRing, CorruptPositions)
+{
+  SharedRing Producer = SharedRing::create(Capacity);
+  SharedRing Consumer = consumerOf(Producer);
+  EXPECT_EQ(Producer.write("abc"), 3);
+  EXPECT_FALSE(Producer.corrupt());
+
+  // A consumer moving its tail past the head must not make the producer
+  // believe that the ring has more free space than its capacity.
+  Consumer.consume(Capacity * 4);
+  EXPECT_TRUE(Producer.corrupt());
+  EXPECT_EQ(Producer.write(std::string(Capacity * 8, 'x')), 0);
+  EXPECT_TRUE(Consumer.peek().empty());
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/SlabPool.hpp"
+
+using namespace monomux;
+
+TEST(SlabPool, SizeClasses)
+{
+  EXPECT_EQ(SlabPool::sizeClass(0), SlabPool::MinSize);
+  EXPECT_EQ(SlabPool::sizeClass(1), SlabPool::MinSize);
+  EXPECT_EQ(SlabPool::sizeClass(SlabPool::MinSize), SlabPool::MinSize);
+  EXPECT_EQ(SlabPool::sizeClass(SlabPool::MinSize + 1), SlabPool::MinSize * 2);
+  EXPECT_EQ(SlabPool::sizeClass(5000), 8192);
+}
+
+TEST(SlabPool, ReusesFreedSlabs)
+{
+  for (std::size_t Size : {std::size_t{8192}, SlabPool::MappedSize * 2})
+  {
+    SCOPED_TRACE(Size);
+    void* Slab = SlabPool::allocate(Size);
+    std::memset(Slab, 'x', Size);
+    SlabPool::deallocate(Slab, Size);
+
+    const SlabPool::Statistics Before = SlabPool::statistics();
+    EXPECT_GE(Before.CachedSlabs, 1);
+    // A request of a different size from the same class is served from the
+    // cache.
+    void* Again = SlabPool::allocate(Size - 1);
+    EXPECT_EQ(Again, Slab);
+    const SlabPool::Statistics After = SlabPool::statistics();
+    EXPECT_EQ(After.Reuses, Before.Reuses + 1);
+    EXPECT_EQ(After.Allocations, Before.Allocations);
+    EXPECT_EQ(After.CachedSlabs, Before.CachedSlabs - 1);
+    SlabPool::deallocate(Again, Size - 1);
+  }
+}
+
+TEST(SlabPool, LargeSlabsAreNotCached)
+{
+  const std::size_t Size = SlabPool::CachedSizeMax * 2;
+  void* Slab = SlabPool::allocate(Size);
+  const SlabPool::Statistics Before = SlabPool::statistics();
+  SlabPool::deallocate(Slab, Size);
+  const SlabPool::Statistics After = SlabPool::statistics();
+  EXPECT_EQ(After.Releases, Before.Releases + 1);
+  EXPECT_EQ(After.CachedSlabs, Before.CachedSlabs);
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/SpillFile.hpp"
+
+using namespace monomux;
+
+static constexpr std::size_t Segment = 4096;
+
+static std::string pattern(std::size_t Size, char Begin = 'a')
+{
+  std::string S(Size, 0);
+  for (std::size_t I = 0; I < Size; ++I)
+    S[I] = static_cast<char>(Begin + (I % 26));
+  return S;
+}
+
+/// Reads back \p Size bytes from \p Offset, crossing segment boundaries.
+static std::string readBack(SpillFile& SF, std::size_t Offset, std::size_t Size)
+{
+  std::string Data;
+  while (Data.size() < Size)
+  {
+    std::string_view View = SF.peek(Offset + Data.size());
+    if (View.empty())
+      break;
+    Data.append(View.substr(0, Size - Data.size()));
+  }
+  return Data;
+}
+
+TEST(SpillFile, AppendPeek)
+{
+  SpillFile SF{"/tmp", Segment};
+  EXPECT_TRUE(SF.empty());
+  EXPECT_TRUE(SF.peek(0).empty());
+
+  SF.append("Hello");
+  EXPECT_EQ(SF.size(), 5);
+  EXPECT_EQ(SF.peek(0), "Hello");
+  EXPECT_EQ(SF.peek(1), "ello");
+  EXPECT_TRUE(SF.peek(5).empty());
+
+  SF.append(" World");
+  EXPECT_EQ(SF.peek(0), "Hello World");
+  EXPECT_EQ(SF.peek(6), "World");
+}
+
+TEST(SpillFile, CrossSegments)
+{
+  SpillFile SF{"/tmp", Segment};
+  const std::string Data = pattern(Segment * 5 + 123);
+  SF.append(std::string_view{Data}.substr(0, 100));
+  SF.append(std::string_view{Data}.substr(100));
+  EXPECT_EQ(SF.end(), Data.size());
+
+  // A view never crosses the end of a segment.
+  EXPECT_EQ(SF.peek(0).size(), Segment);
+  EXPECT_EQ(SF.peek(Segment - 1).size(), 1);
+  EXPECT_EQ(SF.peek(Segment * 5).size(), 123);
+
+  EXPECT_EQ(readBack(SF, 0, Data.size()), Data);
+  EXPECT_EQ(readBack(SF, Segment * 2 + 7, Segment),
+            Data.substr(Segment * 2 + 7, Segment));
+
+  // Only a bounded number of segments are ever mapped.
+  EXPECT_LE(SF.mappedSize(), (SpillFile::ReadMappingCount + 1) * Segment);
+}
+
+TEST(SpillFile, Discard)
+{
+  SpillFile SF{"/tmp", Segment};
+  const std::string Data = pattern(Segment * 3);
+  SF.append(Data);
+
+  SF.discard(10);
+  EXPECT_EQ(SF.begin(), 10);
+  EXPECT_TRUE(SF.peek(9).empty());
+  EXPECT_EQ(SF.peek(10), std::string_view{Data}.substr(10, Segment - 10));
+
+  SF.discard(Segment * 2 + 1);
+  EXPECT_EQ(SF.begin(), Segment * 2 + 1);
+  EXPECT_EQ(SF.size(), Segment - 1);
+  EXPECT_TRUE(SF.peek(Segment).empty());
+  EXPECT_EQ(readBack(SF, SF.begin(), SF.size()), Data.substr(Segment * 2 + 1));
+
+  // Appending continues after the discarded data.
+  SF.append("xyz");
+  EXPECT_EQ(SF.peek(Segment * 3), "xyz");
+
+  SF.discard(SF.end());
+  EXPECT_TRUE(SF.empty());
+}
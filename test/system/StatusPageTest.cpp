@@ -0,0 +1,109 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <system_error>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/StatusPage.hpp"
+
+using namespace monomux;
+
+static std::string pagePath()
+{
+  return "/tmp/mnmx-status-test-" + std::to_string(::getpid());
+}
+
+static bool exists(const std::string& Path)
+{
+  struct ::stat Stat;
+  return ::stat(Path.c_str(), &Stat) == 0;
+}
+
+TEST(StatusPage, PublishRead)
+{
+  StatusPage Writer = StatusPage::create(pagePath());
+  StatusPage Reader = StatusPage::open(pagePath());
+  EXPECT_FALSE(Reader.owning());
+  EXPECT_EQ(Reader.read(), std::string{});
+
+  Writer.publish("first");
+  EXPECT_EQ(Reader.read(), "first");
+  Writer.publish("2nd");
+  EXPECT_EQ(Reader.read(), "2nd");
+}
+
+TEST(StatusPage, OnlyUserAccessible)
+{
+  StatusPage Writer = StatusPage::create(pagePath());
+  struct ::stat Stat;
+  ASSERT_EQ(::stat(pagePath().c_str(), &Stat), 0);
+  EXPECT_EQ(Stat.st_mode & 0777, 0600);
+}
+
+TEST(StatusPage, GrowRetiresOldFile)
+{
+  StatusPage Writer = StatusPage::create(pagePath(), 16);
+  StatusPage Old = StatusPage::open(pagePath());
+  Writer.publish("small");
+
+  const std::string Large(100, 'x');
+  Writer.publish(Large);
+  EXPECT_EQ(Writer.capacity(), 128);
+  // Readers of the old file have to open the page again.
+  EXPECT_EQ(Old.read(), std::nullopt);
+  EXPECT_EQ(StatusPage::open(pagePath()).read(), Large);
+}
+
+TEST(StatusPage, RemovedByWriter)
+{
+  {
+    StatusPage Writer = StatusPage::create(pagePath());
+    StatusPage Reader = StatusPage::open(pagePath());
+    StatusPage Moved = std::move(Writer);
+    EXPECT_TRUE(exists(pagePath()));
+    Moved.publish("data");
+    EXPECT_EQ(Reader.read(), "data");
+  }
+  EXPECT_FALSE(exists(pagePath()));
+  EXPECT_THROW(StatusPage::open(pagePath()), std::system_error);
+}
+
+TEST(StatusPage, StaleFromGoneWriter)
+{
+  const std::string Path = pagePath();
+  ::pid_t Child = ::fork();
+  ASSERT_NE(Child, -1);
+  if (Child == 0)
+  {
+    // The writer exits without removing the file, as if it had crashed.
+    StatusPage Writer = StatusPage::create(Path);
+    ::_exit(0);
+  }
+  int Status;
+  ASSERT_EQ(::waitpid(Child, &Status, 0), Child);
+
+  ASSERT_TRUE(exists(Path));
+  EXPECT_THROW(StatusPage::open(Path), std::system_error);
+  ::unlink(Path.c_str());
+}
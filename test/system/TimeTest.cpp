@@ -0,0 +1,56 @@
+/**
+ * Copyright (C) 2022 Whisperity
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "monomux/system/Time.hpp"
+
+using namespace monomux;
+
+TEST(LoopClock, CachedUntilTick)
+{
+  LoopClock::setResolution(std::chrono::microseconds::zero());
+  LoopClock::tick();
+  const LoopClock::time_point First = LoopClock::now();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  EXPECT_EQ(LoopClock::now(), First);
+
+  LoopClock::tick();
+  EXPECT_GT(LoopClock::now(), First);
+  EXPECT_LE(LoopClock::now(), std::chrono::system_clock::now());
+}
+
+TEST(LoopClock, Resolution)
+{
+  static constexpr std::chrono::microseconds Resolution{100'000};
+  LoopClock::setResolution(Resolution);
+  EXPECT_EQ(LoopClock::resolution(), Resolution);
+
+  // The previous unrounded tick may be up to a resolution ahead of the next
+  // rounded value, which must not move the clock backwards.
+  std::this_thread::sleep_for(2 * Resolution);
+  LoopClock::tick();
+  EXPECT_EQ(LoopClock::now().time_since_epoch() % Resolution,
+            LoopClock::time_point::duration::zero());
+
+  LoopClock::setResolution(std::chrono::microseconds::zero());
+}